@@ -0,0 +1,153 @@
+// Measure channels between coroutines: the throughput of one sender and one
+// receiver and of many of each over buffered and unbuffered channels, the
+// percentiles of the time from send to receive, and the round trip of a
+// request and its reply.
+//
+// usage: bench_channels [scale]
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "benchmark/benchmark.h"
+#include "runtime/channel.h"
+
+namespace {
+
+uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Print the percentiles of the latencies in nanoseconds
+void PrintPercentiles(std::vector<uint64_t>& latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+    };
+    std::cout << "p50 " << percentile(0.5) << " ns, p99 " << percentile(0.99) << " ns, p99.9 "
+        << percentile(0.999) << " ns";
+}
+
+// Send count timestamps from each of the senders to the receivers, which
+// record how long they took
+void Throughput(size_t workers, int senders, int receivers, size_t capacity, long count) {
+    zl::SchedulerOptions options;
+    options.workers = workers;
+    zl::Scheduler scheduler(options);
+    zl::Channel<uint64_t> channel(capacity);
+    std::atomic<int> sending(senders);
+    std::vector<std::vector<uint64_t>> latencies(receivers);
+    zl::bench::Timer timer;
+    for (int k = 0; k < senders; k++) {
+        scheduler.Spawn([&] {
+            for (long i = 0; i < count; i++)
+                channel.Send(Now());
+            if (--sending == 0)
+                channel.Close();
+        });
+    }
+    for (int k = 0; k < receivers; k++) {
+        scheduler.Spawn([&, k] {
+            latencies[k].reserve(senders * count / receivers);
+            uint64_t sent;
+            while (channel.Receive(sent))
+                latencies[k].push_back(Now() - sent);
+        });
+    }
+    scheduler.Wait();
+    double seconds = timer.Seconds();
+    std::vector<uint64_t> all;
+    for (auto& some : latencies)
+        all.insert(all.end(), some.begin(), some.end());
+    std::cout << senders << " to " << receivers << ", " << (capacity ? "buffered " + std::to_string(capacity)
+        : std::string("unbuffered")) << ", " << scheduler.Workers() << " workers: "
+        << senders * count / seconds / 1e6 << " M messages/s, ";
+    PrintPercentiles(all);
+    std::cout << std::endl;
+}
+
+// A coroutine sends requests and waits each reply from another
+void RoundTrip(size_t workers, size_t capacity, long count) {
+    zl::SchedulerOptions options;
+    options.workers = workers;
+    zl::Scheduler scheduler(options);
+    zl::Channel<long> requests(capacity);
+    zl::Channel<long> replies(capacity);
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    scheduler.Spawn([&] {
+        long value;
+        while (requests.Receive(value))
+            replies.Send(value + 1);
+    });
+    scheduler.Spawn([&] {
+        long value = 0;
+        for (long i = 0; i < count; i++) {
+            uint64_t start = Now();
+            requests.Send(value);
+            replies.Receive(value);
+            latencies.push_back(Now() - start);
+        }
+        requests.Close();
+    });
+    scheduler.Wait();
+    std::cout << "round trip, " << (capacity ? "buffered " + std::to_string(capacity) : std::string("unbuffered"))
+        << ", " << scheduler.Workers() << " workers: ";
+    PrintPercentiles(latencies);
+    std::cout << std::endl;
+}
+
+// A receiver selects over several senders' channels
+void Select(size_t workers, int channels, long count) {
+    zl::SchedulerOptions options;
+    options.workers = workers;
+    zl::Scheduler scheduler(options);
+    std::vector<std::unique_ptr<zl::Channel<long>>> inputs;
+    for (int k = 0; k < channels; k++)
+        inputs.emplace_back(new zl::Channel<long>(64));
+    zl::bench::Timer timer;
+    for (int k = 0; k < channels; k++) {
+        scheduler.Spawn([&, k] {
+            for (long i = 0; i < count; i++)
+                inputs[k]->Send(i);
+            inputs[k]->Close();
+        });
+    }
+    long received = 0;
+    scheduler.Spawn([&] {
+        std::vector<long> values(channels);
+        std::vector<zl::ChannelBase::Case> cases;
+        for (int k = 0; k < channels; k++)
+            cases.push_back(zl::ChannelBase::Case{inputs[k].get(), false, &values[k]});
+        while (!cases.empty()) {
+            int index = zl::ChannelBase::Select(cases.data(), cases.size(), true);
+            if (cases[index].ok)
+                received++;
+            else
+                cases.erase(cases.begin() + index);
+        }
+    });
+    scheduler.Wait();
+    std::cout << "select over " << channels << ", " << scheduler.Workers() << " workers: "
+        << received / timer.Seconds() / 1e6 << " M messages/s" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    long count = static_cast<long>(1000000 * scale);
+    for (size_t workers : {size_t(1), size_t(0)}) {
+        Throughput(workers, 1, 1, 1024, count);
+        Throughput(workers, 1, 1, 0, count);
+        Throughput(workers, 4, 4, 1024, count / 4);
+        Throughput(workers, 4, 4, 0, count / 4);
+        RoundTrip(workers, 0, count / 4);
+        RoundTrip(workers, 1, count / 4);
+        Select(workers, 4, count / 4);
+    }
+    return 0;
+}
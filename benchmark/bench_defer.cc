@@ -0,0 +1,111 @@
+// Measure the cost of defer on calls in the bytecode interpreter: a function
+// calling another one directly, deferring the call unconditionally or in a
+// branch, where it is inlined at the exits, and deferring it in a loop,
+// where it goes through the defer stack.
+//
+// usage: bench_defer [scale]
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/frontend.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The body of work(n:int):int, called N times
+    const char* body;
+    // The program without the defer it is compared with, -1 for none
+    int baseline;
+};
+
+const char* const prologue =
+    "var total:int = 0\n"
+    "func leave(n:int) {\n"
+    "    total += n\n"
+    "}\n";
+
+const char* const epilogue =
+    "func main():int {\n"
+    "    var sum:int = 0\n"
+    "    for (i:int = 0; i < N; i += 1) {\n"
+    "        sum += work(i & 7)\n"
+    "    }\n"
+    "    return (sum + total) & 1\n"
+    "}\n";
+
+const Program programs[] = {
+    {"no defer",
+        "    leave(n)\n"
+        "    return n + 1\n",
+        -1},
+    {"defer",
+        "    defer leave(n)\n"
+        "    return n + 1\n",
+        0},
+    {"conditional defer",
+        "    if (n >= 0) {\n"
+        "        defer leave(n)\n"
+        "    }\n"
+        "    return n + 1\n",
+        0},
+    {"loop, no defer",
+        "    for (i:int = 0; i < 1; i += 1) {\n"
+        "        leave(n)\n"
+        "    }\n"
+        "    return n + 1\n",
+        -1},
+    {"defer in loop",
+        "    for (i:int = 0; i < 1; i += 1) {\n"
+        "        defer leave(n)\n"
+        "    }\n"
+        "    return n + 1\n",
+        3},
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    long calls = static_cast<long>(5000000 * scale);
+    std::vector<double> seconds;
+    for (auto& program : programs) {
+        std::string source = std::string(prologue) + "func work(n:int):int {\n" + program.body + "}\n" +
+            epilogue;
+        source.replace(source.find(" N;"), 3, " " + std::to_string(calls) + ";");
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = "defer.zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        zl::Program bytecode;
+        zl::BytecodeCompiler compiler(bytecode);
+        if (!files[0].diagnostics.empty() || !compiler.Compile(files)) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        double best = 1e9;
+        uint64_t instructions = 0;
+        for (int run = 0; run < 5; run++) {
+            zl::Interpreter interpreter(bytecode);
+            zl::Value result;
+            zl::bench::Timer timer;
+            if (!interpreter.RunMain(result)) {
+                std::cerr << program.name << ": " << interpreter.Error() << std::endl;
+                return 1;
+            }
+            best = std::min(best, timer.Seconds());
+            instructions = interpreter.InstructionCount();
+        }
+        seconds.push_back(best);
+        std::cout << program.name << ": " << best * 1e9 / calls << " ns per call, "
+            << static_cast<double>(instructions) / calls << " instructions per call";
+        if (program.baseline >= 0)
+            std::cout << ", " << std::showpos << (best - seconds[program.baseline]) * 1e9 / calls
+                << std::noshowpos << " ns over " << programs[program.baseline].name;
+        std::cout << std::endl;
+    }
+    return 0;
+}
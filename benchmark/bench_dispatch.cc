@@ -0,0 +1,86 @@
+// Measure method calls of the bytecode interpreter through an interface on
+// call sites seeing one, three and eight classes, which stay monomorphic,
+// become polymorphic and become megamorphic. The time per call and how the
+// methods were found are reported.
+//
+// usage: bench_dispatch [scale]
+#include <stdlib.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/frontend.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+// Return a program calling Area through Shape on instances of count classes
+// in turn, iterations times
+std::string GenerateProgram(int count, long iterations) {
+    std::string source = "interface Shape {\n    Area(n:int):int\n}\n";
+    std::string shapes;
+    for (int k = 0; k < count; k++) {
+        std::string n = std::to_string(k);
+        source += "class Shape" + n + " implements Shape {\n"
+            "    Shape" + n + "() {}\n"
+            "    Area(n:int):int {\n"
+            "        return n + " + n + "\n"
+            "    }\n"
+            "}\n";
+        shapes += (k ? ", new Shape" : "new Shape") + n + "()";
+    }
+    source += "func main():int {\n"
+        "    var shapes = [" + shapes + "]\n"
+        "    var sum:int = 0\n"
+        "    var k:int = 0\n"
+        "    for (i:int = 0; i < " + std::to_string(iterations) + "; i += 1) {\n"
+        "        var shape:Shape = shapes[k]\n"
+        "        sum = sum + shape.Area(i)\n"
+        "        k += 1\n"
+        "        if (k == " + std::to_string(count) + ") {\n"
+        "            k = 0\n"
+        "        }\n"
+        "    }\n"
+        "    return sum & 1\n"
+        "}\n";
+    return source;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    long iterations = static_cast<long>(5000000 * scale);
+    for (int count : {1, 3, 8}) {
+        std::string source = GenerateProgram(count, iterations);
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = "dispatch.zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        zl::Program bytecode;
+        zl::BytecodeCompiler compiler(bytecode);
+        if (!files[0].diagnostics.empty() || !compiler.Compile(files)) {
+            std::cerr << count << " classes: can not compile" << std::endl;
+            return 1;
+        }
+
+        double best = 1e9;
+        zl::DispatchStats stats;
+        for (int run = 0; run < 3; run++) {
+            zl::Interpreter interpreter(bytecode);
+            zl::Value result;
+            zl::bench::Timer timer;
+            if (!interpreter.RunMain(result)) {
+                std::cerr << count << " classes: " << interpreter.Error() << std::endl;
+                return 1;
+            }
+            best = std::min(best, timer.Seconds());
+            // The inline caches are in the program, they are warm after
+            // the first run
+            stats = interpreter.Stats();
+        }
+        std::cout << count << (count == 1 ? " class: " : " classes: ") << best * 1e9 / iterations
+            << " ns per iteration, hits monomorphic " << stats.monomorphicHits << " polymorphic "
+            << stats.polymorphicHits << " megamorphic " << stats.megamorphicHits << ", lookups itable "
+            << stats.itableLookups << " name " << stats.nameLookups << std::endl;
+    }
+    return 0;
+}
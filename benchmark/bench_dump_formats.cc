@@ -0,0 +1,219 @@
+// Compare the write and read throughput of the xml, jsonl and binary AST
+// dumps. Each dump is read back and the numbers of nodes found are checked
+// to be the same for all formats.
+//
+// usage: bench_dump_formats [megabytes]
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/ast_serializer.h"
+#include "compiler/frontend.h"
+#include "compiler/xml_builder.h"
+
+namespace {
+
+class StringWriter : public pugi::xml_writer {
+public:
+    void write(const void* data, size_t size) override {
+        output.append(static_cast<const char*>(data), size);
+    }
+    std::string output;
+};
+
+// Count the nodes of the xml dump loaded by pugixml
+void CountXml(pugi::xml_node node, zl::AstDumpSummary& summary) {
+    for (auto child : node.children()) {
+        if (strcmp(child.name(), "null") == 0) {
+            summary.nulls++;
+            continue;
+        }
+        summary.nodes++;
+        for (auto attribute = child.first_attribute(); attribute; attribute = attribute.next_attribute())
+            summary.attributes++;
+        CountXml(child, summary);
+    }
+}
+
+bool ReadXml(const std::string& dump, zl::AstDumpSummary& summary) {
+    pugi::xml_document document;
+    if (!document.load_buffer(dump.data(), dump.size()))
+        return false;
+    for (auto file : document.child("ast").children("file")) {
+        summary.files++;
+        for (auto decl = file.first_child(); decl; decl = decl.next_sibling())
+            summary.decls++;
+        CountXml(file, summary);
+    }
+    return true;
+}
+
+// JsonReader is a minimal json parser for the jsonl dump, strings are
+// decoded so that the work is comparable to the other readers
+class JsonReader {
+public:
+    JsonReader(const char* data, const char* end, zl::AstDumpSummary& summary)
+        : data_(data), end_(end), summary_(summary) {}
+
+    bool Value() {
+        if (data_ == end_)
+            return false;
+        switch (*data_) {
+            case '{': return Object();
+            case '[': return Array();
+            case '"': { std::string value; return String(value); }
+            case 'n':
+                if (end_ - data_ < 4 || strncmp(data_, "null", 4) != 0)
+                    return false;
+                data_ += 4;
+                summary_.nulls++;
+                return true;
+            default:
+                return false;
+        }
+    }
+    const char* Position() const { return data_; }
+
+private:
+    bool Object() {
+        data_++;
+        bool node = false;
+        size_t attributes = 0;
+        while (data_ < end_ && *data_ != '}') {
+            std::string name;
+            if (!String(name) || data_ == end_ || *data_++ != ':')
+                return false;
+            if (name == "node") {
+                node = true;
+                summary_.nodes++;
+            }
+            bool string = data_ < end_ && *data_ == '"';
+            if (!Value())
+                return false;
+            if (string && name != "node" && name != "file")
+                attributes++;
+            if (data_ < end_ && *data_ == ',')
+                data_++;
+        }
+        if (node)
+            summary_.attributes += attributes;
+        return data_++ < end_;
+    }
+    bool Array() {
+        data_++;
+        while (data_ < end_ && *data_ != ']') {
+            if (!Value())
+                return false;
+            if (data_ < end_ && *data_ == ',')
+                data_++;
+        }
+        return data_++ < end_;
+    }
+    bool String(std::string& value) {
+        data_++;
+        while (data_ < end_ && *data_ != '"') {
+            if (*data_ != '\\') {
+                value += *data_++;
+                continue;
+            }
+            if (++data_ == end_)
+                return false;
+            switch (*data_) {
+                case 'n': value += '\n'; data_++; break;
+                case 't': value += '\t'; data_++; break;
+                case 'r': value += '\r'; data_++; break;
+                case 'u':
+                    if (end_ - data_ < 5)
+                        return false;
+                    value += static_cast<char>(strtoul(std::string(data_ + 1, 4).c_str(), nullptr, 16));
+                    data_ += 5;
+                    break;
+                default: value += *data_++; break;
+            }
+        }
+        return data_++ < end_;
+    }
+
+private:
+    const char* data_;
+    const char* end_;
+    zl::AstDumpSummary& summary_;
+};
+
+bool ReadJsonl(const std::string& dump, zl::AstDumpSummary& summary) {
+    const char* line = dump.data();
+    const char* end = line + dump.size();
+    while (line < end) {
+        const char* next = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (!next)
+            return false;
+        JsonReader reader(line, next, summary);
+        size_t nodes = summary.nodes;
+        if (!reader.Value() || reader.Position() != next)
+            return false;
+        if (summary.nodes > nodes)
+            summary.decls++;
+        line = next + 1;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 16;
+    std::string source = zl::bench::GenerateSource(megabytes << 20);
+    std::vector<zl::SourceFile> files(1);
+    files[0].path = "bench.zl";
+    files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+    if (!files[0].diagnostics.empty()) {
+        std::cerr << "bench.zl: can not parse the generated source" << std::endl;
+        return 1;
+    }
+    std::cout << "source " << source.size() / 1e6 << " MB, " << files[0].decls.size()
+        << " declarations" << std::endl;
+
+    struct Format {
+        const char* name;
+        zl::DumpFormat format;
+        bool (*read)(const std::string& dump, zl::AstDumpSummary& summary);
+    };
+    const Format formats[] = {
+        {"xml", zl::DumpFormat::Xml, ReadXml},
+        {"jsonl", zl::DumpFormat::Jsonl, ReadJsonl},
+        {"bin", zl::DumpFormat::Binary, [](const std::string& dump, zl::AstDumpSummary& summary) {
+            return zl::ReadBinaryAst(dump.data(), dump.size(), summary);
+        }},
+    };
+    int status = 0;
+    size_t expectedNodes = 0, expectedNulls = 0, expectedAttributes = 0;
+    for (auto& format : formats) {
+        StringWriter writer;
+        writer.output.reserve(source.size() * 16);
+        zl::bench::Timer timer;
+        zl::NewAstSerializer(format.format, writer)->Serialize(files);
+        double writeSeconds = timer.Seconds();
+
+        zl::AstDumpSummary summary;
+        timer.Restart();
+        bool read = format.read(writer.output, summary);
+        double readSeconds = timer.Seconds();
+
+        double size = writer.output.size() / 1e6;
+        double nodes = summary.nodes / 1e6;
+        std::cout << format.name << ": " << size << " MB, write " << size / writeSeconds
+            << " MB/s " << nodes / writeSeconds << " Mnodes/s, read " << size / readSeconds
+            << " MB/s " << nodes / readSeconds << " Mnodes/s" << std::endl;
+        if (expectedNodes == 0) {
+            expectedNodes = summary.nodes;
+            expectedNulls = summary.nulls;
+            expectedAttributes = summary.attributes;
+        }
+        if (!read || summary.decls != files[0].decls.size() || summary.nodes != expectedNodes ||
+                summary.nulls != expectedNulls || summary.attributes != expectedAttributes) {
+            std::cerr << format.name << ": the dump read back differs" << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,237 @@
+// Compare executables built from the C translation with the bytecode
+// interpreter on integer loops, recursive calls, floating point arithmetic
+// and objects in arrays and maps. Each program prints its result, the
+// output of both must be the same. The time of the C compiler is reported
+// apart from the best of a few runs, which include starting the process.
+// Long arithmetic, which the interpreter refuses, is checked against the
+// 64-bit result computed by the benchmark.
+//
+// usage: bench_emit_c [scale]
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/c_emitter.h"
+#include "compiler/frontend.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The source with N replaced by the iteration count
+    const char* source;
+    long iterations;
+};
+
+const Program programs[] = {
+    {"loop",
+        "func main():int {\n"
+        "    var sum:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        sum += (i & 7) * 3 - (i >> 4)\n"
+        "    }\n"
+        "    print(sum)\n"
+        "    return 0\n"
+        "}\n",
+        20000000},
+    {"call",
+        "func fib(n:int):int {\n"
+        "    if (n < 2) {\n"
+        "        return n\n"
+        "    }\n"
+        "    return fib(n - 1) + fib(n - 2)\n"
+        "}\n"
+        "func main():int {\n"
+        "    print(fib(N))\n"
+        "    return 0\n"
+        "}\n",
+        30},
+    {"float",
+        "func f(x:double):double {\n"
+        "    return 4.0 / (1.0 + x * x)\n"
+        "}\n"
+        "func main():int {\n"
+        "    var sum:double = 0.0\n"
+        "    var step:double = 1.0 / N\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        sum = sum + f((i + 0.5) * step)\n"
+        "    }\n"
+        "    print(sum * step)\n"
+        "    return 0\n"
+        "}\n",
+        5000000},
+    {"objects",
+        "class Particle {\n"
+        "    Particle(x:int, v:int) {\n"
+        "        self.x = x\n"
+        "        self.v = v\n"
+        "    }\n"
+        "    Step() { x = (x + v) % 1000 }\n"
+        "    x:int\n"
+        "    v:int\n"
+        "}\n"
+        "func main():int {\n"
+        "    var particles:Particle[] = []\n"
+        "    for (i:int = 0; i < 1000; i += 1) {\n"
+        "        append(particles, new Particle(i, i % 13 + 1))\n"
+        "    }\n"
+        "    var counts:map<int, int> = {}\n"
+        "    for (step:int = 0; step < N; step += 1) {\n"
+        "        foreach (p in particles) {\n"
+        "            p.Step()\n"
+        "        }\n"
+        "        counts[step % 100] = particles[step % 1000].x\n"
+        "    }\n"
+        "    var sum:int = 0\n"
+        "    foreach (k, v in counts) {\n"
+        "        sum += k * v\n"
+        "    }\n"
+        "    print(sum, len(counts))\n"
+        "    return 0\n"
+        "}\n",
+        2000},
+};
+
+// Run main of the bytecode with the standard output written to a file,
+// return the output
+bool Interpret(zl::Program& bytecode, std::string& output, std::string& error) {
+    char path[] = "/tmp/bench-emit-c-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        error = "can not create a temporary file";
+        return false;
+    }
+    unlink(path);
+    std::cout.flush();
+    fflush(stdout);
+    int saved = dup(1);
+    dup2(fd, 1);
+    zl::Interpreter interpreter(bytecode);
+    zl::Value result;
+    bool ok = interpreter.RunMain(result);
+    std::cout.flush();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    if (!ok)
+        error = interpreter.Error();
+    output.clear();
+    char buffer[4096];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        output.append(buffer, n);
+    close(fd);
+    return ok;
+}
+
+bool RunExecutable(const std::string& path, std::string& output) {
+    FILE* pipe = popen(path.c_str(), "r");
+    if (!pipe)
+        return false;
+    output.clear();
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+        output.append(buffer, n);
+    return pclose(pipe) == 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    std::string executable = "/tmp/bench-emit-c-" + std::to_string(getpid());
+    for (auto& program : programs) {
+        long iterations = program.iterations;
+        // Recursion depth is the scale of fib, it grows exponentially
+        if (std::string(program.name) != "call")
+            iterations = static_cast<long>(iterations * scale);
+        std::string source = zl::bench::Instantiate(program.source, iterations);
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = std::string(program.name) + ".zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        zl::Program bytecode;
+        zl::BytecodeCompiler compiler(bytecode);
+        if (!files[0].diagnostics.empty() || !compiler.Compile(files)) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        double interpreted = 1e9;
+        std::string expected;
+        for (int run = 0; run < 3; run++) {
+            std::string error;
+            zl::bench::Timer timer;
+            if (!Interpret(bytecode, expected, error)) {
+                std::cerr << program.name << ": " << error << std::endl;
+                return 1;
+            }
+            interpreted = std::min(interpreted, timer.Seconds());
+        }
+
+        zl::bench::Timer timer;
+        zl::CEmitter emitter;
+        std::string code;
+        std::string error;
+        if (!emitter.Emit(files, code)) {
+            for (auto& diagnostic : emitter.Diagnostics())
+                std::cerr << program.name << ": " << diagnostic.diagnostic.msg << std::endl;
+            return 1;
+        }
+        double emitting = timer.Seconds();
+        timer.Restart();
+        if (!zl::CompileC(code, executable, error)) {
+            std::cerr << program.name << ": " << error << std::endl;
+            return 1;
+        }
+        double compiling = timer.Seconds();
+        double native = 1e9;
+        std::string output;
+        for (int run = 0; run < 3; run++) {
+            timer.Restart();
+            if (!RunExecutable(executable, output)) {
+                std::cerr << program.name << ": the executable failed" << std::endl;
+                unlink(executable.c_str());
+                return 1;
+            }
+            native = std::min(native, timer.Seconds());
+        }
+        unlink(executable.c_str());
+
+        std::cout << program.name << ": interpreter " << interpreted * 1000 << " ms, native "
+            << native * 1000 << " ms (" << interpreted / native << "x), emit " << emitting * 1000
+            << " ms, cc " << compiling * 1000 << " ms, " << code.size() << " bytes of C" << std::endl;
+        if (output != expected) {
+            std::cerr << program.name << ": interpreter printed " << expected << "native " << output;
+            return 1;
+        }
+    }
+
+    // The interpreter refuses long, the translation is checked against the
+    // 64-bit arithmetic of the benchmark itself
+    std::string source = zl::bench::LongSource(1000);
+    std::vector<zl::SourceFile> files(1);
+    files[0].path = "long.zl";
+    files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+    zl::CEmitter emitter;
+    std::string code, error, output;
+    if (!files[0].diagnostics.empty() || !emitter.Emit(files, code) ||
+            !zl::CompileC(code, executable, error)) {
+        std::cerr << "long: can not compile " << error << std::endl;
+        return 1;
+    }
+    bool ran = RunExecutable(executable, output);
+    unlink(executable.c_str());
+    std::string expected = std::to_string(zl::bench::LongResult(1000)) + "\n";
+    if (!ran || output != expected) {
+        std::cerr << "long: native printed " << output << "expected " << expected;
+        return 1;
+    }
+    std::cout << "long: native agrees with 64-bit arithmetic" << std::endl;
+    return 0;
+}
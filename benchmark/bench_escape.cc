@@ -0,0 +1,169 @@
+// Compare the C translation with and without escape analysis on programs
+// creating many short lived instances. Each executable reports its heap
+// allocations, the instances kept in the frame must not be allocated and
+// the output of both must be the same.
+//
+// usage: bench_escape [scale]
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/c_emitter.h"
+#include "compiler/frontend.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The source with N replaced by the iteration count
+    const char* source;
+    long iterations;
+};
+
+const Program programs[] = {
+    {"vector",
+        "class Vec {\n"
+        "    Vec(x:double, y:double) {\n"
+        "        self.x = x\n"
+        "        self.y = y\n"
+        "    }\n"
+        "    Dot(o:Vec):double { return x * o.x + y * o.y }\n"
+        "    Scale(k:double) {\n"
+        "        x = x * k\n"
+        "        y = y * k\n"
+        "    }\n"
+        "    Len2():double { return x * x + y * y }\n"
+        "    x:double\n"
+        "    y:double\n"
+        "}\n"
+        "func main():int {\n"
+        "    var sum:double = 0.0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        var a:Vec = new Vec(i, 1.0)\n"
+        "        a.Scale(0.5)\n"
+        "        var b:Vec = new Vec(a.Len2(), 0.25)\n"
+        "        sum = sum + b.x * b.y\n"
+        "    }\n"
+        "    print(sum)\n"
+        "    return 0\n"
+        "}\n",
+        20000000},
+    // The rectangles of examples/class.zl, created and dropped in a loop
+    {"rectangle",
+        "class Rectangle {\n"
+        "    Rectangle(x:int, y:int, height:int, width:int) {\n"
+        "        self.x = x\n"
+        "        self.y = y\n"
+        "        self.height = height\n"
+        "        self.width = width\n"
+        "    }\n"
+        "    Move(x:int, y:int) {\n"
+        "        self.x = self.x + x\n"
+        "        self.y = self.y + y\n"
+        "    }\n"
+        "    Select(x:int, y:int):bool {\n"
+        "        return x >= self.x && x < self.x + width && y >= self.y && y < self.y + height\n"
+        "    }\n"
+        "    x:int\n"
+        "    y:int\n"
+        "    height:int\n"
+        "    width:int\n"
+        "}\n"
+        "func main():int {\n"
+        "    var hits:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        var rectangle:Rectangle = new Rectangle(i % 100, i % 50, 10, 20)\n"
+        "        rectangle.Move(1, 2)\n"
+        "        if (rectangle.Select(i % 120, i % 60)) {\n"
+        "            hits += 1\n"
+        "        }\n"
+        "    }\n"
+        "    print(hits)\n"
+        "    return 0\n"
+        "}\n",
+        20000000},
+};
+
+// Run the executable, return its output with the allocation report last
+bool RunExecutable(const std::string& path, std::string& output) {
+    std::string command = "ZL_ALLOC_STATS=1 " + path + " 2>&1";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe)
+        return false;
+    output.clear();
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+        output.append(buffer, n);
+    return pclose(pipe) == 0;
+}
+
+struct Result {
+    std::string output;
+    unsigned long long allocations = 0;
+    double seconds = 1e9;
+};
+
+bool Build(std::vector<zl::SourceFile>& files, bool escapeAnalysis, const std::string& executable,
+        Result& result, std::string& error) {
+    zl::CEmitter emitter;
+    emitter.SetEscapeAnalysis(escapeAnalysis);
+    std::string code;
+    if (!emitter.Emit(files, code)) {
+        error = emitter.Diagnostics().empty() ? "can not translate" : emitter.Diagnostics()[0].diagnostic.msg;
+        return false;
+    }
+    if (!zl::CompileC(code, executable, error))
+        return false;
+    for (int run = 0; run < 3; run++) {
+        zl::bench::Timer timer;
+        if (!RunExecutable(executable, result.output)) {
+            error = "the executable failed";
+            unlink(executable.c_str());
+            return false;
+        }
+        result.seconds = std::min(result.seconds, timer.Seconds());
+    }
+    unlink(executable.c_str());
+    size_t report = result.output.rfind("allocations: ");
+    if (report == std::string::npos) {
+        error = "no allocation report";
+        return false;
+    }
+    result.allocations = strtoull(result.output.c_str() + report + 13, nullptr, 10);
+    result.output.resize(report);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    std::string executable = "/tmp/bench-escape-" + std::to_string(getpid());
+    for (auto& program : programs) {
+        std::string source = zl::bench::Instantiate(program.source, static_cast<long>(program.iterations * scale));
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = std::string(program.name) + ".zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        if (!files[0].diagnostics.empty()) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        Result heap, frame;
+        std::string error;
+        if (!Build(files, false, executable, heap, error) || !Build(files, true, executable, frame, error)) {
+            std::cerr << program.name << ": " << error << std::endl;
+            return 1;
+        }
+        std::cout << program.name << ": heap " << heap.allocations << " allocations " << heap.seconds * 1000
+            << " ms, escape analysis " << frame.allocations << " allocations " << frame.seconds * 1000
+            << " ms (" << heap.seconds / frame.seconds << "x)" << std::endl;
+        if (heap.output != frame.output) {
+            std::cerr << program.name << ": heap printed " << heap.output << "frame " << frame.output;
+            return 1;
+        }
+    }
+    return 0;
+}
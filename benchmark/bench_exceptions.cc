@@ -0,0 +1,185 @@
+// Measure exceptions in the bytecode interpreter: a call with and without a
+// try around it when nothing is thrown, which runs no code for the try, and
+// the latency of a throw caught by the caller, ten frames up, of an instance
+// through a finally, and of a runtime error caught as a string.
+//
+// usage: bench_exceptions [scale]
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/frontend.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The body of work(n:int):int, called N times
+    const char* body;
+    // The program it is compared with, -1 for none
+    int baseline;
+};
+
+const char* const prologue =
+    "var total:int = 0\n"
+    "class Err {\n"
+    "    Err(code:int) { self.code = code }\n"
+    "    code:int\n"
+    "}\n"
+    "func step(n:int):int {\n"
+    "    return n + 1\n"
+    "}\n"
+    "func fail(n:int):int {\n"
+    "    throw n\n"
+    "}\n"
+    "func failDeep(n:int, depth:int):int {\n"
+    "    if (depth == 0) {\n"
+    "        throw n\n"
+    "    }\n"
+    "    return failDeep(n, depth - 1) + 1\n"
+    "}\n"
+    "func deep(n:int, depth:int):int {\n"
+    "    if (depth == 0) {\n"
+    "        return n\n"
+    "    }\n"
+    "    return deep(n, depth - 1) + 1\n"
+    "}\n"
+    "func failInstance(n:int):int {\n"
+    "    throw new Err(n)\n"
+    "}\n"
+    "func failIndex(n:int):int {\n"
+    "    var values:int[] = [n]\n"
+    "    return values[n + 1]\n"
+    "}\n";
+
+const char* const epilogue =
+    "func main():int {\n"
+    "    var sum:int = 0\n"
+    "    for (i:int = 0; i < N; i += 1) {\n"
+    "        sum += work(i & 7)\n"
+    "    }\n"
+    "    return (sum + total) & 1\n"
+    "}\n";
+
+const Program programs[] = {
+    {"no try",
+        "    var r:int = 0\n"
+        "    r = step(n)\n"
+        "    total += 1\n"
+        "    return r\n",
+        -1},
+    {"try, catch",
+        "    var r:int = 0\n"
+        "    try {\n"
+        "        r = step(n)\n"
+        "    } catch (int e) {\n"
+        "        r = e\n"
+        "    }\n"
+        "    total += 1\n"
+        "    return r\n",
+        0},
+    {"try, finally",
+        "    var r:int = 0\n"
+        "    try {\n"
+        "        r = step(n)\n"
+        "    } finally {\n"
+        "        total += 1\n"
+        "    }\n"
+        "    return r\n",
+        0},
+    {"throw, catch in caller",
+        "    var r:int = 0\n"
+        "    try {\n"
+        "        r = fail(n)\n"
+        "    } catch (int e) {\n"
+        "        r = e\n"
+        "    }\n"
+        "    total += 1\n"
+        "    return r\n",
+        0},
+    {"call 10 frames deep",
+        "    var r:int = 0\n"
+        "    r = deep(n, 9)\n"
+        "    total += 1\n"
+        "    return r\n",
+        -1},
+    {"throw, catch 10 frames up",
+        "    var r:int = 0\n"
+        "    try {\n"
+        "        r = failDeep(n, 9)\n"
+        "    } catch (int e) {\n"
+        "        r = e\n"
+        "    }\n"
+        "    total += 1\n"
+        "    return r\n",
+        4},
+    {"throw instance, finally",
+        "    var r:int = 0\n"
+        "    try {\n"
+        "        try {\n"
+        "            r = failInstance(n)\n"
+        "        } finally {\n"
+        "            total += 1\n"
+        "        }\n"
+        "    } catch (Err e) {\n"
+        "        r = e.code\n"
+        "    }\n"
+        "    return r\n",
+        0},
+    {"runtime error, catch",
+        "    var r:int = 0\n"
+        "    try {\n"
+        "        r = failIndex(n)\n"
+        "    } catch (string e) {\n"
+        "        r = len(e)\n"
+        "    }\n"
+        "    total += 1\n"
+        "    return r\n",
+        0},
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    long calls = static_cast<long>(2000000 * scale);
+    std::vector<double> seconds;
+    for (auto& program : programs) {
+        std::string source = std::string(prologue) + "func work(n:int):int {\n" + program.body + "}\n" +
+            epilogue;
+        source.replace(source.find(" N;"), 3, " " + std::to_string(calls) + ";");
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = "exceptions.zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        zl::Program bytecode;
+        zl::BytecodeCompiler compiler(bytecode);
+        if (!files[0].diagnostics.empty() || !compiler.Compile(files)) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        double best = 1e9;
+        uint64_t instructions = 0;
+        for (int run = 0; run < 5; run++) {
+            zl::Interpreter interpreter(bytecode);
+            zl::Value result;
+            zl::bench::Timer timer;
+            if (!interpreter.RunMain(result)) {
+                std::cerr << program.name << ": " << interpreter.Error() << std::endl;
+                return 1;
+            }
+            best = std::min(best, timer.Seconds());
+            instructions = interpreter.InstructionCount();
+        }
+        seconds.push_back(best);
+        std::cout << program.name << ": " << best * 1e9 / calls << " ns per call, "
+            << static_cast<double>(instructions) / calls << " instructions per call";
+        if (program.baseline >= 0)
+            std::cout << ", " << std::showpos << (best - seconds[program.baseline]) * 1e9 / calls
+                << std::noshowpos << " ns over " << programs[program.baseline].name;
+        std::cout << std::endl;
+    }
+    return 0;
+}
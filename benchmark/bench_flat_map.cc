@@ -0,0 +1,138 @@
+// Compare FlatMap, the table of the maps of the runtime, with
+// std::unordered_map on insertion, lookup of present and absent keys,
+// iteration and erasure, with int, long and string keys.
+//
+// usage: bench_flat_map [count]
+#include <stdlib.h>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+#include "benchmark/benchmark.h"
+#include "runtime/flat_map.h"
+
+namespace {
+
+struct Times {
+    double insert = 1e9;
+    double hit = 1e9;
+    double miss = 1e9;
+    double iterate = 1e9;
+    double erase = 1e9;
+    // Checksum of all operations, both tables must agree
+    uint64_t check = 0;
+};
+
+// The hashes of the standard library are identity for integers, the mixed
+// hash of FlatMap is used for both
+template <typename K> struct MixedHash {
+    size_t operator () (const K& key) const { return zl::FlatMapTraits<K>::Hash(key); }
+};
+
+uint64_t CheckOf(int32_t key) { return static_cast<uint32_t>(key); }
+uint64_t CheckOf(int64_t key) { return static_cast<uint64_t>(key); }
+uint64_t CheckOf(const std::string& key) { return key.size(); }
+
+template <typename K> void RunFlat(const std::vector<K>& keys, const std::vector<K>& absent, Times& times) {
+    for (int run = 0; run < 3; run++) {
+        uint64_t check = 0;
+        zl::FlatMap<K, int64_t> map;
+        zl::bench::Timer timer;
+        for (size_t n = 0; n < keys.size(); n++)
+            map.Insert(keys[n], static_cast<int64_t>(n));
+        times.insert = std::min(times.insert, timer.Seconds());
+        timer.Restart();
+        for (auto& key : keys)
+            check += *map.Find(key);
+        times.hit = std::min(times.hit, timer.Seconds());
+        timer.Restart();
+        for (auto& key : absent)
+            check += map.Find(key) != nullptr;
+        times.miss = std::min(times.miss, timer.Seconds());
+        timer.Restart();
+        for (auto& entry : map.Entries())
+            check += CheckOf(entry.first) + entry.second;
+        times.iterate = std::min(times.iterate, timer.Seconds());
+        timer.Restart();
+        for (size_t n = 0; n < keys.size(); n += 2)
+            check += map.Erase(keys[n]);
+        times.erase = std::min(times.erase, timer.Seconds());
+        check += map.Size();
+        times.check = check;
+    }
+}
+
+template <typename K> void RunStd(const std::vector<K>& keys, const std::vector<K>& absent, Times& times) {
+    for (int run = 0; run < 3; run++) {
+        uint64_t check = 0;
+        std::unordered_map<K, int64_t, MixedHash<K>> map;
+        zl::bench::Timer timer;
+        for (size_t n = 0; n < keys.size(); n++)
+            map.insert_or_assign(keys[n], static_cast<int64_t>(n));
+        times.insert = std::min(times.insert, timer.Seconds());
+        timer.Restart();
+        for (auto& key : keys)
+            check += map.find(key)->second;
+        times.hit = std::min(times.hit, timer.Seconds());
+        timer.Restart();
+        for (auto& key : absent)
+            check += map.find(key) != map.end();
+        times.miss = std::min(times.miss, timer.Seconds());
+        timer.Restart();
+        for (auto& entry : map)
+            check += CheckOf(entry.first) + entry.second;
+        times.iterate = std::min(times.iterate, timer.Seconds());
+        timer.Restart();
+        for (size_t n = 0; n < keys.size(); n += 2)
+            check += map.erase(keys[n]);
+        times.erase = std::min(times.erase, timer.Seconds());
+        check += map.size();
+        times.check = check;
+    }
+}
+
+template <typename K> bool Compare(const char* name, const std::vector<K>& keys, const std::vector<K>& absent) {
+    Times flat, standard;
+    RunFlat(keys, absent, flat);
+    RunStd(keys, absent, standard);
+    auto report = [](const char* operation, double flat, double standard, size_t count) {
+        std::cout << "  " << operation << ": flat " << flat * 1e9 / count << " ns, unordered_map "
+            << standard * 1e9 / count << " ns (" << standard / flat << "x)" << std::endl;
+    };
+    std::cout << name << ", " << keys.size() << " keys:" << std::endl;
+    report("insert ", flat.insert, standard.insert, keys.size());
+    report("hit    ", flat.hit, standard.hit, keys.size());
+    report("miss   ", flat.miss, standard.miss, absent.size());
+    report("iterate", flat.iterate, standard.iterate, keys.size());
+    report("erase  ", flat.erase, standard.erase, keys.size() / 2);
+    if (flat.check != standard.check) {
+        std::cerr << name << ": the tables disagree" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    std::mt19937_64 random(1);
+    // Distinct keys, the absent ones are odd and the present ones even
+    std::vector<int64_t> numbers(count * 2);
+    for (auto& number : numbers)
+        number = static_cast<int64_t>(random() >> 2) * 2;
+    std::vector<int32_t> ints, absentInts;
+    std::vector<int64_t> longs, absentLongs;
+    std::vector<std::string> strings, absentStrings;
+    for (size_t n = 0; n < count; n++) {
+        ints.push_back(static_cast<int32_t>(n * 2654435761u) & ~1);
+        absentInts.push_back(static_cast<int32_t>(n * 2654435761u) | 1);
+        longs.push_back(numbers[n]);
+        absentLongs.push_back(numbers[count + n] + 1);
+        strings.push_back("key" + std::to_string(numbers[n]));
+        absentStrings.push_back("key" + std::to_string(numbers[count + n] + 1));
+    }
+    if (!Compare("int", ints, absentInts) || !Compare("long", longs, absentLongs) ||
+            !Compare("string", strings, absentStrings))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,222 @@
+// Run allocation heavy programs with the bytecode interpreter under several
+// nursery sizes and marking threads, and report the collections, their
+// pauses and the allocation throughput. The output of the programs must be
+// the same under all settings.
+//
+// usage: bench_gc [scale]
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/frontend.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The source with N replaced by the iteration count
+    const char* source;
+    long iterations;
+};
+
+const Program programs[] = {
+    // Instances and strings which die young
+    {"churn",
+        "class Point {\n"
+        "    Point(x:int, y:int) {\n"
+        "        self.x = x\n"
+        "        self.y = y\n"
+        "    }\n"
+        "    x:int\n"
+        "    y:int\n"
+        "}\n"
+        "func main():int {\n"
+        "    var sum:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        var p:Point = new Point(i, i + 1)\n"
+        "        var q:Point = new Point(p.y, p.x)\n"
+        "        var name:string = \"p\" + i % 100\n"
+        "        sum += q.x - q.y + len(name)\n"
+        "    }\n"
+        "    print(sum)\n"
+        "    return 0\n"
+        "}\n",
+        2000000},
+    // Binary trees, a long lived one and many short lived ones
+    {"trees",
+        "class Tree {\n"
+        "    Tree(left:Tree, right:Tree) {\n"
+        "        self.left = left\n"
+        "        self.right = right\n"
+        "    }\n"
+        "    left:Tree\n"
+        "    right:Tree\n"
+        "}\n"
+        "func build(depth:int):Tree {\n"
+        "    if (depth == 0) {\n"
+        "        return new Tree(nil, nil)\n"
+        "    }\n"
+        "    return new Tree(build(depth - 1), build(depth - 1))\n"
+        "}\n"
+        "func check(tree:Tree):int {\n"
+        "    if (tree.left == nil) {\n"
+        "        return 1\n"
+        "    }\n"
+        "    return 1 + check(tree.left) + check(tree.right)\n"
+        "}\n"
+        "func main():int {\n"
+        "    var long:Tree = build(16)\n"
+        "    var sum:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        sum += check(build(10))\n"
+        "    }\n"
+        "    print(sum, check(long))\n"
+        "    return 0\n"
+        "}\n",
+        600},
+    // Old maps and arrays given young values, through the write barrier
+    {"tables",
+        "class Entry {\n"
+        "    Entry(key:string, count:int) {\n"
+        "        self.key = key\n"
+        "        self.count = count\n"
+        "    }\n"
+        "    key:string\n"
+        "    count:int\n"
+        "}\n"
+        "func main():int {\n"
+        "    var table:map<string, Entry> = {}\n"
+        "    var recent:Entry[] = []\n"
+        "    for (i:int = 0; i < 1000; i += 1) {\n"
+        "        append(recent, nil)\n"
+        "    }\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        var key:string = \"k\" + i % 5000\n"
+        "        var entry:Entry = table[key]\n"
+        "        if (entry == nil) {\n"
+        "            entry = new Entry(key, 0)\n"
+        "        } else {\n"
+        "            entry = new Entry(key, entry.count + 1)\n"
+        "        }\n"
+        "        table[key] = entry\n"
+        "        recent[i % 1000] = entry\n"
+        "    }\n"
+        "    var sum:int = 0\n"
+        "    foreach (k, v in table) {\n"
+        "        sum += v.count\n"
+        "    }\n"
+        "    foreach (e in recent) {\n"
+        "        sum += e.count\n"
+        "    }\n"
+        "    print(sum, len(table))\n"
+        "    return 0\n"
+        "}\n",
+        1000000},
+};
+
+struct Setting {
+    const char* name;
+    size_t nurserySize;
+    size_t majorThreshold;
+    int markThreads;
+};
+
+const Setting settings[] = {
+    {"nursery 256K", 256 << 10, 32 << 20, 0},
+    {"nursery 4M", 4 << 20, 32 << 20, 0},
+    {"nursery 32M", 32 << 20, 32 << 20, 0},
+    // Major collections of the old generation marked in parallel and not
+    {"nursery 1M, major 4M", 1 << 20, 4 << 20, 0},
+    {"nursery 1M, major 4M, 1 marker", 1 << 20, 4 << 20, 1},
+};
+
+// Run main of the bytecode with the standard output written to a file,
+// return the output
+bool Interpret(zl::Program& bytecode, std::string& output, std::string& error) {
+    char path[] = "/tmp/bench-gc-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        error = "can not create a temporary file";
+        return false;
+    }
+    unlink(path);
+    std::cout.flush();
+    fflush(stdout);
+    int saved = dup(1);
+    dup2(fd, 1);
+    zl::Interpreter interpreter(bytecode);
+    zl::Value result;
+    bool ok = interpreter.RunMain(result);
+    std::cout.flush();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    if (!ok)
+        error = interpreter.Error();
+    output.clear();
+    char buffer[4096];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        output.append(buffer, n);
+    close(fd);
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    for (auto& program : programs) {
+        std::string source = zl::bench::Instantiate(program.source, static_cast<long>(program.iterations * scale));
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = std::string(program.name) + ".zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        if (!files[0].diagnostics.empty()) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        std::string expected;
+        for (auto& setting : settings) {
+            // Each run has its own heap, it is part of the bytecode
+            zl::Program bytecode;
+            zl::BytecodeCompiler compiler(bytecode);
+            if (!compiler.Compile(files)) {
+                std::cerr << program.name << ": can not compile" << std::endl;
+                return 1;
+            }
+            zl::GcOptions options;
+            options.nurserySize = setting.nurserySize;
+            options.majorThreshold = setting.majorThreshold;
+            options.markThreads = setting.markThreads;
+            bytecode.heap.SetOptions(options);
+
+            std::string output, error;
+            zl::bench::Timer timer;
+            if (!Interpret(bytecode, output, error)) {
+                std::cerr << program.name << ": " << error << std::endl;
+                return 1;
+            }
+            double seconds = timer.Seconds();
+            auto& stats = bytecode.heap.Stats();
+            std::cout << program.name << ", " << setting.name << ": " << seconds * 1000 << " ms, "
+                << stats.bytesAllocated / seconds / 1e6 << " MB/s allocated, " << stats.minorCollections
+                << " minor " << stats.minorSeconds * 1000 << " ms, " << stats.majorCollections << " major "
+                << stats.majorSeconds * 1000 << " ms, max pause " << stats.maxPauseSeconds * 1000
+                << " ms, " << stats.bytesPromoted / 1e6 << " MB promoted" << std::endl;
+            if (expected.empty()) {
+                expected = output;
+            } else if (output != expected) {
+                std::cerr << program.name << ": " << setting.name << " printed " << output
+                    << "instead of " << expected;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
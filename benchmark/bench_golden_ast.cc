@@ -0,0 +1,104 @@
+// Measure loading a golden AST dump and comparing it with the tree built
+// from the source, with pugixml allocating from the heap and from XmlArena.
+// Build with -DZLANG_PUGIXML_COMPACT=OFF to compare with the default mode.
+//
+// usage: bench_golden_ast [megabytes]
+#include <stdlib.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/frontend.h"
+#include "compiler/xml_arena.h"
+#include "compiler/xml_builder.h"
+
+namespace {
+
+class StringWriter : public pugi::xml_writer {
+public:
+    void write(const void* data, size_t size) override {
+        output.append(static_cast<const char*>(data), size);
+    }
+    std::string output;
+};
+
+// Heap allocation functions counting the live and the peak bytes, the size
+// is kept in front of each block
+size_t liveBytes = 0;
+size_t peakBytes = 0;
+
+void* CountingAllocate(size_t size) {
+    auto block = static_cast<max_align_t*>(malloc(size + sizeof(max_align_t)));
+    if (!block)
+        return nullptr;
+    *reinterpret_cast<size_t*>(block) = size;
+    liveBytes += size;
+    peakBytes = std::max(peakBytes, liveBytes);
+    return block + 1;
+}
+
+void CountingDeallocate(void* ptr) {
+    if (!ptr)
+        return;
+    auto block = static_cast<max_align_t*>(ptr) - 1;
+    liveBytes -= *reinterpret_cast<size_t*>(block);
+    free(block);
+}
+
+// Load the golden dump and compare it with the files, return the seconds
+double LoadAndCompare(const std::string& golden, const std::vector<zl::SourceFile>& files) {
+    zl::bench::Timer timer;
+    pugi::xml_document expected, actual;
+    if (!expected.load_buffer(golden.data(), golden.size())) {
+        std::cerr << "can not load the golden dump" << std::endl;
+        exit(1);
+    }
+    StringWriter unused;
+    zl::XmlBuilder builder(unused);
+    builder.BuildDocument(files, actual);
+    std::string difference;
+    if (!zl::CompareXml(expected, actual, difference)) {
+        std::cerr << "ast differs at " << difference << std::endl;
+        exit(1);
+    }
+    return timer.Seconds();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+    std::string source = zl::bench::GenerateSource(megabytes << 20);
+    std::vector<zl::SourceFile> files(1);
+    files[0].path = "bench.zl";
+    files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+    StringWriter golden;
+    {
+        zl::XmlBuilder builder(golden);
+        builder.BuildXml(files);
+    }
+#ifdef PUGIXML_COMPACT
+    const char* mode = "compact";
+#else
+    const char* mode = "default";
+#endif
+    std::cout << "golden " << golden.output.size() / 1e6 << " MB, pugixml " << mode
+        << " mode" << std::endl;
+
+    // The best of a few runs of each, alternating so neither is favored
+    auto allocate = pugi::get_memory_allocation_function();
+    auto deallocate = pugi::get_memory_deallocation_function();
+    zl::XmlArena arena;
+    double heapSeconds = 1e9, arenaSeconds = 1e9;
+    for (int run = 0; run < 3; run++) {
+        pugi::set_memory_management_functions(CountingAllocate, CountingDeallocate);
+        heapSeconds = std::min(heapSeconds, LoadAndCompare(golden.output, files));
+        pugi::set_memory_management_functions(allocate, deallocate);
+
+        zl::XmlArenaScope scope(arena);
+        arenaSeconds = std::min(arenaSeconds, LoadAndCompare(golden.output, files));
+    }
+    std::cout << "heap:  " << heapSeconds * 1000 << " ms, peak " << peakBytes / 1e6 << " MB"
+        << std::endl;
+    std::cout << "arena: " << arenaSeconds * 1000 << " ms, peak " << arena.PeakReserved() / 1e6
+        << " MB" << std::endl;
+    return 0;
+}
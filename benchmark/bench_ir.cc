@@ -0,0 +1,94 @@
+// Measure lowering to SSA IR and the optimization passes on one huge
+// generated function, the kind of code generators produce. The time of each
+// pass is reported with the instruction counts before and after.
+//
+// usage: bench_ir [statements]
+#include <stdlib.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/frontend.h"
+#include "compiler/ir_builder.h"
+#include "compiler/ir_passes.h"
+
+namespace {
+
+// Each group has arithmetic with constants to fold, redundant expressions,
+// a branch, and every tenth group a small loop
+std::string GenerateFunction(long groups) {
+    std::string source = "func huge(a:int, b:int, c:double):int {\n"
+        "    var x:int = a\n"
+        "    var y:int = b\n"
+        "    var z:double = c\n";
+    for (long i = 0; i < groups; i++) {
+        std::string n = std::to_string(i % 1000);
+        source += "    x = x + (a * b) + " + n + " * 2\n"
+            "    y = y ^ (a * b) + (x & 255)\n"
+            "    z = z + x * 0.5\n"
+            "    if (x > y + " + n + ") {\n"
+            "        x = x - y\n"
+            "    } else {\n"
+            "        y = y + 1 * 1\n"
+            "    }\n";
+        if (i % 10 == 0) {
+            source += "    for (i:int = 0; i < 4; i += 1) {\n"
+                "        x += i\n"
+                "    }\n";
+        }
+    }
+    source += "    return x + y\n}\n";
+    return source;
+}
+
+size_t CountInstructions(const zl::IrModule& module) {
+    size_t count = 0;
+    for (auto& function : module.functions)
+        count += function->InstructionCount();
+    return count;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    long groups = argc > 1 ? strtol(argv[1], nullptr, 10) : 20000;
+    std::string source = GenerateFunction(groups);
+    std::vector<zl::SourceFile> files(1);
+    files[0].path = "huge.zl";
+    zl::bench::Timer timer;
+    files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+    double parsing = timer.Seconds();
+    if (!files[0].diagnostics.empty()) {
+        std::cerr << "huge.zl: can not parse" << std::endl;
+        return 1;
+    }
+
+    zl::IrModule module;
+    zl::IrBuilder builder(module);
+    timer.Restart();
+    if (!builder.Build(files)) {
+        std::cerr << "huge.zl: can not lower" << std::endl;
+        return 1;
+    }
+    double lowering = timer.Seconds();
+    size_t before = CountInstructions(module);
+
+    zl::IrPassManager passes;
+    passes.AddDefaultPasses();
+    std::vector<std::string> errors;
+    timer.Restart();
+    passes.Run(module, errors);
+    double optimizing = timer.Seconds();
+    size_t after = CountInstructions(module);
+
+    bool valid = zl::VerifyIr(*module.functions[0], errors);
+    std::cout << groups << " statement groups, " << source.size() / 1024 << " KB source" << std::endl
+        << "parse " << parsing * 1000 << " ms, lowering " << lowering * 1000 << " ms, "
+        << before << " instructions, " << before / lowering / 1e6 << " M instructions/s" << std::endl
+        << "optimize " << optimizing * 1000 << " ms, " << after << " instructions left" << std::endl;
+    passes.Report(std::cout);
+    if (!valid) {
+        for (size_t i = 0; i < errors.size() && i < 10; i++)
+            std::cerr << errors[i] << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,173 @@
+// Compare the JIT with the bytecode interpreter on integer loops, recursive
+// calls and floating point arithmetic. Each program is run by both, their
+// results must be the same. The compile time of the JIT, lowering and
+// optimization included, is reported apart from the best of a few runs.
+// Long arithmetic, which the interpreter refuses, is checked against the
+// 64-bit result computed by the benchmark.
+//
+// usage: bench_jit [scale]
+#include <stdlib.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/frontend.h"
+#include "compiler/ir_builder.h"
+#include "compiler/ir_passes.h"
+#include "compiler/jit.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The source with N replaced by the iteration count
+    const char* source;
+    long iterations;
+};
+
+const Program programs[] = {
+    {"loop",
+        "func main():int {\n"
+        "    var sum:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        sum += (i & 7) * 3 - (i >> 4)\n"
+        "    }\n"
+        "    return sum\n"
+        "}\n",
+        20000000},
+    {"call",
+        "func fib(n:int):int {\n"
+        "    if (n < 2) {\n"
+        "        return n\n"
+        "    }\n"
+        "    return fib(n - 1) + fib(n - 2)\n"
+        "}\n"
+        "func main():int {\n"
+        "    return fib(N)\n"
+        "}\n",
+        30},
+    {"float",
+        "func f(x:double):double {\n"
+        "    return 4.0 / (1.0 + x * x)\n"
+        "}\n"
+        "func main():int {\n"
+        "    var sum:double = 0.0\n"
+        "    var step:double = 1.0 / N\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        sum = sum + f((i + 0.5) * step)\n"
+        "    }\n"
+        "    var digits:int = sum * step * 1000000.0\n"
+        "    return digits\n"
+        "}\n",
+        5000000},
+};
+
+// The JIT must give the 64-bit result of mix, and the interpreter, whose
+// integers are 32 bits, must refuse long instead of truncating it
+bool CheckLong(int n) {
+    std::string source = zl::bench::LongSource(n);
+    std::vector<zl::SourceFile> files(1);
+    files[0].path = "long.zl";
+    files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+    zl::Program bytecode;
+    zl::BytecodeCompiler compiler(bytecode);
+    if (!files[0].diagnostics.empty() || compiler.Compile(files)) {
+        std::cerr << "long: the interpreter does not refuse long" << std::endl;
+        return false;
+    }
+    zl::IrModule module;
+    zl::IrBuilder builder(module);
+    zl::IrPassManager passes;
+    passes.AddDefaultPasses();
+    std::vector<std::string> errors;
+    zl::Jit jit;
+    zl::JitValue result;
+    if (!builder.Build(files) || !passes.Run(module, errors) || !jit.Compile(module) || !jit.Has("mix") ||
+            !jit.Call("mix", {zl::JitValue::Integer(zl::IrType::Int, n)}, result)) {
+        std::cerr << "long: can not run mix " << jit.Error() << std::endl;
+        return false;
+    }
+    if (result.type != zl::IrType::Long || result.intValue != zl::bench::LongResult(n)) {
+        std::cerr << "long: jit returned " << result.intValue << ", expected "
+            << zl::bench::LongResult(n) << std::endl;
+        return false;
+    }
+    std::cout << "long: jit agrees with 64-bit arithmetic, the interpreter refuses it" << std::endl;
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    if (!zl::Jit::Supported()) {
+        std::cerr << "the JIT does not run on this machine" << std::endl;
+        return 1;
+    }
+    for (auto& program : programs) {
+        long iterations = program.iterations;
+        // Recursion depth is the scale of fib, it grows exponentially
+        if (std::string(program.name) != "call")
+            iterations = static_cast<long>(iterations * scale);
+        std::string source = zl::bench::Instantiate(program.source, iterations);
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = std::string(program.name) + ".zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        zl::Program bytecode;
+        zl::BytecodeCompiler compiler(bytecode);
+        if (!files[0].diagnostics.empty() || !compiler.Compile(files)) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        double interpreted = 1e9;
+        zl::Value expected;
+        for (int run = 0; run < 3; run++) {
+            zl::Interpreter interpreter(bytecode);
+            zl::bench::Timer timer;
+            if (!interpreter.RunMain(expected)) {
+                std::cerr << program.name << ": " << interpreter.Error() << std::endl;
+                return 1;
+            }
+            interpreted = std::min(interpreted, timer.Seconds());
+        }
+
+        zl::bench::Timer timer;
+        zl::IrModule module;
+        zl::IrBuilder builder(module);
+        zl::IrPassManager passes;
+        passes.AddDefaultPasses();
+        std::vector<std::string> errors;
+        zl::Jit jit;
+        if (!builder.Build(files) || !passes.Run(module, errors) || !jit.Compile(module) || !jit.Has("main")) {
+            std::cerr << program.name << ": can not compile to machine code " << jit.Error() << std::endl;
+            for (auto& skipped : jit.Skipped())
+                std::cerr << "  skipped " << skipped << std::endl;
+            return 1;
+        }
+        double compiling = timer.Seconds();
+        double compiled = 1e9;
+        zl::JitValue result;
+        for (int run = 0; run < 3; run++) {
+            timer.Restart();
+            if (!jit.Call("main", {}, result)) {
+                std::cerr << program.name << ": " << jit.Error() << std::endl;
+                return 1;
+            }
+            compiled = std::min(compiled, timer.Seconds());
+        }
+
+        // The interpreter keeps a double assigned to an int variable, the
+        // compiled code truncates it
+        bool same = expected.IsNumber() && static_cast<int64_t>(expected.ToDouble()) == result.intValue;
+        std::cout << program.name << ": interpreter " << interpreted * 1000 << " ms, jit "
+            << compiled * 1000 << " ms (" << interpreted / compiled << "x), compile "
+            << compiling * 1000 << " ms, " << jit.Stats().codeBytes << " bytes" << std::endl;
+        if (!same) {
+            std::cerr << program.name << ": interpreter returned " << zl::ValueToString(expected)
+                << ", jit " << result.intValue << std::endl;
+            return 1;
+        }
+    }
+    return CheckLong(1000) ? 0 : 1;
+}
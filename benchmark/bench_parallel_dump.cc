@@ -0,0 +1,82 @@
+// Compare the sequential xml dump with the parallel one dumping each top
+// level declaration on a worker, for several numbers of threads.
+//
+// usage: bench_parallel_dump [megabytes [max threads]]
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <thread>
+#include "benchmark/benchmark.h"
+#include "compiler/frontend.h"
+#include "compiler/thread_pool.h"
+#include "compiler/xml_builder.h"
+
+namespace {
+
+class HashXmlWriter : public pugi::xml_writer {
+public:
+    void write(const void* data, size_t size) override { sink.Update(data, size); }
+    zl::bench::HashWriter sink;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 16;
+    std::string source = zl::bench::GenerateSource(megabytes << 20);
+    std::vector<zl::SourceFile> files(1);
+    files[0].path = "bench.zl";
+    files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+    if (!files[0].diagnostics.empty()) {
+        std::cerr << "bench.zl: can not parse the generated source" << std::endl;
+        return 1;
+    }
+
+    // The throughput is measured writing to /dev/null so that writev is
+    // used, the outputs are compared by hash
+    int null = open("/dev/null", O_WRONLY);
+    zl::XmlFileWriter nullWriter(null);
+    HashXmlWriter expected;
+    zl::bench::Timer timer;
+    {
+        zl::XmlBuilder builder(nullWriter);
+        builder.BuildXml(files);
+    }
+    double sequential = timer.Seconds();
+    {
+        zl::XmlBuilder builder(expected);
+        builder.BuildXml(files);
+    }
+    std::cout << files[0].decls.size() << " declarations, " << expected.sink.size / 1e6
+        << " MB" << std::endl;
+    std::cout << "sequential: " << expected.sink.size / 1e6 / sequential << " MB/s" << std::endl;
+
+    size_t cores = argc > 2 ? strtoul(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+    cores = std::max<size_t>(cores, 1);
+    int status = 0;
+    for (size_t threads = 1; ; threads = std::min(threads * 2, cores)) {
+        zl::ThreadPool pool(threads);
+        timer.Restart();
+        {
+            zl::XmlBuilder builder(nullWriter);
+            builder.BuildXml(files, pool);
+        }
+        double seconds = timer.Seconds();
+        HashXmlWriter parallel;
+        {
+            zl::XmlBuilder builder(parallel);
+            builder.BuildXml(files, pool);
+        }
+        bool same = parallel.sink.size == expected.sink.size && parallel.sink.hash == expected.sink.hash;
+        std::cout << "parallel " << threads << " threads: " << expected.sink.size / 1e6 / seconds
+            << " MB/s, speedup " << sequential / seconds << (same ? "" : ", OUTPUT DIFFERS")
+            << std::endl;
+        if (!same)
+            status = 1;
+        if (threads == cores)
+            break;
+    }
+    close(null);
+    return status;
+}
@@ -0,0 +1,165 @@
+// Measure the coroutine scheduler: the cost of spawning a coroutine against
+// a thread, the latency of switching between coroutines which yield or wake
+// each other, and the throughput of fan-out/fan-in rounds with one worker
+// up to one per processor.
+//
+// usage: bench_scheduler [scale]
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include "benchmark/benchmark.h"
+#include "runtime/scheduler.h"
+
+namespace {
+
+// Join let a coroutine wait until count others are done
+class Join {
+public:
+    explicit Join(int count): remaining_(count), waiter_(zl::Scheduler::Current()) {}
+    void Done() {
+        if (--remaining_ == 0)
+            zl::Scheduler::Unpark(waiter_);
+    }
+    void Wait() {
+        while (remaining_ > 0)
+            zl::Scheduler::Park();
+    }
+private:
+    std::atomic<int> remaining_;
+    zl::Coroutine* waiter_;
+};
+
+// Spin on the value, the work of a task. The state is unsigned so that the
+// generator wraps around instead of overflowing
+uint64_t Work(uint64_t value, int iterations) {
+    for (int i = 0; i < iterations; i++)
+        value = value * 6364136223846793005ull + 1442695040888963407ull;
+    return value;
+}
+
+void Spawn(long count) {
+    {
+        zl::bench::Timer timer;
+        for (long i = 0; i < count / 100; i++) {
+            std::thread thread([] {});
+            thread.join();
+        }
+        std::cout << "spawn thread: " << timer.Seconds() * 1e9 / (count / 100) << " ns" << std::endl;
+    }
+    for (size_t workers : {size_t(1), size_t(0)}) {
+        zl::SchedulerOptions options;
+        options.workers = workers;
+        zl::Scheduler scheduler(options);
+        zl::bench::Timer timer;
+        // The coroutines are spawned by one in batches, so they reuse the
+        // stacks of its worker
+        scheduler.Spawn([&] {
+            for (long batch = 0; batch < count / 1000; batch++) {
+                Join join(1000);
+                for (int i = 0; i < 1000; i++)
+                    scheduler.Spawn([&] { join.Done(); });
+                join.Wait();
+            }
+        });
+        scheduler.Wait();
+        std::cout << "spawn coroutine, " << scheduler.Workers() << " workers: "
+            << timer.Seconds() * 1e9 / (count / 1000 * 1000) << " ns" << std::endl;
+    }
+}
+
+void Switch(long count) {
+    zl::SchedulerOptions options;
+    options.workers = 1;
+    {
+        zl::Scheduler scheduler(options);
+        zl::bench::Timer timer;
+        for (int k = 0; k < 2; k++) {
+            scheduler.Spawn([count] {
+                for (long i = 0; i < count; i++)
+                    zl::Scheduler::Yield();
+            });
+        }
+        scheduler.Wait();
+        std::cout << "switch by yield: " << timer.Seconds() * 1e9 / (2 * count) << " ns" << std::endl;
+    }
+    for (size_t workers : {size_t(1), size_t(0)}) {
+        options.workers = workers;
+        zl::Scheduler scheduler(options);
+        // Two coroutines take turns, each waking the other and parking
+        std::atomic<long> turn(0);
+        std::atomic<zl::Coroutine*> coroutines[2] = {{nullptr}, {nullptr}};
+        zl::bench::Timer timer;
+        for (int k = 0; k < 2; k++) {
+            scheduler.Spawn([&, k] {
+                coroutines[k] = zl::Scheduler::Current();
+                while (!coroutines[1 - k])
+                    zl::Scheduler::Yield();
+                while (true) {
+                    long value = turn.load();
+                    if (value >= 2 * count)
+                        break;
+                    if (value % 2 == k) {
+                        turn = value + 1;
+                        zl::Scheduler::Unpark(coroutines[1 - k]);
+                    } else {
+                        zl::Scheduler::Park();
+                    }
+                }
+                zl::Scheduler::Unpark(coroutines[1 - k]);
+            });
+        }
+        scheduler.Wait();
+        std::cout << "switch by park and unpark, " << scheduler.Workers() << " workers: "
+            << timer.Seconds() * 1e9 / (2 * count) << " ns" << std::endl;
+    }
+}
+
+void FanOut(long rounds) {
+    const int width = 1000;
+    const int iterations = 2000;
+    std::vector<size_t> counts;
+    size_t processors = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t workers = 1; workers < processors; workers *= 2)
+        counts.push_back(workers);
+    counts.push_back(processors);
+    double single = 0;
+    for (size_t workers : counts) {
+        zl::SchedulerOptions options;
+        options.workers = workers;
+        zl::Scheduler scheduler(options);
+        std::atomic<long> checksum(0);
+        zl::bench::Timer timer;
+        scheduler.Spawn([&] {
+            for (long round = 0; round < rounds; round++) {
+                Join join(width);
+                for (int task = 0; task < width; task++) {
+                    scheduler.Spawn([&, task] {
+                        checksum += Work(task, iterations) & 1;
+                        join.Done();
+                    });
+                }
+                join.Wait();
+            }
+        });
+        scheduler.Wait();
+        double seconds = timer.Seconds();
+        if (workers == 1)
+            single = seconds;
+        zl::SchedulerStats stats = scheduler.Stats();
+        std::cout << "fan-out of " << width << ", " << workers << " workers: "
+            << rounds * width / seconds / 1e6 << " M tasks/s (" << single / seconds << "x), steals "
+            << stats.steals << ", sleeps " << stats.sleeps << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    Spawn(static_cast<long>(1000000 * scale));
+    Switch(static_cast<long>(1000000 * scale));
+    FanOut(static_cast<long>(200 * scale));
+    return 0;
+}
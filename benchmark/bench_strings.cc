@@ -0,0 +1,167 @@
+// Measure the strings of the bytecode interpreter: concatenation in loops of
+// growing length, which must stay linear, lookups of maps with string keys
+// and comparisons. Programs using literals are run with the literals
+// interned and not interned.
+//
+// usage: bench_strings [scale]
+#include <stdlib.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/frontend.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The source with N replaced by the iteration count
+    const char* source;
+    long iterations;
+};
+
+const Program programs[] = {
+    {"concat 10k",
+        "func main():int {\n"
+        "    var s:string = \"\"\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        s = s + \"item\" + i + \",\"\n"
+        "    }\n"
+        "    return s[len(s) - 1]\n"
+        "}\n",
+        10000},
+    {"concat 100k",
+        "func main():int {\n"
+        "    var s:string = \"\"\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        s = s + \"item\" + i + \",\"\n"
+        "    }\n"
+        "    return s[len(s) - 1]\n"
+        "}\n",
+        100000},
+    {"concat 1M",
+        "func main():int {\n"
+        "    var s:string = \"\"\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        s = s + \"item\" + i + \",\"\n"
+        "    }\n"
+        "    return s[len(s) - 1]\n"
+        "}\n",
+        1000000},
+    {"map literal keys",
+        "func main():int {\n"
+        "    var m = {\"content-type\": 1, \"content-length\": 2, \"transfer-encoding\": 3,\n"
+        "        \"connection\": 4, \"accept-encoding\": 5, \"user-agent\": 6}\n"
+        "    var sum:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        sum = sum + m[\"content-length\"] + m[\"user-agent\"] + m[\"connection\"]\n"
+        "    }\n"
+        "    return sum & 1\n"
+        "}\n",
+        2000000},
+    {"map computed keys",
+        "func main():int {\n"
+        "    var m = {}\n"
+        "    var keys = []\n"
+        "    for (i:int = 0; i < 1000; i += 1) {\n"
+        "        var key = \"session-\" + i * 7919\n"
+        "        m[key] = i\n"
+        "        append(keys, \"session-\" + i * 7919)\n"
+        "    }\n"
+        "    var sum:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        sum = sum + m[keys[i % 1000]]\n"
+        "    }\n"
+        "    return sum & 1\n"
+        "}\n",
+        2000000},
+    {"compare literals",
+        "func main():int {\n"
+        "    var method = \"POST\"\n"
+        "    var count:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        if (method == \"GET\") {\n"
+        "            count += 1\n"
+        "        }\n"
+        "        if (method == \"POST\") {\n"
+        "            count += 2\n"
+        "        }\n"
+        "    }\n"
+        "    return count & 1\n"
+        "}\n",
+        2000000},
+    {"compare long",
+        "func main():int {\n"
+        "    var a = \"\"\n"
+        "    var b = \"\"\n"
+        "    for (i:int = 0; i < 40; i += 1) {\n"
+        "        a = a + \"segment-\" + i + \"/\"\n"
+        "        b = b + \"segment-\" + i + \"/\"\n"
+        "    }\n"
+        "    var c = b + \"tail\"\n"
+        "    var count:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        if (a == b) {\n"
+        "            count += 1\n"
+        "        }\n"
+        "        if (a == c) {\n"
+        "            count += 2\n"
+        "        }\n"
+        "        if (a < c) {\n"
+        "            count += 3\n"
+        "        }\n"
+        "    }\n"
+        "    return count & 1\n"
+        "}\n",
+        2000000},
+};
+
+// Return the best time of a few runs, negative if the program fails
+double Run(const std::vector<zl::SourceFile>& files, bool intern) {
+    double best = 1e9;
+    for (int run = 0; run < 3; run++) {
+        zl::Program bytecode;
+        zl::BytecodeCompiler compiler(bytecode);
+        compiler.SetInternLiterals(intern);
+        if (!compiler.Compile(files))
+            return -1;
+        zl::Interpreter interpreter(bytecode);
+        zl::Value result;
+        zl::bench::Timer timer;
+        if (!interpreter.RunMain(result)) {
+            std::cerr << interpreter.Error() << std::endl;
+            return -1;
+        }
+        best = std::min(best, timer.Seconds());
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    for (auto& program : programs) {
+        // The length of the concatenations is what they measure
+        long iterations = program.iterations;
+        if (std::string(program.name).compare(0, 6, "concat") != 0)
+            iterations = static_cast<long>(iterations * scale);
+        std::string source = zl::bench::Instantiate(program.source, iterations);
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = std::string(program.name) + ".zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        if (!files[0].diagnostics.empty()) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+        double interned = Run(files, true);
+        double copied = Run(files, false);
+        if (interned < 0 || copied < 0) {
+            std::cerr << program.name << ": failed" << std::endl;
+            return 1;
+        }
+        std::cout << program.name << ": " << interned * 1e9 / iterations << " ns per iteration, "
+            << copied * 1e9 / iterations << " ns without interning" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Measure switch statements in the bytecode interpreter with 10, 100 and
+// 1000 cases: dense integers dispatched by a jump table, sparse integers by
+// a binary search and strings by a perfect hash, against a function with
+// no switch and against the same cases as a chain of if and elif.
+//
+// usage: bench_switch [scale]
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/frontend.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+enum class Kind {
+    None,
+    Dense,
+    Sparse,
+    String,
+    IfChain,
+};
+
+struct Program {
+    const char* name;
+    Kind kind;
+    int cases;
+};
+
+const Program programs[] = {
+    {"no switch", Kind::None, 0},
+    {"dense 10", Kind::Dense, 10},
+    {"dense 100", Kind::Dense, 100},
+    {"dense 1000", Kind::Dense, 1000},
+    {"sparse 10", Kind::Sparse, 10},
+    {"sparse 100", Kind::Sparse, 100},
+    {"sparse 1000", Kind::Sparse, 1000},
+    {"strings 10", Kind::String, 10},
+    {"strings 100", Kind::String, 100},
+    {"strings 1000", Kind::String, 1000},
+    {"if chain 10", Kind::IfChain, 10},
+    {"if chain 100", Kind::IfChain, 100},
+};
+
+// The value of case k, sparse ones are spread over the integers
+std::string CaseValue(Kind kind, int k) {
+    if (kind == Kind::String)
+        return "\"key-" + std::to_string(k) + "\"";
+    if (kind == Kind::Sparse)
+        return std::to_string(k * 1000003 + k * k % 1009);
+    return std::to_string(k);
+}
+
+// work(n) maps the value of case k to k, main calls it count times with
+// the values of the cases in turn
+std::string Source(const Program& program, long count) {
+    std::string type = program.kind == Kind::String ? "string" : "int";
+    std::string source = "func work(n:" + type + "):int {\n";
+    if (program.kind == Kind::None) {
+        source += "    return 0\n";
+    } else if (program.kind == Kind::IfChain) {
+        for (int k = 0; k < program.cases; k++)
+            source += std::string(k ? "    elif" : "    if") + " (n == " + CaseValue(program.kind, k) +
+                ") {\n        return " + std::to_string(k) + "\n    }\n";
+        source += "    else {\n        return -1\n    }\n";
+    } else {
+        source += "    switch (n) {\n";
+        for (int k = 0; k < program.cases; k++)
+            source += "        case " + CaseValue(program.kind, k) + ": return " + std::to_string(k) + "\n";
+        source += "        default: return -1\n    }\n";
+    }
+    source += "}\n";
+
+    int cases = std::max(program.cases, 1);
+    source += "func main():int {\n    var values:" + type + "[] = []\n";
+    if (program.kind == Kind::String) {
+        source += "    for (k:int = 0; k < " + std::to_string(cases) + "; k += 1) {\n"
+            "        append(values, \"key-\" + k)\n    }\n";
+    } else if (program.kind == Kind::Sparse) {
+        source += "    for (k:int = 0; k < " + std::to_string(cases) + "; k += 1) {\n"
+            "        append(values, k * 1000003 + k * k % 1009)\n    }\n";
+    } else {
+        source += "    for (k:int = 0; k < " + std::to_string(cases) + "; k += 1) {\n"
+            "        append(values, k)\n    }\n";
+    }
+    source += "    var sum:int = 0\n"
+        "    var k:int = 0\n"
+        "    for (i:int = 0; i < " + std::to_string(count) + "; i += 1) {\n"
+        "        sum += work(values[k])\n"
+        "        k += 1\n"
+        "        if (k == " + std::to_string(cases) + ") {\n"
+        "            k = 0\n"
+        "        }\n"
+        "    }\n"
+        "    return sum & 1\n"
+        "}\n";
+    return source;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    long calls = static_cast<long>(2000000 * scale);
+    double baseline = 0;
+    for (auto& program : programs) {
+        // The chains compare half their cases on average
+        long count = program.kind == Kind::IfChain ? calls * 10 / program.cases : calls;
+        std::string source = Source(program, count);
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = "switch.zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        zl::Program bytecode;
+        zl::BytecodeCompiler compiler(bytecode);
+        if (!files[0].diagnostics.empty() || !compiler.Compile(files)) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        double best = 1e9;
+        uint64_t instructions = 0;
+        for (int run = 0; run < 5; run++) {
+            zl::Interpreter interpreter(bytecode);
+            zl::Value result;
+            zl::bench::Timer timer;
+            if (!interpreter.RunMain(result)) {
+                std::cerr << program.name << ": " << interpreter.Error() << std::endl;
+                return 1;
+            }
+            best = std::min(best, timer.Seconds());
+            instructions = interpreter.InstructionCount();
+        }
+        double perCall = best * 1e9 / count;
+        std::cout << program.name << ": " << perCall << " ns per call, "
+            << static_cast<double>(instructions) / count << " instructions per call";
+        if (program.kind == Kind::None)
+            baseline = perCall;
+        else
+            std::cout << ", " << std::showpos << perCall - baseline << std::noshowpos << " ns over no switch";
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+// Compare the C translation with and without vectorized loops on sums, dot
+// products and saxpy over arrays of int, float and double. The values are
+// small integers and halves, so sums added in any order are exact and the
+// output of both must be the same.
+//
+// usage: bench_vectorize [scale]
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/c_emitter.h"
+#include "compiler/frontend.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The source with N replaced by the repetition count
+    const char* source;
+    long repetitions;
+};
+
+// Each repetition changes an element, so the loops can not be hoisted
+const Program programs[] = {
+    {"sum int",
+        "func main():int {\n"
+        "    var a:int[] = []\n"
+        "    for (i:int = 0; i < 100000; i += 1) {\n"
+        "        append(a, i % 1000 - 500)\n"
+        "    }\n"
+        "    var total:long = 0\n"
+        "    for (r:int = 0; r < N; r += 1) {\n"
+        "        a[r % 100000] = r % 1000\n"
+        "        var sum:int = 0\n"
+        "        foreach (v in a) {\n"
+        "            sum += v\n"
+        "        }\n"
+        "        total = total + sum\n"
+        "    }\n"
+        "    print(total)\n"
+        "    return 0\n"
+        "}\n",
+        5000},
+    {"sum double",
+        "func main():int {\n"
+        "    var a:double[] = []\n"
+        "    for (i:int = 0; i < 100000; i += 1) {\n"
+        "        append(a, i % 1000 * 0.5)\n"
+        "    }\n"
+        "    var total:double = 0.0\n"
+        "    for (r:int = 0; r < N; r += 1) {\n"
+        "        a[r % 100000] = r % 1000\n"
+        "        var sum:double = 0.0\n"
+        "        foreach (v in a) {\n"
+        "            sum += v\n"
+        "        }\n"
+        "        total = total + sum\n"
+        "    }\n"
+        "    print(total)\n"
+        "    return 0\n"
+        "}\n",
+        5000},
+    {"dot float",
+        "func main():int {\n"
+        "    var x:float[] = []\n"
+        "    var y:float[] = []\n"
+        "    for (i:int = 0; i < 100000; i += 1) {\n"
+        "        append(x, i % 16)\n"
+        "        append(y, i % 8)\n"
+        "    }\n"
+        "    var total:double = 0.0\n"
+        "    for (r:int = 0; r < N; r += 1) {\n"
+        "        x[r % 100000] = r % 16\n"
+        "        var dot:float = 0.0\n"
+        "        for (i:int = 0; i < len(x); i += 1) {\n"
+        "            dot += x[i] * y[i]\n"
+        "        }\n"
+        "        total = total + dot\n"
+        "    }\n"
+        "    print(total)\n"
+        "    return 0\n"
+        "}\n",
+        5000},
+    {"dot double",
+        "func main():int {\n"
+        "    var x:double[] = []\n"
+        "    var y:double[] = []\n"
+        "    for (i:int = 0; i < 100000; i += 1) {\n"
+        "        append(x, i % 1000 * 0.5)\n"
+        "        append(y, i % 3)\n"
+        "    }\n"
+        "    var total:double = 0.0\n"
+        "    for (r:int = 0; r < N; r += 1) {\n"
+        "        x[r % 100000] = r % 1000\n"
+        "        var dot:double = 0.0\n"
+        "        for (i:int = 0; i < len(x); i += 1) {\n"
+        "            dot += x[i] * y[i]\n"
+        "        }\n"
+        "        total = total + dot\n"
+        "    }\n"
+        "    print(total)\n"
+        "    return 0\n"
+        "}\n",
+        5000},
+    {"saxpy float",
+        "func main():int {\n"
+        "    var x:float[] = []\n"
+        "    var y:float[] = []\n"
+        "    for (i:int = 0; i < 100000; i += 1) {\n"
+        "        append(x, i % 16)\n"
+        "        append(y, 0)\n"
+        "    }\n"
+        "    var a:float = 0.5\n"
+        "    for (r:int = 0; r < N; r += 1) {\n"
+        "        for (i:int = 0; i < len(x); i += 1) {\n"
+        "            y[i] = a * x[i] + y[i]\n"
+        "        }\n"
+        "    }\n"
+        "    print(y[0], y[7], y[99999])\n"
+        "    return 0\n"
+        "}\n",
+        5000},
+};
+
+bool RunExecutable(const std::string& path, std::string& output) {
+    FILE* pipe = popen(path.c_str(), "r");
+    if (!pipe)
+        return false;
+    output.clear();
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+        output.append(buffer, n);
+    return pclose(pipe) == 0;
+}
+
+struct Result {
+    std::string output;
+    size_t vectorized = 0;
+    double seconds = 1e9;
+};
+
+bool Build(std::vector<zl::SourceFile>& files, bool vectorize, const std::string& executable,
+        Result& result, std::string& error) {
+    zl::CEmitter emitter;
+    emitter.SetVectorize(vectorize);
+    emitter.SetReassociate(true);
+    std::string code;
+    if (!emitter.Emit(files, code)) {
+        error = emitter.Diagnostics().empty() ? "can not translate" : emitter.Diagnostics()[0].diagnostic.msg;
+        return false;
+    }
+    for (auto& report : emitter.LoopReports())
+        result.vectorized += report.vectorized;
+    if (!zl::CompileC(code, executable, error))
+        return false;
+    for (int run = 0; run < 3; run++) {
+        zl::bench::Timer timer;
+        if (!RunExecutable(executable, result.output)) {
+            error = "the executable failed";
+            unlink(executable.c_str());
+            return false;
+        }
+        result.seconds = std::min(result.seconds, timer.Seconds());
+    }
+    unlink(executable.c_str());
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    std::string executable = "/tmp/bench-vectorize-" + std::to_string(getpid());
+    for (auto& program : programs) {
+        std::string source = zl::bench::Instantiate(program.source, static_cast<long>(program.repetitions * scale));
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = std::string(program.name) + ".zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        if (!files[0].diagnostics.empty()) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        Result scalar, vector;
+        std::string error;
+        if (!Build(files, false, executable, scalar, error) || !Build(files, true, executable, vector, error)) {
+            std::cerr << program.name << ": " << error << std::endl;
+            return 1;
+        }
+        std::cout << program.name << ": scalar " << scalar.seconds * 1000 << " ms, vectorized "
+            << vector.seconds * 1000 << " ms (" << scalar.seconds / vector.seconds << "x), "
+            << vector.vectorized << " loops vectorized" << std::endl;
+        if (scalar.output != vector.output) {
+            std::cerr << program.name << ": scalar printed " << scalar.output << "vectorized " << vector.output;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+// Measure the bytecode interpreter on loops, calls and field access on self,
+// with threaded and switch dispatch. Each program is compiled once and run
+// with both dispatches, the best of a few runs is reported.
+//
+// usage: bench_vm [scale]
+#include <stdlib.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/bytecode_compiler.h"
+#include "compiler/frontend.h"
+#include "runtime/interpreter.h"
+
+namespace {
+
+struct Program {
+    const char* name;
+    // The source with N replaced by the iteration count
+    const char* source;
+    long iterations;
+};
+
+const Program programs[] = {
+    {"loop",
+        "func main():int {\n"
+        "    var sum:int = 0\n"
+        "    for (i:int = 0; i < N; i += 1) {\n"
+        "        sum += i & 7\n"
+        "    }\n"
+        "    return sum & 1\n"
+        "}\n",
+        20000000},
+    {"call",
+        "func fib(n:int):int {\n"
+        "    if (n < 2) {\n"
+        "        return n\n"
+        "    }\n"
+        "    return fib(n - 1) + fib(n - 2)\n"
+        "}\n"
+        "func main():int {\n"
+        "    return fib(N) & 1\n"
+        "}\n",
+        30},
+    {"field",
+        "class Counter {\n"
+        "    Counter() {}\n"
+        "    Add(n:int) {\n"
+        "        self.count = self.count + n\n"
+        "        self.calls += 1\n"
+        "    }\n"
+        "    Run(n:int):int {\n"
+        "        for (i:int = 0; i < n; i += 1) {\n"
+        "            self.count = self.count + (i & 3)\n"
+        "            self.calls += 1\n"
+        "        }\n"
+        "        for (i:int = 0; i < n / 10; i += 1) {\n"
+        "            Add(i)\n"
+        "        }\n"
+        "        return self.calls\n"
+        "    }\n"
+        "    count:int\n"
+        "    calls:int\n"
+        "}\n"
+        "func main():int {\n"
+        "    var counter:Counter = new Counter()\n"
+        "    return counter.Run(N) & 1\n"
+        "}\n",
+        10000000},
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double scale = argc > 1 ? strtod(argv[1], nullptr) : 1.0;
+    std::cout << "threaded dispatch "
+        << (zl::Interpreter::HasThreadedDispatch() ? "available" : "not available") << std::endl;
+    for (auto& program : programs) {
+        long iterations = program.iterations;
+        // Recursion depth is the scale of fib, it grows exponentially
+        if (std::string(program.name) != "call")
+            iterations = static_cast<long>(iterations * scale);
+        std::string source = zl::bench::Instantiate(program.source, iterations);
+        std::vector<zl::SourceFile> files(1);
+        files[0].path = std::string(program.name) + ".zl";
+        files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+        zl::Program bytecode;
+        zl::BytecodeCompiler compiler(bytecode);
+        if (!files[0].diagnostics.empty() || !compiler.Compile(files)) {
+            std::cerr << program.name << ": can not compile" << std::endl;
+            return 1;
+        }
+
+        for (auto dispatch : {zl::Interpreter::Dispatch::Threaded, zl::Interpreter::Dispatch::Switch}) {
+            double best = 1e9;
+            uint64_t instructions = 0;
+            for (int run = 0; run < 3; run++) {
+                zl::Interpreter interpreter(bytecode, dispatch);
+                zl::Value result;
+                zl::bench::Timer timer;
+                if (!interpreter.RunMain(result)) {
+                    std::cerr << program.name << ": " << interpreter.Error() << std::endl;
+                    return 1;
+                }
+                best = std::min(best, timer.Seconds());
+                instructions = interpreter.InstructionCount();
+            }
+            std::cout << program.name << " "
+                << (dispatch == zl::Interpreter::Dispatch::Threaded ? "threaded" : "switch  ")
+                << ": " << best * 1000 << " ms, " << instructions / 1e6 << " M instructions, "
+                << instructions / best / 1e6 << " M instructions/s" << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+// Compare the streaming xml dump with building a pugixml document first.
+//
+// usage: bench_xml_dump [megabytes]
+#include <stdlib.h>
+#include <iostream>
+#include "benchmark/benchmark.h"
+#include "compiler/frontend.h"
+#include "compiler/xml_builder.h"
+
+namespace {
+
+class HashXmlWriter : public pugi::xml_writer {
+public:
+    void write(const void* data, size_t size) override { sink.Update(data, size); }
+    zl::bench::HashWriter sink;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 16;
+    std::string source = zl::bench::GenerateSource(megabytes << 20);
+
+    zl::bench::Timer timer;
+    std::vector<zl::SourceFile> files(1);
+    files[0].path = "bench.zl";
+    files[0].diagnostics = zl::RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+    double parseSeconds = timer.Seconds();
+    if (!files[0].diagnostics.empty()) {
+        std::cerr << "bench.zl:" << files[0].diagnostics[0].location.GetLineno() << ": error: "
+            << files[0].diagnostics[0].msg << std::endl;
+        return 1;
+    }
+    std::cout << "source " << source.size() / 1e6 << " MB, " << files[0].decls.size()
+        << " declarations, parsed in " << parseSeconds << " s" << std::endl;
+
+    // The streaming dump runs first, so the growth of the peak rss of each
+    // run is the memory it needs
+    HashXmlWriter streamed, dom;
+    long rss = zl::bench::PeakRssKb();
+    timer.Restart();
+    {
+        zl::XmlBuilder builder(streamed);
+        builder.BuildXml(files);
+    }
+    double seconds = timer.Seconds();
+    long growth = zl::bench::PeakRssKb() - rss;
+    std::cout << "stream: " << streamed.sink.size / 1e6 / seconds << " MB/s, peak rss +"
+        << growth << " KB" << std::endl;
+
+    rss = zl::bench::PeakRssKb();
+    timer.Restart();
+    {
+        zl::XmlBuilder builder(dom);
+        builder.BuildDom(files);
+    }
+    seconds = timer.Seconds();
+    growth = zl::bench::PeakRssKb() - rss;
+    std::cout << "dom:    " << dom.sink.size / 1e6 / seconds << " MB/s, peak rss +"
+        << growth << " KB" << std::endl;
+
+    if (streamed.sink.size != dom.sink.size || streamed.sink.hash != dom.sink.hash) {
+        std::cerr << "outputs differ: " << streamed.sink.size << " and " << dom.sink.size
+            << " bytes" << std::endl;
+        return 1;
+    }
+    std::cout << "outputs identical, " << streamed.sink.size / 1e6 << " MB" << std::endl;
+    return 0;
+}
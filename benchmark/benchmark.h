@@ -0,0 +1,123 @@
+#pragma once
+#include <ctype.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <string>
+
+namespace zl {
+namespace bench {
+
+// Timer measure the wall time since it is created or restarted
+class Timer {
+public:
+    Timer(): start_(std::chrono::steady_clock::now()) {}
+    void Restart() { start_ = std::chrono::steady_clock::now(); }
+    double Seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Return the peak resident set size of the process in kilobytes
+inline long PeakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Generate a source file of about size bytes, it is made of classes and
+// functions with statements, expressions and string literals needing
+// escaping in xml
+inline std::string GenerateSource(size_t size, const std::string& package = "bench") {
+    std::string source = "package " + package + "\n\nimport system.io\n\n";
+    for (size_t i = 0; source.size() < size; i++) {
+        std::string n = std::to_string(i);
+        source += "class Shape" + n + " {\n"
+            "    Shape" + n + "(x:int, y:int)\n"
+            "    Area():int {\n"
+            "        return self.x * self.y + " + n + "\n"
+            "    }\n"
+            "    Name():string {\n"
+            "        return \"shape<" + n + "> & more\"\n"
+            "    }\n"
+            "private:\n"
+            "    x:int\n"
+            "    y:int\n"
+            "    tags:map<string, int[]>\n"
+            "}\n\n";
+        source += "func Compute" + n + "(count:int, values:int[]):int {\n"
+            "    var sum:int = 0\n"
+            "    for (i:int = 0; i < count; i += 1) {\n"
+            "        if (values[i] > " + n + ")\n"
+            "            sum += values[i]\n"
+            "        else\n"
+            "            sum -= 1\n"
+            "    }\n"
+            "    while (sum > 100)\n"
+            "        sum = sum / 2\n"
+            "    return sum\n"
+            "}\n\n";
+    }
+    return source;
+}
+
+// Replace the standalone N of a benchmark program by its iteration count
+inline std::string Instantiate(const char* source, long iterations) {
+    std::string text = source;
+    size_t position = text.find('N');
+    while (position != std::string::npos) {
+        // Only a standalone N is replaced, not the N of a name
+        bool standalone = (position == 0 || !isalnum(text[position - 1])) &&
+            !isalnum(text[position + 1]);
+        if (standalone)
+            text.replace(position, 1, std::to_string(iterations));
+        position = text.find('N', position + 1);
+    }
+    return text;
+}
+
+// Return a program printing mix(n), which steps a 64-bit hash overflowing
+// 32 bits from the first iterations and wrapping around on 64 bits. Every
+// backend supporting long must print LongResult(n).
+inline std::string LongSource(int n) {
+    return "func mix(n:int):long {\n"
+        "    var h:long = 1\n"
+        "    for (i:int = 0; i < n; i += 1) {\n"
+        "        h = h * 1000003 + i\n"
+        "        h = h - h / 7 * 3\n"
+        "    }\n"
+        "    return h\n"
+        "}\n"
+        "func main():int {\n"
+        "    print(mix(" + std::to_string(n) + "))\n"
+        "    return 0\n"
+        "}\n";
+}
+
+inline int64_t LongResult(int n) {
+    uint64_t h = 1;
+    for (int i = 0; i < n; i++) {
+        h = h * 1000003 + i;
+        int64_t value = static_cast<int64_t>(h);
+        h = static_cast<uint64_t>(value - value / 7 * 3);
+    }
+    return static_cast<int64_t>(h);
+}
+
+// HashWriter is a sink which only hashes the bytes written, so that outputs
+// can be compared without keeping them in memory
+struct HashWriter {
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t size = 0;
+    void Update(const void* data, size_t length) {
+        auto bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < length; i++)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        size += length;
+    }
+};
+
+} // namespace bench
+} // namespace zl
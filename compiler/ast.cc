@@ -0,0 +1,350 @@
+#include "ast.h"
+
+namespace zl {
+namespace ast {
+
+void Visitor::Visit(const Node* node) {}
+
+const char* NodeKindName(NodeKind kind) {
+    static const char* names[] = {
+        "Unknown",
+        "BadExpr",
+        "Identifier",
+        "QualifiedName",
+        "QualifiedNameList",
+        "Comment",
+        "NullType",
+        "PrimitiveType",
+        "NonPrimitiveType",
+        "MapType",
+        "ArrayType",
+        "LiteralExpr",
+        "UnaryExpr",
+        "BinaryExpr",
+        "SelectorExpr",
+        "IndexExpr",
+        "CallExpr",
+        "NewExpr",
+        "ArrayLiteralExpr",
+        "MapLiteralExpr",
+        "PackageDecl",
+        "ImportDecl",
+        "UsingDecl",
+        "VarInitializer",
+        "VariableDecl",
+        "VariableBlockDecl",
+        "ConstDecl",
+        "ConstBlockDecl",
+        "FunctionDecl",
+        "FunctionBlockDecl",
+        "FormalParameter",
+        "FormalParameterList",
+        "ReturnParameterList",
+        "InterfaceMethodDecl",
+        "InterfaceDecl",
+        "ClassBodyDecl",
+        "ClassDecl",
+        "UnknownStmt",
+        "DeclStmt",
+        "BlockStmt",
+        "AssignStmt",
+        "LabelStmt",
+        "IfStmt",
+        "ExprStmt",
+        "ExprStmts",
+        "ForStmt",
+        "ForeachStmt",
+        "IterableObject",
+        "WhileStmt",
+        "DoStmt",
+        "SwitchStmt",
+        "ReturnStmt",
+        "BreakStmt",
+        "ContinueStmt",
+        "AssertStmt",
+        "ThrowStmt",
+        "TryStmt",
+        "CatchStmt",
+        "FinallyStmt",
+        "DeferStmt",
+        "CaseStmt",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(NodeKind::kCount),
+            "every node kind needs a name");
+    size_t index = (size_t)kind;
+    if (index >= sizeof(names) / sizeof(names[0]))
+        return "Unknown";
+    return names[index];
+}
+
+template <typename T>
+static void Append(std::vector<Node*>& children, const std::vector<T*>& nodes) {
+    children.insert(children.end(), nodes.begin(), nodes.end());
+}
+
+void CollectChildren(const Node* node, std::vector<Node*>& children) {
+    switch (node->Kind()) {
+        case NodeKind::QualifiedNameList:
+            Append(children, static_cast<const QualifiedNameList*>(node)->names_);
+            break;
+        case NodeKind::NonPrimitiveType:
+            children.push_back(static_cast<const NonPrimitiveType*>(node)->name_);
+            break;
+        case NodeKind::MapType: {
+            auto type = static_cast<const MapType*>(node);
+            children.push_back(type->leftType_);
+            children.push_back(type->rightType_);
+            break;
+        }
+        case NodeKind::ArrayType:
+            children.push_back(static_cast<const ArrayType*>(node)->type_);
+            break;
+
+        case NodeKind::UnaryExpr:
+            children.push_back(static_cast<const UnaryExpr*>(node)->expr_);
+            break;
+        case NodeKind::BinaryExpr: {
+            auto expr = static_cast<const BinaryExpr*>(node);
+            children.push_back(expr->left_);
+            children.push_back(expr->right_);
+            break;
+        }
+        case NodeKind::SelectorExpr: {
+            auto expr = static_cast<const SelectorExpr*>(node);
+            children.push_back(expr->expr_);
+            children.push_back(expr->selector_);
+            break;
+        }
+        case NodeKind::IndexExpr: {
+            auto expr = static_cast<const IndexExpr*>(node);
+            children.push_back(expr->expr_);
+            children.push_back(expr->index_);
+            break;
+        }
+        case NodeKind::CallExpr: {
+            auto expr = static_cast<const CallExpr*>(node);
+            children.push_back(expr->function_);
+            Append(children, expr->arguments_);
+            break;
+        }
+        case NodeKind::NewExpr: {
+            auto expr = static_cast<const NewExpr*>(node);
+            children.push_back(expr->type_);
+            Append(children, expr->arguments_);
+            break;
+        }
+        case NodeKind::ArrayLiteralExpr:
+            Append(children, static_cast<const ArrayLiteralExpr*>(node)->elements_);
+            break;
+        case NodeKind::MapLiteralExpr:
+            for (auto& item : static_cast<const MapLiteralExpr*>(node)->elements_) {
+                children.push_back(item.first);
+                children.push_back(item.second);
+            }
+            break;
+
+        case NodeKind::PackageDecl:
+            children.push_back(static_cast<const PackageDecl*>(node)->name_);
+            break;
+        case NodeKind::ImportDecl:
+            children.push_back(static_cast<const ImportDecl*>(node)->name_);
+            break;
+        case NodeKind::UsingDecl: {
+            auto decl = static_cast<const UsingDecl*>(node);
+            children.push_back(decl->qualifiedName_);
+            children.push_back(decl->aliasName_);
+            break;
+        }
+        case NodeKind::VarInitializer:
+            children.push_back(static_cast<const VarInitializer*>(node)->expr_);
+            break;
+        case NodeKind::VariableDecl: {
+            auto decl = static_cast<const VariableDecl*>(node);
+            children.push_back(decl->name_);
+            children.push_back(decl->type_);
+            children.push_back(decl->varInitializer_);
+            break;
+        }
+        case NodeKind::VariableBlockDecl:
+            Append(children, static_cast<const VariableBlockDecl*>(node)->variables_);
+            break;
+        case NodeKind::ConstDecl: {
+            auto decl = static_cast<const ConstDecl*>(node);
+            children.push_back(decl->name_);
+            children.push_back(decl->type_);
+            children.push_back(decl->varInitializer_);
+            break;
+        }
+        case NodeKind::ConstBlockDecl:
+            Append(children, static_cast<const ConstBlockDecl*>(node)->fields_);
+            break;
+        case NodeKind::FunctionDecl: {
+            auto decl = static_cast<const FunctionDecl*>(node);
+            children.push_back(decl->name_);
+            children.push_back(decl->formalParameterList_);
+            children.push_back(decl->returnParameterList_);
+            children.push_back(decl->functionBlockDecl_);
+            break;
+        }
+        case NodeKind::FunctionBlockDecl:
+            Append(children, static_cast<const FunctionBlockDecl*>(node)->nodes_);
+            break;
+        case NodeKind::FormalParameter: {
+            auto decl = static_cast<const FormalParameter*>(node);
+            children.push_back(decl->name_);
+            children.push_back(decl->type_);
+            break;
+        }
+        case NodeKind::FormalParameterList:
+            Append(children, static_cast<const FormalParameterList*>(node)->formalParameters_);
+            break;
+        case NodeKind::ReturnParameterList:
+            Append(children, static_cast<const ReturnParameterList*>(node)->types_);
+            break;
+        case NodeKind::InterfaceMethodDecl: {
+            auto decl = static_cast<const InterfaceMethodDecl*>(node);
+            children.push_back(decl->name_);
+            children.push_back(decl->formalParameterList_);
+            children.push_back(decl->returnParameterList_);
+            break;
+        }
+        case NodeKind::InterfaceDecl: {
+            auto decl = static_cast<const InterfaceDecl*>(node);
+            children.push_back(decl->name_);
+            Append(children, decl->methods_);
+            break;
+        }
+        case NodeKind::ClassBodyDecl: {
+            auto decl = static_cast<const ClassBodyDecl*>(node);
+            Append(children, decl->variables_);
+            Append(children, decl->functions_);
+            break;
+        }
+        case NodeKind::ClassDecl: {
+            auto decl = static_cast<const ClassDecl*>(node);
+            children.push_back(decl->name_);
+            children.push_back(decl->interfaceList_);
+            children.push_back(decl->classBody_);
+            break;
+        }
+
+        case NodeKind::DeclStmt:
+            children.push_back(static_cast<const DeclStmt*>(node)->decl_);
+            break;
+        case NodeKind::BlockStmt:
+            Append(children, static_cast<const BlockStmt*>(node)->stmts_);
+            break;
+        case NodeKind::AssignStmt: {
+            auto stmt = static_cast<const AssignStmt*>(node);
+            Append(children, stmt->lhs_);
+            Append(children, stmt->rhs_);
+            break;
+        }
+        case NodeKind::IfStmt: {
+            auto stmt = static_cast<const IfStmt*>(node);
+            children.push_back(stmt->conditionExpr_);
+            children.push_back(stmt->ifBlockStmt_);
+            for (auto& item : stmt->elifBlockStmts_) {
+                children.push_back(item.first);
+                children.push_back(item.second);
+            }
+            children.push_back(stmt->finalStmt_);
+            break;
+        }
+        case NodeKind::ExprStmt: {
+            auto stmt = static_cast<const ExprStmt*>(node);
+            children.push_back(stmt->varDecl_);
+            children.push_back(stmt->stmt_);
+            children.push_back(stmt->expr_);
+            break;
+        }
+        case NodeKind::ExprStmts:
+            Append(children, static_cast<const ExprStmts*>(node)->stmts_);
+            break;
+        case NodeKind::ForStmt: {
+            auto stmt = static_cast<const ForStmt*>(node);
+            children.push_back(stmt->initializer_);
+            children.push_back(stmt->expr_);
+            children.push_back(stmt->finalizer_);
+            children.push_back(stmt->block_);
+            break;
+        }
+        case NodeKind::ForeachStmt: {
+            auto stmt = static_cast<const ForeachStmt*>(node);
+            children.push_back(stmt->iterableObject_);
+            children.push_back(stmt->block_);
+            break;
+        }
+        case NodeKind::IterableObject: {
+            auto object = static_cast<const IterableObject*>(node);
+            if (object->primary_)
+                children.push_back(object->primary_);
+            for (auto& item : object->mapElements_) {
+                children.push_back(item.first);
+                children.push_back(item.second);
+            }
+            Append(children, object->arrayElements_);
+            break;
+        }
+        case NodeKind::WhileStmt: {
+            auto stmt = static_cast<const WhileStmt*>(node);
+            children.push_back(stmt->conditionExpr_);
+            children.push_back(stmt->block_);
+            break;
+        }
+        case NodeKind::DoStmt: {
+            auto stmt = static_cast<const DoStmt*>(node);
+            children.push_back(stmt->block_);
+            children.push_back(stmt->conditionExpr_);
+            break;
+        }
+        case NodeKind::SwitchStmt: {
+            auto stmt = static_cast<const SwitchStmt*>(node);
+            children.push_back(stmt->expr_);
+            Append(children, stmt->cases_);
+            children.push_back(stmt->default_);
+            break;
+        }
+        case NodeKind::CaseStmt: {
+            auto stmt = static_cast<const CaseStmt*>(node);
+            Append(children, stmt->exprs_);
+            children.push_back(stmt->block_);
+            break;
+        }
+        case NodeKind::ReturnStmt:
+            Append(children, static_cast<const ReturnStmt*>(node)->exprs_);
+            break;
+        case NodeKind::AssertStmt:
+            children.push_back(static_cast<const AssertStmt*>(node)->expr_);
+            break;
+        case NodeKind::DeferStmt:
+            children.push_back(static_cast<const DeferStmt*>(node)->call_);
+            break;
+        case NodeKind::ThrowStmt:
+            children.push_back(static_cast<const ThrowStmt*>(node)->expr_);
+            break;
+        case NodeKind::TryStmt: {
+            auto stmt = static_cast<const TryStmt*>(node);
+            children.push_back(stmt->block_);
+            Append(children, stmt->catches_);
+            children.push_back(stmt->finally_);
+            break;
+        }
+        case NodeKind::CatchStmt: {
+            auto stmt = static_cast<const CatchStmt*>(node);
+            Append(children, stmt->types_);
+            children.push_back(stmt->name_);
+            children.push_back(stmt->block_);
+            break;
+        }
+        case NodeKind::FinallyStmt:
+            children.push_back(static_cast<const FinallyStmt*>(node)->block_);
+            break;
+        default:
+            // Leaf nodes
+            break;
+    }
+}
+
+} // namespace ast
+} // namespace zl
@@ -2,13 +2,84 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <stdint.h>
 #include "token.h"
 #include "location.h"
 
 namespace zl {
 namespace ast {
 
+enum class NodeKind : uint8_t {
+    Unknown,
+    BadExpr,
+    Identifier,
+    QualifiedName,
+    QualifiedNameList,
+    Comment,
+    NullType,
+    PrimitiveType,
+    NonPrimitiveType,
+    MapType,
+    ArrayType,
+    LiteralExpr,
+    UnaryExpr,
+    BinaryExpr,
+    SelectorExpr,
+    IndexExpr,
+    CallExpr,
+    NewExpr,
+    ArrayLiteralExpr,
+    MapLiteralExpr,
+    PackageDecl,
+    ImportDecl,
+    UsingDecl,
+    VarInitializer,
+    VariableDecl,
+    VariableBlockDecl,
+    ConstDecl,
+    ConstBlockDecl,
+    FunctionDecl,
+    FunctionBlockDecl,
+    FormalParameter,
+    FormalParameterList,
+    ReturnParameterList,
+    InterfaceMethodDecl,
+    InterfaceDecl,
+    ClassBodyDecl,
+    ClassDecl,
+    UnknownStmt,
+    DeclStmt,
+    BlockStmt,
+    AssignStmt,
+    LabelStmt,
+    IfStmt,
+    ExprStmt,
+    ExprStmts,
+    ForStmt,
+    ForeachStmt,
+    IterableObject,
+    WhileStmt,
+    DoStmt,
+    SwitchStmt,
+    ReturnStmt,
+    BreakStmt,
+    ContinueStmt,
+    AssertStmt,
+    ThrowStmt,
+    TryStmt,
+    CatchStmt,
+    FinallyStmt,
+    DeferStmt,
+    CaseStmt,
+    // Number of kinds, new kinds are added before it
+    kCount,
+};
+
+// Return the node kind name, such as "IfStmt"
+const char* NodeKindName(NodeKind kind);
+
 class Node;
+struct Object;
 class Visitor {
 public:
     virtual void Visit(const Node* node);
@@ -16,22 +87,33 @@ public:
 
 class Node {
 public:
-    Node(const Location& location): location_(location) {}
+    Node(const Location& location): location_(location), structuralHash_(0) {}
     virtual ~Node() {}
+    virtual NodeKind Kind() const { return NodeKind::Unknown; }
     // The first location of the node
     virtual Location Pos() {  return location_; }
     // The last location of the node
     virtual Location End() { return Location(); }
     virtual void Visit(Visitor& v) { v.Visit(this); }
+    // The structural hash of the subtree, it is zero until computed by
+    // HashTree(), see ast_hash.h
+    uint64_t StructuralHash() const { return structuralHash_; }
+    void SetStructuralHash(uint64_t hash) { structuralHash_ = hash; }
 protected:
     Location location_;
+    uint64_t structuralHash_;
 };
 
+// Append the direct children of node to children in source order. Absent
+// optional children are appended as nullptr so that the position of a child
+// is stable for the node kind.
+void CollectChildren(const Node* node, std::vector<Node*>& children);
+
 class Decl : public Node { 
 public:
     Decl(const Location& location): Node(location) { publicity_ = true; }
     void SetPublic(bool publicity) { publicity_ = publicity; }
-    bool IsPublic(void) { return publicity_ == true; }
+    bool IsPublic(void) const { return publicity_ == true; }
 protected:
     bool publicity_;
 };
@@ -50,24 +132,31 @@ public:
 
 class BadExpr : public Expr {
 public:
+    NodeKind Kind() const override { return NodeKind::BadExpr; }
     BadExpr(const Location& location): Expr(location) {}
     virtual ~BadExpr() {}
 };
 
 // Common declaration 
-class Identifier : public Node {
+class Identifier : public Expr {
 public:
+    NodeKind Kind() const override { return NodeKind::Identifier; }
     Identifier() = delete;
-    explicit Identifier(const Token& token):Node(token.location_), name_(token.assic_) {}
+    explicit Identifier(const Token& token)
+        :Expr(token.location_), name_(token.assic_), object_(nullptr) {}
     explicit Identifier(const Location& location, const std::string& name)
-        :Node(location), name_(name) {}
+        :Expr(location), name_(name), object_(nullptr) {}
     virtual ~Identifier() {}
     std::string name_;
+    // The object denoted by the identifier, it is set by Resolver and owned
+    // by it, nullptr if not resolved
+    Object* object_;
 };
 
 
 class QualifiedName : public Node {
 public:
+    NodeKind Kind() const override { return NodeKind::QualifiedName; }
     QualifiedName() = delete;
     explicit QualifiedName(const Location& location, std::vector<std::string>& names)
         : Node(location), names_(names) {}
@@ -77,6 +166,7 @@ public:
 
 class QualifiedNameList : public Node {
 public:
+    NodeKind Kind() const override { return NodeKind::QualifiedNameList; }
     QualifiedNameList() = delete;
     explicit QualifiedNameList(const Location& location, std::vector<QualifiedName*>& nameList)
         :Node(location), names_(nameList) {}
@@ -88,6 +178,7 @@ public:
 
 class Comment : public Node {
 public:
+    NodeKind Kind() const override { return NodeKind::Comment; }
     Comment() = delete;
     explicit Comment(const Location& location, const std::string& text): Node(location), text_(text) {}
     ~Comment() {}
@@ -99,18 +190,23 @@ public:
 //
 class Type : public Node { 
 public:
-    Type(const Location& location):Node(location) {}
+    Type(const Location& location):Node(location), typeId_(0) {}
     virtual ~Type() {}
+    // Id of the canonical type in TypeContext, equal types have equal ids.
+    // It is zero until the type is interned, see type_context.h
+    uint32_t typeId_;
 };
 
 class NullType : public Node { 
 public:
+    NodeKind Kind() const override { return NodeKind::NullType; }
     NullType(const Location& location):Node(location) {}
     virtual ~NullType() {}
 };
 
 class PrimitiveType : public Type {
 public:
+    NodeKind Kind() const override { return NodeKind::PrimitiveType; }
     PrimitiveType() = delete;
     explicit PrimitiveType(const Location& location, const std::string& name)
         :Type(location), name_(name) {}
@@ -120,6 +216,7 @@ public:
 
 class NonPrimitiveType : public Type {
 public:
+    NodeKind Kind() const override { return NodeKind::NonPrimitiveType; }
     NonPrimitiveType() = delete;
     explicit NonPrimitiveType(const Location& location, Identifier* name)
         :Type(location), name_(name) {}
@@ -131,6 +228,7 @@ public:
 
 class MapType : public Type {
 public:
+    NodeKind Kind() const override { return NodeKind::MapType; }
     MapType() = delete;
     explicit MapType(const Location& location, Type* leftType, Type* rightType)
         :Type(location), leftType_(leftType), rightType_(rightType) {}
@@ -144,6 +242,7 @@ public:
 
 class ArrayType : public Type {
 public:
+    NodeKind Kind() const override { return NodeKind::ArrayType; }
     ArrayType() = delete;
     explicit ArrayType(const Location& location, Type* type)
         :Type(location), type_(type) {}
@@ -153,6 +252,155 @@ public:
     Type* type_;
 };
 
+//
+// Expressions
+//
+
+// primaryExpr
+//    : 'true' | 'false' | 'null' | NUMBER | FLOATNUMBER | STRING
+//    ;
+class LiteralExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::LiteralExpr; }
+    LiteralExpr() = delete;
+    explicit LiteralExpr(const Location& location, int kind, const std::string& value)
+        :Expr(location), kind_(kind), value_(value) {}
+    virtual ~LiteralExpr() {}
+    // Token type of the literal, such as Token::INT, Token::STRING or Token::TRUE
+    int kind_;
+    std::string value_;
+};
+
+class UnaryExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::UnaryExpr; }
+    UnaryExpr() = delete;
+    explicit UnaryExpr(const Location& location, int op, Expr* expr)
+        :Expr(location), op_(op), expr_(expr) {}
+    virtual ~UnaryExpr() {
+        if (expr_) delete expr_;
+    }
+    int op_;
+    Expr* expr_;
+};
+
+class BinaryExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::BinaryExpr; }
+    BinaryExpr() = delete;
+    explicit BinaryExpr(const Location& location, int op, Expr* left, Expr* right)
+        :Expr(location), op_(op), left_(left), right_(right) {}
+    virtual ~BinaryExpr() {
+        if (left_) delete left_;
+        if (right_) delete right_;
+    }
+    int op_;
+    Expr* left_;
+    Expr* right_;
+};
+
+// assignableSelector
+//    : '.'IDENTIFIER
+//    ;
+class SelectorExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::SelectorExpr; }
+    SelectorExpr() = delete;
+    explicit SelectorExpr(const Location& location, Expr* expr, Identifier* selector)
+        :Expr(location), expr_(expr), selector_(selector) {}
+    virtual ~SelectorExpr() {
+        if (expr_) delete expr_;
+        if (selector_) delete selector_;
+    }
+    Expr* expr_;
+    Identifier* selector_;
+};
+
+// assignableSelector
+//    : '[' expression ']'
+//    ;
+class IndexExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::IndexExpr; }
+    IndexExpr() = delete;
+    explicit IndexExpr(const Location& location, Expr* expr, Expr* index)
+        :Expr(location), expr_(expr), index_(index) {}
+    virtual ~IndexExpr() {
+        if (expr_) delete expr_;
+        if (index_) delete index_;
+    }
+    Expr* expr_;
+    Expr* index_;
+};
+
+// arguments
+//    : '(' argumentList? ')'
+//    ;
+class CallExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::CallExpr; }
+    CallExpr() = delete;
+    explicit CallExpr(const Location& location, Expr* function, const std::vector<Expr*>& arguments)
+        :Expr(location), function_(function), arguments_(arguments) {}
+    virtual ~CallExpr() {
+        if (function_) delete function_;
+        for (auto p : arguments_) delete p;
+    }
+    Expr* function_;
+    std::vector<Expr*> arguments_;
+};
+
+// newExpr
+//    : 'new' type arguments 
+//    ;
+class NewExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::NewExpr; }
+    NewExpr() = delete;
+    explicit NewExpr(const Location& location, Type* type, const std::vector<Expr*>& arguments)
+        :Expr(location), type_(type), arguments_(arguments) {}
+    virtual ~NewExpr() {
+        if (type_) delete type_;
+        for (auto p : arguments_) delete p;
+    }
+    Type* type_;
+    std::vector<Expr*> arguments_;
+};
+
+// arrayLiteral
+//    :'[' expressionList? ']'
+//    ;
+class ArrayLiteralExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::ArrayLiteralExpr; }
+    ArrayLiteralExpr() = delete;
+    explicit ArrayLiteralExpr(const Location& location, const std::vector<Expr*>& elements)
+        :Expr(location), elements_(elements) {}
+    virtual ~ArrayLiteralExpr() {
+        for (auto p : elements_) delete p;
+    }
+    std::vector<Expr*> elements_;
+};
+
+// mapLiteral
+//    : '{' mapLiteralItems? '}'
+//    ;
+class MapLiteralExpr : public Expr {
+public:
+    NodeKind Kind() const override { return NodeKind::MapLiteralExpr; }
+    typedef typename std::pair<Expr*, Expr*> Element;
+    MapLiteralExpr() = delete;
+    explicit MapLiteralExpr(const Location& location, const std::vector<Element>& elements)
+        :Expr(location), elements_(elements) {}
+    virtual ~MapLiteralExpr() {
+        for (auto item : elements_) {
+            delete item.first;
+            delete item.second;
+        }
+    }
+    std::vector<Element> elements_;
+};
+
 
 //
 // Declarations
@@ -162,6 +410,7 @@ class Identifier;
 
 struct PackageDecl : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::PackageDecl; }
     PackageDecl() = delete;
     explicit PackageDecl(const Location& location, Identifier* identifier)
         :Decl(location), name_(identifier) {}
@@ -171,6 +420,7 @@ public:
 
 class ImportDecl : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::ImportDecl; }
     ImportDecl() = delete;
     explicit ImportDecl(const Location& location, QualifiedName* name)
         :Decl(location), name_(name) {}
@@ -182,6 +432,7 @@ public:
 
 class UsingDecl : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::UsingDecl; }
     UsingDecl() = delete;
     explicit UsingDecl(const Location& location, QualifiedName* qualifiedName, Identifier* aliasName)
         :Decl(location), qualifiedName_(qualifiedName), aliasName_(aliasName) {}
@@ -198,6 +449,7 @@ class Expr;
 
 class VarInitializer : public Node {
 public:
+    NodeKind Kind() const override { return NodeKind::VarInitializer; }
     VarInitializer() = delete;
     explicit VarInitializer(const Location& location, Expr* expr)
         :Node(location), expr_(expr) {}
@@ -209,6 +461,7 @@ public:
 
 class VariableDecl : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::VariableDecl; }
     VariableDecl() = delete;
     explicit VariableDecl(const Location& location, Identifier* name, Type* type, 
             VarInitializer* varInitializer)
@@ -225,6 +478,7 @@ public:
 
 class VariableBlockDecl: public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::VariableBlockDecl; }
     VariableBlockDecl() = delete;
     explicit VariableBlockDecl(const Location& location, std::vector<VariableDecl*> variables)
         :Decl(location), variables_(variables) {}
@@ -239,6 +493,7 @@ public:
 //    ;
 class ConstDecl: public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::ConstDecl; }
     ConstDecl() = delete;
     explicit ConstDecl(const Location& location, Identifier* name, Type* type, VarInitializer* varInitializer)
         :Decl(location), name_(name), type_(type), varInitializer_(varInitializer) {}
@@ -257,6 +512,7 @@ public:
 //    ;
 class ConstBlockDecl: public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::ConstBlockDecl; }
     ConstBlockDecl() = delete;
     explicit ConstBlockDecl(const Location& location, std::vector<ConstDecl*> fields)
         :Decl(location), fields_(fields) {}
@@ -275,32 +531,33 @@ class FunctionBlockDecl;
 //    ;
 class FunctionDecl: public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::FunctionDecl; }
     FunctionDecl() = delete;
     explicit FunctionDecl(const Location& location, Identifier* id, FormalParameterList* formalParameterList,
             ReturnParameterList* returnParameterList, FunctionBlockDecl* functionBlockDecl)
         :Decl(location), name_(id), formalParameterList_(formalParameterList),
-        returnParameterList_(returnParameterList), functionBlockDecl_(functionBlockDecl) {}
+        returnParameterList_(returnParameterList), functionBlockDecl_(functionBlockDecl),
+        isStatic_(false) {}
 
-    virtual ~FunctionDecl() {
-        if (formalParameterList_) delete formalParameterList_;
-        if (returnParameterList_) delete returnParameterList_;
-        if (functionBlockDecl_) delete functionBlockDecl_;
-    }
+    virtual ~FunctionDecl();
     Identifier* name_;
     FormalParameterList* formalParameterList_;
     ReturnParameterList* returnParameterList_;
+    // Class methods may be declared without body
     FunctionBlockDecl* functionBlockDecl_;
+    bool isStatic_;
 };
 
 class FunctionBlockDecl: public Node {
 public:
+    NodeKind Kind() const override { return NodeKind::FunctionBlockDecl; }
     FunctionBlockDecl() = delete;
     explicit FunctionBlockDecl(const Location& location) :Node(location) {}
     virtual ~FunctionBlockDecl() {
         for (auto p : nodes_)
             delete p;
     }
-    void Add(Node* n);
+    void Add(Node* n) { nodes_.push_back(n); }
     std::vector<Node*> nodes_;
 };
 
@@ -310,6 +567,7 @@ public:
 // ;
 class FormalParameter : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::FormalParameter; }
     FormalParameter() = delete;
     explicit FormalParameter(const Location& location, Identifier* name, Type* type)
         :Decl(location), name_(name), type_(type) {}
@@ -330,6 +588,7 @@ public:
 // ;
 class FormalParameterList : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::FormalParameterList; }
     FormalParameterList() = delete;
     explicit FormalParameterList(const Location& location, const std::vector<FormalParameter*>& params)
         :Decl(location), formalParameters_(params) {}
@@ -344,6 +603,7 @@ public:
 //    ;
 class ReturnParameterList : public Node {
 public:
+    NodeKind Kind() const override { return NodeKind::ReturnParameterList; }
     ReturnParameterList() = delete;
     explicit ReturnParameterList(const Location& location, const std::vector<Type*>& params)
         :Node(location), types_(params) {}
@@ -353,11 +613,19 @@ public:
     std::vector<Type*> types_;
 };
 
+inline FunctionDecl::~FunctionDecl() {
+    if (name_) delete name_;
+    if (formalParameterList_) delete formalParameterList_;
+    if (returnParameterList_) delete returnParameterList_;
+    if (functionBlockDecl_) delete functionBlockDecl_;
+}
+
 // interfaceMethodDecl
 //    : IDENTIFIER formalParameters (':' (type | 'void'))? ('throw' qualifiedNameList)?
 //    ;
 class InterfaceMethodDecl: public Node {
 public:
+    NodeKind Kind() const override { return NodeKind::InterfaceMethodDecl; }
     InterfaceMethodDecl() = delete;
     explicit InterfaceMethodDecl(const Location& location, Identifier* id, FormalParameterList* formalParameterList,
             ReturnParameterList* returnParameterList)
@@ -380,6 +648,7 @@ public:
 //    ;
 class InterfaceDecl : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::InterfaceDecl; }
     InterfaceDecl() = delete;
     explicit InterfaceDecl(const Location& location, Identifier* name,
             const std::vector<InterfaceMethodDecl*>& methods)
@@ -397,6 +666,7 @@ public:
 //    ;
 class ClassBodyDecl : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::ClassBodyDecl; }
     ClassBodyDecl() = delete;
     explicit ClassBodyDecl(const Location& location, const std::vector<VariableDecl*>& variables,
             const std::vector<FunctionDecl*>& functions)
@@ -416,6 +686,7 @@ public:
 //    ;
 class ClassDecl : public Decl {
 public:
+    NodeKind Kind() const override { return NodeKind::ClassDecl; }
     ClassDecl() = delete;
     explicit ClassDecl(const Location& location, Identifier* name,
            QualifiedNameList* interfaceList, ClassBodyDecl* classBody)
@@ -432,16 +703,67 @@ public:
 
 class UnknownStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::UnknownStmt; }
     UnknownStmt() = delete;
     explicit UnknownStmt(const Location& location) : Stmt(location) {}
 };
 
+// localVariableDeclarationStatement
+//    : variableDeclaration 
+//    ;
+class DeclStmt : public Stmt {
+public:
+    NodeKind Kind() const override { return NodeKind::DeclStmt; }
+    DeclStmt() = delete;
+    explicit DeclStmt(const Location& location, Decl* decl) : Stmt(location), decl_(decl) {}
+    virtual ~DeclStmt() {
+        if (decl_) delete decl_;
+    }
+    Decl* decl_;
+};
+
+// blockStatement
+//    : '{' statements '}'
+//    ;
+class BlockStmt : public Stmt {
+public:
+    NodeKind Kind() const override { return NodeKind::BlockStmt; }
+    BlockStmt() = delete;
+    explicit BlockStmt(const Location& location, const std::vector<Stmt*>& stmts)
+        : Stmt(location), stmts_(stmts) {}
+    virtual ~BlockStmt() {
+        for (auto stmt : stmts_) delete stmt;
+    }
+    std::vector<Stmt*> stmts_;
+};
+
+// assignmentExpr
+//    : unaryExpr (assignmentOperator expression)?
+//    ;
+class AssignStmt : public Stmt {
+public:
+    NodeKind Kind() const override { return NodeKind::AssignStmt; }
+    AssignStmt() = delete;
+    explicit AssignStmt(const Location& location, const std::vector<Expr*>& lhs, int op,
+            const std::vector<Expr*>& rhs)
+        : Stmt(location), lhs_(lhs), op_(op), rhs_(rhs) {}
+    virtual ~AssignStmt() {
+        for (auto p : lhs_) delete p;
+        for (auto p : rhs_) delete p;
+    }
+    std::vector<Expr*> lhs_;
+    // Assignment operator, Token::ASSIGN or compound one like Token::ADD_ASSIGN
+    int op_;
+    std::vector<Expr*> rhs_;
+};
+
 
 // labelStatement
 //    : IDENTIFIER ':' statement
 //    ;
 class LabelStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::LabelStmt; }
     LabelStmt() = delete;
     explicit LabelStmt(const Location& location, const std::string& name) :Stmt(location), labelName_(name) {}
     const std::string labelName_;
@@ -452,10 +774,20 @@ public:
 //    ;
 class IfStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::IfStmt; }
     IfStmt() = delete;
     explicit IfStmt(const Location& location, Expr* conditionExpr, Stmt* ifBlockStmt,
             const std::vector<std::pair<Expr*, Stmt*>>& elifBlockStmts, Stmt* finalStmt) : Stmt(location),
             conditionExpr_(conditionExpr), ifBlockStmt_(ifBlockStmt), elifBlockStmts_(elifBlockStmts), finalStmt_(finalStmt) {}
+    virtual ~IfStmt() {
+        if (conditionExpr_) delete conditionExpr_;
+        if (ifBlockStmt_) delete ifBlockStmt_;
+        for (auto item : elifBlockStmts_) {
+            delete item.first;
+            delete item.second;
+        }
+        if (finalStmt_) delete finalStmt_;
+    }
     Expr* conditionExpr_;
     Stmt* ifBlockStmt_;
     std::vector<std::pair<Expr*, Stmt*>> elifBlockStmts_;
@@ -464,19 +796,27 @@ public:
 
 class ExprStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::ExprStmt; }
     ExprStmt() = delete;
-    explicit ExprStmt(const Location& location, VariableDecl* varDecl) : Stmt(location), varDecl_(varDecl), stmt_(nullptr) {}
-    explicit ExprStmt(const Location& location, Stmt* stmt) : Stmt(location), varDecl_(nullptr), stmt_(stmt) {}
+    explicit ExprStmt(const Location& location, VariableDecl* varDecl)
+        : Stmt(location), varDecl_(varDecl), stmt_(nullptr), expr_(nullptr) {}
+    explicit ExprStmt(const Location& location, Stmt* stmt)
+        : Stmt(location), varDecl_(nullptr), stmt_(stmt), expr_(nullptr) {}
+    explicit ExprStmt(const Location& location, Expr* expr)
+        : Stmt(location), varDecl_(nullptr), stmt_(nullptr), expr_(expr) {}
     virtual ~ExprStmt() {
         if (varDecl_) delete varDecl_;
         if (stmt_) delete stmt_;
+        if (expr_) delete expr_;
     }
     VariableDecl* varDecl_;
     Stmt* stmt_;
+    Expr* expr_;
 };
 
 class ExprStmts : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::ExprStmts; }
     ExprStmts() = delete;
     explicit ExprStmts(const Location& location, const std::vector<ExprStmt*>& stmts):
         Stmt(location), stmts_(stmts) {}
@@ -494,6 +834,7 @@ public:
 //   ;
 class ForStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::ForStmt; }
     ForStmt() = delete;
     explicit ForStmt(const Location& location, ExprStmts* initializer, Expr* expr, ExprStmts* finalizer, Stmt* block):
         Stmt(location), initializer_(initializer), expr_(expr), finalizer_(finalizer), block_(block) {}
@@ -516,6 +857,7 @@ public:
 //   ;
 class ForeachStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::ForeachStmt; }
     ForeachStmt() = delete;
     explicit ForeachStmt(const Location& location, std::vector<std::string>& variables, Node* iterableObject, Stmt* block):
         Stmt(location), variables_(variables), iterableObject_(iterableObject), block_(block) {}
@@ -537,14 +879,15 @@ public:
 //    ;
 class IterableObject : public Node {
 public:
+    NodeKind Kind() const override { return NodeKind::IterableObject; }
     typedef typename std::pair<Node*, Node*> Element;
     IterableObject() = delete;
     explicit IterableObject(const Location& location, Node* primary):
         Node(location), primary_(primary) {}
     explicit IterableObject(const Location& location, const std::vector<Element>& elements):
-        Node(location), mapElements_(elements) {}
+        Node(location), primary_(nullptr), mapElements_(elements) {}
     explicit IterableObject(const Location& location, const std::vector<Node*>& elements):
-        Node(location), arrayElements_(elements) {}
+        Node(location), primary_(nullptr), arrayElements_(elements) {}
     virtual ~IterableObject() {
         if (primary_) delete primary_;
         for (auto item : mapElements_) {
@@ -565,6 +908,16 @@ public:
 //    ;
 class WhileStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::WhileStmt; }
+    WhileStmt() = delete;
+    explicit WhileStmt(const Location& location, Expr* conditionExpr, Stmt* block)
+        : Stmt(location), conditionExpr_(conditionExpr), block_(block) {}
+    virtual ~WhileStmt() {
+        if (conditionExpr_) delete conditionExpr_;
+        if (block_) delete block_;
+    }
+    Expr* conditionExpr_;
+    Stmt* block_;
 };
 
 // doStatement
@@ -572,13 +925,58 @@ public:
 //    ;
 class DoStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::DoStmt; }
+    DoStmt() = delete;
+    explicit DoStmt(const Location& location, Stmt* block, Expr* conditionExpr)
+        : Stmt(location), block_(block), conditionExpr_(conditionExpr) {}
+    virtual ~DoStmt() {
+        if (block_) delete block_;
+        if (conditionExpr_) delete conditionExpr_;
+    }
+    Stmt* block_;
+    Expr* conditionExpr_;
+};
+
+// switchCase
+//    : ('case' expression ':')+ statement*
+//    ;
+// defaultCase
+//    : 'default' ':' statement*
+//    ;
+// The default case has no expressions
+class CaseStmt : public Stmt {
+public:
+    NodeKind Kind() const override { return NodeKind::CaseStmt; }
+    CaseStmt() = delete;
+    explicit CaseStmt(const Location& location, const std::vector<Expr*>& exprs, Stmt* block)
+        : Stmt(location), exprs_(exprs), block_(block) {}
+    virtual ~CaseStmt() {
+        for (auto p : exprs_) delete p;
+        if (block_) delete block_;
+    }
+    std::vector<Expr*> exprs_;
+    Stmt* block_;
 };
 
 // switchStatement
-//    : 'switch' '(' expression ')' '{' switchCase*defaultCase? '}'
+//    : 'switch' '(' expression ')' '{' switchCase* defaultCase? '}'
 //    ;
+// A case does not fall through to the next one, break leaves the switch
 class SwitchStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::SwitchStmt; }
+    SwitchStmt() = delete;
+    explicit SwitchStmt(const Location& location, Expr* expr, const std::vector<CaseStmt*>& cases,
+            CaseStmt* defaultCase)
+        : Stmt(location), expr_(expr), cases_(cases), default_(defaultCase) {}
+    virtual ~SwitchStmt() {
+        if (expr_) delete expr_;
+        for (auto p : cases_) delete p;
+        if (default_) delete default_;
+    }
+    Expr* expr_;
+    std::vector<CaseStmt*> cases_;
+    CaseStmt* default_;
 };
 
 // returnStatement
@@ -586,6 +984,14 @@ public:
 //    ;
 class ReturnStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::ReturnStmt; }
+    ReturnStmt() = delete;
+    explicit ReturnStmt(const Location& location, const std::vector<Expr*>& exprs)
+        : Stmt(location), exprs_(exprs) {}
+    virtual ~ReturnStmt() {
+        for (auto p : exprs_) delete p;
+    }
+    std::vector<Expr*> exprs_;
 };
 
 // breakStatement
@@ -593,6 +999,9 @@ public:
 //    ;
 class BreakStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::BreakStmt; }
+    BreakStmt() = delete;
+    explicit BreakStmt(const Location& location) : Stmt(location) {}
 };
 
 // continueStatement
@@ -601,6 +1010,11 @@ public:
 //    ;
 class ContinueStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::ContinueStmt; }
+    ContinueStmt() = delete;
+    explicit ContinueStmt(const Location& location, const std::string& label)
+        : Stmt(location), labelName_(label) {}
+    std::string labelName_;
 };
 
 // assertStatement
@@ -608,28 +1022,65 @@ public:
 //    ;
 class AssertStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::AssertStmt; }
+    AssertStmt() = delete;
+    explicit AssertStmt(const Location& location, Expr* expr) : Stmt(location), expr_(expr) {}
+    virtual ~AssertStmt() {
+        if (expr_) delete expr_;
+    }
+    Expr* expr_;
 };
 
-// throwStatement
-//    : 'throw' expression ';'
+// deferStatement
+//    : 'defer' expression ';'
 //    ;
-class ThrowStmt : public Stmt {
+// The expression is a call, run when the function returns
+class DeferStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::DeferStmt; }
+    DeferStmt() = delete;
+    explicit DeferStmt(const Location& location, CallExpr* call) : Stmt(location), call_(call) {}
+    virtual ~DeferStmt() {
+        if (call_) delete call_;
+    }
+    CallExpr* call_;
 };
 
-
-// tryStatement
-//    : 'try' block catchParts? finallyPart?
+// throwStatement
+//    : 'throw' expression ';'
 //    ;
-class TryStmt : public Stmt {
+class ThrowStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::ThrowStmt; }
+    ThrowStmt() = delete;
+    explicit ThrowStmt(const Location& location, Expr* expr) : Stmt(location), expr_(expr) {}
+    virtual ~ThrowStmt() {
+        if (expr_) delete expr_;
+    }
+    Expr* expr_;
 };
 
 // catchPart
 //    : 'catch' '('catchType IDENTIFIER ')' block 
 //    ;
+// catchType
+//    : qualifiedName ( '|' qualifiedName)*
+//    ;
 class CatchStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::CatchStmt; }
+    CatchStmt() = delete;
+    explicit CatchStmt(const Location& location, const std::vector<Type*>& types, Identifier* name,
+            Stmt* block)
+        : Stmt(location), types_(types), name_(name), block_(block) {}
+    virtual ~CatchStmt() {
+        for (auto type : types_) delete type;
+        if (name_) delete name_;
+        if (block_) delete block_;
+    }
+    std::vector<Type*> types_;
+    Identifier* name_;
+    Stmt* block_;
 };
 
 // finallyPart
@@ -637,14 +1088,35 @@ public:
 //    ;
 class FinallyStmt : public Stmt {
 public:
+    NodeKind Kind() const override { return NodeKind::FinallyStmt; }
+    FinallyStmt() = delete;
+    explicit FinallyStmt(const Location& location, Stmt* block) : Stmt(location), block_(block) {}
+    virtual ~FinallyStmt() {
+        if (block_) delete block_;
+    }
+    Stmt* block_;
 };
 
-
-
-
-
-
-
+// tryStatement
+//    : 'try' block catchParts? finallyPart?
+//    ;
+// A try has at least a catch or a finally
+class TryStmt : public Stmt {
+public:
+    NodeKind Kind() const override { return NodeKind::TryStmt; }
+    TryStmt() = delete;
+    explicit TryStmt(const Location& location, Stmt* block, const std::vector<CatchStmt*>& catches,
+            FinallyStmt* finally)
+        : Stmt(location), block_(block), catches_(catches), finally_(finally) {}
+    virtual ~TryStmt() {
+        if (block_) delete block_;
+        for (auto p : catches_) delete p;
+        if (finally_) delete finally_;
+    }
+    Stmt* block_;
+    std::vector<CatchStmt*> catches_;
+    FinallyStmt* finally_;
+};
 
 } // namespacde ast
 } // namespace zl
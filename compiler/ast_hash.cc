@@ -0,0 +1,282 @@
+#include <map>
+#include <deque>
+#include "ast_hash.h"
+#include "hash.h"
+#include "thread_pool.h"
+
+namespace zl {
+
+namespace {
+
+// Hasher mix values into a 64 bits state, the mixing is order dependent
+class Hasher {
+public:
+    explicit Hasher(uint64_t seed): state_(seed * 0x9e3779b97f4a7c15ULL + 0x632be59bd9b4e019ULL) {}
+    void Mix(uint64_t v) {
+        state_ ^= v + 0x9e3779b97f4a7c15ULL + (state_ << 6) + (state_ >> 2);
+        state_ *= 0xff51afd7ed558ccdULL;
+        state_ ^= state_ >> 32;
+    }
+    void Mix(const std::string& s) {
+        Mix(HashBuffer(s.data(), s.size()).low);
+    }
+    uint64_t Value() const { return state_ ? state_ : 1; }
+private:
+    uint64_t state_;
+};
+
+// Hash of an absent optional child
+const uint64_t kNullHash = 0x5bd1e9955bd1e995ULL;
+
+} // namespace
+
+// Mix the node payload which is not a child node
+static void MixPayload(const ast::Node* node, Hasher& hasher) {
+    using namespace ast;
+    if (auto decl = dynamic_cast<const Decl*>(node); decl)
+        hasher.Mix(decl->IsPublic());
+
+    switch (node->Kind()) {
+        case NodeKind::Identifier:
+            hasher.Mix(static_cast<const Identifier*>(node)->name_);
+            break;
+        case NodeKind::QualifiedName:
+            for (auto& name : static_cast<const QualifiedName*>(node)->names_)
+                hasher.Mix(name);
+            break;
+        case NodeKind::PrimitiveType:
+            hasher.Mix(static_cast<const PrimitiveType*>(node)->name_);
+            break;
+        case NodeKind::LiteralExpr: {
+            auto literal = static_cast<const LiteralExpr*>(node);
+            hasher.Mix(literal->kind_);
+            hasher.Mix(literal->value_);
+            break;
+        }
+        case NodeKind::UnaryExpr:
+            hasher.Mix(static_cast<const UnaryExpr*>(node)->op_);
+            break;
+        case NodeKind::BinaryExpr:
+            hasher.Mix(static_cast<const BinaryExpr*>(node)->op_);
+            break;
+        case NodeKind::AssignStmt: {
+            auto stmt = static_cast<const AssignStmt*>(node);
+            hasher.Mix(stmt->op_);
+            hasher.Mix(stmt->lhs_.size());
+            break;
+        }
+        case NodeKind::FunctionDecl:
+            hasher.Mix(static_cast<const FunctionDecl*>(node)->isStatic_);
+            break;
+        case NodeKind::ClassBodyDecl:
+            hasher.Mix(static_cast<const ClassBodyDecl*>(node)->variables_.size());
+            break;
+        case NodeKind::LabelStmt:
+            hasher.Mix(static_cast<const LabelStmt*>(node)->labelName_);
+            break;
+        case NodeKind::ContinueStmt:
+            hasher.Mix(static_cast<const ContinueStmt*>(node)->labelName_);
+            break;
+        case NodeKind::ForeachStmt:
+            for (auto& name : static_cast<const ForeachStmt*>(node)->variables_)
+                hasher.Mix(name);
+            break;
+        case NodeKind::IterableObject: {
+            auto object = static_cast<const IterableObject*>(node);
+            hasher.Mix(object->primary_ != nullptr);
+            hasher.Mix(object->mapElements_.size());
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+uint64_t HashNode(ast::Node* node) {
+    Hasher hasher((uint64_t)node->Kind());
+    MixPayload(node, hasher);
+
+    std::vector<ast::Node*> children;
+    ast::CollectChildren(node, children);
+    hasher.Mix(children.size());
+    for (auto child : children)
+        hasher.Mix(child ? HashNode(child) : kNullHash);
+
+    node->SetStructuralHash(hasher.Value());
+    return hasher.Value();
+}
+
+uint64_t HashTree(const std::vector<ast::Node*>& decls, ThreadPool* pool) {
+    if (pool && decls.size() > 1)
+        pool->ParallelFor(decls.size(), [&decls](size_t i) { HashNode(decls[i]); });
+    else
+        for (auto decl : decls)
+            HashNode(decl);
+
+    Hasher hasher(0);
+    hasher.Mix(decls.size());
+    for (auto decl : decls)
+        hasher.Mix(decl->StructuralHash());
+    return hasher.Value();
+}
+
+const char* AstChangeKindName(AstChange::ChangeKind kind) {
+    switch (kind) {
+        case AstChange::Added: return "added";
+        case AstChange::Removed: return "removed";
+        case AstChange::Changed: return "changed";
+    }
+    return "";
+}
+
+static std::string NameOf(const ast::Identifier* identifier) {
+    return identifier ? identifier->name_ : "_";
+}
+
+static std::string JoinNames(const ast::QualifiedName* name) {
+    std::string result;
+    if (!name)
+        return "_";
+    for (auto& item : name->names_)
+        result += (result.empty() ? "" : ".") + item;
+    return result;
+}
+
+// Return the key a declaration is matched by
+static std::string DeclKey(const ast::Node* node) {
+    using namespace ast;
+    switch (node->Kind()) {
+        case NodeKind::PackageDecl:
+            return "package " + NameOf(static_cast<const PackageDecl*>(node)->name_);
+        case NodeKind::ImportDecl:
+            return "import " + JoinNames(static_cast<const ImportDecl*>(node)->name_);
+        case NodeKind::UsingDecl:
+            return "using " + JoinNames(static_cast<const UsingDecl*>(node)->qualifiedName_);
+        case NodeKind::VariableDecl:
+            return "var " + NameOf(static_cast<const VariableDecl*>(node)->name_);
+        case NodeKind::VariableBlockDecl: {
+            std::string names;
+            for (auto item : static_cast<const VariableBlockDecl*>(node)->variables_)
+                names += (names.empty() ? "" : ", ") + NameOf(item->name_);
+            return "var (" + names + ")";
+        }
+        case NodeKind::ConstDecl:
+            return "const " + NameOf(static_cast<const ConstDecl*>(node)->name_);
+        case NodeKind::ConstBlockDecl: {
+            std::string names;
+            for (auto item : static_cast<const ConstBlockDecl*>(node)->fields_)
+                names += (names.empty() ? "" : ", ") + NameOf(item->name_);
+            return "const (" + names + ")";
+        }
+        case NodeKind::FunctionDecl:
+            return "func " + NameOf(static_cast<const FunctionDecl*>(node)->name_);
+        case NodeKind::ClassDecl:
+            return "class " + NameOf(static_cast<const ClassDecl*>(node)->name_);
+        case NodeKind::InterfaceDecl:
+            return "interface " + NameOf(static_cast<const InterfaceDecl*>(node)->name_);
+        default:
+            return NodeKindName(node->Kind());
+    }
+}
+
+typedef std::vector<std::pair<std::string, ast::Node*>> NamedNodes;
+
+static uint64_t HashOf(const ast::Node* node) {
+    return node ? node->StructuralHash() : kNullHash;
+}
+
+// Return the members of class or interface with their names
+static NamedNodes MembersOf(const ast::Node* node, const std::string& prefix) {
+    using namespace ast;
+    NamedNodes members;
+    if (node->Kind() == NodeKind::ClassDecl) {
+        auto body = static_cast<const ClassDecl*>(node)->classBody_;
+        if (!body)
+            return members;
+        for (auto variable : body->variables_)
+            members.push_back({prefix + "." + NameOf(variable->name_), variable});
+        for (auto function : body->functions_)
+            members.push_back({prefix + "." + NameOf(function->name_) + "()", function});
+    } else if (node->Kind() == NodeKind::InterfaceDecl) {
+        for (auto method : static_cast<const InterfaceDecl*>(node)->methods_)
+            members.push_back({prefix + "." + NameOf(method->name_) + "()", method});
+    }
+    return members;
+}
+
+// Return true if the parts of class or interface other than the members
+// are changed
+static bool HeaderChanged(const ast::Node* oldNode, const ast::Node* newNode) {
+    using namespace ast;
+    auto oldDecl = static_cast<const Decl*>(oldNode);
+    auto newDecl = static_cast<const Decl*>(newNode);
+    if (oldDecl->IsPublic() != newDecl->IsPublic())
+        return true;
+    if (oldNode->Kind() == NodeKind::ClassDecl) {
+        return HashOf(static_cast<const ClassDecl*>(oldNode)->interfaceList_) !=
+            HashOf(static_cast<const ClassDecl*>(newNode)->interfaceList_);
+    }
+    return false;
+}
+
+static void DiffNamed(const NamedNodes& oldNodes, const NamedNodes& newNodes,
+        std::vector<AstChange>& changes);
+
+// Compare two matched declarations whose hashes differ
+static void DiffMatched(const std::string& name, ast::Node* oldNode, ast::Node* newNode,
+        std::vector<AstChange>& changes) {
+    auto kind = newNode->Kind();
+    if (kind != ast::NodeKind::ClassDecl && kind != ast::NodeKind::InterfaceDecl) {
+        changes.push_back({AstChange::Changed, name, oldNode, newNode});
+        return;
+    }
+    size_t count = changes.size();
+    if (HeaderChanged(oldNode, newNode))
+        changes.push_back({AstChange::Changed, name, oldNode, newNode});
+    DiffNamed(MembersOf(oldNode, name), MembersOf(newNode, name), changes);
+    // The member order is changed only
+    if (changes.size() == count)
+        changes.push_back({AstChange::Changed, name, oldNode, newNode});
+}
+
+static void DiffNamed(const NamedNodes& oldNodes, const NamedNodes& newNodes,
+        std::vector<AstChange>& changes) {
+    // Declarations with same name are matched in source order
+    std::map<std::string, std::deque<ast::Node*>> candidates;
+    for (auto& item : oldNodes)
+        candidates[item.first].push_back(item.second);
+
+    for (auto& item : newNodes) {
+        auto iter = candidates.find(item.first);
+        if (iter == candidates.end() || iter->second.empty()) {
+            changes.push_back({AstChange::Added, item.first, nullptr, item.second});
+            continue;
+        }
+        ast::Node* oldNode = iter->second.front();
+        iter->second.pop_front();
+        if (oldNode->StructuralHash() != item.second->StructuralHash())
+            DiffMatched(item.first, oldNode, item.second, changes);
+    }
+    for (auto& item : oldNodes) {
+        auto& remain = candidates[item.first];
+        if (!remain.empty() && remain.front() == item.second) {
+            changes.push_back({AstChange::Removed, item.first, item.second, nullptr});
+            remain.pop_front();
+        }
+    }
+}
+
+std::vector<AstChange> DiffTrees(const std::vector<ast::Node*>& oldDecls,
+        const std::vector<ast::Node*>& newDecls) {
+    NamedNodes oldNodes, newNodes;
+    for (auto decl : oldDecls)
+        oldNodes.push_back({DeclKey(decl), decl});
+    for (auto decl : newDecls)
+        newNodes.push_back({DeclKey(decl), decl});
+
+    std::vector<AstChange> changes;
+    DiffNamed(oldNodes, newNodes, changes);
+    return changes;
+}
+
+} // namespace zl
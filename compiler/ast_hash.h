@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ast.h"
+
+namespace zl {
+
+class ThreadPool;
+
+// The structural hash of a node is computed bottom up from its kind, names,
+// literal values, operators and the hashes of its children. Locations are
+// excluded, so whitespace and comment changes never change a hash, and two
+// subtrees with the same hash are equal with very high probability.
+
+// HashNode compute the structural hash of every node in the subtree in one
+// post-order pass, store them in the nodes and return the root hash
+uint64_t HashNode(ast::Node* node);
+
+// HashTree hash all declarations of one compilation unit, in parallel across
+// top level declarations if pool is given, and return the combined hash
+uint64_t HashTree(const std::vector<ast::Node*>& decls, ThreadPool* pool = nullptr);
+
+// AstChange is one changed declaration between two versions of a compilation
+// unit
+struct AstChange {
+    enum ChangeKind { Added, Removed, Changed };
+    ChangeKind kind;
+    // Declaration name such as 'class Shape' or 'class Shape.Draw()'
+    std::string name;
+    ast::Node* oldNode;
+    ast::Node* newNode;
+};
+
+// Return the change kind string, 'added', 'removed' or 'changed'
+const char* AstChangeKindName(AstChange::ChangeKind kind);
+
+// DiffTrees compare two hashed compilation units top down. Declarations are
+// matched by kind and name, equal hashes prune whole subtrees, and changed
+// classes and interfaces are diffed again by member, so the work is
+// proportional to the changed declarations.
+std::vector<AstChange> DiffTrees(const std::vector<ast::Node*>& oldDecls,
+        const std::vector<ast::Node*>& newDecls);
+
+} // namespace zl
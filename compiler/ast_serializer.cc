@@ -0,0 +1,601 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include "ast_serializer.h"
+#include "thread_pool.h"
+#include "xml_builder.h"
+
+namespace zl {
+
+namespace {
+
+const size_t kBufferSize = 64 * 1024;
+// Number of declarations dumped in parallel per worker before their chunks
+// are written, it bounds the memory held by chunks
+const size_t kDeclsPerWorker = 64;
+
+// Control characters, quote and backslash are escaped in json strings
+EscapeTable BuildJsonEscapes() {
+    static const char digits[] = "0123456789abcdef";
+    EscapeTable table;
+    for (int c = 0; c < 32; c++)
+        table.replacement[c] = std::string("\\u00") + digits[c >> 4] + digits[c & 15];
+    table.replacement['\n'] = "\\n";
+    table.replacement['\t'] = "\\t";
+    table.replacement['\r'] = "\\r";
+    table.replacement['"'] = "\\\"";
+    table.replacement['\\'] = "\\\\";
+    return table;
+}
+const EscapeTable jsonEscapes = BuildJsonEscapes();
+
+} // namespace
+
+bool ParseDumpFormat(const std::string& name, DumpFormat& format) {
+    if (name == "xml")
+        format = DumpFormat::Xml;
+    else if (name == "jsonl")
+        format = DumpFormat::Jsonl;
+    else if (name == "bin")
+        format = DumpFormat::Binary;
+    else
+        return false;
+    return true;
+}
+
+void XmlFileWriter::write(const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0 && !failed_) {
+        ssize_t written = ::write(fd_, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            failed_ = true;
+            break;
+        }
+        bytes += written;
+        size -= written;
+    }
+}
+
+void XmlFileWriter::WriteVector(const struct iovec* buffers, size_t count) {
+    std::vector<struct iovec> pending(buffers, buffers + count);
+    size_t first = 0;
+    while (first < pending.size() && !failed_) {
+        int batch = static_cast<int>(std::min<size_t>(pending.size() - first, IOV_MAX));
+        ssize_t written = ::writev(fd_, &pending[first], batch);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            failed_ = true;
+            break;
+        }
+        // Skip the buffers written, a partially written one is adjusted
+        while (first < pending.size() && static_cast<size_t>(written) >= pending[first].iov_len) {
+            written -= pending[first].iov_len;
+            first++;
+        }
+        if (first < pending.size()) {
+            pending[first].iov_base = static_cast<char*>(pending[first].iov_base) + written;
+            pending[first].iov_len -= written;
+        }
+    }
+}
+
+AstSerializer::AstSerializer(const std::string& filePath)
+    : writer_(nullptr), fd_(open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+    buffer_(kBufferSize), used_(0) {
+    if (fd_ < 0)
+        throw std::invalid_argument("can not create dump file " + filePath);
+    fileWriter_.reset(new XmlFileWriter(fd_));
+    writer_ = fileWriter_.get();
+}
+
+AstSerializer::AstSerializer(pugi::xml_writer& writer)
+    : writer_(&writer), fd_(-1), buffer_(kBufferSize), used_(0) {}
+
+AstSerializer::AstSerializer(ChunkTag): writer_(nullptr), fd_(-1), used_(0) {}
+
+AstSerializer::~AstSerializer() {
+    Flush();
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+bool AstSerializer::Good() const {
+    return !fileWriter_ || !fileWriter_->Failed();
+}
+
+void AstSerializer::Flush() {
+    if (used_ > 0 && writer_) {
+        writer_->write(buffer_.data(), used_);
+        used_ = 0;
+    }
+}
+
+void AstSerializer::Write(const char* data, size_t size) {
+    if (used_ + size > buffer_.size()) {
+        if (!writer_) {
+            buffer_.resize(std::max(buffer_.size() * 2, std::max(used_ + size, kBufferSize / 16)));
+        } else {
+            Flush();
+            if (size > buffer_.size()) {
+                writer_->write(data, size);
+                return;
+            }
+        }
+    }
+    memcpy(buffer_.data() + used_, data, size);
+    used_ += size;
+}
+
+void AstSerializer::Write(const char* text) {
+    Write(text, strlen(text));
+}
+
+void AstSerializer::WriteEscaped(const std::string& value, const EscapeTable& table) {
+    const char* begin = value.data();
+    const char* end = begin + value.size();
+    while (begin < end) {
+        const char* run = begin;
+        while (run < end && table.replacement[static_cast<unsigned char>(*run)].empty())
+            run++;
+        Write(begin, run - begin);
+        if (run == end)
+            break;
+        auto& replacement = table.replacement[static_cast<unsigned char>(*run)];
+        Write(replacement.data(), replacement.size());
+        begin = run + 1;
+    }
+}
+
+AstSerializer::Attributes& AstSerializer::CollectAttributes(const ast::Node* node, size_t depth) {
+    using namespace ast;
+    if (attributes_.size() <= depth)
+        attributes_.resize(depth + 1);
+    auto& attributes = attributes_[depth];
+    size_t count = 0;
+    auto add = [&attributes, &count](const char* name, const std::string& value) {
+        if (count == attributes.size())
+            attributes.emplace_back();
+        attributes[count].first = name;
+        attributes[count].second.assign(value);
+        count++;
+    };
+
+    add("line", std::to_string(const_cast<Node*>(node)->Pos().GetLineno()));
+    if (auto decl = dynamic_cast<const Decl*>(node))
+        add("public", decl->IsPublic() ? "true" : "false");
+
+    switch (node->Kind()) {
+        case NodeKind::Identifier:
+            add("name", static_cast<const Identifier*>(node)->name_);
+            break;
+        case NodeKind::QualifiedName: {
+            std::string name;
+            for (auto& item : static_cast<const QualifiedName*>(node)->names_)
+                name += (name.empty() ? "" : ".") + item;
+            add("name", name);
+            break;
+        }
+        case NodeKind::Comment:
+            add("text", static_cast<const Comment*>(node)->text_);
+            break;
+        case NodeKind::PrimitiveType:
+            add("name", static_cast<const PrimitiveType*>(node)->name_);
+            break;
+        case NodeKind::LiteralExpr: {
+            auto literal = static_cast<const LiteralExpr*>(node);
+            add("kind", TokenTypeString(literal->kind_));
+            add("value", literal->value_);
+            break;
+        }
+        case NodeKind::UnaryExpr:
+            add("op", TokenTypeString(static_cast<const UnaryExpr*>(node)->op_));
+            break;
+        case NodeKind::BinaryExpr:
+            add("op", TokenTypeString(static_cast<const BinaryExpr*>(node)->op_));
+            break;
+        case NodeKind::AssignStmt: {
+            auto stmt = static_cast<const AssignStmt*>(node);
+            add("op", TokenTypeString(stmt->op_));
+            add("lhs", std::to_string(stmt->lhs_.size()));
+            break;
+        }
+        case NodeKind::FunctionDecl:
+            add("static", static_cast<const FunctionDecl*>(node)->isStatic_ ? "true" : "false");
+            break;
+        case NodeKind::ClassBodyDecl:
+            add("variables", std::to_string(static_cast<const ClassBodyDecl*>(node)->variables_.size()));
+            break;
+        case NodeKind::LabelStmt:
+            add("label", static_cast<const LabelStmt*>(node)->labelName_);
+            break;
+        case NodeKind::ContinueStmt:
+            add("label", static_cast<const ContinueStmt*>(node)->labelName_);
+            break;
+        case NodeKind::ForeachStmt: {
+            std::string variables;
+            for (auto& item : static_cast<const ForeachStmt*>(node)->variables_)
+                variables += (variables.empty() ? "" : ",") + item;
+            add("variables", variables);
+            break;
+        }
+        case NodeKind::IterableObject: {
+            auto object = static_cast<const IterableObject*>(node);
+            add("form", object->primary_ ? "primary" : object->mapElements_.empty() ? "array" : "map");
+            break;
+        }
+        default:
+            break;
+    }
+    attributes.resize(count);
+    return attributes;
+}
+
+std::vector<ast::Node*>& AstSerializer::CollectChildren(const ast::Node* node, size_t depth) {
+    if (children_.size() <= depth)
+        children_.resize(depth + 1);
+    auto& children = children_[depth];
+    children.clear();
+    ast::CollectChildren(node, children);
+    return children;
+}
+
+void AstSerializer::WriteNode(const ast::Node* node, size_t depth) {
+    if (!node) {
+        WriteNull(depth);
+        return;
+    }
+    auto& attributes = CollectAttributes(node, depth);
+    size_t children = CollectChildren(node, depth).size();
+    WriteNodeStart(node, attributes, children, depth);
+    // Deeper calls may reallocate children_, but not the vector of this depth
+    for (size_t i = 0; i < children; i++)
+        WriteNode(children_[depth][i], depth + 1);
+    WriteNodeEnd(node, children, depth);
+}
+
+void AstSerializer::Serialize(const std::vector<SourceFile>& files) {
+    WriteDocumentStart(files.size());
+    for (auto& file : files) {
+        for (size_t i = 0; i < std::max<size_t>(file.decls.size(), 1); i++)
+            WriteFileDecl(file, i);
+    }
+    WriteDocumentEnd(files.size());
+    Flush();
+}
+
+void AstSerializer::Serialize(const std::vector<SourceFile>& files, ThreadPool& pool) {
+    WriteDocumentStart(files.size());
+    Flush();
+
+    // Every declaration, and every empty file, is one item
+    std::vector<std::pair<const SourceFile*, size_t>> items;
+    for (auto& file : files) {
+        for (size_t i = 0; i < std::max<size_t>(file.decls.size(), 1); i++)
+            items.push_back({&file, i});
+    }
+    // One chunk serializer per worker and one for the calling thread, so the
+    // scratch vectors and chunk capacity are reused
+    std::vector<std::unique_ptr<AstSerializer>> serializers(pool.Size() + 1);
+    size_t window = kDeclsPerWorker * (pool.Size() + 1);
+    std::vector<std::vector<char>> chunks;
+    for (size_t first = 0; first < items.size(); first += window) {
+        size_t count = std::min(window, items.size() - first);
+        chunks.resize(count);
+        pool.ParallelFor(count, [&](size_t i) {
+            auto& serializer = serializers[pool.CurrentWorker()];
+            if (!serializer)
+                serializer.reset(NewChunkSerializer());
+            serializer->WriteFileDecl(*items[first + i].first, items[first + i].second);
+            chunks[i] = serializer->TakeChunk();
+        });
+        WriteChunks(chunks);
+    }
+    WriteDocumentEnd(files.size());
+    Flush();
+}
+
+void AstSerializer::WriteFileDecl(const SourceFile& file, size_t index) {
+    if (index == 0)
+        WriteFileStart(file);
+    if (index < file.decls.size()) {
+        WriteDeclStart(file);
+        WriteNode(file.decls[index], 2);
+        WriteDeclEnd(file);
+    }
+    if (index + 1 >= file.decls.size())
+        WriteFileEnd(file);
+}
+
+std::vector<char> AstSerializer::TakeChunk() {
+    // The next chunk starts with the capacity of this one
+    std::vector<char> chunk(buffer_.size());
+    chunk.swap(buffer_);
+    chunk.resize(used_);
+    used_ = 0;
+    return chunk;
+}
+
+void AstSerializer::WriteChunks(const std::vector<std::vector<char>>& chunks) {
+    auto fileWriter = dynamic_cast<XmlFileWriter*>(writer_);
+    if (!fileWriter) {
+        for (auto& chunk : chunks)
+            writer_->write(chunk.data(), chunk.size());
+        return;
+    }
+    std::vector<struct iovec> buffers(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++) {
+        buffers[i].iov_base = const_cast<char*>(chunks[i].data());
+        buffers[i].iov_len = chunks[i].size();
+    }
+    fileWriter->WriteVector(buffers.data(), buffers.size());
+}
+
+void JsonlSerializer::WriteString(const std::string& value) {
+    Write("\"", 1);
+    WriteEscaped(value, jsonEscapes);
+    Write("\"", 1);
+}
+
+void JsonlSerializer::WriteSeparator(size_t depth) {
+    if (separated_.size() <= depth + 1)
+        separated_.resize(depth + 2, false);
+    if (separated_[depth])
+        Write(",", 1);
+    separated_[depth] = true;
+}
+
+void JsonlSerializer::WriteFileStart(const SourceFile& file) {
+    if (file.decls.empty()) {
+        Write("{\"file\":", 8);
+        WriteString(file.path);
+        Write("}\n", 2);
+    }
+}
+
+void JsonlSerializer::WriteFileEnd(const SourceFile& file) {}
+
+void JsonlSerializer::WriteDeclStart(const SourceFile& file) {
+    Write("{\"file\":", 8);
+    WriteString(file.path);
+    Write(",\"decl\":", 8);
+    if (separated_.size() <= 2)
+        separated_.resize(3, false);
+    separated_[2] = false;
+}
+
+void JsonlSerializer::WriteDeclEnd(const SourceFile& file) {
+    Write("}\n", 2);
+}
+
+void JsonlSerializer::WriteNodeStart(const ast::Node* node, const Attributes& attributes,
+        size_t children, size_t depth) {
+    WriteSeparator(depth);
+    Write("{\"node\":\"", 9);
+    Write(ast::NodeKindName(node->Kind()));
+    Write("\"", 1);
+    for (auto& attribute : attributes) {
+        Write(",\"", 2);
+        Write(attribute.first);
+        Write("\":", 2);
+        WriteString(attribute.second);
+    }
+    if (children > 0) {
+        Write(",\"children\":[", 13);
+        separated_[depth + 1] = false;
+    }
+}
+
+void JsonlSerializer::WriteNodeEnd(const ast::Node* node, size_t children, size_t depth) {
+    if (children > 0)
+        Write("]}", 2);
+    else
+        Write("}", 1);
+}
+
+void JsonlSerializer::WriteNull(size_t depth) {
+    WriteSeparator(depth);
+    Write("null", 4);
+}
+
+AstSerializer* JsonlSerializer::NewChunkSerializer() const {
+    return new JsonlSerializer(ChunkTag());
+}
+
+const char BinarySerializer::kMagic[5] = {'Z', 'L', 'A', 'S', 'T'};
+
+void BinarySerializer::WriteVarint(uint64_t value) {
+    char bytes[10];
+    size_t size = 0;
+    while (value >= 0x80) {
+        bytes[size++] = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = static_cast<char>(value);
+    Write(bytes, size);
+}
+
+void BinarySerializer::WriteName(const char* name) {
+    // Names are the string literals of CollectAttributes, a few distinct
+    // pointers, so they are searched linearly
+    for (size_t i = 0; i < names_.size(); i++) {
+        if (names_[i] == name) {
+            WriteVarint(i + 1);
+            return;
+        }
+    }
+    names_.push_back(name);
+    size_t size = strlen(name);
+    WriteVarint(0);
+    WriteVarint(size);
+    Write(name, size);
+}
+
+void BinarySerializer::WriteDocumentStart(size_t files) {
+    Write(kMagic, sizeof(kMagic));
+    WriteVarint(kVersion);
+    WriteVarint(files);
+}
+
+void BinarySerializer::WriteFileStart(const SourceFile& file) {
+    WriteVarint(file.path.size());
+    Write(file.path.data(), file.path.size());
+    WriteVarint(file.decls.size());
+}
+
+void BinarySerializer::WriteDeclStart(const SourceFile& file) {
+    names_.clear();
+}
+
+void BinarySerializer::WriteNodeStart(const ast::Node* node, const Attributes& attributes,
+        size_t children, size_t depth) {
+    WriteVarint(static_cast<uint64_t>(node->Kind()) + 1);
+    WriteVarint(attributes.size());
+    for (auto& attribute : attributes) {
+        WriteName(attribute.first);
+        WriteVarint(attribute.second.size());
+        Write(attribute.second.data(), attribute.second.size());
+    }
+    WriteVarint(children);
+}
+
+void BinarySerializer::WriteNull(size_t depth) {
+    WriteVarint(0);
+}
+
+AstSerializer* BinarySerializer::NewChunkSerializer() const {
+    return new BinarySerializer(ChunkTag());
+}
+
+std::unique_ptr<AstSerializer> NewAstSerializer(DumpFormat format, pugi::xml_writer& writer) {
+    switch (format) {
+        case DumpFormat::Jsonl:
+            return std::unique_ptr<AstSerializer>(new JsonlSerializer(writer));
+        case DumpFormat::Binary:
+            return std::unique_ptr<AstSerializer>(new BinarySerializer(writer));
+        default:
+            return std::unique_ptr<AstSerializer>(new XmlBuilder(writer));
+    }
+}
+
+std::unique_ptr<AstSerializer> NewAstSerializer(DumpFormat format, const std::string& filePath) {
+    switch (format) {
+        case DumpFormat::Jsonl:
+            return std::unique_ptr<AstSerializer>(new JsonlSerializer(filePath));
+        case DumpFormat::Binary:
+            return std::unique_ptr<AstSerializer>(new BinarySerializer(filePath));
+        default:
+            return std::unique_ptr<AstSerializer>(new XmlBuilder(filePath));
+    }
+}
+
+namespace {
+
+// BinaryReader decode the varints and strings of a binary dump
+class BinaryReader {
+public:
+    BinaryReader(const char* data, size_t size)
+        : data_(reinterpret_cast<const uint8_t*>(data)), end_(data_ + size) {}
+    bool Varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && data_ < end_; shift += 7) {
+            uint8_t byte = *data_++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+    bool Bytes(uint64_t size, const char*& bytes) {
+        if (size > static_cast<uint64_t>(end_ - data_))
+            return false;
+        bytes = reinterpret_cast<const char*>(data_);
+        data_ += size;
+        return true;
+    }
+    bool AtEnd() const { return data_ == end_; }
+private:
+    const uint8_t* data_;
+    const uint8_t* end_;
+};
+
+} // namespace
+
+bool ReadBinaryAst(const char* data, size_t size, AstDumpSummary& summary) {
+    BinaryReader reader(data, size);
+    const char* magic;
+    uint64_t version, files;
+    if (!reader.Bytes(sizeof(BinarySerializer::kMagic), magic) ||
+            memcmp(magic, BinarySerializer::kMagic, sizeof(BinarySerializer::kMagic)) != 0 ||
+            !reader.Varint(version) || version != BinarySerializer::kVersion ||
+            !reader.Varint(files))
+        return false;
+
+    // Names of current declaration, and the number of children left of each
+    // node on the path
+    std::vector<std::pair<const char*, uint64_t>> names;
+    std::vector<uint64_t> remaining;
+    auto readAttribute = [&reader, &names]() {
+        uint64_t ref, length;
+        const char* bytes;
+        if (!reader.Varint(ref))
+            return false;
+        if (ref > names.size())
+            return false;
+        if (ref == 0) {
+            if (!reader.Varint(length) || !reader.Bytes(length, bytes))
+                return false;
+            names.push_back({bytes, length});
+        }
+        return reader.Varint(length) && reader.Bytes(length, bytes);
+    };
+
+    for (uint64_t file = 0; file < files; file++) {
+        uint64_t length, decls;
+        const char* path;
+        if (!reader.Varint(length) || !reader.Bytes(length, path) || !reader.Varint(decls))
+            return false;
+        summary.files++;
+        for (uint64_t decl = 0; decl < decls; decl++) {
+            names.clear();
+            remaining.assign(1, 1);
+            while (!remaining.empty()) {
+                if (remaining.back() == 0) {
+                    remaining.pop_back();
+                    continue;
+                }
+                remaining.back()--;
+                uint64_t kind, attributes, children;
+                if (!reader.Varint(kind))
+                    return false;
+                if (kind == 0) {
+                    summary.nulls++;
+                    continue;
+                }
+                if (kind - 1 >= static_cast<uint64_t>(ast::NodeKind::kCount) ||
+                        !reader.Varint(attributes))
+                    return false;
+                for (uint64_t i = 0; i < attributes; i++) {
+                    if (!readAttribute())
+                        return false;
+                }
+                if (!reader.Varint(children))
+                    return false;
+                summary.nodes++;
+                summary.attributes += attributes;
+                remaining.push_back(children);
+            }
+            summary.decls++;
+        }
+    }
+    return reader.AtEnd();
+}
+
+} // namespace zl
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "pugixml.hpp"
+#include "ast.h"
+#include "frontend.h"
+
+struct iovec;
+
+namespace zl {
+
+class ThreadPool;
+
+// XmlFileWriter is a pugi::xml_writer writing to a file descriptor, it does
+// no buffering since both AstSerializer and pugixml buffer their output. It is
+// the sink of every dump format.
+class XmlFileWriter : public pugi::xml_writer {
+public:
+    // The descriptor is not closed by the writer
+    explicit XmlFileWriter(int fd): fd_(fd), failed_(false) {}
+    void write(const void* data, size_t size) override;
+    // Write the buffers with as few writev calls as possible
+    void WriteVector(const struct iovec* buffers, size_t count);
+    bool Failed() const { return failed_; }
+private:
+    XmlFileWriter() = delete;
+    int fd_;
+    bool failed_;
+};
+
+// DumpFormat is the format of syntax tree dump
+enum class DumpFormat {
+    Xml,
+    // One json object per line for each top-level declaration
+    Jsonl,
+    // Varint encoded preorder stream, see BinarySerializer
+    Binary,
+};
+
+// Parse the format name used on command line, xml, jsonl or bin
+bool ParseDumpFormat(const std::string& name, DumpFormat& format);
+
+// EscapeTable map the characters to escape to their replacements, the
+// replacement is empty for characters written as they are
+struct EscapeTable {
+    std::string replacement[256];
+};
+
+// AstSerializer dump the syntax trees of source files in one preorder
+// traversal. The traversal, the output buffering and the parallel dump are
+// the same for all formats, a format only implements the Write* hooks.
+//
+// Output is written into a fixed size buffer which is flushed to the writer.
+// With a thread pool each top-level declaration is written into a chunk of
+// its own by the worker running it, and the chunks are written in source
+// order, so the output is the same as the one written by one thread. Every
+// format must therefore write a declaration without depending on the ones
+// before it.
+class AstSerializer {
+public:
+    // Write the dump into the file, it throws std::invalid_argument if the
+    // file can not be created
+    explicit AstSerializer(const std::string& filePath);
+    explicit AstSerializer(pugi::xml_writer& writer);
+    virtual ~AstSerializer();
+
+    void Serialize(const std::vector<SourceFile>& files);
+    void Serialize(const std::vector<SourceFile>& files, ThreadPool& pool);
+    // Flush buffered output to the writer
+    void Flush();
+    // Return false if writing to the file failed
+    bool Good() const;
+
+protected:
+    typedef std::vector<std::pair<const char*, std::string>> Attributes;
+
+    // A serializer writing into a chunk which grows as needed and is never
+    // flushed, see TakeChunk
+    struct ChunkTag {};
+    explicit AstSerializer(ChunkTag);
+
+    // Hooks of the format. Declarations are at depth 2, the node of depth
+    // is null if the optional child is absent.
+    virtual void WriteDocumentStart(size_t files) = 0;
+    virtual void WriteDocumentEnd(size_t files) = 0;
+    virtual void WriteFileStart(const SourceFile& file) = 0;
+    virtual void WriteFileEnd(const SourceFile& file) = 0;
+    virtual void WriteDeclStart(const SourceFile& file) {}
+    virtual void WriteDeclEnd(const SourceFile& file) {}
+    virtual void WriteNodeStart(const ast::Node* node, const Attributes& attributes,
+            size_t children, size_t depth) = 0;
+    virtual void WriteNodeEnd(const ast::Node* node, size_t children, size_t depth) = 0;
+    virtual void WriteNull(size_t depth) = 0;
+    // Create a chunk serializer of the same format
+    virtual AstSerializer* NewChunkSerializer() const = 0;
+
+    void WriteNode(const ast::Node* node, size_t depth);
+    void Write(const char* data, size_t size);
+    void Write(const char* text);
+    // Write the value escaped, runs of characters which need no escaping are
+    // written at once
+    void WriteEscaped(const std::string& value, const EscapeTable& table);
+    // Collect the attributes of the node into attributes_[depth], the
+    // vectors are reused so the strings keep their capacity
+    Attributes& CollectAttributes(const ast::Node* node, size_t depth);
+    std::vector<ast::Node*>& CollectChildren(const ast::Node* node, size_t depth);
+
+    // The writer is nullptr for chunk serializers
+    pugi::xml_writer* writer_;
+    // Scratch vectors of each depth of the traversal
+    std::vector<Attributes> attributes_;
+    std::vector<std::vector<ast::Node*>> children_;
+
+private:
+    AstSerializer() = delete;
+    AstSerializer(const AstSerializer&) = delete;
+    AstSerializer& operator = (const AstSerializer&) = delete;
+
+    // Write the declaration of the file, the file start and end are written
+    // if it is the first or the last declaration of the file. An empty file
+    // has no declaration.
+    void WriteFileDecl(const SourceFile& file, size_t index);
+    // Return the bytes written since the last call
+    std::vector<char> TakeChunk();
+    // Write the chunks in order to the writer, the buffer must be flushed
+    void WriteChunks(const std::vector<std::vector<char>>& chunks);
+
+private:
+    int fd_;
+    std::unique_ptr<XmlFileWriter> fileWriter_;
+    std::vector<char> buffer_;
+    size_t used_;
+};
+
+// JsonlSerializer write one json object per line for each top-level
+// declaration, {"file":"a.zl","decl":NODE}, and {"file":"a.zl"} for a file
+// without declarations. A node is {"node":"ClassDecl","line":"2",...} with
+// its attributes as string members and "children" holding the child nodes,
+// absent children are null.
+class JsonlSerializer : public AstSerializer {
+public:
+    explicit JsonlSerializer(const std::string& filePath): AstSerializer(filePath) {}
+    explicit JsonlSerializer(pugi::xml_writer& writer): AstSerializer(writer) {}
+
+protected:
+    void WriteDocumentStart(size_t files) override {}
+    void WriteDocumentEnd(size_t files) override {}
+    void WriteFileStart(const SourceFile& file) override;
+    void WriteFileEnd(const SourceFile& file) override;
+    void WriteDeclStart(const SourceFile& file) override;
+    void WriteDeclEnd(const SourceFile& file) override;
+    void WriteNodeStart(const ast::Node* node, const Attributes& attributes,
+            size_t children, size_t depth) override;
+    void WriteNodeEnd(const ast::Node* node, size_t children, size_t depth) override;
+    void WriteNull(size_t depth) override;
+    AstSerializer* NewChunkSerializer() const override;
+
+private:
+    explicit JsonlSerializer(ChunkTag tag): AstSerializer(tag) {}
+    void WriteString(const std::string& value);
+    // Write a comma if the node is not the first child
+    void WriteSeparator(size_t depth);
+
+private:
+    // Whether a node was written at each depth of current parent
+    std::vector<bool> separated_;
+};
+
+// BinarySerializer write a varint encoded preorder stream:
+//
+//   document: "ZLAST" version files file*
+//   file:     path decls node*
+//   node:     0 for absent node
+//           | kind+1 attributes (name value)* children node*
+//
+// where numbers are unsigned LEB128 varints and kind is ast::NodeKind. The
+// path and values are a length followed by bytes. A name is 0, a length and
+// bytes for a new name, or index+1 of a name seen before in the same
+// top-level declaration, so that each declaration may be decoded alone.
+class BinarySerializer : public AstSerializer {
+public:
+    static const char kMagic[5];
+    static const uint64_t kVersion = 1;
+
+    explicit BinarySerializer(const std::string& filePath): AstSerializer(filePath) {}
+    explicit BinarySerializer(pugi::xml_writer& writer): AstSerializer(writer) {}
+
+protected:
+    void WriteDocumentStart(size_t files) override;
+    void WriteDocumentEnd(size_t files) override {}
+    void WriteFileStart(const SourceFile& file) override;
+    void WriteFileEnd(const SourceFile& file) override {}
+    void WriteDeclStart(const SourceFile& file) override;
+    void WriteNodeStart(const ast::Node* node, const Attributes& attributes,
+            size_t children, size_t depth) override;
+    void WriteNodeEnd(const ast::Node* node, size_t children, size_t depth) override {}
+    void WriteNull(size_t depth) override;
+    AstSerializer* NewChunkSerializer() const override;
+
+private:
+    explicit BinarySerializer(ChunkTag tag): AstSerializer(tag) {}
+    void WriteVarint(uint64_t value);
+    void WriteName(const char* name);
+
+private:
+    // Attribute names written in current declaration
+    std::vector<const char*> names_;
+};
+
+// Create the serializer of the format writing into the writer or the file,
+// the latter throws std::invalid_argument if the file can not be created
+std::unique_ptr<AstSerializer> NewAstSerializer(DumpFormat format, pugi::xml_writer& writer);
+std::unique_ptr<AstSerializer> NewAstSerializer(DumpFormat format, const std::string& filePath);
+
+// AstDumpSummary count what is in a dump
+struct AstDumpSummary {
+    size_t files = 0;
+    size_t decls = 0;
+    // Present nodes, absent children are counted by nulls
+    size_t nodes = 0;
+    size_t nulls = 0;
+    size_t attributes = 0;
+};
+
+// Decode the binary dump, return false if it is malformed
+bool ReadBinaryAst(const char* data, size_t size, AstDumpSummary& summary);
+
+} // namespace zl
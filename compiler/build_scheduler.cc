@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <queue>
+#include "build_scheduler.h"
+#include "lexer.h"
+#include "thread_pool.h"
+
+namespace zl {
+
+FileHeader ScanHeader(const char* source, size_t size) {
+    FileHeader header;
+    Lexer lexer(source, size);
+
+    while (true) {
+        Token token = lexer.Next();
+        if (token.type_ == Token::SEMICOLON)
+            continue;
+        if (token.type_ == Token::PACKAGE) {
+            token = lexer.Next();
+            if (token.type_ != Token::ID)
+                break;
+            if (header.package.empty())
+                header.package = token.assic_;
+        } else if (token.type_ == Token::IMPORT) {
+            // importDeclaration
+            //    : 'import' qualifiedName
+            //    ;
+            Location location = token.location_;
+            std::vector<std::string> names;
+            token = lexer.Next();
+            if (token.type_ != Token::ID)
+                break;
+            names.push_back(token.assic_);
+            while (lexer.Peek().type_ == Token::PERIOD) {
+                lexer.Next();
+                token = lexer.Next();
+                if (token.type_ != Token::ID)
+                    break;
+                names.push_back(token.assic_);
+            }
+            header.imports.push_back(names);
+            header.importLocations.push_back(location);
+        } else {
+            break;
+        }
+    }
+    if (header.package.empty())
+        header.package = "main";
+    return header;
+}
+
+size_t BuildGraph::FindPackage(const std::string& name) const {
+    for (size_t i = 0; i < packages_.size(); i++) {
+        if (packages_[i].name == name)
+            return i;
+    }
+    return packages_.size();
+}
+
+void BuildGraph::AddFile(size_t file, const FileHeader& header, uint64_t size) {
+    size_t index = FindPackage(header.package);
+    if (index == packages_.size()) {
+        packages_.emplace_back();
+        packages_.back().name = header.package;
+    }
+    auto& package = packages_[index];
+    package.files.push_back(file);
+    package.cost += size;
+    for (size_t i = 0; i < header.imports.size(); i++)
+        edges_.push_back({index, file, header.imports[i], header.importLocations[i]});
+}
+
+bool BuildGraph::Build(std::vector<SourceFile>& files) {
+    // The same rule as Resolver, an import matching the importing package
+    // itself refers to an external package
+    for (auto& edge : edges_) {
+        size_t to = packages_.size();
+        for (auto& candidate : ImportCandidates(edge.names)) {
+            to = FindPackage(candidate);
+            if (to < packages_.size())
+                break;
+        }
+        if (to == packages_.size() || to == edge.from) {
+            externalImports_++;
+            continue;
+        }
+        auto& imports = packages_[edge.from].imports;
+        if (std::find(imports.begin(), imports.end(), to) != imports.end())
+            continue;
+        imports.push_back(to);
+        packages_[to].importers.push_back(edge.from);
+    }
+    if (!FindCycles(files))
+        return false;
+    ComputePriorities();
+    return true;
+}
+
+bool BuildGraph::FindCycles(std::vector<SourceFile>& files) {
+    enum Color { White, Gray, Black };
+    std::vector<Color> colors(packages_.size(), White);
+    std::vector<size_t> path;
+    bool acyclic = true;
+
+    // Return the import edge which made package to imported by package from
+    auto findEdge = [this](size_t from, size_t to) -> const ImportEdge* {
+        for (auto& edge : edges_) {
+            if (edge.from != from)
+                continue;
+            for (auto& candidate : ImportCandidates(edge.names)) {
+                size_t index = FindPackage(candidate);
+                if (index < packages_.size()) {
+                    if (index == to)
+                        return &edge;
+                    break;
+                }
+            }
+        }
+        return nullptr;
+    };
+
+    std::function<void(size_t)> visit = [&](size_t from) {
+        colors[from] = Gray;
+        path.push_back(from);
+        for (auto to : packages_[from].imports) {
+            if (colors[to] == White) {
+                visit(to);
+            } else if (colors[to] == Gray) {
+                std::string cycle;
+                auto start = std::find(path.begin(), path.end(), to);
+                for (auto iter = start; iter != path.end(); ++iter)
+                    cycle += packages_[*iter].name + " -> ";
+                cycle += packages_[to].name;
+                auto edge = findEdge(from, to);
+                files[edge->file].diagnostics.push_back(
+                        {edge->location, "import cycle not allowed: " + cycle});
+                acyclic = false;
+            }
+        }
+        path.pop_back();
+        colors[from] = Black;
+    };
+    for (size_t i = 0; i < packages_.size(); i++) {
+        if (colors[i] == White)
+            visit(i);
+    }
+    return acyclic;
+}
+
+void BuildGraph::ComputePriorities() {
+    std::vector<bool> done(packages_.size(), false);
+    std::function<uint64_t(size_t)> priority = [&](size_t index) -> uint64_t {
+        auto& package = packages_[index];
+        if (done[index])
+            return package.priority;
+        uint64_t longest = 0;
+        for (auto importer : package.importers)
+            longest = std::max(longest, priority(importer));
+        package.priority = package.cost + longest;
+        done[index] = true;
+        return package.priority;
+    };
+    for (size_t i = 0; i < packages_.size(); i++)
+        priority(i);
+}
+
+std::vector<size_t> BuildGraph::CriticalPath() const {
+    std::vector<size_t> path;
+    if (packages_.empty())
+        return path;
+    size_t current = 0;
+    for (size_t i = 1; i < packages_.size(); i++) {
+        if (packages_[i].priority > packages_[current].priority)
+            current = i;
+    }
+    while (true) {
+        path.push_back(current);
+        auto& importers = packages_[current].importers;
+        if (importers.empty())
+            break;
+        size_t next = importers[0];
+        for (auto importer : importers) {
+            if (packages_[importer].priority > packages_[next].priority)
+                next = importer;
+        }
+        current = next;
+    }
+    return path;
+}
+
+void BuildScheduler::Run(const std::function<void(const PackageNode&)>& compile) {
+    auto& packages = graph_.Packages();
+    auto begin = std::chrono::steady_clock::now();
+    auto seconds = [begin] {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+
+    // Ready packages ordered by priority, ties are broken by graph order
+    auto lower = [&packages](size_t a, size_t b) {
+        if (packages[a].priority != packages[b].priority)
+            return packages[a].priority < packages[b].priority;
+        return a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(lower)> ready(lower);
+    std::vector<size_t> waiting(packages.size());
+    size_t finished = 0;
+    std::mutex mutex;
+    std::condition_variable finishedCond;
+
+    // Every submitted task runs the best package ready at the time it starts,
+    // not the one which made it submitted
+    std::function<void()> runReady = [&] {
+        size_t index, entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            index = ready.top();
+            ready.pop();
+            entry = schedule_.size();
+            schedule_.push_back({index, pool_.CurrentWorker(), seconds(), 0});
+        }
+        compile(packages[index]);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        schedule_[entry].end = seconds();
+        for (auto importer : packages[index].importers) {
+            if (--waiting[importer] == 0) {
+                ready.push(importer);
+                pool_.Submit(runReady);
+            }
+        }
+        if (++finished == packages.size())
+            finishedCond.notify_all();
+    };
+
+    schedule_.clear();
+    schedule_.reserve(packages.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < packages.size(); i++) {
+            waiting[i] = packages[i].imports.size();
+            if (waiting[i] == 0) {
+                ready.push(i);
+                pool_.Submit(runReady);
+            }
+        }
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    finishedCond.wait(lock, [&] { return finished == packages.size(); });
+    elapsed_ = seconds();
+}
+
+double BuildScheduler::Utilization() const {
+    if (elapsed_ <= 0 || pool_.Size() == 0)
+        return 0;
+    // A worker waiting in ParallelFor may start another package, so the busy
+    // time of a worker is the union of its entries
+    std::vector<std::vector<std::pair<double, double>>> intervals(pool_.Size() + 1);
+    for (auto& entry : schedule_)
+        intervals[std::min(entry.worker, pool_.Size())].push_back({entry.start, entry.end});
+    double busy = 0;
+    for (auto& worker : intervals) {
+        std::sort(worker.begin(), worker.end());
+        double end = 0;
+        for (auto& interval : worker) {
+            double start = std::max(interval.first, end);
+            if (interval.second > start)
+                busy += interval.second - start;
+            end = std::max(end, interval.second);
+        }
+    }
+    return busy / (elapsed_ * pool_.Size());
+}
+
+void BuildScheduler::Report(std::ostream& out) const {
+    auto& packages = graph_.Packages();
+    out << std::fixed << std::setprecision(3);
+    out << "schedule: " << packages.size() << " packages, " << graph_.ExternalImports()
+        << " external imports, " << pool_.Size() << " threads, " << elapsed_ * 1000 << " ms, "
+        << "utilization " << std::setprecision(1) << Utilization() * 100 << "%" << std::endl;
+    out << std::setprecision(3);
+    for (auto& entry : schedule_) {
+        out << "  worker " << std::setw(2) << entry.worker << "  "
+            << std::setw(9) << entry.start * 1000 << " - " << std::setw(9) << entry.end * 1000
+            << " ms  " << packages[entry.package].name
+            << " (priority " << packages[entry.package].priority << ")" << std::endl;
+    }
+    auto path = graph_.CriticalPath();
+    uint64_t cost = 0;
+    out << "critical path:";
+    for (size_t i = 0; i < path.size(); i++) {
+        out << (i ? " -> " : " ") << packages[path[i]].name;
+        cost += packages[path[i]].cost;
+    }
+    out << " (" << path.size() << " packages, " << cost << " bytes)" << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
+
+} // namespace zl
@@ -0,0 +1,116 @@
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "frontend.h"
+
+namespace zl {
+
+class ThreadPool;
+
+// FileHeader are the package and import declarations at the beginning of a
+// source file, they are found without parsing the rest of the file
+struct FileHeader {
+    std::string package;
+    // Names of each import, such as {"system", "io"}
+    std::vector<std::vector<std::string>> imports;
+    std::vector<Location> importLocations;
+};
+
+// ScanHeader lex the source until the first declaration which is neither a
+// package nor an import declaration
+FileHeader ScanHeader(const char* source, size_t size);
+
+// PackageNode is one package of the build graph
+struct PackageNode {
+    std::string name;
+    // Indexes of the input files in the package
+    std::vector<size_t> files;
+    // Packages imported by this package and packages importing it
+    std::vector<size_t> imports;
+    std::vector<size_t> importers;
+    // Estimated compile cost, the source size in bytes
+    uint64_t cost = 0;
+    // Cost of the longest chain from this package to a package nothing
+    // imports, this package included
+    uint64_t priority = 0;
+};
+
+// BuildGraph is the package dependency DAG of the input files
+class BuildGraph {
+public:
+    BuildGraph() {}
+    ~BuildGraph() {}
+
+    void AddFile(size_t file, const FileHeader& header, uint64_t size);
+    // Link imports to the packages of the graph, imports of other packages
+    // are external ones. Every import cycle is reported on the file holding
+    // the import which closes it, return false if there is any.
+    bool Build(std::vector<SourceFile>& files);
+
+    const std::vector<PackageNode>& Packages() const { return packages_; }
+    // Return the packages of the longest chain, dependencies first
+    std::vector<size_t> CriticalPath() const;
+    size_t ExternalImports() const { return externalImports_; }
+
+private:
+    BuildGraph(const BuildGraph&) = delete;
+    BuildGraph& operator = (const BuildGraph&) = delete;
+    size_t FindPackage(const std::string& name) const;
+    bool FindCycles(std::vector<SourceFile>& files);
+    void ComputePriorities();
+
+private:
+    struct ImportEdge {
+        size_t from;
+        size_t file;
+        std::vector<std::string> names;
+        Location location;
+    };
+    std::vector<PackageNode> packages_;
+    std::vector<ImportEdge> edges_;
+    size_t externalImports_ = 0;
+};
+
+// ScheduleEntry record when and where one package is compiled, the times are
+// in seconds since the schedule started
+struct ScheduleEntry {
+    size_t package;
+    size_t worker;
+    double start;
+    double end;
+};
+
+// BuildScheduler compile the packages of the graph on the thread pool. A
+// package is ready when all packages it imports are compiled, the ready
+// package with the highest priority runs first, so that the critical path
+// starts as early as possible and independent packages run concurrently.
+class BuildScheduler {
+public:
+    explicit BuildScheduler(const BuildGraph& graph, ThreadPool& pool)
+        : graph_(graph), pool_(pool), elapsed_(0) {}
+    ~BuildScheduler() {}
+
+    // Run compile for every package, the graph must be acyclic
+    void Run(const std::function<void(const PackageNode&)>& compile);
+
+    // Entries in the order packages were started
+    const std::vector<ScheduleEntry>& Schedule() const { return schedule_; }
+    double Elapsed() const { return elapsed_; }
+    // Busy time of all workers divided by the elapsed time of all workers
+    double Utilization() const;
+    // Print the schedule, the critical path and utilization
+    void Report(std::ostream& out) const;
+
+private:
+    BuildScheduler() = delete;
+
+private:
+    const BuildGraph& graph_;
+    ThreadPool& pool_;
+    std::vector<ScheduleEntry> schedule_;
+    double elapsed_;
+};
+
+} // namespace zl
@@ -0,0 +1,2346 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string_view>
+#include <unordered_set>
+#include "runtime/interpreter.h"
+#include "bytecode_compiler.h"
+
+namespace zl {
+
+namespace {
+
+const char kSelf[] = "self";
+
+bool IsLoop(ast::Node* node) {
+    auto kind = node->Kind();
+    return kind == ast::NodeKind::WhileStmt || kind == ast::NodeKind::DoStmt ||
+        kind == ast::NodeKind::ForStmt || kind == ast::NodeKind::ForeachStmt;
+}
+
+bool IsIntegerType(const std::string& name) {
+    return name == "int" || name == "short" || name == "byte" || name == "char";
+}
+
+OpCode ArithmeticOpCode(int op) {
+    switch (op) {
+        case Token::ADD: case Token::ADD_ASSIGN: return OpCode::Add;
+        case Token::SUB: case Token::SUB_ASSIGN: return OpCode::Sub;
+        case Token::MUL: case Token::MUL_ASSIGN: return OpCode::Mul;
+        case Token::QUO: case Token::QUO_ASSIGN: return OpCode::Div;
+        case Token::REM: case Token::REM_ASSIGN: return OpCode::Mod;
+        case Token::AND: case Token::AND_ASSIGN: return OpCode::BitAnd;
+        case Token::OR: case Token::OR_ASSIGN: return OpCode::BitOr;
+        case Token::XOR: case Token::XOR_ASSIGN: return OpCode::BitXor;
+        case Token::SHL: case Token::SHL_ASSIGN: return OpCode::Shl;
+        case Token::SHR: case Token::SHR_ASSIGN: return OpCode::Shr;
+        default: return OpCode::Move;
+    }
+}
+
+bool IsComparison(int op) {
+    return op == Token::EQL || op == Token::NEQ || op == Token::LSS || op == Token::GTR ||
+        op == Token::LEQ || op == Token::GEQ;
+}
+
+// Return the small integer literal in value, the AddInt immediate is 8 bits
+bool SmallIntLiteral(ast::Expr* expr, int& value) {
+    if (!expr || expr->Kind() != ast::NodeKind::LiteralExpr)
+        return false;
+    auto literal = static_cast<ast::LiteralExpr*>(expr);
+    if (literal->kind_ != Token::INT || literal->value_.size() > 4)
+        return false;
+    char* end = nullptr;
+    long number = strtol(literal->value_.c_str(), &end, 10);
+    if (*end != '\0' || number < -128 || number > 127)
+        return false;
+    value = static_cast<int>(number);
+    return true;
+}
+
+// Values of the cases of a switch are equal as map keys are
+struct SwitchValueHash {
+    size_t operator () (Value value) const { return HashValue(value); }
+};
+struct SwitchValueEqual {
+    bool operator () (Value a, Value b) const { return ValuesEqual(a, b); }
+};
+
+// Build a perfect hash of the distinct hashes, hash and displace: the
+// hashes are put in buckets by their slot for seed 0, then the buckets of
+// several hashes, largest first, are given the first seed placing all of
+// them in free slots, and the buckets of one hash take the free slots left.
+// Set the seed of each bucket and the slot of each hash, return false if no
+// seed is found.
+bool BuildPerfectHash(const std::vector<size_t>& hashes, std::vector<int32_t>& seeds,
+        std::vector<size_t>& slots) {
+    const int32_t kMaxSeed = 1 << 16;
+    size_t size = 1;
+    while (size < hashes.size())
+        size *= 2;
+    size_t mask = size - 1;
+    std::vector<std::vector<size_t>> buckets(size);
+    for (size_t n = 0; n < hashes.size(); n++)
+        buckets[SwitchTable::Slot(hashes[n], 0, mask)].push_back(n);
+    std::vector<size_t> order(size);
+    for (size_t n = 0; n < size; n++)
+        order[n] = n;
+    std::stable_sort(order.begin(), order.end(),
+        [&buckets](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+    seeds.assign(size, 0);
+    slots.assign(hashes.size(), 0);
+    std::vector<bool> used(size);
+    std::vector<size_t> taken;
+    size_t next = 0;
+    for (auto bucket : order) {
+        auto& members = buckets[bucket];
+        if (members.size() == 1) {
+            while (used[next])
+                next++;
+            used[next] = true;
+            slots[members[0]] = next;
+            seeds[bucket] = -static_cast<int32_t>(next) - 1;
+            continue;
+        }
+        if (members.empty())
+            break;
+        int32_t seed = 1;
+        for (; seed < kMaxSeed; seed++) {
+            taken.clear();
+            for (auto member : members) {
+                size_t slot = SwitchTable::Slot(hashes[member], seed, mask);
+                if (used[slot] || std::find(taken.begin(), taken.end(), slot) != taken.end())
+                    break;
+                taken.push_back(slot);
+            }
+            if (taken.size() == members.size())
+                break;
+        }
+        if (seed == kMaxSeed)
+            return false;
+        seeds[bucket] = seed;
+        for (size_t n = 0; n < members.size(); n++) {
+            used[taken[n]] = true;
+            slots[members[n]] = taken[n];
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+BytecodeCompiler::BytecodeCompiler(Program& program)
+    : program_(program), constants_(program.heap), line_(0), state_(nullptr), internLiterals_(true) {
+    scope_ = [this](const std::string& name, Value& value) { return BindName(name, value); };
+    if (program_.globals.empty())
+        Interpreter::DeclareBuiltins(program_);
+    for (size_t i = 0; i < program_.globalNames.size(); i++)
+        globals_[program_.globalNames[i]] = static_cast<int>(i);
+    globalTypes_.resize(program_.globals.size());
+    emptyString_ = Value::FromObject(program_.heap.Intern(""));
+}
+
+bool BytecodeCompiler::Compile(const std::vector<SourceFile>& files) {
+    // Classes and interfaces are created first so that types may refer to
+    // them before their declaration or in other files
+    for (auto& file : files) {
+        path_ = file.path;
+        for (auto node : file.decls) {
+            if (auto interface = dynamic_cast<ast::InterfaceDecl*>(node)) {
+                if (!interface->name_)
+                    continue;
+                SetLine(interface);
+                if (interfaces_.count(interface->name_->name_)) {
+                    Error("interface " + interface->name_->name_ + " is redeclared");
+                    continue;
+                }
+                ProgramInterface declared;
+                declared.name = interface->name_->name_;
+                for (auto method : interface->methods_) {
+                    if (method->name_)
+                        declared.methods.push_back(method->name_->name_);
+                }
+                interfaces_[declared.name] = static_cast<int>(program_.interfaces.size());
+                program_.interfaces.push_back(declared);
+                continue;
+            }
+            auto decl = dynamic_cast<ast::ClassDecl*>(node);
+            if (!decl || !decl->name_)
+                continue;
+            auto klass = program_.heap.NewClass(decl->name_->name_);
+            klass->id = static_cast<uint32_t>(program_.classes.size());
+            classes_[klass->name] = klass;
+            program_.classes.push_back(klass);
+        }
+    }
+    for (auto& file : files) {
+        path_ = file.path;
+        for (auto node : file.decls)
+            CheckTypes(node);
+    }
+    if (!diagnostics_.empty())
+        return false;
+    for (auto& file : files)
+        constants_.DeclareFile(file);
+    for (auto& file : files)
+        DeclareFile(file);
+    BuildItables();
+    constants_.EvaluateAll();
+    for (auto& error : constants_.Errors())
+        diagnostics_.push_back({error.path, error.diagnostic});
+    for (auto& body : bodies_) {
+        path_ = body.path;
+        package_ = body.package;
+        CompileFunction(body.decl, body.function, body.owner);
+    }
+    CompileInit();
+
+    auto iter = functions_.find("main");
+    if (iter != functions_.end()) {
+        program_.main = iter->second;
+    } else {
+        for (auto klass : program_.classes) {
+            auto method = statics_[klass].find("main");
+            if (method != statics_[klass].end()) {
+                program_.main = method->second;
+                break;
+            }
+        }
+    }
+    return diagnostics_.empty();
+}
+
+void BytecodeCompiler::DeclareFile(const SourceFile& file) {
+    path_ = file.path;
+    package_ = PackageNameOf(file.decls);
+    for (auto node : file.decls) {
+        SetLine(node);
+        switch (node->Kind()) {
+            case ast::NodeKind::ClassDecl:
+                DeclareClass(static_cast<ast::ClassDecl*>(node));
+                break;
+            case ast::NodeKind::FunctionDecl: {
+                auto decl = static_cast<ast::FunctionDecl*>(node);
+                if (!decl->name_)
+                    break;
+                if (functions_.count(decl->name_->name_)) {
+                    Error("function " + decl->name_->name_ + " is redeclared");
+                    break;
+                }
+                auto function = program_.heap.NewFunction(decl->name_->name_);
+                functions_[function->name] = function;
+                program_.functions.push_back(function);
+                bodies_.push_back({path_, package_, decl, function, nullptr});
+                break;
+            }
+            case ast::NodeKind::VariableDecl: {
+                auto decl = static_cast<ast::VariableDecl*>(node);
+                DeclareGlobal(decl->name_, decl->type_, decl->varInitializer_);
+                break;
+            }
+            case ast::NodeKind::VariableBlockDecl:
+                for (auto decl : static_cast<ast::VariableBlockDecl*>(node)->variables_)
+                    DeclareGlobal(decl->name_, decl->type_, decl->varInitializer_);
+                break;
+            default:
+                // Packages, imports and interfaces produce no code, nor do
+                // constants, which are evaluated by constants_
+                break;
+        }
+    }
+}
+
+void BytecodeCompiler::CheckTypes(ast::Node* node) {
+    if (node->Kind() == ast::NodeKind::PrimitiveType) {
+        auto& name = static_cast<ast::PrimitiveType*>(node)->name_;
+        if (name == "long") {
+            SetLine(node);
+            Error("long is not supported by the bytecode interpreter, whose integers are 32 bits; "
+                "use --jit or --emit-c");
+            return;
+        }
+        // Numbers of the interpreter are doubles, rounding a float only at
+        // some places would still print other digits than the C float
+        if (name == "float") {
+            SetLine(node);
+            Error("float is not supported by the bytecode interpreter, whose floating point numbers "
+                "are 64 bits; use double, --jit or --emit-c");
+            return;
+        }
+    }
+    std::vector<ast::Node*> children;
+    ast::CollectChildren(node, children);
+    for (auto child : children) {
+        if (child)
+            CheckTypes(child);
+    }
+}
+
+void BytecodeCompiler::DeclareClass(ast::ClassDecl* decl) {
+    if (!decl->name_ || !decl->classBody_)
+        return;
+    auto klass = classes_[decl->name_->name_];
+    classDecls_.push_back({path_, decl, klass});
+    auto& fieldClasses = fieldClasses_[klass];
+    auto& fieldInterfaces = fieldInterfaces_[klass];
+    auto& fieldTypes = fieldTypes_[klass];
+    for (auto variable : decl->classBody_->variables_) {
+        if (!variable->name_)
+            continue;
+        SetLine(variable);
+        Value value = ZeroValue(variable->type_);
+        if (variable->varInitializer_ && variable->varInitializer_->expr_) {
+            auto expr = variable->varInitializer_->expr_;
+            // Fields are initialized by copying the defaults, so only
+            // literals are allowed
+            if (expr->Kind() != ast::NodeKind::LiteralExpr) {
+                Error("initializer of field " + variable->name_->name_ + " must be a literal");
+            } else {
+                auto literal = static_cast<ast::LiteralExpr*>(expr);
+                if (literal->kind_ == Token::INT)
+                    value = Value::Int(static_cast<int32_t>(strtoll(literal->value_.c_str(), nullptr, 0)));
+                else if (literal->kind_ == Token::FLOAT)
+                    value = Value::Double(strtod(literal->value_.c_str(), nullptr));
+                else if (literal->kind_ == Token::STRING)
+                    value = StringLiteral(literal->value_);
+                else if (literal->kind_ == Token::TRUE || literal->kind_ == Token::FALSE)
+                    value = Value::Bool(literal->kind_ == Token::TRUE);
+            }
+            auto number = NumberOfType(variable->type_);
+            if (number == NumberType::Int && value.IsDouble())
+                value = Value::Int(value.ToInt());
+            else if (number == NumberType::Double && value.IsInt())
+                value = Value::Double(value.AsInt());
+        }
+        klass->fieldIndex[variable->name_->name_] = static_cast<int>(klass->fieldNames.size());
+        klass->fieldNames.push_back(variable->name_->name_);
+        klass->fieldDefaults.push_back(value);
+        fieldClasses.push_back(ClassOfType(variable->type_));
+        fieldInterfaces.push_back(InterfaceOfType(variable->type_));
+        fieldTypes.push_back(variable->type_);
+    }
+    for (auto method : decl->classBody_->functions_) {
+        if (!method->name_)
+            continue;
+        auto function = program_.heap.NewFunction(klass->name + "." + method->name_->name_);
+        function->owner = klass;
+        program_.functions.push_back(function);
+        bodies_.push_back({path_, package_, method, function, klass});
+        if (method->name_->name_ == klass->name)
+            klass->constructor = function;
+        else if (method->isStatic_)
+            statics_[klass][method->name_->name_] = function;
+        else
+            klass->methods[method->name_->name_] = function;
+    }
+}
+
+void BytecodeCompiler::BuildItables() {
+    for (auto& declaration : classDecls_) {
+        path_ = declaration.path;
+        SetLine(declaration.decl);
+        auto klass = declaration.klass;
+        std::vector<bool> implements(program_.interfaces.size());
+        if (declaration.decl->interfaceList_) {
+            for (auto name : declaration.decl->interfaceList_->names_) {
+                if (!name || name->names_.empty())
+                    continue;
+                auto iter = interfaces_.find(name->names_.back());
+                if (iter == interfaces_.end())
+                    Error(name->names_.back() + " is not an interface");
+                else
+                    implements[iter->second] = true;
+            }
+        }
+        // A class which does not declare an interface still implements it
+        // if it has all its methods
+        klass->itables.resize(program_.interfaces.size());
+        for (size_t n = 0; n < program_.interfaces.size(); n++) {
+            auto& interface = program_.interfaces[n];
+            std::vector<FunctionObject*> itable;
+            for (auto& method : interface.methods) {
+                auto function = klass->Method(method);
+                if (!function) {
+                    if (implements[n])
+                        Error(klass->name + " does not implement " + interface.name + "." + method);
+                    itable.clear();
+                    break;
+                }
+                itable.push_back(function);
+            }
+            klass->itables[n] = itable;
+        }
+    }
+}
+
+void BytecodeCompiler::DeclareGlobal(ast::Identifier* name, ast::Type* type,
+        ast::VarInitializer* initializer) {
+    if (!name)
+        return;
+    Value constant;
+    std::string error;
+    if (globals_.count(name->name_) || constants_.Lookup(package_, name, constant, error)) {
+        Error("variable " + name->name_ + " is redeclared");
+        return;
+    }
+    int index = static_cast<int>(program_.globals.size());
+    if (index > kMaxBx) {
+        Error("too many global variables");
+        return;
+    }
+    globals_[name->name_] = index;
+    program_.globalNames.push_back(name->name_);
+    program_.globals.push_back(ZeroValue(type));
+    globalTypes_.push_back(type);
+    if (initializer && initializer->expr_)
+        globalInitializers_.push_back({path_, package_, index, initializer->expr_});
+}
+
+void BytecodeCompiler::CompileInit() {
+    if (globalInitializers_.empty())
+        return;
+    auto function = program_.heap.NewFunction("<init>");
+    FunctionState state;
+    state.function = function;
+    state_ = &state;
+    for (auto& initializer : globalInitializers_) {
+        path_ = initializer.path;
+        package_ = initializer.package;
+        SetLine(initializer.expr);
+        int reg = CompileToRegister(initializer.expr);
+        reg = CompileConversion(globalTypes_[initializer.global], NumberOf(initializer.expr), reg);
+        Emit(EncodeABx(OpCode::SetGlobal, reg, initializer.global));
+        state.freeRegister = 0;
+    }
+    Emit(EncodeABC(OpCode::Return, 0, 0, 0));
+    state_ = nullptr;
+    BuildStackMap(function);
+    program_.init = function;
+}
+
+void BytecodeCompiler::CompileFunction(ast::FunctionDecl* decl, FunctionObject* function,
+        ClassObject* owner) {
+    FunctionState state;
+    state.function = function;
+    state.owner = owner;
+    state.hasSelf = owner && !decl->isStatic_;
+    state_ = &state;
+    SetLine(decl);
+
+    if (state.hasSelf)
+        DeclareLocal(kSelf, owner);
+    if (decl->formalParameterList_) {
+        for (auto parameter : decl->formalParameterList_->formalParameters_) {
+            DeclareLocal(parameter->name_ ? parameter->name_->name_ : "", ClassOfType(parameter->type_),
+                InterfaceOfType(parameter->type_));
+            state.locals.back().type = parameter->type_;
+        }
+    }
+    function->numParams = static_cast<int>(state.locals.size());
+    if (decl->returnParameterList_)
+        function->numResults = static_cast<int>(decl->returnParameterList_->types_.size());
+
+    bool returns = false;
+    if (decl->functionBlockDecl_) {
+        auto& nodes = decl->functionBlockDecl_->nodes_;
+        DeclareDefers(decl->functionBlockDecl_);
+        for (auto node : nodes)
+            CompileStmt(node);
+        returns = !nodes.empty() && nodes.back() && nodes.back()->Kind() == ast::NodeKind::ReturnStmt;
+    }
+    // The defers of a body ending with a return are run by it
+    EndDeferRange();
+    if (!returns) {
+        state.freeRegister = static_cast<int>(state.locals.size());
+        CompileDeferredCalls();
+    }
+    Emit(EncodeABC(OpCode::Return, 0, 0, 0));
+    CompileDeferHandlers();
+    state_ = nullptr;
+    BuildStackMap(function);
+}
+
+//
+// Statements
+//
+
+void BytecodeCompiler::CompileStmt(ast::Node* node) {
+    if (!node)
+        return;
+    SetLine(node);
+    if (IsLoop(node)) {
+        // The exits in the loop pop the defers of its earlier iterations
+        for (auto& deferStack : state_->deferStacks) {
+            if (deferStack.loop == node) {
+                EndDeferRange();
+                state_->reached.push_back(deferStack.defers[0]);
+                BeginDeferRange();
+            }
+        }
+    }
+    switch (node->Kind()) {
+        case ast::NodeKind::DeclStmt:
+            CompileStmt(static_cast<ast::DeclStmt*>(node)->decl_);
+            break;
+        case ast::NodeKind::VariableDecl: {
+            auto decl = static_cast<ast::VariableDecl*>(node);
+            CompileVariable(decl->name_, decl->type_, decl->varInitializer_);
+            break;
+        }
+        case ast::NodeKind::ConstDecl:
+            CompileConstant(static_cast<ast::ConstDecl*>(node));
+            break;
+        case ast::NodeKind::ConstBlockDecl:
+            for (auto decl : static_cast<ast::ConstBlockDecl*>(node)->fields_)
+                CompileConstant(decl);
+            break;
+        case ast::NodeKind::VariableBlockDecl:
+            for (auto decl : static_cast<ast::VariableBlockDecl*>(node)->variables_)
+                CompileStmt(decl);
+            break;
+        case ast::NodeKind::BlockStmt:
+            BeginScope();
+            for (auto stmt : static_cast<ast::BlockStmt*>(node)->stmts_)
+                CompileStmt(stmt);
+            EndScope();
+            break;
+        case ast::NodeKind::ExprStmt: {
+            auto stmt = static_cast<ast::ExprStmt*>(node);
+            if (stmt->varDecl_) {
+                CompileStmt(stmt->varDecl_);
+            } else if (stmt->stmt_) {
+                CompileStmt(stmt->stmt_);
+            } else if (stmt->expr_) {
+                int save = state_->freeRegister;
+                if (stmt->expr_->Kind() == ast::NodeKind::CallExpr) {
+                    CompileCall(static_cast<ast::CallExpr*>(stmt->expr_), 0);
+                } else {
+                    CompileToRegister(stmt->expr_);
+                }
+                state_->freeRegister = save;
+            }
+            break;
+        }
+        case ast::NodeKind::ExprStmts:
+            for (auto stmt : static_cast<ast::ExprStmts*>(node)->stmts_)
+                CompileStmt(stmt);
+            break;
+        case ast::NodeKind::AssignStmt:
+            CompileAssign(static_cast<ast::AssignStmt*>(node));
+            break;
+        case ast::NodeKind::IfStmt:
+            CompileIf(static_cast<ast::IfStmt*>(node));
+            break;
+        case ast::NodeKind::WhileStmt: {
+            auto stmt = static_cast<ast::WhileStmt*>(node);
+            CompileWhile(stmt->conditionExpr_, stmt->block_, true);
+            break;
+        }
+        case ast::NodeKind::DoStmt: {
+            auto stmt = static_cast<ast::DoStmt*>(node);
+            CompileWhile(stmt->conditionExpr_, stmt->block_, false);
+            break;
+        }
+        case ast::NodeKind::ForStmt:
+            CompileFor(static_cast<ast::ForStmt*>(node));
+            break;
+        case ast::NodeKind::ForeachStmt:
+            CompileForeach(static_cast<ast::ForeachStmt*>(node));
+            break;
+        case ast::NodeKind::SwitchStmt:
+            CompileSwitch(static_cast<ast::SwitchStmt*>(node));
+            break;
+        case ast::NodeKind::ReturnStmt:
+            CompileReturn(static_cast<ast::ReturnStmt*>(node));
+            break;
+        case ast::NodeKind::BreakStmt:
+        case ast::NodeKind::ContinueStmt: {
+            // break leaves the innermost loop or switch, continue goes on
+            // with the innermost loop
+            bool isBreak = node->Kind() == ast::NodeKind::BreakStmt;
+            size_t loop = state_->loops.size();
+            while (loop > 0 && !isBreak && state_->loops[loop - 1].isSwitch)
+                loop--;
+            if (loop == 0) {
+                Error(isBreak ? "break is not in a loop or a switch" : "continue is not in a loop");
+                break;
+            }
+            // The tries in it are left
+            size_t count = 0;
+            while (count < state_->tries.size() && state_->tries[count].loops < loop)
+                count++;
+            CompileFinallyBlocks(count);
+            if (isBreak)
+                state_->loops[loop - 1].breaks.push_back(EmitJump());
+            else
+                state_->loops[loop - 1].continues.push_back(EmitJump());
+            ResumeTries(count);
+            break;
+        }
+        case ast::NodeKind::AssertStmt: {
+            int save = state_->freeRegister;
+            int reg = CompileToRegister(static_cast<ast::AssertStmt*>(node)->expr_);
+            Emit(EncodeABC(OpCode::Assert, reg, 0, 0));
+            state_->freeRegister = save;
+            break;
+        }
+        case ast::NodeKind::DeferStmt:
+            CompileDefer(static_cast<ast::DeferStmt*>(node));
+            break;
+        case ast::NodeKind::ThrowStmt:
+            CompileThrow(static_cast<ast::ThrowStmt*>(node));
+            break;
+        case ast::NodeKind::TryStmt:
+            CompileTry(static_cast<ast::TryStmt*>(node));
+            break;
+        case ast::NodeKind::LabelStmt:
+            break;
+        default:
+            Error(std::string(ast::NodeKindName(node->Kind())) + " is not supported by the bytecode compiler");
+            break;
+    }
+}
+
+void BytecodeCompiler::CompileBlock(ast::Node* node) {
+    BeginScope();
+    CompileStmt(node);
+    EndScope();
+}
+
+void BytecodeCompiler::CompileVariable(ast::Identifier* name, ast::Type* type,
+        ast::VarInitializer* initializer) {
+    if (!name)
+        return;
+    // The register is reserved before the initializer so that it may refer
+    // to an outer variable of the same name
+    state_->freeRegister = static_cast<int>(state_->locals.size());
+    int reg = AllocRegister();
+    ClassObject* klass = ClassOfType(type);
+    if (initializer && initializer->expr_) {
+        CompileExpr(initializer->expr_, reg);
+        OpCode conversion = Conversion(type, NumberOf(initializer->expr_));
+        if (conversion != OpCode::Move)
+            Emit(EncodeABC(conversion, reg, reg, 0));
+        if (!klass)
+            klass = ClassOf(initializer->expr_);
+    } else {
+        Value zero = ZeroValue(type);
+        if (zero.IsInt())
+            Emit(EncodeAsBx(OpCode::LoadInt, reg, 0));
+        else if (zero.IsNil())
+            Emit(EncodeABC(OpCode::LoadNil, reg, 0, 0));
+        else
+            Emit(EncodeABx(OpCode::LoadK, reg, AddConstant(zero)));
+    }
+    state_->freeRegister = reg;
+    DeclareLocal(name->name_, klass, InterfaceOfType(type));
+    state_->locals.back().type = type;
+    state_->locals.back().converted = true;
+}
+
+void BytecodeCompiler::CompileConstant(ast::ConstDecl* decl) {
+    if (!decl->name_)
+        return;
+    // The value is known, the register holds it for the code which does
+    // not fold it
+    Value value;
+    std::string error;
+    if (!constants_.EvaluateLocal(package_, decl, scope_, value, error)) {
+        if (!error.empty())
+            Error(error);
+        value = Value::Nil();
+    }
+    state_->freeRegister = static_cast<int>(state_->locals.size());
+    CompileValue(value, AllocRegister());
+    DeclareLocal(decl->name_->name_, nullptr);
+    state_->locals.back().constant = true;
+    state_->locals.back().value = value;
+}
+
+void BytecodeCompiler::CompileAssign(ast::AssignStmt* stmt) {
+    int save = state_->freeRegister;
+    if (stmt->op_ != Token::ASSIGN) {
+        if (stmt->lhs_.size() != 1 || stmt->rhs_.size() != 1) {
+            Error("compound assignment must have one operand on each side");
+            return;
+        }
+        auto target = stmt->lhs_[0];
+        OpCode op = ArithmeticOpCode(stmt->op_);
+        int value = 0;
+        const Local* local = nullptr;
+        if (target->Kind() == ast::NodeKind::Identifier)
+            local = FindLocal(static_cast<ast::Identifier*>(target)->name_);
+        if (local && local->constant) {
+            Error("constant " + local->name + " can not be assigned");
+            return;
+        }
+        int left = local ? local->reg : CompileToRegister(target);
+        int result = local ? local->reg : left;
+        if ((op == OpCode::Add || op == OpCode::Sub) && SmallIntLiteral(stmt->rhs_[0], value) &&
+                (op == OpCode::Add || value != -128)) {
+            Emit(EncodeABC(OpCode::AddInt, result, left, (op == OpCode::Add ? value : -value) + 128));
+        } else {
+            int right = CompileToRegister(stmt->rhs_[0]);
+            Emit(EncodeABC(op, result, left, right));
+        }
+        auto number = ArithmeticNumber(op, NumberOf(target), NumberOf(stmt->rhs_[0]));
+        if (!local) {
+            CompileStore(target, result, number);
+        } else {
+            OpCode conversion = Conversion(local->type, number);
+            if (conversion != OpCode::Move)
+                Emit(EncodeABC(conversion, result, result, 0));
+        }
+        state_->freeRegister = save;
+        return;
+    }
+
+    if (stmt->lhs_.size() == 1 && stmt->rhs_.size() == 1) {
+        auto target = stmt->lhs_[0];
+        if (target->Kind() == ast::NodeKind::Identifier) {
+            if (auto local = FindLocal(static_cast<ast::Identifier*>(target)->name_)) {
+                if (local->name == kSelf)
+                    Error("self can not be assigned");
+                else if (local->constant)
+                    Error("constant " + local->name + " can not be assigned");
+                else {
+                    CompileExpr(stmt->rhs_[0], local->reg);
+                    OpCode conversion = Conversion(local->type, NumberOf(stmt->rhs_[0]));
+                    if (conversion != OpCode::Move)
+                        Emit(EncodeABC(conversion, local->reg, local->reg, 0));
+                }
+                state_->freeRegister = save;
+                return;
+            }
+        }
+        CompileStore(target, CompileToRegister(stmt->rhs_[0]), NumberOf(stmt->rhs_[0]));
+        state_->freeRegister = save;
+        return;
+    }
+
+    // All values are evaluated before any is stored, so a, b = b, a swaps
+    std::vector<int> values;
+    std::vector<NumberType> numbers(stmt->lhs_.size(), NumberType::None);
+    if (stmt->rhs_.size() == 1 && stmt->rhs_[0]->Kind() == ast::NodeKind::CallExpr) {
+        int base = state_->freeRegister;
+        CompileCall(static_cast<ast::CallExpr*>(stmt->rhs_[0]), static_cast<int>(stmt->lhs_.size()));
+        state_->freeRegister = base;
+        for (size_t n = 0; n < stmt->lhs_.size(); n++)
+            values.push_back(AllocRegister());
+    } else if (stmt->lhs_.size() == stmt->rhs_.size()) {
+        for (size_t n = 0; n < stmt->rhs_.size(); n++) {
+            int reg = AllocRegister();
+            CompileExpr(stmt->rhs_[n], reg);
+            values.push_back(reg);
+            numbers[n] = NumberOf(stmt->rhs_[n]);
+        }
+    } else {
+        Error("assignment of " + std::to_string(stmt->rhs_.size()) + " values to " +
+            std::to_string(stmt->lhs_.size()) + " variables");
+        return;
+    }
+    for (size_t n = 0; n < stmt->lhs_.size(); n++)
+        CompileStore(stmt->lhs_[n], values[n], numbers[n]);
+    state_->freeRegister = save;
+}
+
+void BytecodeCompiler::CompileStore(ast::Expr* target, int reg, NumberType number) {
+    int save = state_->freeRegister;
+    switch (target->Kind()) {
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(target)->name_;
+            if (auto local = FindLocal(name)) {
+                OpCode conversion = Conversion(local->type, number);
+                if (local->name == kSelf)
+                    Error("self can not be assigned");
+                else if (local->constant)
+                    Error("constant " + name + " can not be assigned");
+                else if (local->reg != reg || conversion != OpCode::Move)
+                    Emit(EncodeABC(conversion, local->reg, reg, 0));
+                return;
+            }
+            if (state_->hasSelf) {
+                int field = state_->owner->FieldIndex(name);
+                if (field >= 0) {
+                    reg = CompileConversion(fieldTypes_[state_->owner][field], number, reg);
+                    Emit(EncodeABC(OpCode::SetField, 0, field, reg));
+                    state_->freeRegister = save;
+                    return;
+                }
+            }
+            Value constant;
+            std::string error;
+            if (constants_.Lookup(package_, target, constant, error)) {
+                Error("constant " + name + " can not be assigned");
+                return;
+            }
+            auto global = globals_.find(name);
+            if (global != globals_.end()) {
+                reg = CompileConversion(globalTypes_[global->second], number, reg);
+                Emit(EncodeABx(OpCode::SetGlobal, reg, global->second));
+                state_->freeRegister = save;
+                return;
+            }
+            Error("undefined variable " + name);
+            return;
+        }
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(target);
+            if (!selector->selector_)
+                return;
+            ClassObject* klass = ClassOf(selector->expr_);
+            int object = CompileToRegister(selector->expr_);
+            int field = klass ? klass->FieldIndex(selector->selector_->name_) : -1;
+            if (field >= 0)
+                reg = CompileConversion(fieldTypes_[klass][field], number, reg);
+            if (field >= 0 && field <= 0xff)
+                Emit(EncodeABC(OpCode::SetField, object, field, reg));
+            else
+                Emit(EncodeABC(OpCode::SetFieldK, object,
+                    SmallConstant(AddStringConstant(selector->selector_->name_)), reg));
+            state_->freeRegister = save;
+            return;
+        }
+        case ast::NodeKind::IndexExpr: {
+            auto index = static_cast<ast::IndexExpr*>(target);
+            reg = CompileConversion(DeclaredType(target), number, reg);
+            int object = CompileToRegister(index->expr_);
+            int key = CompileToRegister(index->index_);
+            Emit(EncodeABC(OpCode::SetIndex, object, key, reg));
+            state_->freeRegister = save;
+            return;
+        }
+        default:
+            Error(std::string(ast::NodeKindName(target->Kind())) + " is not assignable");
+            return;
+    }
+}
+
+OpCode BytecodeCompiler::Conversion(ast::Type* type, NumberType number) {
+    auto declared = NumberOfType(type);
+    if (declared == NumberType::None || declared == number)
+        return OpCode::Move;
+    return declared == NumberType::Int ? OpCode::ToInt : OpCode::ToDouble;
+}
+
+int BytecodeCompiler::CompileConversion(ast::Type* type, NumberType number, int reg) {
+    OpCode conversion = Conversion(type, number);
+    if (conversion == OpCode::Move)
+        return reg;
+    int converted = AllocRegister();
+    Emit(EncodeABC(conversion, converted, reg, 0));
+    return converted;
+}
+
+void BytecodeCompiler::CompileIf(ast::IfStmt* stmt) {
+    std::vector<size_t> ends;
+    std::vector<size_t> next;
+    CompileCondition(stmt->conditionExpr_, false, next);
+    CompileBlock(stmt->ifBlockStmt_);
+    for (auto& elif : stmt->elifBlockStmts_) {
+        ends.push_back(EmitJump());
+        PatchJumps(next, CurrentPosition());
+        next.clear();
+        SetLine(elif.first);
+        CompileCondition(elif.first, false, next);
+        CompileBlock(elif.second);
+    }
+    if (stmt->finalStmt_) {
+        ends.push_back(EmitJump());
+        PatchJumps(next, CurrentPosition());
+        next.clear();
+        CompileBlock(stmt->finalStmt_);
+    }
+    PatchJumps(next, CurrentPosition());
+    PatchJumps(ends, CurrentPosition());
+}
+
+// Loops are rotated, the condition is tested at the bottom so that an
+// iteration runs one jump
+void BytecodeCompiler::CompileWhile(ast::Expr* condition, ast::Stmt* body, bool testFirst) {
+    size_t entry = testFirst ? EmitJump() : 0;
+    size_t top = CurrentPosition();
+    state_->loops.push_back(Loop());
+    CompileBlock(body);
+    if (testFirst)
+        PatchJump(entry, CurrentPosition());
+    Loop loop = state_->loops.back();
+    state_->loops.pop_back();
+    PatchJumps(loop.continues, CurrentPosition());
+    std::vector<size_t> jumps;
+    if (condition)
+        CompileCondition(condition, true, jumps);
+    else
+        jumps.push_back(EmitJump());
+    PatchJumps(jumps, top);
+    PatchJumps(loop.breaks, CurrentPosition());
+}
+
+void BytecodeCompiler::CompileFor(ast::ForStmt* stmt) {
+    BeginScope();
+    CompileStmt(stmt->initializer_);
+    size_t entry = EmitJump();
+    size_t top = CurrentPosition();
+    state_->loops.push_back(Loop());
+    CompileBlock(stmt->block_);
+    Loop loop = state_->loops.back();
+    state_->loops.pop_back();
+    PatchJumps(loop.continues, CurrentPosition());
+    CompileStmt(stmt->finalizer_);
+    PatchJump(entry, CurrentPosition());
+    std::vector<size_t> jumps;
+    if (stmt->expr_)
+        CompileCondition(stmt->expr_, true, jumps);
+    else
+        jumps.push_back(EmitJump());
+    PatchJumps(jumps, top);
+    PatchJumps(loop.breaks, CurrentPosition());
+    EndScope();
+}
+
+void BytecodeCompiler::CompileForeach(ast::ForeachStmt* stmt) {
+    if (stmt->variables_.empty() || stmt->variables_.size() > 2) {
+        Error("foreach must have one or two variables");
+        return;
+    }
+    BeginScope();
+    // The iterated object, the position, then the key and the value
+    int base = DeclareLocal("", nullptr);
+    DeclareLocal("", nullptr);
+    DeclareLocal("", nullptr);
+    DeclareLocal("", nullptr);
+    auto iterable = dynamic_cast<ast::IterableObject*>(stmt->iterableObject_);
+    if (!iterable) {
+        Error("foreach over an invalid object");
+    } else if (iterable->primary_) {
+        if (auto expr = dynamic_cast<ast::Expr*>(iterable->primary_))
+            CompileExpr(expr, base);
+    } else {
+        int start = state_->freeRegister;
+        int count = 0;
+        for (auto& element : iterable->mapElements_) {
+            CompileExpr(dynamic_cast<ast::Expr*>(element.first), AllocRegister());
+            CompileExpr(dynamic_cast<ast::Expr*>(element.second), AllocRegister());
+            count++;
+        }
+        for (auto element : iterable->arrayElements_) {
+            CompileExpr(dynamic_cast<ast::Expr*>(element), AllocRegister());
+            count++;
+        }
+        if (count > 0xff)
+            Error("too many elements in literal");
+        Emit(EncodeABC(iterable->mapElements_.empty() ? OpCode::NewArray : OpCode::NewMap,
+            base, start, count & 0xff));
+        state_->freeRegister = start;
+    }
+    // One variable is the element of an array or the key of a map
+    auto& locals = state_->locals;
+    if (stmt->variables_.size() == 1) {
+        locals[locals.size() - 2].name = stmt->variables_[0];
+    } else {
+        locals[locals.size() - 2].name = stmt->variables_[0];
+        locals[locals.size() - 1].name = stmt->variables_[1];
+    }
+
+    Emit(EncodeABC(OpCode::ForPrep, base, 0, 0));
+    size_t top = CurrentPosition();
+    size_t next = Emit(EncodeAsBx(stmt->variables_.size() == 1 ? OpCode::ForNext1 : OpCode::ForNext,
+        base, 0));
+    state_->loops.push_back(Loop());
+    CompileBlock(stmt->block_);
+    Loop loop = state_->loops.back();
+    state_->loops.pop_back();
+    PatchJumps(loop.continues, top);
+    PatchJump(EmitJump(), top);
+    PatchJump(next, CurrentPosition());
+    PatchJumps(loop.breaks, CurrentPosition());
+    EndScope();
+}
+
+// The value is compared with the cases before any case runs. Cases of
+// constant integers or of constant strings are dispatched by one Switch
+// instruction, see SwitchTable, the others are compared in order. The cases
+// are compiled after the dispatch in source order, each jumps to the end.
+void BytecodeCompiler::CompileSwitch(ast::SwitchStmt* stmt) {
+    int save = state_->freeRegister;
+    int reg = CompileToRegister(stmt->expr_);
+    // The value of each constant case and the index of its case
+    std::vector<std::pair<Value, size_t>> constants;
+    std::unordered_set<Value, SwitchValueHash, SwitchValueEqual> seen;
+    bool constant = true;
+    for (size_t n = 0; n < stmt->cases_.size(); n++) {
+        for (auto expr : stmt->cases_[n]->exprs_) {
+            Value value;
+            if (!constants_.Fold(package_, expr, scope_, value)) {
+                constant = false;
+                continue;
+            }
+            if (!seen.insert(value).second) {
+                SetLine(expr);
+                Error("duplicate case " + (IsObjectOf(value, ObjectKind::String) ?
+                    "\"" + ValueToString(value) + "\"" : ValueToString(value)));
+            }
+            constants.push_back({value, n});
+        }
+    }
+
+    SwitchTable table;
+    size_t dispatch = CurrentPosition();
+    std::vector<std::pair<size_t, size_t>> jumps;
+    size_t defaultJump = 0;
+    bool tabled = constant && !constants.empty() && BuildSwitchTable(constants, table);
+    if (tabled) {
+        auto& switches = state_->function->switches;
+        if (switches.size() > static_cast<size_t>(kMaxBx))
+            Error("too many switch statements in function");
+        Emit(EncodeABx(OpCode::Switch, reg, static_cast<int>(switches.size() & kMaxBx)));
+        switches.push_back(SwitchTable());
+    } else {
+        for (size_t n = 0; n < stmt->cases_.size(); n++) {
+            for (auto expr : stmt->cases_[n]->exprs_) {
+                SetLine(expr);
+                int top = state_->freeRegister;
+                Emit(EncodeABC(OpCode::TestEq, 1, reg, CompileToRegister(expr)));
+                jumps.push_back({EmitJump(), n});
+                state_->freeRegister = top;
+            }
+        }
+        defaultJump = EmitJump();
+    }
+    state_->freeRegister = save;
+
+    Loop entry;
+    entry.isSwitch = true;
+    state_->loops.push_back(entry);
+    std::vector<size_t> starts;
+    std::vector<size_t> ends;
+    for (size_t n = 0; n < stmt->cases_.size(); n++) {
+        starts.push_back(CurrentPosition());
+        CompileBlock(stmt->cases_[n]->block_);
+        if (n + 1 < stmt->cases_.size() || stmt->default_)
+            ends.push_back(EmitJump());
+    }
+    size_t defaultStart = CurrentPosition();
+    if (stmt->default_)
+        CompileBlock(stmt->default_->block_);
+    Loop loop = state_->loops.back();
+    state_->loops.pop_back();
+    PatchJumps(ends, CurrentPosition());
+    PatchJumps(loop.breaks, CurrentPosition());
+
+    if (!tabled) {
+        for (auto& jump : jumps)
+            PatchJump(jump.first, starts[jump.second]);
+        PatchJump(defaultJump, defaultStart);
+        return;
+    }
+    // The targets of the table are the indexes of the cases until here
+    auto offset = [&](int32_t index) {
+        size_t target = index < 0 ? defaultStart : starts[index];
+        return static_cast<int32_t>(static_cast<long>(target) - static_cast<long>(dispatch) - 1);
+    };
+    for (auto& target : table.targets)
+        target = offset(target);
+    table.defaultTarget = offset(-1);
+    state_->function->switches.back() = std::move(table);
+}
+
+// Integers are dispatched by a jump table if at least 40% of its entries
+// are cases, otherwise by a binary search. Strings are dispatched by a
+// perfect hash, see BuildPerfectHash.
+bool BytecodeCompiler::BuildSwitchTable(std::vector<std::pair<Value, size_t>>& cases, SwitchTable& table) {
+    bool integers = std::all_of(cases.begin(), cases.end(),
+        [](const std::pair<Value, size_t>& item) { return item.first.IsInt(); });
+    bool strings = std::all_of(cases.begin(), cases.end(),
+        [](const std::pair<Value, size_t>& item) { return IsObjectOf(item.first, ObjectKind::String); });
+    if (integers) {
+        std::stable_sort(cases.begin(), cases.end(),
+            [](const std::pair<Value, size_t>& a, const std::pair<Value, size_t>& b) {
+                return a.first.AsInt() < b.first.AsInt();
+            });
+        // Duplicates are reported, the first one is kept
+        cases.erase(std::unique(cases.begin(), cases.end(),
+            [](const std::pair<Value, size_t>& a, const std::pair<Value, size_t>& b) {
+                return a.first == b.first;
+            }), cases.end());
+        int64_t low = cases.front().first.AsInt();
+        int64_t range = static_cast<int64_t>(cases.back().first.AsInt()) - low + 1;
+        if (range * 2 <= static_cast<int64_t>(cases.size()) * 5) {
+            table.kind = SwitchTable::Dense;
+            table.low = static_cast<int32_t>(low);
+            table.targets.assign(range, -1);
+            for (auto& item : cases)
+                table.targets[item.first.AsInt() - low] = static_cast<int32_t>(item.second);
+        } else {
+            table.kind = SwitchTable::Sparse;
+            for (auto& item : cases) {
+                table.integers.push_back(item.first.AsInt());
+                table.targets.push_back(static_cast<int32_t>(item.second));
+            }
+        }
+        return true;
+    }
+    if (!strings)
+        return false;
+    std::vector<size_t> hashes;
+    std::vector<std::pair<Value, size_t>> unique;
+    std::unordered_set<std::string_view> seen;
+    for (auto& item : cases) {
+        auto string = static_cast<StringObject*>(item.first.AsObject());
+        if (!seen.insert(string->View()).second)
+            continue;
+        hashes.push_back(string->Hash());
+        unique.push_back(item);
+    }
+    std::vector<size_t> slots;
+    if (!BuildPerfectHash(hashes, table.seeds, slots))
+        return false;
+    table.kind = SwitchTable::String;
+    table.strings.assign(table.seeds.size(), Value::Nil());
+    table.targets.assign(table.seeds.size(), -1);
+    for (size_t n = 0; n < unique.size(); n++) {
+        table.strings[slots[n]] = unique[n].first;
+        table.targets[slots[n]] = static_cast<int32_t>(unique[n].second);
+    }
+    return true;
+}
+
+// The results are computed before the finally blocks and then the defers
+// run, which call above them
+void BytecodeCompiler::CompileReturn(ast::ReturnStmt* stmt) {
+    int save = state_->freeRegister;
+    auto& exprs = stmt->exprs_;
+    bool finally = std::any_of(state_->tries.begin(), state_->tries.end(),
+        [](const Try& entry) { return entry.stmt->finally_ != nullptr; });
+    int base = 0;
+    if (finally) {
+        // The results are kept in locals, the finally blocks may declare
+        // their own above them
+        BeginScope();
+        base = static_cast<int>(state_->locals.size());
+        for (size_t n = 0; n < exprs.size(); n++)
+            DeclareLocal("", nullptr);
+        for (size_t n = 0; n < exprs.size(); n++)
+            CompileExpr(exprs[n], base + static_cast<int>(n));
+    } else if (exprs.size() == 1) {
+        base = CompileToRegister(exprs[0]);
+    } else if (!exprs.empty()) {
+        base = state_->freeRegister;
+        for (auto expr : exprs)
+            CompileExpr(expr, AllocRegister());
+    }
+    CompileFinallyBlocks(0);
+    EndDeferRange();
+    CompileDeferredCalls();
+    Emit(EncodeABC(OpCode::Return, base, static_cast<int>(exprs.size()), 0));
+    BeginDeferRange();
+    ResumeTries(0);
+    if (finally)
+        EndScope();
+    state_->freeRegister = save;
+}
+
+void BytecodeCompiler::DeclareDefers(ast::FunctionBlockDecl* block) {
+    int stack = -1;
+    for (auto node : block->nodes_)
+        FindDefers(node, nullptr, stack, true);
+    for (auto& defer : state_->defers) {
+        // The receiver may be known only when the defer is compiled, a
+        // register is reserved for it
+        int values = static_cast<int>(defer.stmt->call_->arguments_.size()) + 2;
+        if (defer.stack >= 0) {
+            auto& deferStack = state_->deferStacks[defer.stack];
+            deferStack.values = std::max(deferStack.values, values + (deferStack.defers.size() > 1));
+            continue;
+        }
+        defer.reg = DeclareLocal("", nullptr);
+        for (int n = 1; n < values; n++)
+            DeclareLocal("", nullptr);
+        if (!defer.topLevel)
+            defer.flag = DeclareLocal("", nullptr);
+    }
+    for (auto& deferStack : state_->deferStacks)
+        deferStack.reg = DeclareLocal("", nullptr);
+}
+
+// loop is the outermost loop around the node, stack the index of its defer
+// stack, -1 until a defer is found in it
+void BytecodeCompiler::FindDefers(ast::Node* node, ast::Node* loop, int& stack, bool topLevel) {
+    if (!node || dynamic_cast<ast::Expr*>(node))
+        return;
+    if (node->Kind() == ast::NodeKind::DeferStmt) {
+        Defer defer;
+        defer.stmt = static_cast<ast::DeferStmt*>(node);
+        defer.topLevel = topLevel;
+        if (loop) {
+            if (stack < 0) {
+                stack = static_cast<int>(state_->deferStacks.size());
+                state_->deferStacks.push_back(DeferStack());
+                state_->deferStacks.back().loop = loop;
+            }
+            auto& deferStack = state_->deferStacks[stack];
+            defer.stack = stack;
+            defer.site = static_cast<int>(deferStack.defers.size());
+            deferStack.defers.push_back(state_->defers.size());
+        }
+        state_->defers.push_back(defer);
+        return;
+    }
+    std::vector<ast::Node*> children;
+    ast::CollectChildren(node, children);
+    if (!loop && IsLoop(node)) {
+        int loopStack = -1;
+        for (auto child : children)
+            FindDefers(child, node, loopStack, false);
+        return;
+    }
+    for (auto child : children)
+        FindDefers(child, loop, stack, false);
+}
+
+// The callee and the arguments are evaluated at the defer, like Go
+void BytecodeCompiler::CompileDefer(ast::DeferStmt* stmt) {
+    auto iter = std::find_if(state_->defers.begin(), state_->defers.end(),
+        [stmt](const Defer& defer) { return defer.stmt == stmt; });
+    if (iter == state_->defers.end() || !stmt->call_) {
+        Error("defer outside of a function");
+        return;
+    }
+    if (state_->finallies > 0) {
+        Error("defer in finally is not supported by the bytecode compiler");
+        return;
+    }
+    Defer& defer = *iter;
+    size_t index = iter - state_->defers.begin();
+    int save = state_->freeRegister;
+    if (defer.stack >= 0) {
+        auto& deferStack = state_->deferStacks[defer.stack];
+        int first = AllocRegister();
+        int base = first;
+        if (deferStack.defers.size() > 1) {
+            Emit(EncodeAsBx(OpCode::LoadInt, first, defer.site));
+            base = AllocRegister();
+        }
+        defer.argc = CompileArguments(stmt->call_, base);
+        Emit(EncodeABC(OpCode::DeferPush, deferStack.reg, first, base + defer.argc + 1 - first));
+    } else {
+        int base = AllocRegister();
+        defer.argc = CompileArguments(stmt->call_, base);
+        for (int n = 0; n <= defer.argc; n++)
+            Emit(EncodeABC(OpCode::Move, defer.reg + n, base + n, 0));
+        if (defer.flag >= 0)
+            Emit(EncodeABC(OpCode::LoadBool, defer.flag, 1, 0));
+        defer.depth = state_->scopes.size();
+        defer.open = true;
+        EndDeferRange();
+        state_->reached.push_back(index);
+        BeginDeferRange();
+    }
+    for (auto position : defer.calls) {
+        auto& call = state_->function->code[position];
+        call = EncodeABC(OpCode::Call, GetA(call), defer.argc, GetC(call));
+    }
+    defer.calls.clear();
+    state_->freeRegister = save;
+}
+
+void BytecodeCompiler::CompileDeferredCalls() {
+    int top = state_->freeRegister;
+    for (auto iter = state_->reached.rbegin(); iter != state_->reached.rend(); ++iter) {
+        Defer& defer = state_->defers[*iter];
+        if (defer.stack >= 0) {
+            CompileDeferStack(state_->deferStacks[defer.stack]);
+            continue;
+        }
+        // A flag register not set is nil, it is read before it is written
+        // so the frame clears it
+        size_t skip = 0;
+        bool guarded = defer.flag >= 0 && !defer.open;
+        if (guarded) {
+            Emit(EncodeABC(OpCode::Test, defer.flag, 0, 0));
+            skip = EmitJump();
+        }
+        for (int n = 0; n <= defer.argc; n++)
+            Emit(EncodeABC(OpCode::Move, AllocRegister(), defer.reg + n, 0));
+        Emit(EncodeABC(OpCode::Call, top, defer.argc, 0));
+        state_->freeRegister = top;
+        if (guarded)
+            PatchJump(skip, CurrentPosition());
+    }
+}
+
+// Pop the records of the stack and call them, the site of a record selects
+// the call of its defer
+void BytecodeCompiler::CompileDeferStack(DeferStack& stack) {
+    int top = state_->freeRegister;
+    for (int n = 0; n <= stack.values; n++)
+        AllocRegister();
+    int callee = stack.defers.size() > 1 ? top + 1 : top;
+    int site = top + stack.values;
+    size_t loop = CurrentPosition();
+    Emit(EncodeABC(OpCode::DeferPop, top, stack.reg, stack.values));
+    size_t done = EmitJump();
+    for (size_t n = 0; n < stack.defers.size(); n++) {
+        Defer& defer = state_->defers[stack.defers[n]];
+        size_t next = 0;
+        bool tested = n + 1 < stack.defers.size();
+        if (tested) {
+            Emit(EncodeAsBx(OpCode::LoadInt, site, defer.site));
+            Emit(EncodeABC(OpCode::TestEq, 0, top, site));
+            next = EmitJump();
+        }
+        size_t call = Emit(EncodeABC(OpCode::Call, callee, std::max(defer.argc, 0), 0));
+        if (defer.argc < 0)
+            defer.calls.push_back(call);
+        PatchJump(EmitJump(), loop);
+        if (tested)
+            PatchJump(next, CurrentPosition());
+    }
+    PatchJump(done, CurrentPosition());
+    state_->freeRegister = top;
+}
+
+void BytecodeCompiler::EndDeferRange() {
+    size_t end = CurrentPosition();
+    if (!state_->reached.empty() && end > state_->deferStart)
+        state_->deferRanges.push_back({state_->deferStart, end, state_->reached.size()});
+}
+
+void BytecodeCompiler::BeginDeferRange() {
+    state_->deferStart = CurrentPosition();
+}
+
+// The ranges are in the order of the code, where the defers reached only
+// grow. A defer throwing in the handler skips the ones after it.
+void BytecodeCompiler::CompileDeferHandlers() {
+    auto& ranges = state_->deferRanges;
+    std::vector<size_t> reached = state_->reached;
+    for (size_t n = 0; n < ranges.size(); ) {
+        BeginScope();
+        ExceptionHandler handler;
+        handler.target = static_cast<uint32_t>(CurrentPosition());
+        handler.reg = DeclareLocal("", nullptr);
+        handler.rethrows = true;
+        DeclareLocal("", nullptr);
+        DeclareLocal("", nullptr);
+        state_->reached.resize(ranges[n].reached);
+        CompileDeferredCalls();
+        Emit(EncodeABC(OpCode::Throw, handler.reg, 0, 1));
+        EndScope();
+        for (size_t count = ranges[n].reached; n < ranges.size() && ranges[n].reached == count; n++) {
+            handler.start = static_cast<uint32_t>(ranges[n].start);
+            handler.end = static_cast<uint32_t>(ranges[n].end);
+            state_->function->handlers.push_back(handler);
+        }
+        state_->reached = reached;
+    }
+}
+
+void BytecodeCompiler::CompileThrow(ast::ThrowStmt* stmt) {
+    int save = state_->freeRegister;
+    int reg = CompileToRegister(stmt->expr_);
+    Emit(EncodeABC(OpCode::Throw, reg, 0, 0));
+    state_->freeRegister = save;
+}
+
+// Nothing is run on entering the try, its ranges are given to the handlers
+// once it is compiled. The finally is compiled after the block, after each
+// catch and before each exit leaving them. The handler of the finally
+// catches the rest, runs it and throws the exception again.
+void BytecodeCompiler::CompileTry(ast::TryStmt* stmt) {
+    auto& tries = state_->tries;
+    std::vector<ExceptionHandler> handlers;
+    std::vector<size_t> ends;
+    Try entry;
+    entry.stmt = stmt;
+    entry.loops = state_->loops.size();
+    entry.start = CurrentPosition();
+    tries.push_back(entry);
+    CompileBlock(stmt->block_);
+    EndRange(tries.back());
+    entry = tries.back();
+    tries.pop_back();
+    CompileFinally(stmt);
+    ends.push_back(EmitJump());
+
+    for (auto catchStmt : stmt->catches_) {
+        SetLine(catchStmt);
+        BeginScope();
+        ExceptionHandler handler;
+        handler.target = static_cast<uint32_t>(CurrentPosition());
+        // The variable has the declared type if there is one
+        ast::Type* type = catchStmt->types_.size() == 1 ? catchStmt->types_[0] : nullptr;
+        handler.reg = DeclareLocal(catchStmt->name_ ? catchStmt->name_->name_ : "", ClassOfType(type),
+            InterfaceOfType(type));
+        for (auto type : catchStmt->types_) {
+            if (!CatchType(type, handler))
+                continue;
+            for (auto& range : entry.block) {
+                handler.start = static_cast<uint32_t>(range.first);
+                handler.end = static_cast<uint32_t>(range.second);
+                handlers.push_back(handler);
+            }
+        }
+        entry.inCatch = true;
+        entry.start = CurrentPosition();
+        tries.push_back(entry);
+        CompileBlock(catchStmt->block_);
+        EndRange(tries.back());
+        entry = tries.back();
+        tries.pop_back();
+        EndScope();
+        CompileFinally(stmt);
+        ends.push_back(EmitJump());
+    }
+
+    if (stmt->finally_) {
+        SetLine(stmt->finally_);
+        BeginScope();
+        ExceptionHandler handler;
+        handler.target = static_cast<uint32_t>(CurrentPosition());
+        handler.reg = DeclareLocal("", nullptr);
+        handler.rethrows = true;
+        DeclareLocal("", nullptr);
+        DeclareLocal("", nullptr);
+        CompileFinally(stmt);
+        Emit(EncodeABC(OpCode::Throw, handler.reg, 0, 1));
+        EndScope();
+        for (auto ranges : {&entry.block, &entry.catches}) {
+            for (auto& range : *ranges) {
+                handler.start = static_cast<uint32_t>(range.first);
+                handler.end = static_cast<uint32_t>(range.second);
+                handlers.push_back(handler);
+            }
+        }
+    }
+    PatchJumps(ends, CurrentPosition());
+    auto& table = state_->function->handlers;
+    table.insert(table.end(), handlers.begin(), handlers.end());
+}
+
+bool BytecodeCompiler::CatchType(ast::Type* type, ExceptionHandler& handler) {
+    handler.klass = nullptr;
+    handler.interface = -1;
+    handler.type.clear();
+    if (!type)
+        return false;
+    switch (type->Kind()) {
+        case ast::NodeKind::PrimitiveType: {
+            auto& name = static_cast<ast::PrimitiveType*>(type)->name_;
+            if (IsIntegerType(name))
+                handler.type = "int";
+            else if (name == "float" || name == "double")
+                handler.type = "float";
+            else
+                handler.type = name;
+            return true;
+        }
+        case ast::NodeKind::ArrayType:
+            handler.type = "array";
+            return true;
+        case ast::NodeKind::MapType:
+            handler.type = "map";
+            return true;
+        default:
+            break;
+    }
+    handler.klass = ClassOfType(type);
+    handler.interface = InterfaceOfType(type);
+    if (handler.klass || handler.interface >= 0)
+        return true;
+    auto name = type->Kind() == ast::NodeKind::NonPrimitiveType ?
+        static_cast<ast::NonPrimitiveType*>(type)->name_ : nullptr;
+    Error("undefined type " + (name ? name->name_ : std::string("?")) + " in catch");
+    return false;
+}
+
+void BytecodeCompiler::CompileFinally(ast::TryStmt* stmt) {
+    if (!stmt->finally_)
+        return;
+    state_->finallies++;
+    CompileBlock(stmt->finally_->block_);
+    state_->finallies--;
+}
+
+void BytecodeCompiler::CompileFinallyBlocks(size_t count) {
+    auto& tries = state_->tries;
+    for (size_t n = tries.size(); n-- > count; ) {
+        EndRange(tries[n]);
+        // An exit in the finally leaves only the tries around this one
+        std::vector<Try> left(tries.begin() + n, tries.end());
+        tries.resize(n);
+        CompileFinally(left[0].stmt);
+        tries.insert(tries.end(), left.begin(), left.end());
+    }
+}
+
+void BytecodeCompiler::ResumeTries(size_t count) {
+    for (size_t n = count; n < state_->tries.size(); n++)
+        state_->tries[n].start = CurrentPosition();
+}
+
+void BytecodeCompiler::EndRange(Try& entry) {
+    size_t end = CurrentPosition();
+    if (end > entry.start)
+        (entry.inCatch ? entry.catches : entry.block).push_back({entry.start, end});
+}
+
+//
+// Expressions
+//
+
+int BytecodeCompiler::CompileToRegister(ast::Expr* expr) {
+    if (expr && expr->Kind() == ast::NodeKind::Identifier) {
+        if (auto local = FindLocal(static_cast<ast::Identifier*>(expr)->name_))
+            return local->reg;
+    }
+    // The result of a call is left in its callee slot, which is a new
+    // temporary here
+    if (expr && expr->Kind() == ast::NodeKind::CallExpr) {
+        int reg = state_->freeRegister;
+        CompileCall(static_cast<ast::CallExpr*>(expr), 1);
+        return reg;
+    }
+    int reg = AllocRegister();
+    CompileExpr(expr, reg);
+    return reg;
+}
+
+void BytecodeCompiler::CompileExpr(ast::Expr* expr, int target) {
+    if (!expr) {
+        Error("missing expression");
+        return;
+    }
+    int save = state_->freeRegister;
+    // Temporaries of the expression must be above the target
+    if (state_->freeRegister <= target)
+        state_->freeRegister = target + 1;
+    switch (expr->Kind()) {
+        case ast::NodeKind::UnaryExpr:
+        case ast::NodeKind::BinaryExpr:
+        case ast::NodeKind::SelectorExpr:
+        case ast::NodeKind::IndexExpr:
+            if (CompileFolded(expr, target)) {
+                state_->freeRegister = save;
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    switch (expr->Kind()) {
+        case ast::NodeKind::LiteralExpr:
+            CompileLiteral(static_cast<ast::LiteralExpr*>(expr), target);
+            break;
+        case ast::NodeKind::Identifier:
+            CompileIdentifier(static_cast<ast::Identifier*>(expr), target);
+            break;
+        case ast::NodeKind::UnaryExpr: {
+            auto unary = static_cast<ast::UnaryExpr*>(expr);
+            int operand = CompileToRegister(unary->expr_);
+            switch (unary->op_) {
+                case Token::SUB:
+                    Emit(EncodeABC(OpCode::Neg, target, operand, 0));
+                    break;
+                case Token::NOT:
+                    Emit(EncodeABC(OpCode::Not, target, operand, 0));
+                    break;
+                case Token::XOR: {
+                    int ones = AllocRegister();
+                    Emit(EncodeAsBx(OpCode::LoadInt, ones, -1));
+                    Emit(EncodeABC(OpCode::BitXor, target, operand, ones));
+                    break;
+                }
+                default:
+                    if (operand != target)
+                        Emit(EncodeABC(OpCode::Move, target, operand, 0));
+                    break;
+            }
+            break;
+        }
+        case ast::NodeKind::BinaryExpr:
+            CompileBinary(static_cast<ast::BinaryExpr*>(expr), target);
+            break;
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(expr);
+            if (!selector->selector_)
+                break;
+            auto& name = selector->selector_->name_;
+            // Static method of a class used as a value
+            if (selector->expr_ && selector->expr_->Kind() == ast::NodeKind::Identifier &&
+                    !FindLocal(static_cast<ast::Identifier*>(selector->expr_)->name_)) {
+                auto klass = classes_.find(static_cast<ast::Identifier*>(selector->expr_)->name_);
+                if (klass != classes_.end()) {
+                    auto& statics = statics_[klass->second];
+                    auto method = statics.find(name);
+                    if (method == statics.end())
+                        Error(klass->first + " has no static method " + name);
+                    else
+                        Emit(EncodeABx(OpCode::LoadK, target,
+                            AddConstant(Value::FromObject(method->second))));
+                    break;
+                }
+            }
+            // Constant of a package, those which fold are compiled above
+            if (selector->expr_ && selector->expr_->Kind() == ast::NodeKind::Identifier) {
+                Value value;
+                std::string error;
+                if (BindName(static_cast<ast::Identifier*>(selector->expr_)->name_, value) ==
+                        ConstEvaluator::Binding::None && constants_.Lookup(package_, selector, value, error)) {
+                    CompileValue(value, target);
+                    break;
+                }
+                if (!error.empty()) {
+                    Error(error);
+                    break;
+                }
+            }
+            ClassObject* klass = ClassOf(selector->expr_);
+            int object = CompileToRegister(selector->expr_);
+            int field = klass ? klass->FieldIndex(name) : -1;
+            if (field >= 0 && field <= 0xff)
+                Emit(EncodeABC(OpCode::GetField, target, object, field));
+            else
+                Emit(EncodeABC(OpCode::GetFieldK, target, object, SmallConstant(AddStringConstant(name))));
+            break;
+        }
+        case ast::NodeKind::IndexExpr: {
+            auto index = static_cast<ast::IndexExpr*>(expr);
+            int object = CompileToRegister(index->expr_);
+            int key = CompileToRegister(index->index_);
+            Emit(EncodeABC(OpCode::GetIndex, target, object, key));
+            // A missing key reads the zero value of the map, as in C
+            auto type = DeclaredType(index->expr_);
+            if (type && type->Kind() == ast::NodeKind::MapType) {
+                Value zero = ZeroValue(static_cast<ast::MapType*>(type)->rightType_);
+                if (!zero.IsNil())
+                    Emit(EncodeABx(OpCode::OrZero, target, AddConstant(zero)));
+            }
+            break;
+        }
+        case ast::NodeKind::CallExpr: {
+            int base = state_->freeRegister;
+            CompileCall(static_cast<ast::CallExpr*>(expr), 1);
+            if (base != target)
+                Emit(EncodeABC(OpCode::Move, target, base, 0));
+            break;
+        }
+        case ast::NodeKind::NewExpr:
+            CompileNew(static_cast<ast::NewExpr*>(expr), target);
+            break;
+        case ast::NodeKind::ArrayLiteralExpr: {
+            auto& elements = static_cast<ast::ArrayLiteralExpr*>(expr)->elements_;
+            if (elements.size() > 0xff) {
+                Error("too many elements in literal");
+                break;
+            }
+            int start = state_->freeRegister;
+            for (auto element : elements)
+                CompileExpr(element, AllocRegister());
+            Emit(EncodeABC(OpCode::NewArray, target, start, static_cast<int>(elements.size())));
+            break;
+        }
+        case ast::NodeKind::MapLiteralExpr: {
+            auto& elements = static_cast<ast::MapLiteralExpr*>(expr)->elements_;
+            if (elements.size() > 0x7f) {
+                Error("too many elements in literal");
+                break;
+            }
+            int start = state_->freeRegister;
+            for (auto& element : elements) {
+                CompileExpr(element.first, AllocRegister());
+                CompileExpr(element.second, AllocRegister());
+            }
+            Emit(EncodeABC(OpCode::NewMap, target, start, static_cast<int>(elements.size())));
+            break;
+        }
+        default:
+            Error(std::string(ast::NodeKindName(expr->Kind())) + " is not supported by the bytecode compiler");
+            break;
+    }
+    state_->freeRegister = save;
+}
+
+void BytecodeCompiler::CompileLiteral(ast::LiteralExpr* expr, int target) {
+    switch (expr->kind_) {
+        case Token::INT: {
+            bool hex = expr->value_.size() > 2 && expr->value_[0] == '0' &&
+                (expr->value_[1] == 'x' || expr->value_[1] == 'X');
+            char* end = nullptr;
+            long long number = strtoll(expr->value_.c_str(), &end, hex ? 16 : 10);
+            if (*end != '\0' || number < INT32_MIN || number > UINT32_MAX) {
+                Error("integer literal " + expr->value_ + " is out of range");
+                return;
+            }
+            auto value = static_cast<int32_t>(static_cast<uint32_t>(number));
+            if (value >= -kBiasBx && value <= kMaxBx - kBiasBx)
+                Emit(EncodeAsBx(OpCode::LoadInt, target, value));
+            else
+                Emit(EncodeABx(OpCode::LoadK, target, AddConstant(Value::Int(value))));
+            return;
+        }
+        case Token::FLOAT:
+            Emit(EncodeABx(OpCode::LoadK, target, AddConstant(Value::Double(strtod(expr->value_.c_str(), nullptr)))));
+            return;
+        case Token::CHAR:
+            Emit(EncodeAsBx(OpCode::LoadInt, target,
+                expr->value_.empty() ? 0 : static_cast<unsigned char>(expr->value_[0])));
+            return;
+        case Token::STRING:
+            Emit(EncodeABx(OpCode::LoadK, target, AddStringConstant(expr->value_)));
+            return;
+        case Token::TRUE:
+        case Token::FALSE:
+            Emit(EncodeABC(OpCode::LoadBool, target, expr->kind_ == Token::TRUE, 0));
+            return;
+        case Token::NIL:
+            Emit(EncodeABC(OpCode::LoadNil, target, 0, 0));
+            return;
+        default:
+            Error("invalid literal " + expr->value_);
+            return;
+    }
+}
+
+void BytecodeCompiler::CompileIdentifier(ast::Identifier* expr, int target) {
+    auto& name = expr->name_;
+    if (auto local = FindLocal(name)) {
+        if (local->reg != target)
+            Emit(EncodeABC(OpCode::Move, target, local->reg, 0));
+        return;
+    }
+    if (state_->hasSelf) {
+        int field = state_->owner->FieldIndex(name);
+        if (field >= 0 && field <= 0xff) {
+            Emit(EncodeABC(OpCode::GetField, target, 0, field));
+            return;
+        }
+    }
+    Value value;
+    std::string error;
+    if (constants_.Lookup(package_, expr, value, error)) {
+        CompileValue(value, target);
+        return;
+    }
+    if (!error.empty()) {
+        Error(error);
+        return;
+    }
+    auto global = globals_.find(name);
+    if (global != globals_.end()) {
+        Emit(EncodeABx(OpCode::GetGlobal, target, global->second));
+        return;
+    }
+    auto function = functions_.find(name);
+    if (function != functions_.end()) {
+        Emit(EncodeABx(OpCode::LoadK, target, AddConstant(Value::FromObject(function->second))));
+        return;
+    }
+    if (state_->owner) {
+        auto& statics = statics_[state_->owner];
+        auto method = statics.find(name);
+        if (method != statics.end()) {
+            Emit(EncodeABx(OpCode::LoadK, target, AddConstant(Value::FromObject(method->second))));
+            return;
+        }
+    }
+    auto klass = classes_.find(name);
+    if (klass != classes_.end()) {
+        Emit(EncodeABx(OpCode::LoadK, target, AddConstant(Value::FromObject(klass->second))));
+        return;
+    }
+    Error("undefined name " + name);
+}
+
+void BytecodeCompiler::CompileBinary(ast::BinaryExpr* expr, int target) {
+    int op = expr->op_;
+    if (op == Token::LAND || op == Token::LOR) {
+        // The value of the last operand evaluated is the result
+        CompileExpr(expr->left_, target);
+        Emit(EncodeABC(OpCode::Test, target, 0, op == Token::LOR));
+        size_t end = EmitJump();
+        CompileExpr(expr->right_, target);
+        PatchJump(end, CurrentPosition());
+        return;
+    }
+    int value = 0;
+    if ((op == Token::ADD || op == Token::SUB) && SmallIntLiteral(expr->right_, value) &&
+            (op == Token::ADD || value != -128)) {
+        int left = CompileToRegister(expr->left_);
+        Emit(EncodeABC(OpCode::AddInt, target, left, (op == Token::ADD ? value : -value) + 128));
+        return;
+    }
+    int left = CompileToRegister(expr->left_);
+    int right = CompileToRegister(expr->right_);
+    switch (op) {
+        case Token::EQL:
+            Emit(EncodeABC(OpCode::Eq, target, left, right));
+            return;
+        case Token::NEQ:
+            Emit(EncodeABC(OpCode::Eq, target, left, right));
+            Emit(EncodeABC(OpCode::Not, target, target, 0));
+            return;
+        case Token::LSS:
+            Emit(EncodeABC(OpCode::Lt, target, left, right));
+            return;
+        case Token::GTR:
+            Emit(EncodeABC(OpCode::Lt, target, right, left));
+            return;
+        case Token::LEQ:
+            Emit(EncodeABC(OpCode::Le, target, left, right));
+            return;
+        case Token::GEQ:
+            Emit(EncodeABC(OpCode::Le, target, right, left));
+            return;
+        default:
+            break;
+    }
+    OpCode code = ArithmeticOpCode(op);
+    if (code == OpCode::Move) {
+        Error(std::string("operator ") + TokenTypeString(op) + " is not supported by the bytecode compiler");
+        return;
+    }
+    Emit(EncodeABC(code, target, left, right));
+}
+
+bool BytecodeCompiler::CompileFolded(ast::Expr* expr, int target) {
+    Value value;
+    if (!constants_.Fold(package_, expr, scope_, value))
+        return false;
+    CompileValue(value, target);
+    return true;
+}
+
+void BytecodeCompiler::CompileValue(Value value, int target) {
+    if (value.IsInt() && value.AsInt() >= -kBiasBx && value.AsInt() <= kMaxBx - kBiasBx)
+        Emit(EncodeAsBx(OpCode::LoadInt, target, value.AsInt()));
+    else if (value.IsBool())
+        Emit(EncodeABC(OpCode::LoadBool, target, value.AsBool(), 0));
+    else if (value.IsNil())
+        Emit(EncodeABC(OpCode::LoadNil, target, 0, 0));
+    else
+        Emit(EncodeABx(OpCode::LoadK, target, AddConstant(value)));
+}
+
+void BytecodeCompiler::CompileCondition(ast::Expr* expr, bool jumpIf, std::vector<size_t>& jumps) {
+    if (expr && expr->Kind() == ast::NodeKind::UnaryExpr &&
+            static_cast<ast::UnaryExpr*>(expr)->op_ == Token::NOT) {
+        CompileCondition(static_cast<ast::UnaryExpr*>(expr)->expr_, !jumpIf, jumps);
+        return;
+    }
+    // A constant condition jumps always or never
+    Value value;
+    if (expr && constants_.Fold(package_, expr, scope_, value)) {
+        if (value.IsTruthy() == jumpIf)
+            jumps.push_back(EmitJump());
+        return;
+    }
+    if (expr && expr->Kind() == ast::NodeKind::BinaryExpr) {
+        auto binary = static_cast<ast::BinaryExpr*>(expr);
+        int op = binary->op_;
+        if (op == Token::LAND || op == Token::LOR) {
+            // a && b jumps if false when a or b is false, and jumps if true
+            // when both are true, || is the dual
+            bool shortCircuit = op == Token::LOR;
+            if (jumpIf == shortCircuit) {
+                CompileCondition(binary->left_, jumpIf, jumps);
+                CompileCondition(binary->right_, jumpIf, jumps);
+            } else {
+                std::vector<size_t> skip;
+                CompileCondition(binary->left_, !jumpIf, skip);
+                CompileCondition(binary->right_, jumpIf, jumps);
+                PatchJumps(skip, CurrentPosition());
+            }
+            return;
+        }
+        if (IsComparison(op)) {
+            int save = state_->freeRegister;
+            int left = CompileToRegister(binary->left_);
+            int right = CompileToRegister(binary->right_);
+            state_->freeRegister = save;
+            switch (op) {
+                case Token::EQL:
+                    Emit(EncodeABC(OpCode::TestEq, jumpIf, left, right));
+                    break;
+                case Token::NEQ:
+                    Emit(EncodeABC(OpCode::TestEq, !jumpIf, left, right));
+                    break;
+                case Token::LSS:
+                    Emit(EncodeABC(OpCode::TestLt, jumpIf, left, right));
+                    break;
+                case Token::GTR:
+                    Emit(EncodeABC(OpCode::TestLt, jumpIf, right, left));
+                    break;
+                case Token::LEQ:
+                    Emit(EncodeABC(OpCode::TestLe, jumpIf, left, right));
+                    break;
+                case Token::GEQ:
+                    Emit(EncodeABC(OpCode::TestLe, jumpIf, right, left));
+                    break;
+            }
+            jumps.push_back(EmitJump());
+            return;
+        }
+    }
+    int save = state_->freeRegister;
+    int reg = CompileToRegister(expr);
+    state_->freeRegister = save;
+    Emit(EncodeABC(OpCode::Test, reg, 0, jumpIf));
+    jumps.push_back(EmitJump());
+}
+
+void BytecodeCompiler::CompileCall(ast::CallExpr* expr, int numResults) {
+    int base = AllocRegister();
+    int argc = CompileArguments(expr, base);
+    Emit(EncodeABC(OpCode::Call, base, argc, numResults));
+    state_->freeRegister = base;
+    // The results must be within the registers of the function
+    for (int n = 0; n < numResults; n++)
+        AllocRegister();
+    state_->freeRegister = base + 1;
+}
+
+int BytecodeCompiler::CompileArguments(ast::CallExpr* expr, int base) {
+    int argc = 0;
+    auto callee = expr->function_;
+    bool compiled = false;
+    if (callee && callee->Kind() == ast::NodeKind::Identifier) {
+        auto& name = static_cast<ast::Identifier*>(callee)->name_;
+        // A method of the class called without self
+        auto method = state_->hasSelf && !FindLocal(name) ? state_->owner->Method(name) : nullptr;
+        if (method) {
+            Emit(EncodeABx(OpCode::LoadK, base, AddConstant(Value::FromObject(method))));
+            Emit(EncodeABC(OpCode::Move, AllocRegister(), 0, 0));
+            argc = 1;
+            compiled = true;
+        }
+    } else if (callee && callee->Kind() == ast::NodeKind::SelectorExpr) {
+        auto selector = static_cast<ast::SelectorExpr*>(callee);
+        auto object = selector->expr_;
+        bool isClass = object && object->Kind() == ast::NodeKind::Identifier &&
+            !FindLocal(static_cast<ast::Identifier*>(object)->name_) &&
+            classes_.count(static_cast<ast::Identifier*>(object)->name_);
+        if (!isClass && selector->selector_) {
+            // Self reads the receiver from the register after the callee
+            CompileExpr(object, AllocRegister());
+            Emit(EncodeABx(OpCode::Self, base, AddCallSite(selector->selector_->name_, InterfaceOf(object))));
+            argc = 1;
+            compiled = true;
+        }
+    }
+    if (!compiled)
+        CompileExpr(callee, base);
+    for (auto argument : expr->arguments_) {
+        CompileExpr(argument, AllocRegister());
+        argc++;
+    }
+    if (argc > 0xff) {
+        Error("too many arguments");
+        argc = 0xff;
+    }
+    return argc;
+}
+
+void BytecodeCompiler::CompileNew(ast::NewExpr* expr, int target) {
+    ClassObject* klass = ClassOfType(expr->type_);
+    if (!klass) {
+        Error("new of a type which is not a class");
+        return;
+    }
+    // The constructor is called as a method with the new instance as self
+    int base = AllocRegister();
+    int object = AllocRegister();
+    Emit(EncodeABx(OpCode::New, object, AddConstant(Value::FromObject(klass))));
+    if (klass->constructor) {
+        Emit(EncodeABx(OpCode::LoadK, base, AddConstant(Value::FromObject(klass->constructor))));
+        for (auto argument : expr->arguments_)
+            CompileExpr(argument, AllocRegister());
+        if (expr->arguments_.size() + 1 > 0xff)
+            Error("too many arguments");
+        Emit(EncodeABC(OpCode::Call, base, static_cast<int>(expr->arguments_.size() + 1) & 0xff, 0));
+    } else if (!expr->arguments_.empty()) {
+        Error(klass->name + " has no constructor");
+    }
+    Emit(EncodeABC(OpCode::Move, target, object, 0));
+}
+
+ClassObject* BytecodeCompiler::ClassOf(ast::Expr* expr) {
+    if (!expr)
+        return nullptr;
+    switch (expr->Kind()) {
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(expr)->name_;
+            if (auto local = FindLocal(name))
+                return local->klass;
+            if (state_->hasSelf) {
+                int field = state_->owner->FieldIndex(name);
+                if (field >= 0)
+                    return fieldClasses_[state_->owner][field];
+            }
+            return nullptr;
+        }
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(expr);
+            ClassObject* klass = ClassOf(selector->expr_);
+            if (!klass || !selector->selector_)
+                return nullptr;
+            int field = klass->FieldIndex(selector->selector_->name_);
+            return field >= 0 ? fieldClasses_[klass][field] : nullptr;
+        }
+        case ast::NodeKind::NewExpr:
+            return ClassOfType(static_cast<ast::NewExpr*>(expr)->type_);
+        default:
+            return nullptr;
+    }
+}
+
+int BytecodeCompiler::InterfaceOf(ast::Expr* expr) {
+    if (!expr)
+        return -1;
+    switch (expr->Kind()) {
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(expr)->name_;
+            if (auto local = FindLocal(name))
+                return local->interface;
+            if (state_->hasSelf) {
+                int field = state_->owner->FieldIndex(name);
+                if (field >= 0)
+                    return fieldInterfaces_[state_->owner][field];
+            }
+            return -1;
+        }
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(expr);
+            ClassObject* klass = ClassOf(selector->expr_);
+            if (!klass || !selector->selector_)
+                return -1;
+            int field = klass->FieldIndex(selector->selector_->name_);
+            return field >= 0 ? fieldInterfaces_[klass][field] : -1;
+        }
+        default:
+            return -1;
+    }
+}
+
+int BytecodeCompiler::InterfaceOfType(ast::Type* type) {
+    if (!type || type->Kind() != ast::NodeKind::NonPrimitiveType)
+        return -1;
+    auto name = static_cast<ast::NonPrimitiveType*>(type)->name_;
+    if (!name)
+        return -1;
+    auto iter = interfaces_.find(name->name_);
+    return iter == interfaces_.end() ? -1 : iter->second;
+}
+
+ClassObject* BytecodeCompiler::ClassOfType(ast::Type* type) {
+    if (!type || type->Kind() != ast::NodeKind::NonPrimitiveType)
+        return nullptr;
+    auto name = static_cast<ast::NonPrimitiveType*>(type)->name_;
+    if (!name)
+        return nullptr;
+    auto iter = classes_.find(name->name_);
+    return iter == classes_.end() ? nullptr : iter->second;
+}
+
+Value BytecodeCompiler::ZeroValue(ast::Type* type) {
+    if (!type || type->Kind() != ast::NodeKind::PrimitiveType)
+        return Value::Nil();
+    auto& name = static_cast<ast::PrimitiveType*>(type)->name_;
+    if (IsIntegerType(name))
+        return Value::Int(0);
+    if (name == "float" || name == "double")
+        return Value::Double(0);
+    if (name == "bool")
+        return Value::Bool(false);
+    if (name == "string")
+        return emptyString_;
+    return Value::Nil();
+}
+
+ast::Type* BytecodeCompiler::DeclaredType(ast::Expr* expr) {
+    if (!expr)
+        return nullptr;
+    switch (expr->Kind()) {
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(expr)->name_;
+            if (auto local = FindLocal(name))
+                return local->type;
+            if (state_->hasSelf) {
+                int field = state_->owner->FieldIndex(name);
+                if (field >= 0)
+                    return fieldTypes_[state_->owner][field];
+            }
+            auto global = globals_.find(name);
+            return global != globals_.end() ? globalTypes_[global->second] : nullptr;
+        }
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(expr);
+            ClassObject* klass = ClassOf(selector->expr_);
+            if (!klass || !selector->selector_)
+                return nullptr;
+            int field = klass->FieldIndex(selector->selector_->name_);
+            return field >= 0 ? fieldTypes_[klass][field] : nullptr;
+        }
+        case ast::NodeKind::IndexExpr: {
+            auto type = DeclaredType(static_cast<ast::IndexExpr*>(expr)->expr_);
+            if (type && type->Kind() == ast::NodeKind::ArrayType)
+                return static_cast<ast::ArrayType*>(type)->type_;
+            if (type && type->Kind() == ast::NodeKind::MapType)
+                return static_cast<ast::MapType*>(type)->rightType_;
+            return nullptr;
+        }
+        default:
+            return nullptr;
+    }
+}
+
+BytecodeCompiler::NumberType BytecodeCompiler::NumberOfType(ast::Type* type) {
+    if (!type || type->Kind() != ast::NodeKind::PrimitiveType)
+        return NumberType::None;
+    auto& name = static_cast<ast::PrimitiveType*>(type)->name_;
+    if (IsIntegerType(name))
+        return NumberType::Int;
+    if (name == "float" || name == "double")
+        return NumberType::Double;
+    return NumberType::None;
+}
+
+BytecodeCompiler::NumberType BytecodeCompiler::ArithmeticNumber(OpCode op, NumberType left,
+        NumberType right) {
+    if (left == NumberType::None || right == NumberType::None)
+        return NumberType::None;
+    switch (op) {
+        case OpCode::Add:
+        case OpCode::Sub:
+        case OpCode::Mul:
+        case OpCode::Div:
+        case OpCode::Mod:
+            return left == NumberType::Int && right == NumberType::Int ? NumberType::Int : NumberType::Double;
+        case OpCode::BitAnd:
+        case OpCode::BitOr:
+        case OpCode::BitXor:
+        case OpCode::Shl:
+        case OpCode::Shr:
+            return left == NumberType::Int && right == NumberType::Int ? NumberType::Int : NumberType::None;
+        default:
+            return NumberType::None;
+    }
+}
+
+// Only the values of literals, of local variables and globals whose stores
+// are all converted and of arithmetic on those are known. Fields may be set
+// by name on an object of unknown class, elements by an array literal.
+BytecodeCompiler::NumberType BytecodeCompiler::NumberOf(ast::Expr* expr) {
+    if (!expr)
+        return NumberType::None;
+    switch (expr->Kind()) {
+        case ast::NodeKind::LiteralExpr: {
+            auto kind = static_cast<ast::LiteralExpr*>(expr)->kind_;
+            if (kind == Token::INT)
+                return NumberType::Int;
+            return kind == Token::FLOAT ? NumberType::Double : NumberType::None;
+        }
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(expr)->name_;
+            if (auto local = FindLocal(name)) {
+                if (local->constant) {
+                    if (local->value.IsInt())
+                        return NumberType::Int;
+                    return local->value.IsDouble() ? NumberType::Double : NumberType::None;
+                }
+                return local->converted ? NumberOfType(local->type) : NumberType::None;
+            }
+            if (state_->hasSelf && state_->owner->FieldIndex(name) >= 0)
+                return NumberType::None;
+            auto global = globals_.find(name);
+            return global != globals_.end() ? NumberOfType(globalTypes_[global->second]) : NumberType::None;
+        }
+        case ast::NodeKind::UnaryExpr: {
+            auto unary = static_cast<ast::UnaryExpr*>(expr);
+            if (unary->op_ == Token::SUB || unary->op_ == Token::ADD)
+                return NumberOf(unary->expr_);
+            return unary->op_ == Token::XOR && NumberOf(unary->expr_) == NumberType::Int ?
+                NumberType::Int : NumberType::None;
+        }
+        case ast::NodeKind::BinaryExpr: {
+            auto binary = static_cast<ast::BinaryExpr*>(expr);
+            return ArithmeticNumber(ArithmeticOpCode(binary->op_), NumberOf(binary->left_),
+                NumberOf(binary->right_));
+        }
+        default:
+            return NumberType::None;
+    }
+}
+
+ConstEvaluator::Binding BytecodeCompiler::BindName(const std::string& name, Value& value) {
+    if (auto local = FindLocal(name)) {
+        if (!local->constant)
+            return ConstEvaluator::Binding::Variable;
+        value = local->value;
+        return ConstEvaluator::Binding::Constant;
+    }
+    if (state_ && state_->hasSelf && state_->owner->FieldIndex(name) >= 0)
+        return ConstEvaluator::Binding::Variable;
+    // Global variables and constants have different names, a global hides
+    // a package of the same name
+    if (globals_.count(name))
+        return ConstEvaluator::Binding::Variable;
+    return ConstEvaluator::Binding::None;
+}
+
+//
+// Registers and scopes
+//
+
+int BytecodeCompiler::AllocRegister() {
+    int reg = state_->freeRegister++;
+    if (reg >= kMaxRegisters) {
+        Error("function needs too many registers");
+        state_->freeRegister = kMaxRegisters - 1;
+        return kMaxRegisters - 1;
+    }
+    if (state_->freeRegister > state_->function->numRegisters)
+        state_->function->numRegisters = state_->freeRegister;
+    return reg;
+}
+
+void BytecodeCompiler::BeginScope() {
+    state_->scopes.push_back(state_->locals.size());
+}
+
+void BytecodeCompiler::EndScope() {
+    size_t count = state_->scopes.back();
+    state_->scopes.pop_back();
+    // The exits after the scope may not follow its defers
+    for (auto index : state_->reached) {
+        Defer& defer = state_->defers[index];
+        if (defer.depth > state_->scopes.size())
+            defer.open = false;
+    }
+    state_->locals.resize(count);
+    state_->freeRegister = static_cast<int>(count);
+}
+
+// Locals are allocated at the statement level, when no temporary is live, so
+// local i is always register i
+int BytecodeCompiler::DeclareLocal(const std::string& name, ClassObject* klass, int interface) {
+    state_->freeRegister = static_cast<int>(state_->locals.size());
+    int reg = AllocRegister();
+    state_->locals.push_back({name, reg, klass, interface});
+    return reg;
+}
+
+const BytecodeCompiler::Local* BytecodeCompiler::FindLocal(const std::string& name) const {
+    if (!state_ || name.empty())
+        return nullptr;
+    for (auto iter = state_->locals.rbegin(); iter != state_->locals.rend(); ++iter) {
+        if (iter->name == name)
+            return &*iter;
+    }
+    return nullptr;
+}
+
+//
+// Code emission
+//
+
+size_t BytecodeCompiler::Emit(Instruction instruction) {
+    auto function = state_->function;
+    function->code.push_back(instruction);
+    function->lines.push_back(line_);
+    return function->code.size() - 1;
+}
+
+size_t BytecodeCompiler::EmitJump() {
+    return Emit(EncodesJ(OpCode::Jmp, 0));
+}
+
+void BytecodeCompiler::PatchJump(size_t position, size_t target) {
+    auto& instruction = state_->function->code[position];
+    long offset = static_cast<long>(target) - static_cast<long>(position) - 1;
+    if (GetOp(instruction) == OpCode::Jmp) {
+        if (offset < -kBiasJ || offset > kMaxJ - kBiasJ)
+            Error("jump is too far");
+        instruction = EncodesJ(OpCode::Jmp, static_cast<int>(offset));
+    } else {
+        if (offset < -kBiasBx || offset > kMaxBx - kBiasBx)
+            Error("jump is too far");
+        instruction = EncodeAsBx(GetOp(instruction), GetA(instruction), static_cast<int>(offset));
+    }
+}
+
+void BytecodeCompiler::PatchJumps(const std::vector<size_t>& positions, size_t target) {
+    for (auto position : positions)
+        PatchJump(position, target);
+}
+
+size_t BytecodeCompiler::CurrentPosition() const {
+    return state_->function->code.size();
+}
+
+int BytecodeCompiler::AddConstant(Value value) {
+    auto& constants = state_->function->constants;
+    auto result = state_->numberConstants.emplace(value.Bits(), static_cast<int>(constants.size()));
+    if (result.second) {
+        if (constants.size() > static_cast<size_t>(kMaxBx))
+            Error("too many constants");
+        constants.push_back(value);
+    }
+    return result.first->second & kMaxBx;
+}
+
+int BytecodeCompiler::AddStringConstant(const std::string& value) {
+    auto& constants = state_->function->constants;
+    auto result = state_->stringConstants.emplace(value, static_cast<int>(constants.size()));
+    if (result.second) {
+        if (constants.size() > static_cast<size_t>(kMaxBx))
+            Error("too many constants");
+        constants.push_back(StringLiteral(value));
+    }
+    return result.first->second & kMaxBx;
+}
+
+Value BytecodeCompiler::StringLiteral(const std::string& value) {
+    if (internLiterals_)
+        return Value::FromObject(program_.heap.Intern(value));
+    return Value::FromObject(program_.heap.NewString(value));
+}
+
+int BytecodeCompiler::AddCallSite(const std::string& method, int interface) {
+    CallSite site;
+    site.name = AddStringConstant(method);
+    site.selector = selectors_.emplace(method, static_cast<int>(selectors_.size())).first->second;
+    if (interface >= 0) {
+        auto& methods = program_.interfaces[interface].methods;
+        auto slot = std::find(methods.begin(), methods.end(), method);
+        if (slot == methods.end()) {
+            Error(program_.interfaces[interface].name + " has no method " + method);
+        } else {
+            site.interface = interface;
+            site.slot = static_cast<int>(slot - methods.begin());
+        }
+    }
+    auto& callSites = state_->function->callSites;
+    if (callSites.size() > kMaxBx)
+        Error("too many method calls");
+    callSites.push_back(site);
+    return static_cast<int>(callSites.size() - 1) & kMaxBx;
+}
+
+int BytecodeCompiler::SmallConstant(int index) {
+    if (index > 0xff)
+        Error("too many constants for a name operand");
+    return index & 0xff;
+}
+
+void BytecodeCompiler::SetLine(ast::Node* node) {
+    if (node && node->Pos().GetLineno() > 0)
+        line_ = node->Pos().GetLineno();
+}
+
+void BytecodeCompiler::Error(const std::string& msg) {
+    diagnostics_.push_back({path_, {Location(line_), msg}});
+}
+
+} // namespace zl
@@ -0,0 +1,359 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "runtime/bytecode.h"
+#include "ast.h"
+#include "const_evaluator.h"
+#include "error_handler.h"
+#include "frontend.h"
+
+namespace zl {
+
+// BytecodeDiagnostic is a construct the bytecode compiler can not compile
+struct BytecodeDiagnostic {
+    std::string path;
+    Diagnostic diagnostic;
+};
+
+// BytecodeCompiler compile the functions and classes of source files into the
+// register bytecode of a Program, see runtime/bytecode.h.
+//
+// Names are resolved by the compiler itself in the order local variable,
+// field of self, constant, global variable, function and class. Constants
+// are evaluated at compile time by ConstEvaluator, they are loaded as
+// values and operations on them are folded. Parameters and local
+// variables live in registers for the whole scope, temporaries are allocated
+// above them and released after each statement. Field accesses whose class
+// is known from the declared type are compiled to field indexes, the others
+// are looked up by name at run time.
+//
+// Each method call gets a call site with an inline cache, see CallSite. The
+// itables of an interface are built for each class having all its methods,
+// a call on a receiver declared with the interface type names the slot of
+// the method. Classes have no subclasses, so the methods of self called
+// without self are bound at compile time.
+//
+// Integers of the interpreter are 32 bits, so the 64-bit long of the JIT
+// and the C backend is rejected rather than silently truncated. Values
+// stored into variables, fields and elements declared int or double are
+// converted to it like the other backends do, unless the value is known to
+// have that type.
+class BytecodeCompiler {
+public:
+    explicit BytecodeCompiler(Program& program);
+    ~BytecodeCompiler() {}
+
+    // Compile the declarations of the files into the program, return false
+    // if some construct can not be compiled
+    bool Compile(const std::vector<SourceFile>& files);
+    const std::vector<BytecodeDiagnostic>& Diagnostics() const { return diagnostics_; }
+    // Intern the string literals in the heap, their hash is computed once
+    // and equal literals are compared by identity. On by default.
+    void SetInternLiterals(bool intern) { internLiterals_ = intern; }
+
+private:
+    BytecodeCompiler() = delete;
+    BytecodeCompiler(const BytecodeCompiler&) = delete;
+    BytecodeCompiler& operator = (const BytecodeCompiler&) = delete;
+
+    // Number type of a value or of a declared type
+    enum class NumberType : uint8_t {
+        None,
+        Int,
+        Double,
+    };
+    struct Local {
+        std::string name;
+        int reg;
+        // Class of the declared type, nullptr if it is not a class
+        ClassObject* klass;
+        // Interface of the declared type, -1 if it is not an interface
+        int interface;
+        // A local constant, its register holds its value
+        bool constant = false;
+        Value value;
+        // Declared type, nullptr if it is not known
+        ast::Type* type = nullptr;
+        // Every value stored into the register was converted to the type,
+        // which parameters are not
+        bool converted = false;
+    };
+    // Loop is a loop or a switch, which break leaves too
+    struct Loop {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+        bool isSwitch = false;
+    };
+    // Defer is a defer statement of the function. Outside loops a defer runs
+    // at most once, its callee and arguments are kept in registers reserved
+    // for the whole function and its call is inlined at each exit after it.
+    // Inside loops it pushes them on the defer stack of the outermost loop,
+    // which the exits pop.
+    struct Defer {
+        ast::DeferStmt* stmt = nullptr;
+        // Directly in the body of the function, every exit after it runs it
+        bool topLevel = false;
+        // First of the registers of the callee, the receiver if any and the
+        // arguments, -1 in loops
+        int reg = -1;
+        // Register set once the defer ran, -1 at the top level
+        int flag = -1;
+        // Index of the defer stack and of the defer in it, -1 outside loops
+        int stack = -1;
+        int site = -1;
+        // Values given to the call, -1 until the defer is compiled
+        int argc = -1;
+        // Depth of the scope of the defer, the exits compiled while it is
+        // open always run after the defer
+        size_t depth = 0;
+        bool open = false;
+        // Calls compiled before the defer, their argument count is patched
+        std::vector<size_t> calls;
+    };
+    // DeferStack hold the callees and arguments of the defers in a loop, a
+    // record is the site of the defer if there are several, the callee and
+    // the arguments
+    struct DeferStack {
+        // The outermost loop, its exits pop the stack from its start
+        ast::Node* loop = nullptr;
+        int reg = -1;
+        std::vector<size_t> defers;
+        // Most values of a record
+        int values = 0;
+    };
+    // Try is a try statement whose block or catches are compiled. The code
+    // covered by its handlers is a list of ranges, the exits leaving the try
+    // run its finally out of them.
+    struct Try {
+        ast::TryStmt* stmt = nullptr;
+        // Loops around the try, break and continue of those leave it
+        size_t loops = 0;
+        // Whether a catch is compiled, only the finally covers it
+        bool inCatch = false;
+        // Start of the range being compiled
+        size_t start = 0;
+        std::vector<std::pair<size_t, size_t>> block;
+        std::vector<std::pair<size_t, size_t>> catches;
+    };
+    // DeferRange is code where reached defers were reached, an exception
+    // leaving the function from it runs them
+    struct DeferRange {
+        size_t start;
+        size_t end;
+        size_t reached;
+    };
+    // FunctionState is the compilation state of one function
+    struct FunctionState {
+        FunctionObject* function = nullptr;
+        // Class of the method, nullptr for functions
+        ClassObject* owner = nullptr;
+        // Whether register 0 is self
+        bool hasSelf = false;
+        std::vector<Local> locals;
+        std::vector<size_t> scopes;
+        int freeRegister = 0;
+        std::vector<Loop> loops;
+        std::unordered_map<uint64_t, int> numberConstants;
+        std::unordered_map<std::string, int> stringConstants;
+        std::vector<Defer> defers;
+        std::vector<DeferStack> deferStacks;
+        // Defers compiled in order, and the first defer of each stack from
+        // the start of its loop
+        std::vector<size_t> reached;
+        std::vector<Try> tries;
+        std::vector<DeferRange> deferRanges;
+        size_t deferStart = 0;
+        // Depth of the finally blocks compiled, they are compiled once for
+        // each exit
+        int finallies = 0;
+    };
+
+    // Declaration pass, classes, functions and globals are known before any
+    // body is compiled
+    void DeclareFile(const SourceFile& file);
+    // Report the types of the file the interpreter can not represent
+    void CheckTypes(ast::Node* node);
+    void DeclareClass(ast::ClassDecl* decl);
+    void DeclareGlobal(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer);
+    // Build the itables of the classes once all methods are declared
+    void BuildItables();
+    void CompileInit();
+    void CompileFunction(ast::FunctionDecl* decl, FunctionObject* function, ClassObject* owner);
+
+    // Statements
+    void CompileStmt(ast::Node* node);
+    void CompileBlock(ast::Node* node);
+    void CompileVariable(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer);
+    void CompileConstant(ast::ConstDecl* decl);
+    void CompileAssign(ast::AssignStmt* stmt);
+    void CompileIf(ast::IfStmt* stmt);
+    void CompileWhile(ast::Expr* condition, ast::Stmt* body, bool testFirst);
+    void CompileFor(ast::ForStmt* stmt);
+    void CompileForeach(ast::ForeachStmt* stmt);
+    void CompileSwitch(ast::SwitchStmt* stmt);
+    // Build the table of the constant cases, each value with the index of
+    // its case, return false if they are not all integers or all strings
+    bool BuildSwitchTable(std::vector<std::pair<Value, size_t>>& cases, SwitchTable& table);
+    void CompileReturn(ast::ReturnStmt* stmt);
+    // Find the defers of the body and reserve their registers
+    void DeclareDefers(ast::FunctionBlockDecl* block);
+    void FindDefers(ast::Node* node, ast::Node* loop, int& stack, bool topLevel);
+    void CompileDefer(ast::DeferStmt* stmt);
+    // Run the defers which may have run, newest first, from the first free
+    // register, before an exit
+    void CompileDeferredCalls();
+    void CompileDeferStack(DeferStack& stack);
+    void CompileThrow(ast::ThrowStmt* stmt);
+    void CompileTry(ast::TryStmt* stmt);
+    // Set what the handler catches from the type, false if it is not a
+    // class, an interface or a primitive type
+    bool CatchType(ast::Type* type, ExceptionHandler& handler);
+    void CompileFinally(ast::TryStmt* stmt);
+    // Run the finally blocks of the tries after the first count, innermost
+    // first, before an exit leaving them. Their ranges end before, and are
+    // resumed after the exit by ResumeTries.
+    void CompileFinallyBlocks(size_t count);
+    void ResumeTries(size_t count);
+    void EndRange(Try& entry);
+    // Ranges of the reached defers, which end at each exit and each time a
+    // defer is reached
+    void EndDeferRange();
+    void BeginDeferRange();
+    // The handlers of an exception leaving the function run the reached
+    // defers and throw it again
+    void CompileDeferHandlers();
+    // Store the value of register into the assignable expression, number is
+    // the type of the value if it is known
+    void CompileStore(ast::Expr* target, int reg, NumberType number = NumberType::None);
+    // Return the instruction converting a value of number type to the
+    // declared type, Move if none is needed
+    OpCode Conversion(ast::Type* type, NumberType number);
+    // Return the register holding the value of register converted to the
+    // declared type, a temporary if it needs a conversion
+    int CompileConversion(ast::Type* type, NumberType number, int reg);
+
+    // Expressions, the value is compiled into the target register
+    void CompileExpr(ast::Expr* expr, int target);
+    // Return the register holding the value, a local variable is used as
+    // it is, otherwise a temporary is allocated
+    int CompileToRegister(ast::Expr* expr);
+    void CompileLiteral(ast::LiteralExpr* expr, int target);
+    void CompileIdentifier(ast::Identifier* expr, int target);
+    void CompileBinary(ast::BinaryExpr* expr, int target);
+    // Compile the value of the expression if it is constant, return false
+    // if it is not
+    bool CompileFolded(ast::Expr* expr, int target);
+    void CompileValue(Value value, int target);
+    // Compile the call leaving numResults values from base, the callee
+    // slot, which is the first free register
+    void CompileCall(ast::CallExpr* expr, int numResults);
+    // Compile the callee of the call into base and the receiver and the
+    // arguments above it, return their count
+    int CompileArguments(ast::CallExpr* expr, int base);
+    void CompileNew(ast::NewExpr* expr, int target);
+    // Emit jumps taken if the truth of the condition is jumpIf, they are
+    // appended to jumps to be patched
+    void CompileCondition(ast::Expr* expr, bool jumpIf, std::vector<size_t>& jumps);
+
+    // Class of the value of the expression if it is known
+    ClassObject* ClassOf(ast::Expr* expr);
+    ClassObject* ClassOfType(ast::Type* type);
+    // Interface of the declared type of the expression, -1 if it is not
+    // known to be an interface
+    int InterfaceOf(ast::Expr* expr);
+    int InterfaceOfType(ast::Type* type);
+    Value ZeroValue(ast::Type* type);
+    // Declared type of the assignable expression, nullptr if it is not known
+    ast::Type* DeclaredType(ast::Expr* expr);
+    NumberType NumberOfType(ast::Type* type);
+    // Number type of the value of the expression if it is known
+    NumberType NumberOf(ast::Expr* expr);
+    // Number type of the result of the arithmetic instruction on values of
+    // number types
+    static NumberType ArithmeticNumber(OpCode op, NumberType left, NumberType right);
+    // Binding of a name hiding the constants, see ConstEvaluator::Scope
+    ConstEvaluator::Binding BindName(const std::string& name, Value& value);
+
+    // Registers and scopes
+    int AllocRegister();
+    void BeginScope();
+    void EndScope();
+    int DeclareLocal(const std::string& name, ClassObject* klass, int interface = -1);
+    const Local* FindLocal(const std::string& name) const;
+
+    // Code emission
+    size_t Emit(Instruction instruction);
+    size_t EmitJump();
+    // Patch the jump at position to jump to target
+    void PatchJump(size_t position, size_t target);
+    void PatchJumps(const std::vector<size_t>& positions, size_t target);
+    size_t CurrentPosition() const;
+    int AddConstant(Value value);
+    int AddStringConstant(const std::string& value);
+    Value StringLiteral(const std::string& value);
+    // Return the index of a new call site of the method on a receiver of
+    // the interface, -1 if it is not an interface
+    int AddCallSite(const std::string& method, int interface);
+    // Return the constant index for a C operand of 8 bits
+    int SmallConstant(int index);
+    void SetLine(ast::Node* node);
+    void Error(const std::string& msg);
+
+private:
+    Program& program_;
+    std::vector<BytecodeDiagnostic> diagnostics_;
+    std::unordered_map<std::string, FunctionObject*> functions_;
+    std::unordered_map<std::string, ClassObject*> classes_;
+    // Index of each interface in the program
+    std::unordered_map<std::string, int> interfaces_;
+    // Number of each method name called, see CallSite::selector
+    std::unordered_map<std::string, int> selectors_;
+    std::unordered_map<std::string, int> globals_;
+    ConstEvaluator constants_;
+    ConstEvaluator::Scope scope_;
+    // Static methods of each class
+    std::unordered_map<ClassObject*, std::unordered_map<std::string, FunctionObject*>> statics_;
+    // Class of the declared type of each field, nullptr if not a class
+    std::unordered_map<ClassObject*, std::vector<ClassObject*>> fieldClasses_;
+    // Interface of the declared type of each field, -1 if not an interface
+    std::unordered_map<ClassObject*, std::vector<int>> fieldInterfaces_;
+    std::unordered_map<ClassObject*, std::vector<ast::Type*>> fieldTypes_;
+    // Declared type of each global, nullptr for the builtins
+    std::vector<ast::Type*> globalTypes_;
+    // Declarations of the classes, checked against the interfaces they
+    // implement when the itables are built
+    struct ClassDeclaration {
+        std::string path;
+        ast::ClassDecl* decl;
+        ClassObject* klass;
+    };
+    std::vector<ClassDeclaration> classDecls_;
+    // Function bodies are compiled after all files are declared
+    struct Body {
+        std::string path;
+        std::string package;
+        ast::FunctionDecl* decl;
+        FunctionObject* function;
+        ClassObject* owner;
+    };
+    std::vector<Body> bodies_;
+    // Top-level variables with initializers, compiled into program init
+    struct GlobalInitializer {
+        std::string path;
+        std::string package;
+        int global;
+        ast::Expr* expr;
+    };
+    std::vector<GlobalInitializer> globalInitializers_;
+    std::string path_;
+    std::string package_;
+    int line_;
+    FunctionState* state_;
+    Value emptyString_;
+    bool internLiterals_;
+};
+
+} // namespace zl
@@ -0,0 +1,2474 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "c_emitter.h"
+
+extern char** environ;
+
+namespace zl {
+
+namespace {
+
+const char kSelf[] = "self";
+
+// Runtime support of the generated code
+const char kPrelude[] = R"(#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Functions of the runtime and of the types, and the vector types of
+// kernels, are emitted whether the program uses them or not
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-label"
+#pragma GCC diagnostic ignored "-Wunused-local-typedefs"
+#endif
+
+typedef struct zl_string {
+    int32_t len;
+    const char* data;
+} zl_string;
+
+_Noreturn static void zl_fail(const char* message) {
+    fflush(stdout);
+    fprintf(stderr, "runtime error: %s\n", message);
+    exit(1);
+}
+
+_Noreturn static void zl_index_error(int32_t index) {
+    char message[64];
+    snprintf(message, sizeof(message), "index %" PRId32 " out of range", index);
+    zl_fail(message);
+}
+
+// Objects are allocated from chunks which are never freed
+static char* zl_arena;
+static size_t zl_arena_left;
+static uint64_t zl_allocations;
+static uint64_t zl_allocated_bytes;
+
+static void* zl_alloc(size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    zl_allocations++;
+    zl_allocated_bytes += size;
+    if (size > zl_arena_left) {
+        size_t chunk = size > ((size_t)1 << 20) ? size : ((size_t)1 << 20);
+        zl_arena = (char*)calloc(1, chunk);
+        if (!zl_arena)
+            zl_fail("out of memory");
+        zl_arena_left = chunk;
+    }
+    void* object = zl_arena;
+    zl_arena += size;
+    zl_arena_left -= size;
+    return object;
+}
+
+// Printed at exit if the ZL_ALLOC_STATS environment variable is set
+static void zl_report_allocations(void) {
+    fprintf(stderr, "allocations: %" PRIu64 " objects, %" PRIu64 " bytes\n", zl_allocations,
+        zl_allocated_bytes);
+}
+
+// Double the capacity of the elements of an array or a map
+static void* zl_grow(void* data, int32_t* cap, size_t size) {
+    if (*cap > INT32_MAX / 2)
+        zl_fail("out of memory");
+    int32_t next = *cap ? *cap * 2 : 8;
+    data = realloc(data, (size_t)next * size);
+    if (!data)
+        zl_fail("out of memory");
+    *cap = next;
+    return data;
+}
+
+static inline void* zl_nonnil(void* object, const char* message) {
+    if (!object)
+        zl_fail(message);
+    return object;
+}
+
+// Strings, arrays and maps start with their length
+static inline int32_t zl_len(const void* object) {
+    if (!object)
+        zl_fail("len of nil");
+    return *(const int32_t*)object;
+}
+
+#define ZL_INTEGER_OPS(name, type, utype, mask)                                       \
+    static inline type zl_add_##name(type a, type b) { return (type)((utype)a + (utype)b); } \
+    static inline type zl_sub_##name(type a, type b) { return (type)((utype)a - (utype)b); } \
+    static inline type zl_mul_##name(type a, type b) { return (type)((utype)a * (utype)b); } \
+    static inline type zl_neg_##name(type a) { return (type)((utype)0 - (utype)a); }        \
+    static inline type zl_shl_##name(type a, type b) { return (type)((utype)a << (b & mask)); } \
+    static inline type zl_shr_##name(type a, type b) { return a >> (b & mask); }           \
+    static inline type zl_div_##name(type a, type b) {                                  \
+        if (b == 0)                                                                     \
+            zl_fail("division by zero");                                                \
+        return b == -1 ? zl_neg_##name(a) : a / b;                                      \
+    }                                                                                   \
+    static inline type zl_rem_##name(type a, type b) {                                  \
+        if (b == 0)                                                                     \
+            zl_fail("division by zero");                                                \
+        return b == -1 ? 0 : a % b;                                                     \
+    }
+
+ZL_INTEGER_OPS(int, int32_t, uint32_t, 31)
+ZL_INTEGER_OPS(long, int64_t, uint64_t, 63)
+
+static const zl_string zl_nil_string = {3, "nil"};
+// Zero value of string
+static zl_string zl_empty_string = {0, ""};
+
+static zl_string* zl_str_new(const char* data, size_t len) {
+    if (len > INT32_MAX)
+        zl_fail("out of memory");
+    zl_string* string = (zl_string*)zl_alloc(sizeof(zl_string) + len + 1);
+    char* text = (char*)(string + 1);
+    memcpy(text, data, len);
+    string->len = (int32_t)len;
+    string->data = text;
+    return string;
+}
+
+static inline const zl_string* zl_str_text(const zl_string* string) {
+    return string ? string : &zl_nil_string;
+}
+
+static zl_string* zl_str_concat(const zl_string* a, const zl_string* b) {
+    a = zl_str_text(a);
+    b = zl_str_text(b);
+    zl_string* string = zl_str_new(a->data, (size_t)a->len + b->len);
+    memcpy((char*)string->data + a->len, b->data, b->len);
+    return string;
+}
+
+static zl_string* zl_str_of_long(int64_t value) {
+    char text[32];
+    int len = snprintf(text, sizeof(text), "%" PRId64, value);
+    return zl_str_new(text, len);
+}
+
+static zl_string* zl_str_of_double(double value) {
+    char text[32];
+    int len = snprintf(text, sizeof(text), "%.14g", value);
+    return zl_str_new(text, len);
+}
+
+static zl_string* zl_str_of_text(const char* text) {
+    return zl_str_new(text, strlen(text));
+}
+
+static bool zl_str_eq(const zl_string* a, const zl_string* b) {
+    if (a == b)
+        return true;
+    if (!a || !b)
+        return false;
+    return a->len == b->len && memcmp(a->data, b->data, a->len) == 0;
+}
+
+static int zl_str_cmp(const zl_string* a, const zl_string* b) {
+    if (!a || !b)
+        zl_fail("can not compare nil and string");
+    int32_t len = a->len < b->len ? a->len : b->len;
+    int result = memcmp(a->data, b->data, len);
+    if (result)
+        return result;
+    return a->len < b->len ? -1 : a->len > b->len;
+}
+
+static inline int32_t zl_str_at(const zl_string* string, int32_t index) {
+    if (!string)
+        zl_fail("can not index nil with int");
+    if ((uint32_t)index >= (uint32_t)string->len)
+        zl_index_error(index);
+    return (unsigned char)string->data[index];
+}
+
+// Hashes and equality of map keys
+static inline uint64_t zl_hash_u64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    return x ^ (x >> 33);
+}
+
+static inline uint64_t zl_hash_bool(bool key) { return key; }
+static inline uint64_t zl_hash_int(int32_t key) { return zl_hash_u64((uint64_t)key); }
+static inline uint64_t zl_hash_long(int64_t key) { return zl_hash_u64((uint64_t)key); }
+
+static inline uint64_t zl_hash_double(double key) {
+    uint64_t bits;
+    // -0.0 and 0.0 are equal
+    key = key == 0 ? 0 : key;
+    memcpy(&bits, &key, sizeof(bits));
+    return zl_hash_u64(bits);
+}
+
+static inline uint64_t zl_hash_float(float key) { return zl_hash_double(key); }
+
+static uint64_t zl_hash_string(const zl_string* key) {
+    uint64_t hash = 14695981039346656037ull;
+    key = zl_str_text(key);
+    for (int32_t i = 0; i < key->len; i++)
+        hash = (hash ^ (unsigned char)key->data[i]) * 1099511628211ull;
+    return hash;
+}
+
+static inline uint64_t zl_hash_pointer(const void* key) { return zl_hash_u64((uint64_t)(uintptr_t)key); }
+
+// Maps probe the control bytes of 16 slots at once, a control byte is
+// ZL_EMPTY or the low 7 bits of the hash of the key of a full slot. Bit n of
+// the result is set if slot n matches.
+#define ZL_EMPTY ((int8_t)-128)
+#define ZL_GROUP 16
+
+#if defined(__SSE2__)
+static inline uint32_t zl_group_match(const int8_t* ctrl, int8_t byte) {
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(byte), group));
+}
+
+static inline uint32_t zl_group_empty(const int8_t* ctrl) {
+    // Only empty control bytes have the sign bit
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+#else
+static inline uint32_t zl_group_match(const int8_t* ctrl, int8_t byte) {
+    uint32_t bits = 0;
+    for (int i = 0; i < ZL_GROUP; i++)
+        bits |= (uint32_t)(ctrl[i] == byte) << i;
+    return bits;
+}
+
+static inline uint32_t zl_group_empty(const int8_t* ctrl) {
+    return zl_group_match(ctrl, ZL_EMPTY);
+}
+#endif
+
+// Kernels of vectorized loops are compiled for AVX2 and SSE4.2 besides the
+// base instruction set, the widest the processor supports is used
+#if defined(__x86_64__) || defined(__i386__)
+#define ZL_SIMD_DISPATCH 1
+
+static int zl_simd_level(void) {
+    static int level = -1;
+    if (level < 0) {
+        __builtin_cpu_init();
+        level = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse4.2") ? 1 : 0;
+    }
+    return level;
+}
+#endif
+
+static inline bool zl_eq_bool(bool a, bool b) { return a == b; }
+static inline bool zl_eq_int(int32_t a, int32_t b) { return a == b; }
+static inline bool zl_eq_long(int64_t a, int64_t b) { return a == b; }
+static inline bool zl_eq_float(float a, float b) { return a == b; }
+static inline bool zl_eq_double(double a, double b) { return a == b; }
+static inline bool zl_eq_string(const zl_string* a, const zl_string* b) { return zl_str_eq(a, b); }
+static inline bool zl_eq_pointer(const void* a, const void* b) { return a == b; }
+
+static void zl_print_bool(bool value) { fputs(value ? "true" : "false", stdout); }
+static void zl_print_int(int32_t value) { printf("%" PRId32, value); }
+static void zl_print_long(int64_t value) { printf("%" PRId64, value); }
+static void zl_print_float(float value) { printf("%.14g", (double)value); }
+static void zl_print_double(double value) { printf("%.14g", value); }
+
+static void zl_print_string(const zl_string* value) {
+    value = zl_str_text(value);
+    fwrite(value->data, 1, value->len, stdout);
+}
+)";
+
+// Arrays of $T, named $N, printed by $P
+const char kArrayTemplate[] = R"(
+struct $N {
+    int32_t len;
+    int32_t cap;
+    $T* data;
+};
+
+static $N* $N_new(int32_t len) {
+    $N* array = ($N*)zl_alloc(sizeof($N));
+    if (len > 0) {
+        array->data = ($T*)calloc((size_t)len, sizeof($T));
+        if (!array->data)
+            zl_fail("out of memory");
+    }
+    array->len = array->cap = len;
+    return array;
+}
+
+static $N* $N_of(int32_t len, $T const* values) {
+    $N* array = $N_new(len);
+    memcpy(array->data, values, (size_t)len * sizeof($T));
+    return array;
+}
+
+static inline $T $N_get(const $N* array, int32_t index) {
+    if (!array)
+        zl_fail("can not index nil with int");
+    if ((uint32_t)index >= (uint32_t)array->len)
+        zl_index_error(index);
+    return array->data[index];
+}
+
+static inline void $N_set($N* array, int32_t index, $T value) {
+    if (!array)
+        zl_fail("can not index nil with int");
+    if ((uint32_t)index >= (uint32_t)array->len)
+        zl_index_error(index);
+    array->data[index] = value;
+}
+
+static $N* $N_append($N* array, $T value) {
+    if (!array)
+        zl_fail("append to nil");
+    if (array->len == array->cap)
+        array->data = ($T*)zl_grow(array->data, &array->cap, sizeof($T));
+    array->data[array->len++] = value;
+    return array;
+}
+
+static void zl_print_$M(const $N* array) {
+    if (!array) {
+        fputs("nil", stdout);
+        return;
+    }
+    putchar('[');
+    for (int32_t i = 0; i < array->len; i++) {
+        if (i)
+            fputs(", ", stdout);
+        $P(array->data[i]);
+    }
+    putchar(']');
+}
+)";
+
+// Maps of $K to $V, named $N. Entries are kept in insertion order like the
+// interpreter, the slots of the open addressing table index them. A key is
+// in the first empty slot from its home, lookups probe a group of slots at
+// once and stop at the first group with an empty slot. Keys are hashed by
+// zl_hash_$H, missing keys read $Z.
+const char kMapTemplate[] = R"(
+struct $N {
+    int32_t len;
+    int32_t cap;
+    $K* keys;
+    $V* values;
+    // Control byte of each slot, the first ZL_GROUP - 1 are repeated after
+    // the last so that groups wrap around
+    int8_t* ctrl;
+    // Entry of each full slot
+    int32_t* slots;
+    uint32_t mask;
+};
+
+static $N* $N_new(void) {
+    return ($N*)zl_alloc(sizeof($N));
+}
+
+static int32_t $N_find(const $N* map, $K key) {
+    if (!map->slots)
+        return -1;
+    uint64_t hash = zl_hash_$H(key);
+    int8_t control = (int8_t)(hash & 0x7f);
+    uint32_t position = (uint32_t)(hash >> 32) & map->mask;
+    for (;;) {
+        const int8_t* group = map->ctrl + position;
+        for (uint32_t bits = zl_group_match(group, control); bits; bits &= bits - 1) {
+            int32_t entry = map->slots[(position + __builtin_ctz(bits)) & map->mask];
+            if (zl_eq_$H(map->keys[entry], key))
+                return entry;
+        }
+        if (zl_group_empty(group))
+            return -1;
+        position = (position + ZL_GROUP) & map->mask;
+    }
+}
+
+static void $N_place($N* map, int32_t entry) {
+    uint64_t hash = zl_hash_$H(map->keys[entry]);
+    uint32_t position = (uint32_t)(hash >> 32) & map->mask;
+    uint32_t empty;
+    while (!(empty = zl_group_empty(map->ctrl + position)))
+        position = (position + ZL_GROUP) & map->mask;
+    uint32_t slot = (position + __builtin_ctz(empty)) & map->mask;
+    map->ctrl[slot] = (int8_t)(hash & 0x7f);
+    if (slot < ZL_GROUP - 1)
+        map->ctrl[map->mask + 1 + slot] = map->ctrl[slot];
+    map->slots[slot] = entry;
+}
+
+static void $N_rehash($N* map) {
+    uint32_t size = map->slots ? (map->mask + 1) * 2 : ZL_GROUP;
+    free(map->slots);
+    free(map->ctrl);
+    map->slots = (int32_t*)malloc(size * sizeof(int32_t));
+    map->ctrl = (int8_t*)malloc(size + ZL_GROUP - 1);
+    if (!map->slots || !map->ctrl)
+        zl_fail("out of memory");
+    memset(map->ctrl, ZL_EMPTY, size + ZL_GROUP - 1);
+    map->mask = size - 1;
+    for (int32_t entry = 0; entry < map->len; entry++)
+        $N_place(map, entry);
+}
+
+static $V $N_get(const $N* map, $K key) {
+    if (!map)
+        zl_fail("can not index nil with $I");
+    int32_t entry = $N_find(map, key);
+    return entry >= 0 ? map->values[entry] : $Z;
+}
+
+static void $N_set($N* map, $K key, $V value) {
+    if (!map)
+        zl_fail("can not index nil with $I");
+    int32_t entry = $N_find(map, key);
+    if (entry >= 0) {
+        map->values[entry] = value;
+        return;
+    }
+    if (map->len == map->cap) {
+        int32_t cap = map->cap;
+        map->keys = ($K*)zl_grow(map->keys, &cap, sizeof($K));
+        map->values = ($V*)zl_grow(map->values, &map->cap, sizeof($V));
+    }
+    entry = map->len++;
+    map->keys[entry] = key;
+    map->values[entry] = value;
+    if (!map->slots || (uint64_t)map->len * 8 > (uint64_t)(map->mask + 1) * 7)
+        $N_rehash(map);
+    else
+        $N_place(map, entry);
+}
+
+static $N* $N_of(int32_t len, $K const* keys, $V const* values) {
+    $N* map = $N_new();
+    for (int32_t i = 0; i < len; i++)
+        $N_set(map, keys[i], values[i]);
+    return map;
+}
+
+static void zl_print_$M(const $N* map) {
+    if (!map) {
+        fputs("nil", stdout);
+        return;
+    }
+    putchar('{');
+    for (int32_t i = 0; i < map->len; i++) {
+        if (i)
+            fputs(", ", stdout);
+        $A(map->keys[i]);
+        fputs(": ", stdout);
+        $B(map->values[i]);
+    }
+    putchar('}');
+}
+)";
+
+// Replace each $ and the letter after it by the value of the letter
+std::string Expand(const char* text, const std::vector<std::pair<char, std::string>>& values) {
+    std::string result;
+    for (const char* p = text; *p; p++) {
+        if (*p != '$' || !p[1]) {
+            result += *p;
+            continue;
+        }
+        p++;
+        for (auto& value : values) {
+            if (value.first == *p) {
+                result += value.second;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+// Name usable in C identifiers, prefixed by its length so that names made
+// of several parts can not collide
+std::string Identifier(const std::string& name) {
+    std::string result;
+    for (char c : name)
+        result += isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    return std::to_string(result.size()) + result;
+}
+
+// Name of the type in C identifiers, such as "map_string_array_int"
+std::string Mangle(const CType& type) {
+    switch (type.kind) {
+        case CType::Void: return "void";
+        case CType::Nil: return "nil";
+        case CType::Bool: return "bool";
+        case CType::Int: return "int";
+        case CType::Long: return "long";
+        case CType::Float: return "float";
+        case CType::Double: return "double";
+        case CType::String: return "string";
+        case CType::Array: return "array_" + Mangle(type.args[0]);
+        case CType::Map: return "map_" + Mangle(type.args[0]) + "_" + Mangle(type.args[1]);
+        case CType::Class: return "c" + Identifier(type.name);
+        case CType::Interface: return "i" + Identifier(type.name);
+        case CType::Tuple: {
+            std::string name = "tuple" + std::to_string(type.args.size());
+            for (auto& arg : type.args)
+                name += "_" + Mangle(arg);
+            return name;
+        }
+    }
+    return "";
+}
+
+int NumericRank(const CType& type) {
+    switch (type.kind) {
+        case CType::Int: return 0;
+        case CType::Long: return 1;
+        case CType::Float: return 2;
+        case CType::Double: return 3;
+        default: return -1;
+    }
+}
+
+// The operator of a compound assignment, such as Token::ADD of ADD_ASSIGN
+int BaseOperator(int op) {
+    switch (op) {
+        case Token::ADD_ASSIGN: return Token::ADD;
+        case Token::SUB_ASSIGN: return Token::SUB;
+        case Token::MUL_ASSIGN: return Token::MUL;
+        case Token::QUO_ASSIGN: return Token::QUO;
+        case Token::REM_ASSIGN: return Token::REM;
+        case Token::AND_ASSIGN: return Token::AND;
+        case Token::OR_ASSIGN: return Token::OR;
+        case Token::XOR_ASSIGN: return Token::XOR;
+        case Token::SHL_ASSIGN: return Token::SHL;
+        case Token::SHR_ASSIGN: return Token::SHR;
+        default: return op;
+    }
+}
+
+// C string literal of the bytes, octal escapes are always three digits so
+// that a following digit is not taken in, and ? is escaped against trigraphs
+std::string Quote(const std::string& value) {
+    std::string result = "\"";
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\' || c == '?') {
+            result += '\\';
+            result += static_cast<char>(c);
+        } else if (c >= 0x20 && c < 0x7f) {
+            result += static_cast<char>(c);
+        } else {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\%03o", c);
+            result += escape;
+        }
+    }
+    return result + "\"";
+}
+
+std::string IntegerLiteral(const CType& type, int64_t value) {
+    if (type.kind == CType::Long) {
+        if (value == INT64_MIN)
+            return "(-INT64_C(9223372036854775807) - 1)";
+        return value < 0 ? "(-INT64_C(" + std::to_string(-value) + "))" : "INT64_C(" + std::to_string(value) + ")";
+    }
+    if (value == INT32_MIN)
+        return "(-2147483647 - 1)";
+    return value < 0 ? "(" + std::to_string(value) + ")" : std::to_string(value);
+}
+
+} // namespace
+
+std::string CType::ToString() const {
+    switch (kind) {
+        case Void: return "void";
+        case Nil: return "nil";
+        case Bool: return "bool";
+        case Int: return "int";
+        case Long: return "long";
+        case Float: return "float";
+        case Double: return "double";
+        case String: return "string";
+        case Array: return args[0].ToString() + "[]";
+        case Map: return "map<" + args[0].ToString() + ", " + args[1].ToString() + ">";
+        case Class:
+        case Interface: return name;
+        case Tuple: {
+            std::string text = "(";
+            for (size_t n = 0; n < args.size(); n++)
+                text += (n ? ", " : "") + args[n].ToString();
+            return text + ")";
+        }
+    }
+    return "";
+}
+
+CEmitter::CEmitter(): CEmitter(*new TypeContext()) {
+    ownTypeContext_.reset(typeContext_);
+}
+
+CEmitter::CEmitter(TypeContext& types)
+    : line_(0), typeContext_(&types), escapeAnalysis_(true), vectorize_(true), reassociate_(false),
+    vectorLoops_(0), owner_(nullptr), hasSelf_(false), signature_(nullptr), temporaries_(0), indent_(0) {}
+
+bool CEmitter::Emit(const std::vector<SourceFile>& files, std::string& output) {
+    // Class and interface names are known before any type is read
+    for (auto& file : files) {
+        path_ = file.path;
+        for (auto node : file.decls) {
+            SetLine(node);
+            ast::Identifier* name = nullptr;
+            if (node->Kind() == ast::NodeKind::ClassDecl)
+                name = static_cast<ast::ClassDecl*>(node)->name_;
+            else if (node->Kind() == ast::NodeKind::InterfaceDecl)
+                name = static_cast<ast::InterfaceDecl*>(node)->name_;
+            if (!name)
+                continue;
+            if (classes_.count(name->name_) || interfaces_.count(name->name_)) {
+                Error(name->name_ + " is redeclared");
+                continue;
+            }
+            CType type(node->Kind() == ast::NodeKind::ClassDecl ? CType::Class : CType::Interface);
+            type.name = name->name_;
+            if (type.kind == CType::Class)
+                classes_[name->name_].cname = "zl_" + Mangle(type);
+            else
+                interfaces_[name->name_].cname = "zl_" + Mangle(type);
+        }
+    }
+    for (auto& file : files)
+        DeclareFile(file);
+    if (escapeAnalysis_)
+        escape_.Analyze(files);
+
+    for (auto& entry : classes_) {
+        auto& info = entry.second;
+        typedefs_ += "typedef struct " + info.cname + " " + info.cname + ";\n";
+        structs_ += "struct " + info.cname + " {\n";
+        for (auto& field : info.fields) {
+            UseType(field.second);
+            structs_ += "    " + CName(field.second) + " f_" + field.first + ";\n";
+        }
+        // Structs without members are not C
+        if (info.fields.empty())
+            structs_ += "    char unused;\n";
+        structs_ += "};\n\n";
+        functionsOfTypes_ += "static void zl_print_" + info.cname.substr(3) + "(const " + info.cname +
+            "* object) {\n    fputs(object ? " + Quote("<" + entry.first + ">") + " : \"nil\", stdout);\n}\n";
+    }
+    for (auto& entry : interfaces_) {
+        auto& info = entry.second;
+        auto table = info.cname + "_table";
+        typedefs_ += "typedef struct " + info.cname + " " + info.cname + ";\n";
+        typedefs_ += "typedef struct " + table + " " + table + ";\n";
+        structs_ += "struct " + table + " {\n    const char* name;\n";
+        for (auto& method : info.methods) {
+            auto& signature = method.second;
+            std::string parameters = "void* self";
+            for (auto& parameter : signature.parameters)
+                parameters += ", " + CName(parameter);
+            std::string result = "void";
+            if (signature.results.size() == 1) {
+                result = CName(signature.results[0]);
+            } else if (signature.results.size() > 1) {
+                CType tuple(CType::Tuple);
+                tuple.args = signature.results;
+                UseType(tuple);
+                result = CName(tuple);
+            }
+            for (auto& parameter : signature.parameters)
+                UseType(parameter);
+            structs_ += "    " + result + " (*m_" + method.first + ")(" + parameters + ");\n";
+
+            // Calls through the table check the object first
+            std::string declaration = "static inline " + result + " " + info.cname + "_" + method.first +
+                "(" + info.cname + " object";
+            std::string arguments = "object.object";
+            for (size_t n = 0; n < signature.parameters.size(); n++) {
+                declaration += ", " + CName(signature.parameters[n]) + " a" + std::to_string(n);
+                arguments += ", a" + std::to_string(n);
+            }
+            functionsOfTypes_ += "\n" + declaration + ") {\n    if (!object.object)\n        zl_fail(" +
+                Quote("method " + method.first + " called on nil") + ");\n    " +
+                (result == "void" ? "" : "return ") + "object.table->m_" + method.first + "(" + arguments +
+                ");\n}\n";
+        }
+        structs_ += "};\n\n";
+        structs_ += "struct " + info.cname + " {\n    void* object;\n    const " + table + "* table;\n};\n\n";
+        functionsOfTypes_ += "\nstatic void zl_print_" + info.cname.substr(3) + "(" + info.cname +
+            " value) {\n    fputs(value.object ? value.table->name : \"nil\", stdout);\n}\n";
+    }
+
+    // Objects are allocated then given to the constructor, a method named
+    // after the class
+    for (auto& entry : classes_) {
+        auto& info = entry.second;
+        Signature none;
+        auto constructor = info.methods.find(entry.first);
+        auto& signature = constructor != info.methods.end() ? constructor->second : none;
+        std::string parameters, arguments = "self";
+        for (size_t n = 0; n < signature.parameters.size(); n++) {
+            parameters += (n ? ", " : "") + CName(signature.parameters[n]) + " a" + std::to_string(n);
+            arguments += ", a" + std::to_string(n);
+        }
+        if (parameters.empty())
+            parameters = "void";
+        std::string cname = "zn_" + info.cname.substr(3);
+        prototypes_ += "static " + info.cname + "* " + cname + "(" + parameters + ");\n";
+        code_ += "static " + info.cname + "* " + cname + "(" + parameters + ") {\n    " + info.cname +
+            "* self = (" + info.cname + "*)zl_alloc(sizeof(" + info.cname + "));\n";
+        if (constructor != info.methods.end())
+            code_ += "    zm_" + info.cname.substr(3) + "_" + entry.first + "(" + arguments + ");\n";
+        code_ += "    return self;\n}\n\n";
+    }
+
+    EmitInit();
+    for (auto& body : bodies_) {
+        path_ = body.path;
+        EmitFunction(body);
+    }
+
+    auto main = functions_.find("main");
+    if (main == functions_.end()) {
+        Error("no main function");
+    } else if (!main->second.parameters.empty()) {
+        Error("main with parameters is not supported by the C backend");
+    } else {
+        code_ += "int main(void) {\n    if (getenv(\"ZL_ALLOC_STATS\"))\n        atexit(zl_report_allocations);\n"
+            "    zl_init();\n";
+        auto& results = main->second.results;
+        // The int returned by main is the exit status
+        if (results.size() == 1 && results[0].IsInteger())
+            code_ += "    return (int)zf_main();\n";
+        else
+            code_ += "    zf_main();\n    return 0;\n";
+        code_ += "}\n";
+    }
+
+    output = kPrelude;
+    output += "\n" + typedefs_ + "\n" + structs_ + functionsOfTypes_ + kernels_ + "\n" + prototypes_ + "\n" +
+        globalsCode_ + tables_ + "\n" + code_;
+    return diagnostics_.empty();
+}
+
+//
+// Declarations
+//
+
+void CEmitter::DeclareFile(const SourceFile& file) {
+    path_ = file.path;
+    for (auto node : file.decls) {
+        SetLine(node);
+        switch (node->Kind()) {
+            case ast::NodeKind::ClassDecl:
+                DeclareClass(static_cast<ast::ClassDecl*>(node));
+                break;
+            case ast::NodeKind::InterfaceDecl:
+                DeclareInterface(static_cast<ast::InterfaceDecl*>(node));
+                break;
+            case ast::NodeKind::FunctionDecl:
+                DeclareFunction(static_cast<ast::FunctionDecl*>(node));
+                break;
+            case ast::NodeKind::VariableDecl: {
+                auto decl = static_cast<ast::VariableDecl*>(node);
+                DeclareGlobal(decl->name_, decl->type_, decl->varInitializer_);
+                break;
+            }
+            case ast::NodeKind::VariableBlockDecl:
+                for (auto decl : static_cast<ast::VariableBlockDecl*>(node)->variables_)
+                    DeclareGlobal(decl->name_, decl->type_, decl->varInitializer_);
+                break;
+            case ast::NodeKind::ConstDecl: {
+                auto decl = static_cast<ast::ConstDecl*>(node);
+                DeclareGlobal(decl->name_, decl->type_, decl->varInitializer_, true);
+                break;
+            }
+            case ast::NodeKind::ConstBlockDecl:
+                for (auto decl : static_cast<ast::ConstBlockDecl*>(node)->fields_)
+                    DeclareGlobal(decl->name_, decl->type_, decl->varInitializer_, true);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void CEmitter::DeclareClass(ast::ClassDecl* decl) {
+    if (!decl->name_ || !decl->classBody_)
+        return;
+    auto& name = decl->name_->name_;
+    auto& info = classes_[name];
+    for (auto variable : decl->classBody_->variables_) {
+        if (!variable->name_)
+            continue;
+        SetLine(variable);
+        if (!variable->type_) {
+            Error("field " + variable->name_->name_ + " has no type");
+            continue;
+        }
+        info.fields.push_back({variable->name_->name_, TypeOf(variable->type_)});
+    }
+    for (auto method : decl->classBody_->functions_) {
+        if (!method->name_)
+            continue;
+        SetLine(method);
+        auto& methods = method->isStatic_ ? info.statics : info.methods;
+        if (methods.count(method->name_->name_)) {
+            Error("method " + name + "." + method->name_->name_ + " is redeclared");
+            continue;
+        }
+        methods[method->name_->name_] = SignatureOf(method->formalParameterList_, method->returnParameterList_);
+        bodies_.push_back({path_, method, name});
+    }
+}
+
+void CEmitter::DeclareInterface(ast::InterfaceDecl* decl) {
+    if (!decl->name_)
+        return;
+    auto& info = interfaces_[decl->name_->name_];
+    for (auto method : decl->methods_) {
+        if (!method->name_)
+            continue;
+        SetLine(method);
+        info.methods.push_back({method->name_->name_,
+            SignatureOf(method->formalParameterList_, method->returnParameterList_)});
+    }
+}
+
+void CEmitter::DeclareFunction(ast::FunctionDecl* decl) {
+    if (!decl->name_)
+        return;
+    auto& name = decl->name_->name_;
+    if (functions_.count(name) || name == "print" || name == "len" || name == "append") {
+        Error("function " + name + " is redeclared");
+        return;
+    }
+    functions_[name] = SignatureOf(decl->formalParameterList_, decl->returnParameterList_);
+    bodies_.push_back({path_, decl, ""});
+}
+
+void CEmitter::DeclareGlobal(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer,
+        bool constant) {
+    if (!name)
+        return;
+    if (globals_.count(name->name_)) {
+        Error("global " + name->name_ + " is redeclared");
+        return;
+    }
+    // Globals without type take the type of the initializer, in EmitInit
+    globals_[name->name_] = {"g_" + name->name_, TypeOf(type), constant};
+    initializers_.push_back({name->name_, initializer});
+}
+
+CEmitter::Signature CEmitter::SignatureOf(ast::FormalParameterList* parameters, ast::ReturnParameterList* results) {
+    Signature signature;
+    if (parameters) {
+        for (auto parameter : parameters->formalParameters_) {
+            signature.parameters.push_back(TypeOf(parameter->type_));
+            if (!parameter->type_)
+                Error("parameter has no type");
+        }
+    }
+    if (results) {
+        for (auto type : results->types_)
+            signature.results.push_back(TypeOf(type));
+    }
+    return signature;
+}
+
+void CEmitter::EmitInit() {
+    owner_ = nullptr;
+    ownerName_.clear();
+    hasSelf_ = false;
+    signature_ = nullptr;
+    variables_.clear();
+    scopes_.clear();
+    declared_.clear();
+    loops_.clear();
+    temporaries_ = 0;
+    indent_ = 1;
+    code_ += "static void zl_init(void) {\n";
+    for (auto& initializer : initializers_) {
+        auto& global = globals_[initializer.first];
+        if (!initializer.second || !initializer.second->expr_) {
+            if (global.type.kind == CType::Void)
+                Error("type of " + initializer.first + " is unknown");
+            continue;
+        }
+        SetLine(initializer.second);
+        bool typed = global.type.kind != CType::Void;
+        auto value = EmitExpr(initializer.second->expr_, typed ? &global.type : nullptr);
+        if (!typed) {
+            if (value.type.kind == CType::Nil || value.type.kind == CType::Void || value.type.kind == CType::Tuple)
+                Error("type of " + initializer.first + " can not be inferred");
+            global.type = value.type;
+        }
+        Line(global.cname + " = " + Convert(value, global.type).code + ";");
+    }
+    code_ += "}\n\n";
+    for (auto& initializer : initializers_) {
+        auto& global = globals_[initializer.first];
+        if (global.type.kind == CType::Void)
+            continue;
+        UseType(global.type);
+        globalsCode_ += "static " + CName(global.type) + " " + global.cname + ";\n";
+    }
+}
+
+void CEmitter::EmitFunction(const Body& body) {
+    auto decl = body.decl;
+    SetLine(decl);
+    auto& name = decl->name_->name_;
+    owner_ = body.owner.empty() ? nullptr : &classes_[body.owner];
+    ownerName_ = body.owner;
+    hasSelf_ = owner_ && !decl->isStatic_;
+    std::string cname;
+    if (!owner_) {
+        signature_ = &functions_[name];
+        cname = "zf_" + name;
+    } else {
+        signature_ = decl->isStatic_ ? &owner_->statics.at(name) : &owner_->methods.at(name);
+        cname = "zm_" + owner_->cname.substr(3) + "_" + name;
+    }
+    variables_.clear();
+    scopes_.clear();
+    declared_.clear();
+    localObjects_.clear();
+    loops_.clear();
+    temporaries_ = 0;
+    PushScope();
+
+    auto& results = signature_->results;
+    std::string result = "void";
+    CType tuple(CType::Tuple);
+    if (results.size() == 1) {
+        result = CName(results[0]);
+    } else if (results.size() > 1) {
+        tuple.args = results;
+        UseType(tuple);
+        result = CName(tuple);
+    }
+    std::string parameters;
+    if (hasSelf_)
+        parameters = owner_->cname + "* self";
+    if (decl->formalParameterList_) {
+        auto& formals = decl->formalParameterList_->formalParameters_;
+        for (size_t n = 0; n < formals.size(); n++) {
+            auto& type = signature_->parameters[n];
+            UseType(type);
+            auto& variable = DeclareVariable(formals[n]->name_ ? formals[n]->name_->name_ : "", type);
+            parameters += (parameters.empty() ? "" : ", ") + CName(type) + " " + variable.cname;
+        }
+    }
+    if (parameters.empty())
+        parameters = "void";
+    std::string header = "static " + result + " " + cname + "(" + parameters + ")";
+    prototypes_ += header + ";\n";
+    code_ += header + " {\n";
+    indent_ = 1;
+    if (decl->functionBlockDecl_) {
+        for (auto node : decl->functionBlockDecl_->nodes_)
+            EmitStmt(node);
+    }
+    // Falling off the end returns the zero values of the results
+    if (results.size() == 1)
+        Line("return " + ZeroValue(results[0]) + ";");
+    else if (results.size() > 1)
+        Line("return " + ZeroValue(tuple) + ";");
+    code_ += "}\n\n";
+    PopScope();
+}
+
+//
+// Statements
+//
+
+void CEmitter::EmitStmt(ast::Node* node) {
+    if (!node)
+        return;
+    SetLine(node);
+    switch (node->Kind()) {
+        case ast::NodeKind::DeclStmt:
+            EmitStmt(static_cast<ast::DeclStmt*>(node)->decl_);
+            break;
+        case ast::NodeKind::VariableDecl: {
+            auto decl = static_cast<ast::VariableDecl*>(node);
+            EmitVariable(decl->name_, decl->type_, decl->varInitializer_);
+            break;
+        }
+        case ast::NodeKind::ConstDecl: {
+            auto decl = static_cast<ast::ConstDecl*>(node);
+            size_t count = variables_.size();
+            EmitVariable(decl->name_, decl->type_, decl->varInitializer_);
+            if (variables_.size() > count)
+                variables_.back().constant = true;
+            break;
+        }
+        case ast::NodeKind::VariableBlockDecl:
+            for (auto decl : static_cast<ast::VariableBlockDecl*>(node)->variables_)
+                EmitStmt(decl);
+            break;
+        case ast::NodeKind::ConstBlockDecl:
+            for (auto decl : static_cast<ast::ConstBlockDecl*>(node)->fields_)
+                EmitStmt(decl);
+            break;
+        case ast::NodeKind::BlockStmt:
+            Line("{");
+            EmitBlock(node);
+            Line("}");
+            break;
+        case ast::NodeKind::ExprStmt: {
+            auto stmt = static_cast<ast::ExprStmt*>(node);
+            if (stmt->varDecl_) {
+                EmitStmt(stmt->varDecl_);
+            } else if (stmt->stmt_) {
+                EmitStmt(stmt->stmt_);
+            } else if (stmt->expr_ && stmt->expr_->Kind() == ast::NodeKind::CallExpr) {
+                auto call = static_cast<ast::CallExpr*>(stmt->expr_);
+                if (call->function_ && call->function_->Kind() == ast::NodeKind::Identifier &&
+                        static_cast<ast::Identifier*>(call->function_)->name_ == "print" &&
+                        !FindVariable("print")) {
+                    EmitPrint(call);
+                    break;
+                }
+                Line(EmitCall(call).code + ";");
+            } else if (stmt->expr_) {
+                Line("(void)(" + EmitExpr(stmt->expr_).code + ");");
+            }
+            break;
+        }
+        case ast::NodeKind::ExprStmts:
+            for (auto stmt : static_cast<ast::ExprStmts*>(node)->stmts_)
+                EmitStmt(stmt);
+            break;
+        case ast::NodeKind::AssignStmt:
+            EmitAssign(static_cast<ast::AssignStmt*>(node));
+            break;
+        case ast::NodeKind::IfStmt:
+            EmitIf(static_cast<ast::IfStmt*>(node));
+            break;
+        case ast::NodeKind::WhileStmt: {
+            auto stmt = static_cast<ast::WhileStmt*>(node);
+            Line("while (" + Condition(stmt->conditionExpr_) + ") {");
+            loops_.push_back("");
+            EmitBlock(stmt->block_);
+            loops_.pop_back();
+            Line("}");
+            break;
+        }
+        case ast::NodeKind::DoStmt: {
+            auto stmt = static_cast<ast::DoStmt*>(node);
+            Line("do {");
+            loops_.push_back("");
+            EmitBlock(stmt->block_);
+            loops_.pop_back();
+            Line("} while (" + Condition(stmt->conditionExpr_) + ");");
+            break;
+        }
+        case ast::NodeKind::ForStmt:
+            EmitFor(static_cast<ast::ForStmt*>(node));
+            break;
+        case ast::NodeKind::ForeachStmt:
+            EmitForeach(static_cast<ast::ForeachStmt*>(node));
+            break;
+        case ast::NodeKind::ReturnStmt:
+            EmitReturn(static_cast<ast::ReturnStmt*>(node));
+            break;
+        case ast::NodeKind::BreakStmt:
+            if (loops_.empty())
+                Error("break is not in a loop");
+            else
+                Line("break;");
+            break;
+        case ast::NodeKind::ContinueStmt:
+            if (loops_.empty())
+                Error("continue is not in a loop");
+            else if (loops_.back().empty())
+                Line("continue;");
+            else
+                Line("goto " + loops_.back() + ";");
+            break;
+        case ast::NodeKind::AssertStmt:
+            Line("if (!" + Condition(static_cast<ast::AssertStmt*>(node)->expr_) + ")");
+            indent_++;
+            Line("zl_fail(\"assertion failed\");");
+            indent_--;
+            break;
+        case ast::NodeKind::LabelStmt:
+            break;
+        default:
+            Error(std::string(ast::NodeKindName(node->Kind())) + " is not supported by the C backend");
+            break;
+    }
+}
+
+// The statements of the block or the single statement, in their own scope
+// inside the braces written by the caller
+void CEmitter::EmitBlock(ast::Node* node) {
+    indent_++;
+    PushScope();
+    if (node && node->Kind() == ast::NodeKind::BlockStmt) {
+        for (auto stmt : static_cast<ast::BlockStmt*>(node)->stmts_)
+            EmitStmt(stmt);
+    } else {
+        EmitStmt(node);
+    }
+    PopScope();
+    indent_--;
+}
+
+void CEmitter::EmitVariable(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer) {
+    if (!name)
+        return;
+    if (initializer && initializer->expr_ && initializer->expr_->Kind() == ast::NodeKind::NewExpr &&
+            escapeAnalysis_ && escape_.IsLocal(static_cast<ast::NewExpr*>(initializer->expr_))) {
+        EmitLocalObject(name, static_cast<ast::NewExpr*>(initializer->expr_));
+        return;
+    }
+    CType declared = TypeOf(type);
+    std::string value;
+    // The initializer is emitted before the variable is declared so that it
+    // may refer to an outer variable of the same name
+    if (initializer && initializer->expr_) {
+        auto expr = EmitExpr(initializer->expr_, type ? &declared : nullptr);
+        if (!type) {
+            declared = expr.type;
+            if (declared.kind == CType::Nil || declared.kind == CType::Void || declared.kind == CType::Tuple)
+                Error("type of " + name->name_ + " can not be inferred");
+        }
+        value = Convert(expr, declared).code;
+    } else {
+        if (!type)
+            Error("type of " + name->name_ + " is unknown");
+        value = ZeroValue(declared);
+    }
+    UseType(declared);
+    auto& variable = DeclareVariable(name->name_, declared);
+    Line(CName(declared) + " " + variable.cname + " = " + value + ";");
+}
+
+// The instance is a struct in the frame, zeroed like the heap ones, and the
+// variable points to it. Its fields are left to the scalar replacement of
+// the C compiler.
+void CEmitter::EmitLocalObject(ast::Identifier* name, ast::NewExpr* expr) {
+    auto type = TypeOf(expr->type_);
+    auto& info = classes_[type.name];
+    auto constructor = info.methods.find(type.name);
+    std::string arguments;
+    if (constructor != info.methods.end())
+        arguments = EmitArguments(type.name, expr->arguments_, &constructor->second);
+    else if (!expr->arguments_.empty())
+        Error(type.name + " has no constructor");
+    auto& variable = DeclareVariable(name->name_, type);
+    auto object = "o_" + variable.cname.substr(2);
+    Line(info.cname + " " + object + " = {0};");
+    Line(CName(type) + " " + variable.cname + " = &" + object + ";");
+    if (constructor != info.methods.end()) {
+        Line("zm_" + info.cname.substr(3) + "_" + type.name + "(" + variable.cname +
+            (arguments.empty() ? "" : ", " + arguments) + ");");
+    }
+    localObjects_.insert(variable.cname);
+}
+
+void CEmitter::EmitAssign(ast::AssignStmt* stmt) {
+    // The type of a target is found by emitting it, its errors are reported
+    // by the store
+    auto targetType = [&](ast::Expr* target) {
+        size_t errors = diagnostics_.size();
+        auto type = EmitExpr(target).type;
+        diagnostics_.resize(errors);
+        return type;
+    };
+    if (stmt->op_ != Token::ASSIGN) {
+        if (stmt->lhs_.size() != 1 || stmt->rhs_.size() != 1) {
+            Error("compound assignment must have one operand on each side");
+            return;
+        }
+        // The target is read then written, like the IR builder does
+        auto left = EmitExpr(stmt->lhs_[0]);
+        auto right = EmitExpr(stmt->rhs_[0], &left.type);
+        EmitStore(stmt->lhs_[0], EmitArithmetic(BaseOperator(stmt->op_), left, right));
+        return;
+    }
+    if (stmt->lhs_.size() == 1 && stmt->rhs_.size() == 1) {
+        auto type = targetType(stmt->lhs_[0]);
+        EmitStore(stmt->lhs_[0], EmitExpr(stmt->rhs_[0], &type));
+        return;
+    }
+
+    // All values are evaluated before any is stored, so a, b = b, a swaps
+    std::vector<Expr> values;
+    Line("{");
+    indent_++;
+    if (stmt->rhs_.size() == 1 && stmt->lhs_.size() > 1 &&
+            stmt->rhs_[0]->Kind() == ast::NodeKind::CallExpr) {
+        auto call = EmitCall(static_cast<ast::CallExpr*>(stmt->rhs_[0]));
+        if (call.type.kind != CType::Tuple || call.type.args.size() != stmt->lhs_.size()) {
+            Error("assignment of " + call.type.ToString() + " to " + std::to_string(stmt->lhs_.size()) +
+                " variables");
+        } else {
+            auto temporary = NewTemporary();
+            Line(CName(call.type) + " " + temporary + " = " + call.code + ";");
+            for (size_t n = 0; n < call.type.args.size(); n++)
+                values.push_back({temporary + ".r" + std::to_string(n), call.type.args[n]});
+        }
+    } else if (stmt->lhs_.size() == stmt->rhs_.size()) {
+        for (size_t n = 0; n < stmt->rhs_.size(); n++) {
+            auto type = targetType(stmt->lhs_[n]);
+            auto value = EmitExpr(stmt->rhs_[n], &type);
+            auto temporary = NewTemporary();
+            UseType(value.type);
+            Line(CName(value.type) + " " + temporary + " = " + value.code + ";");
+            values.push_back({temporary, value.type});
+        }
+    } else {
+        Error("assignment of " + std::to_string(stmt->rhs_.size()) + " values to " +
+            std::to_string(stmt->lhs_.size()) + " variables");
+    }
+    if (values.size() == stmt->lhs_.size()) {
+        for (size_t n = 0; n < values.size(); n++)
+            EmitStore(stmt->lhs_[n], values[n]);
+    }
+    indent_--;
+    Line("}");
+}
+
+void CEmitter::EmitStore(ast::Expr* target, const Expr& value) {
+    switch (target->Kind()) {
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(target)->name_;
+            if (auto variable = FindVariable(name)) {
+                if (variable->constant)
+                    Error("constant " + name + " can not be assigned");
+                else
+                    Line(variable->cname + " = " + Convert(value, variable->type).code + ";");
+                return;
+            }
+            if (name == kSelf && hasSelf_) {
+                Error("self can not be assigned");
+                return;
+            }
+            if (hasSelf_) {
+                for (auto& field : owner_->fields) {
+                    if (field.first == name) {
+                        Line("self->f_" + name + " = " + Convert(value, field.second).code + ";");
+                        return;
+                    }
+                }
+            }
+            auto global = globals_.find(name);
+            if (global != globals_.end()) {
+                if (global->second.constant)
+                    Error("constant " + name + " can not be assigned");
+                else
+                    Line(global->second.cname + " = " + Convert(value, global->second.type).code + ";");
+                return;
+            }
+            Error("undefined variable " + name);
+            return;
+        }
+        case ast::NodeKind::SelectorExpr: {
+            auto field = EmitSelector(static_cast<ast::SelectorExpr*>(target));
+            if (field.type.kind != CType::Void)
+                Line(field.code + " = " + Convert(value, field.type).code + ";");
+            return;
+        }
+        case ast::NodeKind::IndexExpr: {
+            auto index = static_cast<ast::IndexExpr*>(target);
+            auto object = EmitExpr(index->expr_);
+            if ((object.type.kind == CType::Array || object.type.kind == CType::Map) && IsConstant(index->expr_)) {
+                Error(std::string("store into constant ") + (object.type.kind == CType::Array ? "array" : "map"));
+                return;
+            }
+            if (object.type.kind == CType::Array) {
+                auto position = Convert(EmitExpr(index->index_), CType(CType::Int));
+                Line("zl_" + Mangle(object.type) + "_set(" + object.code + ", " + position.code + ", " +
+                    Convert(value, object.type.args[0]).code + ");");
+            } else if (object.type.kind == CType::Map) {
+                auto key = Convert(EmitExpr(index->index_, &object.type.args[0]), object.type.args[0]);
+                Line("zl_" + Mangle(object.type) + "_set(" + object.code + ", " + key.code + ", " +
+                    Convert(value, object.type.args[1]).code + ");");
+            } else if (object.type.kind != CType::Void) {
+                Error("elements of " + object.type.ToString() + " can not be assigned");
+            }
+            return;
+        }
+        default:
+            Error(std::string(ast::NodeKindName(target->Kind())) + " is not assignable");
+            return;
+    }
+}
+
+void CEmitter::EmitIf(ast::IfStmt* stmt) {
+    Line("if (" + Condition(stmt->conditionExpr_) + ") {");
+    EmitBlock(stmt->ifBlockStmt_);
+    for (auto& elif : stmt->elifBlockStmts_) {
+        SetLine(elif.first);
+        Line("} else if (" + Condition(elif.first) + ") {");
+        EmitBlock(elif.second);
+    }
+    if (stmt->finalStmt_) {
+        Line("} else {");
+        EmitBlock(stmt->finalStmt_);
+    }
+    Line("}");
+}
+
+// continue runs the finalizer of for, it jumps to a label before it when
+// there is one
+void CEmitter::EmitFor(ast::ForStmt* stmt, bool vectorize) {
+    if (vectorize && vectorize_ && VectorizeFor(stmt))
+        return;
+    Line("{");
+    indent_++;
+    PushScope();
+    EmitStmt(stmt->initializer_);
+    bool finalizer = stmt->finalizer_ && !stmt->finalizer_->stmts_.empty();
+    std::string label = finalizer ? "zl_next" + std::to_string(temporaries_++) : "";
+    Line("while (" + (stmt->expr_ ? Condition(stmt->expr_) : std::string("true")) + ") {");
+    loops_.push_back(label);
+    EmitBlock(stmt->block_);
+    loops_.pop_back();
+    if (finalizer) {
+        indent_++;
+        Line(label + ":;");
+        EmitStmt(stmt->finalizer_);
+        indent_--;
+    }
+    Line("}");
+    PopScope();
+    indent_--;
+    Line("}");
+}
+
+void CEmitter::EmitForeach(ast::ForeachStmt* stmt, bool vectorize) {
+    if (vectorize && vectorize_ && VectorizeForeach(stmt))
+        return;
+    if (stmt->variables_.empty() || stmt->variables_.size() > 2) {
+        Error("foreach must have one or two variables");
+        return;
+    }
+    auto iterable = dynamic_cast<ast::IterableObject*>(stmt->iterableObject_);
+    Expr object;
+    if (!iterable) {
+        Error("foreach over an invalid object");
+        return;
+    } else if (iterable->primary_) {
+        object = EmitExpr(dynamic_cast<ast::Expr*>(iterable->primary_));
+    } else if (!iterable->mapElements_.empty()) {
+        std::vector<std::pair<ast::Expr*, ast::Expr*>> elements;
+        for (auto& element : iterable->mapElements_)
+            elements.push_back({dynamic_cast<ast::Expr*>(element.first), dynamic_cast<ast::Expr*>(element.second)});
+        object = EmitMapLiteral(elements, nullptr);
+    } else {
+        std::vector<ast::Expr*> elements;
+        for (auto element : iterable->arrayElements_)
+            elements.push_back(dynamic_cast<ast::Expr*>(element));
+        object = EmitArrayLiteral(elements, nullptr);
+    }
+    if (object.type.kind != CType::Array && object.type.kind != CType::Map) {
+        if (object.type.kind != CType::Void)
+            Error("foreach over " + object.type.ToString());
+        return;
+    }
+
+    Line("{");
+    indent_++;
+    PushScope();
+    auto sequence = NewTemporary();
+    auto index = NewTemporary();
+    Line(CName(object.type) + " " + sequence + " = " + object.code + ";");
+    Line("zl_nonnil(" + sequence + ", \"foreach over nil\");");
+    Line("for (int32_t " + index + " = 0; " + index + " < " + sequence + "->len; " + index + "++) {");
+    indent_++;
+    PushScope();
+    CType keyType = object.type.kind == CType::Array ? CType(CType::Int) : object.type.args[0];
+    CType valueType = object.type.kind == CType::Array ? object.type.args[0] : object.type.args[1];
+    std::string key = object.type.kind == CType::Array ? index : sequence + "->keys[" + index + "]";
+    std::string value = sequence + (object.type.kind == CType::Array ? "->data[" : "->values[") + index + "]";
+    // One variable is the element of an array or the key of a map
+    if (stmt->variables_.size() == 1) {
+        bool array = object.type.kind == CType::Array;
+        auto& variable = DeclareVariable(stmt->variables_[0], array ? valueType : keyType);
+        Line(CName(variable.type) + " " + variable.cname + " = " + (array ? value : key) + ";");
+    } else {
+        auto& keyVariable = DeclareVariable(stmt->variables_[0], keyType);
+        Line(CName(keyType) + " " + keyVariable.cname + " = " + key + ";");
+        auto& valueVariable = DeclareVariable(stmt->variables_[1], valueType);
+        Line(CName(valueType) + " " + valueVariable.cname + " = " + value + ";");
+    }
+    indent_--;
+    loops_.push_back("");
+    EmitBlock(stmt->block_);
+    loops_.pop_back();
+    PopScope();
+    Line("}");
+    PopScope();
+    indent_--;
+    Line("}");
+}
+
+void CEmitter::EmitReturn(ast::ReturnStmt* stmt) {
+    auto& results = signature_->results;
+    if (results.empty()) {
+        if (!stmt->exprs_.empty())
+            Error("return of values from a function without results");
+        Line("return;");
+        return;
+    }
+    if (results.size() == 1) {
+        if (stmt->exprs_.size() != 1) {
+            Error("return of " + std::to_string(stmt->exprs_.size()) + " values from a function of 1 result");
+            return;
+        }
+        Line("return " + Convert(EmitExpr(stmt->exprs_[0], &results[0]), results[0]).code + ";");
+        return;
+    }
+    CType tuple(CType::Tuple);
+    tuple.args = results;
+    std::vector<Expr> values;
+    // Results of a call of other types are converted from a temporary
+    bool scoped = false;
+    if (stmt->exprs_.size() == 1 && stmt->exprs_[0]->Kind() == ast::NodeKind::CallExpr) {
+        // return f() passes all results of f
+        auto call = EmitCall(static_cast<ast::CallExpr*>(stmt->exprs_[0]));
+        if (SameType(call.type, tuple)) {
+            Line("return " + call.code + ";");
+            return;
+        }
+        if (call.type.kind == CType::Tuple && call.type.args.size() == results.size()) {
+            scoped = true;
+            Line("{");
+            indent_++;
+            auto temporary = NewTemporary();
+            Line(CName(call.type) + " " + temporary + " = " + call.code + ";");
+            for (size_t n = 0; n < results.size(); n++)
+                values.push_back({temporary + ".r" + std::to_string(n), call.type.args[n]});
+        } else {
+            values.push_back(call);
+        }
+    } else {
+        for (size_t n = 0; n < stmt->exprs_.size(); n++)
+            values.push_back(EmitExpr(stmt->exprs_[n], n < results.size() ? &results[n] : nullptr));
+    }
+    if (values.size() != results.size()) {
+        Error("return of " + std::to_string(values.size()) + " values from a function of " +
+            std::to_string(results.size()) + " results");
+        return;
+    }
+    std::string code;
+    for (size_t n = 0; n < values.size(); n++)
+        code += (n ? ", " : "") + Convert(values[n], results[n]).code;
+    Line("return (" + CName(tuple) + "){" + code + "};");
+    if (scoped) {
+        indent_--;
+        Line("}");
+    }
+}
+
+// print writes its arguments separated by spaces and a newline, like the
+// builtin of the interpreter
+void CEmitter::EmitPrint(ast::CallExpr* expr) {
+    for (size_t n = 0; n < expr->arguments_.size(); n++) {
+        auto value = EmitExpr(expr->arguments_[n]);
+        if (n > 0)
+            Line("putchar(' ');");
+        if (value.type.kind == CType::Nil)
+            Line("fputs(\"nil\", stdout);");
+        else if (value.type.kind == CType::Void)
+            Error("print of a value of type void");
+        else
+            Line(PrintFunction(value.type) + "(" + value.code + ");");
+    }
+    Line("putchar('\\n');");
+}
+//
+// Expressions
+//
+
+CEmitter::Expr CEmitter::EmitExpr(ast::Expr* expr, const CType* expected) {
+    if (!expr) {
+        Error("missing expression");
+        return {"0", CType()};
+    }
+    switch (expr->Kind()) {
+        case ast::NodeKind::LiteralExpr:
+            return EmitLiteral(static_cast<ast::LiteralExpr*>(expr));
+        case ast::NodeKind::Identifier:
+            return EmitIdentifier(static_cast<ast::Identifier*>(expr));
+        case ast::NodeKind::UnaryExpr:
+            return EmitUnary(static_cast<ast::UnaryExpr*>(expr));
+        case ast::NodeKind::BinaryExpr:
+            return EmitBinary(static_cast<ast::BinaryExpr*>(expr));
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(expr);
+            auto field = EmitSelector(selector);
+            return field;
+        }
+        case ast::NodeKind::IndexExpr:
+            return EmitIndex(static_cast<ast::IndexExpr*>(expr));
+        case ast::NodeKind::CallExpr: {
+            auto call = EmitCall(static_cast<ast::CallExpr*>(expr));
+            if (call.type.kind != CType::Tuple)
+                return call;
+            // The first result of a call with several results
+            return {call.code + ".r0", call.type.args[0]};
+        }
+        case ast::NodeKind::NewExpr:
+            return EmitNew(static_cast<ast::NewExpr*>(expr));
+        case ast::NodeKind::ArrayLiteralExpr:
+            return EmitArrayLiteral(static_cast<ast::ArrayLiteralExpr*>(expr)->elements_, expected);
+        case ast::NodeKind::MapLiteralExpr:
+            return EmitMapLiteral(static_cast<ast::MapLiteralExpr*>(expr)->elements_, expected);
+        default:
+            Error(std::string(ast::NodeKindName(expr->Kind())) + " is not supported by the C backend");
+            return {"0", CType()};
+    }
+}
+
+CEmitter::Expr CEmitter::EmitLiteral(ast::LiteralExpr* expr) {
+    switch (expr->kind_) {
+        case Token::INT: {
+            bool hex = expr->value_.size() > 2 && expr->value_[0] == '0' &&
+                (expr->value_[1] == 'x' || expr->value_[1] == 'X');
+            char* end = nullptr;
+            errno = 0;
+            unsigned long long number = strtoull(expr->value_.c_str(), &end, hex ? 16 : 10);
+            if (*end != '\0' || errno == ERANGE) {
+                Error("integer literal " + expr->value_ + " is out of range");
+                return {"0", CType(CType::Int)};
+            }
+            // Literals of 32 bits are int, as in the interpreter
+            if (number <= UINT32_MAX) {
+                CType type(CType::Int);
+                return {IntegerLiteral(type, static_cast<int32_t>(static_cast<uint32_t>(number))), type};
+            }
+            CType type(CType::Long);
+            return {IntegerLiteral(type, static_cast<int64_t>(number)), type};
+        }
+        case Token::FLOAT: {
+            double number = strtod(expr->value_.c_str(), nullptr);
+            if (isinf(number))
+                return {"HUGE_VAL", CType(CType::Double)};
+            char text[32];
+            snprintf(text, sizeof(text), "%.17g", number);
+            std::string code = text;
+            if (code.find_first_of(".e") == std::string::npos)
+                code += ".0";
+            return {code, CType(CType::Double)};
+        }
+        case Token::CHAR:
+            return {std::to_string(expr->value_.empty() ? 0 : static_cast<unsigned char>(expr->value_[0])),
+                CType(CType::Int)};
+        case Token::STRING:
+            return {StringLiteral(expr->value_), CType(CType::String)};
+        case Token::TRUE:
+            return {"true", CType(CType::Bool)};
+        case Token::FALSE:
+            return {"false", CType(CType::Bool)};
+        case Token::NIL:
+            return {"NULL", CType(CType::Nil)};
+        default:
+            Error("invalid literal " + expr->value_);
+            return {"0", CType()};
+    }
+}
+
+CEmitter::Expr CEmitter::EmitIdentifier(ast::Identifier* expr) {
+    auto& name = expr->name_;
+    if (auto variable = FindVariable(name))
+        return {variable->cname, variable->type};
+    if (name == kSelf && hasSelf_) {
+        CType type(CType::Class);
+        type.name = ownerName_;
+        return {"self", type};
+    }
+    if (hasSelf_) {
+        for (auto& field : owner_->fields) {
+            if (field.first == name)
+                return {"self->f_" + name, field.second};
+        }
+    }
+    auto global = globals_.find(name);
+    if (global != globals_.end())
+        return {global->second.cname, global->second.type};
+    if (functions_.count(name) || classes_.count(name))
+        Error(name + " used as a value is not supported by the C backend");
+    else
+        Error("undefined name " + name);
+    return {"0", CType()};
+}
+
+CEmitter::Expr CEmitter::EmitUnary(ast::UnaryExpr* expr) {
+    if (expr->op_ == Token::NOT)
+        return {"(!" + Condition(expr->expr_) + ")", CType(CType::Bool)};
+    auto operand = EmitExpr(expr->expr_);
+    switch (expr->op_) {
+        case Token::SUB:
+            if (operand.type.IsInteger())
+                return {"zl_neg_" + Mangle(operand.type) + "(" + operand.code + ")", operand.type};
+            if (operand.type.IsNumeric())
+                return {"(-" + operand.code + ")", operand.type};
+            break;
+        case Token::XOR:
+            if (operand.type.IsInteger())
+                return {"(~" + operand.code + ")", operand.type};
+            break;
+        case Token::ADD:
+            if (operand.type.IsNumeric())
+                return operand;
+            break;
+        default:
+            break;
+    }
+    if (operand.type.kind != CType::Void)
+        Error(std::string("invalid operand ") + operand.type.ToString() + " of " + TokenTypeString(expr->op_));
+    return {"0", CType()};
+}
+
+CEmitter::Expr CEmitter::EmitBinary(ast::BinaryExpr* expr) {
+    int op = expr->op_;
+    if (op == Token::LAND || op == Token::LOR) {
+        // Only bool operands, the interpreter gives the last operand
+        // evaluated which has no static type otherwise
+        auto left = EmitExpr(expr->left_);
+        auto right = EmitExpr(expr->right_);
+        if (left.type.kind != CType::Bool || right.type.kind != CType::Bool) {
+            Error(std::string("operands of ") + TokenTypeString(op) + " must be bool for the C backend");
+            return {"false", CType(CType::Bool)};
+        }
+        return {"(" + left.code + (op == Token::LAND ? " && " : " || ") + right.code + ")", CType(CType::Bool)};
+    }
+    auto left = EmitExpr(expr->left_);
+    auto right = EmitExpr(expr->right_, &left.type);
+    return EmitArithmetic(op, left, right);
+}
+
+CEmitter::Expr CEmitter::EmitArithmetic(int op, const Expr& left, const Expr& right) {
+    if (left.type.kind == CType::Void || right.type.kind == CType::Void)
+        return {"0", CType()};
+    CType boolType(CType::Bool);
+    int leftRank = NumericRank(left.type);
+    int rightRank = NumericRank(right.type);
+    bool numeric = leftRank >= 0 && rightRank >= 0;
+    // Numeric operands are promoted to the wider one
+    CType wider = leftRank >= rightRank ? left.type : right.type;
+    auto a = numeric ? Convert(left, wider).code : left.code;
+    auto b = numeric ? Convert(right, wider).code : right.code;
+    auto invalid = [&]() {
+        Error("invalid operands " + left.type.ToString() + " and " + right.type.ToString() + " of " +
+            TokenTypeString(op));
+        return Expr{"0", CType()};
+    };
+
+    switch (op) {
+        case Token::EQL:
+        case Token::NEQ: {
+            std::string negate = op == Token::NEQ ? "!" : "";
+            std::string equal = op == Token::NEQ ? " != " : " == ";
+            auto objectOf = [](const Expr& value) {
+                return value.type.kind == CType::Interface ? "(" + value.code + ").object" : value.code;
+            };
+            if (numeric || (left.type.kind == CType::Bool && right.type.kind == CType::Bool))
+                return {"(" + a + equal + b + ")", boolType};
+            if (left.type.kind == CType::String && right.type.kind == CType::String)
+                return {negate + "zl_str_eq(" + a + ", " + b + ")", boolType};
+            if (left.type.kind == CType::Nil && right.type.kind == CType::Nil)
+                return {op == Token::NEQ ? "false" : "true", boolType};
+            // References are equal if they are the same object
+            bool leftObject = left.type.IsReference() || left.type.kind == CType::Nil;
+            bool rightObject = right.type.IsReference() || right.type.kind == CType::Nil;
+            bool comparable = left.type.kind == CType::Nil || right.type.kind == CType::Nil ||
+                SameType(left.type, right.type) ||
+                (left.type.kind == CType::Interface && right.type.kind == CType::Class) ||
+                (left.type.kind == CType::Class && right.type.kind == CType::Interface);
+            if (leftObject && rightObject && comparable)
+                return {"((const void*)" + objectOf(left) + equal + "(const void*)" + objectOf(right) + ")", boolType};
+            return invalid();
+        }
+        case Token::LSS:
+        case Token::LEQ:
+        case Token::GTR:
+        case Token::GEQ: {
+            const char* comparison = op == Token::LSS ? " < " : op == Token::LEQ ? " <= " :
+                op == Token::GTR ? " > " : " >= ";
+            if (numeric)
+                return {"(" + a + comparison + b + ")", boolType};
+            if (left.type.kind == CType::String && right.type.kind == CType::String)
+                return {"(zl_str_cmp(" + a + ", " + b + ")" + comparison + "0)", boolType};
+            return invalid();
+        }
+        case Token::ADD:
+            if (left.type.kind == CType::String || right.type.kind == CType::String) {
+                // Concatenation converts the other operand like print does
+                auto text = [&](const Expr& value) -> std::string {
+                    switch (value.type.kind) {
+                        case CType::String:
+                            return value.code;
+                        case CType::Nil:
+                            return "NULL";
+                        case CType::Bool:
+                            return "zl_str_of_text(" + value.code + " ? \"true\" : \"false\")";
+                        case CType::Int:
+                        case CType::Long:
+                            return "zl_str_of_long(" + value.code + ")";
+                        case CType::Float:
+                        case CType::Double:
+                            return "zl_str_of_double(" + value.code + ")";
+                        case CType::Class:
+                            return "zl_str_of_text(" + value.code + " ? " + Quote("<" + value.type.name + ">") +
+                                " : \"nil\")";
+                        default:
+                            return "";
+                    }
+                };
+                auto leftText = text(left);
+                auto rightText = text(right);
+                if (leftText.empty() || rightText.empty())
+                    return invalid();
+                return {"zl_str_concat(" + leftText + ", " + rightText + ")", CType(CType::String)};
+            }
+            // Fall through
+        case Token::SUB:
+        case Token::MUL:
+        case Token::QUO:
+        case Token::REM: {
+            if (!numeric)
+                return invalid();
+            const char* names[] = {"add", "sub", "mul", "div", "rem"};
+            int index = op == Token::ADD ? 0 : op == Token::SUB ? 1 : op == Token::MUL ? 2 : op == Token::QUO ? 3 : 4;
+            if (wider.IsInteger())
+                return {std::string("zl_") + names[index] + "_" + Mangle(wider) + "(" + a + ", " + b + ")", wider};
+            if (op == Token::REM)
+                return {(wider.kind == CType::Float ? "fmodf(" : "fmod(") + a + ", " + b + ")", wider};
+            const char* symbols[] = {" + ", " - ", " * ", " / "};
+            return {"(" + a + symbols[index] + b + ")", wider};
+        }
+        case Token::AND:
+        case Token::OR:
+        case Token::XOR: {
+            if (!numeric || !wider.IsInteger())
+                return invalid();
+            const char* symbol = op == Token::AND ? " & " : op == Token::OR ? " | " : " ^ ";
+            return {"(" + a + symbol + b + ")", wider};
+        }
+        case Token::SHL:
+        case Token::SHR: {
+            // The count is converted to the type of the shifted value
+            if (!left.type.IsInteger() || !right.type.IsInteger())
+                return invalid();
+            return {std::string(op == Token::SHL ? "zl_shl_" : "zl_shr_") + Mangle(left.type) + "(" + left.code +
+                ", " + Convert(right, left.type).code + ")", left.type};
+        }
+        default:
+            Error(std::string("operator ") + TokenTypeString(op) + " is not supported by the C backend");
+            return {"0", CType()};
+    }
+}
+
+CEmitter::Expr CEmitter::EmitSelector(ast::SelectorExpr* expr) {
+    if (!expr->selector_)
+        return {"0", CType()};
+    auto& name = expr->selector_->name_;
+    auto object = EmitExpr(expr->expr_);
+    if (object.type.kind == CType::Class) {
+        auto& info = classes_[object.type.name];
+        for (auto& field : info.fields) {
+            if (field.first == name)
+                return {NonNil(object, "nil has no field " + name) + "->f_" + name, field.second};
+        }
+        Error(object.type.name + " has no field " + name);
+    } else if (object.type.kind != CType::Void) {
+        Error("field " + name + " of " + object.type.ToString() + " is not supported by the C backend");
+    }
+    return {"0", CType()};
+}
+
+CEmitter::Expr CEmitter::EmitIndex(ast::IndexExpr* expr) {
+    auto object = EmitExpr(expr->expr_);
+    switch (object.type.kind) {
+        case CType::Array: {
+            auto index = Convert(EmitExpr(expr->index_), CType(CType::Int));
+            return {"zl_" + Mangle(object.type) + "_get(" + object.code + ", " + index.code + ")", object.type.args[0]};
+        }
+        case CType::Map: {
+            auto key = Convert(EmitExpr(expr->index_, &object.type.args[0]), object.type.args[0]);
+            return {"zl_" + Mangle(object.type) + "_get(" + object.code + ", " + key.code + ")", object.type.args[1]};
+        }
+        case CType::String: {
+            auto index = Convert(EmitExpr(expr->index_), CType(CType::Int));
+            return {"zl_str_at(" + object.code + ", " + index.code + ")", CType(CType::Int)};
+        }
+        case CType::Void:
+            return object;
+        default:
+            Error("can not index " + object.type.ToString());
+            return {"0", CType()};
+    }
+}
+
+CEmitter::Expr CEmitter::EmitCall(ast::CallExpr* expr) {
+    auto callee = expr->function_;
+    const Signature* signature = nullptr;
+    std::string cname;
+    std::string name;
+    // The first argument, self of methods
+    std::string receiver;
+    if (callee && callee->Kind() == ast::NodeKind::Identifier) {
+        name = static_cast<ast::Identifier*>(callee)->name_;
+        auto& arguments = expr->arguments_;
+        if (FindVariable(name)) {
+            Error("call of a function value is not supported by the C backend");
+        } else if (name == "len" && !functions_.count(name)) {
+            if (arguments.size() != 1) {
+                Error("len takes 1 arguments, " + std::to_string(arguments.size()) + " given");
+                return {"0", CType(CType::Int)};
+            }
+            auto value = EmitExpr(arguments[0]);
+            if (value.type.kind != CType::String && value.type.kind != CType::Array &&
+                    value.type.kind != CType::Map && value.type.kind != CType::Void)
+                Error("len of " + value.type.ToString());
+            return {"zl_len(" + value.code + ")", CType(CType::Int)};
+        } else if (name == "append") {
+            if (arguments.size() != 2) {
+                Error("append takes 2 arguments, " + std::to_string(arguments.size()) + " given");
+                return {"0", CType()};
+            }
+            auto array = EmitExpr(arguments[0]);
+            if (array.type.kind != CType::Array) {
+                if (array.type.kind != CType::Void)
+                    Error("append to " + array.type.ToString());
+                return {"0", CType()};
+            }
+            if (IsConstant(arguments[0]))
+                Error("append to constant array");
+            auto& element = array.type.args[0];
+            auto value = Convert(EmitExpr(arguments[1], &element), element);
+            return {"zl_" + Mangle(array.type) + "_append(" + array.code + ", " + value.code + ")", array.type};
+        } else if (name == "print") {
+            Error("print has no value");
+            return {"0", CType()};
+        } else if (hasSelf_ && owner_->methods.count(name)) {
+            // A method of the class called without self
+            signature = &owner_->methods.at(name);
+            cname = "zm_" + owner_->cname.substr(3) + "_" + name;
+            receiver = "self";
+        } else if (functions_.count(name)) {
+            signature = &functions_.at(name);
+            cname = "zf_" + name;
+        } else if (owner_ && owner_->statics.count(name)) {
+            signature = &owner_->statics.at(name);
+            cname = "zm_" + owner_->cname.substr(3) + "_" + name;
+        } else {
+            Error("undefined function " + name);
+        }
+    } else if (callee && callee->Kind() == ast::NodeKind::SelectorExpr) {
+        auto selector = static_cast<ast::SelectorExpr*>(callee);
+        auto object = selector->expr_;
+        name = selector->selector_ ? selector->selector_->name_ : "";
+        std::string className;
+        if (object && object->Kind() == ast::NodeKind::Identifier &&
+                !FindVariable(static_cast<ast::Identifier*>(object)->name_))
+            className = static_cast<ast::Identifier*>(object)->name_;
+        auto klass = classes_.find(className);
+        bool field = false;
+        if (hasSelf_) {
+            for (auto& item : owner_->fields)
+                field = field || item.first == className;
+        }
+        if (klass != classes_.end() && !field) {
+            // Static method
+            auto method = klass->second.statics.find(name);
+            if (method == klass->second.statics.end()) {
+                Error(className + " has no static method " + name);
+            } else {
+                signature = &method->second;
+                cname = "zm_" + klass->second.cname.substr(3) + "_" + name;
+            }
+        } else {
+            auto value = EmitExpr(object);
+            if (value.type.kind == CType::Class) {
+                auto& info = classes_[value.type.name];
+                auto method = info.methods.find(name);
+                if (method == info.methods.end()) {
+                    Error(value.type.name + " has no method " + name);
+                } else {
+                    signature = &method->second;
+                    cname = "zm_" + info.cname.substr(3) + "_" + name;
+                    receiver = NonNil(value, "method " + name + " called on nil");
+                }
+            } else if (value.type.kind == CType::Interface) {
+                auto& info = interfaces_[value.type.name];
+                for (auto& method : info.methods) {
+                    if (method.first == name) {
+                        signature = &method.second;
+                        cname = info.cname + "_" + name;
+                        receiver = value.code;
+                    }
+                }
+                if (!signature)
+                    Error(value.type.name + " has no method " + name);
+            } else if (value.type.kind != CType::Void) {
+                Error("method " + name + " of " + value.type.ToString() + " is not supported by the C backend");
+            }
+        }
+    } else {
+        Error("call of a function value is not supported by the C backend");
+    }
+    if (!signature)
+        return {"0", CType()};
+
+    std::string arguments = EmitArguments(name, expr->arguments_, signature);
+    if (!receiver.empty())
+        arguments = receiver + (arguments.empty() ? "" : ", ") + arguments;
+    std::string code = cname + "(" + arguments + ")";
+    auto& results = signature->results;
+    if (results.empty())
+        return {code, CType()};
+    if (results.size() == 1)
+        return {code, results[0]};
+    CType tuple(CType::Tuple);
+    tuple.args = results;
+    UseType(tuple);
+    return {code, tuple};
+}
+
+CEmitter::Expr CEmitter::EmitNew(ast::NewExpr* expr) {
+    auto type = TypeOf(expr->type_);
+    if (type.kind != CType::Class) {
+        if (type.kind != CType::Void)
+            Error("new of " + type.ToString() + " which is not a class");
+        return {"0", CType()};
+    }
+    auto& info = classes_[type.name];
+    auto constructor = info.methods.find(type.name);
+    Signature none;
+    auto& signature = constructor != info.methods.end() ? constructor->second : none;
+    if (constructor == info.methods.end() && !expr->arguments_.empty()) {
+        Error(type.name + " has no constructor");
+        return {"0", CType()};
+    }
+    return {"zn_" + info.cname.substr(3) + "(" + EmitArguments(type.name, expr->arguments_, &signature) + ")", type};
+}
+
+// Elements take the type of the array expected, or of the first element
+CEmitter::Expr CEmitter::EmitArrayLiteral(const std::vector<ast::Expr*>& elements, const CType* expected) {
+    CType type(CType::Array);
+    std::vector<Expr> values;
+    if (expected && expected->kind == CType::Array) {
+        type = *expected;
+        for (auto element : elements)
+            values.push_back(Convert(EmitExpr(element, &type.args[0]), type.args[0]));
+    } else {
+        for (auto element : elements) {
+            values.push_back(EmitExpr(element, values.empty() ? nullptr : &type.args[0]));
+            if (values.size() == 1)
+                type.args.push_back(values[0].type);
+            else
+                values.back() = Convert(values.back(), type.args[0]);
+        }
+        if (type.args.empty() || type.args[0].kind == CType::Nil || type.args[0].kind == CType::Void ||
+                type.args[0].kind == CType::Tuple) {
+            if (type.args.empty() || type.args[0].kind != CType::Void)
+                Error("type of the array literal can not be inferred");
+            return {"0", CType()};
+        }
+    }
+    UseType(type);
+    auto name = "zl_" + Mangle(type);
+    if (values.empty())
+        return {name + "_new(0)", type};
+    std::string code;
+    for (auto& value : values)
+        code += (code.empty() ? "" : ", ") + value.code;
+    return {name + "_of(" + std::to_string(values.size()) + ", (" + CName(type.args[0]) + "[]){" + code + "})", type};
+}
+
+CEmitter::Expr CEmitter::EmitMapLiteral(const std::vector<std::pair<ast::Expr*, ast::Expr*>>& elements,
+        const CType* expected) {
+    CType type(CType::Map);
+    std::vector<std::pair<Expr, Expr>> values;
+    if (expected && expected->kind == CType::Map) {
+        type = *expected;
+        for (auto& element : elements) {
+            values.push_back({Convert(EmitExpr(element.first, &type.args[0]), type.args[0]),
+                Convert(EmitExpr(element.second, &type.args[1]), type.args[1])});
+        }
+    } else {
+        for (auto& element : elements) {
+            bool first = values.empty();
+            auto key = EmitExpr(element.first, first ? nullptr : &type.args[0]);
+            auto value = EmitExpr(element.second, first ? nullptr : &type.args[1]);
+            if (first) {
+                type.args.push_back(key.type);
+                type.args.push_back(value.type);
+            }
+            values.push_back({Convert(key, type.args[0]), Convert(value, type.args[1])});
+        }
+        auto unknown = [](const CType& arg) {
+            return arg.kind == CType::Nil || arg.kind == CType::Void || arg.kind == CType::Tuple;
+        };
+        if (type.args.empty() || unknown(type.args[0]) || unknown(type.args[1])) {
+            Error("type of the map literal can not be inferred");
+            return {"0", CType()};
+        }
+    }
+    UseType(type);
+    auto name = "zl_" + Mangle(type);
+    if (values.empty())
+        return {name + "_new()", type};
+    std::string keys, items;
+    for (auto& value : values) {
+        keys += (keys.empty() ? "" : ", ") + value.first.code;
+        items += (items.empty() ? "" : ", ") + value.second.code;
+    }
+    return {name + "_of(" + std::to_string(values.size()) + ", (" + CName(type.args[0]) + "[]){" + keys +
+        "}, (" + CName(type.args[1]) + "[]){" + items + "})", type};
+}
+
+std::string CEmitter::EmitArguments(const std::string& name, const std::vector<ast::Expr*>& arguments,
+        const Signature* signature) {
+    auto& parameters = signature->parameters;
+    if (parameters.size() != arguments.size()) {
+        Error(name + " takes " + std::to_string(parameters.size()) + " arguments, " +
+            std::to_string(arguments.size()) + " given");
+        return "";
+    }
+    std::string code;
+    for (size_t n = 0; n < arguments.size(); n++)
+        code += (n ? ", " : "") + Convert(EmitExpr(arguments[n], &parameters[n]), parameters[n]).code;
+    return code;
+}
+
+std::string CEmitter::Condition(ast::Expr* expr) {
+    auto value = EmitExpr(expr);
+    switch (value.type.kind) {
+        case CType::Bool:
+            return value.code;
+        case CType::Nil:
+            return "false";
+        case CType::Interface:
+            return "(" + value.code + ".object != NULL)";
+        case CType::Void:
+        case CType::Tuple:
+            if (value.type.kind == CType::Tuple)
+                Error("condition of several values");
+            return "false";
+        default:
+            // Numbers are true even if they are zero
+            if (value.type.IsNumeric())
+                return "((void)" + value.code + ", true)";
+            return "(" + value.code + " != NULL)";
+    }
+}
+
+CEmitter::Expr CEmitter::Convert(const Expr& value, const CType& type) {
+    if (value.type.kind == CType::Void || type.kind == CType::Void || SameType(value.type, type))
+        return {value.code, type};
+    if (value.type.IsNumeric() && type.IsNumeric())
+        return {"((" + CName(type) + ")" + value.code + ")", type};
+    if (value.type.kind == CType::Nil && type.kind == CType::Interface)
+        return {ZeroValue(type), type};
+    if (value.type.kind == CType::Nil && type.IsReference())
+        return {"NULL", type};
+    if (value.type.kind == CType::Class && type.kind == CType::Interface) {
+        auto table = UseMethodTable(type.name, value.type.name);
+        return {"((" + CName(type) + "){" + value.code + ", &" + table + "})", type};
+    }
+    Error("can not convert " + value.type.ToString() + " to " + type.ToString());
+    return {value.code, type};
+}
+
+std::string CEmitter::NonNil(const Expr& object, const std::string& message) {
+    if (object.code == "self" || localObjects_.count(object.code))
+        return object.code;
+    return "((" + CName(object.type) + ")zl_nonnil(" + object.code + ", " + Quote(message) + "))";
+}
+
+//
+// Types
+//
+
+CType CEmitter::TypeOf(ast::Type* type) {
+    if (!type)
+        return CType();
+    TypeId id = type->typeId_ != kNoTypeId ? type->typeId_ : typeContext_->Intern(type);
+    auto iter = declaredTypes_.find(id);
+    if (iter != declaredTypes_.end())
+        return iter->second;
+    CType result = ConvertType(type);
+    // Types which can not be translated are reported at each use
+    if (id != kNoTypeId && result.kind != CType::Void)
+        declaredTypes_[id] = result;
+    return result;
+}
+
+CType CEmitter::ConvertType(ast::Type* type) {
+    switch (type->Kind()) {
+        case ast::NodeKind::PrimitiveType: {
+            auto& name = static_cast<ast::PrimitiveType*>(type)->name_;
+            if (name == "bool")
+                return CType(CType::Bool);
+            if (name == "int" || name == "short" || name == "byte" || name == "char")
+                return CType(CType::Int);
+            if (name == "long")
+                return CType(CType::Long);
+            if (name == "float")
+                return CType(CType::Float);
+            if (name == "double")
+                return CType(CType::Double);
+            if (name == "string")
+                return CType(CType::String);
+            Error("unknown type " + name);
+            return CType();
+        }
+        case ast::NodeKind::NonPrimitiveType: {
+            auto name = static_cast<ast::NonPrimitiveType*>(type)->name_;
+            if (!name)
+                return CType();
+            CType result(classes_.count(name->name_) ? CType::Class : CType::Interface);
+            if (result.kind == CType::Interface && !interfaces_.count(name->name_)) {
+                Error("unknown type " + name->name_);
+                return CType();
+            }
+            result.name = name->name_;
+            return result;
+        }
+        case ast::NodeKind::ArrayType: {
+            auto element = TypeOf(static_cast<ast::ArrayType*>(type)->type_);
+            if (element.kind == CType::Void)
+                return element;
+            CType result(CType::Array);
+            result.args.push_back(element);
+            return result;
+        }
+        case ast::NodeKind::MapType: {
+            auto map = static_cast<ast::MapType*>(type);
+            auto key = TypeOf(map->leftType_);
+            auto value = TypeOf(map->rightType_);
+            if (key.kind == CType::Void || value.kind == CType::Void)
+                return CType();
+            if (key.kind == CType::Interface) {
+                Error("map key type " + key.ToString() + " is not supported by the C backend");
+                return CType();
+            }
+            CType result(CType::Map);
+            result.args.push_back(key);
+            result.args.push_back(value);
+            return result;
+        }
+        default:
+            Error(std::string(ast::NodeKindName(type->Kind())) + " is not a type");
+            return CType();
+    }
+}
+
+TypeId CEmitter::TypeIdOf(const CType& type) {
+    switch (type.kind) {
+        case CType::Void: return kNoTypeId;
+        case CType::Array: return typeContext_->Array(TypeIdOf(type.args[0]));
+        case CType::Map: return typeContext_->Map(TypeIdOf(type.args[0]), TypeIdOf(type.args[1]));
+        // Classes and interfaces share one namespace, as named types of
+        // unresolved syntax do
+        case CType::Class:
+        case CType::Interface:
+            return typeContext_->Named(type.name, nullptr);
+        case CType::Tuple: {
+            std::vector<TypeId> elements;
+            for (auto& arg : type.args)
+                elements.push_back(TypeIdOf(arg));
+            return typeContext_->Tuple(elements);
+        }
+        default:
+            return typeContext_->Primitive(Mangle(type));
+    }
+}
+
+bool CEmitter::SameType(const CType& a, const CType& b) {
+    return TypeIdOf(a) == TypeIdOf(b);
+}
+
+std::string CEmitter::CName(const CType& type) {
+    switch (type.kind) {
+        case CType::Void: return "void";
+        case CType::Nil: return "void*";
+        case CType::Bool: return "bool";
+        case CType::Int: return "int32_t";
+        case CType::Long: return "int64_t";
+        case CType::Float: return "float";
+        case CType::Double: return "double";
+        case CType::String: return "zl_string*";
+        case CType::Array:
+        case CType::Map:
+        case CType::Class: return "zl_" + Mangle(type) + "*";
+        case CType::Interface:
+        case CType::Tuple: return "zl_" + Mangle(type);
+    }
+    return "";
+}
+
+std::string CEmitter::ZeroValue(const CType& type) {
+    switch (type.kind) {
+        case CType::Bool: return "false";
+        case CType::Int:
+        case CType::Long:
+        case CType::Float:
+        case CType::Double: return "0";
+        case CType::String: return "(&zl_empty_string)";
+        case CType::Interface: return "((" + CName(type) + "){NULL, NULL})";
+        case CType::Tuple: return "((" + CName(type) + "){0})";
+        default: return "NULL";
+    }
+}
+
+void CEmitter::UseType(const CType& type) {
+    if (type.kind != CType::Array && type.kind != CType::Map && type.kind != CType::Tuple)
+        return;
+    if (!types_.insert(Mangle(type)).second)
+        return;
+    // The types an array, map or tuple is made of come first
+    for (auto& arg : type.args)
+        UseType(arg);
+    auto name = "zl_" + Mangle(type);
+    typedefs_ += "typedef struct " + name + " " + name + ";\n";
+    if (type.kind == CType::Array)
+        EmitArrayType(type);
+    else if (type.kind == CType::Map)
+        EmitMapType(type);
+    else
+        EmitTupleType(type);
+}
+
+void CEmitter::EmitArrayType(const CType& type) {
+    auto& element = type.args[0];
+    functionsOfTypes_ += Expand(kArrayTemplate, {
+        {'N', "zl_" + Mangle(type)},
+        {'M', Mangle(type)},
+        {'T', CName(element)},
+        {'P', PrintFunction(element)},
+    });
+}
+
+void CEmitter::EmitMapType(const CType& type) {
+    auto& key = type.args[0];
+    auto& value = type.args[1];
+    // Objects used as keys are compared by identity
+    bool pointer = key.IsReference() && key.kind != CType::String;
+    functionsOfTypes_ += Expand(kMapTemplate, {
+        {'N', "zl_" + Mangle(type)},
+        {'M', Mangle(type)},
+        {'K', CName(key)},
+        {'V', CName(value)},
+        {'H', pointer ? "pointer" : Mangle(key)},
+        {'I', key.ToString()},
+        {'Z', ZeroValue(value)},
+        {'A', PrintFunction(key)},
+        {'B', PrintFunction(value)},
+    });
+}
+
+void CEmitter::EmitTupleType(const CType& type) {
+    functionsOfTypes_ += "\nstruct zl_" + Mangle(type) + " {\n";
+    for (size_t n = 0; n < type.args.size(); n++)
+        functionsOfTypes_ += "    " + CName(type.args[n]) + " r" + std::to_string(n) + ";\n";
+    functionsOfTypes_ += "};\n";
+}
+
+std::string CEmitter::UseMethodTable(const std::string& interface, const std::string& klass) {
+    auto& interfaceInfo = interfaces_[interface];
+    auto& classInfo = classes_[klass];
+    auto name = "zl_table_" + interfaceInfo.cname.substr(3) + "_" + classInfo.cname.substr(3);
+    if (!tableNames_.insert(name).second)
+        return name;
+    std::string entries = Quote("<" + klass + ">");
+    for (auto& method : interfaceInfo.methods) {
+        auto& signature = method.second;
+        auto implementation = classInfo.methods.find(method.first);
+        bool same = implementation != classInfo.methods.end() &&
+            implementation->second.parameters.size() == signature.parameters.size() &&
+            implementation->second.results.size() == signature.results.size();
+        for (size_t n = 0; same && n < signature.parameters.size(); n++)
+            same = SameType(signature.parameters[n], implementation->second.parameters[n]);
+        for (size_t n = 0; same && n < signature.results.size(); n++)
+            same = SameType(signature.results[n], implementation->second.results[n]);
+        if (!same) {
+            Error(klass + " does not implement " + interface + "." + method.first);
+            continue;
+        }
+        // The thunk gives the class to the method
+        std::string result = "void";
+        if (signature.results.size() == 1) {
+            result = CName(signature.results[0]);
+        } else if (signature.results.size() > 1) {
+            CType tuple(CType::Tuple);
+            tuple.args = signature.results;
+            result = CName(tuple);
+        }
+        std::string parameters = "void* self";
+        std::string arguments = "(" + classInfo.cname + "*)self";
+        for (size_t n = 0; n < signature.parameters.size(); n++) {
+            parameters += ", " + CName(signature.parameters[n]) + " a" + std::to_string(n);
+            arguments += ", a" + std::to_string(n);
+        }
+        auto thunk = name + "_" + method.first;
+        tables_ += "static " + result + " " + thunk + "(" + parameters + ") {\n    " +
+            (result == "void" ? "" : "return ") + "zm_" + classInfo.cname.substr(3) + "_" + method.first +
+            "(" + arguments + ");\n}\n\n";
+        entries += ", " + thunk;
+    }
+    tables_ += "static const " + interfaceInfo.cname + "_table " + name + " = {" + entries + "};\n\n";
+    return name;
+}
+
+std::string CEmitter::PrintFunction(const CType& type) {
+    return "zl_print_" + Mangle(type);
+}
+
+std::string CEmitter::StringLiteral(const std::string& value) {
+    auto iter = strings_.find(value);
+    if (iter == strings_.end()) {
+        auto name = "zl_s" + std::to_string(strings_.size());
+        globalsCode_ += "static zl_string " + name + " = {" + std::to_string(value.size()) + ", " +
+            Quote(value) + "};\n";
+        iter = strings_.emplace(value, name).first;
+    }
+    return "(&" + iter->second + ")";
+}
+
+//
+// Variables
+//
+
+void CEmitter::PushScope() {
+    scopes_.push_back(variables_.size());
+}
+
+void CEmitter::PopScope() {
+    variables_.resize(scopes_.back());
+    scopes_.pop_back();
+}
+
+// Each variable of a function gets its own C name, so an initializer
+// referring to an outer variable of the same name is right
+const CEmitter::Variable& CEmitter::DeclareVariable(const std::string& name, const CType& type) {
+    int count = declared_[name]++;
+    std::string cname = "l_" + name;
+    if (count > 0)
+        cname += "_" + std::to_string(count);
+    variables_.push_back({name, cname, type});
+    return variables_.back();
+}
+
+const CEmitter::Variable* CEmitter::FindVariable(const std::string& name) const {
+    if (name.empty())
+        return nullptr;
+    for (auto iter = variables_.rbegin(); iter != variables_.rend(); ++iter) {
+        if (iter->name == name)
+            return &*iter;
+    }
+    return nullptr;
+}
+
+bool CEmitter::IsConstant(ast::Expr* expr) const {
+    if (!expr)
+        return false;
+    if (expr->Kind() == ast::NodeKind::IndexExpr)
+        return IsConstant(static_cast<ast::IndexExpr*>(expr)->expr_);
+    if (expr->Kind() != ast::NodeKind::Identifier)
+        return false;
+    auto& name = static_cast<ast::Identifier*>(expr)->name_;
+    if (auto variable = FindVariable(name))
+        return variable->constant;
+    if (hasSelf_) {
+        for (auto& field : owner_->fields) {
+            if (field.first == name)
+                return false;
+        }
+    }
+    auto global = globals_.find(name);
+    return global != globals_.end() && global->second.constant;
+}
+
+std::string CEmitter::NewTemporary() {
+    return "zl_t" + std::to_string(temporaries_++);
+}
+
+void CEmitter::Line(const std::string& text) {
+    code_.append(indent_ * 4, ' ');
+    code_ += text;
+    code_ += '\n';
+}
+
+void CEmitter::SetLine(ast::Node* node) {
+    if (node && node->Pos().GetLineno() > 0)
+        line_ = node->Pos().GetLineno();
+}
+
+void CEmitter::Error(const std::string& msg) {
+    diagnostics_.push_back({path_, {Location(line_), msg}});
+}
+
+bool CompileC(const std::string& source, const std::string& executable, std::string& error) {
+    const char* directory = getenv("TMPDIR");
+    std::string path = std::string(directory && *directory ? directory : "/tmp") + "/zlc-XXXXXX.c";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = mkstemps(name.data(), 2);
+    if (fd < 0) {
+        error = "can not create " + path + ": " + strerror(errno);
+        return false;
+    }
+    size_t written = 0;
+    while (written < source.size()) {
+        ssize_t n = write(fd, source.data() + written, source.size() - written);
+        if (n <= 0) {
+            error = std::string("can not write ") + name.data() + ": " + strerror(errno);
+            close(fd);
+            unlink(name.data());
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    close(fd);
+
+    const char* compiler = getenv("CC");
+    if (!compiler || !*compiler)
+        compiler = "cc";
+    std::vector<std::string> args = {compiler, "-std=c11", "-O2", "-o", executable, name.data(), "-lm"};
+    std::vector<char*> argv;
+    for (auto& arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    pid_t pid;
+    int status = posix_spawnp(&pid, compiler, nullptr, nullptr, argv.data(), environ);
+    if (status != 0) {
+        error = std::string("can not run ") + compiler + ": " + strerror(status);
+        unlink(name.data());
+        return false;
+    }
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    unlink(name.data());
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        error = std::string(compiler) + " failed to compile the generated C";
+        return false;
+    }
+    return true;
+}
+
+} // namespace zl
@@ -0,0 +1,365 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ast.h"
+#include "error_handler.h"
+#include "escape_analysis.h"
+#include "frontend.h"
+#include "type_context.h"
+
+namespace zl {
+
+// CDiagnostic is a construct which can not be translated to C
+struct CDiagnostic {
+    std::string path;
+    Diagnostic diagnostic;
+};
+
+// CLoopReport tell whether a for or foreach loop was translated to SIMD
+// kernels, and why not
+struct CLoopReport {
+    std::string path;
+    int line;
+    bool vectorized;
+    // What the kernels compute, such as "sum into total", or the reason the
+    // loop was left scalar
+    std::string detail;
+};
+
+// CType is the static type of a declaration or an expression
+struct CType {
+    enum Kind : uint8_t {
+        Void,
+        // Type of the nil literal, converted to any reference type
+        Nil,
+        Bool,
+        Int,
+        Long,
+        Float,
+        Double,
+        String,
+        Array,
+        Map,
+        Class,
+        Interface,
+        // Results of a function with several results
+        Tuple,
+    };
+    Kind kind = Void;
+    // Name of the class or interface
+    std::string name;
+    // Element of an array, key and value of a map, results of a tuple
+    std::vector<CType> args;
+
+    CType() {}
+    explicit CType(Kind kind): kind(kind) {}
+    bool IsNumeric() const { return kind >= Int && kind <= Double; }
+    bool IsInteger() const { return kind == Int || kind == Long; }
+    bool IsReference() const { return kind >= String && kind <= Interface; }
+    // Readable name for diagnostics, such as "map<string, int[]>"
+    std::string ToString() const;
+};
+
+// CEmitter translate the functions, classes and interfaces of source files
+// to one C11 translation unit.
+//
+// Every value has a static type. Primitives are C scalars and are never
+// boxed: int is int32_t, long int64_t and float a C float, int arithmetic
+// wraps like the interpreter. Classes are structs whose methods are
+// functions taking self, strings, arrays and maps are pointers to structs,
+// and each array element type and map key and value types get their own
+// struct and functions, so no element is boxed either. Interface values are
+// the object and a table of the methods of its class. Packages are merged,
+// names are resolved like the IR builder does.
+//
+// Objects are allocated from an arena and never freed, the programs are
+// short lived. Instances which do not escape their function, see
+// EscapeAnalysis, are allocated in its frame instead. Loops of arithmetic
+// over arrays of numbers run SIMD kernels, see SetVectorize. Runtime errors
+// print the message of the interpreter and exit with status 1. Constructs
+// without static types, exceptions and switch are reported as not
+// supported.
+class CEmitter {
+public:
+    CEmitter();
+    // The types of the files are interned in types, or not at all, so that
+    // equal declared types have equal ids
+    explicit CEmitter(TypeContext& types);
+    ~CEmitter() {}
+
+    // Translate the files to C into output, return false if some construct
+    // can not be translated
+    bool Emit(const std::vector<SourceFile>& files, std::string& output);
+    const std::vector<CDiagnostic>& Diagnostics() const { return diagnostics_; }
+    // All instances are allocated on the heap if the analysis is disabled,
+    // it is enabled by default
+    void SetEscapeAnalysis(bool enabled) { escapeAnalysis_ = enabled; }
+    const EscapeAnalysis& Escape() const { return escape_; }
+    // Counted for loops and foreach loops over arrays of int, long, float
+    // and double, whose bodies are sums and elementwise maps, run SIMD
+    // kernels compiled for AVX2, SSE4.2 and the base instruction set, the
+    // widest the processor supports is picked at run time. It is enabled
+    // by default. Sums of floating point values are added in another order,
+    // they are only vectorized if reassociation is allowed.
+    void SetVectorize(bool enabled) { vectorize_ = enabled; }
+    void SetReassociate(bool enabled) { reassociate_ = enabled; }
+    // A report for each for and foreach loop if vectorization is enabled
+    const std::vector<CLoopReport>& LoopReports() const { return loopReports_; }
+
+private:
+    CEmitter(const CEmitter&) = delete;
+    CEmitter& operator = (const CEmitter&) = delete;
+
+    struct Signature {
+        std::vector<CType> parameters;
+        std::vector<CType> results;
+    };
+    struct ClassInfo {
+        std::string cname;
+        std::vector<std::pair<std::string, CType>> fields;
+        std::map<std::string, Signature> methods;
+        std::map<std::string, Signature> statics;
+    };
+    struct InterfaceInfo {
+        std::string cname;
+        // In declaration order, it is the order of the method table
+        std::vector<std::pair<std::string, Signature>> methods;
+    };
+    struct Global {
+        std::string cname;
+        CType type;
+        bool constant = false;
+    };
+    struct Variable {
+        std::string name;
+        std::string cname;
+        CType type;
+        bool constant = false;
+    };
+    struct Body {
+        std::string path;
+        ast::FunctionDecl* decl;
+        // Class of the method, empty for functions
+        std::string owner;
+    };
+    // Expr is the C code of an expression and its type
+    struct Expr {
+        std::string code;
+        CType type;
+    };
+    // VectorNode is an operation of the body of a vectorized loop, on all
+    // lanes at once
+    struct VectorNode {
+        enum Op : uint8_t { Load, Scalar, Index, Cast, Neg, Add, Sub, Mul, Div };
+        Op op;
+        CType::Kind type;
+        // Array of Load, scalar of Scalar, operands of the others
+        int a;
+        int b;
+    };
+    // VectorStmt add a value to an accumulator or store it into an array at
+    // the loop index
+    struct VectorStmt {
+        bool store;
+        // Index of the accumulator or the array
+        int target;
+        int value;
+        bool subtract;
+    };
+    struct VectorLoop {
+        std::vector<VectorNode> nodes;
+        std::vector<VectorStmt> stmts;
+        // Parameters of the kernels: arrays, loop invariant values and
+        // accumulators, with the names of the arrays and accumulators
+        std::vector<Expr> arrays;
+        std::vector<Expr> scalars;
+        std::vector<Expr> accumulators;
+        std::vector<std::string> arrayNames;
+        std::vector<std::string> accumulatorNames;
+        // The index and the element variables of foreach, the index of for
+        std::string index;
+        std::string element;
+        int elementArray = -1;
+        // Variables declared in the body by name, and their values
+        std::vector<std::pair<std::string, int>> lets;
+        // Variables read as loop invariant values
+        std::set<std::string> reads;
+        // Why the loop is not vectorized, empty if it is
+        std::string reason;
+    };
+
+    // Declarations
+    void DeclareFile(const SourceFile& file);
+    void DeclareClass(ast::ClassDecl* decl);
+    void DeclareInterface(ast::InterfaceDecl* decl);
+    void DeclareFunction(ast::FunctionDecl* decl);
+    void DeclareGlobal(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer,
+        bool constant = false);
+    Signature SignatureOf(ast::FormalParameterList* parameters, ast::ReturnParameterList* results);
+    void EmitFunction(const Body& body);
+    void EmitInit();
+
+    // Statements
+    void EmitStmt(ast::Node* node);
+    void EmitBlock(ast::Node* node);
+    void EmitVariable(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer);
+    void EmitLocalObject(ast::Identifier* name, ast::NewExpr* expr);
+    void EmitAssign(ast::AssignStmt* stmt);
+    void EmitStore(ast::Expr* target, const Expr& value);
+    void EmitIf(ast::IfStmt* stmt);
+    void EmitFor(ast::ForStmt* stmt, bool vectorize = true);
+    void EmitForeach(ast::ForeachStmt* stmt, bool vectorize = true);
+    void EmitReturn(ast::ReturnStmt* stmt);
+    void EmitPrint(ast::CallExpr* expr);
+
+    // Expressions, expected is the type the value is converted to if known,
+    // it types the literals of arrays and maps
+    Expr EmitExpr(ast::Expr* expr, const CType* expected = nullptr);
+    Expr EmitLiteral(ast::LiteralExpr* expr);
+    Expr EmitIdentifier(ast::Identifier* expr);
+    Expr EmitUnary(ast::UnaryExpr* expr);
+    Expr EmitBinary(ast::BinaryExpr* expr);
+    Expr EmitArithmetic(int op, const Expr& left, const Expr& right);
+    Expr EmitSelector(ast::SelectorExpr* expr);
+    Expr EmitIndex(ast::IndexExpr* expr);
+    // All results of the call, a tuple if there are several
+    Expr EmitCall(ast::CallExpr* expr);
+    Expr EmitNew(ast::NewExpr* expr);
+    Expr EmitArrayLiteral(const std::vector<ast::Expr*>& elements, const CType* expected);
+    Expr EmitMapLiteral(const std::vector<std::pair<ast::Expr*, ast::Expr*>>& elements, const CType* expected);
+    // The arguments converted to the parameters, joined by commas
+    std::string EmitArguments(const std::string& name, const std::vector<ast::Expr*>& arguments,
+        const Signature* signature);
+    // C expression of the truth of the value, only nil and false are false
+    std::string Condition(ast::Expr* expr);
+    Expr Convert(const Expr& value, const CType& type);
+    // The object with a nil check unless it is self
+    std::string NonNil(const Expr& object, const std::string& message);
+
+    // Vectorized loops, see c_vectorizer.cc. If true is returned the loop
+    // is emitted, with its scalar version for when the arrays are nil or
+    // too short
+    bool VectorizeFor(ast::ForStmt* stmt);
+    bool VectorizeForeach(ast::ForeachStmt* stmt);
+    void VectorizeBody(ast::Node* node, VectorLoop& loop);
+    void VectorizeStmt(ast::Node* node, VectorLoop& loop);
+    void VectorizeAssign(ast::AssignStmt* stmt, VectorLoop& loop);
+    // Add the nodes of the value of the expression, return the last one or
+    // -1 if the expression can not be vectorized
+    int VectorizeExpr(ast::Expr* expr, VectorLoop& loop);
+    int VectorizeArithmetic(int op, int left, int right, VectorLoop& loop);
+    int VectorizeCast(int node, CType::Kind type, VectorLoop& loop);
+    int VectorArray(ast::Identifier* name, VectorLoop& loop);
+    int VectorScalar(const Expr& value, VectorLoop& loop);
+    // Return the value of an expression evaluated once before the loop, the
+    // type is void if it may change in the loop
+    Expr LoopInvariant(ast::Expr* expr, const VectorLoop& loop);
+    // Emit the kernels of the loop and return their call, the index goes
+    // from start to end
+    std::string EmitKernels(const VectorLoop& loop, const std::string& start, const std::string& end);
+    std::string VectorKernel(const VectorLoop& loop, const std::string& declarator, size_t width,
+        const std::string& attribute);
+    // Record the report of the loop, return true if it is vectorized
+    bool ReportLoop(const VectorLoop& loop, int line);
+
+    // Types, each canonical declared type is converted once
+    CType TypeOf(ast::Type* type);
+    CType ConvertType(ast::Type* type);
+    // Id of the canonical type in the type context, equal types have equal
+    // ids
+    TypeId TypeIdOf(const CType& type);
+    bool SameType(const CType& a, const CType& b);
+    // C type of values of the type
+    std::string CName(const CType& type);
+    std::string ZeroValue(const CType& type);
+    // Emit the struct and the functions of an array, map or tuple type and
+    // of the types it is made of, once
+    void UseType(const CType& type);
+    void EmitArrayType(const CType& type);
+    void EmitMapType(const CType& type);
+    void EmitTupleType(const CType& type);
+    // Name of the method table of the class for the interface
+    std::string UseMethodTable(const std::string& interface, const std::string& klass);
+    // Name of the C function printing values of the type
+    std::string PrintFunction(const CType& type);
+    std::string StringLiteral(const std::string& value);
+
+    // Variables
+    void PushScope();
+    void PopScope();
+    const Variable& DeclareVariable(const std::string& name, const CType& type);
+    const Variable* FindVariable(const std::string& name) const;
+    // Whether the expression names a constant or an element of one, the
+    // arrays and maps of constants are read-only like in the interpreter
+    bool IsConstant(ast::Expr* expr) const;
+    std::string NewTemporary();
+
+    void Line(const std::string& text);
+    void SetLine(ast::Node* node);
+    void Error(const std::string& msg);
+
+private:
+    std::vector<CDiagnostic> diagnostics_;
+    std::map<std::string, ClassInfo> classes_;
+    std::map<std::string, InterfaceInfo> interfaces_;
+    std::map<std::string, Signature> functions_;
+    std::unordered_map<std::string, Global> globals_;
+    // Initializers of globals in declaration order
+    std::vector<std::pair<std::string, ast::VarInitializer*>> initializers_;
+    std::vector<Body> bodies_;
+    std::string path_;
+    int line_;
+
+    // Sections of the translation unit
+    std::string typedefs_;
+    std::string structs_;
+    std::string functionsOfTypes_;
+    std::string kernels_;
+    std::string prototypes_;
+    std::string tables_;
+    std::string globalsCode_;
+    std::string code_;
+    // Emitted types by their mangled names and string literals by value
+    std::set<std::string> types_;
+    std::set<std::string> tableNames_;
+    std::unordered_map<std::string, std::string> strings_;
+    // typeContext_ is ownTypeContext_ unless one is given
+    std::unique_ptr<TypeContext> ownTypeContext_;
+    TypeContext* typeContext_;
+    std::unordered_map<TypeId, CType> declaredTypes_;
+    EscapeAnalysis escape_;
+    bool escapeAnalysis_;
+    bool vectorize_;
+    bool reassociate_;
+    std::vector<CLoopReport> loopReports_;
+    int vectorLoops_;
+
+    // State of the function being emitted
+    const ClassInfo* owner_;
+    std::string ownerName_;
+    bool hasSelf_;
+    const Signature* signature_;
+    std::vector<Variable> variables_;
+    std::vector<size_t> scopes_;
+    std::unordered_map<std::string, int> declared_;
+    // Variables of instances in the frame, they are never nil
+    std::unordered_set<std::string> localObjects_;
+    // Label continue jumps to for each loop, empty if continue is plain
+    std::vector<std::string> loops_;
+    int temporaries_;
+    int indent_;
+};
+
+// Compile the C source to an executable with the C compiler named by the
+// CC environment variable, cc by default. Return false with the reason in
+// error if the compiler fails.
+bool CompileC(const std::string& source, const std::string& executable, std::string& error);
+
+} // namespace zl
@@ -0,0 +1,914 @@
+#include <algorithm>
+#include <functional>
+#include "c_emitter.h"
+
+namespace zl {
+
+// A loop is vectorized if it is
+//
+//   for (i:int = start; i < end; i += 1) { body }
+//   foreach (x in a) { body } or foreach (i, x in a) { body }
+//
+// where start and end do not change in the loop, a is an array of int,
+// long, float or double and the statements of the body are
+//
+//   var t:T = e                 a value used by the next statements
+//   b[i] = e or b[i] op= e      an elementwise map into an array
+//   s += e or s = s + e         a sum, with -= and - too
+//
+// The expressions are made of numbers, variables which are not assigned in
+// the loop, the index, the element and elements b[i] of arrays at the
+// index, with +, - and * and / of floating point values. Integer division
+// is left out since it fails on zero, there are no calls, conditions nor
+// other statements, so iterations only depend on each other through sums.
+//
+// The kernels run groups of iterations as lanes of vectors, with two groups
+// per step, then the remaining iterations one by one. The arrays are checked
+// before the kernels run, the scalar loop runs instead if one is nil or
+// shorter than the index goes, so runtime errors are reported as before.
+// Integer sums wrap, they are the same in any order. Floating point sums are
+// not, they are only vectorized if reassociation is allowed.
+
+namespace {
+
+const char* KindName(CType::Kind kind) {
+    switch (kind) {
+        case CType::Int: return "int";
+        case CType::Long: return "long";
+        case CType::Float: return "float";
+        default: return "double";
+    }
+}
+
+const char* ScalarType(CType::Kind kind) {
+    switch (kind) {
+        case CType::Int: return "int32_t";
+        case CType::Long: return "int64_t";
+        case CType::Float: return "float";
+        default: return "double";
+    }
+}
+
+size_t KindSize(CType::Kind kind) {
+    return kind == CType::Long || kind == CType::Double ? 8 : 4;
+}
+
+bool IsInteger(CType::Kind kind) {
+    return kind == CType::Int || kind == CType::Long;
+}
+
+bool IsName(ast::Node* node, const std::string& name) {
+    return !name.empty() && node && node->Kind() == ast::NodeKind::Identifier &&
+        static_cast<ast::Identifier*>(node)->name_ == name;
+}
+
+bool IsOne(ast::Node* node) {
+    return node && node->Kind() == ast::NodeKind::LiteralExpr &&
+        static_cast<ast::LiteralExpr*>(node)->kind_ == Token::INT &&
+        static_cast<ast::LiteralExpr*>(node)->value_ == "1";
+}
+
+// The operator of a compound assignment of the arithmetic of vectors
+int ArithmeticOperator(int op) {
+    switch (op) {
+        case Token::ADD_ASSIGN: return Token::ADD;
+        case Token::SUB_ASSIGN: return Token::SUB;
+        case Token::MUL_ASSIGN: return Token::MUL;
+        case Token::QUO_ASSIGN: return Token::QUO;
+        default: return -1;
+    }
+}
+
+std::string Join(const std::vector<std::string>& items) {
+    std::string text;
+    for (auto& item : items)
+        text += (text.empty() ? "" : ", ") + item;
+    return text;
+}
+
+} // namespace
+
+bool CEmitter::VectorizeFor(ast::ForStmt* stmt) {
+    int line = line_;
+    size_t errors = diagnostics_.size();
+    VectorLoop loop;
+    ast::Expr* first = nullptr;
+    // Variable of the index declared before the loop, it is set to the end
+    const Variable* outer = nullptr;
+    auto initializer = stmt->initializer_ && stmt->initializer_->stmts_.size() == 1 ?
+        stmt->initializer_->stmts_[0] : nullptr;
+    if (initializer && initializer->varDecl_) {
+        auto decl = initializer->varDecl_;
+        if (decl->name_ && TypeOf(decl->type_).kind == CType::Int && decl->varInitializer_) {
+            loop.index = decl->name_->name_;
+            first = decl->varInitializer_->expr_;
+        }
+    } else if (initializer && initializer->stmt_ && initializer->stmt_->Kind() == ast::NodeKind::AssignStmt) {
+        auto assign = static_cast<ast::AssignStmt*>(initializer->stmt_);
+        if (assign->op_ == Token::ASSIGN && assign->lhs_.size() == 1 && assign->rhs_.size() == 1 &&
+                assign->lhs_[0]->Kind() == ast::NodeKind::Identifier) {
+            outer = FindVariable(static_cast<ast::Identifier*>(assign->lhs_[0])->name_);
+            if (outer && outer->type.kind == CType::Int) {
+                loop.index = outer->name;
+                first = assign->rhs_[0];
+            }
+        }
+    }
+    auto condition = stmt->expr_ && stmt->expr_->Kind() == ast::NodeKind::BinaryExpr ?
+        static_cast<ast::BinaryExpr*>(stmt->expr_) : nullptr;
+    auto step = stmt->finalizer_ && stmt->finalizer_->stmts_.size() == 1 ?
+        dynamic_cast<ast::AssignStmt*>(stmt->finalizer_->stmts_[0]->stmt_) : nullptr;
+    bool increment = false;
+    if (step && step->lhs_.size() == 1 && step->rhs_.size() == 1 && IsName(step->lhs_[0], loop.index)) {
+        auto sum = dynamic_cast<ast::BinaryExpr*>(step->rhs_[0]);
+        increment = (step->op_ == Token::ADD_ASSIGN && IsOne(step->rhs_[0])) ||
+            (step->op_ == Token::ASSIGN && sum && sum->op_ == Token::ADD &&
+                ((IsName(sum->left_, loop.index) && IsOne(sum->right_)) ||
+                    (IsOne(sum->left_) && IsName(sum->right_, loop.index))));
+    }
+
+    Expr start, end;
+    if (!first) {
+        loop.reason = "the loop does not start with an int variable";
+    } else if (!condition || condition->op_ != Token::LSS || !IsName(condition->left_, loop.index)) {
+        loop.reason = "the condition is not " + loop.index + " < end";
+    } else if (!increment) {
+        loop.reason = loop.index + " is not incremented by 1";
+    } else {
+        VectorizeBody(stmt->block_, loop);
+        if (loop.reason.empty()) {
+            start = LoopInvariant(first, loop);
+            end = LoopInvariant(condition->right_, loop);
+            if (start.type.kind != CType::Int)
+                loop.reason = "the start of " + loop.index + " is not an int which is the same in the loop";
+            else if (end.type.kind != CType::Int)
+                loop.reason = "the end of " + loop.index + " is not an int which is the same in the loop";
+        }
+    }
+    if (diagnostics_.size() != errors) {
+        // They are reported by the scalar loop
+        diagnostics_.resize(errors);
+        loop.reason = "the loop has errors";
+    }
+    if (!ReportLoop(loop, line))
+        return false;
+
+    Line("{");
+    indent_++;
+    auto low = NewTemporary();
+    auto high = NewTemporary();
+    Line("int32_t " + low + " = " + start.code + ";");
+    Line("int32_t " + high + " = " + end.code + ";");
+    std::string check = low + " < " + high + " && " + low + " >= 0";
+    for (auto& array : loop.arrays)
+        check += " && " + array.code + " && " + high + " <= " + array.code + "->len";
+    auto call = EmitKernels(loop, low, high);
+    Line("if (" + check + ") {");
+    indent_++;
+    Line(call + ";");
+    if (outer)
+        Line(outer->cname + " = " + high + ";");
+    indent_--;
+    Line("} else {");
+    indent_++;
+    EmitFor(stmt, false);
+    indent_--;
+    Line("}");
+    indent_--;
+    Line("}");
+    return true;
+}
+
+bool CEmitter::VectorizeForeach(ast::ForeachStmt* stmt) {
+    int line = line_;
+    size_t errors = diagnostics_.size();
+    VectorLoop loop;
+    auto iterable = dynamic_cast<ast::IterableObject*>(stmt->iterableObject_);
+    auto name = iterable ? dynamic_cast<ast::Identifier*>(iterable->primary_) : nullptr;
+    if (stmt->variables_.empty() || stmt->variables_.size() > 2) {
+        loop.reason = "foreach must have one or two variables";
+    } else if (!name) {
+        loop.reason = "foreach is not over a variable";
+    } else {
+        auto sequence = EmitIdentifier(name);
+        if (sequence.type.kind == CType::Map) {
+            loop.reason = "foreach is over a map";
+        } else if (sequence.type.kind != CType::Array || !sequence.type.args[0].IsNumeric()) {
+            loop.reason = "foreach is not over an array of int, long, float or double";
+        } else {
+            loop.element = stmt->variables_.back();
+            if (stmt->variables_.size() == 2)
+                loop.index = stmt->variables_[0];
+            loop.elementArray = VectorArray(name, loop);
+            VectorizeBody(stmt->block_, loop);
+        }
+    }
+    if (diagnostics_.size() != errors) {
+        diagnostics_.resize(errors);
+        loop.reason = "the loop has errors";
+    }
+    if (!ReportLoop(loop, line))
+        return false;
+
+    auto& sequence = loop.arrays[loop.elementArray].code;
+    std::string check = sequence + " && " + sequence + "->len > 0";
+    for (size_t n = 0; n < loop.arrays.size(); n++) {
+        if (static_cast<int>(n) != loop.elementArray)
+            check += " && " + loop.arrays[n].code + " && " + sequence + "->len <= " + loop.arrays[n].code + "->len";
+    }
+    auto call = EmitKernels(loop, "0", sequence + "->len");
+    Line("if (" + check + ") {");
+    indent_++;
+    Line(call + ";");
+    indent_--;
+    Line("} else {");
+    indent_++;
+    EmitForeach(stmt, false);
+    indent_--;
+    Line("}");
+    return true;
+}
+
+void CEmitter::VectorizeBody(ast::Node* node, VectorLoop& loop) {
+    if (node && node->Kind() == ast::NodeKind::BlockStmt) {
+        for (auto stmt : static_cast<ast::BlockStmt*>(node)->stmts_) {
+            VectorizeStmt(stmt, loop);
+            if (!loop.reason.empty())
+                return;
+        }
+    } else {
+        VectorizeStmt(node, loop);
+    }
+    if (!loop.reason.empty())
+        return;
+    if (loop.stmts.empty()) {
+        loop.reason = "the body has no sum nor store into an array";
+        return;
+    }
+    // Sums can not be read in the loop, their value is only known after it
+    for (size_t n = 0; n < loop.accumulators.size(); n++) {
+        if (loop.reads.count(loop.accumulators[n].code)) {
+            loop.reason = loop.accumulatorNames[n] + " is read in the body";
+            return;
+        }
+    }
+}
+
+void CEmitter::VectorizeStmt(ast::Node* node, VectorLoop& loop) {
+    if (!node)
+        return;
+    switch (node->Kind()) {
+        case ast::NodeKind::DeclStmt:
+            VectorizeStmt(static_cast<ast::DeclStmt*>(node)->decl_, loop);
+            return;
+        case ast::NodeKind::ExprStmt: {
+            auto stmt = static_cast<ast::ExprStmt*>(node);
+            if (stmt->varDecl_ || stmt->stmt_) {
+                VectorizeStmt(stmt->varDecl_ ? static_cast<ast::Node*>(stmt->varDecl_) : stmt->stmt_, loop);
+            } else if (stmt->expr_ && stmt->expr_->Kind() == ast::NodeKind::CallExpr) {
+                auto function = static_cast<ast::CallExpr*>(stmt->expr_)->function_;
+                loop.reason = "the body calls " + (function && function->Kind() == ast::NodeKind::Identifier ?
+                    static_cast<ast::Identifier*>(function)->name_ : std::string("a function"));
+            } else {
+                loop.reason = "the body has an expression statement";
+            }
+            return;
+        }
+        case ast::NodeKind::ExprStmts:
+            for (auto stmt : static_cast<ast::ExprStmts*>(node)->stmts_) {
+                VectorizeStmt(stmt, loop);
+                if (!loop.reason.empty())
+                    return;
+            }
+            return;
+        case ast::NodeKind::VariableDecl: {
+            auto decl = static_cast<ast::VariableDecl*>(node);
+            if (!decl->name_ || !decl->varInitializer_ || !decl->varInitializer_->expr_) {
+                loop.reason = "a variable of the body has no value";
+                return;
+            }
+            auto& name = decl->name_->name_;
+            for (auto& let : loop.lets) {
+                if (let.first == name) {
+                    loop.reason = name + " is declared twice in the body";
+                    return;
+                }
+            }
+            int value = VectorizeExpr(decl->varInitializer_->expr_, loop);
+            if (value < 0)
+                return;
+            if (decl->type_) {
+                auto type = TypeOf(decl->type_);
+                if (!type.IsNumeric()) {
+                    loop.reason = name + " is not a number";
+                    return;
+                }
+                value = VectorizeCast(value, type.kind, loop);
+            }
+            loop.lets.push_back({name, value});
+            return;
+        }
+        case ast::NodeKind::AssignStmt:
+            VectorizeAssign(static_cast<ast::AssignStmt*>(node), loop);
+            return;
+        default:
+            loop.reason = std::string(ast::NodeKindName(node->Kind())) + " in the body";
+            return;
+    }
+}
+
+void CEmitter::VectorizeAssign(ast::AssignStmt* stmt, VectorLoop& loop) {
+    if (stmt->lhs_.size() != 1 || stmt->rhs_.size() != 1) {
+        loop.reason = "the body assigns several values";
+        return;
+    }
+    auto target = stmt->lhs_[0];
+    int op = ArithmeticOperator(stmt->op_);
+    if (stmt->op_ != Token::ASSIGN && op < 0) {
+        loop.reason = "the body has operator " + TokenTypeString(stmt->op_);
+        return;
+    }
+
+    // b[i] = e stores into the array at the index
+    if (target->Kind() == ast::NodeKind::IndexExpr) {
+        auto index = static_cast<ast::IndexExpr*>(target);
+        auto name = dynamic_cast<ast::Identifier*>(index->expr_);
+        if (!name) {
+            loop.reason = "the body stores into an array which is not a variable";
+            return;
+        }
+        if (!IsName(index->index_, loop.index)) {
+            loop.reason = "the body stores into " + name->name_ + " out of the index";
+            return;
+        }
+        int array = VectorArray(name, loop);
+        if (array < 0)
+            return;
+        int value = VectorizeExpr(stmt->rhs_[0], loop);
+        if (value < 0)
+            return;
+        auto element = loop.arrays[array].type.args[0].kind;
+        if (op >= 0) {
+            loop.nodes.push_back({VectorNode::Load, element, array, 0});
+            value = VectorizeArithmetic(op, static_cast<int>(loop.nodes.size() - 1), value, loop);
+            if (value < 0)
+                return;
+        }
+        loop.stmts.push_back({true, array, VectorizeCast(value, element, loop), false});
+        return;
+    }
+
+    auto name = dynamic_cast<ast::Identifier*>(target);
+    if (!name) {
+        loop.reason = "the body assigns a " + std::string(ast::NodeKindName(target->Kind()));
+        return;
+    }
+    auto assigned = name->name_ + " is assigned in the body";
+    if (name->name_ == loop.index || name->name_ == loop.element) {
+        loop.reason = assigned;
+        return;
+    }
+    for (auto& let : loop.lets) {
+        if (let.first == name->name_) {
+            loop.reason = assigned;
+            return;
+        }
+    }
+    // s += e, s -= e, s = s + e, s = e + s and s = s - e are sums
+    ast::Expr* operand = nullptr;
+    bool subtract = false;
+    if (op == Token::ADD || op == Token::SUB) {
+        operand = stmt->rhs_[0];
+        subtract = op == Token::SUB;
+    } else if (stmt->op_ == Token::ASSIGN && stmt->rhs_[0]->Kind() == ast::NodeKind::BinaryExpr) {
+        auto sum = static_cast<ast::BinaryExpr*>(stmt->rhs_[0]);
+        if ((sum->op_ == Token::ADD || sum->op_ == Token::SUB) && IsName(sum->left_, name->name_)) {
+            operand = sum->right_;
+            subtract = sum->op_ == Token::SUB;
+        } else if (sum->op_ == Token::ADD && IsName(sum->right_, name->name_)) {
+            operand = sum->left_;
+        }
+    }
+    if (!operand) {
+        loop.reason = assigned;
+        return;
+    }
+    auto accumulator = EmitIdentifier(name);
+    if (!accumulator.type.IsNumeric()) {
+        loop.reason = name->name_ + " is not a number";
+        return;
+    }
+    int value = VectorizeExpr(operand, loop);
+    if (value < 0)
+        return;
+    auto kind = accumulator.type.kind;
+    auto valueKind = loop.nodes[value].type;
+    if (IsInteger(kind) && !IsInteger(valueKind)) {
+        loop.reason = "the sum into " + name->name_ + " converts floating point values to an integer";
+        return;
+    }
+    if (!IsInteger(kind) && valueKind > kind) {
+        loop.reason = "the sum into " + name->name_ + " is of values wider than it";
+        return;
+    }
+    if (!IsInteger(kind) && !reassociate_) {
+        loop.reason = "the sum into " + name->name_ + " is of floating point values and reassociation is not allowed";
+        return;
+    }
+    size_t slot = 0;
+    while (slot < loop.accumulators.size() && loop.accumulators[slot].code != accumulator.code)
+        slot++;
+    if (slot == loop.accumulators.size()) {
+        loop.accumulators.push_back(accumulator);
+        loop.accumulatorNames.push_back(name->name_);
+    }
+    // Integers wrap, the value is truncated to the sum like the scalar loop
+    // truncates each sum
+    loop.stmts.push_back({false, static_cast<int>(slot), VectorizeCast(value, kind, loop), subtract});
+}
+
+int CEmitter::VectorizeExpr(ast::Expr* expr, VectorLoop& loop) {
+    if (!expr) {
+        loop.reason = "the body has a missing expression";
+        return -1;
+    }
+    switch (expr->Kind()) {
+        case ast::NodeKind::LiteralExpr: {
+            auto literal = static_cast<ast::LiteralExpr*>(expr);
+            if (literal->kind_ != Token::INT && literal->kind_ != Token::FLOAT && literal->kind_ != Token::CHAR) {
+                loop.reason = "the body has a " + TokenTypeString(literal->kind_) + " literal";
+                return -1;
+            }
+            return VectorScalar(EmitLiteral(literal), loop);
+        }
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(expr)->name_;
+            for (auto let = loop.lets.rbegin(); let != loop.lets.rend(); let++) {
+                if (let->first == name)
+                    return let->second;
+            }
+            if (name == loop.element) {
+                loop.nodes.push_back({VectorNode::Load, loop.arrays[loop.elementArray].type.args[0].kind,
+                    loop.elementArray, 0});
+                return static_cast<int>(loop.nodes.size() - 1);
+            }
+            if (name == loop.index) {
+                loop.nodes.push_back({VectorNode::Index, CType::Int, 0, 0});
+                return static_cast<int>(loop.nodes.size() - 1);
+            }
+            auto value = EmitIdentifier(static_cast<ast::Identifier*>(expr));
+            if (!value.type.IsNumeric()) {
+                loop.reason = name + " is not a number";
+                return -1;
+            }
+            loop.reads.insert(value.code);
+            return VectorScalar(value, loop);
+        }
+        case ast::NodeKind::SelectorExpr: {
+            // Fields of self do not change in the loop
+            auto selector = static_cast<ast::SelectorExpr*>(expr);
+            if (!hasSelf_ || !IsName(selector->expr_, "self")) {
+                loop.reason = "the body reads a field of an object other than self";
+                return -1;
+            }
+            auto value = EmitSelector(selector);
+            if (!value.type.IsNumeric()) {
+                loop.reason = "the body reads a field which is not a number";
+                return -1;
+            }
+            loop.reads.insert(value.code);
+            return VectorScalar(value, loop);
+        }
+        case ast::NodeKind::UnaryExpr: {
+            auto unary = static_cast<ast::UnaryExpr*>(expr);
+            if (unary->op_ != Token::SUB && unary->op_ != Token::ADD) {
+                loop.reason = "the body has operator " + TokenTypeString(unary->op_);
+                return -1;
+            }
+            int operand = VectorizeExpr(unary->expr_, loop);
+            if (operand < 0 || unary->op_ == Token::ADD)
+                return operand;
+            loop.nodes.push_back({VectorNode::Neg, loop.nodes[operand].type, operand, 0});
+            return static_cast<int>(loop.nodes.size() - 1);
+        }
+        case ast::NodeKind::BinaryExpr: {
+            auto binary = static_cast<ast::BinaryExpr*>(expr);
+            int left = VectorizeExpr(binary->left_, loop);
+            if (left < 0)
+                return -1;
+            int right = VectorizeExpr(binary->right_, loop);
+            if (right < 0)
+                return -1;
+            return VectorizeArithmetic(binary->op_, left, right, loop);
+        }
+        case ast::NodeKind::IndexExpr: {
+            auto index = static_cast<ast::IndexExpr*>(expr);
+            auto name = dynamic_cast<ast::Identifier*>(index->expr_);
+            if (!name) {
+                loop.reason = "the body indexes an array which is not a variable";
+                return -1;
+            }
+            if (!IsName(index->index_, loop.index)) {
+                loop.reason = "the body reads " + name->name_ + " out of the index";
+                return -1;
+            }
+            int array = VectorArray(name, loop);
+            if (array < 0)
+                return -1;
+            loop.nodes.push_back({VectorNode::Load, loop.arrays[array].type.args[0].kind, array, 0});
+            return static_cast<int>(loop.nodes.size() - 1);
+        }
+        case ast::NodeKind::CallExpr: {
+            auto function = static_cast<ast::CallExpr*>(expr)->function_;
+            loop.reason = "the body calls " + (function && function->Kind() == ast::NodeKind::Identifier ?
+                static_cast<ast::Identifier*>(function)->name_ : std::string("a function"));
+            return -1;
+        }
+        default:
+            loop.reason = std::string(ast::NodeKindName(expr->Kind())) + " in the body";
+            return -1;
+    }
+}
+
+// Operands are promoted to the wider type like the scalar code does
+int CEmitter::VectorizeArithmetic(int op, int left, int right, VectorLoop& loop) {
+    VectorNode::Op operation;
+    switch (op) {
+        case Token::ADD: operation = VectorNode::Add; break;
+        case Token::SUB: operation = VectorNode::Sub; break;
+        case Token::MUL: operation = VectorNode::Mul; break;
+        case Token::QUO: operation = VectorNode::Div; break;
+        default:
+            loop.reason = "the body has operator " + TokenTypeString(op);
+            return -1;
+    }
+    auto wider = std::max(loop.nodes[left].type, loop.nodes[right].type);
+    if (operation == VectorNode::Div && IsInteger(wider)) {
+        loop.reason = "the body has an integer division";
+        return -1;
+    }
+    left = VectorizeCast(left, wider, loop);
+    right = VectorizeCast(right, wider, loop);
+    loop.nodes.push_back({operation, wider, left, right});
+    return static_cast<int>(loop.nodes.size() - 1);
+}
+
+int CEmitter::VectorizeCast(int node, CType::Kind type, VectorLoop& loop) {
+    if (loop.nodes[node].type == type)
+        return node;
+    loop.nodes.push_back({VectorNode::Cast, type, node, 0});
+    return static_cast<int>(loop.nodes.size() - 1);
+}
+
+int CEmitter::VectorArray(ast::Identifier* name, VectorLoop& loop) {
+    for (auto& let : loop.lets) {
+        if (let.first == name->name_) {
+            loop.reason = name->name_ + " is not an array";
+            return -1;
+        }
+    }
+    auto array = EmitIdentifier(name);
+    if (array.type.kind != CType::Array || !array.type.args[0].IsNumeric()) {
+        loop.reason = name->name_ + " is not an array of int, long, float or double";
+        return -1;
+    }
+    for (size_t n = 0; n < loop.arrays.size(); n++) {
+        if (loop.arrays[n].code == array.code)
+            return static_cast<int>(n);
+    }
+    loop.arrays.push_back(array);
+    loop.arrayNames.push_back(name->name_);
+    return static_cast<int>(loop.arrays.size() - 1);
+}
+
+int CEmitter::VectorScalar(const Expr& value, VectorLoop& loop) {
+    size_t n = 0;
+    while (n < loop.scalars.size() && loop.scalars[n].code != value.code)
+        n++;
+    if (n == loop.scalars.size())
+        loop.scalars.push_back(value);
+    loop.nodes.push_back({VectorNode::Scalar, value.type.kind, static_cast<int>(n), 0});
+    return static_cast<int>(loop.nodes.size() - 1);
+}
+
+// Numbers, variables which are not sums of the loop nor its index, len of
+// them and their arithmetic
+CEmitter::Expr CEmitter::LoopInvariant(ast::Expr* expr, const VectorLoop& loop) {
+    std::function<bool(ast::Expr*)> invariant = [&](ast::Expr* expr) -> bool {
+        if (!expr)
+            return false;
+        switch (expr->Kind()) {
+            case ast::NodeKind::LiteralExpr:
+                return static_cast<ast::LiteralExpr*>(expr)->kind_ == Token::INT;
+            case ast::NodeKind::Identifier: {
+                if (IsName(expr, loop.index))
+                    return false;
+                auto code = EmitIdentifier(static_cast<ast::Identifier*>(expr)).code;
+                for (auto& accumulator : loop.accumulators) {
+                    if (accumulator.code == code)
+                        return false;
+                }
+                return true;
+            }
+            case ast::NodeKind::CallExpr: {
+                auto call = static_cast<ast::CallExpr*>(expr);
+                return IsName(call->function_, "len") && !functions_.count("len") && call->arguments_.size() == 1 &&
+                    call->arguments_[0]->Kind() == ast::NodeKind::Identifier && invariant(call->arguments_[0]);
+            }
+            case ast::NodeKind::UnaryExpr:
+                return static_cast<ast::UnaryExpr*>(expr)->op_ == Token::SUB &&
+                    invariant(static_cast<ast::UnaryExpr*>(expr)->expr_);
+            case ast::NodeKind::BinaryExpr: {
+                auto binary = static_cast<ast::BinaryExpr*>(expr);
+                return (binary->op_ == Token::ADD || binary->op_ == Token::SUB || binary->op_ == Token::MUL) &&
+                    invariant(binary->left_) && invariant(binary->right_);
+            }
+            default:
+                return false;
+        }
+    };
+    if (!invariant(expr))
+        return {"0", CType()};
+    return EmitExpr(expr);
+}
+
+std::string CEmitter::EmitKernels(const VectorLoop& loop, const std::string& start, const std::string& end) {
+    auto name = "zl_vloop" + std::to_string(vectorLoops_++);
+    std::string parameters = "int64_t start, int64_t end";
+    std::string arguments = "start, end";
+    std::string call = name + "(" + start + ", " + end;
+    for (size_t n = 0; n < loop.arrays.size(); n++) {
+        parameters += std::string(", ") + ScalarType(loop.arrays[n].type.args[0].kind) + "* a" + std::to_string(n);
+        arguments += ", a" + std::to_string(n);
+        call += ", " + loop.arrays[n].code + "->data";
+    }
+    for (size_t n = 0; n < loop.scalars.size(); n++) {
+        parameters += std::string(", ") + ScalarType(loop.scalars[n].type.kind) + " s" + std::to_string(n);
+        arguments += ", s" + std::to_string(n);
+        call += ", " + loop.scalars[n].code;
+    }
+    for (size_t n = 0; n < loop.accumulators.size(); n++) {
+        parameters += std::string(", ") + ScalarType(loop.accumulators[n].type.kind) + "* r" + std::to_string(n);
+        arguments += ", r" + std::to_string(n);
+        call += ", &" + loop.accumulators[n].code;
+    }
+
+    kernels_ += "\n#if defined(ZL_SIMD_DISPATCH)";
+    kernels_ += VectorKernel(loop, name + "_avx2(" + parameters + ")", 32, "__attribute__((target(\"avx2\"))) ");
+    kernels_ += VectorKernel(loop, name + "_sse42(" + parameters + ")", 16, "__attribute__((target(\"sse4.2\"))) ");
+    kernels_ += "#endif\n";
+    kernels_ += VectorKernel(loop, name + "_base(" + parameters + ")", 16, "");
+    kernels_ += "\nstatic void " + name + "(" + parameters + ") {\n"
+        "#if defined(ZL_SIMD_DISPATCH)\n"
+        "    int level = zl_simd_level();\n"
+        "    if (level == 2) {\n"
+        "        " + name + "_avx2(" + arguments + ");\n"
+        "        return;\n"
+        "    }\n"
+        "    if (level == 1) {\n"
+        "        " + name + "_sse42(" + arguments + ");\n"
+        "        return;\n"
+        "    }\n"
+        "#endif\n"
+        "    " + name + "_base(" + arguments + ");\n"
+        "}\n";
+    return call + ")";
+}
+
+// The kernel of the loop with vectors of width bytes, the declarator is its
+// name and parameters. Integer arithmetic is done on unsigned vectors so
+// that it wraps.
+std::string CEmitter::VectorKernel(const VectorLoop& loop, const std::string& declarator, size_t width,
+        const std::string& attribute) {
+    std::set<CType::Kind> kinds;
+    for (auto& node : loop.nodes)
+        kinds.insert(node.type);
+    for (auto& array : loop.arrays)
+        kinds.insert(array.type.args[0].kind);
+    for (auto& accumulator : loop.accumulators)
+        kinds.insert(accumulator.type.kind);
+    // All vectors have the same lanes, as many as the widest elements fit
+    size_t lanes = width / 4;
+    for (auto kind : kinds)
+        lanes = std::min(lanes, width / KindSize(kind));
+    auto vector = [](CType::Kind kind) { return std::string("v") + KindName(kind); };
+    auto unsignedVector = [](CType::Kind kind) { return std::string("vu") + KindName(kind); };
+    auto repeat = [&](const std::string& value) {
+        std::string text = "{";
+        for (size_t n = 0; n < lanes; n++)
+            text += (n ? ", " : "") + value;
+        return text + "}";
+    };
+
+    std::string text = "\nstatic " + attribute + "void " + declarator + " {\n";
+    for (auto kind : kinds) {
+        auto size = std::to_string(KindSize(kind) * lanes);
+        text += std::string("    typedef ") + ScalarType(kind) + " " + vector(kind) + " __attribute__((vector_size(" +
+            size + ")));\n";
+        if (IsInteger(kind)) {
+            text += std::string("    typedef u") + ScalarType(kind) + " " + unsignedVector(kind) +
+                " __attribute__((vector_size(" + size + ")));\n";
+        }
+    }
+    for (size_t n = 0; n < loop.scalars.size(); n++) {
+        auto scalar = "s" + std::to_string(n);
+        text += "    " + vector(loop.scalars[n].type.kind) + " " + scalar + "v = " + repeat(scalar) + ";\n";
+    }
+    bool index = false;
+    for (auto& node : loop.nodes)
+        index = index || node.op == VectorNode::Index;
+    if (index) {
+        std::string iota = "{";
+        for (size_t n = 0; n < lanes; n++)
+            iota += (n ? ", " : "") + std::to_string(n);
+        text += "    vint iota = " + iota + "};\n";
+    }
+    for (size_t n = 0; n < loop.stmts.size(); n++) {
+        if (!loop.stmts[n].store) {
+            auto sum = "p" + std::to_string(n);
+            text += "    " + vector(loop.accumulators[loop.stmts[n].target].type.kind) + " " + sum + "a = {0}, " +
+                sum + "b = {0};\n";
+        }
+    }
+
+    // The statements of the lanes from the index plus offset, sums go into
+    // the partial sums of the part
+    auto lanesOf = [&](const std::string& offset, const std::string& part, const std::string& indent) {
+        std::string block = indent + "{\n";
+        std::vector<std::string> values(loop.nodes.size());
+        auto position = "i" + (offset.empty() ? "" : " + " + offset);
+        for (size_t n = 0; n < loop.nodes.size(); n++) {
+            auto& node = loop.nodes[n];
+            auto value = "x" + std::to_string(n);
+            auto type = vector(node.type);
+            auto wrap = [&](const std::string& a, const char* op, const std::string& b) {
+                if (!IsInteger(node.type))
+                    return a + op + b;
+                return "(" + type + ")((" + unsignedVector(node.type) + ")" + a + op + "(" +
+                    unsignedVector(node.type) + ")" + b + ")";
+            };
+            std::string code;
+            switch (node.op) {
+                case VectorNode::Load:
+                    block += indent + "    " + type + " " + value + ";\n";
+                    block += indent + "    memcpy(&" + value + ", a" + std::to_string(node.a) + " + " + position +
+                        ", sizeof(" + value + "));\n";
+                    break;
+                case VectorNode::Scalar:
+                    value = "s" + std::to_string(node.a) + "v";
+                    break;
+                case VectorNode::Index:
+                    code = "iota + (vint)" + repeat("(int32_t)(" + position + ")");
+                    break;
+                case VectorNode::Cast:
+                    code = "__builtin_convertvector(" + values[node.a] + ", " + type + ")";
+                    break;
+                case VectorNode::Neg:
+                    code = IsInteger(node.type) ? "(" + type + ")(-(" + unsignedVector(node.type) + ")" +
+                        values[node.a] + ")" : "-" + values[node.a];
+                    break;
+                case VectorNode::Add:
+                    code = wrap(values[node.a], " + ", values[node.b]);
+                    break;
+                case VectorNode::Sub:
+                    code = wrap(values[node.a], " - ", values[node.b]);
+                    break;
+                case VectorNode::Mul:
+                    code = wrap(values[node.a], " * ", values[node.b]);
+                    break;
+                case VectorNode::Div:
+                    code = values[node.a] + " / " + values[node.b];
+                    break;
+            }
+            if (!code.empty())
+                block += indent + "    " + type + " " + value + " = " + code + ";\n";
+            values[n] = value;
+        }
+        for (size_t n = 0; n < loop.stmts.size(); n++) {
+            auto& stmt = loop.stmts[n];
+            auto& value = values[stmt.value];
+            if (stmt.store) {
+                block += indent + "    memcpy(a" + std::to_string(stmt.target) + " + " + position + ", &" + value +
+                    ", sizeof(" + value + "));\n";
+                continue;
+            }
+            auto kind = loop.accumulators[stmt.target].type.kind;
+            auto sum = "p" + std::to_string(n) + part;
+            if (IsInteger(kind)) {
+                block += indent + "    " + sum + " = (" + vector(kind) + ")((" + unsignedVector(kind) + ")" + sum +
+                    " + (" + unsignedVector(kind) + ")" + value + ");\n";
+            } else {
+                block += indent + "    " + sum + " += " + value + ";\n";
+            }
+        }
+        return block + indent + "}\n";
+    };
+    auto step = std::to_string(lanes);
+    auto step2 = std::to_string(lanes * 2);
+    text += "    int64_t i = start;\n";
+    text += "    for (; i + " + step2 + " <= end; i += " + step2 + ") {\n";
+    text += lanesOf("", "a", "        ");
+    text += lanesOf(step, "b", "        ");
+    text += "    }\n";
+    text += "    if (i + " + step + " <= end) {\n";
+    text += lanesOf("", "a", "        ");
+    text += "        i += " + step + ";\n";
+    text += "    }\n";
+
+    // The partial sums are added together, then the remaining iterations
+    auto add = [&](CType::Kind kind, const std::string& a, const std::string& b, bool subtract) {
+        if (IsInteger(kind))
+            return std::string(subtract ? "zl_sub_" : "zl_add_") + KindName(kind) + "(" + a + ", " + b + ")";
+        return a + (subtract ? " - " : " + ") + b;
+    };
+    for (size_t n = 0; n < loop.stmts.size(); n++) {
+        if (loop.stmts[n].store)
+            continue;
+        auto kind = loop.accumulators[loop.stmts[n].target].type.kind;
+        auto sum = "p" + std::to_string(n);
+        auto total = "t" + std::to_string(n);
+        text += std::string("    ") + ScalarType(kind) + " " + total + " = 0;\n";
+        text += "    for (int lane = 0; lane < " + step + "; lane++)\n";
+        text += "        " + total + " = " + add(kind, add(kind, total, sum + "a[lane]", false), sum + "b[lane]", false) +
+            ";\n";
+    }
+    text += "    for (; i < end; i++) {\n";
+    std::vector<std::string> values(loop.nodes.size());
+    for (size_t n = 0; n < loop.nodes.size(); n++) {
+        auto& node = loop.nodes[n];
+        auto value = "y" + std::to_string(n);
+        std::string code;
+        switch (node.op) {
+            case VectorNode::Load:
+                code = "a" + std::to_string(node.a) + "[i]";
+                break;
+            case VectorNode::Scalar:
+                value = "s" + std::to_string(node.a);
+                break;
+            case VectorNode::Index:
+                code = "(int32_t)i";
+                break;
+            case VectorNode::Cast:
+                code = std::string("(") + ScalarType(node.type) + ")" + values[node.a];
+                break;
+            case VectorNode::Neg:
+                code = IsInteger(node.type) ? std::string("zl_neg_") + KindName(node.type) + "(" + values[node.a] + ")" :
+                    "-" + values[node.a];
+                break;
+            case VectorNode::Add:
+                code = add(node.type, values[node.a], values[node.b], false);
+                break;
+            case VectorNode::Sub:
+                code = add(node.type, values[node.a], values[node.b], true);
+                break;
+            case VectorNode::Mul:
+                code = IsInteger(node.type) ? std::string("zl_mul_") + KindName(node.type) + "(" + values[node.a] +
+                    ", " + values[node.b] + ")" : values[node.a] + " * " + values[node.b];
+                break;
+            case VectorNode::Div:
+                code = values[node.a] + " / " + values[node.b];
+                break;
+        }
+        if (!code.empty())
+            text += std::string("        ") + ScalarType(node.type) + " " + value + " = " + code + ";\n";
+        values[n] = value;
+    }
+    for (size_t n = 0; n < loop.stmts.size(); n++) {
+        auto& stmt = loop.stmts[n];
+        if (stmt.store) {
+            text += "        a" + std::to_string(stmt.target) + "[i] = " + values[stmt.value] + ";\n";
+        } else {
+            auto total = "t" + std::to_string(n);
+            text += "        " + total + " = " + add(loop.accumulators[stmt.target].type.kind, total,
+                values[stmt.value], false) + ";\n";
+        }
+    }
+    text += "    }\n";
+    for (size_t n = 0; n < loop.stmts.size(); n++) {
+        auto& stmt = loop.stmts[n];
+        if (stmt.store)
+            continue;
+        auto sum = "*r" + std::to_string(stmt.target);
+        text += "    " + sum + " = " + add(loop.accumulators[stmt.target].type.kind, sum, "t" + std::to_string(n),
+            stmt.subtract) + ";\n";
+    }
+    return text + "}\n";
+}
+
+bool CEmitter::ReportLoop(const VectorLoop& loop, int line) {
+    if (!loop.reason.empty()) {
+        loopReports_.push_back({path_, line, false, loop.reason});
+        return false;
+    }
+    std::vector<std::string> stmts;
+    for (auto& stmt : loop.stmts) {
+        auto what = stmt.store ? "store into " + loop.arrayNames[stmt.target] :
+            (stmt.subtract ? "difference into " : "sum into ") + loop.accumulatorNames[stmt.target];
+        if (std::find(stmts.begin(), stmts.end(), what) == stmts.end())
+            stmts.push_back(what);
+    }
+    loopReports_.push_back({path_, line, true, Join(stmts)});
+    return true;
+}
+
+} // namespace zl
@@ -0,0 +1,539 @@
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "ast_hash.h"
+#include "build_scheduler.h"
+#include "bytecode_compiler.h"
+#include "c_emitter.h"
+#include "compiler.h"
+#include "ir_builder.h"
+#include "ir_passes.h"
+#include "jit.h"
+#include "resolver.h"
+#include "runtime/interpreter.h"
+#include "thread_pool.h"
+#include "type_context.h"
+#include "xml_arena.h"
+#include "xml_builder.h"
+
+namespace zl {
+
+bool LoadSourceFile(const std::string& path, std::string& content) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file)
+        return false;
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    content = stream.str();
+    return true;
+}
+
+Compiler::Compiler(const CompileOptions& options): options_(options) {
+    if (!options_.cacheDir.empty())
+        cache_.reset(new FrontEndCache(options_.cacheDir, options_.cacheSizeLimit));
+}
+
+int Compiler::Run() {
+    int status = 0;
+
+    if (!options_.diffAgainst.empty()) {
+        if (options_.inputFiles.size() != 1) {
+            std::cerr << "zlc: --diff-against needs exactly one input file" << std::endl;
+            return 2;
+        }
+        return DiffFile(options_.diffAgainst, options_.inputFiles[0]);
+    }
+    if (options_.resolve)
+        return ResolveFiles();
+    if (!options_.checkAst.empty())
+        return CheckAst();
+    if (!options_.dumpAst.empty())
+        return DumpFiles();
+    if (options_.emitC || !options_.emitExe.empty() || options_.escapeStats || options_.vectorReport)
+        return EmitC();
+    if (options_.jit)
+        return RunJit();
+    if (options_.dumpIr || options_.irStats || options_.verifyIr) {
+        IrModule module;
+        status = BuildIr(module);
+        // The IR is reported first, then the bytecode is run as asked
+        if (status || !(options_.run || options_.dumpBytecode))
+            return status;
+    }
+    if (options_.run || options_.dumpBytecode)
+        return RunProgram();
+
+    for (auto& path : options_.inputFiles) {
+        FrontEndResult result;
+        if (!CompileFile(path, result)) {
+            std::cerr << path << ": can not read file" << std::endl;
+            status = 1;
+            continue;
+        }
+        ReportDiagnostics(path, result);
+        if (!result.diagnostics.empty())
+            status = 1;
+    }
+
+    if (cache_) {
+        cache_->Trim();
+        if (options_.cacheStats) {
+            std::cerr << "cache " << cache_->Directory() << ": "
+                << cache_->Hits() << " hits, " << cache_->Misses() << " misses, "
+                << cache_->Stores() << " stores, " << cache_->Evictions() << " evictions"
+                << std::endl;
+        }
+    }
+    return status;
+}
+
+bool Compiler::CompileFile(const std::string& path, FrontEndResult& result) {
+    std::string source;
+    if (!LoadSourceFile(path, source))
+        return false;
+
+    if (!cache_) {
+        result = RunFrontEnd(source.data(), source.size());
+        return true;
+    }
+    Hash128 key = FrontEndCache::KeyOf(source.data(), source.size());
+    if (cache_->Lookup(key, result))
+        return true;
+    result = RunFrontEnd(source.data(), source.size());
+    cache_->Store(key, result);
+    return true;
+}
+
+void Compiler::ReportDiagnostics(const std::string& path, const FrontEndResult& result) {
+    for (auto& diagnostic : result.diagnostics) {
+        std::cerr << path << ":" << diagnostic.location.GetLineno() << ": error: "
+            << diagnostic.msg << std::endl;
+    }
+}
+
+int Compiler::DiffFile(const std::string& oldPath, const std::string& newPath) {
+    std::string oldSource, newSource;
+    if (!LoadSourceFile(oldPath, oldSource) || !LoadSourceFile(newPath, newSource)) {
+        std::cerr << "zlc: can not read " << oldPath << " or " << newPath << std::endl;
+        return 1;
+    }
+    std::vector<ast::Node*> oldDecls, newDecls;
+    auto oldResult = RunFrontEnd(oldSource.data(), oldSource.size(), &oldDecls);
+    auto newResult = RunFrontEnd(newSource.data(), newSource.size(), &newDecls);
+    ReportDiagnostics(oldPath, oldResult);
+    ReportDiagnostics(newPath, newResult);
+
+    ThreadPool pool(options_.jobs);
+    HashTree(oldDecls, &pool);
+    HashTree(newDecls, &pool);
+    for (auto& change : DiffTrees(oldDecls, newDecls))
+        std::cout << AstChangeKindName(change.kind) << " " << change.name << std::endl;
+
+    for (auto decl : oldDecls)
+        delete decl;
+    for (auto decl : newDecls)
+        delete decl;
+    return 0;
+}
+
+int Compiler::ResolveFiles() {
+    int status = 0;
+    ThreadPool pool(options_.jobs);
+    std::vector<SourceFile> files(options_.inputFiles.size());
+    std::vector<std::string> sources(files.size());
+    std::vector<FileHeader> headers(files.size());
+    // Workers set the flags of different files concurrently, which is not
+    // safe on the packed bits of vector<bool>
+    std::vector<uint8_t> loaded(files.size());
+
+    // Only the package and import declarations are scanned before the build
+    // graph is known
+    pool.ParallelFor(files.size(), [&](size_t i) {
+        files[i].path = options_.inputFiles[i];
+        loaded[i] = LoadSourceFile(files[i].path, sources[i]);
+        if (loaded[i])
+            headers[i] = ScanHeader(sources[i].data(), sources[i].size());
+    });
+    BuildGraph graph;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!loaded[i]) {
+            std::cerr << files[i].path << ": can not read file" << std::endl;
+            status = 1;
+            continue;
+        }
+        graph.AddFile(i, headers[i], sources[i].size());
+    }
+
+    Resolver resolver(pool);
+    BuildScheduler scheduler(graph, pool);
+    bool acyclic = graph.Build(files);
+    if (acyclic) {
+        scheduler.Run([&](const PackageNode& package) {
+            pool.ParallelFor(package.files.size(), [&](size_t i) {
+                auto& file = files[package.files[i]];
+                auto& source = sources[package.files[i]];
+                file.diagnostics = RunFrontEnd(source.data(), source.size(), &file.decls).diagnostics;
+            });
+            std::vector<SourceFile*> packageFiles;
+            for (auto index : package.files) {
+                auto& file = files[index];
+                if (PackageNameOf(file.decls) != package.name) {
+                    file.diagnostics.push_back({Location(1),
+                            "package declaration must precede other declarations"});
+                    continue;
+                }
+                packageFiles.push_back(&file);
+            }
+            resolver.Resolve(packageFiles);
+            // Named types are interned by their declarations, so types are
+            // interned after resolving
+            for (auto file : packageFiles)
+                types_.InternAll(file->decls);
+        });
+    }
+
+    for (auto& file : files) {
+        FrontEndResult result;
+        result.diagnostics = file.diagnostics;
+        ReportDiagnostics(file.path, result);
+        if (!file.diagnostics.empty())
+            status = 1;
+    }
+    if (options_.resolveStats) {
+        std::cerr << "resolve: " << resolver.TaskCount() << " tasks on " << pool.Size()
+            << " threads, " << resolver.ResolvedCount() << " resolved ("
+            << resolver.ImportResolvedCount() << " from imports), "
+            << resolver.UnresolvedCount() << " undeclared" << std::endl;
+        std::cerr << "types: " << types_.InternedNodes() << " type nodes, "
+            << types_.Size() << " canonical types" << std::endl;
+    }
+    if (acyclic && options_.scheduleReport)
+        scheduler.Report(std::cerr);
+    return status;
+}
+
+int Compiler::ParseFiles(ThreadPool& pool, std::vector<SourceFile>& files) {
+    int status = 0;
+    // One byte per file, workers must not share the words of vector<bool>
+    std::vector<uint8_t> loaded(options_.inputFiles.size());
+    files.resize(options_.inputFiles.size());
+
+    pool.ParallelFor(files.size(), [&](size_t i) {
+        std::string source;
+        files[i].path = options_.inputFiles[i];
+        loaded[i] = LoadSourceFile(files[i].path, source);
+        if (!loaded[i])
+            return;
+        files[i].diagnostics = RunFrontEnd(source.data(), source.size(), &files[i].decls).diagnostics;
+        // Without resolving, named types are the same if their names are
+        types_.InternAll(files[i].decls);
+    });
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!loaded[i]) {
+            std::cerr << files[i].path << ": can not read file" << std::endl;
+            status = 2;
+            continue;
+        }
+        FrontEndResult result;
+        result.diagnostics = files[i].diagnostics;
+        ReportDiagnostics(files[i].path, result);
+        if (!result.diagnostics.empty())
+            status = std::max(status, 1);
+    }
+    return status;
+}
+
+int Compiler::DumpFiles() {
+    DumpFormat format;
+    if (!ParseDumpFormat(options_.dumpAst, format)) {
+        std::cerr << "zlc: unknown dump format '" << options_.dumpAst << "'" << std::endl;
+        return 2;
+    }
+    if (options_.dumpDom && format != DumpFormat::Xml) {
+        std::cerr << "zlc: --dump-dom needs the xml format" << std::endl;
+        return 2;
+    }
+    ThreadPool pool(options_.jobs);
+    std::vector<SourceFile> files;
+    int status = ParseFiles(pool, files) ? 1 : 0;
+
+    std::unique_ptr<AstSerializer> serializer;
+    XmlFileWriter stdoutWriter(STDOUT_FILENO);
+    try {
+        if (options_.dumpOutput.empty())
+            serializer = NewAstSerializer(format, stdoutWriter);
+        else
+            serializer = NewAstSerializer(format, options_.dumpOutput);
+    } catch (std::invalid_argument& error) {
+        std::cerr << "zlc: " << error.what() << std::endl;
+        return 1;
+    }
+    if (options_.dumpDom) {
+        XmlArena arena;
+        XmlArenaScope scope(arena);
+        static_cast<XmlBuilder*>(serializer.get())->BuildDom(files);
+    } else {
+        serializer->Serialize(files, pool);
+    }
+    if (!serializer->Good() || stdoutWriter.Failed()) {
+        std::cerr << "zlc: can not write the syntax tree dump" << std::endl;
+        return 1;
+    }
+    return status;
+}
+
+int Compiler::CheckAst() {
+    ThreadPool pool(options_.jobs);
+    std::vector<SourceFile> files;
+    // Diagnostics are a part of what the golden file checks, only unreadable
+    // files fail the check
+    if (ParseFiles(pool, files) > 1)
+        return 1;
+
+    // Both documents are allocated from the arena and dropped at once
+    XmlArena arena;
+    XmlArenaScope scope(arena);
+    pugi::xml_document golden, actual;
+    auto result = golden.load_file(options_.checkAst.c_str());
+    if (!result) {
+        std::cerr << options_.checkAst << ": can not load golden ast, " << result.description()
+            << " at offset " << result.offset << std::endl;
+        return 1;
+    }
+    // The builder only builds the document, nothing is written
+    XmlFileWriter stdoutWriter(STDOUT_FILENO);
+    XmlBuilder builder(stdoutWriter);
+    builder.BuildDocument(files, actual);
+    std::string difference;
+    if (!CompareXml(golden, actual, difference)) {
+        std::cerr << options_.checkAst << ": ast differs at " << difference << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int Compiler::RunProgram() {
+    ThreadPool pool(options_.jobs);
+    std::vector<SourceFile> files;
+    if (ParseFiles(pool, files))
+        return 1;
+
+    Program program;
+    BytecodeCompiler compiler(program);
+    if (!compiler.Compile(files)) {
+        for (auto& error : compiler.Diagnostics()) {
+            std::cerr << error.path << ":" << error.diagnostic.location.GetLineno() << ": error: "
+                << error.diagnostic.msg << std::endl;
+        }
+        return 1;
+    }
+    if (options_.dumpBytecode)
+        std::cout << Disassemble(program);
+    if (!options_.run)
+        return 0;
+
+    if (options_.nurserySize) {
+        GcOptions gcOptions = program.heap.Options();
+        gcOptions.nurserySize = options_.nurserySize;
+        program.heap.SetOptions(gcOptions);
+    }
+    Interpreter interpreter(program);
+    Value result;
+    bool ok = interpreter.RunMain(result);
+    std::cout.flush();
+    if (options_.gcStats) {
+        auto& stats = program.heap.Stats();
+        std::cerr << "gc: " << stats.allocations << " objects, " << stats.bytesAllocated << " bytes allocated, "
+            << stats.bytesPromoted << " promoted, " << stats.bytesFreed << " freed, " << stats.oldBytes
+            << " old" << std::endl;
+        std::cerr << "gc: " << stats.minorCollections << " minor " << std::fixed << std::setprecision(3)
+            << stats.minorSeconds * 1000 << " ms, " << stats.majorCollections << " major "
+            << stats.majorSeconds * 1000 << " ms, max pause " << stats.maxPauseSeconds * 1000 << " ms"
+            << std::endl;
+        std::cerr.unsetf(std::ios::floatfield);
+    }
+    if (options_.dispatchStats) {
+        auto& stats = interpreter.Stats();
+        uint64_t calls = stats.monomorphicHits + stats.polymorphicHits + stats.megamorphicHits +
+            stats.itableLookups + stats.nameLookups;
+        auto percent = [calls](uint64_t count) {
+            return calls ? std::to_string(count * 100 / calls) + "%" : std::string("0%");
+        };
+        std::cerr << "dispatch: " << calls << " method calls, monomorphic hits " << percent(stats.monomorphicHits)
+            << ", polymorphic hits " << percent(stats.polymorphicHits) << ", megamorphic hits "
+            << percent(stats.megamorphicHits) << std::endl;
+        std::cerr << "dispatch: " << stats.itableLookups << " itable and " << stats.nameLookups
+            << " name lookups, " << stats.polymorphicSites << " polymorphic and " << stats.megamorphicSites
+            << " megamorphic sites" << std::endl;
+    }
+    if (!ok) {
+        std::cerr << "zlc: runtime error: " << interpreter.Error() << std::endl;
+        return 1;
+    }
+    return result.IsInt() ? result.AsInt() : 0;
+}
+
+int Compiler::BuildIr(IrModule& module) {
+    ThreadPool pool(options_.jobs);
+    std::vector<SourceFile> files;
+    if (ParseFiles(pool, files))
+        return 1;
+
+    auto start = std::chrono::steady_clock::now();
+    IrBuilder builder(module);
+    if (!builder.Build(files)) {
+        for (auto& error : builder.Diagnostics()) {
+            std::cerr << error.path << ":" << error.diagnostic.location.GetLineno() << ": error: "
+                << error.diagnostic.msg << std::endl;
+        }
+        return 1;
+    }
+    double lowering = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    IrPassManager passes;
+    passes.AddDefaultPasses();
+    passes.SetVerify(options_.verifyIr);
+    std::vector<std::string> errors;
+    bool ok = passes.Run(module, errors);
+    for (auto& error : errors)
+        std::cerr << "zlc: " << error << std::endl;
+    if (options_.irStats) {
+        size_t instructions = 0;
+        for (auto& function : module.functions)
+            instructions += function->InstructionCount();
+        std::cerr << "ir: " << module.functions.size() << " functions, " << instructions
+            << " instructions, lowering " << std::fixed << std::setprecision(3) << lowering * 1000
+            << " ms" << std::endl;
+        std::cerr.unsetf(std::ios::floatfield);
+        passes.Report(std::cerr);
+    }
+    if (options_.dumpIr)
+        std::cout << module.ToString();
+    return ok ? 0 : 1;
+}
+
+// Return true if a function of the module takes, computes or returns a value
+// of type
+static bool UsesType(const IrModule& module, IrType type) {
+    for (auto& function : module.functions) {
+        for (auto result : function->ResultTypes()) {
+            if (result == type)
+                return true;
+        }
+        for (auto argument : function->Arguments()) {
+            if (argument->type == type)
+                return true;
+        }
+        for (auto block : function->Blocks()) {
+            for (auto instruction : block->instructions) {
+                if (instruction->type == type)
+                    return true;
+                for (auto operand : instruction->operands) {
+                    if (operand->type == type)
+                        return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+int Compiler::RunJit() {
+    IrModule module;
+    int status = BuildIr(module);
+    if (status)
+        return status;
+
+    Jit jit;
+    bool compiled = jit.Compile(module);
+    if (options_.irStats) {
+        auto& stats = jit.Stats();
+        std::cerr << "jit: " << stats.compiled << " functions, " << jit.Skipped().size() << " skipped, "
+            << stats.codeBytes << " bytes, " << stats.spills << " spills, " << std::fixed
+            << std::setprecision(3) << stats.seconds * 1000 << " ms" << std::endl;
+        std::cerr.unsetf(std::ios::floatfield);
+        for (auto& skipped : jit.Skipped())
+            std::cerr << "jit: skipped " << skipped << std::endl;
+    }
+    // Programs the JIT can not compile are interpreted, but not the ones
+    // using long or float: the integers of the interpreter are 32 bits and
+    // its floating point numbers 64 bits
+    if (!compiled || !jit.Has("main") || !jit.ParameterTypes("main").empty()) {
+        IrType refused = UsesType(module, IrType::Long) ? IrType::Long : IrType::Float;
+        if (UsesType(module, refused)) {
+            std::cerr << "zlc: main can not be compiled to machine code and the program uses "
+                << IrTypeName(refused) << ", which the interpreter does not support" << std::endl;
+            if (!compiled)
+                std::cerr << "zlc: " << jit.Error() << std::endl;
+            for (auto& skipped : jit.Skipped())
+                std::cerr << "zlc: skipped " << skipped << std::endl;
+            return 1;
+        }
+        if (!compiled)
+            std::cerr << "zlc: " << jit.Error() << ", main is interpreted" << std::endl;
+        options_.run = true;
+        return RunProgram();
+    }
+    JitValue result;
+    if (!jit.Call("main", {}, result)) {
+        std::cout.flush();
+        std::cerr << "zlc: runtime error: " << jit.Error() << std::endl;
+        return 1;
+    }
+    return result.type == IrType::Int ? static_cast<int>(result.intValue) : 0;
+}
+
+int Compiler::EmitC() {
+    ThreadPool pool(options_.jobs);
+    std::vector<SourceFile> files;
+    if (ParseFiles(pool, files))
+        return 1;
+
+    CEmitter emitter(types_);
+    emitter.SetReassociate(options_.fpReassociate);
+    std::string source;
+    if (!emitter.Emit(files, source)) {
+        for (auto& error : emitter.Diagnostics()) {
+            std::cerr << error.path << ":" << error.diagnostic.location.GetLineno() << ": error: "
+                << error.diagnostic.msg << std::endl;
+        }
+        return 1;
+    }
+    if (options_.escapeStats) {
+        auto& escape = emitter.Escape();
+        std::cerr << "escape: " << escape.LocalSites() << " of " << escape.Sites()
+            << " new expressions allocated in the frame" << std::endl;
+    }
+    if (options_.vectorReport) {
+        for (auto& report : emitter.LoopReports()) {
+            std::cerr << report.path << ":" << report.line << ": loop "
+                << (report.vectorized ? "vectorized: " : "not vectorized: ") << report.detail << std::endl;
+        }
+    }
+    if (!options_.emitExe.empty()) {
+        std::string error;
+        if (!CompileC(source, options_.emitExe, error)) {
+            std::cerr << "zlc: " << error << std::endl;
+            return 1;
+        }
+    }
+    if (!options_.emitC)
+        return 0;
+    if (options_.dumpOutput.empty()) {
+        std::cout << source;
+        return 0;
+    }
+    std::ofstream output(options_.dumpOutput, std::ios::out | std::ios::binary);
+    if (!output || !output.write(source.data(), source.size())) {
+        std::cerr << "zlc: can not write " << options_.dumpOutput << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace zl
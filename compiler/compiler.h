@@ -1 +1,126 @@
 #pragma once
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "frontend.h"
+#include "frontend_cache.h"
+#include "type_context.h"
+
+namespace zl {
+
+class ThreadPool;
+struct IrModule;
+
+// CompileOptions are the options given on zlc command line
+struct CompileOptions {
+    std::vector<std::string> inputFiles;
+    // Directory of front end cache, empty if the cache is disabled
+    std::string cacheDir;
+    uint64_t cacheSizeLimit = 256ull << 20;
+    bool cacheStats = false;
+    // Old version of the single input file, the changed declarations are
+    // printed instead of compiling
+    std::string diffAgainst;
+    // Number of worker threads, zero for one per hardware thread
+    size_t jobs = 0;
+    // Resolve names of all input files together, the syntax trees are
+    // needed so the front end cache is not used
+    bool resolve = false;
+    bool resolveStats = false;
+    // Print the package schedule, the critical path and utilization
+    bool scheduleReport = false;
+    // Format of the syntax tree dump, xml, jsonl or bin, empty if the tree is
+    // not dumped. The dump is written to dumpOutput, or the standard output
+    // if it is empty
+    std::string dumpAst;
+    std::string dumpOutput;
+    // Build the xml document in memory before writing it
+    bool dumpDom = false;
+    // Golden xml file the syntax trees are compared with, empty if there is
+    // no check
+    std::string checkAst;
+    // Compile the files to bytecode and run main
+    bool run = false;
+    // Print the collections and pauses of the heap after running main
+    bool gcStats = false;
+    // Print how the methods of the calls were found after running main
+    bool dispatchStats = false;
+    // Bytes of the nursery of the heap, 0 for the default
+    uint64_t nurserySize = 0;
+    // Print the bytecode listing
+    bool dumpBytecode = false;
+    // Print the optimized SSA IR of all functions
+    bool dumpIr = false;
+    // Print the time of lowering and of each optimization pass
+    bool irStats = false;
+    // Verify the IR after lowering and after each pass
+    bool verifyIr = false;
+    // Run main compiled to machine code, programs which can not be compiled
+    // are interpreted unless they use long
+    bool jit = false;
+    // Translate the files to C, written to dumpOutput or the standard output
+    bool emitC = false;
+    // Executable built from the C translation with the C compiler, empty if
+    // none is built
+    std::string emitExe;
+    // Print how many instances the C translation allocates in the frame
+    bool escapeStats = false;
+    // Print which loops of the C translation run SIMD kernels, and why the
+    // others do not
+    bool vectorReport = false;
+    // Let the C translation add floating point sums of loops in another
+    // order so that they can be vectorized
+    bool fpReassociate = false;
+};
+
+// Compiler drive all compilation phases for input files
+class Compiler {
+public:
+    explicit Compiler(const CompileOptions& options);
+    ~Compiler() {}
+
+    // Compile all input files, return the process exit status
+    int Run();
+
+private:
+    Compiler() = delete;
+    // Run front end on one file, the cached result is used if possible
+    bool CompileFile(const std::string& path, FrontEndResult& result);
+    void ReportDiagnostics(const std::string& path, const FrontEndResult& result);
+    // Print the declarations changed since the old version of the file
+    int DiffFile(const std::string& oldPath, const std::string& newPath);
+    // Compile the packages of input files in import order, each package is
+    // parsed and resolved
+    int ResolveFiles();
+    // Parse the input files and report their diagnostics, return 2 if a
+    // file can not be read, 1 if there are diagnostics
+    int ParseFiles(ThreadPool& pool, std::vector<SourceFile>& files);
+    // Parse the input files and dump their syntax trees
+    int DumpFiles();
+    // Compare the syntax trees of the input files with the golden file
+    int CheckAst();
+    // Compile the input files to bytecode, print or run it. The exit status
+    // is the int returned by main.
+    int RunProgram();
+    // Lower the input files to SSA IR and optimize it
+    int BuildIr(IrModule& module);
+    // Compile the optimized IR to machine code and run main. The exit status
+    // is the int returned by main.
+    int RunJit();
+    // Translate the input files to C, print it or compile it to an
+    // executable
+    int EmitC();
+
+private:
+    CompileOptions options_;
+    std::unique_ptr<FrontEndCache> cache_;
+    // Types of all input files, kept for the whole compilation so that the
+    // backends compare types by id
+    TypeContext types_;
+};
+
+// Load the whole file into content, return false if the file can not be read
+bool LoadSourceFile(const std::string& path, std::string& content);
+
+} // namespace zl
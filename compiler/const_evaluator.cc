@@ -0,0 +1,507 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "runtime/interpreter.h"
+#include "const_evaluator.h"
+
+namespace zl {
+
+namespace {
+
+bool IsIntegerType(const std::string& name) {
+    return name == "int" || name == "long" || name == "short" || name == "byte" || name == "char";
+}
+
+OpCode ArithmeticOpCode(int op) {
+    switch (op) {
+        case Token::ADD: return OpCode::Add;
+        case Token::SUB: return OpCode::Sub;
+        case Token::MUL: return OpCode::Mul;
+        case Token::QUO: return OpCode::Div;
+        case Token::REM: return OpCode::Mod;
+        case Token::AND: return OpCode::BitAnd;
+        case Token::OR: return OpCode::BitOr;
+        case Token::XOR: return OpCode::BitXor;
+        case Token::SHL: return OpCode::Shl;
+        case Token::SHR: return OpCode::Shr;
+        default: return OpCode::Move;
+    }
+}
+
+// Return the name of the values of the type as TypeNameOf gives it, empty
+// if the type does not constrain them
+std::string TypeNameOfType(ast::Type* type) {
+    if (!type)
+        return "";
+    switch (type->Kind()) {
+        case ast::NodeKind::PrimitiveType: {
+            auto& name = static_cast<ast::PrimitiveType*>(type)->name_;
+            if (IsIntegerType(name))
+                return "int";
+            if (name == "float" || name == "double")
+                return "float";
+            if (name == "bool" || name == "string")
+                return name;
+            return "";
+        }
+        case ast::NodeKind::ArrayType:
+            return "array";
+        case ast::NodeKind::MapType:
+            return "map";
+        case ast::NodeKind::NonPrimitiveType: {
+            auto name = static_cast<ast::NonPrimitiveType*>(type)->name_;
+            return name ? name->name_ : "";
+        }
+        default:
+            return "";
+    }
+}
+
+std::string NameOf(ast::Expr* expr) {
+    if (expr->Kind() == ast::NodeKind::Identifier)
+        return static_cast<ast::Identifier*>(expr)->name_;
+    auto selector = static_cast<ast::SelectorExpr*>(expr);
+    if (selector->expr_ && selector->expr_->Kind() == ast::NodeKind::Identifier && selector->selector_)
+        return static_cast<ast::Identifier*>(selector->expr_)->name_ + "." + selector->selector_->name_;
+    return "expression";
+}
+
+} // namespace
+
+void ConstEvaluator::DeclareFile(const SourceFile& file) {
+    auto package = PackageNameOf(file.decls);
+    packages_.insert(package);
+    auto declare = [&](ast::ConstDecl* decl, bool exported) {
+        if (!decl->name_)
+            return;
+        auto& name = decl->name_->name_;
+        if (!qualified_.emplace(package + "." + name, constants_.size()).second) {
+            errors_.push_back({file.path, {decl->Pos(), "constant " + name + " is redeclared"}});
+            return;
+        }
+        if (exported)
+            exported_[name].push_back(constants_.size());
+        constants_.push_back({file.path, package, decl, exported, State::Unevaluated, Value::Nil()});
+    };
+    for (auto node : file.decls) {
+        if (node->Kind() == ast::NodeKind::ConstDecl) {
+            auto decl = static_cast<ast::ConstDecl*>(node);
+            declare(decl, decl->IsPublic());
+        } else if (node->Kind() == ast::NodeKind::ConstBlockDecl) {
+            // Constants of a block share the publicity of the block
+            auto block = static_cast<ast::ConstBlockDecl*>(node);
+            for (auto decl : block->fields_)
+                declare(decl, block->IsPublic());
+        }
+    }
+}
+
+void ConstEvaluator::EvaluateAll() {
+    for (auto& constant : constants_)
+        Evaluate(constant);
+}
+
+bool ConstEvaluator::Lookup(const std::string& package, ast::Expr* expr, Value& value, std::string& error) {
+    Context context{&package, nullptr, nullptr, "", false};
+    auto constant = Find(context, expr);
+    if (!constant) {
+        error = context.error;
+        return false;
+    }
+    value = Evaluate(*constant) ? constant->value : Value::Nil();
+    return true;
+}
+
+bool ConstEvaluator::Fold(const std::string& package, ast::Expr* expr, const Scope& scope, Value& value) {
+    // Literals of arrays and maps are left to run time, each evaluation
+    // makes a new one
+    Context context{&package, &scope, nullptr, "", false};
+    return Eval(context, expr, value);
+}
+
+bool ConstEvaluator::EvaluateLocal(const std::string& package, ast::ConstDecl* decl, const Scope& scope,
+        Value& value, std::string& error) {
+    Context context{&package, &scope, nullptr, "", true};
+    if (Initialize(context, decl, value))
+        return true;
+    if (!context.error.empty() && decl->name_)
+        error = "constant " + decl->name_->name_ + ": " + context.error;
+    return false;
+}
+
+ConstEvaluator::Constant* ConstEvaluator::Find(Context& context, ast::Expr* expr) {
+    if (!expr)
+        return nullptr;
+    if (expr->Kind() == ast::NodeKind::Identifier)
+        return FindName(context, static_cast<ast::Identifier*>(expr)->name_);
+    if (expr->Kind() != ast::NodeKind::SelectorExpr)
+        return nullptr;
+    auto selector = static_cast<ast::SelectorExpr*>(expr);
+    if (!selector->selector_ || !selector->expr_ || selector->expr_->Kind() != ast::NodeKind::Identifier)
+        return nullptr;
+    auto& package = static_cast<ast::Identifier*>(selector->expr_)->name_;
+    Value unused;
+    if (context.scope && (*context.scope)(package, unused) != Binding::None)
+        return nullptr;
+    return FindQualified(context, package, selector->selector_->name_);
+}
+
+ConstEvaluator::Constant* ConstEvaluator::FindName(Context& context, const std::string& name) {
+    auto iter = qualified_.find(*context.package + "." + name);
+    if (iter != qualified_.end())
+        return &constants_[iter->second];
+    auto exported = exported_.find(name);
+    if (exported == exported_.end())
+        return nullptr;
+    // The name must be exported by only one other package
+    Constant* found = nullptr;
+    for (auto index : exported->second) {
+        auto& constant = constants_[index];
+        if (found) {
+            context.error = "ambiguous constant " + name + ", it is exported by " + found->package +
+                " and " + constant.package;
+            return nullptr;
+        }
+        found = &constant;
+    }
+    return found;
+}
+
+ConstEvaluator::Constant* ConstEvaluator::FindQualified(Context& context, const std::string& package,
+        const std::string& name) {
+    // The package is named by its full name, such as system.io, or by the
+    // last part of it
+    auto iter = qualified_.find(package + "." + name);
+    for (auto candidate = packages_.begin(); iter == qualified_.end() && candidate != packages_.end(); ++candidate) {
+        if (candidate->size() > package.size() + 1 &&
+                candidate->compare(candidate->size() - package.size(), package.size(), package) == 0 &&
+                (*candidate)[candidate->size() - package.size() - 1] == '.')
+            iter = qualified_.find(*candidate + "." + name);
+    }
+    if (iter == qualified_.end())
+        return nullptr;
+    auto& constant = constants_[iter->second];
+    if (!constant.exported && constant.package != *context.package) {
+        context.error = name + " is not exported by " + constant.package;
+        return nullptr;
+    }
+    return &constant;
+}
+
+bool ConstEvaluator::Evaluate(Constant& constant) {
+    if (constant.state == State::Done)
+        return true;
+    if (constant.state == State::Failed)
+        return false;
+    auto& name = constant.decl->name_->name_;
+    if (constant.state == State::Evaluating) {
+        std::string cycle;
+        auto first = std::find(evaluating_.begin(), evaluating_.end(), &constant);
+        for (auto iter = first; iter != evaluating_.end(); ++iter)
+            cycle += (*iter)->decl->name_->name_ + " -> ";
+        Report(constant, constant.decl, "constant cycle " + cycle + name);
+        // The constants of the cycle fail without other errors
+        constant.state = State::Failed;
+        return false;
+    }
+    constant.state = State::Evaluating;
+    evaluating_.push_back(&constant);
+    Context context{&constant.package, nullptr, nullptr, "", true};
+    Value value;
+    bool ok = Initialize(context, constant.decl, value);
+    evaluating_.pop_back();
+    if (constant.state == State::Failed)
+        return false;
+    if (!ok) {
+        if (!context.error.empty())
+            Report(constant, context.node ? context.node : constant.decl, "constant " + name + ": " + context.error);
+        constant.state = State::Failed;
+        return false;
+    }
+    constant.value = value;
+    constant.state = State::Done;
+    return true;
+}
+
+bool ConstEvaluator::Initialize(Context& context, ast::ConstDecl* decl, Value& value) {
+    auto type = TypeNameOfType(decl->type_);
+    if (!decl->varInitializer_ || !decl->varInitializer_->expr_) {
+        value = ZeroValue(type);
+        return true;
+    }
+    auto expr = decl->varInitializer_->expr_;
+    if (!Eval(context, expr, value))
+        return false;
+    if (type.empty())
+        return true;
+    if (type == "float" && value.IsInt())
+        value = Value::Double(value.AsInt());
+    bool primitive = type == "int" || type == "float" || type == "bool" || type == "string";
+    if (TypeNameOf(value) != type && (primitive || !value.IsNil()))
+        return Fail(context, expr, "constant of type " + type + " is given a value of type " + TypeNameOf(value));
+    return true;
+}
+
+bool ConstEvaluator::Eval(Context& context, ast::Expr* expr, Value& value) {
+    if (!expr)
+        return Fail(context, expr, "missing expression");
+    switch (expr->Kind()) {
+        case ast::NodeKind::LiteralExpr:
+            return EvalLiteral(context, static_cast<ast::LiteralExpr*>(expr), value);
+        case ast::NodeKind::Identifier:
+        case ast::NodeKind::SelectorExpr: {
+            if (expr->Kind() == ast::NodeKind::Identifier && context.scope) {
+                switch ((*context.scope)(static_cast<ast::Identifier*>(expr)->name_, value)) {
+                    case Binding::Constant:
+                        return true;
+                    case Binding::Variable:
+                        return Fail(context, expr, NameOf(expr) + " is not a constant");
+                    case Binding::None:
+                        break;
+                }
+            }
+            auto constant = Find(context, expr);
+            if (!constant)
+                return Fail(context, expr, context.error.empty() ? NameOf(expr) + " is not a constant" : context.error);
+            if (!Evaluate(*constant)) {
+                // Its own failure is reported with it
+                context.node = expr;
+                context.error.clear();
+                return false;
+            }
+            value = constant->value;
+            return true;
+        }
+        case ast::NodeKind::UnaryExpr:
+            return EvalUnary(context, static_cast<ast::UnaryExpr*>(expr), value);
+        case ast::NodeKind::BinaryExpr:
+            return EvalBinary(context, static_cast<ast::BinaryExpr*>(expr), value);
+        case ast::NodeKind::IndexExpr:
+            return EvalIndex(context, static_cast<ast::IndexExpr*>(expr), value);
+        case ast::NodeKind::ArrayLiteralExpr: {
+            if (!context.literals)
+                return Fail(context, expr, "array literal is not constant");
+            std::vector<Value> elements;
+            for (auto element : static_cast<ast::ArrayLiteralExpr*>(expr)->elements_) {
+                if (!Eval(context, element, value))
+                    return false;
+                elements.push_back(value);
+            }
+            auto array = heap_.NewArray();
+            array->elements = std::move(elements);
+            array->readOnly = true;
+            value = Value::FromObject(array);
+            return true;
+        }
+        case ast::NodeKind::MapLiteralExpr: {
+            if (!context.literals)
+                return Fail(context, expr, "map literal is not constant");
+            std::vector<std::pair<Value, Value>> entries;
+            for (auto& element : static_cast<ast::MapLiteralExpr*>(expr)->elements_) {
+                Value key;
+                if (!Eval(context, element.first, key) || !Eval(context, element.second, value))
+                    return false;
+                entries.push_back({key, value});
+            }
+            auto map = heap_.NewMap();
+            for (auto& entry : entries)
+                map->Set(entry.first, entry.second);
+            map->readOnly = true;
+            value = Value::FromObject(map);
+            return true;
+        }
+        case ast::NodeKind::CallExpr:
+            return Fail(context, expr, "a call is not constant");
+        default:
+            return Fail(context, expr, std::string(ast::NodeKindName(expr->Kind())) + " is not constant");
+    }
+}
+
+bool ConstEvaluator::EvalLiteral(Context& context, ast::LiteralExpr* expr, Value& value) {
+    switch (expr->kind_) {
+        case Token::INT: {
+            bool hex = expr->value_.size() > 2 && expr->value_[0] == '0' &&
+                (expr->value_[1] == 'x' || expr->value_[1] == 'X');
+            char* end = nullptr;
+            long long number = strtoll(expr->value_.c_str(), &end, hex ? 16 : 10);
+            if (*end != '\0' || number < INT32_MIN || number > UINT32_MAX)
+                return Fail(context, expr, "integer literal " + expr->value_ + " is out of range");
+            value = Value::Int(static_cast<int32_t>(static_cast<uint32_t>(number)));
+            return true;
+        }
+        case Token::FLOAT:
+            value = Value::Double(strtod(expr->value_.c_str(), nullptr));
+            return true;
+        case Token::CHAR:
+            value = Value::Int(expr->value_.empty() ? 0 : static_cast<unsigned char>(expr->value_[0]));
+            return true;
+        case Token::STRING:
+            value = Value::FromObject(heap_.Intern(expr->value_));
+            return true;
+        case Token::TRUE:
+        case Token::FALSE:
+            value = Value::Bool(expr->kind_ == Token::TRUE);
+            return true;
+        case Token::NIL:
+            value = Value::Nil();
+            return true;
+        default:
+            return Fail(context, expr, "invalid literal " + expr->value_);
+    }
+}
+
+bool ConstEvaluator::EvalUnary(Context& context, ast::UnaryExpr* expr, Value& value) {
+    Value operand;
+    if (!Eval(context, expr->expr_, operand))
+        return false;
+    switch (expr->op_) {
+        case Token::SUB:
+            if (operand.IsInt())
+                value = Value::Int(static_cast<int32_t>(0u - static_cast<uint32_t>(operand.AsInt())));
+            else if (operand.IsDouble())
+                value = Value::Double(-operand.AsDouble());
+            else
+                return Fail(context, expr, "invalid operand " + TypeNameOf(operand) + " of -");
+            return true;
+        case Token::NOT:
+            value = Value::Bool(!operand.IsTruthy());
+            return true;
+        case Token::XOR:
+            try {
+                value = Interpreter::Arithmetic(heap_, OpCode::BitXor, operand, Value::Int(-1));
+            } catch (RuntimeError& e) {
+                return Fail(context, expr, e.what());
+            }
+            return true;
+        default:
+            value = operand;
+            return true;
+    }
+}
+
+bool ConstEvaluator::EvalBinary(Context& context, ast::BinaryExpr* expr, Value& value) {
+    int op = expr->op_;
+    Value left;
+    if (!Eval(context, expr->left_, left))
+        return false;
+    if (op == Token::LAND || op == Token::LOR) {
+        // The value of the last operand evaluated is the result
+        if (left.IsTruthy() == (op == Token::LOR)) {
+            value = left;
+            return true;
+        }
+        return Eval(context, expr->right_, value);
+    }
+    Value right;
+    if (!Eval(context, expr->right_, right))
+        return false;
+    try {
+        switch (op) {
+            case Token::EQL:
+                value = Value::Bool(ValuesEqual(left, right));
+                return true;
+            case Token::NEQ:
+                value = Value::Bool(!ValuesEqual(left, right));
+                return true;
+            case Token::LSS:
+                value = Value::Bool(Interpreter::LessThan(left, right, false));
+                return true;
+            case Token::GTR:
+                value = Value::Bool(Interpreter::LessThan(right, left, false));
+                return true;
+            case Token::LEQ:
+                value = Value::Bool(Interpreter::LessThan(left, right, true));
+                return true;
+            case Token::GEQ:
+                value = Value::Bool(Interpreter::LessThan(right, left, true));
+                return true;
+            default:
+                break;
+        }
+        OpCode code = ArithmeticOpCode(op);
+        if (code == OpCode::Move)
+            return Fail(context, expr, std::string("operator ") + TokenTypeString(op) + " is not constant");
+        if (code == OpCode::Add && (IsObjectOf(left, ObjectKind::String) || IsObjectOf(right, ObjectKind::String))) {
+            // Concatenations are interned like literals rather than ropes
+            value = Value::FromObject(heap_.Intern(ValueToString(left) + ValueToString(right)));
+            return true;
+        }
+        value = Interpreter::Arithmetic(heap_, code, left, right);
+        return true;
+    } catch (RuntimeError& e) {
+        return Fail(context, expr, e.what());
+    }
+}
+
+bool ConstEvaluator::EvalIndex(Context& context, ast::IndexExpr* expr, Value& value) {
+    Value object;
+    Value index;
+    if (!Eval(context, expr->expr_, object) || !Eval(context, expr->index_, index))
+        return false;
+    // Arrays and maps of constants are read-only, their elements are too
+    if (IsObjectOf(object, ObjectKind::Map)) {
+        if (auto found = static_cast<MapObject*>(object.AsObject())->table.Find(index)) {
+            value = *found;
+            return true;
+        }
+        // A missing key reads the zero value of the map, which is known from
+        // the type of the constant
+        auto type = MapValueType(context, expr->expr_);
+        if (!type)
+            return Fail(context, expr, "key " + ValueToString(index) + " is missing");
+        value = ZeroValue(TypeNameOfType(type));
+        return true;
+    }
+    if (IsObjectOf(object, ObjectKind::Array) && index.IsInt()) {
+        auto& elements = static_cast<ArrayObject*>(object.AsObject())->elements;
+        if (static_cast<uint32_t>(index.AsInt()) >= elements.size())
+            return Fail(context, expr, "index " + std::to_string(index.AsInt()) + " out of range");
+        value = elements[index.AsInt()];
+        return true;
+    }
+    if (IsObjectOf(object, ObjectKind::String) && index.IsInt()) {
+        auto string = static_cast<StringObject*>(object.AsObject());
+        if (static_cast<uint32_t>(index.AsInt()) >= string->Size())
+            return Fail(context, expr, "index " + std::to_string(index.AsInt()) + " out of range");
+        value = Value::Int(static_cast<unsigned char>(string->Data()[index.AsInt()]));
+        return true;
+    }
+    return Fail(context, expr, "can not index " + TypeNameOf(object) + " with " + TypeNameOf(index));
+}
+
+ast::Type* ConstEvaluator::MapValueType(Context& context, ast::Expr* expr) {
+    if (expr->Kind() == ast::NodeKind::Identifier && context.scope) {
+        Value unused;
+        if ((*context.scope)(static_cast<ast::Identifier*>(expr)->name_, unused) != Binding::None)
+            return nullptr;
+    }
+    Context lookup = context;
+    auto constant = Find(lookup, expr);
+    if (!constant || !constant->decl->type_ || constant->decl->type_->Kind() != ast::NodeKind::MapType)
+        return nullptr;
+    return static_cast<ast::MapType*>(constant->decl->type_)->rightType_;
+}
+
+Value ConstEvaluator::ZeroValue(const std::string& type) {
+    if (type == "int")
+        return Value::Int(0);
+    if (type == "float")
+        return Value::Double(0);
+    if (type == "bool")
+        return Value::Bool(false);
+    if (type == "string")
+        return Value::FromObject(heap_.Intern(""));
+    return Value::Nil();
+}
+
+bool ConstEvaluator::Fail(Context& context, ast::Node* node, const std::string& error) {
+    context.node = node;
+    context.error = error;
+    return false;
+}
+
+void ConstEvaluator::Report(const Constant& constant, ast::Node* node, const std::string& error) {
+    errors_.push_back({constant.path, {node->Pos(), error}});
+}
+
+} // namespace zl
@@ -0,0 +1,135 @@
+#pragma once
+#include <stddef.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "runtime/heap.h"
+#include "ast.h"
+#include "error_handler.h"
+#include "frontend.h"
+
+namespace zl {
+
+// ConstEvaluator evaluate the constants of a program at compile time, so a
+// constant costs the load of its value and runs no code at startup.
+//
+// The initializer of a constant may use literals, other constants, unary
+// and binary operators, indexes of constants and array and map literals.
+// Operators have the semantics of the interpreter, integers wrap at 32 bits
+// and + with a string operand concatenates, a missing key of a map reads
+// the zero value of its type; an operation which would fail at run time,
+// such as a division by zero, is an error. The strings of
+// constants are interned, their arrays and maps are permanent objects of
+// the heap and read-only.
+//
+// A constant is named by its name in its package, and in the others as
+// pkg.Name or by its name if it is exported and no other package exports
+// that name. Constants are evaluated once, on first use, a constant whose
+// initializer refers to itself through others is an error.
+class ConstEvaluator {
+public:
+    // Binding of a name of the code being folded, which hides constants
+    enum class Binding {
+        None,
+        // A local constant, its value is given
+        Constant,
+        // A variable or any other name which is not constant
+        Variable,
+    };
+    typedef std::function<Binding(const std::string& name, Value& value)> Scope;
+    struct Error {
+        std::string path;
+        Diagnostic diagnostic;
+    };
+
+    explicit ConstEvaluator(Heap& heap): heap_(heap) {}
+    ~ConstEvaluator() {}
+
+    // Declare the constants of the file, a constant declared twice in a
+    // package is an error
+    void DeclareFile(const SourceFile& file);
+    // Evaluate the constants not used yet, so the errors of all are known
+    void EvaluateAll();
+    const std::vector<Error>& Errors() const { return errors_; }
+
+    // Return true if expr, an identifier or pkg.Name, names a constant seen
+    // from the package, and its value, nil if its initializer failed. Set
+    // error if it names a constant which can not be used from there.
+    bool Lookup(const std::string& package, ast::Expr* expr, Value& value, std::string& error);
+    // Fold the expression of a function of the package to its value, return
+    // false if it is not constant or fails, that is left to run time
+    bool Fold(const std::string& package, ast::Expr* expr, const Scope& scope, Value& value);
+    // Evaluate the initializer of a constant declared in a function, the
+    // message is set if it is not constant
+    bool EvaluateLocal(const std::string& package, ast::ConstDecl* decl, const Scope& scope,
+            Value& value, std::string& error);
+
+private:
+    ConstEvaluator(const ConstEvaluator&) = delete;
+    ConstEvaluator& operator = (const ConstEvaluator&) = delete;
+
+    enum class State {
+        Unevaluated,
+        Evaluating,
+        Done,
+        Failed,
+    };
+    struct Constant {
+        std::string path;
+        std::string package;
+        ast::ConstDecl* decl;
+        bool exported;
+        State state;
+        Value value;
+    };
+    // Context of an evaluation, the failing node and its message. The
+    // message is empty if the failure is already reported.
+    struct Context {
+        const std::string* package;
+        const Scope* scope;
+        ast::Node* node;
+        std::string error;
+        // Whether array and map literals are evaluated, only initializers
+        // of constants make read-only ones
+        bool literals;
+    };
+
+    // Return the constant the expression names, nullptr with the error set
+    // in context if it is not one
+    Constant* Find(Context& context, ast::Expr* expr);
+    Constant* FindName(Context& context, const std::string& name);
+    Constant* FindQualified(Context& context, const std::string& package, const std::string& name);
+    // Evaluate the constant once, report its failure
+    bool Evaluate(Constant& constant);
+    bool Initialize(Context& context, ast::ConstDecl* decl, Value& value);
+    bool Eval(Context& context, ast::Expr* expr, Value& value);
+    bool EvalLiteral(Context& context, ast::LiteralExpr* expr, Value& value);
+    bool EvalUnary(Context& context, ast::UnaryExpr* expr, Value& value);
+    bool EvalBinary(Context& context, ast::BinaryExpr* expr, Value& value);
+    bool EvalIndex(Context& context, ast::IndexExpr* expr, Value& value);
+    // Type of the values of the map constant named by expr, nullptr if it
+    // does not name one
+    ast::Type* MapValueType(Context& context, ast::Expr* expr);
+    // Zero value of the values of the type, named as TypeNameOf gives it
+    Value ZeroValue(const std::string& type);
+    bool Fail(Context& context, ast::Node* node, const std::string& error);
+    void Report(const Constant& constant, ast::Node* node, const std::string& error);
+
+private:
+    Heap& heap_;
+    // Stable addresses, the constants being evaluated are referenced
+    std::deque<Constant> constants_;
+    // Index of each constant by package and name, "pkg.Name"
+    std::unordered_map<std::string, size_t> qualified_;
+    // Exported constants by name
+    std::unordered_map<std::string, std::vector<size_t>> exported_;
+    std::unordered_set<std::string> packages_;
+    // Constants being evaluated, innermost last
+    std::vector<Constant*> evaluating_;
+    std::vector<Error> errors_;
+};
+
+} // namespace zl
@@ -1,13 +1,34 @@
 #pragma once
 #include <string>
+#include <vector>
 #include "location.h"
 
 namespace zl {
 
 class ErrorHandler {
 public:
+    virtual ~ErrorHandler() {}
     virtual void ErrorAt(const Location& location, const std::string& msg) = 0;
 
 };
 
+// Diagnostic is one message reported by the front end
+struct Diagnostic {
+    Location location;
+    std::string msg;
+};
+
+// DiagnosticCollector keep all messages in reported order so that the driver
+// can print them later or store them with other front end products
+class DiagnosticCollector : public ErrorHandler {
+public:
+    void ErrorAt(const Location& location, const std::string& msg) override {
+        diagnostics_.push_back({location, msg});
+    }
+    const std::vector<Diagnostic>& Diagnostics() const { return diagnostics_; }
+    bool HasErrors() const { return !diagnostics_.empty(); }
+private:
+    std::vector<Diagnostic> diagnostics_;
+};
+
 } // namespace zl
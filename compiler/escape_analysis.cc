@@ -0,0 +1,400 @@
+#include "escape_analysis.h"
+
+namespace zl {
+
+namespace {
+
+const char kSelf[] = "self";
+
+// Return the class name of the type, empty if it is not a named type
+std::string NameOf(ast::Type* type) {
+    if (!type || type->Kind() != ast::NodeKind::NonPrimitiveType)
+        return "";
+    auto name = static_cast<ast::NonPrimitiveType*>(type)->name_;
+    return name ? name->name_ : "";
+}
+
+} // namespace
+
+void EscapeAnalysis::Analyze(const std::vector<SourceFile>& files) {
+    std::vector<std::pair<ast::FunctionDecl*, std::string>> bodies;
+    for (auto& file : files) {
+        for (auto node : file.decls) {
+            if (node->Kind() == ast::NodeKind::FunctionDecl) {
+                bodies.push_back({static_cast<ast::FunctionDecl*>(node), ""});
+                continue;
+            }
+            if (node->Kind() != ast::NodeKind::ClassDecl)
+                continue;
+            auto decl = static_cast<ast::ClassDecl*>(node);
+            if (!decl->name_ || !decl->classBody_)
+                continue;
+            auto& info = classes_[decl->name_->name_];
+            for (auto method : decl->classBody_->functions_) {
+                if (!method->name_)
+                    continue;
+                bodies.push_back({method, decl->name_->name_});
+                if (method->isStatic_)
+                    continue;
+                info.methods.insert(method->name_->name_);
+                info.hasConstructor = info.hasConstructor || method->name_->name_ == decl->name_->name_;
+            }
+        }
+    }
+    for (auto& body : bodies)
+        AnalyzeBody(body.first, body.second);
+
+    // Self escapes a method if it escapes a method called with it, until no
+    // more method is found
+    for (auto& tracked : tracked_) {
+        if (!tracked.method.empty() && tracked.escapes)
+            escapingSelf_.insert(tracked.method);
+    }
+    auto callEscapes = [&](const Tracked& tracked) {
+        for (auto& call : tracked.calls) {
+            if (escapingSelf_.count(tracked.klass + "." + call))
+                return true;
+        }
+        return false;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto& tracked : tracked_) {
+            if (tracked.method.empty() || escapingSelf_.count(tracked.method) || !callEscapes(tracked))
+                continue;
+            escapingSelf_.insert(tracked.method);
+            changed = true;
+        }
+    }
+    for (auto& tracked : tracked_) {
+        if (tracked.site && !tracked.escapes && !callEscapes(tracked))
+            locals_.insert(tracked.site);
+    }
+}
+
+bool EscapeAnalysis::SelfIsLocal(const std::string& klass, const std::string& method) const {
+    return !escapingSelf_.count(klass + "." + method);
+}
+
+void EscapeAnalysis::AnalyzeBody(ast::FunctionDecl* decl, const std::string& owner) {
+    owner_ = owner;
+    self_ = -1;
+    scope_.clear();
+    scopes_.clear();
+    if (!owner.empty() && !decl->isStatic_) {
+        self_ = static_cast<int>(tracked_.size());
+        tracked_.push_back({owner, owner + "." + decl->name_->name_, nullptr, false, {}});
+    }
+    if (decl->formalParameterList_) {
+        for (auto parameter : decl->formalParameterList_->formalParameters_)
+            scope_.push_back({parameter->name_ ? parameter->name_->name_ : "", -1});
+    }
+    if (decl->functionBlockDecl_) {
+        for (auto node : decl->functionBlockDecl_->nodes_)
+            Walk(node);
+    }
+}
+
+void EscapeAnalysis::Walk(ast::Node* node) {
+    if (!node)
+        return;
+    switch (node->Kind()) {
+        case ast::NodeKind::DeclStmt:
+            Walk(static_cast<ast::DeclStmt*>(node)->decl_);
+            break;
+        case ast::NodeKind::VariableDecl: {
+            auto decl = static_cast<ast::VariableDecl*>(node);
+            Declare(decl->name_, decl->type_, decl->varInitializer_);
+            break;
+        }
+        case ast::NodeKind::ConstDecl: {
+            auto decl = static_cast<ast::ConstDecl*>(node);
+            Declare(decl->name_, decl->type_, decl->varInitializer_);
+            break;
+        }
+        case ast::NodeKind::VariableBlockDecl:
+            for (auto decl : static_cast<ast::VariableBlockDecl*>(node)->variables_)
+                Walk(decl);
+            break;
+        case ast::NodeKind::ConstBlockDecl:
+            for (auto decl : static_cast<ast::ConstBlockDecl*>(node)->fields_)
+                Walk(decl);
+            break;
+        case ast::NodeKind::BlockStmt:
+            WalkBlock(node);
+            break;
+        case ast::NodeKind::ExprStmt: {
+            auto stmt = static_cast<ast::ExprStmt*>(node);
+            Walk(stmt->varDecl_);
+            Walk(stmt->stmt_);
+            Use(stmt->expr_);
+            break;
+        }
+        case ast::NodeKind::ExprStmts:
+            for (auto stmt : static_cast<ast::ExprStmts*>(node)->stmts_)
+                Walk(stmt);
+            break;
+        case ast::NodeKind::AssignStmt: {
+            auto stmt = static_cast<ast::AssignStmt*>(node);
+            for (auto target : stmt->lhs_) {
+                if (!target)
+                    continue;
+                // A variable of an instance is assigned once, a field of it
+                // may be assigned any number of times
+                int tracked = TrackedOf(target);
+                if (tracked >= 0) {
+                    Escape(tracked);
+                } else if (target->Kind() == ast::NodeKind::SelectorExpr) {
+                    Inspect(static_cast<ast::SelectorExpr*>(target)->expr_);
+                } else if (target->Kind() == ast::NodeKind::IndexExpr) {
+                    Use(static_cast<ast::IndexExpr*>(target)->expr_);
+                    Use(static_cast<ast::IndexExpr*>(target)->index_);
+                }
+            }
+            for (auto value : stmt->rhs_)
+                Use(value);
+            break;
+        }
+        case ast::NodeKind::IfStmt: {
+            auto stmt = static_cast<ast::IfStmt*>(node);
+            Use(stmt->conditionExpr_);
+            WalkBlock(stmt->ifBlockStmt_);
+            for (auto& elif : stmt->elifBlockStmts_) {
+                Use(elif.first);
+                WalkBlock(elif.second);
+            }
+            WalkBlock(stmt->finalStmt_);
+            break;
+        }
+        case ast::NodeKind::WhileStmt: {
+            auto stmt = static_cast<ast::WhileStmt*>(node);
+            Use(stmt->conditionExpr_);
+            WalkBlock(stmt->block_);
+            break;
+        }
+        case ast::NodeKind::DoStmt: {
+            auto stmt = static_cast<ast::DoStmt*>(node);
+            WalkBlock(stmt->block_);
+            Use(stmt->conditionExpr_);
+            break;
+        }
+        case ast::NodeKind::ForStmt: {
+            auto stmt = static_cast<ast::ForStmt*>(node);
+            scopes_.push_back(scope_.size());
+            Walk(stmt->initializer_);
+            Use(stmt->expr_);
+            WalkBlock(stmt->block_);
+            Walk(stmt->finalizer_);
+            scope_.resize(scopes_.back());
+            scopes_.pop_back();
+            break;
+        }
+        case ast::NodeKind::ForeachStmt: {
+            auto stmt = static_cast<ast::ForeachStmt*>(node);
+            if (auto iterable = dynamic_cast<ast::IterableObject*>(stmt->iterableObject_)) {
+                Use(dynamic_cast<ast::Expr*>(iterable->primary_));
+                for (auto& element : iterable->mapElements_) {
+                    Use(dynamic_cast<ast::Expr*>(element.first));
+                    Use(dynamic_cast<ast::Expr*>(element.second));
+                }
+                for (auto element : iterable->arrayElements_)
+                    Use(dynamic_cast<ast::Expr*>(element));
+            }
+            scopes_.push_back(scope_.size());
+            for (auto& variable : stmt->variables_)
+                scope_.push_back({variable, -1});
+            WalkBlock(stmt->block_);
+            scope_.resize(scopes_.back());
+            scopes_.pop_back();
+            break;
+        }
+        case ast::NodeKind::ReturnStmt:
+            for (auto expr : static_cast<ast::ReturnStmt*>(node)->exprs_)
+                Use(expr);
+            break;
+        case ast::NodeKind::AssertStmt:
+            Use(static_cast<ast::AssertStmt*>(node)->expr_);
+            break;
+        case ast::NodeKind::DeferStmt:
+            Use(static_cast<ast::DeferStmt*>(node)->call_);
+            break;
+        case ast::NodeKind::ThrowStmt:
+            // The value leaves the frame
+            Use(static_cast<ast::ThrowStmt*>(node)->expr_);
+            break;
+        case ast::NodeKind::TryStmt: {
+            auto stmt = static_cast<ast::TryStmt*>(node);
+            WalkBlock(stmt->block_);
+            for (auto catchStmt : stmt->catches_) {
+                scopes_.push_back(scope_.size());
+                if (catchStmt->name_)
+                    scope_.push_back({catchStmt->name_->name_, -1});
+                WalkBlock(catchStmt->block_);
+                scope_.resize(scopes_.back());
+                scopes_.pop_back();
+            }
+            if (stmt->finally_)
+                WalkBlock(stmt->finally_->block_);
+            break;
+        }
+        default: {
+            // Other statements use all the expressions in them
+            std::vector<ast::Node*> children;
+            ast::CollectChildren(node, children);
+            for (auto child : children) {
+                if (auto expr = dynamic_cast<ast::Expr*>(child))
+                    Use(expr);
+                else
+                    Walk(child);
+            }
+            break;
+        }
+    }
+}
+
+void EscapeAnalysis::WalkBlock(ast::Node* node) {
+    scopes_.push_back(scope_.size());
+    if (node && node->Kind() == ast::NodeKind::BlockStmt) {
+        for (auto stmt : static_cast<ast::BlockStmt*>(node)->stmts_)
+            Walk(stmt);
+    } else {
+        Walk(node);
+    }
+    scope_.resize(scopes_.back());
+    scopes_.pop_back();
+}
+
+void EscapeAnalysis::Declare(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer) {
+    auto expr = initializer ? initializer->expr_ : nullptr;
+    int tracked = -1;
+    if (expr && expr->Kind() == ast::NodeKind::NewExpr) {
+        // The initializer is walked before the variable is declared
+        auto site = static_cast<ast::NewExpr*>(expr);
+        for (auto argument : site->arguments_)
+            Use(argument);
+        auto klass = classes_.find(NameOf(site->type_));
+        if (klass != classes_.end()) {
+            sites_++;
+            // The variable must have the class type, not an interface
+            if (!type || NameOf(type) == klass->first) {
+                tracked = static_cast<int>(tracked_.size());
+                tracked_.push_back({klass->first, "", site, false, {}});
+                if (klass->second.hasConstructor)
+                    tracked_.back().calls.push_back(klass->first);
+            }
+        }
+    } else {
+        Use(expr);
+    }
+    if (name)
+        scope_.push_back({name->name_, tracked});
+}
+
+void EscapeAnalysis::Use(ast::Expr* expr) {
+    if (!expr)
+        return;
+    int tracked = TrackedOf(expr);
+    if (tracked >= 0) {
+        Escape(tracked);
+        return;
+    }
+    switch (expr->Kind()) {
+        case ast::NodeKind::Identifier:
+        case ast::NodeKind::LiteralExpr:
+            break;
+        case ast::NodeKind::SelectorExpr:
+            // A field of the instance is read
+            Inspect(static_cast<ast::SelectorExpr*>(expr)->expr_);
+            break;
+        case ast::NodeKind::CallExpr:
+            UseCall(static_cast<ast::CallExpr*>(expr));
+            break;
+        case ast::NodeKind::NewExpr: {
+            auto site = static_cast<ast::NewExpr*>(expr);
+            if (classes_.count(NameOf(site->type_)))
+                sites_++;
+            for (auto argument : site->arguments_)
+                Use(argument);
+            break;
+        }
+        case ast::NodeKind::BinaryExpr: {
+            auto binary = static_cast<ast::BinaryExpr*>(expr);
+            if (binary->op_ == Token::EQL || binary->op_ == Token::NEQ) {
+                Inspect(binary->left_);
+                Inspect(binary->right_);
+            } else {
+                Use(binary->left_);
+                Use(binary->right_);
+            }
+            break;
+        }
+        default: {
+            std::vector<ast::Node*> children;
+            ast::CollectChildren(expr, children);
+            for (auto child : children)
+                Use(dynamic_cast<ast::Expr*>(child));
+            break;
+        }
+    }
+}
+
+void EscapeAnalysis::UseCall(ast::CallExpr* expr) {
+    auto callee = expr->function_;
+    if (callee && callee->Kind() == ast::NodeKind::SelectorExpr) {
+        auto selector = static_cast<ast::SelectorExpr*>(callee);
+        int tracked = TrackedOf(selector->expr_);
+        if (tracked >= 0 && selector->selector_)
+            Call(tracked, selector->selector_->name_);
+        else
+            Use(selector->expr_);
+    } else if (callee && callee->Kind() == ast::NodeKind::Identifier) {
+        auto& name = static_cast<ast::Identifier*>(callee)->name_;
+        bool shadowed = false;
+        for (auto& local : scope_)
+            shadowed = shadowed || local.name == name;
+        if (!shadowed && name == "print") {
+            // Printing an instance prints its class name
+            for (auto argument : expr->arguments_)
+                Inspect(argument);
+            return;
+        }
+        // A method of the class called without self is given self
+        if (!shadowed && self_ >= 0 && classes_[owner_].methods.count(name))
+            Call(self_, name);
+    } else {
+        Use(callee);
+    }
+    for (auto argument : expr->arguments_)
+        Use(argument);
+}
+
+void EscapeAnalysis::Inspect(ast::Expr* expr) {
+    if (TrackedOf(expr) < 0)
+        Use(expr);
+}
+
+int EscapeAnalysis::TrackedOf(ast::Expr* expr) const {
+    if (!expr || expr->Kind() != ast::NodeKind::Identifier)
+        return -1;
+    auto& name = static_cast<ast::Identifier*>(expr)->name_;
+    for (auto iter = scope_.rbegin(); iter != scope_.rend(); ++iter) {
+        if (iter->name == name)
+            return iter->tracked;
+    }
+    return name == kSelf ? self_ : -1;
+}
+
+void EscapeAnalysis::Call(int tracked, const std::string& method) {
+    auto& instance = tracked_[tracked];
+    // Static and missing methods are not analyzed
+    if (!classes_[instance.klass].methods.count(method))
+        instance.escapes = true;
+    else
+        instance.calls.push_back(method);
+}
+
+void EscapeAnalysis::Escape(int tracked) {
+    tracked_[tracked].escapes = true;
+}
+
+} // namespace zl
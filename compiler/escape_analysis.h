@@ -0,0 +1,94 @@
+#pragma once
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "ast.h"
+#include "frontend.h"
+
+namespace zl {
+
+// EscapeAnalysis find the class instances which never outlive the function
+// creating them, so they can live in its frame instead of the heap.
+//
+// An instance is local if it is created by the initializer of a local
+// variable, var p:Point = new Point(1, 2), and the variable is only used to
+// read and write fields, to call methods, to compare with == and != and to
+// be printed. It escapes if the variable is assigned, returned, passed as an
+// argument, stored into a variable, a field, an array or a map, or used in
+// any other way. A method call passes the instance as self, it escapes if
+// self escapes the method, which is found the same way over all methods:
+// self escapes a method if it is used as a value or given to a method of
+// the class where it escapes. zlang has no closures, nothing is captured.
+class EscapeAnalysis {
+public:
+    EscapeAnalysis(): sites_(0) {}
+    ~EscapeAnalysis() {}
+
+    void Analyze(const std::vector<SourceFile>& files);
+    // Return true if the instance created by the new expression is local to
+    // the function
+    bool IsLocal(const ast::NewExpr* expr) const { return locals_.count(expr) != 0; }
+    // Return true if self does not escape the method of the class
+    bool SelfIsLocal(const std::string& klass, const std::string& method) const;
+
+    // Number of new expressions of classes, and how many of them are local
+    size_t Sites() const { return sites_; }
+    size_t LocalSites() const { return locals_.size(); }
+
+private:
+    EscapeAnalysis(const EscapeAnalysis&) = delete;
+    EscapeAnalysis& operator = (const EscapeAnalysis&) = delete;
+
+    struct ClassInfo {
+        std::unordered_set<std::string> methods;
+        bool hasConstructor = false;
+    };
+    // Tracked is an instance of a local variable or the self of a method
+    struct Tracked {
+        std::string klass;
+        // Key of the method for self, empty for instances
+        std::string method;
+        const ast::NewExpr* site;
+        bool escapes;
+        // Methods called with the instance as self
+        std::vector<std::string> calls;
+    };
+    struct Local {
+        std::string name;
+        // Index in tracked_, -1 if the variable is not tracked
+        int tracked;
+    };
+
+    void AnalyzeBody(ast::FunctionDecl* decl, const std::string& owner);
+    void Walk(ast::Node* node);
+    void WalkBlock(ast::Node* node);
+    void Declare(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer);
+    // Walk an expression whose value is used, tracked instances escape
+    void Use(ast::Expr* expr);
+    void UseCall(ast::CallExpr* expr);
+    // Use the expression unless it is a tracked instance itself, for
+    // operands which do not keep the value
+    void Inspect(ast::Expr* expr);
+    // Return the tracked instance the expression denotes, -1 if none
+    int TrackedOf(ast::Expr* expr) const;
+    void Call(int tracked, const std::string& method);
+    void Escape(int tracked);
+
+private:
+    std::map<std::string, ClassInfo> classes_;
+    std::vector<Tracked> tracked_;
+    std::unordered_set<const ast::NewExpr*> locals_;
+    // Methods whose self escapes, by "Class.method"
+    std::unordered_set<std::string> escapingSelf_;
+    size_t sites_;
+
+    // State of the body being walked
+    std::string owner_;
+    int self_;
+    std::vector<Local> scope_;
+    std::vector<size_t> scopes_;
+};
+
+} // namespace zl
@@ -0,0 +1,54 @@
+#include "frontend.h"
+#include "lexer.h"
+#include "outline.h"
+#include "parser.h"
+
+namespace zl {
+
+FrontEndResult RunFrontEnd(const char* source, size_t size, std::vector<ast::Node*>* decls) {
+    FrontEndResult result;
+    Lexer lexer(source, size);
+    ProgramHandler programHandler;
+    DiagnosticCollector errorHandler;
+    Parser parser(lexer, programHandler, errorHandler);
+    std::vector<ast::Node*> nodes;
+
+    parser.Build(nodes);
+    result.tokenCount = lexer.TokenCount();
+    result.diagnostics = errorHandler.Diagnostics();
+    result.outline = BuildOutline(nodes);
+
+    if (decls) {
+        decls->insert(decls->end(), nodes.begin(), nodes.end());
+    } else {
+        for (auto node : nodes)
+            delete node;
+    }
+    return result;
+}
+
+std::string PackageNameOf(const std::vector<ast::Node*>& decls) {
+    for (auto decl : decls) {
+        if (decl->Kind() == ast::NodeKind::PackageDecl) {
+            auto name = static_cast<ast::PackageDecl*>(decl)->name_;
+            if (name && !name->name_.empty())
+                return name->name_;
+        }
+    }
+    return "main";
+}
+
+std::vector<std::string> ImportCandidates(const std::vector<std::string>& names) {
+    std::vector<std::string> candidates;
+    if (names.empty())
+        return candidates;
+    std::string fullName;
+    for (auto& name : names)
+        fullName += (fullName.empty() ? "" : ".") + name;
+    candidates.push_back(fullName);
+    if (names.size() > 1)
+        candidates.push_back(names.back());
+    return candidates;
+}
+
+} // namespace zl
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "ast.h"
+#include "error_handler.h"
+
+namespace zl {
+
+// FrontEndResult are the products of lexing and parsing one source buffer
+// which do not need the syntax tree to be kept, so they can be cached
+struct FrontEndResult {
+    size_t tokenCount = 0;
+    std::vector<Diagnostic> diagnostics;
+    // One line for each public declaration, see BuildOutline
+    std::vector<std::string> outline;
+};
+
+// RunFrontEnd lex and parse the source buffer. If decls is not null the parsed
+// declarations are appended to it and owned by caller, otherwise they are
+// released before return.
+FrontEndResult RunFrontEnd(const char* source, size_t size,
+        std::vector<ast::Node*>* decls = nullptr);
+
+// SourceFile is one input file kept with its syntax tree for the phases after
+// parsing, the declarations are owned by it
+struct SourceFile {
+    SourceFile() = default;
+    SourceFile(SourceFile&&) = default;
+    SourceFile& operator = (SourceFile&&) = default;
+    ~SourceFile() {
+        for (auto decl : decls)
+            delete decl;
+    }
+    std::string path;
+    std::vector<ast::Node*> decls;
+    std::vector<Diagnostic> diagnostics;
+};
+
+// Return the name in package declaration, files without it are in package
+// "main"
+std::string PackageNameOf(const std::vector<ast::Node*>& decls);
+
+// Return the package names an import may refer to in preferred order, the
+// full name such as "system.io" and then its last part "io"
+std::vector<std::string> ImportCandidates(const std::vector<std::string>& names);
+
+} // namespace zl
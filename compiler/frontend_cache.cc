@@ -0,0 +1,266 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "frontend_cache.h"
+
+namespace zl {
+
+// Entry layout, all integers are little endian
+//    magic 'ZLFC', version, key(16 bytes), token count,
+//    diagnostic count, (lineno, length, message)*,
+//    outline count, (length, line)*
+static const uint32_t kCacheMagic = 0x43464c5a;
+// Bump the version whenever the front end or entry layout changes, old
+// entries then no longer match any key
+static const uint32_t kCacheVersion = 2;
+static const char* kEntrySuffix = ".zfc";
+static const char* kTempPrefix = ".tmp-";
+// Temporary files left by crashed compilers are removed after one hour
+static const time_t kTempExpireSeconds = 3600;
+
+namespace {
+
+class EntryWriter {
+public:
+    void Put32(uint32_t v) {
+        for (int i = 0; i < 4; i++)
+            buf_ += (char)((v >> (i * 8)) & 0xff);
+    }
+    void Put64(uint64_t v) {
+        Put32((uint32_t)v);
+        Put32((uint32_t)(v >> 32));
+    }
+    void PutString(const std::string& s) {
+        Put32((uint32_t)s.size());
+        buf_ += s;
+    }
+    const std::string& Data() const { return buf_; }
+private:
+    std::string buf_;
+};
+
+class EntryReader {
+public:
+    EntryReader(const std::string& buf): buf_(buf), pos_(0), ok_(true) {}
+    uint32_t Get32() {
+        if (pos_ + 4 > buf_.size()) {
+            ok_ = false;
+            return 0;
+        }
+        uint32_t v = 0;
+        for (int i = 0; i < 4; i++)
+            v |= (uint32_t)(uint8_t)buf_[pos_ + i] << (i * 8);
+        pos_ += 4;
+        return v;
+    }
+    uint64_t Get64() {
+        uint64_t low = Get32();
+        return low | ((uint64_t)Get32() << 32);
+    }
+    std::string GetString() {
+        uint32_t size = Get32();
+        if (!ok_ || pos_ + size > buf_.size()) {
+            ok_ = false;
+            return "";
+        }
+        std::string s = buf_.substr(pos_, size);
+        pos_ += size;
+        return s;
+    }
+    bool Ok() const { return ok_; }
+    bool AtEnd() const { return pos_ == buf_.size(); }
+private:
+    const std::string& buf_;
+    size_t pos_;
+    bool ok_;
+};
+
+} // namespace
+
+static bool ReadFile(const std::string& path, std::string& content) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        close(fd);
+        return false;
+    }
+    content.resize(sb.st_size);
+    size_t done = 0;
+    while (done < content.size()) {
+        ssize_t n = read(fd, &content[done], content.size() - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+    return done == content.size();
+}
+
+static bool WriteFile(const std::string& path, const std::string& content) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return false;
+    size_t done = 0;
+    while (done < content.size()) {
+        ssize_t n = write(fd, content.data() + done, content.size() - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+    return done == content.size();
+}
+
+// Create the directory and its parents if they do not exist
+static void MakeDirectories(const std::string& path) {
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        mkdir(path.substr(0, pos).c_str(), 0755);
+        if (pos == std::string::npos)
+            break;
+    }
+}
+
+static bool EndsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+        s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+FrontEndCache::FrontEndCache(const std::string& directory, uint64_t sizeLimit)
+    : directory_(directory), sizeLimit_(sizeLimit), hits_(0), misses_(0),
+    stores_(0), evictions_(0), tempCounter_(0) {
+    while (directory_.size() > 1 && directory_.back() == '/')
+        directory_.pop_back();
+    MakeDirectories(directory_);
+}
+
+Hash128 FrontEndCache::KeyOf(const char* source, size_t size) {
+    return HashBuffer(source, size, kCacheVersion);
+}
+
+std::string FrontEndCache::EntryPath(const Hash128& key) const {
+    return directory_ + "/" + key.ToString() + kEntrySuffix;
+}
+
+bool FrontEndCache::Lookup(const Hash128& key, FrontEndResult& result) {
+    std::string path = EntryPath(key);
+    std::string content;
+    if (!ReadFile(path, content)) {
+        misses_++;
+        return false;
+    }
+
+    EntryReader reader(content);
+    FrontEndResult entry;
+    bool valid = reader.Get32() == kCacheMagic && reader.Get32() == kCacheVersion;
+    valid = valid && reader.Get64() == key.low && reader.Get64() == key.high;
+    if (valid) {
+        entry.tokenCount = reader.Get64();
+        uint32_t count = reader.Get32();
+        for (uint32_t i = 0; i < count && reader.Ok(); i++) {
+            int lineno = (int)reader.Get32();
+            entry.diagnostics.push_back({Location(lineno), reader.GetString()});
+        }
+        count = reader.Get32();
+        for (uint32_t i = 0; i < count && reader.Ok(); i++)
+            entry.outline.push_back(reader.GetString());
+        valid = reader.Ok() && reader.AtEnd();
+    }
+    if (!valid) {
+        // A corrupted entry is treated as missing and overwritten later
+        misses_++;
+        return false;
+    }
+
+    // Refresh the entry for least recently used eviction
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    result = std::move(entry);
+    hits_++;
+    return true;
+}
+
+void FrontEndCache::Store(const Hash128& key, const FrontEndResult& result) {
+    EntryWriter writer;
+    writer.Put32(kCacheMagic);
+    writer.Put32(kCacheVersion);
+    writer.Put64(key.low);
+    writer.Put64(key.high);
+    writer.Put64(result.tokenCount);
+    writer.Put32((uint32_t)result.diagnostics.size());
+    for (auto& diagnostic : result.diagnostics) {
+        writer.Put32((uint32_t)diagnostic.location.GetLineno());
+        writer.PutString(diagnostic.msg);
+    }
+    writer.Put32((uint32_t)result.outline.size());
+    for (auto& line : result.outline)
+        writer.PutString(line);
+
+    // The temporary name is unique among processes and threads, rename()
+    // then publish the complete entry atomically
+    std::string tempPath = directory_ + "/" + kTempPrefix + std::to_string(getpid()) +
+        "-" + std::to_string(tempCounter_++) + "-" + key.ToString();
+    if (!WriteFile(tempPath, writer.Data())) {
+        unlink(tempPath.c_str());
+        return;
+    }
+    if (rename(tempPath.c_str(), EntryPath(key).c_str()) < 0) {
+        unlink(tempPath.c_str());
+        return;
+    }
+    stores_++;
+}
+
+void FrontEndCache::Trim() {
+    struct Entry {
+        std::string path;
+        uint64_t size;
+        struct timespec mtime;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    time_t now = time(nullptr);
+
+    DIR* dir = opendir(directory_.c_str());
+    if (!dir)
+        return;
+    while (struct dirent* dirent = readdir(dir)) {
+        std::string name = dirent->d_name;
+        std::string path = directory_ + "/" + name;
+        struct stat sb;
+        if (name.compare(0, strlen(kTempPrefix), kTempPrefix) == 0) {
+            if (stat(path.c_str(), &sb) == 0 && now - sb.st_mtime > kTempExpireSeconds)
+                unlink(path.c_str());
+            continue;
+        }
+        if (!EndsWith(name, kEntrySuffix) || stat(path.c_str(), &sb) < 0)
+            continue;
+        entries.push_back({path, (uint64_t)sb.st_size, sb.st_mtim});
+        total += sb.st_size;
+    }
+    closedir(dir);
+
+    if (total <= sizeLimit_)
+        return;
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        if (a.mtime.tv_sec != b.mtime.tv_sec)
+            return a.mtime.tv_sec < b.mtime.tv_sec;
+        return a.mtime.tv_nsec < b.mtime.tv_nsec;
+    });
+    for (auto& entry : entries) {
+        if (total <= sizeLimit_)
+            break;
+        // Another compiler may have evicted it already
+        if (unlink(entry.path.c_str()) == 0)
+            evictions_++;
+        total -= entry.size;
+    }
+}
+
+} // namespace zl
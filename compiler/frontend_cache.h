@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "frontend.h"
+#include "hash.h"
+
+namespace zl {
+
+// FrontEndCache keep front end products on disk keyed by the content hash of
+// source buffer, so an unchanged source is never lexed and parsed again.
+//
+// Every entry is one file named by the key. Entries are written to a private
+// temporary file and renamed into place, so concurrent compilers sharing the
+// directory only ever see complete entries. The modification time of an
+// entry is refreshed on hit, and Trim() evicts least recently used entries
+// until the directory fits in the size limit.
+class FrontEndCache {
+public:
+    explicit FrontEndCache(const std::string& directory, uint64_t sizeLimit);
+    ~FrontEndCache() {}
+
+    // Return the cache key of source buffer
+    static Hash128 KeyOf(const char* source, size_t size);
+
+    // Lookup fill result and return true if the entry exist and is valid
+    bool Lookup(const Hash128& key, FrontEndResult& result);
+    // Store write the entry atomically, failures are ignored because the
+    // cache is only an optimization
+    void Store(const Hash128& key, const FrontEndResult& result);
+    // Trim evict least recently used entries until the cache size is under limit
+    void Trim();
+
+    size_t Hits() const { return hits_; }
+    size_t Misses() const { return misses_; }
+    size_t Stores() const { return stores_; }
+    size_t Evictions() const { return evictions_; }
+    const std::string& Directory() const { return directory_; }
+
+private:
+    std::string EntryPath(const Hash128& key) const;
+
+private:
+    std::string directory_;
+    uint64_t sizeLimit_;
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+    std::atomic<size_t> stores_;
+    std::atomic<size_t> evictions_;
+    std::atomic<size_t> tempCounter_;
+};
+
+} // namespace zl
@@ -0,0 +1,92 @@
+#include <string.h>
+#include "hash.h"
+
+namespace zl {
+
+static inline uint64_t Rotl64(uint64_t x, int8_t r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline uint64_t Load64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+std::string Hash128::ToString() const {
+    static const char digits[] = "0123456789abcdef";
+    std::string result(32, '0');
+    for (int i = 0; i < 16; i++) {
+        result[15 - i] = digits[(high >> (i * 4)) & 0xf];
+        result[31 - i] = digits[(low >> (i * 4)) & 0xf];
+    }
+    return result;
+}
+
+Hash128 HashBuffer(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* buf = (const uint8_t*)data;
+    const size_t nblocks = size / 16;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    for (size_t i = 0; i < nblocks; i++) {
+        uint64_t k1 = Load64(buf + i * 16);
+        uint64_t k2 = Load64(buf + i * 16 + 8);
+
+        k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // tail
+    const uint8_t* tail = buf + nblocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (size & 15) {
+        case 15: k2 ^= ((uint64_t)tail[14]) << 48; // fall through
+        case 14: k2 ^= ((uint64_t)tail[13]) << 40; // fall through
+        case 13: k2 ^= ((uint64_t)tail[12]) << 32; // fall through
+        case 12: k2 ^= ((uint64_t)tail[11]) << 24; // fall through
+        case 11: k2 ^= ((uint64_t)tail[10]) << 16; // fall through
+        case 10: k2 ^= ((uint64_t)tail[9]) << 8;   // fall through
+        case 9:
+            k2 ^= ((uint64_t)tail[8]);
+            k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+            // fall through
+        case 8: k1 ^= ((uint64_t)tail[7]) << 56;   // fall through
+        case 7: k1 ^= ((uint64_t)tail[6]) << 48;   // fall through
+        case 6: k1 ^= ((uint64_t)tail[5]) << 40;   // fall through
+        case 5: k1 ^= ((uint64_t)tail[4]) << 32;   // fall through
+        case 4: k1 ^= ((uint64_t)tail[3]) << 24;   // fall through
+        case 3: k1 ^= ((uint64_t)tail[2]) << 16;   // fall through
+        case 2: k1 ^= ((uint64_t)tail[1]) << 8;    // fall through
+        case 1:
+            k1 ^= ((uint64_t)tail[0]);
+            k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    // finalization
+    h1 ^= size;
+    h2 ^= size;
+    h1 += h2;
+    h2 += h1;
+    h1 = Fmix64(h1);
+    h2 = Fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    return Hash128{h1, h2};
+}
+
+} // namespace zl
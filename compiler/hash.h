@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace zl {
+
+// Hash128 is a 128 bits hash value, used as key of content addressed data
+struct Hash128 {
+    uint64_t low;
+    uint64_t high;
+
+    bool operator == (const Hash128& rhs) const {
+        return low == rhs.low && high == rhs.high;
+    }
+    bool operator != (const Hash128& rhs) const { return !(*this == rhs); }
+    // Return the 32 hex digits string of the hash
+    std::string ToString() const;
+};
+
+// Hash the buffer with MurmurHash3 x64 128 bits variant, which is fast on
+// 64 bits platform and good enough to identify source content
+Hash128 HashBuffer(const void* data, size_t size, uint64_t seed = 0);
+
+} // namespace zl
@@ -0,0 +1,636 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "ir.h"
+
+namespace zl {
+
+namespace {
+
+const char* const opcodeNames[] = {
+#define ZL_IR_OPCODE_NAME(name, text) text,
+    ZL_IR_OPCODES(ZL_IR_OPCODE_NAME)
+#undef ZL_IR_OPCODE_NAME
+};
+
+void AddUse(IrInstruction* instruction, uint32_t operand) {
+    auto value = instruction->operands[operand];
+    instruction->useIndexes[operand] = static_cast<uint32_t>(value->users.size());
+    value->users.push_back({instruction, operand});
+}
+
+// Remove the use by moving the last use of the value in its place
+void RemoveUse(IrInstruction* instruction, uint32_t operand) {
+    auto& users = instruction->operands[operand]->users;
+    uint32_t index = instruction->useIndexes[operand];
+    users[index] = users.back();
+    users[index].user->useIndexes[users[index].operand] = index;
+    users.pop_back();
+}
+
+std::string EscapeString(const std::string& value) {
+    std::string text = "\"";
+    for (char c : value) {
+        switch (c) {
+            case '"': text += "\\\""; break;
+            case '\\': text += "\\\\"; break;
+            case '\n': text += "\\n"; break;
+            case '\t': text += "\\t"; break;
+            default: text += c; break;
+        }
+    }
+    return text + "\"";
+}
+
+std::string ValueToString(const IrValue* value) {
+    if (!value)
+        return "<null>";
+    if (value->kind != IrValueKind::Constant)
+        return "%" + std::to_string(value->id);
+    auto constant = static_cast<const IrConstant*>(value);
+    switch (constant->type) {
+        case IrType::Bool:
+            return constant->intValue ? "true" : "false";
+        case IrType::Int:
+        case IrType::Long:
+            return std::to_string(constant->intValue);
+        case IrType::Float:
+        case IrType::Double: {
+            char text[32];
+            snprintf(text, sizeof(text), "%.17g", constant->doubleValue);
+            // Keep a point so that the constant reads as floating
+            if (!strpbrk(text, ".eEn"))
+                strcat(text, ".0");
+            return text;
+        }
+        default:
+            return constant->isNil ? "nil" : EscapeString(constant->stringValue);
+    }
+}
+
+std::string InstructionToString(const IrInstruction* instruction) {
+    std::string text = "  ";
+    if (instruction->type != IrType::Void)
+        text += "%" + std::to_string(instruction->id) + " = ";
+    text += IrOpcodeName(instruction->opcode);
+    if (instruction->type != IrType::Void)
+        text += std::string(" ") + IrTypeName(instruction->type);
+    if (!instruction->name.empty())
+        text += " @" + instruction->name;
+    if (instruction->opcode == IrOpcode::Phi) {
+        auto& preds = instruction->block->preds;
+        for (size_t i = 0; i < instruction->operands.size(); i++) {
+            text += i ? ", [" : " [";
+            text += ValueToString(instruction->operands[i]) + ", ";
+            text += i < preds.size() ? "b" + std::to_string(preds[i]->id) : "?";
+            text += "]";
+        }
+        return text;
+    }
+    for (size_t i = 0; i < instruction->operands.size(); i++)
+        text += (i ? ", " : " ") + ValueToString(instruction->operands[i]);
+    if (instruction->opcode == IrOpcode::Extract || (instruction->opcode == IrOpcode::IterValue &&
+            instruction->index))
+        text += ", " + std::to_string(instruction->index);
+    if (instruction->opcode == IrOpcode::Cast && !instruction->operands.empty())
+        text += std::string(" from ") + IrTypeName(instruction->operands[0]->type);
+    for (size_t i = 0; i < instruction->targets.size(); i++)
+        text += (i || !instruction->operands.empty() ? ", b" : " b") + std::to_string(instruction->targets[i]->id);
+    return text;
+}
+
+} // namespace
+
+const char* IrTypeName(IrType type) {
+    switch (type) {
+        case IrType::Void: return "void";
+        case IrType::Bool: return "bool";
+        case IrType::Int: return "int";
+        case IrType::Long: return "long";
+        case IrType::Float: return "float";
+        case IrType::Double: return "double";
+        case IrType::Ref: return "ref";
+        case IrType::Any: return "any";
+    }
+    return "?";
+}
+
+IrType IrTypeOfName(const std::string& name) {
+    if (name == "bool")
+        return IrType::Bool;
+    if (name == "int" || name == "short" || name == "byte" || name == "char")
+        return IrType::Int;
+    if (name == "long")
+        return IrType::Long;
+    if (name == "float")
+        return IrType::Float;
+    if (name == "double")
+        return IrType::Double;
+    return IrType::Ref;
+}
+
+bool IsIntegerIrType(IrType type) {
+    return type == IrType::Int || type == IrType::Long;
+}
+
+bool IsNumericIrType(IrType type) {
+    return type == IrType::Int || type == IrType::Long || type == IrType::Float ||
+        type == IrType::Double;
+}
+
+const char* IrOpcodeName(IrOpcode opcode) {
+    return opcodeNames[static_cast<size_t>(opcode)];
+}
+
+bool IsTerminator(IrOpcode opcode) {
+    return opcode == IrOpcode::Br || opcode == IrOpcode::CondBr || opcode == IrOpcode::Ret;
+}
+
+bool IsCommutative(IrOpcode opcode) {
+    switch (opcode) {
+        case IrOpcode::Add:
+        case IrOpcode::Mul:
+        case IrOpcode::And:
+        case IrOpcode::Or:
+        case IrOpcode::Xor:
+        case IrOpcode::Eq:
+        case IrOpcode::Ne:
+            return true;
+        default:
+            return false;
+    }
+}
+
+IrInstruction* IrBlock::Terminator() const {
+    if (instructions.empty())
+        return nullptr;
+    auto last = instructions.back();
+    return !last->erased && IsTerminator(last->opcode) ? last : nullptr;
+}
+
+std::vector<IrBlock*> IrBlock::Successors() const {
+    auto terminator = Terminator();
+    return terminator ? terminator->targets : std::vector<IrBlock*>();
+}
+
+IrArgument* IrFunction::NewArgument(IrType type) {
+    auto argument = new IrArgument(type, nextId_++, arguments_.size());
+    values_.emplace_back(argument);
+    arguments_.push_back(argument);
+    return argument;
+}
+
+IrBlock* IrFunction::NewBlock() {
+    auto block = new IrBlock(nextBlockId_++);
+    blockStorage_.emplace_back(block);
+    blocks_.push_back(block);
+    return block;
+}
+
+IrInstruction* IrFunction::NewInstruction(IrOpcode opcode, IrType type,
+        const std::vector<IrValue*>& operands) {
+    auto instruction = new IrInstruction(opcode, type, nextId_++);
+    values_.emplace_back(instruction);
+    for (auto operand : operands)
+        AddOperand(instruction, operand);
+    return instruction;
+}
+
+void IrFunction::Append(IrBlock* block, IrInstruction* instruction) {
+    instruction->block = block;
+    if (instruction->opcode != IrOpcode::Phi) {
+        block->instructions.push_back(instruction);
+        return;
+    }
+    auto position = std::find_if(block->instructions.begin(), block->instructions.end(),
+        [](IrInstruction* i) { return i->opcode != IrOpcode::Phi; });
+    block->instructions.insert(position, instruction);
+}
+
+IrConstant* IrFunction::NewConstant(IrType type, const std::string& key) {
+    auto& constant = constants_[key];
+    if (!constant) {
+        constant = new IrConstant(type, nextId_++);
+        values_.emplace_back(constant);
+    }
+    return constant;
+}
+
+IrConstant* IrFunction::IntConstant(IrType type, int64_t value) {
+    if (type == IrType::Int)
+        value = static_cast<int32_t>(value);
+    auto constant = NewConstant(type, std::string(IrTypeName(type)) + ":" + std::to_string(value));
+    constant->intValue = value;
+    return constant;
+}
+
+IrConstant* IrFunction::DoubleConstant(IrType type, double value) {
+    if (type == IrType::Float)
+        value = static_cast<float>(value);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    auto constant = NewConstant(type, std::string(IrTypeName(type)) + ":" + std::to_string(bits));
+    constant->doubleValue = value;
+    return constant;
+}
+
+IrConstant* IrFunction::BoolConstant(bool value) {
+    auto constant = NewConstant(IrType::Bool, value ? "bool:1" : "bool:0");
+    constant->intValue = value;
+    return constant;
+}
+
+IrConstant* IrFunction::NilConstant() {
+    auto constant = NewConstant(IrType::Ref, "nil");
+    constant->isNil = true;
+    return constant;
+}
+
+IrConstant* IrFunction::StringConstant(const std::string& value) {
+    auto constant = NewConstant(IrType::Ref, "string:" + value);
+    constant->stringValue = value;
+    return constant;
+}
+
+IrConstant* IrFunction::ZeroConstant(IrType type) {
+    switch (type) {
+        case IrType::Bool:
+            return BoolConstant(false);
+        case IrType::Int:
+        case IrType::Long:
+            return IntConstant(type, 0);
+        case IrType::Float:
+        case IrType::Double:
+            return DoubleConstant(type, 0);
+        default:
+            return NilConstant();
+    }
+}
+
+void IrFunction::SetOperand(IrInstruction* instruction, size_t index, IrValue* value) {
+    if (instruction->operands[index] == value)
+        return;
+    RemoveUse(instruction, static_cast<uint32_t>(index));
+    instruction->operands[index] = value;
+    AddUse(instruction, static_cast<uint32_t>(index));
+}
+
+void IrFunction::AddOperand(IrInstruction* instruction, IrValue* value) {
+    instruction->operands.push_back(value);
+    instruction->useIndexes.push_back(0);
+    AddUse(instruction, static_cast<uint32_t>(instruction->operands.size() - 1));
+}
+
+void IrFunction::ReplaceAllUses(IrValue* from, IrValue* to) {
+    if (from == to)
+        return;
+    for (auto& use : from->users) {
+        use.user->operands[use.operand] = to;
+        use.user->useIndexes[use.operand] = static_cast<uint32_t>(to->users.size());
+        to->users.push_back(use);
+    }
+    from->users.clear();
+}
+
+void IrFunction::Erase(IrInstruction* instruction) {
+    for (size_t i = 0; i < instruction->operands.size(); i++)
+        RemoveUse(instruction, static_cast<uint32_t>(i));
+    instruction->operands.clear();
+    instruction->useIndexes.clear();
+    instruction->targets.clear();
+    instruction->erased = true;
+}
+
+void IrFunction::RemovePredecessor(IrBlock* block, IrBlock* pred) {
+    auto iter = std::find(block->preds.begin(), block->preds.end(), pred);
+    if (iter == block->preds.end())
+        return;
+    size_t index = iter - block->preds.begin();
+    block->preds.erase(iter);
+    for (auto instruction : block->instructions) {
+        if (instruction->opcode != IrOpcode::Phi)
+            break;
+        auto& operands = instruction->operands;
+        if (instruction->erased || index >= operands.size())
+            continue;
+        RemoveUse(instruction, static_cast<uint32_t>(index));
+        operands.erase(operands.begin() + index);
+        instruction->useIndexes.erase(instruction->useIndexes.begin() + index);
+        // The uses of the following operands moved down
+        for (size_t i = index; i < operands.size(); i++)
+            operands[i]->users[instruction->useIndexes[i]].operand = static_cast<uint32_t>(i);
+    }
+}
+
+void IrFunction::RemoveBlock(IrBlock* block) {
+    for (auto successor : block->Successors())
+        RemovePredecessor(successor, block);
+    for (auto instruction : block->instructions) {
+        if (!instruction->erased)
+            Erase(instruction);
+    }
+    block->preds.clear();
+    block->removed = true;
+}
+
+void IrFunction::Compact() {
+    blocks_.erase(std::remove_if(blocks_.begin(), blocks_.end(),
+        [](IrBlock* block) { return block->removed; }), blocks_.end());
+    for (auto block : blocks_) {
+        auto& instructions = block->instructions;
+        instructions.erase(std::remove_if(instructions.begin(), instructions.end(),
+            [](IrInstruction* instruction) { return instruction->erased; }), instructions.end());
+    }
+}
+
+size_t IrFunction::InstructionCount() const {
+    size_t count = 0;
+    for (auto block : blocks_) {
+        for (auto instruction : block->instructions)
+            count += !instruction->erased;
+    }
+    return count;
+}
+
+std::string IrFunction::ToString() const {
+    std::string text = "func " + name_ + "(";
+    for (size_t i = 0; i < arguments_.size(); i++) {
+        text += (i ? ", %" : "%") + std::to_string(arguments_[i]->id) + ": " +
+            IrTypeName(arguments_[i]->type);
+    }
+    text += ")";
+    for (size_t i = 0; i < resultTypes_.size(); i++)
+        text += (i ? ", " : " -> ") + std::string(IrTypeName(resultTypes_[i]));
+    text += " {\n";
+    for (auto block : blocks_) {
+        if (block->removed)
+            continue;
+        text += "b" + std::to_string(block->id) + ":";
+        for (size_t i = 0; i < block->preds.size(); i++)
+            text += (i ? ", b" : "\t\t\t; preds b") + std::to_string(block->preds[i]->id);
+        text += "\n";
+        for (auto instruction : block->instructions) {
+            if (!instruction->erased)
+                text += InstructionToString(instruction) + "\n";
+        }
+    }
+    return text + "}\n";
+}
+
+std::string IrModule::ToString() const {
+    std::string text;
+    for (size_t i = 0; i < functions.size(); i++)
+        text += (i ? "\n" : "") + functions[i]->ToString();
+    return text;
+}
+
+IrDominatorTree::IrDominatorTree(const IrFunction& function) {
+    uint32_t maxId = 0;
+    for (auto block : function.Blocks())
+        maxId = std::max(maxId, block->id + 1);
+    position_.assign(maxId, -1);
+    if (function.Blocks().empty())
+        return;
+
+    // Postorder by an explicit stack, huge generated functions would
+    // overflow the native one
+    std::vector<IrBlock*> postorder;
+    std::vector<bool> visited(maxId);
+    std::vector<std::pair<IrBlock*, size_t>> stack;
+    auto entry = function.Blocks()[0];
+    visited[entry->id] = true;
+    stack.push_back({entry, 0});
+    std::vector<std::vector<IrBlock*>> successors(maxId);
+    successors[entry->id] = entry->Successors();
+    while (!stack.empty()) {
+        auto& top = stack.back();
+        auto& next = successors[top.first->id];
+        if (top.second < next.size()) {
+            auto successor = next[top.second++];
+            if (!visited[successor->id]) {
+                visited[successor->id] = true;
+                successors[successor->id] = successor->Successors();
+                stack.push_back({successor, 0});
+            }
+            continue;
+        }
+        postorder.push_back(top.first);
+        stack.pop_back();
+    }
+    order_.assign(postorder.rbegin(), postorder.rend());
+    for (size_t i = 0; i < order_.size(); i++)
+        position_[order_[i]->id] = static_cast<int>(i);
+
+    // Dominators are numbered by reverse postorder position, a dominator
+    // has a smaller position than the blocks it dominates
+    idom_.assign(order_.size(), -1);
+    idom_[0] = 0;
+    auto intersect = [this](int a, int b) {
+        while (a != b) {
+            while (a > b)
+                a = idom_[a];
+            while (b > a)
+                b = idom_[b];
+        }
+        return a;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order_.size(); i++) {
+            int idom = -1;
+            for (auto pred : order_[i]->preds) {
+                int p = pred->id < position_.size() ? position_[pred->id] : -1;
+                if (p < 0 || idom_[p] < 0)
+                    continue;
+                idom = idom < 0 ? p : intersect(p, idom);
+            }
+            if (idom != idom_[i]) {
+                idom_[i] = idom;
+                changed = true;
+            }
+        }
+    }
+    children_.assign(order_.size(), {});
+    for (size_t i = 1; i < order_.size(); i++) {
+        if (idom_[i] >= 0)
+            children_[idom_[i]].push_back(order_[i]);
+    }
+
+    // Number the tree in preorder, a block dominates the blocks numbered
+    // from it to its last descendant
+    first_.assign(order_.size(), 0);
+    last_.assign(order_.size(), 0);
+    int counter = 0;
+    std::vector<std::pair<int, size_t>> walk(1, {0, 0});
+    first_[0] = counter++;
+    while (!walk.empty()) {
+        auto& top = walk.back();
+        auto& children = children_[top.first];
+        if (top.second < children.size()) {
+            int child = position_[children[top.second++]->id];
+            first_[child] = counter++;
+            walk.push_back({child, 0});
+            continue;
+        }
+        last_[top.first] = counter - 1;
+        walk.pop_back();
+    }
+}
+
+IrBlock* IrDominatorTree::Idom(const IrBlock* block) const {
+    int position = Reachable(block) ? position_[block->id] : -1;
+    if (position <= 0 || idom_[position] < 0)
+        return nullptr;
+    return order_[idom_[position]];
+}
+
+bool IrDominatorTree::Reachable(const IrBlock* block) const {
+    return block->id < position_.size() && position_[block->id] >= 0;
+}
+
+bool IrDominatorTree::Dominates(const IrBlock* a, const IrBlock* b) const {
+    if (!Reachable(a) || !Reachable(b))
+        return false;
+    int dominator = position_[a->id];
+    int position = position_[b->id];
+    return first_[dominator] <= first_[position] && first_[position] <= last_[dominator];
+}
+
+const std::vector<IrBlock*>& IrDominatorTree::Children(const IrBlock* block) const {
+    static const std::vector<IrBlock*> none;
+    if (!Reachable(block))
+        return none;
+    return children_[position_[block->id]];
+}
+
+bool VerifyIr(const IrFunction& function, std::vector<std::string>& errors) {
+    size_t count = errors.size();
+    auto error = [&](const IrBlock* block, const std::string& msg) {
+        errors.push_back(function.Name() + ": b" + std::to_string(block->id) + ": " + msg);
+    };
+    if (function.Blocks().empty()) {
+        errors.push_back(function.Name() + ": no entry block");
+        return false;
+    }
+    if (!function.Blocks()[0]->preds.empty())
+        error(function.Blocks()[0], "entry block has predecessors");
+
+    IrDominatorTree dominators(function);
+    // Position of each instruction in its block, for dominance in a block
+    std::unordered_map<const IrInstruction*, size_t> positions;
+    for (auto block : function.Blocks()) {
+        size_t position = 0;
+        for (auto instruction : block->instructions)
+            positions[instruction] = position++;
+    }
+
+    for (auto block : function.Blocks()) {
+        if (block->removed) {
+            error(block, "removed block is listed");
+            continue;
+        }
+        if (!block->Terminator())
+            error(block, "block is not terminated");
+        bool phis = true;
+        for (size_t i = 0; i < block->instructions.size(); i++) {
+            auto instruction = block->instructions[i];
+            std::string where = "%" + std::to_string(instruction->id) + " " +
+                IrOpcodeName(instruction->opcode) + ": ";
+            if (instruction->erased) {
+                error(block, where + "erased instruction is listed");
+                continue;
+            }
+            if (instruction->block != block)
+                error(block, where + "instruction is in another block");
+            if (IsTerminator(instruction->opcode) && i + 1 != block->instructions.size())
+                error(block, where + "terminator is not last");
+            if (instruction->opcode == IrOpcode::Phi) {
+                if (!phis)
+                    error(block, where + "phi after other instructions");
+                if (instruction->operands.size() != block->preds.size())
+                    error(block, where + "phi has " + std::to_string(instruction->operands.size()) +
+                        " operands for " + std::to_string(block->preds.size()) + " predecessors");
+            } else {
+                phis = false;
+            }
+            for (size_t n = 0; n < instruction->operands.size(); n++) {
+                auto operand = instruction->operands[n];
+                if (!operand) {
+                    error(block, where + "null operand");
+                    continue;
+                }
+                uint32_t slot = n < instruction->useIndexes.size() ? instruction->useIndexes[n] : UINT32_MAX;
+                if (slot >= operand->users.size() || operand->users[slot].user != instruction ||
+                        operand->users[slot].operand != n)
+                    error(block, where + "operand %" + std::to_string(operand->id) + " does not list the use");
+                if (operand->kind != IrValueKind::Instruction)
+                    continue;
+                auto definition = static_cast<IrInstruction*>(operand);
+                if (definition->erased || !definition->block || definition->block->removed) {
+                    error(block, where + "operand %" + std::to_string(operand->id) + " is erased");
+                    continue;
+                }
+                if (!dominators.Reachable(block))
+                    continue;
+                const IrBlock* use = block;
+                if (instruction->opcode == IrOpcode::Phi) {
+                    if (n >= block->preds.size() || !dominators.Reachable(block->preds[n]))
+                        continue;
+                    use = block->preds[n];
+                }
+                bool dominates = definition->block == use && instruction->opcode != IrOpcode::Phi ?
+                    positions[definition] < i : dominators.Dominates(definition->block, use);
+                if (!dominates)
+                    error(block, where + "operand %" + std::to_string(operand->id) + " does not dominate its use");
+            }
+            switch (instruction->opcode) {
+                case IrOpcode::Add: case IrOpcode::Sub: case IrOpcode::Mul:
+                case IrOpcode::Div: case IrOpcode::Rem:
+                    if (instruction->operands.size() != 2)
+                        error(block, where + "needs two operands");
+                    else if (instruction->type != IrType::Any && instruction->type != IrType::Ref &&
+                            (instruction->operands[0]->type != instruction->type ||
+                             instruction->operands[1]->type != instruction->type))
+                        error(block, where + "operand types differ from the result");
+                    break;
+                case IrOpcode::Eq: case IrOpcode::Ne: case IrOpcode::Lt:
+                case IrOpcode::Le: case IrOpcode::Gt: case IrOpcode::Ge:
+                    if (instruction->type != IrType::Bool)
+                        error(block, where + "comparison is not bool");
+                    if (instruction->operands.size() != 2)
+                        error(block, where + "needs two operands");
+                    break;
+                case IrOpcode::CondBr:
+                    if (instruction->operands.size() != 1 || instruction->targets.size() != 2)
+                        error(block, where + "needs a condition and two targets");
+                    break;
+                case IrOpcode::Br:
+                    if (instruction->targets.size() != 1)
+                        error(block, where + "needs one target");
+                    break;
+                default:
+                    break;
+            }
+        }
+        // Each edge is listed once in the predecessors for each target
+        for (auto successor : block->Successors()) {
+            if (successor->removed) {
+                error(block, "successor b" + std::to_string(successor->id) + " is removed");
+                continue;
+            }
+            auto targets = block->Successors();
+            if (std::count(successor->preds.begin(), successor->preds.end(), block) !=
+                    std::count(targets.begin(), targets.end(), successor))
+                error(block, "edge to b" + std::to_string(successor->id) + " is not in its predecessors");
+        }
+        for (auto pred : block->preds) {
+            auto targets = pred->Successors();
+            if (std::find(targets.begin(), targets.end(), block) == targets.end())
+                error(block, "predecessor b" + std::to_string(pred->id) + " does not branch here");
+        }
+    }
+    return errors.size() == count;
+}
+
+} // namespace zl
@@ -0,0 +1,270 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zl {
+
+// IrType is the type of an IR value. Ref is any reference value, strings,
+// instances, arrays, maps and nil, Any is a value whose type is not known
+// statically.
+enum class IrType : uint8_t {
+    Void,
+    Bool,
+    Int,
+    Long,
+    Float,
+    Double,
+    Ref,
+    Any,
+};
+
+const char* IrTypeName(IrType type);
+// Return the type of primitive type name, Ref for other names
+IrType IrTypeOfName(const std::string& name);
+bool IsIntegerIrType(IrType type);
+bool IsNumericIrType(IrType type);
+
+// The opcodes of instructions with their names in the textual dump
+#define ZL_IR_OPCODES(X)                 \
+    X(Add, "add")                        \
+    X(Sub, "sub")                        \
+    X(Mul, "mul")                        \
+    X(Div, "div")                        \
+    X(Rem, "rem")                        \
+    X(And, "and")                        \
+    X(Or, "or")                          \
+    X(Xor, "xor")                        \
+    X(Shl, "shl")                        \
+    X(Shr, "shr")                        \
+    X(Neg, "neg")                        \
+    X(Not, "not")                        \
+    X(Eq, "eq")                          \
+    X(Ne, "ne")                          \
+    X(Lt, "lt")                          \
+    X(Le, "le")                          \
+    X(Gt, "gt")                          \
+    X(Ge, "ge")                          \
+    X(Cast, "cast")                      \
+    X(Copy, "copy")                      \
+    X(Phi, "phi")                        \
+    X(Extract, "extract")                \
+    X(Call, "call")                      \
+    X(CallMethod, "callmethod")          \
+    X(New, "new")                        \
+    X(GetField, "getfield")              \
+    X(SetField, "setfield")              \
+    X(GetIndex, "getindex")              \
+    X(SetIndex, "setindex")              \
+    X(NewArray, "newarray")              \
+    X(NewMap, "newmap")                  \
+    X(LoadGlobal, "loadglobal")          \
+    X(StoreGlobal, "storeglobal")        \
+    X(IterBegin, "iterbegin")            \
+    X(IterNext, "iternext")              \
+    X(IterKey, "iterkey")                \
+    X(IterValue, "itervalue")            \
+    X(Assert, "assert")                  \
+    X(Br, "br")                          \
+    X(CondBr, "condbr")                  \
+    X(Ret, "ret")
+
+enum class IrOpcode : uint8_t {
+#define ZL_IR_OPCODE_ENUM(name, text) name,
+    ZL_IR_OPCODES(ZL_IR_OPCODE_ENUM)
+#undef ZL_IR_OPCODE_ENUM
+};
+
+const char* IrOpcodeName(IrOpcode opcode);
+bool IsTerminator(IrOpcode opcode);
+bool IsCommutative(IrOpcode opcode);
+
+struct IrBlock;
+struct IrInstruction;
+
+enum class IrValueKind : uint8_t {
+    Constant,
+    Argument,
+    Instruction,
+};
+
+// IrUse is an operand of an instruction
+struct IrUse {
+    IrInstruction* user;
+    uint32_t operand;
+};
+
+// IrValue is an SSA value, it keeps its uses so that they are replaced
+// without a scan of the function
+struct IrValue {
+    IrValue(IrValueKind kind, IrType type, uint32_t id): kind(kind), type(type), id(id) {}
+    virtual ~IrValue() {}
+    IrValueKind kind;
+    IrType type;
+    uint32_t id;
+    std::vector<IrUse> users;
+};
+
+struct IrConstant : IrValue {
+    IrConstant(IrType type, uint32_t id): IrValue(IrValueKind::Constant, type, id),
+        intValue(0), doubleValue(0), isNil(false) {}
+    // Value of Bool, Int and Long constants
+    int64_t intValue;
+    // Value of Float and Double constants
+    double doubleValue;
+    // Ref constants are nil or a string
+    bool isNil;
+    std::string stringValue;
+};
+
+struct IrArgument : IrValue {
+    IrArgument(IrType type, uint32_t id, size_t index)
+        : IrValue(IrValueKind::Argument, type, id), index(index) {}
+    size_t index;
+};
+
+// IrInstruction is an instruction in a block. The operands of a phi are in
+// the order of the predecessors of its block.
+struct IrInstruction : IrValue {
+    IrInstruction(IrOpcode opcode, IrType type, uint32_t id)
+        : IrValue(IrValueKind::Instruction, type, id), opcode(opcode), block(nullptr),
+          index(0), erased(false) {}
+    IrOpcode opcode;
+    std::vector<IrValue*> operands;
+    // Position of the use of each operand in the users of the operand, a
+    // use is removed in constant time, constants have thousands of users
+    std::vector<uint32_t> useIndexes;
+    IrBlock* block;
+    // Targets of branches
+    std::vector<IrBlock*> targets;
+    // Function, method, field, class or global name
+    std::string name;
+    // Result index of extract. itervalue of the single variable form of
+    // foreach has 1, the value is the element of an array or the key of a
+    // map.
+    int64_t index;
+    // Erased instructions stay in their block until IrFunction::Compact
+    bool erased;
+};
+
+struct IrBlock {
+    explicit IrBlock(uint32_t id): id(id), removed(false) {}
+    // Return the terminator, nullptr if the block is not terminated yet
+    IrInstruction* Terminator() const;
+    std::vector<IrBlock*> Successors() const;
+    uint32_t id;
+    std::vector<IrInstruction*> instructions;
+    std::vector<IrBlock*> preds;
+    bool removed;
+};
+
+// IrFunction owns its blocks, instructions and constants. blocks[0] is the
+// entry block.
+class IrFunction {
+public:
+    explicit IrFunction(const std::string& name): name_(name), nextId_(0), nextBlockId_(0) {}
+    ~IrFunction() {}
+
+    const std::string& Name() const { return name_; }
+    std::vector<IrArgument*>& Arguments() { return arguments_; }
+    const std::vector<IrArgument*>& Arguments() const { return arguments_; }
+    std::vector<IrBlock*>& Blocks() { return blocks_; }
+    const std::vector<IrBlock*>& Blocks() const { return blocks_; }
+    std::vector<IrType>& ResultTypes() { return resultTypes_; }
+    const std::vector<IrType>& ResultTypes() const { return resultTypes_; }
+
+    IrArgument* NewArgument(IrType type);
+    IrBlock* NewBlock();
+    // Create an instruction which is not in a block yet
+    IrInstruction* NewInstruction(IrOpcode opcode, IrType type, const std::vector<IrValue*>& operands);
+    // Append the instruction to the block, phis are inserted before other
+    // instructions
+    void Append(IrBlock* block, IrInstruction* instruction);
+
+    // Constants are unique in a function
+    IrConstant* IntConstant(IrType type, int64_t value);
+    IrConstant* DoubleConstant(IrType type, double value);
+    IrConstant* BoolConstant(bool value);
+    IrConstant* NilConstant();
+    IrConstant* StringConstant(const std::string& value);
+    // Zero value of the type, nil for references
+    IrConstant* ZeroConstant(IrType type);
+
+    void SetOperand(IrInstruction* instruction, size_t index, IrValue* value);
+    void AddOperand(IrInstruction* instruction, IrValue* value);
+    void ReplaceAllUses(IrValue* from, IrValue* to);
+    // Drop the operands of the instruction and mark it erased, its users
+    // must be replaced or erased too
+    void Erase(IrInstruction* instruction);
+    // Remove the edge from pred to block, the phi operands of the edge are
+    // dropped
+    void RemovePredecessor(IrBlock* block, IrBlock* pred);
+    // Drop the instructions of the block and the edges to its successors,
+    // the block is dropped from the list by Compact
+    void RemoveBlock(IrBlock* block);
+    // Drop erased instructions and removed blocks from the lists
+    void Compact();
+
+    size_t InstructionCount() const;
+    // Number of values ever created, an upper bound of value ids
+    uint32_t ValueCount() const { return nextId_; }
+    // Textual dump of the function
+    std::string ToString() const;
+
+private:
+    IrFunction() = delete;
+    IrFunction(const IrFunction&) = delete;
+    IrFunction& operator = (const IrFunction&) = delete;
+    IrConstant* NewConstant(IrType type, const std::string& key);
+
+private:
+    std::string name_;
+    std::vector<IrArgument*> arguments_;
+    std::vector<IrBlock*> blocks_;
+    std::vector<IrType> resultTypes_;
+    std::vector<std::unique_ptr<IrValue>> values_;
+    std::vector<std::unique_ptr<IrBlock>> blockStorage_;
+    std::unordered_map<std::string, IrConstant*> constants_;
+    uint32_t nextId_;
+    uint32_t nextBlockId_;
+};
+
+// IrModule is the IR of all functions and methods of the input files
+struct IrModule {
+    std::vector<std::unique_ptr<IrFunction>> functions;
+    std::string ToString() const;
+};
+
+// IrDominatorTree compute the immediate dominators of reachable blocks with
+// the iterative algorithm of Cooper, Harvey and Kennedy
+class IrDominatorTree {
+public:
+    explicit IrDominatorTree(const IrFunction& function);
+    // Reachable blocks in reverse postorder, the entry is first
+    const std::vector<IrBlock*>& ReversePostorder() const { return order_; }
+    // Immediate dominator, nullptr for the entry and unreachable blocks
+    IrBlock* Idom(const IrBlock* block) const;
+    bool Reachable(const IrBlock* block) const;
+    bool Dominates(const IrBlock* a, const IrBlock* b) const;
+    const std::vector<IrBlock*>& Children(const IrBlock* block) const;
+
+private:
+    IrDominatorTree() = delete;
+    std::vector<IrBlock*> order_;
+    // Indexed by block id, -1 for unreachable blocks
+    std::vector<int> position_;
+    std::vector<int> idom_;
+    std::vector<std::vector<IrBlock*>> children_;
+    // Preorder number of each block in the tree and the last number of its
+    // descendants, by reverse postorder position
+    std::vector<int> first_;
+    std::vector<int> last_;
+};
+
+// Check the structure of the function and the SSA property, the problems
+// are appended to errors. Return true if there is none.
+bool VerifyIr(const IrFunction& function, std::vector<std::string>& errors);
+
+} // namespace zl
@@ -0,0 +1,1201 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ir_builder.h"
+
+namespace zl {
+
+namespace {
+
+const char kSelf[] = "self";
+
+IrOpcode ArithmeticIrOpcode(int op) {
+    switch (op) {
+        case Token::ADD: case Token::ADD_ASSIGN: return IrOpcode::Add;
+        case Token::SUB: case Token::SUB_ASSIGN: return IrOpcode::Sub;
+        case Token::MUL: case Token::MUL_ASSIGN: return IrOpcode::Mul;
+        case Token::QUO: case Token::QUO_ASSIGN: return IrOpcode::Div;
+        case Token::REM: case Token::REM_ASSIGN: return IrOpcode::Rem;
+        case Token::AND: case Token::AND_ASSIGN: return IrOpcode::And;
+        case Token::OR: case Token::OR_ASSIGN: return IrOpcode::Or;
+        case Token::XOR: case Token::XOR_ASSIGN: return IrOpcode::Xor;
+        case Token::SHL: case Token::SHL_ASSIGN: return IrOpcode::Shl;
+        case Token::SHR: case Token::SHR_ASSIGN: return IrOpcode::Shr;
+        case Token::EQL: return IrOpcode::Eq;
+        case Token::NEQ: return IrOpcode::Ne;
+        case Token::LSS: return IrOpcode::Lt;
+        case Token::LEQ: return IrOpcode::Le;
+        case Token::GTR: return IrOpcode::Gt;
+        case Token::GEQ: return IrOpcode::Ge;
+        default: return IrOpcode::Copy;
+    }
+}
+
+bool IsComparisonIrOpcode(IrOpcode opcode) {
+    return opcode >= IrOpcode::Eq && opcode <= IrOpcode::Ge;
+}
+
+int NumericRank(IrType type) {
+    switch (type) {
+        case IrType::Int: return 0;
+        case IrType::Long: return 1;
+        case IrType::Float: return 2;
+        case IrType::Double: return 3;
+        default: return -1;
+    }
+}
+
+} // namespace
+
+IrBuilder::IrBuilder(IrModule& module)
+    : module_(module), line_(0), function_(nullptr), owner_(nullptr), self_(nullptr),
+      signature_(nullptr), block_(nullptr) {
+    // Builtins of the interpreter
+    functions_["print"] = Signature();
+    functions_["len"].results.push_back(IrType::Int);
+    functions_["append"].results.push_back(IrType::Ref);
+}
+
+bool IrBuilder::Build(const std::vector<SourceFile>& files) {
+    for (auto& file : files)
+        DeclareFile(file);
+    for (auto& body : bodies_) {
+        path_ = body.path;
+        BuildFunction(body);
+    }
+    return diagnostics_.empty();
+}
+
+void IrBuilder::DeclareFile(const SourceFile& file) {
+    path_ = file.path;
+    for (auto node : file.decls) {
+        SetLine(node);
+        switch (node->Kind()) {
+            case ast::NodeKind::ClassDecl: {
+                auto decl = static_cast<ast::ClassDecl*>(node);
+                if (!decl->name_ || !decl->classBody_)
+                    break;
+                auto& name = decl->name_->name_;
+                auto& info = classes_[name];
+                for (auto variable : decl->classBody_->variables_) {
+                    if (!variable->name_)
+                        continue;
+                    info.fieldTypes[variable->name_->name_] = TypeOf(variable->type_);
+                    info.fieldClasses[variable->name_->name_] = ClassNameOf(variable->type_);
+                }
+                for (auto method : decl->classBody_->functions_) {
+                    if (!method->name_)
+                        continue;
+                    if (method->isStatic_)
+                        info.statics[method->name_->name_] = SignatureOf(method);
+                    else
+                        info.methods[method->name_->name_] = SignatureOf(method);
+                    bodies_.push_back({path_, method, name + "." + method->name_->name_, name});
+                }
+                break;
+            }
+            case ast::NodeKind::FunctionDecl: {
+                auto decl = static_cast<ast::FunctionDecl*>(node);
+                if (!decl->name_)
+                    break;
+                if (functions_.count(decl->name_->name_)) {
+                    Error("function " + decl->name_->name_ + " is redeclared");
+                    break;
+                }
+                functions_[decl->name_->name_] = SignatureOf(decl);
+                bodies_.push_back({path_, decl, decl->name_->name_, ""});
+                break;
+            }
+            case ast::NodeKind::VariableDecl: {
+                auto decl = static_cast<ast::VariableDecl*>(node);
+                DeclareGlobal(decl->name_, decl->type_);
+                break;
+            }
+            case ast::NodeKind::VariableBlockDecl:
+                for (auto decl : static_cast<ast::VariableBlockDecl*>(node)->variables_)
+                    DeclareGlobal(decl->name_, decl->type_);
+                break;
+            case ast::NodeKind::ConstDecl: {
+                auto decl = static_cast<ast::ConstDecl*>(node);
+                DeclareGlobal(decl->name_, decl->type_);
+                break;
+            }
+            case ast::NodeKind::ConstBlockDecl:
+                for (auto decl : static_cast<ast::ConstBlockDecl*>(node)->fields_)
+                    DeclareGlobal(decl->name_, decl->type_);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void IrBuilder::DeclareGlobal(ast::Identifier* name, ast::Type* type) {
+    if (!name)
+        return;
+    // Initializers of globals are run by the program init, not lowered
+    globals_[name->name_] = {TypeOf(type), ClassNameOf(type)};
+}
+
+IrBuilder::Signature IrBuilder::SignatureOf(ast::FunctionDecl* decl) {
+    Signature signature;
+    if (decl->formalParameterList_) {
+        for (auto parameter : decl->formalParameterList_->formalParameters_)
+            signature.parameters.push_back(TypeOf(parameter->type_));
+    }
+    if (decl->returnParameterList_) {
+        for (auto type : decl->returnParameterList_->types_) {
+            signature.results.push_back(TypeOf(type));
+            signature.resultClasses.push_back(ClassNameOf(type));
+        }
+    }
+    return signature;
+}
+
+void IrBuilder::BuildFunction(const Body& body) {
+    auto decl = body.decl;
+    SetLine(decl);
+    module_.functions.emplace_back(new IrFunction(body.name));
+    function_ = module_.functions.back().get();
+    owner_ = body.owner.empty() ? nullptr : &classes_[body.owner];
+    ownerName_ = body.owner;
+    if (!owner_) {
+        signature_ = &functions_[body.name];
+    } else {
+        auto& name = decl->name_->name_;
+        signature_ = decl->isStatic_ ? &classes_[body.owner].statics[name] : &classes_[body.owner].methods[name];
+    }
+    function_->ResultTypes() = signature_->results;
+    variables_.clear();
+    scope_.clear();
+    scopes_.clear();
+    loops_.clear();
+    currentDef_.clear();
+    sealed_.clear();
+    incompletePhis_.clear();
+    replaced_.clear();
+
+    block_ = NewBlock();
+    SealBlock(block_);
+    self_ = owner_ && !decl->isStatic_ ? function_->NewArgument(IrType::Ref) : nullptr;
+    if (decl->formalParameterList_) {
+        auto& parameters = decl->formalParameterList_->formalParameters_;
+        for (size_t i = 0; i < parameters.size(); i++) {
+            auto type = signature_->parameters[i];
+            auto argument = function_->NewArgument(type);
+            int variable = DeclareVariable(parameters[i]->name_ ? parameters[i]->name_->name_ : "",
+                type, ClassNameOf(parameters[i]->type_));
+            WriteVariable(variable, block_, argument);
+        }
+    }
+    if (decl->functionBlockDecl_) {
+        for (auto node : decl->functionBlockDecl_->nodes_)
+            BuildStmt(node);
+    }
+    // Falling off the end returns the zero values of the results
+    std::vector<IrValue*> results;
+    for (auto type : function_->ResultTypes())
+        results.push_back(function_->ZeroConstant(type));
+    EmitReturn(results);
+    // Trivial phis were erased in place
+    function_->Compact();
+    function_ = nullptr;
+}
+
+//
+// Statements
+//
+
+void IrBuilder::BuildStmt(ast::Node* node) {
+    if (!node)
+        return;
+    SetLine(node);
+    switch (node->Kind()) {
+        case ast::NodeKind::DeclStmt:
+            BuildStmt(static_cast<ast::DeclStmt*>(node)->decl_);
+            break;
+        case ast::NodeKind::VariableDecl: {
+            auto decl = static_cast<ast::VariableDecl*>(node);
+            BuildVariable(decl->name_, decl->type_, decl->varInitializer_);
+            break;
+        }
+        case ast::NodeKind::ConstDecl: {
+            auto decl = static_cast<ast::ConstDecl*>(node);
+            BuildVariable(decl->name_, decl->type_, decl->varInitializer_);
+            break;
+        }
+        case ast::NodeKind::VariableBlockDecl:
+            for (auto decl : static_cast<ast::VariableBlockDecl*>(node)->variables_)
+                BuildStmt(decl);
+            break;
+        case ast::NodeKind::BlockStmt:
+            scopes_.push_back(scope_.size());
+            for (auto stmt : static_cast<ast::BlockStmt*>(node)->stmts_)
+                BuildStmt(stmt);
+            scope_.resize(scopes_.back());
+            scopes_.pop_back();
+            break;
+        case ast::NodeKind::ExprStmt: {
+            auto stmt = static_cast<ast::ExprStmt*>(node);
+            if (stmt->varDecl_) {
+                BuildStmt(stmt->varDecl_);
+            } else if (stmt->stmt_) {
+                BuildStmt(stmt->stmt_);
+            } else if (stmt->expr_) {
+                const Signature* signature = nullptr;
+                if (stmt->expr_->Kind() == ast::NodeKind::CallExpr)
+                    BuildCall(static_cast<ast::CallExpr*>(stmt->expr_), signature);
+                else
+                    BuildExpr(stmt->expr_);
+            }
+            break;
+        }
+        case ast::NodeKind::ExprStmts:
+            for (auto stmt : static_cast<ast::ExprStmts*>(node)->stmts_)
+                BuildStmt(stmt);
+            break;
+        case ast::NodeKind::AssignStmt:
+            BuildAssign(static_cast<ast::AssignStmt*>(node));
+            break;
+        case ast::NodeKind::IfStmt:
+            BuildIf(static_cast<ast::IfStmt*>(node));
+            break;
+        case ast::NodeKind::WhileStmt: {
+            auto stmt = static_cast<ast::WhileStmt*>(node);
+            BuildLoop(stmt->conditionExpr_, nullptr, stmt->block_, true);
+            break;
+        }
+        case ast::NodeKind::DoStmt: {
+            auto stmt = static_cast<ast::DoStmt*>(node);
+            BuildLoop(stmt->conditionExpr_, nullptr, stmt->block_, false);
+            break;
+        }
+        case ast::NodeKind::ForStmt: {
+            auto stmt = static_cast<ast::ForStmt*>(node);
+            scopes_.push_back(scope_.size());
+            BuildStmt(stmt->initializer_);
+            BuildLoop(stmt->expr_, stmt->finalizer_, stmt->block_, true);
+            scope_.resize(scopes_.back());
+            scopes_.pop_back();
+            break;
+        }
+        case ast::NodeKind::ForeachStmt:
+            BuildForeach(static_cast<ast::ForeachStmt*>(node));
+            break;
+        case ast::NodeKind::ReturnStmt:
+            BuildReturn(static_cast<ast::ReturnStmt*>(node));
+            break;
+        case ast::NodeKind::BreakStmt:
+        case ast::NodeKind::ContinueStmt:
+            if (loops_.empty()) {
+                Error(node->Kind() == ast::NodeKind::BreakStmt ? "break is not in a loop" :
+                    "continue is not in a loop");
+                break;
+            }
+            EmitBranch(node->Kind() == ast::NodeKind::BreakStmt ? loops_.back().breakTarget :
+                loops_.back().continueTarget);
+            StartDeadBlock();
+            break;
+        case ast::NodeKind::AssertStmt:
+            Emit(IrOpcode::Assert, IrType::Void, {BuildExpr(static_cast<ast::AssertStmt*>(node)->expr_)});
+            break;
+        case ast::NodeKind::LabelStmt:
+            break;
+        default:
+            Error(std::string(ast::NodeKindName(node->Kind())) + " is not supported by the IR builder");
+            break;
+    }
+}
+
+void IrBuilder::BuildScope(ast::Node* node) {
+    scopes_.push_back(scope_.size());
+    BuildStmt(node);
+    scope_.resize(scopes_.back());
+    scopes_.pop_back();
+}
+
+void IrBuilder::BuildVariable(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer) {
+    if (!name)
+        return;
+    IrType irType = TypeOf(type);
+    std::string klass = ClassNameOf(type);
+    IrValue* value = nullptr;
+    // The initializer is built before the variable is declared so that it
+    // may refer to an outer variable of the same name
+    if (initializer && initializer->expr_) {
+        value = BuildExpr(initializer->expr_);
+        if (!type) {
+            irType = value->type;
+            klass = ClassOf(initializer->expr_);
+        }
+        value = Convert(value, irType);
+    } else {
+        value = function_->ZeroConstant(irType);
+    }
+    int variable = DeclareVariable(name->name_, irType, klass);
+    WriteVariable(variable, block_, value);
+}
+
+void IrBuilder::BuildAssign(ast::AssignStmt* stmt) {
+    if (stmt->op_ != Token::ASSIGN) {
+        if (stmt->lhs_.size() != 1 || stmt->rhs_.size() != 1) {
+            Error("compound assignment must have one operand on each side");
+            return;
+        }
+        // The target is read then written, so a field or an element is
+        // loaded and stored
+        auto left = BuildExpr(stmt->lhs_[0]);
+        auto right = BuildExpr(stmt->rhs_[0]);
+        IrValue* value = BuildArithmetic(ArithmeticIrOpcode(stmt->op_), left, right);
+        BuildStore(stmt->lhs_[0], value);
+        return;
+    }
+
+    // All values are evaluated before any is stored, so a, b = b, a swaps
+    std::vector<IrValue*> values;
+    if (stmt->rhs_.size() == 1 && stmt->lhs_.size() > 1 &&
+            stmt->rhs_[0]->Kind() == ast::NodeKind::CallExpr) {
+        const Signature* signature = nullptr;
+        auto call = BuildCall(static_cast<ast::CallExpr*>(stmt->rhs_[0]), signature);
+        for (size_t n = 0; n < stmt->lhs_.size(); n++) {
+            IrType type = signature && n < signature->results.size() ? signature->results[n] : IrType::Any;
+            auto extract = Emit(IrOpcode::Extract, type, {call});
+            extract->index = static_cast<int64_t>(n);
+            values.push_back(extract);
+        }
+        if (signature && signature->results.size() != stmt->lhs_.size())
+            Error("assignment of " + std::to_string(signature->results.size()) + " values to " +
+                std::to_string(stmt->lhs_.size()) + " variables");
+    } else if (stmt->lhs_.size() == stmt->rhs_.size()) {
+        for (auto expr : stmt->rhs_)
+            values.push_back(BuildExpr(expr));
+    } else {
+        Error("assignment of " + std::to_string(stmt->rhs_.size()) + " values to " +
+            std::to_string(stmt->lhs_.size()) + " variables");
+        return;
+    }
+    for (size_t n = 0; n < stmt->lhs_.size(); n++)
+        BuildStore(stmt->lhs_[n], values[n]);
+}
+
+void IrBuilder::BuildStore(ast::Expr* target, IrValue* value) {
+    switch (target->Kind()) {
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(target)->name_;
+            int variable = FindVariable(name);
+            if (variable >= 0) {
+                WriteVariable(variable, block_, Convert(value, variables_[variable].type));
+                return;
+            }
+            if (name == kSelf && self_) {
+                Error("self can not be assigned");
+                return;
+            }
+            if (self_ && owner_->fieldTypes.count(name)) {
+                auto store = Emit(IrOpcode::SetField, IrType::Void,
+                    {self_, Convert(value, owner_->fieldTypes.at(name))});
+                store->name = name;
+                return;
+            }
+            auto global = globals_.find(name);
+            if (global != globals_.end()) {
+                auto store = Emit(IrOpcode::StoreGlobal, IrType::Void, {Convert(value, global->second.type)});
+                store->name = name;
+                return;
+            }
+            Error("undefined variable " + name);
+            return;
+        }
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(target);
+            if (!selector->selector_)
+                return;
+            auto& name = selector->selector_->name_;
+            auto klass = classes_.find(ClassOf(selector->expr_));
+            if (klass != classes_.end() && klass->second.fieldTypes.count(name))
+                value = Convert(value, klass->second.fieldTypes.at(name));
+            auto object = BuildExpr(selector->expr_);
+            auto store = Emit(IrOpcode::SetField, IrType::Void, {object, value});
+            store->name = name;
+            return;
+        }
+        case ast::NodeKind::IndexExpr: {
+            auto index = static_cast<ast::IndexExpr*>(target);
+            auto object = BuildExpr(index->expr_);
+            auto key = BuildExpr(index->index_);
+            Emit(IrOpcode::SetIndex, IrType::Void, {object, key, value});
+            return;
+        }
+        default:
+            Error(std::string(ast::NodeKindName(target->Kind())) + " is not assignable");
+            return;
+    }
+}
+
+void IrBuilder::BuildIf(ast::IfStmt* stmt) {
+    auto end = NewBlock();
+    auto then = NewBlock();
+    auto next = NewBlock();
+    BuildCondition(stmt->conditionExpr_, then, next);
+    SealBlock(then);
+    block_ = then;
+    BuildScope(stmt->ifBlockStmt_);
+    EmitBranch(end);
+    for (auto& elif : stmt->elifBlockStmts_) {
+        SealBlock(next);
+        block_ = next;
+        SetLine(elif.first);
+        then = NewBlock();
+        next = NewBlock();
+        BuildCondition(elif.first, then, next);
+        SealBlock(then);
+        block_ = then;
+        BuildScope(elif.second);
+        EmitBranch(end);
+    }
+    SealBlock(next);
+    block_ = next;
+    if (stmt->finalStmt_)
+        BuildScope(stmt->finalStmt_);
+    EmitBranch(end);
+    SealBlock(end);
+    block_ = end;
+}
+
+// The condition of while and for is tested in a header block before the
+// body, do tests it after the body. continue branches to the latch block
+// which runs the finalizer of for.
+void IrBuilder::BuildLoop(ast::Expr* condition, ast::Node* finalizer, ast::Stmt* body, bool testFirst) {
+    auto header = testFirst ? NewBlock() : nullptr;
+    auto bodyBlock = NewBlock();
+    auto latch = NewBlock();
+    auto exit = NewBlock();
+    if (testFirst) {
+        EmitBranch(header);
+        block_ = header;
+        if (condition)
+            BuildCondition(condition, bodyBlock, exit);
+        else
+            EmitBranch(bodyBlock);
+        SealBlock(bodyBlock);
+    } else {
+        EmitBranch(bodyBlock);
+    }
+    block_ = bodyBlock;
+    loops_.push_back({latch, exit});
+    BuildScope(body);
+    loops_.pop_back();
+    EmitBranch(latch);
+    SealBlock(latch);
+    block_ = latch;
+    BuildStmt(finalizer);
+    if (testFirst) {
+        EmitBranch(header);
+        SealBlock(header);
+    } else {
+        if (condition)
+            BuildCondition(condition, bodyBlock, exit);
+        else
+            EmitBranch(bodyBlock);
+        SealBlock(bodyBlock);
+    }
+    SealBlock(exit);
+    block_ = exit;
+}
+
+void IrBuilder::BuildForeach(ast::ForeachStmt* stmt) {
+    if (stmt->variables_.empty() || stmt->variables_.size() > 2) {
+        Error("foreach must have one or two variables");
+        return;
+    }
+    IrValue* object = nullptr;
+    auto iterable = dynamic_cast<ast::IterableObject*>(stmt->iterableObject_);
+    if (!iterable) {
+        Error("foreach over an invalid object");
+        return;
+    } else if (iterable->primary_) {
+        object = BuildExpr(dynamic_cast<ast::Expr*>(iterable->primary_));
+    } else if (!iterable->mapElements_.empty()) {
+        std::vector<IrValue*> elements;
+        for (auto& element : iterable->mapElements_) {
+            elements.push_back(BuildExpr(dynamic_cast<ast::Expr*>(element.first)));
+            elements.push_back(BuildExpr(dynamic_cast<ast::Expr*>(element.second)));
+        }
+        object = Emit(IrOpcode::NewMap, IrType::Ref, elements);
+    } else {
+        std::vector<IrValue*> elements;
+        for (auto element : iterable->arrayElements_)
+            elements.push_back(BuildExpr(dynamic_cast<ast::Expr*>(element)));
+        object = Emit(IrOpcode::NewArray, IrType::Ref, elements);
+    }
+    auto iterator = Emit(IrOpcode::IterBegin, IrType::Ref, {object});
+    auto header = NewBlock();
+    auto body = NewBlock();
+    auto exit = NewBlock();
+    EmitBranch(header);
+    block_ = header;
+    EmitCondBranch(Emit(IrOpcode::IterNext, IrType::Bool, {iterator}), body, exit);
+    SealBlock(body);
+    block_ = body;
+
+    scopes_.push_back(scope_.size());
+    if (stmt->variables_.size() == 1) {
+        auto value = Emit(IrOpcode::IterValue, IrType::Any, {iterator});
+        value->index = 1;
+        WriteVariable(DeclareVariable(stmt->variables_[0], IrType::Any, ""), block_, value);
+    } else {
+        auto key = Emit(IrOpcode::IterKey, IrType::Any, {iterator});
+        WriteVariable(DeclareVariable(stmt->variables_[0], IrType::Any, ""), block_, key);
+        auto value = Emit(IrOpcode::IterValue, IrType::Any, {iterator});
+        WriteVariable(DeclareVariable(stmt->variables_[1], IrType::Any, ""), block_, value);
+    }
+    loops_.push_back({header, exit});
+    BuildScope(stmt->block_);
+    loops_.pop_back();
+    scope_.resize(scopes_.back());
+    scopes_.pop_back();
+    EmitBranch(header);
+    SealBlock(header);
+    SealBlock(exit);
+    block_ = exit;
+}
+
+void IrBuilder::BuildReturn(ast::ReturnStmt* stmt) {
+    auto& results = signature_->results;
+    std::vector<IrValue*> values;
+    if (stmt->exprs_.size() == 1 && results.size() > 1 &&
+            stmt->exprs_[0]->Kind() == ast::NodeKind::CallExpr) {
+        // return f() passes all results of f
+        const Signature* signature = nullptr;
+        auto call = BuildCall(static_cast<ast::CallExpr*>(stmt->exprs_[0]), signature);
+        for (size_t n = 0; n < results.size(); n++) {
+            auto extract = Emit(IrOpcode::Extract, results[n], {call});
+            extract->index = static_cast<int64_t>(n);
+            values.push_back(extract);
+        }
+    } else {
+        for (auto expr : stmt->exprs_)
+            values.push_back(BuildExpr(expr));
+    }
+    if (values.size() != results.size()) {
+        Error("return of " + std::to_string(values.size()) + " values from a function of " +
+            std::to_string(results.size()) + " results");
+        values.resize(results.size(), nullptr);
+    }
+    for (size_t n = 0; n < values.size(); n++)
+        values[n] = values[n] ? Convert(values[n], results[n]) : function_->ZeroConstant(results[n]);
+    EmitReturn(values);
+    StartDeadBlock();
+}
+
+//
+// Expressions
+//
+
+IrValue* IrBuilder::BuildExpr(ast::Expr* expr) {
+    if (!expr) {
+        Error("missing expression");
+        return function_->NilConstant();
+    }
+    switch (expr->Kind()) {
+        case ast::NodeKind::LiteralExpr:
+            return BuildLiteral(static_cast<ast::LiteralExpr*>(expr));
+        case ast::NodeKind::Identifier:
+            return BuildIdentifier(static_cast<ast::Identifier*>(expr));
+        case ast::NodeKind::UnaryExpr: {
+            auto unary = static_cast<ast::UnaryExpr*>(expr);
+            auto operand = BuildExpr(unary->expr_);
+            IrType type = IsNumericIrType(operand->type) ? operand->type : IrType::Any;
+            switch (unary->op_) {
+                case Token::SUB:
+                    return Emit(IrOpcode::Neg, type, {operand});
+                case Token::NOT:
+                    return Emit(IrOpcode::Not, IrType::Bool, {operand});
+                case Token::XOR:
+                    if (!IsIntegerIrType(operand->type))
+                        return Emit(IrOpcode::Xor, IrType::Any, {operand, function_->IntConstant(IrType::Int, -1)});
+                    return Emit(IrOpcode::Xor, type, {operand, function_->IntConstant(type, -1)});
+                default:
+                    return operand;
+            }
+        }
+        case ast::NodeKind::BinaryExpr:
+            return BuildBinary(static_cast<ast::BinaryExpr*>(expr));
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(expr);
+            if (!selector->selector_)
+                return function_->NilConstant();
+            auto& name = selector->selector_->name_;
+            auto klass = classes_.find(ClassOf(selector->expr_));
+            IrType type = IrType::Any;
+            if (klass != classes_.end() && klass->second.fieldTypes.count(name))
+                type = klass->second.fieldTypes.at(name);
+            auto load = Emit(IrOpcode::GetField, type, {BuildExpr(selector->expr_)});
+            load->name = name;
+            return load;
+        }
+        case ast::NodeKind::IndexExpr: {
+            auto index = static_cast<ast::IndexExpr*>(expr);
+            auto object = BuildExpr(index->expr_);
+            auto key = BuildExpr(index->index_);
+            return Emit(IrOpcode::GetIndex, IrType::Any, {object, key});
+        }
+        case ast::NodeKind::CallExpr: {
+            const Signature* signature = nullptr;
+            auto call = BuildCall(static_cast<ast::CallExpr*>(expr), signature);
+            if (!signature || signature->results.size() == 1)
+                return call;
+            if (signature->results.empty()) {
+                Error("function returns no value");
+                return function_->NilConstant();
+            }
+            // The first result of a call with several results
+            auto extract = Emit(IrOpcode::Extract, signature->results[0], {call});
+            extract->index = 0;
+            return extract;
+        }
+        case ast::NodeKind::NewExpr:
+            return BuildNew(static_cast<ast::NewExpr*>(expr));
+        case ast::NodeKind::ArrayLiteralExpr: {
+            std::vector<IrValue*> elements;
+            for (auto element : static_cast<ast::ArrayLiteralExpr*>(expr)->elements_)
+                elements.push_back(BuildExpr(element));
+            return Emit(IrOpcode::NewArray, IrType::Ref, elements);
+        }
+        case ast::NodeKind::MapLiteralExpr: {
+            std::vector<IrValue*> elements;
+            for (auto& element : static_cast<ast::MapLiteralExpr*>(expr)->elements_) {
+                elements.push_back(BuildExpr(element.first));
+                elements.push_back(BuildExpr(element.second));
+            }
+            return Emit(IrOpcode::NewMap, IrType::Ref, elements);
+        }
+        default:
+            Error(std::string(ast::NodeKindName(expr->Kind())) + " is not supported by the IR builder");
+            return function_->NilConstant();
+    }
+}
+
+IrValue* IrBuilder::BuildLiteral(ast::LiteralExpr* expr) {
+    switch (expr->kind_) {
+        case Token::INT: {
+            bool hex = expr->value_.size() > 2 && expr->value_[0] == '0' &&
+                (expr->value_[1] == 'x' || expr->value_[1] == 'X');
+            char* end = nullptr;
+            errno = 0;
+            unsigned long long number = strtoull(expr->value_.c_str(), &end, hex ? 16 : 10);
+            if (*end != '\0' || errno == ERANGE) {
+                Error("integer literal " + expr->value_ + " is out of range");
+                return function_->IntConstant(IrType::Int, 0);
+            }
+            // Literals of 32 bits are int, as in the interpreter
+            if (number <= UINT32_MAX)
+                return function_->IntConstant(IrType::Int, static_cast<int32_t>(static_cast<uint32_t>(number)));
+            return function_->IntConstant(IrType::Long, static_cast<int64_t>(number));
+        }
+        case Token::FLOAT:
+            return function_->DoubleConstant(IrType::Double, strtod(expr->value_.c_str(), nullptr));
+        case Token::CHAR:
+            return function_->IntConstant(IrType::Int,
+                expr->value_.empty() ? 0 : static_cast<unsigned char>(expr->value_[0]));
+        case Token::STRING:
+            return function_->StringConstant(expr->value_);
+        case Token::TRUE:
+        case Token::FALSE:
+            return function_->BoolConstant(expr->kind_ == Token::TRUE);
+        case Token::NIL:
+            return function_->NilConstant();
+        default:
+            Error("invalid literal " + expr->value_);
+            return function_->NilConstant();
+    }
+}
+
+IrValue* IrBuilder::BuildIdentifier(ast::Identifier* expr) {
+    auto& name = expr->name_;
+    int variable = FindVariable(name);
+    if (variable >= 0)
+        return ReadVariable(variable, block_);
+    if (name == kSelf && self_)
+        return self_;
+    if (self_ && owner_->fieldTypes.count(name)) {
+        auto load = Emit(IrOpcode::GetField, owner_->fieldTypes.at(name), {self_});
+        load->name = name;
+        return load;
+    }
+    auto global = globals_.find(name);
+    if (global != globals_.end()) {
+        auto load = Emit(IrOpcode::LoadGlobal, global->second.type, {});
+        load->name = name;
+        return load;
+    }
+    if (functions_.count(name) || classes_.count(name))
+        Error(name + " used as a value is not supported by the IR builder");
+    else
+        Error("undefined name " + name);
+    return function_->NilConstant();
+}
+
+IrValue* IrBuilder::BuildBinary(ast::BinaryExpr* expr) {
+    int op = expr->op_;
+    if (op == Token::LAND || op == Token::LOR)
+        return BuildLogical(expr);
+    IrOpcode opcode = ArithmeticIrOpcode(op);
+    if (opcode == IrOpcode::Copy) {
+        Error(std::string("operator ") + TokenTypeString(op) + " is not supported by the IR builder");
+        return function_->NilConstant();
+    }
+    auto left = BuildExpr(expr->left_);
+    auto right = BuildExpr(expr->right_);
+    return BuildArithmetic(opcode, left, right);
+}
+
+IrValue* IrBuilder::BuildArithmetic(IrOpcode opcode, IrValue* left, IrValue* right) {
+    IrType type = IrType::Any;
+    int leftRank = NumericRank(left->type);
+    int rightRank = NumericRank(right->type);
+    if (opcode == IrOpcode::Shl || opcode == IrOpcode::Shr) {
+        // The count is converted to the type of the shifted value
+        if (IsIntegerIrType(left->type) && IsIntegerIrType(right->type)) {
+            type = left->type;
+            right = Convert(right, type);
+        }
+    } else if (leftRank >= 0 && rightRank >= 0) {
+        type = leftRank >= rightRank ? left->type : right->type;
+        left = Convert(left, type);
+        right = Convert(right, type);
+        bool bitwise = opcode == IrOpcode::And || opcode == IrOpcode::Or || opcode == IrOpcode::Xor;
+        if (bitwise && !IsIntegerIrType(type))
+            type = IrType::Any;
+    } else if (opcode == IrOpcode::Add && (left->type == IrType::Ref || right->type == IrType::Ref)) {
+        // Concatenation of strings
+        type = IrType::Ref;
+    }
+    if (IsComparisonIrOpcode(opcode))
+        type = IrType::Bool;
+    return Emit(opcode, type, {left, right});
+}
+
+// The value of a && b and a || b is the last operand evaluated, as in the
+// interpreter
+IrValue* IrBuilder::BuildLogical(ast::BinaryExpr* expr) {
+    auto left = BuildExpr(expr->left_);
+    auto leftBlock = block_;
+    auto right = NewBlock();
+    auto join = NewBlock();
+    if (expr->op_ == Token::LAND)
+        EmitCondBranch(left, right, join);
+    else
+        EmitCondBranch(left, join, right);
+    SealBlock(right);
+    block_ = right;
+    auto rightValue = BuildExpr(expr->right_);
+    EmitBranch(join);
+    SealBlock(join);
+    block_ = join;
+
+    IrType type = left->type == rightValue->type ? left->type : IrType::Any;
+    auto phi = function_->NewInstruction(IrOpcode::Phi, type, {});
+    function_->Append(join, phi);
+    for (auto pred : join->preds)
+        function_->AddOperand(phi, pred == leftBlock ? left : rightValue);
+    return phi;
+}
+
+IrInstruction* IrBuilder::BuildCall(ast::CallExpr* expr, const Signature*& signature) {
+    signature = nullptr;
+    auto callee = expr->function_;
+    std::vector<IrValue*> operands;
+    IrOpcode opcode = IrOpcode::Call;
+    std::string name;
+    if (callee && callee->Kind() == ast::NodeKind::Identifier) {
+        name = static_cast<ast::Identifier*>(callee)->name_;
+        if (FindVariable(name) >= 0) {
+            Error("call of a function value is not supported by the IR builder");
+        } else if (self_ && owner_->methods.count(name)) {
+            // A method of the class called without self
+            opcode = IrOpcode::CallMethod;
+            signature = &owner_->methods.at(name);
+            operands.push_back(self_);
+        } else if (functions_.count(name)) {
+            signature = &functions_.at(name);
+        } else if (owner_ && owner_->statics.count(name)) {
+            signature = &owner_->statics.at(name);
+            name = ownerName_ + "." + name;
+        } else {
+            Error("undefined function " + name);
+        }
+    } else if (callee && callee->Kind() == ast::NodeKind::SelectorExpr) {
+        auto selector = static_cast<ast::SelectorExpr*>(callee);
+        auto object = selector->expr_;
+        name = selector->selector_ ? selector->selector_->name_ : "";
+        std::string className;
+        if (object && object->Kind() == ast::NodeKind::Identifier &&
+                FindVariable(static_cast<ast::Identifier*>(object)->name_) < 0)
+            className = static_cast<ast::Identifier*>(object)->name_;
+        auto klass = classes_.find(className);
+        if (klass != classes_.end() && !(self_ && owner_->fieldTypes.count(className))) {
+            // Static method
+            auto method = klass->second.statics.find(name);
+            if (method == klass->second.statics.end())
+                Error(className + " has no static method " + name);
+            else
+                signature = &method->second;
+            name = className + "." + name;
+        } else {
+            opcode = IrOpcode::CallMethod;
+            auto objectClass = classes_.find(ClassOf(object));
+            if (objectClass != classes_.end()) {
+                auto method = objectClass->second.methods.find(name);
+                if (method != objectClass->second.methods.end())
+                    signature = &method->second;
+            }
+            operands.push_back(BuildExpr(object));
+        }
+    } else {
+        Error("call of a function value is not supported by the IR builder");
+    }
+
+    for (size_t n = 0; n < expr->arguments_.size(); n++) {
+        auto argument = BuildExpr(expr->arguments_[n]);
+        // Builtins take any values
+        if (signature && n < signature->parameters.size())
+            argument = Convert(argument, signature->parameters[n]);
+        operands.push_back(argument);
+    }
+    if (signature && !signature->parameters.empty() &&
+            signature->parameters.size() != expr->arguments_.size())
+        Error(name + " takes " + std::to_string(signature->parameters.size()) + " arguments, " +
+            std::to_string(expr->arguments_.size()) + " given");
+
+    IrType type = IrType::Any;
+    if (signature && signature->results.empty())
+        type = IrType::Void;
+    else if (signature && signature->results.size() == 1)
+        type = signature->results[0];
+    auto call = Emit(opcode, type, operands);
+    call->name = name;
+    return call;
+}
+
+IrValue* IrBuilder::BuildNew(ast::NewExpr* expr) {
+    auto name = ClassNameOf(expr->type_);
+    auto klass = classes_.find(name);
+    if (klass == classes_.end()) {
+        Error("new of a type which is not a class");
+        return function_->NilConstant();
+    }
+    // The constructor is a method named after the class
+    auto constructor = klass->second.methods.find(name);
+    std::vector<IrValue*> operands;
+    for (size_t n = 0; n < expr->arguments_.size(); n++) {
+        auto argument = BuildExpr(expr->arguments_[n]);
+        if (constructor != klass->second.methods.end() && n < constructor->second.parameters.size())
+            argument = Convert(argument, constructor->second.parameters[n]);
+        operands.push_back(argument);
+    }
+    if (constructor == klass->second.methods.end() && !expr->arguments_.empty())
+        Error(name + " has no constructor");
+    auto instruction = Emit(IrOpcode::New, IrType::Ref, operands);
+    instruction->name = name;
+    return instruction;
+}
+
+void IrBuilder::BuildCondition(ast::Expr* expr, IrBlock* ifTrue, IrBlock* ifFalse) {
+    if (expr && expr->Kind() == ast::NodeKind::UnaryExpr &&
+            static_cast<ast::UnaryExpr*>(expr)->op_ == Token::NOT) {
+        BuildCondition(static_cast<ast::UnaryExpr*>(expr)->expr_, ifFalse, ifTrue);
+        return;
+    }
+    if (expr && expr->Kind() == ast::NodeKind::BinaryExpr) {
+        auto binary = static_cast<ast::BinaryExpr*>(expr);
+        if (binary->op_ == Token::LAND || binary->op_ == Token::LOR) {
+            auto next = NewBlock();
+            if (binary->op_ == Token::LAND)
+                BuildCondition(binary->left_, next, ifFalse);
+            else
+                BuildCondition(binary->left_, ifTrue, next);
+            SealBlock(next);
+            block_ = next;
+            BuildCondition(binary->right_, ifTrue, ifFalse);
+            return;
+        }
+    }
+    EmitCondBranch(BuildExpr(expr), ifTrue, ifFalse);
+}
+
+//
+// Types
+//
+
+IrType IrBuilder::TypeOf(ast::Type* type) const {
+    if (!type)
+        return IrType::Any;
+    if (type->Kind() == ast::NodeKind::PrimitiveType)
+        return IrTypeOfName(static_cast<ast::PrimitiveType*>(type)->name_);
+    return IrType::Ref;
+}
+
+std::string IrBuilder::ClassNameOf(ast::Type* type) const {
+    if (!type || type->Kind() != ast::NodeKind::NonPrimitiveType)
+        return "";
+    auto name = static_cast<ast::NonPrimitiveType*>(type)->name_;
+    if (!name || !classes_.count(name->name_))
+        return "";
+    return name->name_;
+}
+
+std::string IrBuilder::ClassOf(ast::Expr* expr) {
+    if (!expr)
+        return "";
+    switch (expr->Kind()) {
+        case ast::NodeKind::Identifier: {
+            auto& name = static_cast<ast::Identifier*>(expr)->name_;
+            int variable = FindVariable(name);
+            if (variable >= 0)
+                return variables_[variable].klass;
+            if (name == kSelf && self_)
+                return ownerName_;
+            if (self_ && owner_->fieldClasses.count(name))
+                return owner_->fieldClasses.at(name);
+            auto global = globals_.find(name);
+            return global != globals_.end() ? global->second.klass : "";
+        }
+        case ast::NodeKind::SelectorExpr: {
+            auto selector = static_cast<ast::SelectorExpr*>(expr);
+            auto klass = classes_.find(ClassOf(selector->expr_));
+            if (klass == classes_.end() || !selector->selector_)
+                return "";
+            auto field = klass->second.fieldClasses.find(selector->selector_->name_);
+            return field != klass->second.fieldClasses.end() ? field->second : "";
+        }
+        case ast::NodeKind::NewExpr:
+            return ClassNameOf(static_cast<ast::NewExpr*>(expr)->type_);
+        default:
+            return "";
+    }
+}
+
+IrValue* IrBuilder::Convert(IrValue* value, IrType type) {
+    if (value->type == type || !IsNumericIrType(type))
+        return value;
+    // Values of unknown types are checked when converted
+    if (value->type == IrType::Any)
+        return Emit(IrOpcode::Cast, type, {value});
+    if (!IsNumericIrType(value->type))
+        return value;
+    // Constants are converted at once
+    if (value->kind == IrValueKind::Constant) {
+        auto constant = static_cast<IrConstant*>(value);
+        bool fromInteger = IsIntegerIrType(value->type);
+        if (!IsIntegerIrType(type))
+            return function_->DoubleConstant(type, fromInteger ? static_cast<double>(constant->intValue) :
+                constant->doubleValue);
+        if (fromInteger)
+            return function_->IntConstant(type, constant->intValue);
+        double number = constant->doubleValue;
+        if (number > -9.2e18 && number < 9.2e18)
+            return function_->IntConstant(type, static_cast<int64_t>(number));
+    }
+    return Emit(IrOpcode::Cast, type, {value});
+}
+
+//
+// SSA construction
+//
+
+int IrBuilder::DeclareVariable(const std::string& name, IrType type, const std::string& klass) {
+    int variable = static_cast<int>(variables_.size());
+    variables_.push_back({name, type, klass});
+    currentDef_.emplace_back();
+    scope_.push_back({name, variable});
+    return variable;
+}
+
+int IrBuilder::FindVariable(const std::string& name) const {
+    if (name.empty())
+        return -1;
+    for (auto iter = scope_.rbegin(); iter != scope_.rend(); ++iter) {
+        if (iter->first == name)
+            return iter->second;
+    }
+    return -1;
+}
+
+void IrBuilder::WriteVariable(int variable, IrBlock* block, IrValue* value) {
+    currentDef_[variable][block] = value;
+}
+
+IrValue* IrBuilder::ReadVariable(int variable, IrBlock* block) {
+    std::vector<std::pair<int, IrInstruction*>> pending;
+    auto value = LookupVariable(variable, block, pending);
+    if (pending.empty())
+        return value;
+    CompletePhis(pending);
+    return Resolve(value);
+}
+
+IrValue* IrBuilder::LookupVariable(int variable, IrBlock* block,
+        std::vector<std::pair<int, IrInstruction*>>& pending) {
+    auto& defs = currentDef_[variable];
+    std::vector<IrBlock*> visited;
+    IrValue* value = nullptr;
+    // Blocks with a single predecessor take its value
+    for (;;) {
+        auto iter = defs.find(block);
+        if (iter != defs.end()) {
+            value = iter->second = Resolve(iter->second);
+            break;
+        }
+        visited.push_back(block);
+        if (!sealed_.count(block)) {
+            auto phi = function_->NewInstruction(IrOpcode::Phi, variables_[variable].type, {});
+            function_->Append(block, phi);
+            incompletePhis_[block].push_back({variable, phi});
+            value = phi;
+            break;
+        }
+        if (block->preds.empty()) {
+            // Read in an unreachable block
+            value = function_->ZeroConstant(variables_[variable].type);
+            break;
+        }
+        if (block->preds.size() == 1) {
+            block = block->preds[0];
+            continue;
+        }
+        // The phi is the value of the block before its operands are read,
+        // which breaks the cycles of loops
+        auto phi = function_->NewInstruction(IrOpcode::Phi, variables_[variable].type, {});
+        function_->Append(block, phi);
+        pending.push_back({variable, phi});
+        value = phi;
+        break;
+    }
+    for (auto visit : visited)
+        defs[visit] = value;
+    return value;
+}
+
+void IrBuilder::CompletePhis(std::vector<std::pair<int, IrInstruction*>>& pending) {
+    std::vector<IrInstruction*> completed;
+    while (!pending.empty()) {
+        auto variable = pending.back().first;
+        auto phi = pending.back().second;
+        pending.pop_back();
+        // The predecessors are copied, reads never add edges
+        for (auto pred : phi->block->preds)
+            function_->AddOperand(phi, Resolve(LookupVariable(variable, pred, pending)));
+        completed.push_back(phi);
+    }
+    for (auto phi : completed)
+        TryRemoveTrivialPhi(phi);
+}
+
+void IrBuilder::TryRemoveTrivialPhi(IrInstruction* phi) {
+    std::vector<IrInstruction*> worklist(1, phi);
+    while (!worklist.empty()) {
+        auto candidate = worklist.back();
+        worklist.pop_back();
+        // Phis of unsealed blocks have not all their operands yet
+        if (candidate->erased || !sealed_.count(candidate->block))
+            continue;
+        IrValue* same = nullptr;
+        bool trivial = true;
+        for (auto operand : candidate->operands) {
+            if (operand == same || operand == candidate)
+                continue;
+            if (same) {
+                trivial = false;
+                break;
+            }
+            same = operand;
+        }
+        if (!trivial)
+            continue;
+        // A phi of itself only is an undefined value
+        if (!same)
+            same = function_->ZeroConstant(candidate->type);
+        std::vector<IrInstruction*> users;
+        for (auto& use : candidate->users) {
+            if (use.user != candidate && use.user->opcode == IrOpcode::Phi)
+                users.push_back(use.user);
+        }
+        function_->ReplaceAllUses(candidate, same);
+        function_->Erase(candidate);
+        replaced_[candidate] = same;
+        // Removing the phi may make the phis using it trivial
+        worklist.insert(worklist.end(), users.begin(), users.end());
+    }
+}
+
+IrValue* IrBuilder::Resolve(IrValue* value) {
+    for (;;) {
+        auto iter = replaced_.find(value);
+        if (iter == replaced_.end())
+            return value;
+        value = iter->second;
+    }
+}
+
+void IrBuilder::SealBlock(IrBlock* block) {
+    sealed_.insert(block);
+    auto iter = incompletePhis_.find(block);
+    if (iter == incompletePhis_.end())
+        return;
+    auto pending = std::move(iter->second);
+    incompletePhis_.erase(iter);
+    CompletePhis(pending);
+}
+
+//
+// Code emission
+//
+
+IrBlock* IrBuilder::NewBlock() {
+    return function_->NewBlock();
+}
+
+IrInstruction* IrBuilder::Emit(IrOpcode opcode, IrType type, const std::vector<IrValue*>& operands) {
+    std::vector<IrValue*> resolved;
+    resolved.reserve(operands.size());
+    for (auto operand : operands)
+        resolved.push_back(Resolve(operand));
+    auto instruction = function_->NewInstruction(opcode, type, resolved);
+    function_->Append(block_, instruction);
+    return instruction;
+}
+
+void IrBuilder::EmitBranch(IrBlock* target) {
+    auto branch = Emit(IrOpcode::Br, IrType::Void, {});
+    branch->targets.push_back(target);
+    target->preds.push_back(block_);
+}
+
+void IrBuilder::EmitCondBranch(IrValue* condition, IrBlock* ifTrue, IrBlock* ifFalse) {
+    auto branch = Emit(IrOpcode::CondBr, IrType::Void, {condition});
+    branch->targets.push_back(ifTrue);
+    branch->targets.push_back(ifFalse);
+    ifTrue->preds.push_back(block_);
+    ifFalse->preds.push_back(block_);
+}
+
+void IrBuilder::EmitReturn(const std::vector<IrValue*>& values) {
+    Emit(IrOpcode::Ret, IrType::Void, values);
+}
+
+void IrBuilder::StartDeadBlock() {
+    block_ = NewBlock();
+    SealBlock(block_);
+}
+
+void IrBuilder::SetLine(ast::Node* node) {
+    if (node && node->Pos().GetLineno() > 0)
+        line_ = node->Pos().GetLineno();
+}
+
+void IrBuilder::Error(const std::string& msg) {
+    diagnostics_.push_back({path_, {Location(line_), msg}});
+}
+
+} // namespace zl
@@ -0,0 +1,175 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ast.h"
+#include "error_handler.h"
+#include "frontend.h"
+#include "ir.h"
+
+namespace zl {
+
+// IrDiagnostic is a construct which can not be lowered to the IR
+struct IrDiagnostic {
+    std::string path;
+    Diagnostic diagnostic;
+};
+
+// IrBuilder lower the functions and methods of source files to SSA form.
+//
+// SSA is constructed directly from the syntax tree with the algorithm of
+// Braun et al., "Simple and Efficient Construction of Static Single
+// Assignment Form": each block maps the variables to their current value,
+// reads in blocks whose predecessors are not all known yet create
+// incomplete phis which are completed when the block is sealed, and phis
+// whose operands are all the same value are removed as they are built.
+// Names are resolved like the bytecode compiler does, local variable, field
+// of self, global variable, function and class. Numeric operands of
+// different types are promoted to the wider one with explicit casts.
+class IrBuilder {
+public:
+    explicit IrBuilder(IrModule& module);
+    ~IrBuilder() {}
+
+    // Lower all functions and methods of the files, return false if some
+    // construct can not be lowered
+    bool Build(const std::vector<SourceFile>& files);
+    const std::vector<IrDiagnostic>& Diagnostics() const { return diagnostics_; }
+
+private:
+    IrBuilder() = delete;
+    IrBuilder(const IrBuilder&) = delete;
+    IrBuilder& operator = (const IrBuilder&) = delete;
+
+    // Signature of a function or method
+    struct Signature {
+        std::vector<IrType> parameters;
+        std::vector<IrType> results;
+        // Class names of the result types, empty if not a class
+        std::vector<std::string> resultClasses;
+    };
+    struct ClassInfo {
+        std::unordered_map<std::string, IrType> fieldTypes;
+        std::unordered_map<std::string, std::string> fieldClasses;
+        std::unordered_map<std::string, Signature> methods;
+        std::unordered_map<std::string, Signature> statics;
+    };
+    struct Global {
+        IrType type;
+        std::string klass;
+    };
+    struct Variable {
+        std::string name;
+        IrType type;
+        // Class name of the declared type, empty if not a class
+        std::string klass;
+    };
+    struct Loop {
+        IrBlock* continueTarget;
+        IrBlock* breakTarget;
+    };
+    struct Body {
+        std::string path;
+        ast::FunctionDecl* decl;
+        std::string name;
+        // Class of the method, empty for functions
+        std::string owner;
+    };
+
+    void DeclareFile(const SourceFile& file);
+    void DeclareGlobal(ast::Identifier* name, ast::Type* type);
+    Signature SignatureOf(ast::FunctionDecl* decl);
+    void BuildFunction(const Body& body);
+
+    // Statements
+    void BuildStmt(ast::Node* node);
+    void BuildVariable(ast::Identifier* name, ast::Type* type, ast::VarInitializer* initializer);
+    void BuildAssign(ast::AssignStmt* stmt);
+    void BuildStore(ast::Expr* target, IrValue* value);
+    void BuildIf(ast::IfStmt* stmt);
+    void BuildLoop(ast::Expr* condition, ast::Node* finalizer, ast::Stmt* body, bool testFirst);
+    void BuildForeach(ast::ForeachStmt* stmt);
+    void BuildReturn(ast::ReturnStmt* stmt);
+    void BuildScope(ast::Node* node);
+
+    // Expressions
+    IrValue* BuildExpr(ast::Expr* expr);
+    IrValue* BuildLiteral(ast::LiteralExpr* expr);
+    IrValue* BuildIdentifier(ast::Identifier* expr);
+    IrValue* BuildBinary(ast::BinaryExpr* expr);
+    // Build the arithmetic or comparison, numeric operands are promoted
+    IrValue* BuildArithmetic(IrOpcode opcode, IrValue* left, IrValue* right);
+    IrValue* BuildLogical(ast::BinaryExpr* expr);
+    // Build the call, the instruction has all results of the callee
+    IrInstruction* BuildCall(ast::CallExpr* expr, const Signature*& signature);
+    IrValue* BuildNew(ast::NewExpr* expr);
+    // Branch to ifTrue or ifFalse on the condition, && and || short circuit
+    void BuildCondition(ast::Expr* expr, IrBlock* ifTrue, IrBlock* ifFalse);
+
+    // Types
+    IrType TypeOf(ast::Type* type) const;
+    std::string ClassNameOf(ast::Type* type) const;
+    // Class name of the value of the expression if it is known
+    std::string ClassOf(ast::Expr* expr);
+    IrValue* Convert(IrValue* value, IrType type);
+
+    // SSA construction
+    int DeclareVariable(const std::string& name, IrType type, const std::string& klass);
+    int FindVariable(const std::string& name) const;
+    void WriteVariable(int variable, IrBlock* block, IrValue* value);
+    IrValue* ReadVariable(int variable, IrBlock* block);
+    // Find the value of the variable in the block, the phis created for
+    // blocks with several predecessors are appended to pending without
+    // operands. Reads are iterative, the chains of blocks of huge generated
+    // functions would overflow the stack of the recursive algorithm.
+    IrValue* LookupVariable(int variable, IrBlock* block, std::vector<std::pair<int, IrInstruction*>>& pending);
+    // Add the operands of the pending phis, then remove the trivial ones
+    void CompletePhis(std::vector<std::pair<int, IrInstruction*>>& pending);
+    void TryRemoveTrivialPhi(IrInstruction* phi);
+    IrValue* Resolve(IrValue* value);
+    void SealBlock(IrBlock* block);
+
+    // Code emission
+    IrBlock* NewBlock();
+    IrInstruction* Emit(IrOpcode opcode, IrType type, const std::vector<IrValue*>& operands);
+    void EmitBranch(IrBlock* target);
+    void EmitCondBranch(IrValue* condition, IrBlock* ifTrue, IrBlock* ifFalse);
+    void EmitReturn(const std::vector<IrValue*>& values);
+    // Continue in a new unreachable block after a return, break or continue
+    void StartDeadBlock();
+    void SetLine(ast::Node* node);
+    void Error(const std::string& msg);
+
+private:
+    IrModule& module_;
+    std::vector<IrDiagnostic> diagnostics_;
+    std::unordered_map<std::string, Signature> functions_;
+    std::unordered_map<std::string, ClassInfo> classes_;
+    std::unordered_map<std::string, Global> globals_;
+    std::vector<Body> bodies_;
+    std::string path_;
+    int line_;
+
+    // State of the function being built
+    IrFunction* function_;
+    const ClassInfo* owner_;
+    std::string ownerName_;
+    IrValue* self_;
+    const Signature* signature_;
+    IrBlock* block_;
+    std::vector<Variable> variables_;
+    // Variables visible by name, the innermost last
+    std::vector<std::pair<std::string, int>> scope_;
+    std::vector<size_t> scopes_;
+    std::vector<Loop> loops_;
+    // Current value of each variable in each block
+    std::vector<std::unordered_map<IrBlock*, IrValue*>> currentDef_;
+    std::unordered_set<IrBlock*> sealed_;
+    std::unordered_map<IrBlock*, std::vector<std::pair<int, IrInstruction*>>> incompletePhis_;
+    // Trivial phis removed, mapped to the value replacing them
+    std::unordered_map<IrValue*, IrValue*> replaced_;
+};
+
+} // namespace zl
@@ -0,0 +1,688 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <unordered_map>
+#include "ir_passes.h"
+
+namespace zl {
+
+namespace {
+
+IrConstant* AsConstant(IrValue* value) {
+    return value->kind == IrValueKind::Constant ? static_cast<IrConstant*>(value) : nullptr;
+}
+
+// Truth of a constant as the interpreter tests it, only nil and false are
+// false
+bool ConstantTruth(const IrConstant* constant) {
+    if (constant->type == IrType::Bool)
+        return constant->intValue != 0;
+    return !(constant->type == IrType::Ref && constant->isNil);
+}
+
+// Whether the instruction may be erased when its value is not used
+bool IsRemovable(const IrInstruction* instruction) {
+    switch (instruction->opcode) {
+        case IrOpcode::LoadGlobal:
+        case IrOpcode::NewArray:
+        case IrOpcode::NewMap:
+        case IrOpcode::IterKey:
+        case IrOpcode::IterValue:
+            return true;
+        default:
+            return IsPureInstruction(instruction);
+    }
+}
+
+// Replace the terminator of the block by a branch to target
+void ReplaceByBranch(IrFunction& function, IrBlock* block, IrBlock* target) {
+    auto branch = function.NewInstruction(IrOpcode::Br, IrType::Void, {});
+    branch->targets.push_back(target);
+    branch->block = block;
+    function.Erase(block->instructions.back());
+    block->instructions.back() = branch;
+}
+
+class ConstantFoldPass : public IrPass {
+public:
+    const char* Name() const override { return "constfold"; }
+
+    bool Run(IrFunction& function) override {
+        bool changed = false;
+        for (auto block : function.Blocks()) {
+            for (size_t i = 0; i < block->instructions.size(); i++) {
+                auto instruction = block->instructions[i];
+                if (instruction->erased)
+                    continue;
+                if (instruction->opcode == IrOpcode::CondBr) {
+                    auto condition = AsConstant(instruction->operands[0]);
+                    if (!condition)
+                        continue;
+                    bool truth = ConstantTruth(condition);
+                    auto taken = instruction->targets[truth ? 0 : 1];
+                    auto other = instruction->targets[truth ? 1 : 0];
+                    ReplaceByBranch(function, block, taken);
+                    function.RemovePredecessor(other, block);
+                    changed = true;
+                    continue;
+                }
+                if (auto value = Fold(function, instruction)) {
+                    function.ReplaceAllUses(instruction, value);
+                    function.Erase(instruction);
+                    changed = true;
+                }
+            }
+        }
+        if (changed)
+            function.Compact();
+        return changed;
+    }
+
+private:
+    IrValue* Fold(IrFunction& function, IrInstruction* instruction) {
+        auto& operands = instruction->operands;
+        IrType type = instruction->type;
+        switch (instruction->opcode) {
+            case IrOpcode::Add: case IrOpcode::Sub: case IrOpcode::Mul:
+            case IrOpcode::Div: case IrOpcode::Rem: case IrOpcode::And:
+            case IrOpcode::Or: case IrOpcode::Xor: case IrOpcode::Shl:
+            case IrOpcode::Shr:
+                if (operands.size() != 2 || operands[0]->type != type || operands[1]->type != type)
+                    return nullptr;
+                if (IsIntegerIrType(type))
+                    return FoldInteger(function, instruction);
+                if (type == IrType::Float || type == IrType::Double)
+                    return FoldFloating(function, instruction);
+                return nullptr;
+            case IrOpcode::Neg: {
+                auto a = AsConstant(operands[0]);
+                if (!a || a->type != type)
+                    return nullptr;
+                if (IsIntegerIrType(type))
+                    return function.IntConstant(type, static_cast<int64_t>(0 - static_cast<uint64_t>(a->intValue)));
+                if (type == IrType::Float || type == IrType::Double)
+                    return function.DoubleConstant(type, -a->doubleValue);
+                return nullptr;
+            }
+            case IrOpcode::Not: {
+                auto a = AsConstant(operands[0]);
+                return a ? function.BoolConstant(!ConstantTruth(a)) : nullptr;
+            }
+            case IrOpcode::Eq: case IrOpcode::Ne: case IrOpcode::Lt:
+            case IrOpcode::Le: case IrOpcode::Gt: case IrOpcode::Ge:
+                return FoldComparison(function, instruction);
+            case IrOpcode::Cast: {
+                auto a = AsConstant(operands[0]);
+                if (!a || !IsNumericIrType(a->type) || !IsNumericIrType(type))
+                    return nullptr;
+                if (IsIntegerIrType(a->type)) {
+                    if (IsIntegerIrType(type))
+                        return function.IntConstant(type, a->intValue);
+                    return function.DoubleConstant(type, static_cast<double>(a->intValue));
+                }
+                if (!IsIntegerIrType(type))
+                    return function.DoubleConstant(type, a->doubleValue);
+                // Conversions out of range are not defined
+                double limit = type == IrType::Int ? 2147483648.0 : 9223372036854775808.0;
+                if (!(a->doubleValue > -limit && a->doubleValue < limit))
+                    return nullptr;
+                return function.IntConstant(type, static_cast<int64_t>(a->doubleValue));
+            }
+            default:
+                return nullptr;
+        }
+    }
+
+    IrValue* FoldInteger(IrFunction& function, IrInstruction* instruction) {
+        IrType type = instruction->type;
+        auto x = instruction->operands[0];
+        auto y = instruction->operands[1];
+        auto a = AsConstant(x);
+        auto b = AsConstant(y);
+        bool isInt = type == IrType::Int;
+        if (a && b) {
+            int64_t p = a->intValue;
+            int64_t q = b->intValue;
+            uint64_t u = static_cast<uint64_t>(p);
+            uint64_t v = static_cast<uint64_t>(q);
+            int64_t result = 0;
+            switch (instruction->opcode) {
+                case IrOpcode::Add: result = static_cast<int64_t>(u + v); break;
+                case IrOpcode::Sub: result = static_cast<int64_t>(u - v); break;
+                case IrOpcode::Mul: result = static_cast<int64_t>(u * v); break;
+                case IrOpcode::Div:
+                case IrOpcode::Rem:
+                    // Division by zero is an error at run time, the
+                    // overflow of long is not defined
+                    if (q == 0 || (!isInt && p == INT64_MIN && q == -1))
+                        return nullptr;
+                    result = instruction->opcode == IrOpcode::Div ? p / q : p % q;
+                    break;
+                case IrOpcode::And: result = p & q; break;
+                case IrOpcode::Or: result = p | q; break;
+                case IrOpcode::Xor: result = p ^ q; break;
+                case IrOpcode::Shl:
+                    result = isInt ? static_cast<int32_t>(static_cast<uint32_t>(p) << (q & 31)) :
+                        static_cast<int64_t>(u << (q & 63));
+                    break;
+                case IrOpcode::Shr:
+                    result = isInt ? static_cast<int32_t>(p) >> (q & 31) : p >> (q & 63);
+                    break;
+                default:
+                    return nullptr;
+            }
+            return function.IntConstant(type, result);
+        }
+        // Identities
+        bool bZero = b && b->intValue == 0;
+        bool bOne = b && b->intValue == 1;
+        bool aZero = a && a->intValue == 0;
+        bool aOne = a && a->intValue == 1;
+        switch (instruction->opcode) {
+            case IrOpcode::Add:
+                if (bZero)
+                    return x;
+                if (aZero)
+                    return y;
+                return nullptr;
+            case IrOpcode::Sub:
+                if (bZero)
+                    return x;
+                if (x == y)
+                    return function.IntConstant(type, 0);
+                return nullptr;
+            case IrOpcode::Mul:
+                if (bOne)
+                    return x;
+                if (aOne)
+                    return y;
+                if (aZero || bZero)
+                    return function.IntConstant(type, 0);
+                return nullptr;
+            case IrOpcode::Div:
+                return bOne ? x : nullptr;
+            case IrOpcode::Rem:
+                return bOne ? function.IntConstant(type, 0) : nullptr;
+            case IrOpcode::And:
+                if (x == y || (b && b->intValue == -1))
+                    return x;
+                if (a && a->intValue == -1)
+                    return y;
+                if (aZero || bZero)
+                    return function.IntConstant(type, 0);
+                return nullptr;
+            case IrOpcode::Or:
+                if (x == y || bZero)
+                    return x;
+                if (aZero)
+                    return y;
+                return nullptr;
+            case IrOpcode::Xor:
+                if (x == y)
+                    return function.IntConstant(type, 0);
+                if (bZero)
+                    return x;
+                if (aZero)
+                    return y;
+                return nullptr;
+            case IrOpcode::Shl:
+            case IrOpcode::Shr:
+                return bZero ? x : nullptr;
+            default:
+                return nullptr;
+        }
+    }
+
+    IrValue* FoldFloating(IrFunction& function, IrInstruction* instruction) {
+        auto a = AsConstant(instruction->operands[0]);
+        auto b = AsConstant(instruction->operands[1]);
+        if (!a || !b)
+            return nullptr;
+        double x = a->doubleValue;
+        double y = b->doubleValue;
+        switch (instruction->opcode) {
+            case IrOpcode::Add: return function.DoubleConstant(instruction->type, x + y);
+            case IrOpcode::Sub: return function.DoubleConstant(instruction->type, x - y);
+            case IrOpcode::Mul: return function.DoubleConstant(instruction->type, x * y);
+            case IrOpcode::Div: return function.DoubleConstant(instruction->type, x / y);
+            case IrOpcode::Rem: return function.DoubleConstant(instruction->type, fmod(x, y));
+            default: return nullptr;
+        }
+    }
+
+    IrValue* FoldComparison(IrFunction& function, IrInstruction* instruction) {
+        auto opcode = instruction->opcode;
+        auto x = instruction->operands[0];
+        auto y = instruction->operands[1];
+        // An integer is equal to itself, floating NaN is not
+        if (x == y && IsIntegerIrType(x->type)) {
+            bool equal = opcode == IrOpcode::Eq || opcode == IrOpcode::Le || opcode == IrOpcode::Ge;
+            return function.BoolConstant(equal);
+        }
+        auto a = AsConstant(x);
+        auto b = AsConstant(y);
+        if (!a || !b || a->type != b->type)
+            return nullptr;
+        int order = 0;
+        if (IsIntegerIrType(a->type) || a->type == IrType::Bool) {
+            order = a->intValue < b->intValue ? -1 : a->intValue > b->intValue;
+        } else if (a->type == IrType::Float || a->type == IrType::Double) {
+            if (a->doubleValue != a->doubleValue || b->doubleValue != b->doubleValue)
+                return function.BoolConstant(opcode == IrOpcode::Ne);
+            order = a->doubleValue < b->doubleValue ? -1 : a->doubleValue > b->doubleValue;
+        } else if (opcode == IrOpcode::Eq || opcode == IrOpcode::Ne) {
+            bool equal = a->isNil == b->isNil && a->stringValue == b->stringValue;
+            return function.BoolConstant(equal == (opcode == IrOpcode::Eq));
+        } else {
+            return nullptr;
+        }
+        switch (opcode) {
+            case IrOpcode::Eq: return function.BoolConstant(order == 0);
+            case IrOpcode::Ne: return function.BoolConstant(order != 0);
+            case IrOpcode::Lt: return function.BoolConstant(order < 0);
+            case IrOpcode::Le: return function.BoolConstant(order <= 0);
+            case IrOpcode::Gt: return function.BoolConstant(order > 0);
+            case IrOpcode::Ge: return function.BoolConstant(order >= 0);
+            default: return nullptr;
+        }
+    }
+};
+
+class CopyPropagationPass : public IrPass {
+public:
+    const char* Name() const override { return "copyprop"; }
+
+    bool Run(IrFunction& function) override {
+        bool changed = false;
+        for (auto block : function.Blocks()) {
+            for (auto instruction : block->instructions) {
+                if (instruction->erased)
+                    continue;
+                IrValue* value = nullptr;
+                if (instruction->opcode == IrOpcode::Copy) {
+                    value = instruction->operands[0];
+                } else if (instruction->opcode == IrOpcode::Phi) {
+                    for (auto operand : instruction->operands) {
+                        if (operand == instruction || operand == value)
+                            continue;
+                        if (value) {
+                            value = nullptr;
+                            break;
+                        }
+                        value = operand;
+                    }
+                }
+                if (!value)
+                    continue;
+                function.ReplaceAllUses(instruction, value);
+                function.Erase(instruction);
+                changed = true;
+            }
+        }
+        if (changed)
+            function.Compact();
+        return changed;
+    }
+};
+
+class DeadCodePass : public IrPass {
+public:
+    const char* Name() const override { return "dce"; }
+
+    bool Run(IrFunction& function) override {
+        // Instructions with effects are live, then the instructions they use
+        std::vector<bool> live(function.ValueCount());
+        std::vector<IrInstruction*> worklist;
+        for (auto block : function.Blocks()) {
+            for (auto instruction : block->instructions) {
+                if (!instruction->erased && !IsRemovable(instruction)) {
+                    live[instruction->id] = true;
+                    worklist.push_back(instruction);
+                }
+            }
+        }
+        while (!worklist.empty()) {
+            auto instruction = worklist.back();
+            worklist.pop_back();
+            for (auto operand : instruction->operands) {
+                if (operand->kind != IrValueKind::Instruction || live[operand->id])
+                    continue;
+                live[operand->id] = true;
+                worklist.push_back(static_cast<IrInstruction*>(operand));
+            }
+        }
+        bool changed = false;
+        for (auto block : function.Blocks()) {
+            for (auto instruction : block->instructions) {
+                if (!instruction->erased && !live[instruction->id]) {
+                    function.Erase(instruction);
+                    changed = true;
+                }
+            }
+        }
+        if (changed)
+            function.Compact();
+        return changed;
+    }
+};
+
+class SimplifyCfgPass : public IrPass {
+public:
+    const char* Name() const override { return "simplifycfg"; }
+
+    bool Run(IrFunction& function) override {
+        bool changed = RemoveUnreachable(function);
+        auto entry = function.Blocks()[0];
+        bool progress = true;
+        while (progress) {
+            progress = false;
+            for (auto block : function.Blocks()) {
+                if (block->removed)
+                    continue;
+                auto terminator = block->Terminator();
+                if (!terminator)
+                    continue;
+                if (terminator->opcode == IrOpcode::CondBr && terminator->targets[0] == terminator->targets[1]) {
+                    auto target = terminator->targets[0];
+                    ReplaceByBranch(function, block, target);
+                    function.RemovePredecessor(target, block);
+                    progress = true;
+                    continue;
+                }
+                if (terminator->opcode != IrOpcode::Br)
+                    continue;
+                auto successor = terminator->targets[0];
+                if (successor != block && successor != entry && successor->preds.size() == 1) {
+                    Merge(function, block, successor);
+                    progress = true;
+                } else if (block != entry && block->instructions.size() == 1 && successor != block &&
+                        Forward(function, block, successor)) {
+                    progress = true;
+                }
+            }
+            changed |= progress;
+        }
+        if (changed)
+            function.Compact();
+        return changed;
+    }
+
+private:
+    bool RemoveUnreachable(IrFunction& function) {
+        auto& blocks = function.Blocks();
+        std::unordered_map<IrBlock*, bool> reachable;
+        std::vector<IrBlock*> stack(1, blocks[0]);
+        reachable[blocks[0]] = true;
+        while (!stack.empty()) {
+            auto block = stack.back();
+            stack.pop_back();
+            for (auto successor : block->Successors()) {
+                if (!reachable[successor]) {
+                    reachable[successor] = true;
+                    stack.push_back(successor);
+                }
+            }
+        }
+        bool changed = false;
+        for (auto block : blocks) {
+            if (!block->removed && !reachable[block]) {
+                function.RemoveBlock(block);
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // Append the single successor to the block
+    void Merge(IrFunction& function, IrBlock* block, IrBlock* successor) {
+        function.Erase(block->instructions.back());
+        block->instructions.pop_back();
+        for (auto instruction : successor->instructions) {
+            if (instruction->erased)
+                continue;
+            if (instruction->opcode == IrOpcode::Phi) {
+                function.ReplaceAllUses(instruction, instruction->operands[0]);
+                function.Erase(instruction);
+                continue;
+            }
+            instruction->block = block;
+            block->instructions.push_back(instruction);
+        }
+        successor->instructions.clear();
+        for (auto next : block->Successors())
+            std::replace(next->preds.begin(), next->preds.end(), successor, block);
+        successor->preds.clear();
+        successor->removed = true;
+    }
+
+    // Branch from the predecessors of the empty block to its successor
+    bool Forward(IrFunction& function, IrBlock* block, IrBlock* successor) {
+        auto& preds = successor->preds;
+        size_t edge = std::find(preds.begin(), preds.end(), block) - preds.begin();
+        bool hasPhi = !successor->instructions.empty() &&
+            successor->instructions[0]->opcode == IrOpcode::Phi;
+        // The phis could not tell apart the edges of a predecessor which
+        // already branches to the successor
+        if (hasPhi) {
+            for (auto pred : block->preds) {
+                if (std::count(preds.begin(), preds.end(), pred))
+                    return false;
+            }
+        }
+        for (auto pred : block->preds) {
+            auto& targets = pred->Terminator()->targets;
+            // A conditional branch to the block on both edges is forwarded
+            // once for each edge
+            auto iter = std::find(targets.begin(), targets.end(), block);
+            *iter = successor;
+            preds.push_back(pred);
+            for (auto instruction : successor->instructions) {
+                if (instruction->opcode != IrOpcode::Phi)
+                    break;
+                if (!instruction->erased)
+                    function.AddOperand(instruction, instruction->operands[edge]);
+            }
+        }
+        function.RemovePredecessor(successor, block);
+        function.Erase(block->instructions.back());
+        block->preds.clear();
+        block->removed = true;
+        return true;
+    }
+};
+
+class ValueNumberingPass : public IrPass {
+public:
+    const char* Name() const override { return "gvn"; }
+
+    bool Run(IrFunction& function) override {
+        IrDominatorTree dominators(function);
+        std::unordered_map<std::string, IrInstruction*> table;
+        table.reserve(function.InstructionCount());
+        std::vector<std::string> inserted;
+        std::string key;
+        bool changed = false;
+        // Preorder of the dominator tree, the values of a block are visible
+        // in the blocks it dominates
+        std::vector<std::pair<IrBlock*, size_t>> stack;
+        std::vector<size_t> marks;
+        auto enter = [&](IrBlock* block) {
+            marks.push_back(inserted.size());
+            for (auto instruction : block->instructions) {
+                if (instruction->erased || !IsPureInstruction(instruction))
+                    continue;
+                Key(instruction, key);
+                auto result = table.emplace(key, instruction);
+                if (result.second) {
+                    inserted.push_back(key);
+                    continue;
+                }
+                function.ReplaceAllUses(instruction, result.first->second);
+                function.Erase(instruction);
+                changed = true;
+            }
+            stack.push_back({block, 0});
+        };
+        enter(function.Blocks()[0]);
+        while (!stack.empty()) {
+            auto& top = stack.back();
+            auto& children = dominators.Children(top.first);
+            if (top.second < children.size()) {
+                enter(children[top.second++]);
+                continue;
+            }
+            for (size_t n = marks.back(); n < inserted.size(); n++)
+                table.erase(inserted[n]);
+            inserted.resize(marks.back());
+            marks.pop_back();
+            stack.pop_back();
+        }
+        if (changed)
+            function.Compact();
+        return changed;
+    }
+
+private:
+    static void AppendId(std::string& key, uint32_t id) {
+        key.append(reinterpret_cast<const char*>(&id), sizeof(id));
+    }
+
+    // The key buffer is reused over instructions to save allocations
+    static void Key(const IrInstruction* instruction, std::string& key) {
+        key.clear();
+        key += static_cast<char>(instruction->opcode);
+        key += static_cast<char>(instruction->type);
+        key.append(reinterpret_cast<const char*>(&instruction->index), sizeof(instruction->index));
+        // Phis are equal only in the same block
+        if (instruction->opcode == IrOpcode::Phi)
+            AppendId(key, instruction->block->id);
+        auto& operands = instruction->operands;
+        if (IsCommutative(instruction->opcode) && operands.size() == 2) {
+            AppendId(key, std::min(operands[0]->id, operands[1]->id));
+            AppendId(key, std::max(operands[0]->id, operands[1]->id));
+        } else {
+            for (auto operand : operands)
+                AppendId(key, operand->id);
+        }
+    }
+};
+
+} // namespace
+
+bool IsPureInstruction(const IrInstruction* instruction) {
+    auto& operands = instruction->operands;
+    switch (instruction->opcode) {
+        case IrOpcode::Add: case IrOpcode::Sub: case IrOpcode::Mul:
+        case IrOpcode::And: case IrOpcode::Or: case IrOpcode::Xor:
+        case IrOpcode::Shl: case IrOpcode::Shr: case IrOpcode::Neg:
+            return IsNumericIrType(instruction->type);
+        case IrOpcode::Div:
+        case IrOpcode::Rem: {
+            if (!IsNumericIrType(instruction->type))
+                return false;
+            if (!IsIntegerIrType(instruction->type))
+                return true;
+            auto divisor = AsConstant(operands[1]);
+            return divisor && divisor->intValue != 0 &&
+                !(instruction->type == IrType::Long && divisor->intValue == -1);
+        }
+        case IrOpcode::Lt: case IrOpcode::Le: case IrOpcode::Gt:
+        case IrOpcode::Ge:
+            return IsNumericIrType(operands[0]->type) && IsNumericIrType(operands[1]->type);
+        case IrOpcode::Cast:
+            return IsNumericIrType(operands[0]->type);
+        case IrOpcode::Eq: case IrOpcode::Ne: case IrOpcode::Not:
+        case IrOpcode::Copy: case IrOpcode::Phi: case IrOpcode::Extract:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::unique_ptr<IrPass> NewConstantFoldPass() {
+    return std::unique_ptr<IrPass>(new ConstantFoldPass());
+}
+
+std::unique_ptr<IrPass> NewCopyPropagationPass() {
+    return std::unique_ptr<IrPass>(new CopyPropagationPass());
+}
+
+std::unique_ptr<IrPass> NewDeadCodePass() {
+    return std::unique_ptr<IrPass>(new DeadCodePass());
+}
+
+std::unique_ptr<IrPass> NewSimplifyCfgPass() {
+    return std::unique_ptr<IrPass>(new SimplifyCfgPass());
+}
+
+std::unique_ptr<IrPass> NewValueNumberingPass() {
+    return std::unique_ptr<IrPass>(new ValueNumberingPass());
+}
+
+void IrPassManager::Add(std::unique_ptr<IrPass> pass) {
+    IrPassStats stats;
+    stats.name = pass->Name();
+    stats_.push_back(stats);
+    passes_.push_back(std::move(pass));
+}
+
+void IrPassManager::AddDefaultPasses() {
+    Add(NewConstantFoldPass());
+    Add(NewCopyPropagationPass());
+    Add(NewValueNumberingPass());
+    Add(NewDeadCodePass());
+    Add(NewSimplifyCfgPass());
+}
+
+bool IrPassManager::Run(IrFunction& function, std::vector<std::string>& errors) {
+    if (verify_ && !VerifyIr(function, errors)) {
+        errors.push_back(function.Name() + ": invalid IR before optimization");
+        return false;
+    }
+    for (int round = 0; round < maxRounds_; round++) {
+        bool changed = false;
+        for (size_t i = 0; i < passes_.size(); i++) {
+            auto start = std::chrono::steady_clock::now();
+            bool passChanged = passes_[i]->Run(function);
+            auto& stats = stats_[i];
+            stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.runs++;
+            if (!passChanged)
+                continue;
+            stats.changes++;
+            changed = true;
+            if (verify_ && !VerifyIr(function, errors)) {
+                errors.push_back(function.Name() + ": invalid IR after " + stats.name);
+                return false;
+            }
+        }
+        if (!changed)
+            break;
+    }
+    return true;
+}
+
+bool IrPassManager::Run(IrModule& module, std::vector<std::string>& errors) {
+    bool ok = true;
+    for (auto& function : module.functions)
+        ok &= Run(*function, errors);
+    return ok;
+}
+
+void IrPassManager::Report(std::ostream& out) const {
+    double total = 0;
+    out << std::fixed << std::setprecision(3);
+    for (auto& stats : stats_) {
+        out << "pass " << std::left << std::setw(12) << stats.name << std::right
+            << std::setw(7) << stats.runs << " runs " << std::setw(7) << stats.changes << " changes "
+            << std::setw(10) << stats.seconds * 1000 << " ms" << std::endl;
+        total += stats.seconds;
+    }
+    out << "passes: " << total * 1000 << " ms" << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
+
+} // namespace zl
@@ -0,0 +1,84 @@
+#pragma once
+#include <stddef.h>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ir.h"
+
+namespace zl {
+
+// IrPass is an optimization of one function
+class IrPass {
+public:
+    virtual ~IrPass() {}
+    virtual const char* Name() const = 0;
+    // Return true if the function is changed
+    virtual bool Run(IrFunction& function) = 0;
+};
+
+// Whether the instruction has no effect but its value. Instructions which may
+// raise a runtime error, such as arithmetic on values of unknown types or
+// integer division by a value which may be zero, are not.
+bool IsPureInstruction(const IrInstruction* instruction);
+
+// Fold instructions of constant operands and integer identities, branches on
+// constants become jumps
+std::unique_ptr<IrPass> NewConstantFoldPass();
+// Replace copies and phis of a single value by the value
+std::unique_ptr<IrPass> NewCopyPropagationPass();
+// Erase pure instructions whose values are not used, dead phi cycles included
+std::unique_ptr<IrPass> NewDeadCodePass();
+// Remove unreachable blocks, forward empty blocks and merge blocks with
+// their single successor
+std::unique_ptr<IrPass> NewSimplifyCfgPass();
+// Replace pure instructions computing the same value as a dominating one
+std::unique_ptr<IrPass> NewValueNumberingPass();
+
+// IrPassStats are the statistics of one pass over all functions
+struct IrPassStats {
+    std::string name;
+    double seconds = 0;
+    size_t runs = 0;
+    // Number of runs which changed the function
+    size_t changes = 0;
+};
+
+// IrPassManager run the passes in order over each function. The pipeline is
+// repeated while a pass changes the function, at most maxRounds times, so
+// the optimization time is bounded by rounds of linear passes even on huge
+// generated functions.
+class IrPassManager {
+public:
+    IrPassManager(): verify_(false), maxRounds_(4) {}
+    ~IrPassManager() {}
+
+    void Add(std::unique_ptr<IrPass> pass);
+    // Add constant folding, copy propagation, value numbering, dead code
+    // elimination and CFG simplification
+    void AddDefaultPasses();
+    // Verify the function after each pass
+    void SetVerify(bool verify) { verify_ = verify; }
+    void SetMaxRounds(int rounds) { maxRounds_ = rounds; }
+
+    // Optimize the function, return false if the verifier fails, the
+    // problems are appended to errors
+    bool Run(IrFunction& function, std::vector<std::string>& errors);
+    bool Run(IrModule& module, std::vector<std::string>& errors);
+
+    const std::vector<IrPassStats>& Stats() const { return stats_; }
+    // Print the time, runs and changes of each pass
+    void Report(std::ostream& out) const;
+
+private:
+    IrPassManager(const IrPassManager&) = delete;
+    IrPassManager& operator = (const IrPassManager&) = delete;
+
+private:
+    std::vector<std::unique_ptr<IrPass>> passes_;
+    std::vector<IrPassStats> stats_;
+    bool verify_;
+    int maxRounds_;
+};
+
+} // namespace zl
@@ -0,0 +1,1308 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define ZL_JIT_SUPPORTED 1
+#endif
+#include "jit.h"
+#include "linear_scan.h"
+#include "runtime/object.h"
+#include "x64_assembler.h"
+
+namespace zl {
+
+namespace {
+
+typedef X64Assembler::Label Label;
+
+// Registers of the System V arguments
+const Gpr kArgumentGprs[] = {Gpr::Rdi, Gpr::Rsi, Gpr::Rdx, Gpr::Rcx, Gpr::R8, Gpr::R9};
+const size_t kArgumentGprCount = 6;
+const size_t kArgumentXmmCount = 8;
+// rax, rcx, rdx, r11, xmm0, xmm1 and xmm15 are never allocated, they are
+// the scratch registers of instructions. r11 and xmm15 hold a value while a
+// cycle of parallel moves is broken.
+const Gpr kCycleGpr = Gpr::R11;
+const Xmm kCycleXmm = Xmm::Xmm15;
+
+// The entry stub takes the argument registers in an array, the integer ones
+// first, and writes rax and xmm0 to the results
+typedef int (*EntryFunction)(const uint64_t* args, uint64_t* results, const void* target);
+
+bool IsFloatingType(IrType type) {
+    return type == IrType::Float || type == IrType::Double;
+}
+
+bool IsScalarType(IrType type) {
+    return type == IrType::Bool || IsNumericIrType(type);
+}
+
+X64Memory Frame(int32_t offset) {
+    return X64Memory(Gpr::Rbp, offset);
+}
+
+// Print the values of a print call, types has a letter per value
+void JitPrint(const uint64_t* values, const char* types, int64_t count) {
+    std::string text;
+    for (int64_t n = 0; n < count; n++) {
+        if (n > 0)
+            text += " ";
+        uint64_t bits = values[n];
+        switch (types[n]) {
+            case 'b':
+                text += ValueToString(Value::Bool(bits & 1));
+                break;
+            case 'i':
+                text += ValueToString(Value::Int(static_cast<int32_t>(bits)));
+                break;
+            case 'l':
+                text += std::to_string(static_cast<int64_t>(bits));
+                break;
+            case 'f': {
+                uint32_t low = static_cast<uint32_t>(bits);
+                float value;
+                memcpy(&value, &low, sizeof(value));
+                text += ValueToString(Value::Double(value));
+                break;
+            }
+            default: {
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                text += ValueToString(Value::Double(value));
+                break;
+            }
+        }
+    }
+    text += "\n";
+    fwrite(text.data(), 1, text.size(), stdout);
+}
+
+char TypeLetter(IrType type) {
+    switch (type) {
+        case IrType::Bool: return 'b';
+        case IrType::Int: return 'i';
+        case IrType::Long: return 'l';
+        case IrType::Float: return 'f';
+        default: return 'd';
+    }
+}
+
+// Return an empty string if the instructions of the function can be
+// compiled, the reason otherwise. Calls of functions other than print are
+// appended to calls, they are checked when all functions are known.
+std::string CheckFunction(const IrFunction& function, std::vector<const IrInstruction*>& calls) {
+    if (function.ResultTypes().size() > 1)
+        return "returns more than one value";
+    if (!function.ResultTypes().empty() && !IsScalarType(function.ResultTypes()[0]))
+        return std::string("returns ") + IrTypeName(function.ResultTypes()[0]);
+    size_t general = 0, floating = 0;
+    for (auto argument : function.Arguments()) {
+        if (!IsScalarType(argument->type))
+            return std::string("takes ") + IrTypeName(argument->type);
+        (IsFloatingType(argument->type) ? floating : general)++;
+    }
+    if (general > kArgumentGprCount || floating > kArgumentXmmCount)
+        return "takes arguments on the stack";
+
+    for (auto block : function.Blocks()) {
+        for (auto instruction : block->instructions) {
+            if (instruction->erased)
+                continue;
+            auto opcode = instruction->opcode;
+            IrType type = instruction->type;
+            auto& operands = instruction->operands;
+            if (type != IrType::Void && !IsScalarType(type))
+                return std::string("has ") + IrTypeName(type) + " values";
+            for (auto operand : operands) {
+                if (!IsScalarType(operand->type))
+                    return std::string("has ") + IrTypeName(operand->type) + " values";
+            }
+            switch (opcode) {
+                case IrOpcode::Add: case IrOpcode::Sub: case IrOpcode::Mul:
+                case IrOpcode::Div: case IrOpcode::Rem:
+                    if (!IsNumericIrType(type) || operands[0]->type != type || operands[1]->type != type)
+                        return std::string("has ") + IrOpcodeName(opcode) + " of mixed types";
+                    break;
+                case IrOpcode::And: case IrOpcode::Or: case IrOpcode::Xor:
+                case IrOpcode::Shl: case IrOpcode::Shr:
+                    if (!IsIntegerIrType(type) || operands[0]->type != type || operands[1]->type != type)
+                        return std::string("has ") + IrOpcodeName(opcode) + " of " + IrTypeName(type);
+                    break;
+                case IrOpcode::Neg:
+                    if (!IsNumericIrType(type) || operands[0]->type != type)
+                        return "has neg of mixed types";
+                    break;
+                case IrOpcode::Not:
+                case IrOpcode::Assert:
+                case IrOpcode::CondBr:
+                    if (operands[0]->type != IrType::Bool)
+                        return std::string("has ") + IrOpcodeName(opcode) + " of " + IrTypeName(operands[0]->type);
+                    break;
+                case IrOpcode::Eq: case IrOpcode::Ne:
+                case IrOpcode::Lt: case IrOpcode::Le: case IrOpcode::Gt:
+                case IrOpcode::Ge:
+                    if (operands[0]->type != operands[1]->type)
+                        return "compares values of different types";
+                    if (operands[0]->type == IrType::Bool && opcode != IrOpcode::Eq && opcode != IrOpcode::Ne)
+                        return "orders bool values";
+                    break;
+                case IrOpcode::Cast:
+                    if (!IsNumericIrType(type) || !IsNumericIrType(operands[0]->type))
+                        return "has a cast of bool";
+                    break;
+                case IrOpcode::Copy:
+                case IrOpcode::Phi:
+                case IrOpcode::Br:
+                    break;
+                case IrOpcode::Ret:
+                    if (operands.size() > 1)
+                        return "returns more than one value";
+                    break;
+                case IrOpcode::Call:
+                    if (instruction->name != "print")
+                        calls.push_back(instruction);
+                    break;
+                default:
+                    return std::string("uses ") + IrOpcodeName(opcode);
+            }
+        }
+    }
+    return "";
+}
+
+// Location of an operand in the code of an instruction
+struct Loc {
+    enum Kind : uint8_t {
+        Register,
+        Stack,
+        Constant,
+    };
+    Kind kind;
+    bool floating;
+    uint8_t reg;
+    int32_t offset;
+    const IrConstant* constant;
+
+    static Loc Of(Gpr reg) { return Loc{Register, false, static_cast<uint8_t>(reg), 0, nullptr}; }
+    static Loc Of(Xmm reg) { return Loc{Register, true, static_cast<uint8_t>(reg), 0, nullptr}; }
+    bool operator == (const Loc& rhs) const {
+        if (kind != rhs.kind)
+            return false;
+        if (kind == Register)
+            return floating == rhs.floating && reg == rhs.reg;
+        if (kind == Stack)
+            return offset == rhs.offset;
+        return constant == rhs.constant;
+    }
+};
+
+// FunctionCompiler emit the code of one function
+class FunctionCompiler {
+public:
+    FunctionCompiler(X64Assembler& assembler, const std::unordered_map<std::string, Label>& labels,
+            Jit::Context* context, Label errorExit, std::vector<std::string>& sites,
+            std::deque<std::string>& strings)
+        : asm_(assembler), labels_(labels), context_(context), errorExit_(errorExit), sites_(sites),
+          strings_(strings), allocator_(GeneralRegisters(), FloatingRegisters()), function_(nullptr),
+          frameSaved_(0), printOffset_(0), fused_(false), fusedCond_(Cond::Equal) {}
+
+    void Compile(const IrFunction& function, Label entry);
+    size_t SpillCount() const { return allocator_.SpillCount(); }
+
+private:
+    FunctionCompiler() = delete;
+
+    struct Move {
+        Loc dst;
+        Loc src;
+        IrType type;
+    };
+    struct ErrorSite {
+        Label label;
+        size_t site;
+    };
+
+    static RegisterClass GeneralRegisters();
+    static RegisterClass FloatingRegisters();
+    static bool IsCall(const IrInstruction* instruction);
+
+    Loc LocOf(const IrValue* value) const;
+    int64_t ConstantBits(const IrConstant* constant) const;
+    // Load the value into the register
+    void MoveTo(Gpr dst, const IrValue* value);
+    void MoveTo(Xmm dst, const IrValue* value);
+    // Return the register of the value, it is loaded into scratch if it is
+    // not in a register
+    Gpr Use(const IrValue* value, Gpr scratch);
+    Xmm Use(const IrValue* value, Xmm scratch);
+    // The register the result is computed in, scratch if the result is not
+    // in a register
+    Gpr Result(const IrInstruction* instruction, Gpr scratch);
+    Xmm Result(const IrInstruction* instruction, Xmm scratch);
+    // Store the result computed in the register to its location
+    void Finish(const IrInstruction* instruction, Gpr reg);
+    void Finish(const IrInstruction* instruction, Xmm reg);
+    // Apply the operation with the value as second operand
+    void AluWith(AluOp op, bool wide, Gpr dst, const IrValue* value);
+
+    void EmitMove(const Loc& dst, const Loc& src, IrType type);
+    // Emit the moves as if they were done at once
+    void ParallelMove(std::vector<Move> moves);
+    std::vector<Move> EdgeMoves(const IrBlock* from, const IrBlock* to);
+    Label NewErrorSite(const std::string& message);
+
+    void EmitInstruction(const IrInstruction* instruction, bool fuse);
+    void EmitIntegerBinary(const IrInstruction* instruction);
+    void EmitDivision(const IrInstruction* instruction);
+    void EmitFloatingBinary(const IrInstruction* instruction);
+    void EmitNeg(const IrInstruction* instruction);
+    // Emit the comparison, return the condition which is true if the result
+    // is true. Floating equality needs two flags and is materialized here.
+    Cond EmitCompare(const IrInstruction* instruction, bool materialize);
+    void EmitCast(const IrInstruction* instruction);
+    void EmitCall(const IrInstruction* instruction);
+    void EmitPrint(const IrInstruction* instruction);
+    void EmitBranch(const IrBlock* block, const IrBlock* next);
+    void EmitReturn(const IrInstruction* instruction);
+
+private:
+    X64Assembler& asm_;
+    const std::unordered_map<std::string, Label>& labels_;
+    Jit::Context* context_;
+    Label errorExit_;
+    std::vector<std::string>& sites_;
+    std::deque<std::string>& strings_;
+    LinearScanAllocator allocator_;
+    const IrFunction* function_;
+    std::vector<Label> blockLabels_;
+    std::vector<ErrorSite> errorSites_;
+    std::vector<Gpr> savedGprs_;
+    int32_t frameSaved_;
+    // Offset of the array of print arguments
+    int32_t printOffset_;
+    // The comparison before the branch left its condition in the flags
+    bool fused_;
+    Cond fusedCond_;
+};
+
+RegisterClass FunctionCompiler::GeneralRegisters() {
+    RegisterClass general;
+    for (auto reg : {Gpr::Rsi, Gpr::Rdi, Gpr::R8, Gpr::R9, Gpr::R10})
+        general.callerSaved.push_back(static_cast<uint8_t>(reg));
+    for (auto reg : {Gpr::Rbx, Gpr::R12, Gpr::R13, Gpr::R14, Gpr::R15})
+        general.calleeSaved.push_back(static_cast<uint8_t>(reg));
+    return general;
+}
+
+RegisterClass FunctionCompiler::FloatingRegisters() {
+    // System V has no callee saved xmm registers
+    RegisterClass floating;
+    for (int reg = 2; reg <= 14; reg++)
+        floating.callerSaved.push_back(static_cast<uint8_t>(reg));
+    return floating;
+}
+
+bool FunctionCompiler::IsCall(const IrInstruction* instruction) {
+    return instruction->opcode == IrOpcode::Call ||
+        (instruction->opcode == IrOpcode::Rem && IsFloatingType(instruction->type));
+}
+
+Loc FunctionCompiler::LocOf(const IrValue* value) const {
+    if (value->kind == IrValueKind::Constant)
+        return Loc{Loc::Constant, IsFloatingType(value->type), 0, 0, static_cast<const IrConstant*>(value)};
+    auto& location = allocator_.Location(value);
+    if (location.kind == ValueLocation::Register)
+        return Loc{Loc::Register, IsFloatingType(value->type), location.reg, 0, nullptr};
+    int32_t offset = -8 * (frameSaved_ + 1 + static_cast<int32_t>(location.slot));
+    return Loc{Loc::Stack, IsFloatingType(value->type), 0, offset, nullptr};
+}
+
+int64_t FunctionCompiler::ConstantBits(const IrConstant* constant) const {
+    if (constant->type == IrType::Double) {
+        int64_t bits;
+        memcpy(&bits, &constant->doubleValue, sizeof(bits));
+        return bits;
+    }
+    if (constant->type == IrType::Float) {
+        float value = static_cast<float>(constant->doubleValue);
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+    return constant->intValue;
+}
+
+void FunctionCompiler::MoveTo(Gpr dst, const IrValue* value) {
+    Loc loc = LocOf(value);
+    if (loc.kind == Loc::Register) {
+        if (static_cast<Gpr>(loc.reg) != dst)
+            asm_.Mov(true, dst, static_cast<Gpr>(loc.reg));
+    } else if (loc.kind == Loc::Stack) {
+        asm_.Mov(true, dst, Frame(loc.offset));
+    } else {
+        // Doubles are loaded as bits by the negation
+        bool wide = value->type == IrType::Long || value->type == IrType::Double;
+        asm_.MovImm(wide, dst, ConstantBits(loc.constant));
+    }
+}
+
+void FunctionCompiler::MoveTo(Xmm dst, const IrValue* value) {
+    Loc loc = LocOf(value);
+    if (loc.kind == Loc::Register) {
+        if (static_cast<Xmm>(loc.reg) != dst)
+            asm_.MovXmm(dst, static_cast<Xmm>(loc.reg));
+    } else if (loc.kind == Loc::Stack) {
+        asm_.MovXmm(value->type == IrType::Float, dst, Frame(loc.offset));
+    } else {
+        asm_.MovImm(true, Gpr::Rax, ConstantBits(loc.constant));
+        asm_.MovBits(true, dst, Gpr::Rax);
+    }
+}
+
+Gpr FunctionCompiler::Use(const IrValue* value, Gpr scratch) {
+    Loc loc = LocOf(value);
+    if (loc.kind == Loc::Register)
+        return static_cast<Gpr>(loc.reg);
+    MoveTo(scratch, value);
+    return scratch;
+}
+
+Xmm FunctionCompiler::Use(const IrValue* value, Xmm scratch) {
+    Loc loc = LocOf(value);
+    if (loc.kind == Loc::Register)
+        return static_cast<Xmm>(loc.reg);
+    MoveTo(scratch, value);
+    return scratch;
+}
+
+Gpr FunctionCompiler::Result(const IrInstruction* instruction, Gpr scratch) {
+    Loc loc = LocOf(instruction);
+    return loc.kind == Loc::Register ? static_cast<Gpr>(loc.reg) : scratch;
+}
+
+Xmm FunctionCompiler::Result(const IrInstruction* instruction, Xmm scratch) {
+    Loc loc = LocOf(instruction);
+    return loc.kind == Loc::Register ? static_cast<Xmm>(loc.reg) : scratch;
+}
+
+void FunctionCompiler::Finish(const IrInstruction* instruction, Gpr reg) {
+    Loc loc = LocOf(instruction);
+    if (loc.kind == Loc::Register && static_cast<Gpr>(loc.reg) != reg)
+        asm_.Mov(true, static_cast<Gpr>(loc.reg), reg);
+    else if (loc.kind == Loc::Stack)
+        asm_.Mov(true, Frame(loc.offset), reg);
+}
+
+void FunctionCompiler::Finish(const IrInstruction* instruction, Xmm reg) {
+    Loc loc = LocOf(instruction);
+    if (loc.kind == Loc::Register && static_cast<Xmm>(loc.reg) != reg)
+        asm_.MovXmm(static_cast<Xmm>(loc.reg), reg);
+    else if (loc.kind == Loc::Stack)
+        asm_.MovXmm(instruction->type == IrType::Float, Frame(loc.offset), reg);
+}
+
+void FunctionCompiler::AluWith(AluOp op, bool wide, Gpr dst, const IrValue* value) {
+    Loc loc = LocOf(value);
+    if (loc.kind == Loc::Register) {
+        asm_.Alu(op, wide, dst, static_cast<Gpr>(loc.reg));
+    } else if (loc.kind == Loc::Stack) {
+        asm_.Alu(op, wide, dst, Frame(loc.offset));
+    } else {
+        int64_t bits = ConstantBits(loc.constant);
+        if (bits >= INT32_MIN && bits <= INT32_MAX) {
+            asm_.Alu(op, wide, dst, static_cast<int32_t>(bits));
+        } else {
+            asm_.MovImm(true, Gpr::Rcx, bits);
+            asm_.Alu(op, wide, dst, Gpr::Rcx);
+        }
+    }
+}
+
+void FunctionCompiler::EmitMove(const Loc& dst, const Loc& src, IrType type) {
+    bool single = type == IrType::Float;
+    if (src.kind == Loc::Constant) {
+        int64_t bits = ConstantBits(src.constant);
+        if (dst.kind == Loc::Register && !dst.floating) {
+            asm_.MovImm(type == IrType::Long, static_cast<Gpr>(dst.reg), bits);
+        } else if (dst.kind == Loc::Register) {
+            asm_.MovImm(true, Gpr::Rax, bits);
+            asm_.MovBits(true, static_cast<Xmm>(dst.reg), Gpr::Rax);
+        } else if (bits >= INT32_MIN && bits <= INT32_MAX) {
+            asm_.MovImm(true, Frame(dst.offset), static_cast<int32_t>(bits));
+        } else {
+            asm_.MovImm(true, Gpr::Rax, bits);
+            asm_.Mov(true, Frame(dst.offset), Gpr::Rax);
+        }
+        return;
+    }
+    if (dst.kind == Loc::Stack && src.kind == Loc::Stack) {
+        asm_.Mov(true, Gpr::Rax, Frame(src.offset));
+        asm_.Mov(true, Frame(dst.offset), Gpr::Rax);
+        return;
+    }
+    if (!dst.floating) {
+        if (dst.kind == Loc::Register && src.kind == Loc::Register)
+            asm_.Mov(true, static_cast<Gpr>(dst.reg), static_cast<Gpr>(src.reg));
+        else if (dst.kind == Loc::Register)
+            asm_.Mov(true, static_cast<Gpr>(dst.reg), Frame(src.offset));
+        else
+            asm_.Mov(true, Frame(dst.offset), static_cast<Gpr>(src.reg));
+        return;
+    }
+    if (dst.kind == Loc::Register && src.kind == Loc::Register)
+        asm_.MovXmm(static_cast<Xmm>(dst.reg), static_cast<Xmm>(src.reg));
+    else if (dst.kind == Loc::Register)
+        asm_.MovXmm(single, static_cast<Xmm>(dst.reg), Frame(src.offset));
+    else
+        asm_.MovXmm(single, Frame(dst.offset), static_cast<Xmm>(src.reg));
+}
+
+void FunctionCompiler::ParallelMove(std::vector<Move> moves) {
+    moves.erase(std::remove_if(moves.begin(), moves.end(), [](const Move& move) {
+        return move.dst == move.src;
+    }), moves.end());
+    while (!moves.empty()) {
+        // A move is emitted when no other move still reads its destination
+        bool emitted = false;
+        for (size_t i = 0; i < moves.size() && !emitted; i++) {
+            bool read = false;
+            for (size_t j = 0; j < moves.size() && !read; j++)
+                read = j != i && moves[j].src == moves[i].dst;
+            if (read)
+                continue;
+            EmitMove(moves[i].dst, moves[i].src, moves[i].type);
+            moves.erase(moves.begin() + i);
+            emitted = true;
+        }
+        if (emitted)
+            continue;
+        // Every destination is read, the moves are cycles. One destination
+        // is saved in the cycle register and read from there.
+        Loc blocked = moves[0].dst;
+        Loc temp = blocked.floating ? Loc::Of(kCycleXmm) : Loc::Of(kCycleGpr);
+        EmitMove(temp, blocked, moves[0].type);
+        for (auto& move : moves) {
+            if (move.src == blocked)
+                move.src = temp;
+        }
+    }
+}
+
+std::vector<FunctionCompiler::Move> FunctionCompiler::EdgeMoves(const IrBlock* from, const IrBlock* to) {
+    std::vector<Move> moves;
+    auto pred = std::find(to->preds.begin(), to->preds.end(), from);
+    size_t index = pred - to->preds.begin();
+    for (auto instruction : to->instructions) {
+        if (instruction->opcode != IrOpcode::Phi)
+            break;
+        moves.push_back({LocOf(instruction), LocOf(instruction->operands[index]), instruction->type});
+    }
+    return moves;
+}
+
+Label FunctionCompiler::NewErrorSite(const std::string& message) {
+    Label label = asm_.NewLabel();
+    errorSites_.push_back({label, sites_.size()});
+    sites_.push_back(function_->Name() + ": " + message);
+    return label;
+}
+
+void FunctionCompiler::Compile(const IrFunction& function, Label entry) {
+    function_ = &function;
+    IrDominatorTree dominators(function);
+    auto& order = dominators.ReversePostorder();
+    allocator_.Allocate(function, order, IsFloatingType, IsCall);
+
+    uint32_t maxBlockId = 0;
+    size_t printValues = 0;
+    for (auto block : order) {
+        maxBlockId = std::max(maxBlockId, block->id);
+        for (auto instruction : block->instructions) {
+            if (instruction->opcode == IrOpcode::Call && instruction->name == "print")
+                printValues = std::max(printValues, instruction->operands.size());
+        }
+    }
+    blockLabels_.assign(maxBlockId + 1, 0);
+    for (auto block : order)
+        blockLabels_[block->id] = asm_.NewLabel();
+
+    // Frame: saved callee saved registers, spill slots and the print array
+    for (auto reg : allocator_.UsedCalleeSaved(false))
+        savedGprs_.push_back(static_cast<Gpr>(reg));
+    frameSaved_ = static_cast<int32_t>(savedGprs_.size());
+    int32_t words = frameSaved_ + static_cast<int32_t>(allocator_.SlotCount() + printValues);
+    printOffset_ = -8 * words;
+    int32_t frameSize = (words * 8 + 15) & ~15;
+
+    asm_.Bind(entry);
+    asm_.Push(Gpr::Rbp);
+    asm_.Mov(true, Gpr::Rbp, Gpr::Rsp);
+    if (frameSize)
+        asm_.Alu(AluOp::Sub, true, Gpr::Rsp, frameSize);
+    for (size_t n = 0; n < savedGprs_.size(); n++)
+        asm_.Mov(true, Frame(-8 * static_cast<int32_t>(n + 1)), savedGprs_[n]);
+
+    // Arguments move from their registers to their locations
+    std::vector<Move> moves;
+    size_t general = 0, floating = 0;
+    for (auto argument : function.Arguments()) {
+        Loc src = IsFloatingType(argument->type) ? Loc::Of(static_cast<Xmm>(floating++)) :
+            Loc::Of(kArgumentGprs[general++]);
+        if (!argument->users.empty())
+            moves.push_back({LocOf(argument), src, argument->type});
+    }
+    ParallelMove(moves);
+
+    for (size_t n = 0; n < order.size(); n++) {
+        auto block = order[n];
+        asm_.Bind(blockLabels_[block->id]);
+        fused_ = false;
+        auto& instructions = block->instructions;
+        for (size_t i = 0; i < instructions.size(); i++) {
+            auto instruction = instructions[i];
+            if (IsTerminator(instruction->opcode))
+                break;
+            // A comparison only used by the branch right after it leaves its
+            // result in the flags
+            bool fuse = i + 2 == instructions.size() && instructions[i + 1]->opcode == IrOpcode::CondBr &&
+                instructions[i + 1]->operands[0] == instruction && instruction->users.size() == 1;
+            EmitInstruction(instruction, fuse);
+        }
+        auto terminator = block->Terminator();
+        if (terminator->opcode == IrOpcode::Ret)
+            EmitReturn(terminator);
+        else
+            EmitBranch(block, n + 1 < order.size() ? order[n + 1] : nullptr);
+    }
+
+    // Runtime errors are out of line after the function
+    for (auto& site : errorSites_) {
+        asm_.Bind(site.label);
+        asm_.MovImm(true, Gpr::Rax, reinterpret_cast<int64_t>(context_));
+        asm_.MovImm(false, X64Memory(Gpr::Rax, offsetof(Jit::Context, errorSite)),
+            static_cast<int32_t>(site.site));
+        asm_.Jmp(errorExit_);
+    }
+}
+
+void FunctionCompiler::EmitInstruction(const IrInstruction* instruction, bool fuse) {
+    IrType type = instruction->type;
+    switch (instruction->opcode) {
+        case IrOpcode::Add: case IrOpcode::Sub: case IrOpcode::Mul:
+            if (IsFloatingType(type))
+                EmitFloatingBinary(instruction);
+            else
+                EmitIntegerBinary(instruction);
+            break;
+        case IrOpcode::Div: case IrOpcode::Rem:
+            if (IsFloatingType(type))
+                EmitFloatingBinary(instruction);
+            else
+                EmitDivision(instruction);
+            break;
+        case IrOpcode::And: case IrOpcode::Or: case IrOpcode::Xor:
+        case IrOpcode::Shl: case IrOpcode::Shr:
+            EmitIntegerBinary(instruction);
+            break;
+        case IrOpcode::Neg:
+            EmitNeg(instruction);
+            break;
+        case IrOpcode::Not: {
+            Gpr dst = Result(instruction, Gpr::Rax);
+            MoveTo(dst, instruction->operands[0]);
+            asm_.Alu(AluOp::Xor, false, dst, 1);
+            Finish(instruction, dst);
+            break;
+        }
+        case IrOpcode::Eq: case IrOpcode::Ne: case IrOpcode::Lt:
+        case IrOpcode::Le: case IrOpcode::Gt: case IrOpcode::Ge: {
+            auto operandType = instruction->operands[0]->type;
+            bool twoFlags = IsFloatingType(operandType) &&
+                (instruction->opcode == IrOpcode::Eq || instruction->opcode == IrOpcode::Ne);
+            fused_ = fuse && !twoFlags;
+            fusedCond_ = EmitCompare(instruction, !fused_);
+            break;
+        }
+        case IrOpcode::Cast:
+            EmitCast(instruction);
+            break;
+        case IrOpcode::Copy:
+            ParallelMove({{LocOf(instruction), LocOf(instruction->operands[0]), type}});
+            break;
+        case IrOpcode::Phi:
+            break;
+        case IrOpcode::Call:
+            if (instruction->name == "print")
+                EmitPrint(instruction);
+            else
+                EmitCall(instruction);
+            break;
+        case IrOpcode::Assert: {
+            auto condition = instruction->operands[0];
+            Loc loc = LocOf(condition);
+            if (loc.kind == Loc::Constant) {
+                if (!loc.constant->intValue)
+                    asm_.Jmp(NewErrorSite("assertion failed"));
+                break;
+            }
+            Gpr reg = Use(condition, Gpr::Rax);
+            asm_.Test(false, reg, reg);
+            asm_.Jcc(Cond::Equal, NewErrorSite("assertion failed"));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void FunctionCompiler::EmitIntegerBinary(const IrInstruction* instruction) {
+    bool wide = instruction->type == IrType::Long;
+    auto a = instruction->operands[0];
+    auto b = instruction->operands[1];
+    // The result never shares a register with an operand, their intervals
+    // overlap at the instruction
+    Gpr dst = Result(instruction, Gpr::Rax);
+    switch (instruction->opcode) {
+        case IrOpcode::Shl:
+        case IrOpcode::Shr: {
+            bool left = instruction->opcode == IrOpcode::Shl;
+            Loc count = LocOf(b);
+            if (count.kind == Loc::Constant) {
+                MoveTo(dst, a);
+                uint8_t bits = static_cast<uint8_t>(count.constant->intValue & (wide ? 63 : 31));
+                if (bits && left)
+                    asm_.Shl(wide, dst, bits);
+                else if (bits)
+                    asm_.Sar(wide, dst, bits);
+            } else {
+                MoveTo(Gpr::Rcx, b);
+                MoveTo(dst, a);
+                if (left)
+                    asm_.Shl(wide, dst);
+                else
+                    asm_.Sar(wide, dst);
+            }
+            break;
+        }
+        case IrOpcode::Mul: {
+            Loc loc = LocOf(b);
+            if (loc.kind == Loc::Constant && loc.constant->intValue >= INT32_MIN &&
+                    loc.constant->intValue <= INT32_MAX) {
+                Gpr reg = Use(a, Gpr::Rax);
+                asm_.Imul(wide, dst, reg, static_cast<int32_t>(loc.constant->intValue));
+                break;
+            }
+            MoveTo(dst, a);
+            if (loc.kind == Loc::Register) {
+                asm_.Imul(wide, dst, static_cast<Gpr>(loc.reg));
+            } else if (loc.kind == Loc::Stack) {
+                asm_.Imul(wide, dst, Frame(loc.offset));
+            } else {
+                MoveTo(Gpr::Rcx, b);
+                asm_.Imul(wide, dst, Gpr::Rcx);
+            }
+            break;
+        }
+        default: {
+            AluOp op = AluOp::Add;
+            switch (instruction->opcode) {
+                case IrOpcode::Sub: op = AluOp::Sub; break;
+                case IrOpcode::And: op = AluOp::And; break;
+                case IrOpcode::Or: op = AluOp::Or; break;
+                case IrOpcode::Xor: op = AluOp::Xor; break;
+                default: break;
+            }
+            MoveTo(dst, a);
+            AluWith(op, wide, dst, b);
+            break;
+        }
+    }
+    Finish(instruction, dst);
+}
+
+void FunctionCompiler::EmitDivision(const IrInstruction* instruction) {
+    bool wide = instruction->type == IrType::Long;
+    bool division = instruction->opcode == IrOpcode::Div;
+    auto b = instruction->operands[1];
+    Loc divisor = LocOf(b);
+    bool constant = divisor.kind == Loc::Constant;
+    MoveTo(Gpr::Rcx, b);
+    if (!constant || divisor.constant->intValue == 0) {
+        asm_.Test(wide, Gpr::Rcx, Gpr::Rcx);
+        asm_.Jcc(Cond::Equal, NewErrorSite("division by zero"));
+    }
+    MoveTo(Gpr::Rax, instruction->operands[0]);
+    if (!wide) {
+        // int is divided in 64 bits, the quotient of INT_MIN / -1 wraps
+        // instead of trapping
+        asm_.Movsxd(Gpr::Rax, Gpr::Rax);
+        asm_.Movsxd(Gpr::Rcx, Gpr::Rcx);
+        asm_.Cqo();
+        asm_.Idiv(true, Gpr::Rcx);
+    } else if (constant && divisor.constant->intValue != -1) {
+        asm_.Cqo();
+        asm_.Idiv(true, Gpr::Rcx);
+    } else {
+        // Division of long by -1 is a negation, idiv traps on LONG_MIN
+        Label divide = asm_.NewLabel();
+        Label done = asm_.NewLabel();
+        asm_.Alu(AluOp::Cmp, true, Gpr::Rcx, -1);
+        asm_.Jcc(Cond::NotEqual, divide);
+        if (division)
+            asm_.Neg(true, Gpr::Rax);
+        else
+            asm_.MovImm(false, Gpr::Rdx, 0);
+        asm_.Jmp(done);
+        asm_.Bind(divide);
+        asm_.Cqo();
+        asm_.Idiv(true, Gpr::Rcx);
+        asm_.Bind(done);
+    }
+    Finish(instruction, division ? Gpr::Rax : Gpr::Rdx);
+}
+
+void FunctionCompiler::EmitFloatingBinary(const IrInstruction* instruction) {
+    bool single = instruction->type == IrType::Float;
+    auto a = instruction->operands[0];
+    auto b = instruction->operands[1];
+    if (instruction->opcode == IrOpcode::Rem) {
+        // fmod of the C library, float is computed in double
+        MoveTo(Xmm::Xmm0, a);
+        MoveTo(Xmm::Xmm1, b);
+        if (single) {
+            asm_.CvtFloat(false, Xmm::Xmm0, Xmm::Xmm0);
+            asm_.CvtFloat(false, Xmm::Xmm1, Xmm::Xmm1);
+        }
+        double (*remainder)(double, double) = fmod;
+        asm_.MovImm(true, Gpr::Rax, reinterpret_cast<int64_t>(remainder));
+        asm_.Call(Gpr::Rax);
+        if (single)
+            asm_.CvtFloat(true, Xmm::Xmm0, Xmm::Xmm0);
+        Finish(instruction, Xmm::Xmm0);
+        return;
+    }
+    SseOp op = SseOp::Add;
+    switch (instruction->opcode) {
+        case IrOpcode::Sub: op = SseOp::Sub; break;
+        case IrOpcode::Mul: op = SseOp::Mul; break;
+        case IrOpcode::Div: op = SseOp::Div; break;
+        default: break;
+    }
+    Xmm dst = Result(instruction, Xmm::Xmm0);
+    MoveTo(dst, a);
+    Loc loc = LocOf(b);
+    if (loc.kind == Loc::Register)
+        asm_.Sse(op, single, dst, static_cast<Xmm>(loc.reg));
+    else if (loc.kind == Loc::Stack)
+        asm_.Sse(op, single, dst, Frame(loc.offset));
+    else
+        asm_.Sse(op, single, dst, Use(b, Xmm::Xmm1));
+    Finish(instruction, dst);
+}
+
+void FunctionCompiler::EmitNeg(const IrInstruction* instruction) {
+    IrType type = instruction->type;
+    auto a = instruction->operands[0];
+    if (!IsFloatingType(type)) {
+        Gpr dst = Result(instruction, Gpr::Rax);
+        MoveTo(dst, a);
+        asm_.Neg(type == IrType::Long, dst);
+        Finish(instruction, dst);
+        return;
+    }
+    // Flip the sign bit, so that the negation of 0 is -0
+    Loc loc = LocOf(a);
+    if (loc.kind == Loc::Register)
+        asm_.MovBits(true, Gpr::Rax, static_cast<Xmm>(loc.reg));
+    else
+        MoveTo(Gpr::Rax, a);
+    if (type == IrType::Float) {
+        asm_.Alu(AluOp::Xor, false, Gpr::Rax, static_cast<int32_t>(0x80000000u));
+    } else {
+        asm_.MovImm(true, Gpr::Rcx, INT64_MIN);
+        asm_.Alu(AluOp::Xor, true, Gpr::Rax, Gpr::Rcx);
+    }
+    Loc result = LocOf(instruction);
+    if (result.kind == Loc::Register)
+        asm_.MovBits(true, static_cast<Xmm>(result.reg), Gpr::Rax);
+    else
+        asm_.Mov(true, Frame(result.offset), Gpr::Rax);
+}
+
+Cond FunctionCompiler::EmitCompare(const IrInstruction* instruction, bool materialize) {
+    auto a = instruction->operands[0];
+    auto b = instruction->operands[1];
+    auto opcode = instruction->opcode;
+    Cond cond = Cond::Equal;
+    bool twoFlags = false;
+    if (!IsFloatingType(a->type)) {
+        // The constant goes second, the order is mirrored
+        if (a->kind == IrValueKind::Constant && b->kind != IrValueKind::Constant) {
+            std::swap(a, b);
+            switch (opcode) {
+                case IrOpcode::Lt: opcode = IrOpcode::Gt; break;
+                case IrOpcode::Le: opcode = IrOpcode::Ge; break;
+                case IrOpcode::Gt: opcode = IrOpcode::Lt; break;
+                case IrOpcode::Ge: opcode = IrOpcode::Le; break;
+                default: break;
+            }
+        }
+        bool wide = a->type == IrType::Long;
+        AluWith(AluOp::Cmp, wide, Use(a, Gpr::Rax), b);
+        switch (opcode) {
+            case IrOpcode::Eq: cond = Cond::Equal; break;
+            case IrOpcode::Ne: cond = Cond::NotEqual; break;
+            case IrOpcode::Lt: cond = Cond::Less; break;
+            case IrOpcode::Le: cond = Cond::LessEqual; break;
+            case IrOpcode::Gt: cond = Cond::Greater; break;
+            default: cond = Cond::GreaterEqual; break;
+        }
+    } else {
+        // Unordered comparisons set CF, only above and above or equal are
+        // false for NaN
+        bool single = a->type == IrType::Float;
+        Xmm x = Use(a, Xmm::Xmm0);
+        Xmm y = Use(b, Xmm::Xmm1);
+        switch (opcode) {
+            case IrOpcode::Lt: asm_.Ucomi(single, y, x); cond = Cond::Above; break;
+            case IrOpcode::Le: asm_.Ucomi(single, y, x); cond = Cond::AboveEqual; break;
+            case IrOpcode::Gt: asm_.Ucomi(single, x, y); cond = Cond::Above; break;
+            case IrOpcode::Ge: asm_.Ucomi(single, x, y); cond = Cond::AboveEqual; break;
+            default: asm_.Ucomi(single, x, y); twoFlags = true; break;
+        }
+    }
+    if (!materialize)
+        return cond;
+    Gpr dst = Result(instruction, Gpr::Rax);
+    if (twoFlags) {
+        bool equal = opcode == IrOpcode::Eq;
+        asm_.Setcc(equal ? Cond::Equal : Cond::NotEqual, Gpr::Rax);
+        asm_.Setcc(equal ? Cond::NoParity : Cond::Parity, Gpr::Rcx);
+        asm_.Alu(equal ? AluOp::And : AluOp::Or, false, Gpr::Rax, Gpr::Rcx);
+        asm_.Movzx8(dst, Gpr::Rax);
+    } else {
+        asm_.Setcc(cond, dst);
+        asm_.Movzx8(dst, dst);
+    }
+    Finish(instruction, dst);
+    return Cond::NotEqual;
+}
+
+void FunctionCompiler::EmitCast(const IrInstruction* instruction) {
+    auto a = instruction->operands[0];
+    IrType from = a->type;
+    IrType to = instruction->type;
+    if (from == to) {
+        ParallelMove({{LocOf(instruction), LocOf(a), to}});
+        return;
+    }
+    if (!IsFloatingType(from) && !IsFloatingType(to)) {
+        Gpr src = Use(a, Gpr::Rax);
+        Gpr dst = Result(instruction, Gpr::Rax);
+        if (to == IrType::Long)
+            asm_.Movsxd(dst, src);
+        else
+            asm_.Mov(false, dst, src);
+        Finish(instruction, dst);
+    } else if (!IsFloatingType(from)) {
+        Gpr src = Use(a, Gpr::Rax);
+        Xmm dst = Result(instruction, Xmm::Xmm0);
+        asm_.CvtIntToFloat(to == IrType::Float, from == IrType::Long, dst, src);
+        Finish(instruction, dst);
+    } else if (!IsFloatingType(to)) {
+        Xmm src = Use(a, Xmm::Xmm0);
+        Gpr dst = Result(instruction, Gpr::Rax);
+        asm_.CvtFloatToInt(from == IrType::Float, to == IrType::Long, dst, src);
+        Finish(instruction, dst);
+    } else {
+        Xmm src = Use(a, Xmm::Xmm0);
+        Xmm dst = Result(instruction, Xmm::Xmm0);
+        asm_.CvtFloat(to == IrType::Float, dst, src);
+        Finish(instruction, dst);
+    }
+}
+
+void FunctionCompiler::EmitCall(const IrInstruction* instruction) {
+    std::vector<Move> moves;
+    size_t general = 0, floating = 0;
+    for (auto operand : instruction->operands) {
+        Loc dst = IsFloatingType(operand->type) ? Loc::Of(static_cast<Xmm>(floating++)) :
+            Loc::Of(kArgumentGprs[general++]);
+        moves.push_back({dst, LocOf(operand), operand->type});
+    }
+    ParallelMove(moves);
+    asm_.Call(labels_.at(instruction->name));
+    if (instruction->type == IrType::Void)
+        return;
+    if (IsFloatingType(instruction->type))
+        Finish(instruction, Xmm::Xmm0);
+    else
+        Finish(instruction, Gpr::Rax);
+}
+
+void FunctionCompiler::EmitPrint(const IrInstruction* instruction) {
+    // The values are stored in an array of the frame first, the caller
+    // saved registers holding them are clobbered by the call
+    std::string types;
+    auto& operands = instruction->operands;
+    for (size_t n = 0; n < operands.size(); n++) {
+        X64Memory slot = Frame(printOffset_ + 8 * static_cast<int32_t>(n));
+        auto operand = operands[n];
+        if (IsFloatingType(operand->type))
+            asm_.MovXmm(operand->type == IrType::Float, slot, Use(operand, Xmm::Xmm0));
+        else
+            asm_.Mov(true, slot, Use(operand, Gpr::Rax));
+        types += TypeLetter(operand->type);
+    }
+    strings_.push_back(types);
+    asm_.Mov(true, Gpr::Rdi, Gpr::Rbp);
+    asm_.Alu(AluOp::Add, true, Gpr::Rdi, printOffset_);
+    asm_.MovImm(true, Gpr::Rsi, reinterpret_cast<int64_t>(strings_.back().c_str()));
+    asm_.MovImm(false, Gpr::Rdx, static_cast<int64_t>(operands.size()));
+    asm_.MovImm(true, Gpr::Rax, reinterpret_cast<int64_t>(&JitPrint));
+    asm_.Call(Gpr::Rax);
+}
+
+void FunctionCompiler::EmitBranch(const IrBlock* block, const IrBlock* next) {
+    auto terminator = block->Terminator();
+    auto label = [&](const IrBlock* target) {
+        return blockLabels_[target->id];
+    };
+    if (terminator->opcode == IrOpcode::Br) {
+        auto target = terminator->targets[0];
+        ParallelMove(EdgeMoves(block, target));
+        if (target != next)
+            asm_.Jmp(label(target));
+        return;
+    }
+
+    auto taken = terminator->targets[0];
+    auto other = terminator->targets[1];
+    Cond cond = Cond::NotEqual;
+    if (fused_) {
+        cond = fusedCond_;
+    } else {
+        auto condition = terminator->operands[0];
+        Loc loc = LocOf(condition);
+        if (loc.kind == Loc::Constant) {
+            auto target = loc.constant->intValue ? taken : other;
+            ParallelMove(EdgeMoves(block, target));
+            if (target != next)
+                asm_.Jmp(label(target));
+            return;
+        }
+        if (loc.kind == Loc::Register)
+            asm_.Test(false, static_cast<Gpr>(loc.reg), static_cast<Gpr>(loc.reg));
+        else
+            asm_.Alu(AluOp::Cmp, false, Frame(loc.offset), 0);
+    }
+
+    auto takenMoves = EdgeMoves(block, taken);
+    auto otherMoves = EdgeMoves(block, other);
+    if (takenMoves.empty() && otherMoves.empty()) {
+        if (taken == next) {
+            asm_.Jcc(InvertCond(cond), label(other));
+            return;
+        }
+        asm_.Jcc(cond, label(taken));
+        if (other != next)
+            asm_.Jmp(label(other));
+        return;
+    }
+    // The moves of each edge are on their own path, they do not change the
+    // flags
+    Label takenPath = asm_.NewLabel();
+    asm_.Jcc(cond, takenPath);
+    ParallelMove(otherMoves);
+    asm_.Jmp(label(other));
+    asm_.Bind(takenPath);
+    ParallelMove(takenMoves);
+    if (taken != next)
+        asm_.Jmp(label(taken));
+}
+
+void FunctionCompiler::EmitReturn(const IrInstruction* instruction) {
+    if (!instruction->operands.empty()) {
+        auto value = instruction->operands[0];
+        if (IsFloatingType(value->type))
+            MoveTo(Xmm::Xmm0, value);
+        else
+            MoveTo(Gpr::Rax, value);
+    }
+    for (size_t n = 0; n < savedGprs_.size(); n++)
+        asm_.Mov(true, savedGprs_[n], Frame(-8 * static_cast<int32_t>(n + 1)));
+    asm_.Mov(true, Gpr::Rsp, Gpr::Rbp);
+    asm_.Pop(Gpr::Rbp);
+    asm_.Ret();
+}
+
+// Emit the entry stub at the start of the code, return the label runtime
+// errors jump to
+Label EmitEntry(X64Assembler& assembler, Jit::Context* context) {
+    const Gpr saved[] = {Gpr::Rbx, Gpr::R12, Gpr::R13, Gpr::R14, Gpr::R15};
+    assembler.Push(Gpr::Rbp);
+    assembler.Mov(true, Gpr::Rbp, Gpr::Rsp);
+    for (auto reg : saved)
+        assembler.Push(reg);
+    // The results pointer, the stack is aligned to 16 bytes for the call
+    assembler.Push(Gpr::Rsi);
+    assembler.MovImm(true, Gpr::Rax, reinterpret_cast<int64_t>(context));
+    assembler.Mov(true, X64Memory(Gpr::Rax, offsetof(Jit::Context, savedStack)), Gpr::Rsp);
+    assembler.Mov(true, Gpr::R11, Gpr::Rdx);
+    assembler.Mov(true, Gpr::Rax, Gpr::Rdi);
+    for (int n = 0; n < static_cast<int>(kArgumentXmmCount); n++)
+        assembler.MovXmm(false, static_cast<Xmm>(n), X64Memory(Gpr::Rax, 8 * (kArgumentGprCount + n)));
+    for (int n = 0; n < static_cast<int>(kArgumentGprCount); n++)
+        assembler.Mov(true, kArgumentGprs[n], X64Memory(Gpr::Rax, 8 * n));
+    assembler.Call(Gpr::R11);
+    assembler.Pop(Gpr::Rsi);
+    assembler.Mov(true, X64Memory(Gpr::Rsi, 0), Gpr::Rax);
+    assembler.MovXmm(false, X64Memory(Gpr::Rsi, 8), Xmm::Xmm0);
+    assembler.MovImm(false, Gpr::Rax, 1);
+    Label exit = assembler.NewLabel();
+    assembler.Bind(exit);
+    for (int n = 4; n >= 0; n--)
+        assembler.Pop(saved[n]);
+    assembler.Pop(Gpr::Rbp);
+    assembler.Ret();
+
+    // Runtime errors drop the frames of compiled code and return 0
+    Label error = assembler.NewLabel();
+    assembler.Bind(error);
+    assembler.MovImm(true, Gpr::Rax, reinterpret_cast<int64_t>(context));
+    assembler.Mov(true, Gpr::Rsp, X64Memory(Gpr::Rax, offsetof(Jit::Context, savedStack)));
+    assembler.Pop(Gpr::Rsi);
+    assembler.MovImm(false, Gpr::Rax, 0);
+    assembler.Jmp(exit);
+    return error;
+}
+
+} // namespace
+
+JitValue JitValue::Integer(IrType type, int64_t value) {
+    JitValue result;
+    result.type = type;
+    result.intValue = value;
+    return result;
+}
+
+JitValue JitValue::Floating(IrType type, double value) {
+    JitValue result;
+    result.type = type;
+    result.doubleValue = value;
+    return result;
+}
+
+bool Jit::Supported() {
+#ifdef ZL_JIT_SUPPORTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+Jit::Jit(): context_(new Context()), code_(nullptr), codeSize_(0) {
+    context_->savedStack = 0;
+    context_->errorSite = -1;
+}
+
+Jit::~Jit() {
+    Release();
+}
+
+void Jit::Release() {
+#ifdef ZL_JIT_SUPPORTED
+    if (code_)
+        munmap(code_, codeSize_);
+#endif
+    code_ = nullptr;
+    codeSize_ = 0;
+}
+
+bool Jit::Compile(const IrModule& module) {
+    auto start = std::chrono::steady_clock::now();
+    Release();
+    functions_.clear();
+    sites_.clear();
+    strings_.clear();
+    skipped_.clear();
+    error_.clear();
+    stats_ = JitStats();
+
+    std::unordered_map<std::string, const IrFunction*> byName;
+    std::unordered_map<std::string, std::vector<const IrInstruction*>> calls;
+    std::unordered_set<std::string> compiled;
+    std::unordered_map<std::string, std::string> reasons;
+    for (auto& function : module.functions) {
+        auto& name = function->Name();
+        byName[name] = function.get();
+        std::string reason = CheckFunction(*function, calls[name]);
+        if (reason.empty())
+            compiled.insert(name);
+        else
+            reasons[name] = reason;
+    }
+    // A function is compiled if the functions it calls are, with the
+    // arguments and results they take
+    for (bool dropped = true; dropped;) {
+        dropped = false;
+        for (auto& function : module.functions) {
+            auto& name = function->Name();
+            if (!compiled.count(name))
+                continue;
+            for (auto call : calls[name]) {
+                std::string reason;
+                auto callee = byName.find(call->name);
+                if (callee == byName.end() || !compiled.count(call->name)) {
+                    reason = "calls " + call->name + " which is not compiled";
+                } else {
+                    auto& arguments = callee->second->Arguments();
+                    auto& results = callee->second->ResultTypes();
+                    bool match = arguments.size() == call->operands.size() &&
+                        call->type == (results.empty() ? IrType::Void : results[0]);
+                    for (size_t n = 0; match && n < arguments.size(); n++)
+                        match = arguments[n]->type == call->operands[n]->type;
+                    if (!match)
+                        reason = "calls " + call->name + " with other types";
+                }
+                if (!reason.empty()) {
+                    compiled.erase(name);
+                    reasons[name] = reason;
+                    dropped = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    X64Assembler assembler;
+    Label errorExit = EmitEntry(assembler, context_.get());
+    std::unordered_map<std::string, Label> labels;
+    for (auto& name : compiled)
+        labels[name] = assembler.NewLabel();
+    for (auto& function : module.functions) {
+        auto& name = function->Name();
+        if (!compiled.count(name)) {
+            skipped_.push_back(name + ": " + reasons[name]);
+            continue;
+        }
+        FunctionCompiler compiler(assembler, labels, context_.get(), errorExit, sites_, strings_);
+        compiler.Compile(*function, labels[name]);
+        stats_.spills += compiler.SpillCount();
+
+        CompiledFunction entry;
+        entry.offset = assembler.Position(labels[name]);
+        for (auto argument : function->Arguments())
+            entry.parameters.push_back(argument->type);
+        entry.result = function->ResultTypes().empty() ? IrType::Void : function->ResultTypes()[0];
+        functions_[name] = entry;
+    }
+    stats_.compiled = functions_.size();
+    stats_.codeBytes = assembler.Size();
+
+#ifdef ZL_JIT_SUPPORTED
+    // The code is written while the memory is writable and then made
+    // executable, never both
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (assembler.Size() + page - 1) / page * page;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        error_ = "can not map memory for the code";
+        functions_.clear();
+        return false;
+    }
+    memcpy(memory, assembler.Code().data(), assembler.Size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        error_ = "can not make the code executable";
+        functions_.clear();
+        return false;
+    }
+    code_ = static_cast<uint8_t*>(memory);
+    codeSize_ = size;
+    stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+#else
+    error_ = "compiled code does not run on this machine";
+    functions_.clear();
+    return false;
+#endif
+}
+
+const std::vector<IrType>& Jit::ParameterTypes(const std::string& name) const {
+    return functions_.at(name).parameters;
+}
+
+IrType Jit::ResultType(const std::string& name) const {
+    return functions_.at(name).result;
+}
+
+bool Jit::Call(const std::string& name, const std::vector<JitValue>& args, JitValue& result) {
+    auto function = functions_.find(name);
+    if (function == functions_.end() || !code_) {
+        error_ = name + " is not compiled";
+        return false;
+    }
+    auto& parameters = function->second.parameters;
+    if (args.size() != parameters.size()) {
+        error_ = name + " expects " + std::to_string(parameters.size()) + " arguments, " +
+            std::to_string(args.size()) + " given";
+        return false;
+    }
+    uint64_t registers[kArgumentGprCount + kArgumentXmmCount] = {};
+    size_t general = 0, floating = 0;
+    for (size_t n = 0; n < args.size(); n++) {
+        if (parameters[n] == IrType::Float) {
+            float value = static_cast<float>(args[n].doubleValue);
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            registers[kArgumentGprCount + floating++] = bits;
+        } else if (parameters[n] == IrType::Double) {
+            memcpy(&registers[kArgumentGprCount + floating++], &args[n].doubleValue, sizeof(double));
+        } else {
+            registers[general++] = static_cast<uint64_t>(args[n].intValue);
+        }
+    }
+
+    uint64_t results[2] = {};
+    auto entry = reinterpret_cast<EntryFunction>(code_);
+    context_->errorSite = -1;
+    if (!entry(registers, results, code_ + function->second.offset)) {
+        error_ = sites_[context_->errorSite];
+        return false;
+    }
+    result = JitValue();
+    result.type = function->second.result;
+    switch (result.type) {
+        case IrType::Bool:
+            result.intValue = results[0] & 1;
+            break;
+        case IrType::Int:
+            result.intValue = static_cast<int32_t>(results[0]);
+            break;
+        case IrType::Long:
+            result.intValue = static_cast<int64_t>(results[0]);
+            break;
+        case IrType::Float: {
+            uint32_t bits = static_cast<uint32_t>(results[1]);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            result.doubleValue = value;
+            break;
+        }
+        case IrType::Double:
+            memcpy(&result.doubleValue, &results[1], sizeof(double));
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+} // namespace zl
@@ -0,0 +1,102 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ir.h"
+
+namespace zl {
+
+// JitValue is an argument or the result of a compiled function, the field
+// used depends on the type
+struct JitValue {
+    IrType type = IrType::Void;
+    // Value of Bool, Int and Long
+    int64_t intValue = 0;
+    // Value of Float and Double
+    double doubleValue = 0;
+
+    static JitValue Integer(IrType type, int64_t value);
+    static JitValue Floating(IrType type, double value);
+};
+
+// JitStats are the statistics of the last compilation
+struct JitStats {
+    size_t compiled = 0;
+    size_t codeBytes = 0;
+    // Values which did not get a register
+    size_t spills = 0;
+    double seconds = 0;
+};
+
+// Jit compile functions of optimized SSA IR to x86-64 machine code for the
+// System V calling convention. Functions whose values are all bool, int,
+// long, float or double and which only call such functions or print are
+// compiled, the others are skipped with the reason.
+//
+// Registers are assigned by linear scan. The code is written to memory
+// mapped writable and then made executable, it is never writable and
+// executable at once. Runtime errors, division by zero and failed
+// assertions, return through the entry stub with the stack of the call, so
+// no unwinding tables are needed. Calls are not reentrant, one thread calls
+// the compiled code at a time, and deep recursion is not checked.
+class Jit {
+public:
+    // Return true if compiled code can run on this machine
+    static bool Supported();
+
+    Jit();
+    ~Jit();
+
+    // Compile all the functions of the module which can be compiled, the
+    // code of a previous compilation is dropped. Return false if there is
+    // no executable memory.
+    bool Compile(const IrModule& module);
+    bool Has(const std::string& name) const { return functions_.count(name) != 0; }
+    // Parameter and result types of a compiled function
+    const std::vector<IrType>& ParameterTypes(const std::string& name) const;
+    IrType ResultType(const std::string& name) const;
+    // Call the compiled function, return false on runtime error. Arguments
+    // are taken by the parameter types.
+    bool Call(const std::string& name, const std::vector<JitValue>& args, JitValue& result);
+    // The message of last runtime error, "function: message"
+    const std::string& Error() const { return error_; }
+    // Functions not compiled, "name: reason"
+    const std::vector<std::string>& Skipped() const { return skipped_; }
+    const JitStats& Stats() const { return stats_; }
+
+    // Context of the running call, its address is in the compiled code
+    struct Context {
+        uint64_t savedStack;
+        int32_t errorSite;
+    };
+
+private:
+    Jit(const Jit&) = delete;
+    Jit& operator = (const Jit&) = delete;
+
+    struct CompiledFunction {
+        size_t offset;
+        std::vector<IrType> parameters;
+        IrType result;
+    };
+    void Release();
+
+private:
+    std::unique_ptr<Context> context_;
+    uint8_t* code_;
+    size_t codeSize_;
+    std::unordered_map<std::string, CompiledFunction> functions_;
+    // Messages of the places raising runtime errors, by site number
+    std::vector<std::string> sites_;
+    // Strings referenced by the compiled code
+    std::deque<std::string> strings_;
+    std::vector<std::string> skipped_;
+    std::string error_;
+    JitStats stats_;
+};
+
+} // namespace zl
@@ -3,10 +3,12 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 //#include <error.h>
 #include "lexer.h"
 #include <map>
+#include <stdexcept>
 #include <string>
 
 namespace zl {
@@ -20,40 +22,167 @@ struct {
     { "import",     Token::IMPORT },
     { "class",      Token::CLASS },
     { "interface",  Token::INTERFACE },
+    { "break",      Token::BREAK },
+    { "case",       Token::CASE },
+    { "chan",       Token::CHAN },
+    { "const",      Token::CONST },
+    { "continue",   Token::CONTINUE },
+    { "default",    Token::DEFAULT },
+    { "defer",      Token::DEFER },
+    { "else",       Token::ELSE },
+    { "elif",       Token::ELIF },
+    { "fallthrough",Token::FALLTHROUGH },
+    { "for",        Token::FOR },
+    { "foreach",    Token::FOREACH },
+    { "func",       Token::FUNC },
+    { "goto",       Token::GOTO },
+    { "if",         Token::IF },
+    { "map",        Token::MAP },
+    { "range",      Token::RANGE },
+    { "return",     Token::RETURN },
+    { "select",     Token::SELECT },
+    { "switch",     Token::SWITCH },
+    { "var",        Token::VAR },
+    { "in",         Token::IN },
+    { "public",     Token::PUBLIC },
+    { "private",    Token::PRIVATE },
+    { "using",      Token::USING },
+    { "function",   Token::FUNCTION },
+    { "void",       Token::VOID },
+    { "implements", Token::IMPLEMENTS },
+    { "while",      Token::WHILE },
+    { "do",         Token::DO },
+    { "assert",     Token::ASSERT },
+    { "throw",      Token::THROW },
+    { "try",        Token::TRY },
+    { "catch",      Token::CATCH },
+    { "finally",    Token::FINALLY },
+    { "static",     Token::STATIC },
+    { "new",        Token::NEW },
+    { "true",       Token::TRUE },
+    { "false",      Token::FALSE },
+    { "null",       Token::NIL },
+    { "nil",        Token::NIL },
 };
-static std::map<std::string, int> keywordMaps_;
 
-static void InitializeKeywords() {
-    static bool initialized = false;
-    if (!initialized) {
-        for (auto &kd :keywords_) {
-            keywordMaps_[kd.name] = kd.type;
-        }
-        initialized = true;
+// Map between operator and name, longer operators must come first because
+// the lexer choose the first operator matched
+struct {
+    const char* name;
+    int type;
+} operators_[] = {
+    { "&^=", Token::AND_NOT_ASSIGN },
+    { "<<=", Token::SHL_ASSIGN },
+    { ">>=", Token::SHR_ASSIGN },
+    { "...", Token::ELLIPSIS },
+    { "+=",  Token::ADD_ASSIGN },
+    { "-=",  Token::SUB_ASSIGN },
+    { "*=",  Token::MUL_ASSIGN },
+    { "/=",  Token::QUO_ASSIGN },
+    { "%=",  Token::REM_ASSIGN },
+    { "&=",  Token::AND_ASSIGN },
+    { "|=",  Token::OR_ASSIGN },
+    { "^=",  Token::XOR_ASSIGN },
+    { "&^",  Token::AND_NOT },
+    { "<<",  Token::SHL },
+    { ">>",  Token::SHR },
+    { "&&",  Token::LAND },
+    { "||",  Token::LOR },
+    { "<-",  Token::ARROW },
+    { "++",  Token::INC },
+    { "--",  Token::DEC },
+    { "==",  Token::EQL },
+    { "!=",  Token::NEQ },
+    { "<=",  Token::LEQ },
+    { ">=",  Token::GEQ },
+    { ":=",  Token::DEFINE },
+    { "+",   Token::ADD },
+    { "-",   Token::SUB },
+    { "*",   Token::MUL },
+    { "/",   Token::QUO },
+    { "%",   Token::REM },
+    { "&",   Token::AND },
+    { "|",   Token::OR },
+    { "^",   Token::XOR },
+    { "<",   Token::LSS },
+    { ">",   Token::GTR },
+    { "=",   Token::ASSIGN },
+    { "!",   Token::NOT },
+    { "(",   Token::LPAREN },
+    { "[",   Token::LBRACK },
+    { "{",   Token::LBRACE },
+    { ",",   Token::COMMA },
+    { ".",   Token::PERIOD },
+    { ")",   Token::RPAREN },
+    { "]",   Token::RBRACK },
+    { "}",   Token::RBRACE },
+    { ";",   Token::SEMICOLON },
+    { ":",   Token::COLON },
+};
+static std::map<std::string, int> BuildKeywordMap() {
+    std::map<std::string, int> keywords;
+    for (auto &kd :keywords_) {
+        keywords[kd.name] = kd.type;
     }
+    return keywords;
 }
 
+// The keyword map is built before main and only read afterwards, so lexers
+// may run on several threads at the same time
+static const std::map<std::string, int> keywordMap_ = BuildKeywordMap();
+
 static int GetKeyword(const std::string& name) {
-    std::map<std::string, int>::iterator iter = keywordMaps_.find(name);
-    if (iter != keywordMaps_.end()) 
+    auto iter = keywordMap_.find(name);
+    if (iter != keywordMap_.end()) 
         return iter->second;
     return -1;
 }
 
+std::string TokenTypeString(int type) {
+    switch (type) {
+        case Token::ILLEGAL: return "illegal token";
+        case Token::END_OF_FILE: return "EOF";
+        case Token::COMMENT: return "comment";
+        case Token::ID: return "identifier";
+        case Token::INT: return "integer literal";
+        case Token::FLOAT: return "float literal";
+        case Token::IMAG: return "imaginary literal";
+        case Token::CHAR: return "char literal";
+        case Token::STRING: return "string literal";
+        default: break;
+    }
+    for (auto& op : operators_) {
+        if (op.type == type)
+            return op.name;
+    }
+    for (auto& kd : keywords_) {
+        if (kd.type == type)
+            return kd.name;
+    }
+    return "unknown token";
+}
+
 // Load source code from specifed fullpath file
 Lexer::Lexer(const string& fullpath)  {
     struct stat sb;
-    if ((fd_ = open(fullpath.c_str(), O_RDWR)) < 0) 
+    if ((fd_ = open(fullpath.c_str(), O_RDONLY)) < 0) 
         throw std::invalid_argument("file no exist");
-    if (fstat(fd_, &sb) < 0) 
+    if (fstat(fd_, &sb) < 0) {
+        close(fd_);
         throw std::invalid_argument("invalid file state");
-    if ((buf_ = (char*)mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd_, 0)) == nullptr) 
-        throw std::invalid_argument("file map failed");
-
+    }
     bufSize_ = sb.st_size;
+    buf_ = "";
+    if (bufSize_ > 0) {
+        void* addr = mmap(nullptr, bufSize_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED) {
+            close(fd_);
+            throw std::invalid_argument("file map failed");
+        }
+        buf_ = (const char*)addr;
+    }
     fullFileName_ = fullpath;
-    mark_ = 0;
-    InitializeKeywords();
+    Initialize();
 }
 
 // Load source code from specified string buffer
@@ -62,20 +191,37 @@ Lexer::Lexer(const char* codes) {
         throw std::invalid_argument("invalid code buffer");
     fd_ = -1;
     buf_ = codes;
-    mark_ = 0;
-    InitializeKeywords();
+    bufSize_ = strlen(codes);
+    Initialize();
 }
 
+// Load source code from specified buffer with explicit size
+Lexer::Lexer(const char* codes, size_t size) {
+    if (codes == nullptr && size > 0) 
+        throw std::invalid_argument("invalid code buffer");
+    fd_ = -1;
+    buf_ = codes ? codes : "";
+    bufSize_ = size;
+    Initialize();
+}
 
 Lexer::~Lexer() {
-    if (fd_ > 0) {
-        munmap((void*)buf_, bufSize_);
+    if (fd_ >= 0) {
+        if (bufSize_ > 0)
+            munmap((void*)buf_, bufSize_);
         close(fd_);
     }
     fd_ = -1;
     buf_ = nullptr;
 }
 
+void Lexer::Initialize() {
+    mark_ = 0;
+    index_ = 0;
+    lineno_ = 1;
+    tokenCount_ = 0;
+}
+
 // Back return the previous token position
 void Lexer::Back() {
     index_ = mark_;
@@ -87,7 +233,7 @@ std::string Lexer::GetAtomString(char ch) {
     atom = ch;
 
     while (((ch = NextChar()) != EOF)) {
-        if (isalpha(ch)) {
+        if (isalnum(ch) || ch == '_') {
             atom += ch;
         } else {
             PutbackChar();
@@ -97,35 +243,83 @@ std::string Lexer::GetAtomString(char ch) {
     return atom;
 }
 
-Token Lexer::ParseStringLiteral(char ch) {
+// String and char literal, the token value keep the unescaped content without
+// quotes
+Token Lexer::ParseStringLiteral(char quote) {
     std::string atom;
+    char ch;
+    int lineno = lineno_;
 
     while (((ch = NextChar()) != EOF)) {
-        if (ch == '"') 
-            return Token(atom, Token::ID, lineno_++);
-        else if (isalpha(ch)) 
-            atom += ch;
-        else{
+        if (ch == quote) 
+            return Token(atom, quote == '"' ? Token::STRING : Token::CHAR, lineno);
+        if (ch == '\n') {
             PutbackChar();
-            return Token(atom, Token::ID, lineno_++);
+            break;
+        }
+        if (ch == '\\') {
+            if ((ch = NextChar()) == EOF)
+                break;
+            switch (ch) {
+                case 'n': atom += '\n'; break;
+                case 't': atom += '\t'; break;
+                case 'r': atom += '\r'; break;
+                case '0': atom += '\0'; break;
+                default: atom += ch; break;
+            }
+            continue;
         }
+        atom += ch;
     }
-    return Token();
+    // unterminated literal
+    return Token(atom, Token::ILLEGAL, lineno);
 }
 
 Token Lexer::ParseDigitalLiteral(char ch) {
     std::string atom;
+    int type = Token::INT;
     atom = ch;
 
+    if (ch == '0') {
+        ch = NextChar();
+        if (ch == 'x' || ch == 'X') {
+            atom += ch;
+            while (((ch = NextChar()) != EOF) && isxdigit(ch))
+                atom += ch;
+            if (ch != EOF)
+                PutbackChar();
+            return Token(atom, Token::INT, lineno_);
+        }
+        // The first digit is consumed, only the character after it is
+        // put back
+        if (ch != EOF)
+            PutbackChar();
+    }
+
     while (((ch = NextChar()) != EOF)) {
-        if (isdigit(ch)) 
+        if (isdigit(ch)) {
             atom += ch;
-        else{
+        } else if (ch == '.' && type == Token::INT) {
+            // '1...' is a range rather than a float
+            if (index_ < bufSize_ && buf_[index_] == '.') {
+                PutbackChar();
+                break;
+            }
+            type = Token::FLOAT;
+            atom += ch;
+        } else if ((ch == 'e' || ch == 'E') && atom.find_first_of("eE") == std::string::npos) {
+            type = Token::FLOAT;
+            atom += ch;
+            if ((ch = NextChar()) == '+' || ch == '-')
+                atom += ch;
+            else if (ch != EOF)
+                PutbackChar();
+        } else {
             PutbackChar();
-            return Token(atom, Token::INT, lineno_++);
+            break;
         }
     }
-    return Token();
+    return Token(atom, type, lineno_);
 }
 
 // AlphaToken may be identifier or keyword
@@ -134,78 +328,91 @@ Token Lexer::ParseAlphaToken(char ch) {
     int tokenType = GetKeyword(id);
 
     if (tokenType > 0) 
-        return Token(id, tokenType, lineno_++);
+        return Token(id, tokenType, lineno_);
     else 
-        return Token(id, Token::ID, lineno_++);
+        return Token(id, Token::ID, lineno_);
+}
+
+// Operator is matched by longest prefix
+Token Lexer::ParseOperator(char ch) {
+    size_t start = index_ - 1;
+    for (auto& op : operators_) {
+        size_t len = strlen(op.name);
+        if (start + len <= bufSize_ && strncmp(buf_ + start, op.name, len) == 0) {
+            index_ = start + len;
+            return Token(op.name, op.type, lineno_);
+        }
+    }
+    return Token(std::string(1, ch), Token::ILLEGAL, lineno_);
 }
 
-// The function return next token internal
-Token Lexer::NextToken(bool mark) {
+// The function return next token internal, a peeked token leave the lexer
+// state unchanged
+Token Lexer::NextToken(bool peek) {
+    if (peek) {
+        size_t mark = mark_, index = index_;
+        int lineno = lineno_;
+        Token token = ScanToken();
+        mark_ = mark;
+        index_ = index;
+        lineno_ = lineno;
+        return token;
+    }
+    Token token = ScanToken();
+    if (token.type_ != Token::END_OF_FILE)
+        tokenCount_++;
+    return token;
+}
+
+Token Lexer::ScanToken() {
     char ch;
     
     while ((ch = NextChar()) != EOF) {
         switch (ch) {
+            case '\n':
+                lineno_ ++;
+                continue;
+            case ' ':
+            case '\t':
+            case '\r':
+                continue;
             case '/':
                 // consume comments
-                if (((ch = NextChar()) != EOF) && (ch = '/')) {
+                if (index_ < bufSize_ && buf_[index_] == '/') {
+                    while (((ch = NextChar()) != EOF) && ch != '\n')
+                        ;
+                    if (ch == '\n')
+                        lineno_++;
+                    continue;
+                }
+                if (index_ < bufSize_ && buf_[index_] == '*') {
+                    NextChar();
                     while (((ch = NextChar()) != EOF)) {
-                        if (ch == '\r' || ch == '\n') {
+                        if (ch == '\n')
                             lineno_++;
-                            break; 
+                        else if (ch == '*' && index_ < bufSize_ && buf_[index_] == '/') {
+                            NextChar();
+                            break;
                         }
                     }
+                    continue;
                 }
-                break;
-            case '+':
-            case '-':
-            case '*':
-            case ':':
-            case '.':
-            case '&':
-            case '!':
-            case '=':
-            case '>':
-            case '<':
-            case ';':
-            case '%':
-            case '[':
-            case ']':
-            case '{':
-            case '}':
-            case '(':
-            case ')':
-            case '\'':
-            case '?':
-            case ',':
-            case '#':
-            case '~':
-            case '`':
                 UpdateMark();
-                //return Token(ch, Token::OP, lineno_);
-            case '\r':
-                continue;
-                break;
-            case '\n':
-                lineno_ ++;
-                break;
-            case ' ':
-                continue;
-                break;
-
+                return ParseOperator(ch);
             case '"':
+            case '\'':
                 UpdateMark();
                 return ParseStringLiteral(ch);
             default:
                 UpdateMark();
                 if (isdigit(ch))
                     return ParseDigitalLiteral(ch);
-                if (isalpha(ch))
+                if (isalpha(ch) || ch == '_')
                     return ParseAlphaToken(ch);
-                return Token(GetAtomString(ch), Token::ILLEGAL, lineno_++);
-                break;
+                return ParseOperator(ch);
         }
     }
-    return Token();
+    return Token("", Token::END_OF_FILE, lineno_);
 }
 
 
@@ -16,6 +16,10 @@ public:
 
     // Load source code from specified string buffer
     Lexer(const char* codes);
+
+    // Load source code from specified buffer with explicit size, the buffer
+    // must outlive the lexer
+    Lexer(const char* codes, size_t size);
     ~Lexer();
 
     // Return the next token in lexer
@@ -31,20 +35,26 @@ public:
     // if matched
     bool Match(int tokenType, Token* token = nullptr) { return false;}
     bool Match(char ch) { return false;}
-    bool Eof() const { return  false; }
+    bool Eof() const { return index_ >= bufSize_; }
     Location GetLocation() const { return Location(lineno_); }
 
+    // Return the number of tokens returned by Next() so far
+    size_t TokenCount() const { return tokenCount_; }
+
 private:
-    Token NextToken(bool mark = false);
+    void Initialize();
+    Token NextToken(bool peek = false);
+    Token ScanToken();
+    Token ParseOperator(char ch);
     Token ParseStringLiteral(char ch);
     Token ParseDigitalLiteral(char ch);
     Token ParseAlphaToken(char ch);
     std::string GetAtomString(char ch);
-    void UpdateMark() { mark_ = index_; }
+    void UpdateMark() { mark_ = index_ - 1; }
     void PutbackChar(){ index_--; }
 
     char NextChar() {
-        if (index_ == bufSize_)
+        if (index_ >= bufSize_)
             return EOF;
         char ch = *(buf_ + index_); 
         index_++;
@@ -60,11 +70,13 @@ private:
     const char* buf_;
     size_t bufSize_;
     // mark indication to current index postion, using in peek or back
-    int mark_;
+    size_t mark_;
     // current char index
-    int index_;
+    size_t index_;
     // current line number
     int lineno_;
+    // tokens returned by Next()
+    size_t tokenCount_;
 };
 
 } // namespace zl
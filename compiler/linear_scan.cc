@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include "linear_scan.h"
+
+namespace zl {
+
+LinearScanAllocator::LinearScanAllocator(const RegisterClass& general, const RegisterClass& floating)
+    : slotCount_(0), spills_(0) {
+    classes_[0] = general;
+    classes_[1] = floating;
+}
+
+void LinearScanAllocator::Allocate(const IrFunction& function, const std::vector<IrBlock*>& order,
+        const ClassOf& isFloating, const IsCall& isCall) {
+    intervals_.clear();
+    locations_.assign(function.ValueCount(), ValueLocation());
+    freeSlots_.clear();
+    usedSlots_.clear();
+    slotCount_ = 0;
+    usedGeneral_.clear();
+    usedFloating_.clear();
+    spills_ = 0;
+    BuildIntervals(function, order, isFloating, isCall);
+    Scan();
+}
+
+void LinearScanAllocator::BuildIntervals(const IrFunction& function, const std::vector<IrBlock*>& order,
+        const ClassOf& isFloating, const IsCall& isCall) {
+    const uint32_t kNone = UINT32_MAX;
+    // Arguments are defined at 0, the phis of a block at its start and the
+    // other instructions at their own positions
+    std::vector<uint32_t> position(function.ValueCount(), kNone);
+    std::vector<uint32_t> blockStart, blockEnd;
+    std::vector<uint32_t> calls;
+    uint32_t next = 1;
+    for (auto block : order) {
+        if (block->id >= blockStart.size()) {
+            blockStart.resize(block->id + 1, kNone);
+            blockEnd.resize(block->id + 1, kNone);
+        }
+        blockStart[block->id] = next++;
+        for (auto instruction : block->instructions) {
+            if (instruction->opcode == IrOpcode::Phi) {
+                position[instruction->id] = blockStart[block->id];
+                continue;
+            }
+            if (isCall(instruction))
+                calls.push_back(next);
+            position[instruction->id] = next++;
+        }
+        blockEnd[block->id] = next - 1;
+    }
+    auto numbered = [&](const IrBlock* block) {
+        return block->id < blockStart.size() && blockStart[block->id] != kNone;
+    };
+
+    // The blocks where the value is live in are found walking up from its
+    // uses, the interval ends at the last of its uses and the ends of the
+    // blocks it is live out of
+    std::vector<uint32_t> visited(blockStart.size(), kNone);
+    std::vector<const IrBlock*> worklist;
+    auto addInterval = [&](const IrValue* value, const IrBlock* defBlock) {
+        uint32_t start = position[value->id];
+        uint32_t end = start;
+        auto liveIn = [&](const IrBlock* block) {
+            if (block == defBlock || visited[block->id] == value->id)
+                return;
+            visited[block->id] = value->id;
+            worklist.push_back(block);
+        };
+        for (auto& use : value->users) {
+            auto user = use.user;
+            if (user->erased || !numbered(user->block))
+                continue;
+            if (user->opcode == IrOpcode::Phi) {
+                auto pred = user->block->preds[use.operand];
+                if (!numbered(pred))
+                    continue;
+                end = std::max(end, blockEnd[pred->id]);
+                liveIn(pred);
+            } else {
+                end = std::max(end, position[user->id]);
+                liveIn(user->block);
+            }
+        }
+        while (!worklist.empty()) {
+            auto block = worklist.back();
+            worklist.pop_back();
+            for (auto pred : block->preds) {
+                if (!numbered(pred))
+                    continue;
+                end = std::max(end, blockEnd[pred->id]);
+                liveIn(pred);
+            }
+        }
+        // The phi location is written on every incoming edge, back edges
+        // included
+        if (value->kind == IrValueKind::Instruction &&
+                static_cast<const IrInstruction*>(value)->opcode == IrOpcode::Phi) {
+            for (auto pred : defBlock->preds) {
+                if (numbered(pred))
+                    end = std::max(end, blockEnd[pred->id]);
+            }
+        }
+        auto call = std::upper_bound(calls.begin(), calls.end(), start);
+        bool crossesCall = call != calls.end() && *call < end;
+        intervals_.push_back({value, start, end, isFloating(value->type), crossesCall});
+    };
+
+    for (auto argument : function.Arguments()) {
+        position[argument->id] = 0;
+        addInterval(argument, order.empty() ? nullptr : order[0]);
+    }
+    for (auto block : order) {
+        for (auto instruction : block->instructions) {
+            if (instruction->type != IrType::Void)
+                addInterval(instruction, block);
+        }
+    }
+    // Phis of a block start together, the others are in order already
+    std::stable_sort(intervals_.begin(), intervals_.end(), [](const Interval& a, const Interval& b) {
+        return a.start < b.start;
+    });
+}
+
+uint32_t LinearScanAllocator::NewSlot(uint32_t end) {
+    uint32_t slot;
+    if (!freeSlots_.empty()) {
+        slot = freeSlots_.back();
+        freeSlots_.pop_back();
+    } else {
+        slot = slotCount_++;
+    }
+    usedSlots_.push_back({end, slot});
+    std::push_heap(usedSlots_.begin(), usedSlots_.end(), std::greater<std::pair<uint32_t, uint32_t>>());
+    spills_++;
+    return slot;
+}
+
+void LinearScanAllocator::Scan() {
+    // Active intervals by class, and which registers they hold
+    std::vector<size_t> active[2];
+    bool busy[2][256] = {};
+    auto greater = std::greater<std::pair<uint32_t, uint32_t>>();
+
+    for (size_t n = 0; n < intervals_.size(); n++) {
+        auto& interval = intervals_[n];
+        int c = interval.floating ? 1 : 0;
+        // Expire the intervals ended before this one
+        for (int k = 0; k < 2; k++) {
+            auto& list = active[k];
+            for (size_t i = 0; i < list.size();) {
+                auto& other = intervals_[list[i]];
+                if (other.end < interval.start) {
+                    busy[k][locations_[other.value->id].reg] = false;
+                    list[i] = list.back();
+                    list.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+        while (!usedSlots_.empty() && usedSlots_.front().first < interval.start) {
+            freeSlots_.push_back(usedSlots_.front().second);
+            std::pop_heap(usedSlots_.begin(), usedSlots_.end(), greater);
+            usedSlots_.pop_back();
+        }
+
+        auto& regs = classes_[c];
+        auto& location = locations_[interval.value->id];
+        int chosen = -1;
+        if (!interval.crossesCall) {
+            for (auto reg : regs.callerSaved) {
+                if (!busy[c][reg]) {
+                    chosen = reg;
+                    break;
+                }
+            }
+        }
+        if (chosen < 0) {
+            for (auto reg : regs.calleeSaved) {
+                if (!busy[c][reg]) {
+                    chosen = reg;
+                    break;
+                }
+            }
+        }
+        if (chosen < 0) {
+            // Take the register of the active interval ending last if it
+            // ends after this one
+            auto usable = [&](uint8_t reg) {
+                return !interval.crossesCall ||
+                    std::find(regs.calleeSaved.begin(), regs.calleeSaved.end(), reg) != regs.calleeSaved.end();
+            };
+            size_t victim = SIZE_MAX;
+            for (size_t i = 0; i < active[c].size(); i++) {
+                auto& other = intervals_[active[c][i]];
+                if (!usable(locations_[other.value->id].reg))
+                    continue;
+                if (victim == SIZE_MAX || other.end > intervals_[active[c][victim]].end)
+                    victim = i;
+            }
+            if (victim != SIZE_MAX && intervals_[active[c][victim]].end > interval.end) {
+                auto& other = intervals_[active[c][victim]];
+                auto& otherLocation = locations_[other.value->id];
+                chosen = otherLocation.reg;
+                otherLocation.kind = ValueLocation::Stack;
+                otherLocation.slot = NewSlot(other.end);
+                active[c][victim] = active[c].back();
+                active[c].pop_back();
+                busy[c][chosen] = false;
+            }
+        }
+        if (chosen < 0) {
+            location.kind = ValueLocation::Stack;
+            location.slot = NewSlot(interval.end);
+            continue;
+        }
+        location.kind = ValueLocation::Register;
+        location.reg = static_cast<uint8_t>(chosen);
+        busy[c][chosen] = true;
+        active[c].push_back(n);
+        auto& used = c ? usedFloating_ : usedGeneral_;
+        if (std::find(regs.calleeSaved.begin(), regs.calleeSaved.end(), chosen) != regs.calleeSaved.end() &&
+                std::find(used.begin(), used.end(), chosen) == used.end())
+            used.push_back(static_cast<uint8_t>(chosen));
+    }
+}
+
+} // namespace zl
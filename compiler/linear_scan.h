@@ -0,0 +1,99 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "ir.h"
+
+namespace zl {
+
+// ValueLocation is where an SSA value lives for its whole live range
+struct ValueLocation {
+    enum Kind : uint8_t {
+        // Constants and values without a location
+        None,
+        Register,
+        Stack,
+    };
+    Kind kind = None;
+    // Register number of the class of the value
+    uint8_t reg = 0;
+    // Spill slot index
+    uint32_t slot = 0;
+};
+
+// RegisterClass is a set of allocatable registers. Callee saved registers
+// survive calls, the others are clobbered by them.
+struct RegisterClass {
+    // In order of preference
+    std::vector<uint8_t> callerSaved;
+    std::vector<uint8_t> calleeSaved;
+};
+
+// LinearScanAllocator assign registers to the values of a function with the
+// linear scan of Poletto and Sarkar. Blocks are numbered in the given order,
+// which must list a block after its dominator, and each value gets one
+// interval from its definition to its last use, the blocks in between
+// included. Values live across a call get callee saved registers or stack
+// slots. When registers run out the interval ending last is spilled.
+//
+// The phis of a block are defined at its start and their operands are used
+// at the end of the predecessors, the code generator moves the operands to
+// the phi locations on each edge.
+class LinearScanAllocator {
+public:
+    // Return true for values of the second register class, floating point
+    typedef std::function<bool(IrType)> ClassOf;
+    // Return true for instructions which clobber caller saved registers
+    typedef std::function<bool(const IrInstruction*)> IsCall;
+
+    LinearScanAllocator(const RegisterClass& general, const RegisterClass& floating);
+    ~LinearScanAllocator() {}
+
+    void Allocate(const IrFunction& function, const std::vector<IrBlock*>& order,
+        const ClassOf& isFloating, const IsCall& isCall);
+
+    // Location of an argument or instruction, indexed by value id
+    const ValueLocation& Location(const IrValue* value) const { return locations_[value->id]; }
+    // Number of stack slots of spilled values
+    uint32_t SlotCount() const { return slotCount_; }
+    // Callee saved registers assigned to some value, they must be preserved
+    const std::vector<uint8_t>& UsedCalleeSaved(bool floating) const {
+        return floating ? usedFloating_ : usedGeneral_;
+    }
+    // Number of values spilled to the stack
+    size_t SpillCount() const { return spills_; }
+
+private:
+    LinearScanAllocator() = delete;
+    LinearScanAllocator(const LinearScanAllocator&) = delete;
+    LinearScanAllocator& operator = (const LinearScanAllocator&) = delete;
+
+    struct Interval {
+        const IrValue* value;
+        uint32_t start;
+        uint32_t end;
+        bool floating;
+        bool crossesCall;
+    };
+
+    // Compute the intervals of all values in order of their start
+    void BuildIntervals(const IrFunction& function, const std::vector<IrBlock*>& order,
+        const ClassOf& isFloating, const IsCall& isCall);
+    void Scan();
+    uint32_t NewSlot(uint32_t end);
+
+private:
+    RegisterClass classes_[2];
+    std::vector<Interval> intervals_;
+    std::vector<ValueLocation> locations_;
+    // Slots whose values are dead, and the slots in use with their ends
+    std::vector<uint32_t> freeSlots_;
+    std::vector<std::pair<uint32_t, uint32_t>> usedSlots_;
+    uint32_t slotCount_;
+    std::vector<uint8_t> usedGeneral_;
+    std::vector<uint8_t> usedFloating_;
+    size_t spills_;
+};
+
+} // namespace zl
@@ -1,13 +1,156 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
 #include <iostream>
-#include <typeinfo>
-#include "token.h"
-#include "location.h"
-#include "lexer.h"
-#include "parser.h"
+#include "compiler.h"
 
-class Hello {};
+static void Usage() {
+    std::cerr << "usage: zlc [options] file..." << std::endl
+        << "options:" << std::endl
+        << "  --cache-dir=<dir>      reuse front end results cached in dir" << std::endl
+        << "  --cache-size=<bytes>   evict cached results beyond the size, default 256M" << std::endl
+        << "  --cache-stats          print cache hits and misses" << std::endl
+        << "  --diff-against=<file>  print declarations changed since the old file" << std::endl
+        << "  --dump-ast=<format>    dump the syntax trees of all files, xml, jsonl or bin" << std::endl
+        << "  --dump-output=<file>   write the dump into file instead of standard output" << std::endl
+        << "  --dump-dom             build the whole xml document before writing it" << std::endl
+        << "  --check-ast=<file>     compare the syntax trees with the golden xml dump" << std::endl
+        << "  --run                  compile the files to bytecode and run main" << std::endl
+        << "  --dump-bytecode        print the bytecode of all functions" << std::endl
+        << "  --gc-stats             print the collections and pauses of the heap after running" << std::endl
+        << "  --dispatch-stats       print the hits of the method caches after running" << std::endl
+        << "  --nursery-size=<bytes> size of the young generation of the heap, default 4M" << std::endl
+        << "  --jit                  run main compiled to x86-64 code, or interpreted if it can not be" << std::endl
+        << "  --emit-c               translate the files to C" << std::endl
+        << "  --emit-exe=<file>      compile the C translation to an executable with cc -O2" << std::endl
+        << "  --escape-stats         print how many instances the C translation keeps in the frame" << std::endl
+        << "  --vector-report        print which loops of the C translation are vectorized, or why not" << std::endl
+        << "  --fp-reassociate       vectorize floating point sums, adding them in another order" << std::endl
+        << "  --dump-ir              print the optimized SSA IR of all functions" << std::endl
+        << "  --ir-stats             print the time of lowering and of each IR pass" << std::endl
+        << "  --verify-ir            verify the IR after lowering and after each pass" << std::endl
+        << "  --resolve              resolve names of all files, report undeclared ones" << std::endl
+        << "  --resolve-stats        print the number of resolved names" << std::endl
+        << "  --schedule             print the package schedule and critical path" << std::endl
+        << "  -j, --jobs=<n>         number of worker threads" << std::endl;
+}
 
-int main(int argc, char* argv[]) {
-    std::cout << "hello zlang" << std::endl;
+// Option value is given as '--name=value' or '--name value'
+static bool OptionValue(const char* name, int argc, char* argv[], int& i, std::string& value) {
+    size_t len = strlen(name);
+    if (strncmp(argv[i], name, len) != 0)
+        return false;
+    if (argv[i][len] == '=') {
+        value = argv[i] + len + 1;
+        return true;
+    }
+    if (argv[i][len] == '\0' && i + 1 < argc) {
+        value = argv[++i];
+        return true;
+    }
+    return false;
+}
+
+// Size may have suffix K, M or G
+static bool ParseSize(const std::string& text, uint64_t& size) {
+    char* end = nullptr;
+    size = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str())
+        return false;
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+        default: break;
+    }
+    return *end == '\0';
 }
 
+int main(int argc, char* argv[]) {
+    zl::CompileOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string value;
+        if (OptionValue("--cache-dir", argc, argv, i, value)) {
+            options.cacheDir = value;
+        } else if (OptionValue("--cache-size", argc, argv, i, value)) {
+            if (!ParseSize(value, options.cacheSizeLimit)) {
+                std::cerr << "zlc: invalid cache size '" << value << "'" << std::endl;
+                return 2;
+            }
+        } else if (OptionValue("--nursery-size", argc, argv, i, value)) {
+            if (!ParseSize(value, options.nurserySize) || options.nurserySize == 0) {
+                std::cerr << "zlc: invalid nursery size '" << value << "'" << std::endl;
+                return 2;
+            }
+        } else if (OptionValue("--diff-against", argc, argv, i, value)) {
+            options.diffAgainst = value;
+        } else if (OptionValue("--dump-ast", argc, argv, i, value)) {
+            options.dumpAst = value;
+        } else if (OptionValue("--dump-output", argc, argv, i, value)) {
+            options.dumpOutput = value;
+        } else if (OptionValue("--emit-exe", argc, argv, i, value)) {
+            options.emitExe = value;
+        } else if (OptionValue("--check-ast", argc, argv, i, value)) {
+            options.checkAst = value;
+        } else if (OptionValue("--jobs", argc, argv, i, value) ||
+                OptionValue("-j", argc, argv, i, value)) {
+            options.jobs = strtoul(value.c_str(), nullptr, 10);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && isdigit(argv[i][2])) {
+            options.jobs = strtoul(argv[i] + 2, nullptr, 10);
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            options.cacheStats = true;
+        } else if (strcmp(argv[i], "--resolve") == 0) {
+            options.resolve = true;
+        } else if (strcmp(argv[i], "--resolve-stats") == 0) {
+            options.resolve = true;
+            options.resolveStats = true;
+        } else if (strcmp(argv[i], "--schedule") == 0) {
+            options.resolve = true;
+            options.scheduleReport = true;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            options.run = true;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            options.gcStats = true;
+        } else if (strcmp(argv[i], "--dispatch-stats") == 0) {
+            options.dispatchStats = true;
+        } else if (strcmp(argv[i], "--dump-bytecode") == 0) {
+            options.dumpBytecode = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.jit = true;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            options.emitC = true;
+        } else if (strcmp(argv[i], "--escape-stats") == 0) {
+            options.escapeStats = true;
+        } else if (strcmp(argv[i], "--vector-report") == 0) {
+            options.vectorReport = true;
+        } else if (strcmp(argv[i], "--fp-reassociate") == 0) {
+            options.fpReassociate = true;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            options.dumpIr = true;
+        } else if (strcmp(argv[i], "--ir-stats") == 0) {
+            options.irStats = true;
+        } else if (strcmp(argv[i], "--verify-ir") == 0) {
+            options.verifyIr = true;
+        } else if (strcmp(argv[i], "--dump-dom") == 0) {
+            if (options.dumpAst.empty())
+                options.dumpAst = "xml";
+            options.dumpDom = true;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            Usage();
+            return 0;
+        } else if (argv[i][0] == '-') {
+            std::cerr << "zlc: unknown option '" << argv[i] << "'" << std::endl;
+            Usage();
+            return 2;
+        } else {
+            options.inputFiles.push_back(argv[i]);
+        }
+    }
+    if (options.inputFiles.empty()) {
+        Usage();
+        return 2;
+    }
+    zl::Compiler compiler(options);
+    return compiler.Run();
+}
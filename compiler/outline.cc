@@ -0,0 +1,124 @@
+#include "outline.h"
+
+namespace zl {
+
+std::string TypeString(const ast::Type* type) {
+    if (auto primitive = dynamic_cast<const ast::PrimitiveType*>(type); primitive)
+        return primitive->name_;
+    if (auto nonPrimitive = dynamic_cast<const ast::NonPrimitiveType*>(type); nonPrimitive)
+        return nonPrimitive->name_ ? nonPrimitive->name_->name_ : "_";
+    if (auto array = dynamic_cast<const ast::ArrayType*>(type); array)
+        return TypeString(array->type_) + "[]";
+    if (auto map = dynamic_cast<const ast::MapType*>(type); map)
+        return "map<" + TypeString(map->leftType_) + ", " + TypeString(map->rightType_) + ">";
+    return "_";
+}
+
+static std::string NameOf(const ast::Identifier* identifier) {
+    return identifier ? identifier->name_ : "_";
+}
+
+static std::string SignatureOf(const ast::Identifier* name,
+        const ast::FormalParameterList* params, const ast::ReturnParameterList* returns) {
+    std::string result = NameOf(name) + "(";
+    if (params) {
+        for (size_t i = 0; i < params->formalParameters_.size(); i++) {
+            auto param = params->formalParameters_[i];
+            if (i > 0)
+                result += ", ";
+            result += NameOf(param->name_) + ":" + TypeString(param->type_);
+        }
+    }
+    result += ")";
+    if (returns && !returns->types_.empty()) {
+        result += ":";
+        if (returns->types_.size() > 1)
+            result += "(";
+        for (size_t i = 0; i < returns->types_.size(); i++) {
+            if (i > 0)
+                result += ", ";
+            result += TypeString(returns->types_[i]);
+        }
+        if (returns->types_.size() > 1)
+            result += ")";
+    }
+    return result;
+}
+
+static void OutlineVariable(const std::string& prefix, ast::VariableDecl* decl,
+        std::vector<std::string>& outline) {
+    std::string line = prefix + NameOf(decl->name_);
+    if (decl->type_)
+        line += ":" + TypeString(decl->type_);
+    outline.push_back(line);
+}
+
+static void OutlineConst(ast::ConstDecl* decl, std::vector<std::string>& outline) {
+    std::string line = "const " + NameOf(decl->name_);
+    if (decl->type_)
+        line += ":" + TypeString(decl->type_);
+    outline.push_back(line);
+}
+
+std::vector<std::string> BuildOutline(const std::vector<ast::Node*>& decls) {
+    std::vector<std::string> outline;
+
+    for (auto node : decls) {
+        auto decl = dynamic_cast<ast::Decl*>(node);
+        if (!decl || !decl->IsPublic())
+            continue;
+
+        if (auto variable = dynamic_cast<ast::VariableDecl*>(decl); variable) {
+            OutlineVariable("var ", variable, outline);
+        } else if (auto block = dynamic_cast<ast::VariableBlockDecl*>(decl); block) {
+            for (auto item : block->variables_)
+                OutlineVariable("var ", item, outline);
+        } else if (auto constant = dynamic_cast<ast::ConstDecl*>(decl); constant) {
+            OutlineConst(constant, outline);
+        } else if (auto block = dynamic_cast<ast::ConstBlockDecl*>(decl); block) {
+            for (auto item : block->fields_)
+                OutlineConst(item, outline);
+        } else if (auto function = dynamic_cast<ast::FunctionDecl*>(decl); function) {
+            outline.push_back("func " + SignatureOf(function->name_,
+                        function->formalParameterList_, function->returnParameterList_));
+        } else if (auto interface = dynamic_cast<ast::InterfaceDecl*>(decl); interface) {
+            std::string name = NameOf(interface->name_);
+            outline.push_back("interface " + name);
+            for (auto method : interface->methods_) {
+                outline.push_back("  " + name + "." + SignatureOf(method->name_,
+                            method->formalParameterList_, method->returnParameterList_));
+            }
+        } else if (auto klass = dynamic_cast<ast::ClassDecl*>(decl); klass) {
+            std::string name = NameOf(klass->name_);
+            std::string line = "class " + name;
+            if (klass->interfaceList_) {
+                line += " implements ";
+                for (size_t i = 0; i < klass->interfaceList_->names_.size(); i++) {
+                    if (i > 0)
+                        line += ", ";
+                    std::string qualified;
+                    for (auto& item : klass->interfaceList_->names_[i]->names_)
+                        qualified += (qualified.empty() ? "" : ".") + item;
+                    line += qualified;
+                }
+            }
+            outline.push_back(line);
+            if (!klass->classBody_)
+                continue;
+            for (auto variable : klass->classBody_->variables_) {
+                if (variable->IsPublic())
+                    OutlineVariable("  " + name + ".", variable, outline);
+            }
+            for (auto function : klass->classBody_->functions_) {
+                if (!function->IsPublic())
+                    continue;
+                outline.push_back("  " + std::string(function->isStatic_ ? "static " : "") +
+                        name + "." + SignatureOf(function->name_, function->formalParameterList_,
+                            function->returnParameterList_));
+            }
+        }
+    }
+    return outline;
+}
+
+} // namespace zl
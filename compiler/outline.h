@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "ast.h"
+
+namespace zl {
+
+// Return the source spelling of the type, such as 'map<string, int[]>'
+std::string TypeString(const ast::Type* type);
+
+// BuildOutline return one line for each public declaration and public class
+// member, it is a compact summary of what a compilation unit exports
+std::vector<std::string> BuildOutline(const std::vector<ast::Node*>& decls);
+
+} // namespace zl
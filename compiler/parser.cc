@@ -2,7 +2,21 @@
 
 namespace zl {
 
+// primitive type names, they are lexed as identifier
+static const char* primitiveTypes_[] = {
+    "bool", "char", "byte", "short", "int", "long", "float", "double", "string",
+};
+
+static bool IsPrimitiveType(const std::string& name) {
+    for (auto type : primitiveTypes_) {
+        if (name == type)
+            return true;
+    }
+    return false;
+}
+
 void  Parser::Build(std::vector<Node*>& decls) {
+    Next();
     ParseCompilationUnit(decls);
 }
 
@@ -36,38 +50,132 @@ bool Parser::Match(Token::TokenType type) {
 }
 
 // The function just output systax error messge to ErrorHandler
-void Parser::SyntaxErrorAt(const Token& token, const std::string& msg) {}
-void Parser::SyntaxErrorAt(const Location& location, const std::string& msg) {}
-void Parser::SyntaxError(const std::string& msg) {}
+void Parser::SyntaxErrorAt(const Token& token, const std::string& msg) {
+    SyntaxErrorAt(token.location_, msg);
+}
+
+void Parser::SyntaxErrorAt(const Location& location, const std::string& msg) {
+    // Only the first error of one line is reported, the others are most
+    // likely caused by the first one
+    if (location.GetLineno() == lastErrorLine_)
+        return;
+    lastErrorLine_ = location.GetLineno();
+    errorHandler_.ErrorAt(location, msg);
+}
+
+void Parser::SyntaxError(const std::string& msg) {
+    SyntaxErrorAt(location_, msg);
+}
+
 void Parser::ErrorExpected(const Location& location, const std::string& msg) {
+    std::string found;
+    if (Match(Token::END_OF_FILE))
+        found = "EOF";
+    else
+        found = "'" + literal_ + "'";
+    SyntaxErrorAt(location, "expected " + msg + ", found " + found);
+}
+
+// Return true if the token can start an expression
+bool Parser::IsExprStart(int type) {
+    switch (type) {
+        case Token::ID:
+        case Token::INT:
+        case Token::FLOAT:
+        case Token::CHAR:
+        case Token::STRING:
+        case Token::TRUE:
+        case Token::FALSE:
+        case Token::NIL:
+        case Token::NEW:
+        case Token::LPAREN:
+        case Token::LBRACK:
+        case Token::ADD:
+        case Token::SUB:
+        case Token::NOT:
+        case Token::XOR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Return true if the token start a statement with keyword
+bool Parser::IsStmtKeyword(int type) {
+    switch (type) {
+        case Token::VAR:
+        case Token::CONST:
+        case Token::IF:
+        case Token::FOR:
+        case Token::FOREACH:
+        case Token::WHILE:
+        case Token::DO:
+        case Token::SWITCH:
+        case Token::RETURN:
+        case Token::BREAK:
+        case Token::CONTINUE:
+        case Token::ASSERT:
+        case Token::DEFER:
+        case Token::THROW:
+        case Token::TRY:
+            return true;
+        default:
+            return false;
+    }
 }
 
 // SyncStmt advances to the next statement, Used for synchronization after an error.
 void Parser::SyncStmt() {
+    Next();
+    while (!Match(Token::END_OF_FILE) && !Match(Token::RBRACE)) {
+        if (IsStmtKeyword(token_.type_))
+            return;
+        Next();
+    }
 }
 // SyncDecl advances to the next declaration. Used for synchronization after an error.
 void Parser::SyncDecl() {
+    Next();
+    while (!Match(Token::END_OF_FILE)) {
+        switch (token_.type_) {
+            case Token::PACKAGE:
+            case Token::IMPORT:
+            case Token::USING:
+            case Token::CONST:
+            case Token::VAR:
+            case Token::FUNC:
+            case Token::CLASS:
+            case Token::INTERFACE:
+            case Token::PUBLIC:
+            case Token::PRIVATE:
+                return;
+            default:
+                Next();
+                break;
+        }
+    }
 }
 
 // ParseCompilationUnit will iterate all tokens to match declarations
 // compilationUnit
 //    : scopeModifier? declaration* EOF
 //    ;
-void Parser::ParseCompilationUnit(std::vector<Node*>& decls) { 
-    while (!lexer_.Eof()) {
+void Parser::ParseCompilationUnit(std::vector<Node*>& decls) {
+    while (!Match(Token::END_OF_FILE)) {
         Token token;
         if (Match(Token::PRIVATE) || Match(Token::PUBLIC))  {
-            token = lexer_.Next();
+            token = token_;
+            Next();
         }
         if (ast::Decl* decl = ParseDeclaration(token); decl)
             decls.push_back(decl);
     }
 }
 
-// Declaration nonterminal parser function 
+// Declaration nonterminal parser function
 // declaration
-//    : packageDeclaration 
-//    | importDeclaration 
+//    : packageDeclaration
+//    | importDeclaration
 //    | usingDeclaration
 //    | constDeclaration
 //    | varDeclaration
@@ -75,12 +183,11 @@ void Parser::ParseCompilationUnit(std::vector<Node*>& decls) {
 //    | classDeclaration
 //    | interfaceDeclaration
 //    ;
-ast::Decl* Parser::ParseDeclaration(const Token& publicityToken) { 
+ast::Decl* Parser::ParseDeclaration(const Token& publicityToken) {
     bool publicity = (publicityToken.type_ == Token::PUBLIC);
-    Token token = lexer_.Peek(); 
     ast::Decl* decl;
 
-    switch (token.type_) {
+    switch (token_.type_) {
         case Token::PACKAGE:
             if (publicityToken.Valid())
                 SyntaxErrorAt(publicityToken.location_, "scope specifier not allowed here");
@@ -107,10 +214,10 @@ ast::Decl* Parser::ParseDeclaration(const Token& publicityToken) {
             decl = ParseVarDeclaration();
             break;
 
-        case Token::FUNC: 
+        case Token::FUNC:
             decl = ParseFunctionDeclaration();
             break;
- 
+
         case Token::CLASS:
             decl = ParseClassDeclaration();
             break;
@@ -119,8 +226,14 @@ ast::Decl* Parser::ParseDeclaration(const Token& publicityToken) {
             decl = ParseInterfaceDecl();
             break;
 
+        case Token::SEMICOLON:
+            Next();
+            decl = nullptr;
+            break;
+
        default:
             SyntaxError("unknown declaration");
+            SyncDecl();
             decl = nullptr;
             break;
     }
@@ -130,18 +243,18 @@ ast::Decl* Parser::ParseDeclaration(const Token& publicityToken) {
 }
 
 // packageDeclaration
-//    : 'package' IDENTIFIER 
-ast::Decl* Parser::ParsePackageDeclaration() { 
+//    : 'package' IDENTIFIER
+ast::Decl* Parser::ParsePackageDeclaration() {
     auto location = Expect(Token::PACKAGE);
     auto identifier = ParseIdentifier();
     return new ast::PackageDecl(location, identifier);
 }
 
 // importDeclaration
-//    : 'import' qualifiedName 
+//    : 'import' qualifiedName
 //    ;
-ast::Decl* Parser::ParseImportDeclaration() { 
-    auto location = Expect(Token::PACKAGE);
+ast::Decl* Parser::ParseImportDeclaration() {
+    auto location = Expect(Token::IMPORT);
     auto qualifiedName = ParseQualifiedName();
     return new ast::ImportDecl(location, qualifiedName);
 }
@@ -149,11 +262,11 @@ ast::Decl* Parser::ParseImportDeclaration() {
 // usingDeclaration
 //    : 'using' qualifiedName '=' IDENTIFIER
 //    ;
-ast::Decl* Parser::ParseUsingDeclaration() { 
+ast::Decl* Parser::ParseUsingDeclaration() {
     auto location = Expect(Token::USING);
     auto qualifiedName = ParseQualifiedName();
     Expect(Token::ASSIGN);
-    auto identifier = ParseIdentifier(); 
+    auto identifier = ParseIdentifier();
     return new ast::UsingDecl(location, qualifiedName, identifier);
 }
 
@@ -162,8 +275,9 @@ ast::Decl* Parser::ParseUsingDeclaration() {
 //        : 'var' varBlockDeclaration | singleVarDeclaration
 //        ;
 ast::Decl* Parser::ParseVarDeclaration() {
+    Expect(Token::VAR);
     if (Match(Token::LPAREN))
-        return ParseVarBlockDeclaration(); 
+        return ParseVarBlockDeclaration();
     else
         return ParseSingleVarDeclaration();
 }
@@ -175,7 +289,12 @@ ast::Decl* Parser::ParseVarBlockDeclaration() {
     std::vector<ast::VariableDecl*> decls;
     auto location = Expect(Token::LPAREN);
 
-    while (!Match(Token::RPAREN)) {
+    while (!Match(Token::RPAREN) && !Match(Token::END_OF_FILE)) {
+        if (!Match(Token::ID)) {
+            ErrorExpected(location_, "variable declaration");
+            Next();
+            continue;
+        }
         auto varDecl = ParseSingleVarDeclaration();
         decls.push_back(varDecl);
     }
@@ -184,15 +303,24 @@ ast::Decl* Parser::ParseVarBlockDeclaration() {
 }
 
 // singleSingleVarDeclaration:
-//    : IDENTIFIER ':' IDENTIFIER ('=' expression)?
+//    : IDENTIFIER ':' type ('=' expression)?
 //    ;
 ast::VariableDecl* Parser::ParseSingleVarDeclaration() {
     auto location = location_;
     auto identifier = ParseIdentifier();
-    Match(Token::ASSIGN);
-    auto type = ParseType();
-    auto expr = ParseVariableInitializer();
-    return new ast::VariableDecl(location, identifier, type, expr);
+    ast::Type* type = nullptr;
+    ast::VarInitializer* varInitializer = nullptr;
+
+    // The type may be omitted only if the initializer is given
+    if (Match(Token::COLON) || !Match(Token::ASSIGN)) {
+        Expect(Token::COLON);
+        type = ParseType();
+    }
+    if (Match(Token::ASSIGN)) {
+        Next();
+        varInitializer = ParseVariableInitializer();
+    }
+    return new ast::VariableDecl(location, identifier, type, varInitializer);
 }
 
 
@@ -200,10 +328,11 @@ ast::VariableDecl* Parser::ParseSingleVarDeclaration() {
 //    : 'const' constBlockDeclaration | singleConstDeclaration
 //    ;
 ast::Decl* Parser::ParseConstDeclaration() {
+    Expect(Token::CONST);
     if (Match(Token::LPAREN))
         return ParseConstBlockDeclaration();
-    else 
-        return ParseSingleVarDeclaration();
+    else
+        return ParseSingleConstDeclaration();
 }
 
 // constBlockDeclaration
@@ -213,7 +342,12 @@ ast::ConstBlockDecl* Parser::ParseConstBlockDeclaration() {
     std::vector<ast::ConstDecl*> declarations;
 
     auto location = Expect(Token::LPAREN);
-    while (!Match(Token::RPAREN)) {
+    while (!Match(Token::RPAREN) && !Match(Token::END_OF_FILE)) {
+        if (!Match(Token::ID)) {
+            ErrorExpected(location_, "constant declaration");
+            Next();
+            continue;
+        }
         if (auto decl  = ParseSingleConstDeclaration(); decl)
             declarations.push_back(decl);
     }
@@ -222,7 +356,7 @@ ast::ConstBlockDecl* Parser::ParseConstBlockDeclaration() {
 }
 
 // singleConstDeclaration
-//    : IDENTIFIER (':' type)? ('=' variablieInitialization)?
+//    : IDENTIFIER (':' type)? ('=' constExpression)?
 //    ;
 ast::ConstDecl* Parser::ParseSingleConstDeclaration() {
     auto location = location_;
@@ -236,16 +370,20 @@ ast::ConstDecl* Parser::ParseSingleConstDeclaration() {
     }
     if (Match(Token::ASSIGN)) {
         Next();
-        varInitializer = ParseVariableInitializer();
+        varInitializer = new ast::VarInitializer(location_, ParseConstExpr());
     }
-    return new ast::ConstDecl(location, nameId, type, varInitializer); 
+    return new ast::ConstDecl(location, nameId, type, varInitializer);
 }
 
 // functionDeclaration
-//    : 'func' IDENTIFIER formalParameters (':' functionReturnParameters)?  functionBodyDeclaration
+//    : 'func' IDENTIFIER formalParameters (':' functionReturnParameters)?  functionBlockDeclaration
 //    ;
+// Class method shares the function except the 'func' keyword, and its body
+// may be omitted.
 ast::FunctionDecl* Parser::ParseFunctionDeclaration() {
-    auto location = location_;  
+    auto location = location_;
+    if (Match(Token::FUNC))
+        Next();
     auto nameId = ParseIdentifier();
     auto formalParameters = ParseFormalParameters();
     ast::ReturnParameterList* returnParams = nullptr;
@@ -254,9 +392,11 @@ ast::FunctionDecl* Parser::ParseFunctionDeclaration() {
         Next();
         returnParams = ParseFunctionReturnParameters();
     }
-    auto functionBlockDecl = ParseFunctionBlockDeclaration();
+    ast::FunctionBlockDecl* functionBlockDecl = nullptr;
+    if (Match(Token::LBRACE))
+        functionBlockDecl = ParseFunctionBlockDeclaration();
 
-    return new ast::FunctionDecl(location, nameId, formalParameters, 
+    return new ast::FunctionDecl(location, nameId, formalParameters,
             returnParams, functionBlockDecl);
 }
 
@@ -265,7 +405,11 @@ ast::FunctionDecl* Parser::ParseFunctionDeclaration() {
 //    ;
 ast::FormalParameterList* Parser::ParseFormalParameters() {
     Expect(Token::LPAREN);
-    auto formalParameterList = ParseFormalParameterList();
+    ast::FormalParameterList* formalParameterList;
+    if (Match(Token::RPAREN))
+        formalParameterList = new ast::FormalParameterList(location_, {});
+    else
+        formalParameterList = ParseFormalParameterList();
     Expect(Token::RPAREN);
     return formalParameterList;
 }
@@ -282,7 +426,7 @@ ast::FormalParameterList* Parser::ParseFormalParameterList() {
         Next();
         parameterList.push_back(ParseFormalParameter());
     }
-    return new ast::FormalParameterList(location, parameterList); 
+    return new ast::FormalParameterList(location, parameterList);
 }
 
 // formalParameter
@@ -302,13 +446,14 @@ ast::FormalParameter* Parser::ParseFormalParameter() {
 ast::ReturnParameterList* Parser::ParseFunctionReturnParameters() {
     auto location = location_;
     std::vector<ast::Type*> types;
-    
+
     if (Match(Token::LPAREN) ) {
         Next();
         types = ParseTypeList();
         Expect(Token::RPAREN);
     } else if (Match(Token::VOID)) {
         // Do nothing for void type
+        Next();
     } else if (Match(Token::LBRACE)) {
         // Do nothing for void type
     } else {
@@ -323,19 +468,13 @@ ast::ReturnParameterList* Parser::ParseFunctionReturnParameters() {
 //    : block
 //    ;
 ast::FunctionBlockDecl* Parser::ParseFunctionBlockDeclaration() {
-    auto location = location_;
-    std::vector<ast::Node*> nodes;
+    auto location = Expect(Token::LBRACE);
+    auto functionBlockDecl = new ast::FunctionBlockDecl(location);
 
-    Expect(Token::LBRACE);
-    while (!Match(Token::RBRACE)) {
-        Next();
-        if (token_.type_ == Token::VAR) 
-            nodes.push_back(ParseVarDeclaration());
-        else 
-            nodes.push_back(ParseStmt());
-    }
+    for (auto stmt : ParseStatements())
+        functionBlockDecl->Add(stmt);
     Expect(Token::RBRACE);
-    return new ast::FunctionBlockDecl(location);
+    return functionBlockDecl;
 }
 
 // qualifiedName
@@ -343,13 +482,13 @@ ast::FunctionBlockDecl* Parser::ParseFunctionBlockDeclaration() {
 //    ;
 ast::QualifiedName* Parser::ParseQualifiedName() {
     std::vector<std::string> names;
-    
-    auto location = Expect(Token::ID);
+
     names.push_back(literal_);
+    auto location = Expect(Token::ID);
     while (Match(Token::PERIOD)) {
         Next();
-        Expect(Token::ID);
         names.push_back(literal_);
+        Expect(Token::ID);
     }
     return new ast::QualifiedName(location, names);
 }
@@ -371,9 +510,9 @@ ast::QualifiedNameList* Parser::ParseQualifiedNameList() {
 
 // interfaceMethodDecl
 //    : IDENTIFIER formalParameters (':' (type | 'void'))? ('throw' qualifiedNameList)?
-// 
+//
 ast::InterfaceMethodDecl* Parser::ParseInterfaceMethod() {
-    auto location = location_;  
+    auto location = location_;
     auto nameId = ParseIdentifier();
     auto formalParameters = ParseFormalParameters();
     ast::ReturnParameterList* returnParams = nullptr;
@@ -389,12 +528,17 @@ ast::InterfaceMethodDecl* Parser::ParseInterfaceMethod() {
 //    : 'interface' '{' interfaceMethodDecl* '}'
 //    ;
 ast::InterfaceDecl* Parser::ParseInterfaceDecl() {
-    auto location = location_;
+    auto location = Expect(Token::INTERFACE);
     auto methodName = ParseIdentifier();
     std::vector<ast::InterfaceMethodDecl*> methods;
 
     Expect(Token::LBRACE);
-    while (!Match(Token::RBRACE)) {
+    while (!Match(Token::RBRACE) && !Match(Token::END_OF_FILE)) {
+        if (!Match(Token::ID)) {
+            ErrorExpected(location_, "interface method");
+            Next();
+            continue;
+        }
         if (auto method  = ParseInterfaceMethod(); method)
             methods.push_back(method);
     }
@@ -403,14 +547,14 @@ ast::InterfaceDecl* Parser::ParseInterfaceDecl() {
 }
 
 // classDeclaration
-//    : 'class' IDENTIFIER ('implements' qualifiedNameList)? 
+//    : 'class' IDENTIFIER ('implements' qualifiedNameList)?
 //     '{' classBodyDeclaration* '}'
 //    ;
 ast::ClassDecl* Parser::ParseClassDeclaration() {
-    auto location = location_;
+    auto location = Expect(Token::CLASS);
     auto className = ParseIdentifier();
     QualifiedNameList* interfaceList = nullptr;
-    
+
     if (Match(Token::IMPLEMENTS)) {
         Next();
         interfaceList = ParseQualifiedNameList();
@@ -422,7 +566,7 @@ ast::ClassDecl* Parser::ParseClassDeclaration() {
 }
 
 // classBodyDeclaration
-//    : (classSectionSpecifier)? classMethodDeclaration |classVariableDeclaration 
+//    : (classSectionSpecifier)? classMethodDeclaration |classVariableDeclaration
 //    ;
 ast::ClassBodyDecl* Parser::ParseClassBody() {
     auto location = location_;
@@ -430,24 +574,35 @@ ast::ClassBodyDecl* Parser::ParseClassBody() {
     std::vector<ast::FunctionDecl*> functions;
     bool publicity = false;
 
-    while (!Match(Token::RBRACE)) {
+    while (!Match(Token::RBRACE) && !Match(Token::END_OF_FILE)) {
         if (token_.type_ == Token::PRIVATE || token_.type_ == Token::PUBLIC) {
             publicity = (token_.type_ == Token::PUBLIC);
             Next();
             Expect(Token::COLON);
             continue;
         }
+        bool isStatic = false;
+        if (Match(Token::STATIC)) {
+            isStatic = true;
+            Next();
+        }
+        if (!Match(Token::ID)) {
+            ErrorExpected(location_, "class member");
+            Next();
+            continue;
+        }
         // method and varaible declaration both begin with identifier
-        Expect(Token::ID);
-        if (Match(Token::LPAREN)) { // method declaration
-            Back();
-            functions.push_back(ParseFunctionDeclaration());
-        } else { // variable declaration 
-            Back();
-            variables.push_back((ast::VariableDecl*)ParseVarDeclaration());
+        if (lexer_.Peek().type_ == Token::LPAREN) { // method declaration
+            auto function = ParseFunctionDeclaration();
+            function->SetPublic(publicity);
+            function->isStatic_ = isStatic;
+            functions.push_back(function);
+        } else { // variable declaration
+            auto variable = ParseSingleVarDeclaration();
+            variable->SetPublic(publicity);
+            variables.push_back(variable);
         }
     }
-    Expect(Token::RBRACE);
     return new ast::ClassBodyDecl(location, variables, functions);
 }
 
@@ -456,8 +611,14 @@ ast::ClassBodyDecl* Parser::ParseClassBody() {
 //    ;
 std::vector<ast::Stmt*> Parser::ParseStatements() {
     std::vector<ast::Stmt*> stmts;
-    while (ast::Stmt* stmt = ParseStatement())
-        stmts.push_back(stmt);
+    while (!Match(Token::RBRACE) && !Match(Token::END_OF_FILE)) {
+        // empty statement
+        if (Match(Token::SEMICOLON)) {
+            Next();
+            continue;
+        }
+        stmts.push_back(ParseStatement());
+    }
     return stmts;
 }
 
@@ -467,81 +628,163 @@ std::vector<ast::Stmt*> Parser::ParseStatements() {
 //     | foreachStatement
 //     | doStatement
 //     | whileStatement
+//     | switchStatement
 //     | returnStatement
 //     | tryStatement
 //     | throwStatement
 //     | breakStatement
 //     | continueStatement
 //     | assertStatement
+//     | deferStatement
 //     | expressionStatement
 //     | labelStatement
 //     | blockStatement
 //     | localVariableDeclarationStatement
 //     ;
 ast::Stmt* Parser::ParseStatement() {
-    Next();
+    auto location = location_;
     switch (token_.type_) {
+        case Token::VAR:
+        case Token::CONST:
+            return new ast::DeclStmt(location, ParseLocalVaraible());
         case Token::IF:
             return ParseIfStatement();
         case Token::FOR:
             return ParseForStatement();
         case Token::FOREACH:
             return ParseForeachStatement();
+        case Token::WHILE:
+            return ParseWhileStatement();
+        case Token::DO:
+            return ParseDoStatement();
+        case Token::SWITCH:
+            return ParseSwitchStatement();
+        case Token::RETURN:
+            return ParseReturnStatement();
+        case Token::BREAK:
+            return ParseBreakStatement();
+        case Token::CONTINUE:
+            return ParseContinueStatement();
+        case Token::ASSERT:
+            return ParseAssertStatement();
+        case Token::DEFER:
+            return ParseDeferStatement();
+        case Token::THROW:
+            return ParseThrowStatement();
+        case Token::TRY:
+            return ParseTryStatement();
+        case Token::LBRACE:
+            return ParseBlockStatement();
         case Token::ID:
-            if (Match(Token::COLON))
+            if (lexer_.Peek().type_ == Token::COLON)
                 return ParseLabelStatement();
-            else 
-                return ParseExprStatement();
+            return ParseSimpleStatement();
         default:
+            if (IsExprStart(token_.type_))
+                return ParseSimpleStatement();
             break;
     }
     SyntaxError("unkown statement");
     SyncStmt();
-    return new UnknownStmt(location_);
+    return new UnknownStmt(location);
+}
+
+// local variable declaration statement
+// localVariableDeclarationStatement
+//    : variableDeclaration
+//    ;
+ast::Decl* Parser::ParseLocalVaraible() {
+    if (Match(Token::CONST))
+        return ParseConstDeclaration();
+    return ParseVarDeclaration();
 }
 
 // labelStatement
-//    : IDENTIFIER ':' 
+//    : IDENTIFIER ':'
 //    ;
+// A local variable may also be declared without 'var' as 'IDENTIFIER : type',
+// it is a label only if a keyword statement or block follows the colon.
 ast::Stmt* Parser::ParseLabelStatement() {
     auto location = location_;
-    const std::string label = token_.assic_;
+    auto identifier = ParseIdentifier();
     Expect(Token::COLON);
-    return new ast::LabelStmt(location, label);
+    if (IsStmtKeyword(token_.type_) || Match(Token::LBRACE)) {
+        auto label = identifier->name_;
+        delete identifier;
+        return new ast::LabelStmt(location, label);
+    }
+    auto type = ParseType();
+    ast::VarInitializer* varInitializer = nullptr;
+    if (Match(Token::ASSIGN)) {
+        Next();
+        varInitializer = ParseVariableInitializer();
+    }
+    return new ast::DeclStmt(location,
+            new ast::VariableDecl(location, identifier, type, varInitializer));
 }
 
 // blockStatement
 //    : '{' statements '}'
 //    ;
 ast::Stmt* Parser::ParseBlockStatement() {
-    return nullptr;
+    auto location = Expect(Token::LBRACE);
+    auto stmts = ParseStatements();
+    Expect(Token::RBRACE);
+    return new ast::BlockStmt(location, stmts);
+}
+
+// simpleStatement
+//    : expressionList (assignmentOperator expressionList)?
+//    | expression ('++' | '--')
+//    ;
+ast::Stmt* Parser::ParseSimpleStatement() {
+    auto location = location_;
+    auto lhs = ParseExprList();
+
+    if (IsAssignOperator(token_.type_)) {
+        int op = token_.type_;
+        Next();
+        auto rhs = ParseExprList();
+        return new ast::AssignStmt(location, lhs, op, rhs);
+    }
+    if (Match(Token::INC) || Match(Token::DEC)) {
+        int op = Match(Token::INC) ? Token::ADD_ASSIGN : Token::SUB_ASSIGN;
+        std::vector<ast::Expr*> rhs = { new ast::LiteralExpr(location_, Token::INT, "1") };
+        Next();
+        return new ast::AssignStmt(location, lhs, op, rhs);
+    }
+    if (lhs.size() > 1) {
+        ErrorExpected(location_, "'='");
+        for (size_t i = 1; i < lhs.size(); i++)
+            delete lhs[i];
+    }
+    return new ast::ExprStmt(location, lhs[0]);
 }
 
 // ifStatement
 //    : 'if' expression  statementBlock ('elif' expression statementBlock)* ('else' statementBlock)?
 //    ;
 ast::Stmt* Parser::ParseIfStatement() {
-    auto location = location_;
+    auto location = Expect(Token::IF);
     bool elseNeed = false;
 
     auto conditionExpr = ParseExpr();
-    auto ifstmt = ParseBlockStatement();
+    auto ifstmt = ParseStatement();
 
     std::vector<std::pair<ast::Expr*, ast::Stmt*>> stmts;
     while (Match(Token::ELIF)) {
         elseNeed = true;
         Next();
         auto expr = ParseExpr();
-        auto stmt = ParseBlockStatement();
+        auto stmt = ParseStatement();
         stmts.push_back(std::make_pair(expr, stmt));
     }
     ast::Stmt* finalStmt = nullptr;
     if (Match(Token::ELSE)) {
         Next();
-        finalStmt = ParseBlockStatement();
+        finalStmt = ParseStatement();
     } else if (elseNeed) {
         SyntaxError("no else statement");
-        SyncStmt();
     } else {
         // Do nothing
     }
@@ -549,24 +792,63 @@ ast::Stmt* Parser::ParseIfStatement() {
     return new ast::IfStmt(location, conditionExpr, ifstmt, stmts, finalStmt);
 }
 
+// exprStatement used in for statement
+//    : IDENTIFIER ':' type ('=' expression)?
+//    | simpleStatement
+//    ;
 ast::ExprStmt* Parser::ParseExprStatement() {
-    return nullptr;
+    auto location = location_;
+    if (Match(Token::ID) && lexer_.Peek().type_ == Token::COLON) {
+        auto identifier = ParseIdentifier();
+        Next();
+        auto type = ParseType();
+        ast::VarInitializer* varInitializer = nullptr;
+        if (Match(Token::ASSIGN)) {
+            Next();
+            varInitializer = ParseVariableInitializer();
+        }
+        return new ast::ExprStmt(location,
+                new ast::VariableDecl(location, identifier, type, varInitializer));
+    }
+    auto stmt = ParseSimpleStatement();
+    if (auto exprStmt = dynamic_cast<ast::ExprStmt*>(stmt); exprStmt)
+        return exprStmt;
+    return new ast::ExprStmt(location, stmt);
 }
+
 ast::ExprStmts* Parser::ParseExprStatements() {
-    return nullptr;
+    auto location = location_;
+    std::vector<ast::ExprStmt*> stmts;
+    stmts.push_back(ParseExprStatement());
+    return new ast::ExprStmts(location, stmts);
 }
 
 
 
 // forStatement
-//    : 'for' 
-//      forInitializer?  ';' expr? ';' exprStmts?  blockStmt
+//    : 'for' '('? forInitializer?  ';' expr? ';' exprStmts? ')'? statement
+//    | 'for' '(' IDENTIFIER 'in' iterableObject ')' statement
 //   ;
 ast::Stmt* Parser::ParseForStatement() {
-    auto location = location_;
+    auto location = Expect(Token::FOR);
     ExprStmts* initializer = nullptr;
     Expr* expr = nullptr;
     ExprStmts* finalizer = nullptr;
+    bool paren = Match(Token::LPAREN);
+
+    if (paren)
+        Next();
+    // 'for (x in items)' is a shorthand of foreach statement
+    if (Match(Token::ID) && lexer_.Peek().type_ == Token::IN) {
+        std::vector<std::string> variables = { literal_ };
+        Next();
+        Expect(Token::IN);
+        auto iterableObject = ParseIterableObject();
+        if (paren)
+            Expect(Token::RPAREN);
+        auto block = ParseStatement();
+        return new ast::ForeachStmt(location, variables, iterableObject, block);
+    }
 
     if (!Match(Token::SEMICOLON))
         initializer = ParseExprStatements();
@@ -576,35 +858,50 @@ ast::Stmt* Parser::ParseForStatement() {
         expr = ParseExpr();
     Expect(Token::SEMICOLON);
 
-    if (!Match(Token::LBRACE))
+    if (!Match(paren ? Token::RPAREN : Token::LBRACE))
         finalizer = ParseExprStatements();
+    if (paren)
+        Expect(Token::RPAREN);
 
-    auto block = ParseBlockStatement();
+    auto block = ParseStatement();
     return new ast::ForStmt(location, initializer, expr, finalizer, block);
 }
 
 // foreachStatement
-//    : 'foreach' IDENTIFIER (',' IDENTIFIER)* 'in' iterableObject  blockStmt 
+//    : 'foreach' '('? foreachVariable (',' foreachVariable)* 'in' iterableObject ')'? statement
 //    ;
+// foreachVariable
+//     : IDENTIFIER (':' type)?
+//     ;
 ast::Stmt* Parser::ParseForeachStatement() {
-    auto location = location_;
+    auto location = Expect(Token::FOREACH);
     std::vector<std::string> variables;
-    Expect(Token::ID);
-    variables.push_back(token_.assic_);
+    bool paren = Match(Token::LPAREN);
 
-    while (Match(Token::COMMA)) {
+    if (paren)
         Next();
+    do {
+        if (!variables.empty())
+            Next();
+        variables.push_back(literal_);
         Expect(Token::ID);
-        variables.push_back(token_.assic_);
-    }
+        // The variable type is inferred from iterable object
+        if (Match(Token::COLON)) {
+            Next();
+            delete ParseType();
+        }
+    } while (Match(Token::COMMA));
+
     Expect(Token::IN);
     auto iterableObject = ParseIterableObject();
-    auto block = ParseBlockStatement();
+    if (paren)
+        Expect(Token::RPAREN);
+    auto block = ParseStatement();
     return new ast::ForeachStmt(location, variables, iterableObject, block);
 }
 
 // iterableObject
-//    : primary 
+//    : primary
 //    | mapInitializer
 //    | arrayInitializer
 //    ;
@@ -615,13 +912,12 @@ ast::Node* Parser::ParseIterableObject() {
         return new ast::IterableObject(location, ParseMapInitializer());
     else if (Match(Token::LBRACK))
         return new ast::IterableObject(location, ParseArrayInitializer());
-    else 
+    else
         return new ast::IterableObject(location, ParsePrimary());
 }
 
 ast::Node* Parser::ParsePrimary() {
-    auto location = location_;
-    return nullptr;
+    return ParsePrimaryExpr();
 }
 
 // arrayInitializer
@@ -630,6 +926,15 @@ ast::Node* Parser::ParsePrimary() {
 //  ;
 std::vector<ast::Node*> Parser::ParseArrayInitializer() {
     std::vector<ast::Node*> elements;
+
+    Expect(Token::LBRACK);
+    while (!Match(Token::RBRACK) && !Match(Token::END_OF_FILE)) {
+        elements.push_back(ParsePrimary());
+        if (!Match(Token::COMMA))
+            break;
+        Next();
+    }
+    Expect(Token::RBRACK);
     return elements;
 }
 
@@ -637,7 +942,6 @@ std::vector<ast::Node*> Parser::ParseArrayInitializer() {
 //  : '{' mapElementPair (',' mapElementPair)* '}'
 //  ;
 std::vector<ast::IterableObject::Element> Parser::ParseMapInitializer() {
-    auto location = location_;
     std::vector<ast::IterableObject::Element> elements;
 
     Expect(Token::LBRACE);
@@ -665,49 +969,102 @@ ast::IterableObject::Element Parser::ParseMapElementPair() {
 //    : 'while' '(' expression ')' statement
 //    ;
 ast::Stmt* Parser::ParseWhileStatement() {
-    return nullptr;
+    auto location = Expect(Token::WHILE);
+    auto conditionExpr = ParseExpr();
+    auto block = ParseStatement();
+    return new ast::WhileStmt(location, conditionExpr, block);
 }
 
 // doStatement
 //    : 'do' statement 'while' '(' expression ')'
 //    ;
 ast::Stmt* Parser::ParseDoStatement() {
-    return nullptr;
+    auto location = Expect(Token::DO);
+    auto block = ParseStatement();
+    Expect(Token::WHILE);
+    auto conditionExpr = ParseExpr();
+    return new ast::DoStmt(location, block, conditionExpr);
 }
 
 // switchStatement
-//    : 'switch' '(' expression ')' '{' switchCase*defaultCase? '}'
+//    : 'switch' '(' expression ')' '{' switchCase* defaultCase? '}'
 //    ;
 ast::Stmt* Parser::ParseSwitchStatement() {
-    return nullptr;
+    auto location = Expect(Token::SWITCH);
+    auto expr = ParseExpr();
+    std::vector<ast::CaseStmt*> cases;
+    ast::CaseStmt* defaultCase = nullptr;
+    Expect(Token::LBRACE);
+    while (Match(Token::CASE) || Match(Token::DEFAULT)) {
+        if (defaultCase)
+            SyntaxError("default must be the last case of a switch");
+        if (Match(Token::CASE))
+            cases.push_back(ParseSwitchCase());
+        else if (defaultCase)
+            delete ParseSwitchDefault();
+        else
+            defaultCase = ParseSwitchDefault();
+    }
+    Expect(Token::RBRACE);
+    return new ast::SwitchStmt(location, expr, cases, defaultCase);
 }
 
 // switchCase
-//    : ('case' expression ':')+ statement
+//    : ('case' expression ':')+ statement*
 //    ;
-ast::Node* Parser::ParseSwitchCase() {
-    return nullptr;
+ast::CaseStmt* Parser::ParseSwitchCase() {
+    auto location = location_;
+    std::vector<ast::Expr*> exprs;
+    while (Match(Token::CASE)) {
+        Next();
+        exprs.push_back(ParseExpr());
+        Expect(Token::COLON);
+    }
+    return new ast::CaseStmt(location, exprs, ParseCaseStatements());
 }
 
 // defaultCase
-//    : 'default' ':' statement
+//    : 'default' ':' statement*
 //    ;
-ast::Node* Parser::ParseSwitchDefault() {
-    return nullptr;
+ast::CaseStmt* Parser::ParseSwitchDefault() {
+    auto location = Expect(Token::DEFAULT);
+    Expect(Token::COLON);
+    return new ast::CaseStmt(location, std::vector<ast::Expr*>(), ParseCaseStatements());
+}
+
+// The statements of a case run until the next case
+ast::Stmt* Parser::ParseCaseStatements() {
+    auto location = location_;
+    std::vector<ast::Stmt*> stmts;
+    while (!Match(Token::CASE) && !Match(Token::DEFAULT) && !Match(Token::RBRACE) &&
+            !Match(Token::END_OF_FILE)) {
+        if (Match(Token::SEMICOLON)) {
+            Next();
+            continue;
+        }
+        stmts.push_back(ParseStatement());
+    }
+    return new ast::BlockStmt(location, stmts);
 }
 
 // returnStatement
 //    : 'return' expression? ';'
 //    ;
+// Without semicolon the returned expressions must start on the same line
 ast::Stmt* Parser::ParseReturnStatement() {
-    return nullptr;
+    auto location = Expect(Token::RETURN);
+    std::vector<ast::Expr*> exprs;
+    if (IsExprStart(token_.type_) && location_.GetLineno() == location.GetLineno())
+        exprs = ParseExprList();
+    return new ast::ReturnStmt(location, exprs);
 }
 
 // breakStatement
 //    : 'break' ';'
 //    ;
 ast::Stmt* Parser::ParseBreakStatement() {
-    return nullptr;
+    auto location = Expect(Token::BREAK);
+    return new ast::BreakStmt(location);
 }
 
 // continueStatement
@@ -715,14 +1072,35 @@ ast::Stmt* Parser::ParseBreakStatement() {
 //    : 'continue' IDENTIFIER? ';'
 //    ;
 ast::Stmt* Parser::ParseContinueStatement() {
-    return nullptr;
+    auto location = Expect(Token::CONTINUE);
+    std::string label;
+    if (Match(Token::ID) && location_.GetLineno() == location.GetLineno()) {
+        label = literal_;
+        Next();
+    }
+    return new ast::ContinueStmt(location, label);
 }
 
 // assertStatement
 //    : 'assert' '(' expression ')' ';'
 //    ;
 ast::Stmt* Parser::ParseAssertStatement() {
-    return nullptr;
+    auto location = Expect(Token::ASSERT);
+    auto expr = ParseExpr();
+    return new ast::AssertStmt(location, expr);
+}
+
+// deferStatement
+//    : 'defer' expression ';'
+//    ;
+ast::Stmt* Parser::ParseDeferStatement() {
+    auto location = Expect(Token::DEFER);
+    auto expr = ParseExpr();
+    if (expr && expr->Kind() == ast::NodeKind::CallExpr)
+        return new ast::DeferStmt(location, static_cast<ast::CallExpr*>(expr));
+    SyntaxErrorAt(location, "expression in defer must be a function call");
+    delete expr;
+    return new UnknownStmt(location);
 }
 
 
@@ -730,42 +1108,70 @@ ast::Stmt* Parser::ParseAssertStatement() {
 //    : 'throw' expression ';'
 //    ;
 ast::Stmt* Parser::ParseThrowStatement() {
-    return nullptr;
+    auto location = Expect(Token::THROW);
+    auto expr = ParseExpr();
+    return new ast::ThrowStmt(location, expr);
 }
 
 // tryStatement
 //    : 'try' block catchParts? finallyPart?
 //    ;
 ast::Stmt* Parser::ParseTryStatement() {
-    return nullptr;
+    auto location = Expect(Token::TRY);
+    auto block = ParseBlockStatement();
+    auto catches = ParseCatchParts();
+    ast::FinallyStmt* finally = nullptr;
+    if (Match(Token::FINALLY))
+        finally = ParseFinallyPart();
+    if (catches.empty() && !finally)
+        SyntaxErrorAt(location, "try without catch or finally");
+    return new ast::TryStmt(location, block, catches, finally);
 }
 
 // catchParts
 //    : catchPart*
 //    ;
-ast::Stmt* Parser::ParseCatchParts() {
-    return nullptr;
+std::vector<ast::CatchStmt*> Parser::ParseCatchParts() {
+    std::vector<ast::CatchStmt*> catches;
+    while (Match(Token::CATCH))
+        catches.push_back(ParseCatchPart());
+    return catches;
 }
 
 // catchPart
-//    : 'catch' '('catchType IDENTIFIER ')' block 
+//    : 'catch' '('catchType IDENTIFIER ')' block
 //    ;
-ast::Stmt* Parser::ParseCatchPart() {
-    return nullptr;
+ast::CatchStmt* Parser::ParseCatchPart() {
+    auto location = Expect(Token::CATCH);
+    Expect(Token::LPAREN);
+    auto types = ParseCatchType();
+    auto name = ParseIdentifier();
+    Expect(Token::RPAREN);
+    auto block = ParseBlockStatement();
+    return new ast::CatchStmt(location, types, name, block);
 }
 
 // catchType
 //    : qualifiedName ( '|' qualifiedName)*
 //    ;
-ast::Node* Parser::ParseCatchType() {
-    return nullptr;
+// The names of primitive types are allowed too, to catch values which are
+// not instances
+std::vector<ast::Type*> Parser::ParseCatchType() {
+    std::vector<ast::Type*> types;
+    types.push_back(ParseType());
+    while (Match(Token::OR)) {
+        Next();
+        types.push_back(ParseType());
+    }
+    return types;
 }
 
 // finallyPart
 //    : 'finally' block
 //    ;
-ast::Stmt* Parser::ParseFinallyPart() {
-    return nullptr;
+ast::FinallyStmt* Parser::ParseFinallyPart() {
+    auto location = Expect(Token::FINALLY);
+    return new ast::FinallyStmt(location, ParseBlockStatement());
 }
 
 // type
@@ -774,7 +1180,26 @@ ast::Stmt* Parser::ParseFinallyPart() {
 //    | mapType
 //    ;
 ast::Type* Parser::ParseType() {
-    return nullptr;
+    auto location = location_;
+    ast::Type* type = nullptr;
+
+    if (Match(Token::MAP))
+        return ParseMapType();
+    if (!Match(Token::ID)) {
+        ErrorExpected(location_, "type");
+        return nullptr;
+    }
+    if (IsPrimitiveType(literal_))
+        type = ParsePrimitiveType();
+    else
+        type = ParseClassType();
+
+    while (Match(Token::LBRACK) && lexer_.Peek().type_ == Token::RBRACK) {
+        Next();
+        Next();
+        type = new ast::ArrayType(location, type);
+    }
+    return type;
 }
 
 // typeList
@@ -782,29 +1207,55 @@ ast::Type* Parser::ParseType() {
 //    ;
 std::vector<ast::Type*> Parser::ParseTypeList() {
     std::vector<ast::Type*> types;
+    types.push_back(ParseType());
+    while (Match(Token::COMMA)) {
+        Next();
+        types.push_back(ParseType());
+    }
     return types;
 }
 
 // classType
 //   : qualifiedName
 //    ;
-Node* Parser::ParseClassType() {
-    return nullptr;
+ast::Type* Parser::ParseClassType() {
+    auto location = location_;
+    auto qualifiedName = ParseQualifiedName();
+    std::string name;
+    for (auto& item : qualifiedName->names_) {
+        if (!name.empty())
+            name += ".";
+        name += item;
+    }
+    delete qualifiedName;
+    return new ast::NonPrimitiveType(location, new ast::Identifier(location, name));
 }
 
 // mapType
-//    : 'map' '<' mapItemType ','  mapItemType '>' 
+//    : 'map' '<' mapItemType ','  mapItemType '>'
 //    ;
-Node* Parser::ParseMapType() {
-    return nullptr;
+ast::Type* Parser::ParseMapType() {
+    auto location = Expect(Token::MAP);
+    Expect(Token::LSS);
+    auto leftType = ParseMapItemType();
+    Expect(Token::COMMA);
+    auto rightType = ParseMapItemType();
+    // '>>' closes two type argument lists, split it and keep the last '>'
+    if (Match(Token::SHR)) {
+        token_.type_ = Token::GTR;
+        literal_ = token_.assic_ = ">";
+    } else {
+        Expect(Token::GTR);
+    }
+    return new ast::MapType(location, leftType, rightType);
 }
 
 // mapItemType
 //    : primitiveType
 //    | classType
 //    ;
-Node* Parser::ParseMapItemType() {
-    return nullptr;
+ast::Type* Parser::ParseMapItemType() {
+    return ParseType();
 }
 
 // primitiveType
@@ -818,18 +1269,241 @@ Node* Parser::ParseMapItemType() {
 //    | 'double'
 //    | 'string'
 //    ;
-Node* Parser::ParsePrimitiveType() {
-    return nullptr;
+ast::Type* Parser::ParsePrimitiveType() {
+    auto type = new ast::PrimitiveType(location_, literal_);
+    Next();
+    return type;
 }
 
-VarInitializer* Parser::ParseVariableInitializer(){ return nullptr; }
+VarInitializer* Parser::ParseVariableInitializer() {
+    auto location = location_;
+    return new ast::VarInitializer(location, ParseExpr());
+}
 
-// Statement parser functions
+// Expression parser functions
 
+ast::Identifier* Parser::ParseIdentifier() {
+    if (Match(Token::ID)) {
+        auto identifier = new ast::Identifier(token_);
+        Next();
+        return identifier;
+    }
+    ErrorExpected(location_, "identifier");
+    return new ast::Identifier(location_, "_");
+}
 
+Expr* Parser::ParseExpr() {
+    return ParseBinaryExpr(1);
+}
 
+// expressionList
+//    : expression (',' expression)*
+//    ;
+std::vector<ast::Expr*> Parser::ParseExprList() {
+    std::vector<ast::Expr*> exprs;
+    exprs.push_back(ParseExpr());
+    while (Match(Token::COMMA)) {
+        Next();
+        exprs.push_back(ParseExpr());
+    }
+    return exprs;
+}
+
+static int Precedence(int type) {
+    switch (type) {
+        case Token::LOR:
+            return 1;
+        case Token::LAND:
+            return 2;
+        case Token::OR:
+            return 3;
+        case Token::XOR:
+            return 4;
+        case Token::AND:
+        case Token::AND_NOT:
+            return 5;
+        case Token::EQL:
+        case Token::NEQ:
+            return 6;
+        case Token::LSS:
+        case Token::LEQ:
+        case Token::GTR:
+        case Token::GEQ:
+            return 7;
+        case Token::SHL:
+        case Token::SHR:
+            return 8;
+        case Token::ADD:
+        case Token::SUB:
+            return 9;
+        case Token::MUL:
+        case Token::QUO:
+        case Token::REM:
+            return 10;
+        default:
+            return 0;
+    }
+}
 
+// Binary operators of same precedence are left associative
+ast::Expr* Parser::ParseBinaryExpr(int precedence) {
+    auto expr = ParseUnaryExpr();
+    for (int prec = Precedence(token_.type_); prec >= precedence; prec = Precedence(token_.type_)) {
+        auto location = location_;
+        int op = token_.type_;
+        Next();
+        auto right = ParseBinaryExpr(prec + 1);
+        expr = new ast::BinaryExpr(location, op, expr, right);
+    }
+    return expr;
+}
+
+// unaryExpr
+//    : ('+' | '-' | '!' | '^') unaryExpr
+//    | primaryExpr selector*
+//    ;
+ast::Expr* Parser::ParseUnaryExpr() {
+    switch (token_.type_) {
+        case Token::ADD:
+        case Token::SUB:
+        case Token::NOT:
+        case Token::XOR: {
+            auto location = location_;
+            int op = token_.type_;
+            Next();
+            return new ast::UnaryExpr(location, op, ParseUnaryExpr());
+        }
+        default:
+            return ParsePrimaryExpr();
+    }
+}
 
+// primaryExpr selector*
+// selector
+//    : '.'IDENTIFIER
+//    | '[' expression ']'
+//    | arguments
+//    ;
+ast::Expr* Parser::ParsePrimaryExpr() {
+    auto expr = ParseOperand();
+    while (true) {
+        auto location = location_;
+        if (Match(Token::PERIOD)) {
+            Next();
+            expr = new ast::SelectorExpr(location, expr, ParseIdentifier());
+        } else if (Match(Token::LBRACK)) {
+            Next();
+            auto index = ParseExpr();
+            Expect(Token::RBRACK);
+            expr = new ast::IndexExpr(location, expr, index);
+        } else if (Match(Token::LPAREN)) {
+            expr = new ast::CallExpr(location, expr, ParseArguments());
+        } else {
+            break;
+        }
+    }
+    return expr;
+}
+
+// primaryExpr
+//    : 'true' | 'false' | 'null'
+//    | NUMBER | FLOATNUMBER | STRING
+//    | mapLiteral | arrayLiteral
+//    | IDENTIFIER
+//    | '(' expression ')'
+//    | 'new' type arguments
+//    ;
+ast::Expr* Parser::ParseOperand() {
+    auto location = location_;
+    switch (token_.type_) {
+        case Token::ID:
+            return ParseIdentifier();
+
+        case Token::INT:
+        case Token::FLOAT:
+        case Token::CHAR:
+        case Token::STRING:
+        case Token::TRUE:
+        case Token::FALSE:
+        case Token::NIL: {
+            auto literal = new ast::LiteralExpr(location, token_.type_, literal_);
+            Next();
+            return literal;
+        }
+
+        case Token::LPAREN: {
+            Next();
+            auto expr = ParseExpr();
+            Expect(Token::RPAREN);
+            return expr;
+        }
+
+        // arrayLiteral
+        //    :'[' expressionList? ']'
+        //    ;
+        case Token::LBRACK: {
+            std::vector<ast::Expr*> elements;
+            Next();
+            while (!Match(Token::RBRACK) && !Match(Token::END_OF_FILE)) {
+                elements.push_back(ParseExpr());
+                if (!Match(Token::COMMA))
+                    break;
+                Next();
+            }
+            Expect(Token::RBRACK);
+            return new ast::ArrayLiteralExpr(location, elements);
+        }
+
+        // mapLiteral
+        //    : '{' mapLiteralItems? '}'
+        //    ;
+        case Token::LBRACE: {
+            std::vector<ast::MapLiteralExpr::Element> elements;
+            Next();
+            while (!Match(Token::RBRACE) && !Match(Token::END_OF_FILE)) {
+                auto key = ParseExpr();
+                Expect(Token::COLON);
+                auto value = ParseExpr();
+                elements.push_back(std::make_pair(key, value));
+                if (!Match(Token::COMMA))
+                    break;
+                Next();
+            }
+            Expect(Token::RBRACE);
+            return new ast::MapLiteralExpr(location, elements);
+        }
+
+        case Token::NEW: {
+            Next();
+            auto type = ParseType();
+            std::vector<ast::Expr*> arguments;
+            if (Match(Token::LPAREN))
+                arguments = ParseArguments();
+            return new ast::NewExpr(location, type, arguments);
+        }
+
+        default:
+            break;
+    }
+    ErrorExpected(location, "operand");
+    return new ast::BadExpr(location);
+}
+
+// arguments
+//    : '(' argumentList? ')'
+//    ;
+std::vector<ast::Expr*> Parser::ParseArguments() {
+    std::vector<ast::Expr*> arguments;
+    Expect(Token::LPAREN);
+    while (!Match(Token::RPAREN) && !Match(Token::END_OF_FILE)) {
+        arguments.push_back(ParseExpr());
+        if (!Match(Token::COMMA))
+            break;
+        Next();
+    }
+    Expect(Token::RPAREN);
+    return arguments;
+}
 
 
 } // namespace zl
@@ -7,7 +7,6 @@
 #include "error_handler.h"
 #include "program_handler.h"
 #include "ast.h"
-#include "scope.h"
 
 namespace zl {
 using namespace ast;
@@ -15,7 +14,8 @@ using namespace ast;
 class Parser {
 public:
     explicit Parser(Lexer& lexer, ProgramHandler& programHandler, ErrorHandler& errorHandler):
-        lexer_(lexer), programHandler_(programHandler), errorHandler_(errorHandler) {}
+        lexer_(lexer), programHandler_(programHandler), errorHandler_(errorHandler),
+        syncPos_(0), syncCount_(0), trace_(false), lastErrorLine_(-1) {}
     ~Parser() {}
     void Build(std::vector<Node*>& decls);
 
@@ -188,18 +188,18 @@ private:
     // classType
     //   : qualifiedName
     //   ;
-    Node* ParseClassType();
+    ast::Type* ParseClassType();
 
     // mapType
     //    : 'map' '<' mapItemType ','  mapItemType '>' 
     //    ;
-    Node* ParseMapType();
+    ast::Type* ParseMapType();
 
     // mapItemType
     //    : primitiveType
     //    | classType
     //    ;
-    Node* ParseMapItemType();
+    ast::Type* ParseMapItemType();
     
     // primitiveType
     //    : 'bool'
@@ -212,7 +212,7 @@ private:
     //    | 'double'
     //    | 'string'
     //    ;
-    Node* ParsePrimitiveType();
+    ast::Type* ParsePrimitiveType();
 
     ast::VarInitializer* ParseVariableInitializer();
 
@@ -222,6 +222,11 @@ private:
     //    ;
     std::vector<ast::Stmt*> ParseStatements();
 
+    // Return true if the token can start an expression
+    static bool IsExprStart(int type);
+    // Return true if the token start a statement with keyword
+    static bool IsStmtKeyword(int type);
+
     // statement
     //     : localVariableDeclarationStatement
     //     | ifStatement
@@ -229,6 +234,7 @@ private:
     //     | foreachStatement
     //     | doStatement
     //     | whileStatement
+    //     | switchStatement
     //     | returnStatement
     //     | tryStatement
     //     | throwStatement
@@ -263,6 +269,12 @@ private:
     //    ;
     ast::Stmt* ParseBlockStatement();
 
+    // simpleStatement
+    //    : expressionList (assignmentOperator expressionList)?
+    //    | expression ('++' | '--')
+    //    ;
+    ast::Stmt* ParseSimpleStatement();
+
     // ifStatement
     //    : 'if' expression  statementBlock ('elif' statementBlock)* ('else' statementBlock)?
     //    ;
@@ -311,19 +323,20 @@ private:
     ast::Stmt* ParseDoStatement();
 
     // switchStatement
-    //    : 'switch' '(' expression ')' '{' switchCase*defaultCase? '}'
+    //    : 'switch' '(' expression ')' '{' switchCase* defaultCase? '}'
     //    ;
     ast::Stmt* ParseSwitchStatement();
 
     // switchCase
-    //    : ('case' expression ':')+ statement
+    //    : ('case' expression ':')+ statement*
     //    ;
-    ast::Node* ParseSwitchCase();
+    ast::CaseStmt* ParseSwitchCase();
 
     // defaultCase
-    //    : 'default' ':' statement
+    //    : 'default' ':' statement*
     //    ;
-    ast::Node* ParseSwitchDefault();
+    ast::CaseStmt* ParseSwitchDefault();
+    ast::Stmt* ParseCaseStatements();
 
     // returnStatement
     //    : 'return' expression? ';'
@@ -346,6 +359,11 @@ private:
     //    ;
     ast::Stmt* ParseAssertStatement();
 
+    // deferStatement
+    //    : 'defer' expression ';'
+    //    ;
+    ast::Stmt* ParseDeferStatement();
+
     // throwStatement
     //    : 'throw' expression ';'
     //    ;
@@ -359,66 +377,77 @@ private:
     // catchParts
     //    : catchPart*
     //    ;
-    ast::Stmt* ParseCatchParts();
+    std::vector<ast::CatchStmt*> ParseCatchParts();
 
     // catchPart
     //    : 'catch' '('catchType IDENTIFIER ')' block 
     //    ;
-    ast::Stmt* ParseCatchPart();
+    ast::CatchStmt* ParseCatchPart();
 
     // catchType
     //    : qualifiedName ( '|' qualifiedName)*
     //    ;
-    ast::Node* ParseCatchType();
+    std::vector<ast::Type*> ParseCatchType();
 
     // finallyPart
     //    : 'finally' block
     //    ;
-    ast::Stmt* ParseFinallyPart();
+    ast::FinallyStmt* ParseFinallyPart();
 
     
 
 
+ 
     // Expr
-    Expr* ParseExpr() { return nullptr; }
-    Expr* ParseConstExpr() { return nullptr; }
+    Expr* ParseExpr();
+    // constExpression
+    //    : expression
+    //    ;
+    // It is evaluated at compile time, see ConstEvaluator
+    Expr* ParseConstExpr() { return ParseExpr(); }
+
+    // expressionList
+    //    : expression (',' expression)*
+    //    ;
+    std::vector<ast::Expr*> ParseExprList();
+
+    // Binary expressions are parsed by precedence climbing, from
+    // logicalOrExpr(1) down to multiplicativeExpr(10)
+    ast::Expr* ParseBinaryExpr(int precedence);
+
+    // unaryExpr
+    //    : ('+' | '-' | '!' | '^') unaryExpr
+    //    | primaryExpr selector*
+    //    ;
+    ast::Expr* ParseUnaryExpr();
+    ast::Expr* ParsePrimaryExpr();
+    ast::Expr* ParseOperand();
+
+    // arguments
+    //    : '(' argumentList? ')'
+    //    ;
+    std::vector<ast::Expr*> ParseArguments();
 
     // Statement
     Stmt* ParseStmt() { return nullptr; }
 
     // Identifier
-    ast::Identifier* ParseIdentifier() { return nullptr; }
-    
-    // Scoping support
-    void OpenScope();
-    void CloseScope();
-    void OpenLabelScope();
-    void CloseLabelScope();
-    void Declare();
-    // If x is an identifier, tryResolve attempts to resolve x by looking up
-    // the object it denotes. If no object is found and collectUnresolved is
-    // set, x is marked as unresolved and collected in the list of unresolved
-    // identifiers.
-    //
-    void TryResolve(ast::Identifier* id, bool collectedUnresolved = true);
-    void Resolve(ast::Identifier* id, bool collectedUnresolved = true);
+    ast::Identifier* ParseIdentifier();
+
 private:
     Lexer& lexer_;
     ProgramHandler& programHandler_;
     ErrorHandler& errorHandler_;
     int syncPos_;
     int syncCount_;
-    ast::Scope* pkgScope_;
-    ast::Scope* topScope_;
-    ast::Scope* labelScope_;
-    std::vector<ast::Identifier*> unresolved_;
-    std::vector<ast::ImportDecl*> imports_;
 
     // Next token look ahead
     Token token_;
     std::string literal_;
     Location location_;
     bool trace_;
+    // Only the first error of one line is reported
+    int lastErrorLine_;
 };
 
 
@@ -0,0 +1,664 @@
+#include <algorithm>
+#include "resolver.h"
+#include "thread_pool.h"
+
+namespace zl {
+using namespace ast;
+
+struct Resolver::Package {
+    std::string name;
+    Scope* scope;
+    // Public declarations, it is searched for identifiers of importing files
+    Scope* exported;
+    // Objects and scopes of the package, its files and its tasks
+    std::vector<std::unique_ptr<Object>> objects;
+    std::vector<std::unique_ptr<Scope>> scopes;
+    std::vector<std::unique_ptr<Task>> tasks;
+
+    Object* NewObject(ObjectKind kind, const std::string& name, Decl* decl, Type* type, void* data) {
+        objects.emplace_back(new Object{kind, name, decl, type, data});
+        return objects.back().get();
+    }
+    Scope* NewScope(Scope* outer) {
+        scopes.emplace_back(new Scope(outer));
+        return scopes.back().get();
+    }
+};
+
+// Task resolve one top level declaration or class method. The package scope
+// is only read, everything written by the task is owned by it.
+struct Resolver::Task {
+    size_t file;
+    Node* decl;
+    // Class of the method, nullptr for top level declarations
+    ClassDecl* owner;
+    Scope* packageScope;
+    std::vector<std::unique_ptr<Object>> objects;
+    std::vector<std::unique_ptr<Scope>> scopes;
+    std::vector<Identifier*> unresolved;
+    std::vector<Diagnostic> diagnostics;
+    size_t resolved = 0;
+
+    void Run();
+    Scope* OpenScope(Scope* outer);
+    Object* Declare(Scope* scope, ObjectKind kind, const std::string& name,
+            const Location& location, Decl* decl, Type* type, void* data);
+    void Bind(Scope* scope, Identifier* id, bool wantType);
+    void ResolveType(Scope* scope, Type* type);
+    void ResolveExpr(Scope* scope, Node* node);
+    void ResolveStmt(Scope* scope, Node* node);
+    // Resolve the statement in a new scope unless it opens one itself
+    void ResolveBody(Scope* scope, Stmt* stmt);
+    void ResolveLocalDecl(Scope* scope, Decl* decl);
+    void ResolveParameters(Scope* scope, FormalParameterList* params,
+            ReturnParameterList* results);
+    void ResolveFunction(Scope* scope, FunctionDecl* function);
+};
+
+void Resolver::Task::Run() {
+    switch (decl->Kind()) {
+        case NodeKind::FunctionDecl:
+            ResolveFunction(packageScope, static_cast<FunctionDecl*>(decl));
+            break;
+        case NodeKind::VariableDecl:
+        case NodeKind::VariableBlockDecl:
+        case NodeKind::ConstDecl:
+        case NodeKind::ConstBlockDecl:
+            // The names are already declared in package scope, only the types
+            // and initializers are resolved
+            if (auto variable = dynamic_cast<VariableDecl*>(decl)) {
+                ResolveType(packageScope, variable->type_);
+                if (variable->varInitializer_)
+                    ResolveExpr(packageScope, variable->varInitializer_->expr_);
+            } else if (auto block = dynamic_cast<VariableBlockDecl*>(decl)) {
+                for (auto variable : block->variables_) {
+                    ResolveType(packageScope, variable->type_);
+                    if (variable->varInitializer_)
+                        ResolveExpr(packageScope, variable->varInitializer_->expr_);
+                }
+            } else if (auto constant = dynamic_cast<ConstDecl*>(decl)) {
+                ResolveType(packageScope, constant->type_);
+                if (constant->varInitializer_)
+                    ResolveExpr(packageScope, constant->varInitializer_->expr_);
+            } else if (auto block = dynamic_cast<ConstBlockDecl*>(decl)) {
+                for (auto constant : block->fields_) {
+                    ResolveType(packageScope, constant->type_);
+                    if (constant->varInitializer_)
+                        ResolveExpr(packageScope, constant->varInitializer_->expr_);
+                }
+            }
+            break;
+        case NodeKind::ClassDecl: {
+            // Methods are resolved by their own tasks
+            auto classDecl = static_cast<ClassDecl*>(decl);
+            if (!classDecl->classBody_)
+                break;
+            for (auto variable : classDecl->classBody_->variables_) {
+                ResolveType(packageScope, variable->type_);
+                if (variable->varInitializer_)
+                    ResolveExpr(packageScope, variable->varInitializer_->expr_);
+            }
+            break;
+        }
+        case NodeKind::InterfaceDecl:
+            for (auto method : static_cast<InterfaceDecl*>(decl)->methods_)
+                ResolveParameters(packageScope, method->formalParameterList_,
+                        method->returnParameterList_);
+            break;
+        default:
+            break;
+    }
+}
+
+Scope* Resolver::Task::OpenScope(Scope* outer) {
+    scopes.emplace_back(new Scope(outer));
+    return scopes.back().get();
+}
+
+Object* Resolver::Task::Declare(Scope* scope, ObjectKind kind, const std::string& name,
+        const Location& location, Decl* decl, Type* type, void* data) {
+    objects.emplace_back(new Object{kind, name, decl, type, data});
+    auto object = objects.back().get();
+    if (scope->Insert(object))
+        diagnostics.push_back({location, name + " redeclared in this block"});
+    return object;
+}
+
+void Resolver::Task::Bind(Scope* scope, Identifier* id, bool wantType) {
+    for (; scope; scope = scope->Outer()) {
+        if (auto object = scope->Lookup(id->name_)) {
+            if (wantType && object->kind != ObjectKind::Type)
+                diagnostics.push_back({id->Pos(), id->name_ + " is not a type"});
+            id->object_ = object;
+            resolved++;
+            return;
+        }
+    }
+    unresolved.push_back(id);
+}
+
+void Resolver::Task::ResolveType(Scope* scope, Type* type) {
+    if (!type)
+        return;
+    switch (type->Kind()) {
+        case NodeKind::NonPrimitiveType:
+            if (auto name = static_cast<NonPrimitiveType*>(type)->name_)
+                Bind(scope, name, true);
+            break;
+        case NodeKind::MapType:
+            ResolveType(scope, static_cast<MapType*>(type)->leftType_);
+            ResolveType(scope, static_cast<MapType*>(type)->rightType_);
+            break;
+        case NodeKind::ArrayType:
+            ResolveType(scope, static_cast<ArrayType*>(type)->type_);
+            break;
+        default:
+            break;
+    }
+}
+
+void Resolver::Task::ResolveExpr(Scope* scope, Node* node) {
+    if (!node)
+        return;
+    switch (node->Kind()) {
+        case NodeKind::Identifier:
+            Bind(scope, static_cast<Identifier*>(node), false);
+            break;
+        case NodeKind::UnaryExpr:
+            ResolveExpr(scope, static_cast<UnaryExpr*>(node)->expr_);
+            break;
+        case NodeKind::BinaryExpr:
+            ResolveExpr(scope, static_cast<BinaryExpr*>(node)->left_);
+            ResolveExpr(scope, static_cast<BinaryExpr*>(node)->right_);
+            break;
+        case NodeKind::SelectorExpr:
+            // The selector is a member name, it is not in any scope
+            ResolveExpr(scope, static_cast<SelectorExpr*>(node)->expr_);
+            break;
+        case NodeKind::IndexExpr:
+            ResolveExpr(scope, static_cast<IndexExpr*>(node)->expr_);
+            ResolveExpr(scope, static_cast<IndexExpr*>(node)->index_);
+            break;
+        case NodeKind::CallExpr: {
+            auto call = static_cast<CallExpr*>(node);
+            ResolveExpr(scope, call->function_);
+            for (auto argument : call->arguments_)
+                ResolveExpr(scope, argument);
+            break;
+        }
+        case NodeKind::NewExpr: {
+            auto newExpr = static_cast<NewExpr*>(node);
+            ResolveType(scope, newExpr->type_);
+            for (auto argument : newExpr->arguments_)
+                ResolveExpr(scope, argument);
+            break;
+        }
+        case NodeKind::ArrayLiteralExpr:
+            for (auto element : static_cast<ArrayLiteralExpr*>(node)->elements_)
+                ResolveExpr(scope, element);
+            break;
+        case NodeKind::MapLiteralExpr:
+            for (auto& element : static_cast<MapLiteralExpr*>(node)->elements_) {
+                ResolveExpr(scope, element.first);
+                ResolveExpr(scope, element.second);
+            }
+            break;
+        case NodeKind::IterableObject: {
+            auto iterable = static_cast<IterableObject*>(node);
+            ResolveExpr(scope, iterable->primary_);
+            for (auto& element : iterable->mapElements_) {
+                ResolveExpr(scope, element.first);
+                ResolveExpr(scope, element.second);
+            }
+            for (auto element : iterable->arrayElements_)
+                ResolveExpr(scope, element);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void Resolver::Task::ResolveLocalDecl(Scope* scope, Decl* decl) {
+    if (!decl)
+        return;
+    // The initializer is resolved before the name is declared, so that
+    // "x:int = x" refers to x of outer scope
+    switch (decl->Kind()) {
+        case NodeKind::VariableDecl: {
+            auto variable = static_cast<VariableDecl*>(decl);
+            ResolveType(scope, variable->type_);
+            if (variable->varInitializer_)
+                ResolveExpr(scope, variable->varInitializer_->expr_);
+            if (variable->name_) {
+                variable->name_->object_ = Declare(scope, ObjectKind::Variable,
+                        variable->name_->name_, variable->Pos(), variable, variable->type_, nullptr);
+            }
+            break;
+        }
+        case NodeKind::VariableBlockDecl:
+            for (auto variable : static_cast<VariableBlockDecl*>(decl)->variables_)
+                ResolveLocalDecl(scope, variable);
+            break;
+        case NodeKind::ConstDecl: {
+            auto constant = static_cast<ConstDecl*>(decl);
+            ResolveType(scope, constant->type_);
+            if (constant->varInitializer_)
+                ResolveExpr(scope, constant->varInitializer_->expr_);
+            if (constant->name_) {
+                constant->name_->object_ = Declare(scope, ObjectKind::Constant,
+                        constant->name_->name_, constant->Pos(), constant, constant->type_, nullptr);
+            }
+            break;
+        }
+        case NodeKind::ConstBlockDecl:
+            for (auto constant : static_cast<ConstBlockDecl*>(decl)->fields_)
+                ResolveLocalDecl(scope, constant);
+            break;
+        default:
+            break;
+    }
+}
+
+void Resolver::Task::ResolveBody(Scope* scope, Stmt* stmt) {
+    if (!stmt)
+        return;
+    if (stmt->Kind() == NodeKind::BlockStmt)
+        ResolveStmt(scope, stmt);
+    else
+        ResolveStmt(OpenScope(scope), stmt);
+}
+
+void Resolver::Task::ResolveStmt(Scope* scope, Node* node) {
+    if (!node)
+        return;
+    switch (node->Kind()) {
+        case NodeKind::DeclStmt:
+            ResolveLocalDecl(scope, static_cast<DeclStmt*>(node)->decl_);
+            break;
+        case NodeKind::BlockStmt: {
+            auto inner = OpenScope(scope);
+            for (auto stmt : static_cast<BlockStmt*>(node)->stmts_)
+                ResolveStmt(inner, stmt);
+            break;
+        }
+        case NodeKind::AssignStmt: {
+            auto assign = static_cast<AssignStmt*>(node);
+            for (auto expr : assign->lhs_)
+                ResolveExpr(scope, expr);
+            for (auto expr : assign->rhs_)
+                ResolveExpr(scope, expr);
+            break;
+        }
+        case NodeKind::IfStmt: {
+            auto ifStmt = static_cast<IfStmt*>(node);
+            ResolveExpr(scope, ifStmt->conditionExpr_);
+            ResolveBody(scope, ifStmt->ifBlockStmt_);
+            for (auto& item : ifStmt->elifBlockStmts_) {
+                ResolveExpr(scope, item.first);
+                ResolveBody(scope, item.second);
+            }
+            ResolveBody(scope, ifStmt->finalStmt_);
+            break;
+        }
+        case NodeKind::ExprStmt: {
+            auto exprStmt = static_cast<ExprStmt*>(node);
+            ResolveLocalDecl(scope, exprStmt->varDecl_);
+            ResolveStmt(scope, exprStmt->stmt_);
+            ResolveExpr(scope, exprStmt->expr_);
+            break;
+        }
+        case NodeKind::ExprStmts:
+            for (auto stmt : static_cast<ExprStmts*>(node)->stmts_)
+                ResolveStmt(scope, stmt);
+            break;
+        case NodeKind::ForStmt: {
+            auto forStmt = static_cast<ForStmt*>(node);
+            auto inner = OpenScope(scope);
+            ResolveStmt(inner, forStmt->initializer_);
+            ResolveExpr(inner, forStmt->expr_);
+            ResolveStmt(inner, forStmt->finalizer_);
+            ResolveBody(inner, forStmt->block_);
+            break;
+        }
+        case NodeKind::ForeachStmt: {
+            auto foreach = static_cast<ForeachStmt*>(node);
+            ResolveExpr(scope, foreach->iterableObject_);
+            auto inner = OpenScope(scope);
+            for (auto& variable : foreach->variables_)
+                Declare(inner, ObjectKind::Variable, variable, foreach->Pos(), nullptr, nullptr, foreach);
+            ResolveBody(inner, foreach->block_);
+            break;
+        }
+        case NodeKind::WhileStmt:
+            ResolveExpr(scope, static_cast<WhileStmt*>(node)->conditionExpr_);
+            ResolveBody(scope, static_cast<WhileStmt*>(node)->block_);
+            break;
+        case NodeKind::DoStmt:
+            ResolveBody(scope, static_cast<DoStmt*>(node)->block_);
+            ResolveExpr(scope, static_cast<DoStmt*>(node)->conditionExpr_);
+            break;
+        case NodeKind::SwitchStmt: {
+            auto switchStmt = static_cast<SwitchStmt*>(node);
+            ResolveExpr(scope, switchStmt->expr_);
+            for (auto caseStmt : switchStmt->cases_) {
+                for (auto expr : caseStmt->exprs_)
+                    ResolveExpr(scope, expr);
+                ResolveBody(scope, caseStmt->block_);
+            }
+            if (switchStmt->default_)
+                ResolveBody(scope, switchStmt->default_->block_);
+            break;
+        }
+        case NodeKind::ReturnStmt:
+            for (auto expr : static_cast<ReturnStmt*>(node)->exprs_)
+                ResolveExpr(scope, expr);
+            break;
+        case NodeKind::AssertStmt:
+            ResolveExpr(scope, static_cast<AssertStmt*>(node)->expr_);
+            break;
+        case NodeKind::DeferStmt:
+            ResolveExpr(scope, static_cast<DeferStmt*>(node)->call_);
+            break;
+        case NodeKind::ThrowStmt:
+            ResolveExpr(scope, static_cast<ThrowStmt*>(node)->expr_);
+            break;
+        case NodeKind::TryStmt: {
+            auto tryStmt = static_cast<TryStmt*>(node);
+            ResolveBody(scope, tryStmt->block_);
+            for (auto catchStmt : tryStmt->catches_) {
+                auto inner = OpenScope(scope);
+                for (auto type : catchStmt->types_)
+                    ResolveType(scope, type);
+                // A variable catching several types has none of them
+                if (catchStmt->name_) {
+                    catchStmt->name_->object_ = Declare(inner, ObjectKind::Variable, catchStmt->name_->name_,
+                        catchStmt->Pos(), nullptr,
+                        catchStmt->types_.size() == 1 ? catchStmt->types_[0] : nullptr, nullptr);
+                }
+                ResolveBody(inner, catchStmt->block_);
+            }
+            if (tryStmt->finally_)
+                ResolveBody(scope, tryStmt->finally_->block_);
+            break;
+        }
+        default:
+            // Labels are not objects of block scopes, break and continue do
+            // not refer to any other names
+            break;
+    }
+}
+
+void Resolver::Task::ResolveParameters(Scope* scope, FormalParameterList* params,
+        ReturnParameterList* results) {
+    if (params) {
+        for (auto param : params->formalParameters_)
+            ResolveType(scope, param->type_);
+    }
+    if (results) {
+        for (auto type : results->types_)
+            ResolveType(scope, type);
+    }
+}
+
+void Resolver::Task::ResolveFunction(Scope* scope, FunctionDecl* function) {
+    // Parameter types are resolved in the enclosing scope, the parameters and
+    // the body share the function scope
+    ResolveParameters(scope, function->formalParameterList_, function->returnParameterList_);
+    auto functionScope = OpenScope(scope);
+    if (owner && !function->isStatic_)
+        Declare(functionScope, ObjectKind::Variable, "self", function->Pos(), owner, nullptr, nullptr);
+    if (function->formalParameterList_) {
+        for (auto param : function->formalParameterList_->formalParameters_) {
+            if (param->name_) {
+                param->name_->object_ = Declare(functionScope, ObjectKind::Variable,
+                        param->name_->name_, param->Pos(), param, param->type_, nullptr);
+            }
+        }
+    }
+    if (function->functionBlockDecl_) {
+        for (auto node : function->functionBlockDecl_->nodes_)
+            ResolveStmt(functionScope, node);
+    }
+}
+
+Resolver::Resolver(ThreadPool& pool)
+    : pool_(pool), resolved_(0), importResolved_(0), unresolved_(0), taskCount_(0) {}
+
+Resolver::~Resolver() {}
+
+Resolver::Package* Resolver::FindPackage(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = packages_.find(name);
+    return iter == packages_.end() ? nullptr : iter->second.get();
+}
+
+Scope* Resolver::PackageScope(const std::string& name) const {
+    auto package = FindPackage(name);
+    return package ? package->scope : nullptr;
+}
+
+Scope* Resolver::ExportedScope(const std::string& name) const {
+    auto package = FindPackage(name);
+    return package ? package->exported : nullptr;
+}
+
+Resolver::Package* Resolver::GetPackage(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& package = packages_[name];
+    if (!package) {
+        package.reset(new Package());
+        package->name = name;
+        package->scope = package->NewScope(UniverseScope());
+        package->exported = package->NewScope(nullptr);
+    }
+    return package.get();
+}
+
+void Resolver::Declare(Package& package, SourceFile& file, Decl* decl,
+        Identifier* name, ObjectKind kind, Type* type) {
+    if (!name || name->name_.empty())
+        return;
+    auto object = package.NewObject(kind, name->name_, decl, type, nullptr);
+    name->object_ = object;
+    if (package.scope->Insert(object)) {
+        file.diagnostics.push_back({decl->Pos(), name->name_ + " redeclared in this block"});
+        return;
+    }
+    if (decl->IsPublic())
+        package.exported->Insert(object);
+}
+
+void Resolver::DeclareFile(Package& package, SourceFile& file) {
+    for (auto decl : file.decls) {
+        switch (decl->Kind()) {
+            case NodeKind::VariableDecl: {
+                auto variable = static_cast<VariableDecl*>(decl);
+                Declare(package, file, variable, variable->name_, ObjectKind::Variable, variable->type_);
+                break;
+            }
+            case NodeKind::VariableBlockDecl: {
+                // Variables of a block share the publicity of the block
+                auto block = static_cast<VariableBlockDecl*>(decl);
+                for (auto variable : block->variables_) {
+                    variable->SetPublic(block->IsPublic());
+                    Declare(package, file, variable, variable->name_, ObjectKind::Variable, variable->type_);
+                }
+                break;
+            }
+            case NodeKind::ConstDecl: {
+                auto constant = static_cast<ConstDecl*>(decl);
+                Declare(package, file, constant, constant->name_, ObjectKind::Constant, constant->type_);
+                break;
+            }
+            case NodeKind::ConstBlockDecl: {
+                auto block = static_cast<ConstBlockDecl*>(decl);
+                for (auto constant : block->fields_) {
+                    constant->SetPublic(block->IsPublic());
+                    Declare(package, file, constant, constant->name_, ObjectKind::Constant, constant->type_);
+                }
+                break;
+            }
+            case NodeKind::FunctionDecl: {
+                auto function = static_cast<FunctionDecl*>(decl);
+                Declare(package, file, function, function->name_, ObjectKind::Func, nullptr);
+                break;
+            }
+            case NodeKind::ClassDecl: {
+                auto classDecl = static_cast<ClassDecl*>(decl);
+                Declare(package, file, classDecl, classDecl->name_, ObjectKind::Type, nullptr);
+                break;
+            }
+            case NodeKind::InterfaceDecl: {
+                auto interface = static_cast<InterfaceDecl*>(decl);
+                Declare(package, file, interface, interface->name_, ObjectKind::Type, nullptr);
+                break;
+            }
+            case NodeKind::UsingDecl: {
+                // The alias is declared as a type, the aliased name is
+                // not checked
+                auto usingDecl = static_cast<UsingDecl*>(decl);
+                Declare(package, file, usingDecl, usingDecl->aliasName_, ObjectKind::Type, nullptr);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+Scope* Resolver::BuildFileScope(Package& owner, SourceFile& file, std::vector<Package*>& imports) {
+    auto scope = owner.NewScope(nullptr);
+
+    for (auto decl : file.decls) {
+        if (decl->Kind() != NodeKind::ImportDecl)
+            continue;
+        auto importDecl = static_cast<ImportDecl*>(decl);
+        if (!importDecl->name_ || importDecl->name_->names_.empty())
+            continue;
+        auto& names = importDecl->name_->names_;
+
+        // Packages not in the compilation are kept as external ones whose
+        // members can not be checked
+        Package* package = nullptr;
+        for (auto& candidate : ImportCandidates(names)) {
+            package = FindPackage(candidate);
+            if (package)
+                break;
+        }
+        if (package == &owner)
+            package = nullptr;
+
+        auto object = owner.NewObject(ObjectKind::Package, names.back(), importDecl, nullptr, package);
+        if (scope->Insert(object)) {
+            file.diagnostics.push_back({importDecl->Pos(), names.back() + " redeclared in this block"});
+            continue;
+        }
+        if (package)
+            imports.push_back(package);
+    }
+    return scope;
+}
+
+void Resolver::ResolveImported(SourceFile& file, Scope* fileScope,
+        const std::vector<Package*>& imports, Identifier* id) {
+    auto& name = id->name_;
+    auto dot = name.find('.');
+    if (dot != std::string::npos) {
+        // Qualified name such as io.File
+        auto object = fileScope->Lookup(name.substr(0, dot));
+        if (object) {
+            auto package = static_cast<Package*>(object->data);
+            auto member = package ? package->exported->Lookup(name.substr(dot + 1)) : object;
+            if (member) {
+                id->object_ = member;
+                importResolved_++;
+                return;
+            }
+        }
+    } else if (auto object = fileScope->Lookup(name)) {
+        id->object_ = object;
+        importResolved_++;
+        return;
+    } else {
+        // Search the exported scopes of imported packages, the name must be
+        // exported by only one of them
+        Object* found = nullptr;
+        Package* from = nullptr;
+        for (auto package : imports) {
+            auto object = package->exported->Lookup(name);
+            if (!object || object == found)
+                continue;
+            if (found) {
+                file.diagnostics.push_back({id->Pos(), "ambiguous name " + name +
+                        ", it is exported by " + from->name + " and " + package->name});
+                unresolved_++;
+                return;
+            }
+            found = object;
+            from = package;
+        }
+        if (found) {
+            id->object_ = found;
+            importResolved_++;
+            return;
+        }
+    }
+    file.diagnostics.push_back({id->Pos(), "undeclared name: " + name});
+    unresolved_++;
+}
+
+void Resolver::Resolve(std::vector<SourceFile>& files) {
+    std::vector<SourceFile*> pointers;
+    for (auto& file : files)
+        pointers.push_back(&file);
+    Resolve(pointers);
+}
+
+void Resolver::Resolve(const std::vector<SourceFile*>& files) {
+    std::vector<Package*> owners;
+    for (auto file : files) {
+        owners.push_back(GetPackage(PackageNameOf(file->decls)));
+        DeclareFile(*owners.back(), *file);
+    }
+
+    std::vector<std::unique_ptr<Task>> tasks;
+    for (size_t i = 0; i < files.size(); i++) {
+        for (auto decl : files[i]->decls) {
+            tasks.emplace_back(new Task{i, decl, nullptr, owners[i]->scope});
+            auto classDecl = dynamic_cast<ClassDecl*>(decl);
+            if (!classDecl || !classDecl->classBody_)
+                continue;
+            for (auto method : classDecl->classBody_->functions_)
+                tasks.emplace_back(new Task{i, method, classDecl, owners[i]->scope});
+        }
+    }
+    taskCount_ += tasks.size();
+    pool_.ParallelFor(tasks.size(), [&tasks](size_t i) { tasks[i]->Run(); });
+
+    // Batch resolving of the identifiers not found in package scopes, tasks
+    // are in source order so the result is deterministic
+    size_t taskIndex = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        auto& file = *files[i];
+        std::vector<Package*> imports;
+        auto fileScope = BuildFileScope(*owners[i], file, imports);
+
+        for (; taskIndex < tasks.size() && tasks[taskIndex]->file == i; taskIndex++) {
+            auto& task = *tasks[taskIndex];
+            resolved_ += task.resolved;
+            file.diagnostics.insert(file.diagnostics.end(),
+                    task.diagnostics.begin(), task.diagnostics.end());
+
+            for (auto id : task.unresolved)
+                ResolveImported(file, fileScope, imports, id);
+            owners[i]->tasks.push_back(std::move(tasks[taskIndex]));
+        }
+        std::stable_sort(file.diagnostics.begin(), file.diagnostics.end(),
+                [](const Diagnostic& a, const Diagnostic& b) {
+                    return a.location.GetLineno() < b.location.GetLineno();
+                });
+    }
+}
+
+} // namespace zl
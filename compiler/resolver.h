@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "frontend.h"
+#include "scope.h"
+
+namespace zl {
+
+class ThreadPool;
+
+// Resolver bind every identifier of the syntax trees to the object it denotes
+// and report undeclared and redeclared names. It runs after all files are
+// parsed:
+//  1. the package scope of each package is built from top level declarations
+//     of all its files, it is never modified after this step
+//  2. every top level declaration and class method is resolved as one task on
+//     the thread pool, a task only writes its own local scopes and the
+//     identifiers of its subtree
+//  3. the identifiers a task can not find are batch resolved against the
+//     packages imported by the file, in source order
+// The bindings and diagnostics do not depend on the number of threads.
+//
+// Packages may also be resolved one by one in import order, see
+// BuildScheduler, the calls for independent packages can run concurrently.
+class Resolver {
+public:
+    explicit Resolver(ThreadPool& pool);
+    ~Resolver();
+
+    // Resolve all files, the diagnostics are appended to each file in line
+    // order. The files must live as long as the resolver.
+    void Resolve(std::vector<SourceFile>& files);
+    // Resolve the files, all files of one package must be given in one call.
+    // The packages imported by them but not among them must have been
+    // resolved by calls returned earlier.
+    void Resolve(const std::vector<SourceFile*>& files);
+
+    // Return the scope of the package, nullptr if there is no such package
+    ast::Scope* PackageScope(const std::string& name) const;
+    // Return the scope of public declarations of the package
+    ast::Scope* ExportedScope(const std::string& name) const;
+
+    // Number of identifiers bound to an object
+    size_t ResolvedCount() const { return resolved_ + importResolved_; }
+    // Number of identifiers bound by the batch resolving of imports
+    size_t ImportResolvedCount() const { return importResolved_; }
+    size_t UnresolvedCount() const { return unresolved_; }
+    size_t TaskCount() const { return taskCount_; }
+
+private:
+    Resolver() = delete;
+    Resolver(const Resolver&) = delete;
+    Resolver& operator = (const Resolver&) = delete;
+
+    struct Package;
+    struct Task;
+    Package* FindPackage(const std::string& name) const;
+    // Return the package, it is created if not exists
+    Package* GetPackage(const std::string& name);
+    // Declare the top level declarations of the file in package scope
+    void DeclareFile(Package& package, SourceFile& file);
+    void Declare(Package& package, SourceFile& file, ast::Decl* decl,
+            ast::Identifier* name, ast::ObjectKind kind, ast::Type* type);
+    // Build the scope of imported package names of the file
+    ast::Scope* BuildFileScope(Package& owner, SourceFile& file, std::vector<Package*>& imports);
+    // Resolve the identifier not found in package scope with the imports
+    void ResolveImported(SourceFile& file, ast::Scope* fileScope,
+            const std::vector<Package*>& imports, ast::Identifier* id);
+
+private:
+    ThreadPool& pool_;
+    // Guard packages_ only, a package is modified by one call of Resolve
+    mutable std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<Package>> packages_;
+    std::atomic<size_t> resolved_;
+    std::atomic<size_t> importResolved_;
+    std::atomic<size_t> unresolved_;
+    std::atomic<size_t> taskCount_;
+};
+
+} // namespace zl
@@ -1,9 +1,60 @@
+#include <iostream>
 #include "scope.h"
 
 namespace zl {
 namespace ast {
 
+Location Object::Pos() {
+    return decl ? decl->Pos() : Location();
+}
 
+std::string Object::Kind() {
+    switch (kind) {
+        case ObjectKind::Bad: return "bad";
+        case ObjectKind::Package: return "package";
+        case ObjectKind::Constant: return "const";
+        case ObjectKind::Type: return "type";
+        case ObjectKind::Variable: return "var";
+        case ObjectKind::Func: return "func";
+        case ObjectKind::Label: return "label";
+    }
+    return "";
+}
+
+Object* Scope::Lookup(const std::string& name) {
+    auto iter = objects_.find(name);
+    if (iter == objects_.end())
+        return nullptr;
+    return iter->second;
+}
+
+Object* Scope::Insert(Object* obj) {
+    auto result = objects_.insert(std::make_pair(obj->name, obj));
+    if (!result.second)
+        return result.first->second;
+    return nullptr;
+}
+
+void Scope::Dump() {
+    std::cout << "scope " << this << " {" << std::endl;
+    for (auto& item : objects_)
+        std::cout << "\t" << item.second->Kind() << " " << item.first << std::endl;
+    std::cout << "}" << std::endl;
+}
+
+Scope* UniverseScope() {
+    static const char* types[] = {
+        "bool", "char", "byte", "short", "int", "long", "float", "double", "string",
+        "error",
+    };
+    static Scope* universe = [] {
+        auto scope = new Scope(nullptr);
+        for (auto name : types)
+            scope->Insert(new Object{ObjectKind::Type, name, nullptr, nullptr, nullptr});
+        return scope;
+    }();
+    return universe;
+}
 
-} // namespace zl
 } // namespace ast
+} // namespace zl
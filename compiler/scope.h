@@ -6,6 +6,8 @@
 namespace zl {
 namespace ast {
 
+class Scope;
+
 enum class ObjectKind: uint8_t {
     Bad,
     Package,
@@ -29,6 +31,9 @@ struct Object {
     std::string Kind();
 };
 
+// Builtin objects, the universe scope is the outermost scope of every package
+Scope* UniverseScope();
+
 class Scope {
 public:
     explicit Scope(Scope* scope):outer_(scope) {}
@@ -47,6 +52,9 @@ public:
     //
     Object* Insert(Object* obj);
     void Dump();
+    Scope* Outer() const { return outer_; }
+    size_t Size() const { return objects_.size(); }
+    const std::map<std::string, Object*>& Objects() const { return objects_; }
 private:
     std::map<std::string, Object*> objects_;
     Scope* outer_;
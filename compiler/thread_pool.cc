@@ -0,0 +1,133 @@
+#include <chrono>
+#include "thread_pool.h"
+
+namespace zl {
+
+namespace {
+// The pool and worker index of current thread
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+}
+
+ThreadPool::ThreadPool(size_t threads)
+    : queued_(0), pending_(0), nextQueue_(0), steals_(0), stop_(false) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < threads; i++)
+        queues_.emplace_back(new WorkQueue());
+    for (size_t i = 0; i < threads; i++)
+        workers_.emplace_back([this, i] { WorkerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    taskCond_.notify_all();
+    for (auto& worker : workers_)
+        worker.join();
+}
+
+size_t ThreadPool::CurrentWorker() const {
+    return currentPool == this ? currentWorker : queues_.size();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    size_t index = CurrentWorker();
+    if (index == queues_.size())
+        index = nextQueue_++ % queues_.size();
+    pending_++;
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    queued_++;
+    // Take the lock so that a worker checking queued_ before sleeping can not
+    // miss the notification
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    taskCond_.notify_one();
+}
+
+bool ThreadPool::TakeTask(size_t index, std::function<void()>& task) {
+    size_t count = queues_.size();
+    if (index < count) {
+        auto& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queued_--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i <= count; i++) {
+        auto& victim = *queues_[(index + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued_--;
+            steals_++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::RunOneTask(size_t index) {
+    std::function<void()> task;
+    if (!TakeTask(index, task))
+        return false;
+    task();
+    if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        doneCond_.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    doneCond_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void ThreadPool::ParallelFor(size_t n, const std::function<void(size_t)>& fn) {
+    std::atomic<size_t> remaining(n);
+    std::mutex mutex;
+    std::condition_variable cond;
+    for (size_t i = 0; i < n; i++) {
+        Submit([&, i] {
+            fn(i);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--remaining == 0)
+                cond.notify_all();
+        });
+    }
+    size_t index = CurrentWorker();
+    while (remaining > 0) {
+        if (RunOneTask(index))
+            continue;
+        // The remaining tasks are running on other workers
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait_for(lock, std::chrono::milliseconds(1), [&] { return remaining == 0; });
+    }
+    // The last task may still hold the lock, wait for it before the lock and
+    // the condition are destroyed
+    std::lock_guard<std::mutex> lock(mutex);
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    currentPool = this;
+    currentWorker = index;
+    while (true) {
+        if (RunOneTask(index))
+            continue;
+        std::unique_lock<std::mutex> lock(mutex_);
+        taskCond_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (stop_ && queued_ == 0)
+            return;
+    }
+}
+
+} // namespace zl
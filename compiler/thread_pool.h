@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zl {
+
+// ThreadPool run submitted tasks on a fixed number of worker threads. Every
+// worker owns a deque, it pops its own tasks from the back and steals from the
+// front of other workers' deques when it runs out of work, so tasks submitted
+// by a task stay on the same worker while idle workers still get balanced.
+class ThreadPool {
+public:
+    // The pool has one worker per hardware thread if threads is zero
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    // Submit queue the task to be run by one of the workers. A task submitted
+    // from a worker is queued on that worker.
+    void Submit(std::function<void()> task);
+    // Wait block until all submitted tasks are finished, it must not be called
+    // from a task
+    void Wait();
+    // ParallelFor run fn(i) for each i in [0, n) and wait them finished. The
+    // caller runs queued tasks while waiting, so it can be used from a task.
+    void ParallelFor(size_t n, const std::function<void(size_t)>& fn);
+    size_t Size() const { return workers_.size(); }
+    // Number of tasks taken from another worker's deque
+    size_t Steals() const { return steals_; }
+    // Return the worker index of current thread, Size() if it is not a worker
+    size_t CurrentWorker() const;
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    void WorkerLoop(size_t index);
+    // Take one task from own deque of worker index or steal one, the index is
+    // out of range for threads which are not workers
+    bool TakeTask(size_t index, std::function<void()>& task);
+    bool RunOneTask(size_t index);
+
+private:
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::mutex mutex_;
+    std::condition_variable taskCond_;
+    std::condition_variable doneCond_;
+    std::atomic<size_t> queued_;
+    std::atomic<size_t> pending_;
+    std::atomic<size_t> nextQueue_;
+    std::atomic<size_t> steals_;
+    bool stop_;
+};
+
+} // namespace zl
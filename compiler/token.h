@@ -7,6 +7,7 @@ class Token {
 public:
     enum TokenType { 
         ILLEGAL = -1,
+        END_OF_FILE,
         COMMENT,
         LITERAL_BEGIN,
         // Identifiers and basic type literals
@@ -115,6 +116,18 @@ public:
         FUNCTION,
         VOID,
         IMPLEMENTS,
+        WHILE,
+        DO,
+        ASSERT,
+        THROW,
+        TRY,
+        CATCH,
+        FINALLY,
+        STATIC,
+        NEW,
+        TRUE,
+        FALSE,
+        NIL,
         KEYWORD_END,
         };
     static Token InvalidToken;
@@ -135,15 +148,19 @@ public:
             assic_ = ch;
         }
     bool Valid() const {
-        return assic_ =="" || type_ == TokenType::ILLEGAL;
+        return assic_ != "" && type_ != TokenType::ILLEGAL;
     }
     bool operator == (const Token& rhs) {
         return (this->assic_ == rhs.assic_ && this->location_ == rhs.location_);
     }
 };
 
-inline std::string TokenTypeString(Token::TokenType type) {
-    return "" ;// now
+// Return the source spelling of the token type, used in diagnostics
+std::string TokenTypeString(int type);
+
+// Return true if the token type is an assignment operator such as '=', '+='
+inline bool IsAssignOperator(int type) {
+    return type == Token::ASSIGN || (type >= Token::ADD_ASSIGN && type <= Token::AND_NOT_ASSIGN);
 }
 
 } // namespace zl
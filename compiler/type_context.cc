@@ -0,0 +1,163 @@
+#include <functional>
+#include <mutex>
+#include "scope.h"
+#include "type_context.h"
+
+namespace zl {
+
+size_t TypeContext::TypeKeyHash::operator () (const TypeKey& key) const {
+    size_t hash = std::hash<std::string>()(key.name);
+    auto mix = [&hash](size_t value) {
+        hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    };
+    mix(static_cast<size_t>(key.kind));
+    mix(reinterpret_cast<size_t>(key.decl));
+    mix(key.key);
+    mix(key.value);
+    return hash;
+}
+
+TypeContext::TypeContext(): internedNodes_(0) {
+    types_.push_back({TypeKind::Invalid, "", nullptr, kNoTypeId, kNoTypeId});
+}
+
+TypeId TypeContext::Lookup(const TypeKey& key) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto iter = ids_.find(key);
+        if (iter != ids_.end())
+            return iter->second;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto result = ids_.emplace(key, static_cast<TypeId>(types_.size()));
+    if (result.second)
+        types_.push_back({key.kind, key.name, key.decl, key.key, key.value});
+    return result.first->second;
+}
+
+TypeId TypeContext::Primitive(const std::string& name) {
+    return Lookup({TypeKind::Primitive, name, nullptr, kNoTypeId, kNoTypeId});
+}
+
+TypeId TypeContext::Named(const std::string& name, const ast::Decl* decl) {
+    // The name is not a part of the key of resolved types, io.File and File
+    // may refer to the same declaration
+    return Lookup({TypeKind::Named, decl ? "" : name, decl, kNoTypeId, kNoTypeId});
+}
+
+TypeId TypeContext::Map(TypeId key, TypeId value) {
+    return Lookup({TypeKind::Map, "", nullptr, key, value});
+}
+
+TypeId TypeContext::Array(TypeId element) {
+    return Lookup({TypeKind::Array, "", nullptr, element, kNoTypeId});
+}
+
+TypeId TypeContext::Tuple(const std::vector<TypeId>& elements) {
+    TypeId rest = kNoTypeId;
+    for (auto element = elements.rbegin(); element != elements.rend(); ++element)
+        rest = Lookup({TypeKind::Tuple, "", nullptr, *element, rest});
+    return elements.empty() ? Lookup({TypeKind::Tuple, "", nullptr, kNoTypeId, kNoTypeId}) : rest;
+}
+
+TypeId TypeContext::Intern(ast::Type* type) {
+    if (!type)
+        return kNoTypeId;
+    TypeId id = kNoTypeId;
+    switch (type->Kind()) {
+        case ast::NodeKind::PrimitiveType:
+            id = Primitive(static_cast<ast::PrimitiveType*>(type)->name_);
+            break;
+        case ast::NodeKind::NonPrimitiveType: {
+            auto name = static_cast<ast::NonPrimitiveType*>(type)->name_;
+            if (!name)
+                break;
+            auto object = name->object_;
+            const ast::Decl* decl = nullptr;
+            if (object && object->kind == ast::ObjectKind::Type)
+                decl = object->decl;
+            id = Named(name->name_, decl);
+            break;
+        }
+        case ast::NodeKind::MapType: {
+            auto map = static_cast<ast::MapType*>(type);
+            TypeId key = Intern(map->leftType_);
+            id = Map(key, Intern(map->rightType_));
+            break;
+        }
+        case ast::NodeKind::ArrayType:
+            id = Array(Intern(static_cast<ast::ArrayType*>(type)->type_));
+            break;
+        default:
+            break;
+    }
+    type->typeId_ = id;
+    internedNodes_++;
+    return id;
+}
+
+void TypeContext::InternAll(const std::vector<ast::Node*>& decls) {
+    std::vector<ast::Node*> stack(decls.rbegin(), decls.rend());
+    std::vector<ast::Node*> children;
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+        if (!node)
+            continue;
+        switch (node->Kind()) {
+            case ast::NodeKind::PrimitiveType:
+            case ast::NodeKind::NonPrimitiveType:
+            case ast::NodeKind::MapType:
+            case ast::NodeKind::ArrayType:
+                Intern(static_cast<ast::Type*>(node));
+                continue;
+            default:
+                break;
+        }
+        children.clear();
+        ast::CollectChildren(node, children);
+        stack.insert(stack.end(), children.rbegin(), children.rend());
+    }
+}
+
+const CanonicalType& TypeContext::Get(TypeId id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return id < types_.size() ? types_[id] : types_[kNoTypeId];
+}
+
+std::string TypeContext::ToString(TypeId id) const {
+    auto& type = Get(id);
+    switch (type.kind) {
+        case TypeKind::Primitive:
+            return type.name;
+        case TypeKind::Named:
+            if (!type.name.empty())
+                return type.name;
+            if (auto classDecl = dynamic_cast<const ast::ClassDecl*>(type.decl))
+                return classDecl->name_ ? classDecl->name_->name_ : "";
+            if (auto interface = dynamic_cast<const ast::InterfaceDecl*>(type.decl))
+                return interface->name_ ? interface->name_->name_ : "";
+            if (auto usingDecl = dynamic_cast<const ast::UsingDecl*>(type.decl))
+                return usingDecl->aliasName_ ? usingDecl->aliasName_->name_ : "";
+            return "";
+        case TypeKind::Map:
+            return "map<" + ToString(type.key) + ", " + ToString(type.value) + ">";
+        case TypeKind::Array:
+            return ToString(type.key) + "[]";
+        case TypeKind::Tuple: {
+            std::string result;
+            for (TypeId cell = id; cell != kNoTypeId && Get(cell).key != kNoTypeId; cell = Get(cell).value)
+                result += (result.empty() ? "" : ", ") + ToString(Get(cell).key);
+            return "(" + result + ")";
+        }
+        default:
+            return "invalid";
+    }
+}
+
+size_t TypeContext::Size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return types_.size() - 1;
+}
+
+} // namespace zl
@@ -0,0 +1,103 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+namespace zl {
+
+// TypeId identify a canonical type of one TypeContext, zero is no type
+typedef uint32_t TypeId;
+const TypeId kNoTypeId = 0;
+
+enum class TypeKind : uint8_t {
+    Invalid,
+    Primitive,
+    // Class, interface or alias referred by name
+    Named,
+    Map,
+    Array,
+    // Results of a function with several results, a list of cells whose
+    // key is an element and value the cell of the next ones
+    Tuple,
+};
+
+// CanonicalType is the only instance of a structurally distinct type
+struct CanonicalType {
+    TypeKind kind;
+    // Name of primitive and named types
+    std::string name;
+    // Declaration of named type, nullptr if the name is not resolved
+    const ast::Decl* decl;
+    // Key and value type of map, element type of array, element and rest of
+    // tuple
+    TypeId key;
+    TypeId value;
+};
+
+// TypeContext intern types structurally, so that each distinct type exists
+// once and type equality and hashing are comparison of TypeId. Named types
+// are the same if they refer to the same declaration, or have the same name
+// if they are not resolved.
+//
+// Types may be interned from several threads at the same time.
+class TypeContext {
+public:
+    TypeContext();
+    ~TypeContext() {}
+
+    TypeId Primitive(const std::string& name);
+    TypeId Named(const std::string& name, const ast::Decl* decl);
+    TypeId Map(TypeId key, TypeId value);
+    TypeId Array(TypeId element);
+    TypeId Tuple(const std::vector<TypeId>& elements);
+
+    // Intern the syntax type and the types in it, set their typeId_ and
+    // return the id of type
+    TypeId Intern(ast::Type* type);
+    // Intern every type of the declarations
+    void InternAll(const std::vector<ast::Node*>& decls);
+
+    // Return the canonical type, the reference is valid as long as the
+    // context
+    const CanonicalType& Get(TypeId id) const;
+    std::string ToString(TypeId id) const;
+    // Number of canonical types
+    size_t Size() const;
+    // Number of syntax types interned
+    size_t InternedNodes() const { return internedNodes_; }
+
+private:
+    TypeContext(const TypeContext&) = delete;
+    TypeContext& operator = (const TypeContext&) = delete;
+
+    struct TypeKey {
+        TypeKind kind;
+        std::string name;
+        const ast::Decl* decl;
+        TypeId key;
+        TypeId value;
+        bool operator == (const TypeKey& rhs) const {
+            return kind == rhs.kind && decl == rhs.decl && key == rhs.key &&
+                value == rhs.value && name == rhs.name;
+        }
+    };
+    struct TypeKeyHash {
+        size_t operator () (const TypeKey& key) const;
+    };
+    TypeId Lookup(const TypeKey& key);
+
+private:
+    mutable std::shared_mutex mutex_;
+    // The canonical type of id is types_[id], types_[0] is the invalid type.
+    // A deque keeps the references of Get() valid while types are added.
+    std::deque<CanonicalType> types_;
+    std::unordered_map<TypeKey, TypeId, TypeKeyHash> ids_;
+    std::atomic<size_t> internedNodes_;
+};
+
+} // namespace zl
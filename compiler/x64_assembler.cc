@@ -0,0 +1,323 @@
+#include <string.h>
+#include "x64_assembler.h"
+
+namespace zl {
+
+namespace {
+
+bool FitsInt8(int64_t value) {
+    return value >= -128 && value <= 127;
+}
+
+bool FitsInt32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+uint8_t Reg(Gpr reg) {
+    return static_cast<uint8_t>(reg);
+}
+
+uint8_t Reg(Xmm reg) {
+    return static_cast<uint8_t>(reg);
+}
+
+} // namespace
+
+Cond InvertCond(Cond cond) {
+    return static_cast<Cond>(static_cast<uint8_t>(cond) ^ 1);
+}
+
+X64Assembler::Label X64Assembler::NewLabel() {
+    positions_.push_back(-1);
+    fixups_.emplace_back();
+    return static_cast<Label>(positions_.size() - 1);
+}
+
+void X64Assembler::Bind(Label label) {
+    positions_[label] = static_cast<int64_t>(code_.size());
+    // Patch the jumps emitted before the label
+    for (auto offset : fixups_[label]) {
+        int32_t disp = static_cast<int32_t>(code_.size() - (offset + 4));
+        memcpy(&code_[offset], &disp, sizeof(disp));
+    }
+    unresolved_ -= fixups_[label].size();
+    fixups_[label].clear();
+    fixups_[label].shrink_to_fit();
+}
+
+bool X64Assembler::Resolved() const {
+    return unresolved_ == 0;
+}
+
+void X64Assembler::Int32(int32_t value) {
+    uint8_t bytes[4];
+    memcpy(bytes, &value, sizeof(bytes));
+    code_.insert(code_.end(), bytes, bytes + sizeof(bytes));
+}
+
+void X64Assembler::Int64(int64_t value) {
+    uint8_t bytes[8];
+    memcpy(bytes, &value, sizeof(bytes));
+    code_.insert(code_.end(), bytes, bytes + sizeof(bytes));
+}
+
+void X64Assembler::Emit(uint8_t prefix, bool wide, uint16_t opcode, uint8_t reg, Rm rm, bool byteReg) {
+    if (prefix)
+        Byte(prefix);
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm.reg & 8) ? 0x01 : 0);
+    bool byteRegister = byteReg && ((!rm.memory && rm.reg >= 4) || reg >= 4);
+    if (rex != 0x40 || byteRegister)
+        Byte(rex);
+    if (opcode > 0xff)
+        Byte(static_cast<uint8_t>(opcode >> 8));
+    Byte(static_cast<uint8_t>(opcode));
+
+    uint8_t regField = static_cast<uint8_t>((reg & 7) << 3);
+    if (!rm.memory) {
+        Byte(0xc0 | regField | (rm.reg & 7));
+        return;
+    }
+    // rbp and r13 as base always have a displacement, rsp and r12 need a SIB
+    uint8_t base = rm.reg & 7;
+    uint8_t mod = 0x80;
+    if (rm.disp == 0 && base != 5)
+        mod = 0x00;
+    else if (FitsInt8(rm.disp))
+        mod = 0x40;
+    Byte(mod | regField | base);
+    if (base == 4)
+        Byte(0x24);
+    if (mod == 0x40)
+        Byte(static_cast<uint8_t>(static_cast<int8_t>(rm.disp)));
+    else if (mod == 0x80)
+        Int32(rm.disp);
+}
+
+void X64Assembler::Mov(bool wide, Gpr dst, Gpr src) {
+    Emit(0, wide, 0x89, Reg(src), RegRm(Reg(dst)));
+}
+
+void X64Assembler::Mov(bool wide, Gpr dst, X64Memory src) {
+    Emit(0, wide, 0x8b, Reg(dst), MemRm(src));
+}
+
+void X64Assembler::Mov(bool wide, X64Memory dst, Gpr src) {
+    Emit(0, wide, 0x89, Reg(src), MemRm(dst));
+}
+
+void X64Assembler::MovImm(bool wide, Gpr dst, int64_t value) {
+    if (!wide || (value >= 0 && value <= UINT32_MAX)) {
+        // mov r32, imm32 zero extends
+        if (Reg(dst) & 8)
+            Byte(0x41);
+        Byte(0xb8 | (Reg(dst) & 7));
+        Int32(static_cast<int32_t>(static_cast<uint32_t>(value)));
+    } else if (FitsInt32(value)) {
+        Emit(0, true, 0xc7, 0, RegRm(Reg(dst)));
+        Int32(static_cast<int32_t>(value));
+    } else {
+        Byte(0x48 | ((Reg(dst) & 8) ? 0x01 : 0));
+        Byte(0xb8 | (Reg(dst) & 7));
+        Int64(value);
+    }
+}
+
+void X64Assembler::MovImm(bool wide, X64Memory dst, int32_t value) {
+    Emit(0, wide, 0xc7, 0, MemRm(dst));
+    Int32(value);
+}
+
+void X64Assembler::Alu(AluOp op, bool wide, Gpr dst, Gpr src) {
+    Emit(0, wide, static_cast<uint8_t>(op) << 3 | 0x01, Reg(src), RegRm(Reg(dst)));
+}
+
+void X64Assembler::Alu(AluOp op, bool wide, Gpr dst, X64Memory src) {
+    Emit(0, wide, static_cast<uint8_t>(op) << 3 | 0x03, Reg(dst), MemRm(src));
+}
+
+void X64Assembler::Alu(AluOp op, bool wide, Gpr dst, int32_t value) {
+    if (FitsInt8(value)) {
+        Emit(0, wide, 0x83, static_cast<uint8_t>(op), RegRm(Reg(dst)));
+        Byte(static_cast<uint8_t>(static_cast<int8_t>(value)));
+    } else {
+        Emit(0, wide, 0x81, static_cast<uint8_t>(op), RegRm(Reg(dst)));
+        Int32(value);
+    }
+}
+
+void X64Assembler::Alu(AluOp op, bool wide, X64Memory dst, int32_t value) {
+    if (FitsInt8(value)) {
+        Emit(0, wide, 0x83, static_cast<uint8_t>(op), MemRm(dst));
+        Byte(static_cast<uint8_t>(static_cast<int8_t>(value)));
+    } else {
+        Emit(0, wide, 0x81, static_cast<uint8_t>(op), MemRm(dst));
+        Int32(value);
+    }
+}
+
+void X64Assembler::Imul(bool wide, Gpr dst, Gpr src) {
+    Emit(0, wide, 0x0faf, Reg(dst), RegRm(Reg(src)));
+}
+
+void X64Assembler::Imul(bool wide, Gpr dst, X64Memory src) {
+    Emit(0, wide, 0x0faf, Reg(dst), MemRm(src));
+}
+
+void X64Assembler::Imul(bool wide, Gpr dst, Gpr src, int32_t value) {
+    if (FitsInt8(value)) {
+        Emit(0, wide, 0x6b, Reg(dst), RegRm(Reg(src)));
+        Byte(static_cast<uint8_t>(static_cast<int8_t>(value)));
+    } else {
+        Emit(0, wide, 0x69, Reg(dst), RegRm(Reg(src)));
+        Int32(value);
+    }
+}
+
+void X64Assembler::Neg(bool wide, Gpr reg) {
+    Emit(0, wide, 0xf7, 3, RegRm(Reg(reg)));
+}
+
+void X64Assembler::Not(bool wide, Gpr reg) {
+    Emit(0, wide, 0xf7, 2, RegRm(Reg(reg)));
+}
+
+void X64Assembler::Shl(bool wide, Gpr reg) {
+    Emit(0, wide, 0xd3, 4, RegRm(Reg(reg)));
+}
+
+void X64Assembler::Sar(bool wide, Gpr reg) {
+    Emit(0, wide, 0xd3, 7, RegRm(Reg(reg)));
+}
+
+void X64Assembler::Shl(bool wide, Gpr reg, uint8_t count) {
+    Emit(0, wide, 0xc1, 4, RegRm(Reg(reg)));
+    Byte(count);
+}
+
+void X64Assembler::Sar(bool wide, Gpr reg, uint8_t count) {
+    Emit(0, wide, 0xc1, 7, RegRm(Reg(reg)));
+    Byte(count);
+}
+
+void X64Assembler::Cqo() {
+    Byte(0x48);
+    Byte(0x99);
+}
+
+void X64Assembler::Idiv(bool wide, Gpr divisor) {
+    Emit(0, wide, 0xf7, 7, RegRm(Reg(divisor)));
+}
+
+void X64Assembler::Test(bool wide, Gpr a, Gpr b) {
+    Emit(0, wide, 0x85, Reg(b), RegRm(Reg(a)));
+}
+
+void X64Assembler::Movsxd(Gpr dst, Gpr src) {
+    Emit(0, true, 0x63, Reg(dst), RegRm(Reg(src)));
+}
+
+void X64Assembler::Movzx8(Gpr dst, Gpr src) {
+    Emit(0, false, 0x0fb6, Reg(dst), RegRm(Reg(src)), true);
+}
+
+void X64Assembler::Setcc(Cond cond, Gpr dst) {
+    Emit(0, false, 0x0f90 | static_cast<uint8_t>(cond), 0, RegRm(Reg(dst)), true);
+}
+
+void X64Assembler::EmitJump(Label label) {
+    if (IsBound(label)) {
+        Int32(static_cast<int32_t>(positions_[label] - static_cast<int64_t>(code_.size() + 4)));
+        return;
+    }
+    fixups_[label].push_back(code_.size());
+    unresolved_++;
+    Int32(0);
+}
+
+void X64Assembler::Jmp(Label label) {
+    Byte(0xe9);
+    EmitJump(label);
+}
+
+void X64Assembler::Jcc(Cond cond, Label label) {
+    Byte(0x0f);
+    Byte(0x80 | static_cast<uint8_t>(cond));
+    EmitJump(label);
+}
+
+void X64Assembler::Call(Label label) {
+    Byte(0xe8);
+    EmitJump(label);
+}
+
+void X64Assembler::Call(Gpr target) {
+    Emit(0, false, 0xff, 2, RegRm(Reg(target)));
+}
+
+void X64Assembler::Jmp(Gpr target) {
+    Emit(0, false, 0xff, 4, RegRm(Reg(target)));
+}
+
+void X64Assembler::Ret() {
+    Byte(0xc3);
+}
+
+void X64Assembler::Push(Gpr reg) {
+    if (Reg(reg) & 8)
+        Byte(0x41);
+    Byte(0x50 | (Reg(reg) & 7));
+}
+
+void X64Assembler::Pop(Gpr reg) {
+    if (Reg(reg) & 8)
+        Byte(0x41);
+    Byte(0x58 | (Reg(reg) & 7));
+}
+
+void X64Assembler::MovXmm(Xmm dst, Xmm src) {
+    // movaps copies the whole register without a dependency on dst
+    Emit(0, false, 0x0f28, Reg(dst), RegRm(Reg(src)));
+}
+
+void X64Assembler::MovXmm(bool single, Xmm dst, X64Memory src) {
+    Emit(single ? 0xf3 : 0xf2, false, 0x0f10, Reg(dst), MemRm(src));
+}
+
+void X64Assembler::MovXmm(bool single, X64Memory dst, Xmm src) {
+    Emit(single ? 0xf3 : 0xf2, false, 0x0f11, Reg(src), MemRm(dst));
+}
+
+void X64Assembler::MovBits(bool wide, Xmm dst, Gpr src) {
+    Emit(0x66, wide, 0x0f6e, Reg(dst), RegRm(Reg(src)));
+}
+
+void X64Assembler::MovBits(bool wide, Gpr dst, Xmm src) {
+    Emit(0x66, wide, 0x0f7e, Reg(src), RegRm(Reg(dst)));
+}
+
+void X64Assembler::Sse(SseOp op, bool single, Xmm dst, Xmm src) {
+    Emit(single ? 0xf3 : 0xf2, false, 0x0f00 | static_cast<uint8_t>(op), Reg(dst), RegRm(Reg(src)));
+}
+
+void X64Assembler::Sse(SseOp op, bool single, Xmm dst, X64Memory src) {
+    Emit(single ? 0xf3 : 0xf2, false, 0x0f00 | static_cast<uint8_t>(op), Reg(dst), MemRm(src));
+}
+
+void X64Assembler::Ucomi(bool single, Xmm a, Xmm b) {
+    Emit(single ? 0 : 0x66, false, 0x0f2e, Reg(a), RegRm(Reg(b)));
+}
+
+void X64Assembler::CvtIntToFloat(bool single, bool wide, Xmm dst, Gpr src) {
+    Emit(single ? 0xf3 : 0xf2, wide, 0x0f2a, Reg(dst), RegRm(Reg(src)));
+}
+
+void X64Assembler::CvtFloatToInt(bool single, bool wide, Gpr dst, Xmm src) {
+    Emit(single ? 0xf3 : 0xf2, wide, 0x0f2c, Reg(dst), RegRm(Reg(src)));
+}
+
+void X64Assembler::CvtFloat(bool single, Xmm dst, Xmm src) {
+    // cvtsd2ss when converting to single, cvtss2sd otherwise
+    Emit(single ? 0xf2 : 0xf3, false, 0x0f5a, Reg(dst), RegRm(Reg(src)));
+}
+
+} // namespace zl
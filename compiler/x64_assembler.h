@@ -0,0 +1,176 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace zl {
+
+// General purpose registers in the order of their encoding
+enum class Gpr : uint8_t {
+    Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum class Xmm : uint8_t {
+    Xmm0, Xmm1, Xmm2, Xmm3, Xmm4, Xmm5, Xmm6, Xmm7,
+    Xmm8, Xmm9, Xmm10, Xmm11, Xmm12, Xmm13, Xmm14, Xmm15,
+};
+
+// Condition codes of jcc and setcc
+enum class Cond : uint8_t {
+    Overflow = 0x0,
+    Below = 0x2,
+    AboveEqual = 0x3,
+    Equal = 0x4,
+    NotEqual = 0x5,
+    BelowEqual = 0x6,
+    Above = 0x7,
+    Parity = 0xa,
+    NoParity = 0xb,
+    Less = 0xc,
+    GreaterEqual = 0xd,
+    LessEqual = 0xe,
+    Greater = 0xf,
+};
+
+// Return the condition which is true when cond is false
+Cond InvertCond(Cond cond);
+
+// X64Memory is a [base + disp] operand
+struct X64Memory {
+    X64Memory(Gpr base, int32_t disp): base(base), disp(disp) {}
+    Gpr base;
+    int32_t disp;
+};
+
+// Integer operations sharing the encoding of add
+enum class AluOp : uint8_t {
+    Add = 0,
+    Or = 1,
+    And = 4,
+    Sub = 5,
+    Xor = 6,
+    Cmp = 7,
+};
+
+// Scalar SSE arithmetic, the value is the second opcode byte
+enum class SseOp : uint8_t {
+    Add = 0x58,
+    Mul = 0x59,
+    Sub = 0x5c,
+    Div = 0x5e,
+};
+
+// X64Assembler encode x86-64 instructions into a byte buffer. Only the forms
+// used by the JIT are provided. Operations on general purpose registers take
+// wide, 64 bits if it is true and 32 bits otherwise, 32 bits results are zero
+// extended. Scalar SSE operations take single for float, double otherwise.
+//
+// Jumps and calls to labels are always encoded with 32 bits displacements and
+// patched when the label is bound, so the code is emitted in one pass.
+class X64Assembler {
+public:
+    typedef uint32_t Label;
+
+    X64Assembler(): unresolved_(0) {}
+    ~X64Assembler() {}
+
+    const std::vector<uint8_t>& Code() const { return code_; }
+    size_t Size() const { return code_.size(); }
+
+    Label NewLabel();
+    void Bind(Label label);
+    bool IsBound(Label label) const { return positions_[label] >= 0; }
+    // Offset of a bound label in the code
+    size_t Position(Label label) const { return static_cast<size_t>(positions_[label]); }
+    // Return true if every label used by a jump is bound
+    bool Resolved() const;
+
+    void Mov(bool wide, Gpr dst, Gpr src);
+    void Mov(bool wide, Gpr dst, X64Memory src);
+    void Mov(bool wide, X64Memory dst, Gpr src);
+    // Load the constant, with the shortest encoding for its value
+    void MovImm(bool wide, Gpr dst, int64_t value);
+    // Store a 32 bits immediate, sign extended if wide
+    void MovImm(bool wide, X64Memory dst, int32_t value);
+    void Alu(AluOp op, bool wide, Gpr dst, Gpr src);
+    void Alu(AluOp op, bool wide, Gpr dst, X64Memory src);
+    void Alu(AluOp op, bool wide, Gpr dst, int32_t value);
+    void Alu(AluOp op, bool wide, X64Memory dst, int32_t value);
+    void Imul(bool wide, Gpr dst, Gpr src);
+    void Imul(bool wide, Gpr dst, X64Memory src);
+    void Imul(bool wide, Gpr dst, Gpr src, int32_t value);
+    void Neg(bool wide, Gpr reg);
+    void Not(bool wide, Gpr reg);
+    // Shift left and arithmetic shift right by cl or by a constant
+    void Shl(bool wide, Gpr reg);
+    void Sar(bool wide, Gpr reg);
+    void Shl(bool wide, Gpr reg, uint8_t count);
+    void Sar(bool wide, Gpr reg, uint8_t count);
+    // Sign extend rax into rdx
+    void Cqo();
+    // Signed divide rdx:rax, or edx:eax, by the register
+    void Idiv(bool wide, Gpr divisor);
+    void Test(bool wide, Gpr a, Gpr b);
+    void Movsxd(Gpr dst, Gpr src);
+    void Movzx8(Gpr dst, Gpr src);
+    void Setcc(Cond cond, Gpr dst);
+
+    void Jmp(Label label);
+    void Jcc(Cond cond, Label label);
+    void Call(Label label);
+    void Call(Gpr target);
+    void Jmp(Gpr target);
+    void Ret();
+    void Push(Gpr reg);
+    void Pop(Gpr reg);
+
+    void MovXmm(Xmm dst, Xmm src);
+    void MovXmm(bool single, Xmm dst, X64Memory src);
+    void MovXmm(bool single, X64Memory dst, Xmm src);
+    // Move bits between general purpose and xmm registers, movd or movq
+    void MovBits(bool wide, Xmm dst, Gpr src);
+    void MovBits(bool wide, Gpr dst, Xmm src);
+    void Sse(SseOp op, bool single, Xmm dst, Xmm src);
+    void Sse(SseOp op, bool single, Xmm dst, X64Memory src);
+    // Unordered compare, sets ZF, PF and CF
+    void Ucomi(bool single, Xmm a, Xmm b);
+    // Convert an integer of wide or 32 bits to float or double
+    void CvtIntToFloat(bool single, bool wide, Xmm dst, Gpr src);
+    // Convert float or double to an integer, truncated
+    void CvtFloatToInt(bool single, bool wide, Gpr dst, Xmm src);
+    // Convert double to float if single, float to double otherwise
+    void CvtFloat(bool single, Xmm dst, Xmm src);
+
+private:
+    X64Assembler(const X64Assembler&) = delete;
+    X64Assembler& operator = (const X64Assembler&) = delete;
+
+    // The rm operand of an instruction, a register or a memory operand
+    struct Rm {
+        bool memory;
+        uint8_t reg;
+        int32_t disp;
+    };
+    static Rm RegRm(uint8_t reg) { return Rm{false, reg, 0}; }
+    static Rm MemRm(X64Memory mem) { return Rm{true, static_cast<uint8_t>(mem.base), mem.disp}; }
+
+    void Byte(uint8_t byte) { code_.push_back(byte); }
+    void Int32(int32_t value);
+    void Int64(int64_t value);
+    // Emit the prefix, REX, opcode bytes and the operands. opcode holds one
+    // or two bytes, 0x0f first for two bytes opcodes. byteReg forces a REX
+    // so that spl, bpl, sil and dil are addressed instead of ah to bh.
+    void Emit(uint8_t prefix, bool wide, uint16_t opcode, uint8_t reg, Rm rm, bool byteReg = false);
+    void EmitJump(Label label);
+
+private:
+    std::vector<uint8_t> code_;
+    // Offset of each label, -1 until bound
+    std::vector<int64_t> positions_;
+    // Offsets of the displacements of jumps to each label not bound yet
+    std::vector<std::vector<size_t>> fixups_;
+    size_t unresolved_;
+};
+
+} // namespace zl
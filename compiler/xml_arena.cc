@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+#include "xml_arena.h"
+
+namespace zl {
+
+namespace {
+
+const size_t kAlignment = alignof(max_align_t);
+
+// The arena of the active XmlArenaScope
+XmlArena* activeArena = nullptr;
+
+void* ArenaAllocate(size_t size) {
+    return activeArena->Allocate(size);
+}
+
+void ArenaDeallocate(void* ptr) {}
+
+size_t AlignUp(size_t size) {
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+} // namespace
+
+XmlArena::XmlArena(size_t blockSize)
+    : blockSize_(AlignUp(blockSize)), current_(0), used_(0), allocated_(0),
+    reserved_(0), peakReserved_(0) {}
+
+XmlArena::~XmlArena() {
+    Reset();
+    for (auto& block : blocks_)
+        free(block.data);
+}
+
+void* XmlArena::Allocate(size_t size) {
+    size = AlignUp(std::max<size_t>(size, 1));
+    allocated_ += size;
+    if (size > blockSize_) {
+        void* data = aligned_alloc(kAlignment, size);
+        if (!data)
+            return nullptr;
+        largeBlocks_.push_back({static_cast<char*>(data), size});
+        reserved_ += size;
+        peakReserved_ = std::max(peakReserved_, reserved_);
+        return data;
+    }
+    if (blocks_.empty() || used_ + size > blocks_[current_].size) {
+        // The block is only moved to once it exists, a failed allocation
+        // leaves the arena as it was
+        size_t next = blocks_.empty() ? 0 : current_ + 1;
+        if (next == blocks_.size()) {
+            void* data = aligned_alloc(kAlignment, blockSize_);
+            if (!data)
+                return nullptr;
+            blocks_.push_back({static_cast<char*>(data), blockSize_});
+            reserved_ += blockSize_;
+            peakReserved_ = std::max(peakReserved_, reserved_);
+        }
+        current_ = next;
+        used_ = 0;
+    }
+    void* data = blocks_[current_].data + used_;
+    used_ += size;
+    return data;
+}
+
+void XmlArena::Reset() {
+    for (auto& block : largeBlocks_) {
+        free(block.data);
+        reserved_ -= block.size;
+    }
+    largeBlocks_.clear();
+    current_ = 0;
+    used_ = 0;
+    allocated_ = 0;
+}
+
+XmlArenaScope::XmlArenaScope(XmlArena& arena)
+    : arena_(arena), allocate_(pugi::get_memory_allocation_function()),
+    deallocate_(pugi::get_memory_deallocation_function()) {
+    activeArena = &arena;
+    pugi::set_memory_management_functions(ArenaAllocate, ArenaDeallocate);
+}
+
+XmlArenaScope::~XmlArenaScope() {
+    pugi::set_memory_management_functions(allocate_, deallocate_);
+    activeArena = nullptr;
+    arena_.Reset();
+}
+
+} // namespace zl
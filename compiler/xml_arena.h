@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+#include "pugixml.hpp"
+
+namespace zl {
+
+// XmlArena is a bump allocator for pugixml documents. Memory is never freed
+// one allocation at a time, Reset release all of it at once, so loading and
+// dropping large documents costs no heap bookkeeping.
+class XmlArena {
+public:
+    explicit XmlArena(size_t blockSize = 1 << 20);
+    ~XmlArena();
+
+    // Return memory aligned for any type
+    void* Allocate(size_t size);
+    // Release everything allocated, blocks of the default size are kept to
+    // be reused
+    void Reset();
+    // Bytes handed out since the last reset
+    size_t Allocated() const { return allocated_; }
+    // Bytes of blocks held, the most since the last reset
+    size_t Reserved() const { return reserved_; }
+    size_t PeakReserved() const { return peakReserved_; }
+
+private:
+    XmlArena(const XmlArena&) = delete;
+    XmlArena& operator = (const XmlArena&) = delete;
+
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+private:
+    size_t blockSize_;
+    // Blocks of the default size, blocks_[current_] is being used
+    std::vector<Block> blocks_;
+    size_t current_;
+    size_t used_;
+    // Blocks of allocations larger than the default block size
+    std::vector<Block> largeBlocks_;
+    size_t allocated_;
+    size_t reserved_;
+    size_t peakReserved_;
+};
+
+// XmlArenaScope route pugixml allocations to the arena while it is alive,
+// the previous functions are restored and the arena is reset when it is
+// destroyed. Every pugixml object created in the scope must be destroyed
+// before it. The memory functions of pugixml are global, so scopes must not
+// be nested and no other thread may use pugixml meanwhile.
+class XmlArenaScope {
+public:
+    explicit XmlArenaScope(XmlArena& arena);
+    ~XmlArenaScope();
+
+private:
+    XmlArenaScope() = delete;
+    XmlArenaScope(const XmlArenaScope&) = delete;
+    XmlArenaScope& operator = (const XmlArenaScope&) = delete;
+
+    XmlArena& arena_;
+    pugi::allocation_function allocate_;
+    pugi::deallocation_function deallocate_;
+};
+
+} // namespace zl
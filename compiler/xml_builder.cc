@@ -1 +1,226 @@
+#include <string.h>
+#include <algorithm>
 #include "xml_builder.h"
+
+namespace zl {
+
+namespace {
+
+const char kDeclaration[] = "<?xml version=\"1.0\"?>\n";
+
+// Characters escaped in attribute values, the same as pugixml so that the
+// streamed and the DOM document are identical
+EscapeTable BuildXmlEscapes() {
+    EscapeTable table;
+    for (int c = 0; c < 32; c++)
+        table.replacement[c] = std::string("&#") + char('0' + c / 10) + char('0' + c % 10) + ";";
+    table.replacement['&'] = "&amp;";
+    table.replacement['<'] = "&lt;";
+    table.replacement['"'] = "&quot;";
+    return table;
+}
+const EscapeTable xmlEscapes = BuildXmlEscapes();
+
+} // namespace
+
+void XmlBuilder::WriteIndent(size_t depth) {
+    static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+    while (depth > 0) {
+        size_t count = std::min(depth, sizeof(tabs) - 1);
+        Write(tabs, count);
+        depth -= count;
+    }
+}
+
+void XmlBuilder::WriteStartTag(const char* name, const Attributes& attributes, size_t depth) {
+    WriteIndent(depth);
+    Write("<", 1);
+    Write(name);
+    for (auto& attribute : attributes) {
+        Write(" ", 1);
+        Write(attribute.first);
+        Write("=\"", 2);
+        WriteEscaped(attribute.second, xmlEscapes);
+        Write("\"", 1);
+    }
+}
+
+void XmlBuilder::WriteDocumentStart(size_t files) {
+    Write(kDeclaration);
+    Write(files > 0 ? "<ast>\n" : "<ast />\n");
+}
+
+void XmlBuilder::WriteDocumentEnd(size_t files) {
+    if (files > 0)
+        Write("</ast>\n");
+}
+
+void XmlBuilder::WriteFileStart(const SourceFile& file) {
+    WriteStartTag("file", {{"path", file.path}}, 1);
+    if (file.decls.empty())
+        Write(" />\n", 4);
+    else
+        Write(">\n", 2);
+}
+
+void XmlBuilder::WriteFileEnd(const SourceFile& file) {
+    if (!file.decls.empty())
+        Write("\t</file>\n");
+}
+
+void XmlBuilder::WriteNodeStart(const ast::Node* node, const Attributes& attributes,
+        size_t children, size_t depth) {
+    WriteStartTag(ast::NodeKindName(node->Kind()), attributes, depth);
+    if (children == 0)
+        Write(" />\n", 4);
+    else
+        Write(">\n", 2);
+}
+
+void XmlBuilder::WriteNodeEnd(const ast::Node* node, size_t children, size_t depth) {
+    if (children == 0)
+        return;
+    WriteIndent(depth);
+    Write("</", 2);
+    Write(ast::NodeKindName(node->Kind()));
+    Write(">\n", 2);
+}
+
+// Absent optional children are written as <null /> so that the position of
+// every child is kept
+void XmlBuilder::WriteNull(size_t depth) {
+    WriteIndent(depth);
+    Write("<null />\n");
+}
+
+AstSerializer* XmlBuilder::NewChunkSerializer() const {
+    return new XmlBuilder(ChunkTag());
+}
+
+void XmlBuilder::BuildXml(ast::Node* tree) {
+    Write(kDeclaration);
+    WriteNode(tree, 0);
+    Flush();
+}
+
+void XmlBuilder::AppendNode(pugi::xml_node parent, const ast::Node* node, size_t depth) {
+    if (!node) {
+        parent.append_child("null");
+        return;
+    }
+    auto element = parent.append_child(ast::NodeKindName(node->Kind()));
+    for (auto& attribute : CollectAttributes(node, depth))
+        element.append_attribute(attribute.first).set_value(attribute.second.c_str());
+    CollectChildren(node, depth);
+    for (size_t i = 0; i < children_[depth].size(); i++)
+        AppendNode(element, children_[depth][i], depth + 1);
+}
+
+void XmlBuilder::BuildDocument(const std::vector<SourceFile>& files, pugi::xml_document& document) {
+    auto root = document.append_child("ast");
+    for (auto& file : files) {
+        auto element = root.append_child("file");
+        element.append_attribute("path").set_value(file.path.c_str());
+        for (auto decl : file.decls)
+            AppendNode(element, decl, 2);
+    }
+}
+
+void XmlBuilder::BuildDom(const std::vector<SourceFile>& files) {
+    pugi::xml_document document;
+    BuildDocument(files, document);
+    Flush();
+    document.save(*writer_, "\t");
+}
+
+namespace {
+
+// Return the xpath of the element, the position of a step is among the
+// siblings of the same name. It is only built for a difference, since the
+// positions cost a scan of the siblings.
+std::string XPathOf(pugi::xml_node node) {
+    std::string path;
+    for (; node && node.type() == pugi::node_element; node = node.parent()) {
+        size_t position = 1;
+        for (auto sibling = node.previous_sibling(node.name()); sibling;
+                sibling = sibling.previous_sibling(node.name()))
+            position++;
+        path = "/" + std::string(node.name()) + "[" + std::to_string(position) + "]" + path;
+    }
+    return path;
+}
+
+pugi::xml_node FirstElement(const pugi::xml_node& node) {
+    return node.find_child([](pugi::xml_node child) { return child.type() == pugi::node_element; });
+}
+
+pugi::xml_node NextElement(pugi::xml_node node) {
+    do {
+        node = node.next_sibling();
+    } while (node && node.type() != pugi::node_element);
+    return node;
+}
+
+bool CompareElements(const pugi::xml_node& expected, const pugi::xml_node& actual,
+        std::string& difference) {
+    if (strcmp(expected.name(), actual.name()) != 0) {
+        difference = XPathOf(expected) + ": expected <" + expected.name() + ">, found <" +
+            actual.name() + ">";
+        return false;
+    }
+    auto expectedAttribute = expected.first_attribute();
+    auto actualAttribute = actual.first_attribute();
+    for (; expectedAttribute && actualAttribute; expectedAttribute = expectedAttribute.next_attribute(),
+            actualAttribute = actualAttribute.next_attribute()) {
+        if (strcmp(expectedAttribute.name(), actualAttribute.name()) != 0) {
+            difference = XPathOf(expected) + "/@" + expectedAttribute.name() + ": found @" +
+                actualAttribute.name();
+            return false;
+        }
+        if (strcmp(expectedAttribute.value(), actualAttribute.value()) != 0) {
+            difference = XPathOf(expected) + "/@" + expectedAttribute.name() + ": expected " +
+                expectedAttribute.value() + ", found " + actualAttribute.value();
+            return false;
+        }
+    }
+    if (expectedAttribute) {
+        difference = XPathOf(expected) + "/@" + expectedAttribute.name() + ": missing";
+        return false;
+    }
+    if (actualAttribute) {
+        difference = XPathOf(actual) + "/@" + actualAttribute.name() + ": unexpected";
+        return false;
+    }
+
+    auto expectedChild = FirstElement(expected);
+    auto actualChild = FirstElement(actual);
+    for (; expectedChild && actualChild; expectedChild = NextElement(expectedChild),
+            actualChild = NextElement(actualChild)) {
+        if (!CompareElements(expectedChild, actualChild, difference))
+            return false;
+    }
+    if (expectedChild) {
+        difference = XPathOf(expectedChild) + ": missing";
+        return false;
+    }
+    if (actualChild) {
+        difference = XPathOf(actualChild) + ": unexpected";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool CompareXml(const pugi::xml_node& expected, const pugi::xml_node& actual,
+        std::string& difference) {
+    auto expectedRoot = expected.type() == pugi::node_document ? FirstElement(expected) : expected;
+    auto actualRoot = actual.type() == pugi::node_document ? FirstElement(actual) : actual;
+    if (!expectedRoot || !actualRoot) {
+        difference = "/: document is empty";
+        return expectedRoot == actualRoot;
+    }
+    return CompareElements(expectedRoot, actualRoot, difference);
+}
+
+} // namespace zl
@@ -1,17 +1,59 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include "pugixml.hpp"
 #include "ast.h"
+#include "ast_serializer.h"
+#include "frontend.h"
 
 namespace zl {
 
 // ParserXmlBuilder will dump the whole parser tree into xml document for
 // confirmating wether the parser work normally.
-class XmlBuilder {
+//
+// The document is streamed by AstSerializer, so the memory used does not
+// depend on the size of the tree. BuildDom produce the same bytes by building
+// a pugi::xml_document first, it is only meant for small inputs.
+class XmlBuilder : public AstSerializer {
 public:
-    explicit XmlBuilder(const std::string& filePath);
-    ~XmlBuilder();
+    // Write the document into the file, it throws std::invalid_argument if
+    // the file can not be created
+    explicit XmlBuilder(const std::string& filePath): AstSerializer(filePath) {}
+    explicit XmlBuilder(pugi::xml_writer& writer): AstSerializer(writer) {}
+
+    // Write the document whose root element is the tree
     void BuildXml(ast::Node* tree);
+    // Write the document of the files, the root element is <ast> and each
+    // file is a <file> element holding its declarations
+    void BuildXml(const std::vector<SourceFile>& files) { Serialize(files); }
+    void BuildXml(const std::vector<SourceFile>& files, ThreadPool& pool) { Serialize(files, pool); }
+    void BuildDom(const std::vector<SourceFile>& files);
+    // Build the document of the files without writing it
+    void BuildDocument(const std::vector<SourceFile>& files, pugi::xml_document& document);
+
+protected:
+    void WriteDocumentStart(size_t files) override;
+    void WriteDocumentEnd(size_t files) override;
+    void WriteFileStart(const SourceFile& file) override;
+    void WriteFileEnd(const SourceFile& file) override;
+    void WriteNodeStart(const ast::Node* node, const Attributes& attributes,
+            size_t children, size_t depth) override;
+    void WriteNodeEnd(const ast::Node* node, size_t children, size_t depth) override;
+    void WriteNull(size_t depth) override;
+    AstSerializer* NewChunkSerializer() const override;
+
+private:
+    explicit XmlBuilder(ChunkTag tag): AstSerializer(tag) {}
+    void AppendNode(pugi::xml_node parent, const ast::Node* node, size_t depth);
+    void WriteStartTag(const char* name, const Attributes& attributes, size_t depth);
+    void WriteIndent(size_t depth);
 };
 
+// Compare the element trees of the documents, return false and describe the
+// first difference with its xpath in difference, such as
+// "/ast/file[1]/ClassDecl[2]/@line: expected 3, found 4"
+bool CompareXml(const pugi::xml_node& expected, const pugi::xml_node& actual,
+        std::string& difference);
+
 } // namespace zl
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <algorithm>
+#include "bytecode.h"
+
+namespace zl {
+
+namespace {
+
+const char* const opCodeNames[] = {
+#define ZL_OPCODE_NAME(name) #name,
+    ZL_OPCODES(ZL_OPCODE_NAME)
+#undef ZL_OPCODE_NAME
+};
+
+std::string ConstantToString(const FunctionObject* function, int index) {
+    if (index >= static_cast<int>(function->constants.size()))
+        return "?";
+    Value value = function->constants[index];
+    if (IsObjectOf(value, ObjectKind::String))
+        return "\"" + ValueToString(value) + "\"";
+    return ValueToString(value);
+}
+
+const char* SwitchKindName(SwitchTable::Kind kind) {
+    switch (kind) {
+        case SwitchTable::Dense: return "dense";
+        case SwitchTable::Sparse: return "sparse";
+        default: return "strings";
+    }
+}
+
+// The cases of the table with their targets, for the Switch at pc
+std::string SwitchToString(const SwitchTable& table, size_t pc) {
+    std::string text = SwitchKindName(table.kind);
+    for (size_t n = 0; n < table.targets.size(); n++) {
+        std::string key;
+        if (table.kind == SwitchTable::Dense) {
+            if (table.targets[n] == table.defaultTarget)
+                continue;
+            key = std::to_string(static_cast<int64_t>(table.low) + static_cast<int64_t>(n));
+        } else if (table.kind == SwitchTable::Sparse) {
+            key = std::to_string(table.integers[n]);
+        } else {
+            if (table.strings[n].IsNil())
+                continue;
+            key = "\"" + ValueToString(table.strings[n]) + "\"";
+        }
+        text += " " + key + " to " + std::to_string(pc + 1 + table.targets[n]) + ",";
+    }
+    return text + " default to " + std::to_string(pc + 1 + table.defaultTarget);
+}
+
+// A set of registers, a bit per register
+struct Registers {
+    uint64_t words[kMaxRegisters / 64] = {};
+
+    void Add(int reg) {
+        if (reg < kMaxRegisters)
+            words[reg / 64] |= 1ull << (reg % 64);
+    }
+    void Remove(int reg) {
+        if (reg < kMaxRegisters)
+            words[reg / 64] &= ~(1ull << (reg % 64));
+    }
+    void AddRange(int first, int count) {
+        for (int reg = first; reg < first + count; reg++)
+            Add(reg);
+    }
+    void RemoveRange(int first, int count) {
+        for (int reg = first; reg < first + count; reg++)
+            Remove(reg);
+    }
+};
+
+// Registers read and registers always written by an instruction
+void UsesAndDefs(Instruction i, Registers& uses, Registers& defs) {
+    int a = GetA(i);
+    int b = GetB(i);
+    int c = GetC(i);
+    switch (GetOp(i)) {
+        case OpCode::Move:
+        case OpCode::AddInt:
+        case OpCode::Neg:
+        case OpCode::Not:
+        case OpCode::ToInt:
+        case OpCode::ToDouble:
+        case OpCode::GetField:
+        case OpCode::GetFieldK:
+            uses.Add(b);
+            defs.Add(a);
+            break;
+        case OpCode::LoadK:
+        case OpCode::LoadInt:
+        case OpCode::LoadNil:
+        case OpCode::LoadBool:
+        case OpCode::GetGlobal:
+        case OpCode::New:
+            defs.Add(a);
+            break;
+        case OpCode::OrZero:
+            uses.Add(a);
+            defs.Add(a);
+            break;
+        case OpCode::SetGlobal:
+        case OpCode::Test:
+        case OpCode::Assert:
+        case OpCode::Switch:
+            uses.Add(a);
+            break;
+        case OpCode::Throw:
+            uses.AddRange(a, c ? 3 : 1);
+            break;
+        case OpCode::Add:
+        case OpCode::Sub:
+        case OpCode::Mul:
+        case OpCode::Div:
+        case OpCode::Mod:
+        case OpCode::BitAnd:
+        case OpCode::BitOr:
+        case OpCode::BitXor:
+        case OpCode::Shl:
+        case OpCode::Shr:
+        case OpCode::Eq:
+        case OpCode::Lt:
+        case OpCode::Le:
+        case OpCode::GetIndex:
+            uses.Add(b);
+            uses.Add(c);
+            defs.Add(a);
+            break;
+        case OpCode::TestEq:
+        case OpCode::TestLt:
+        case OpCode::TestLe:
+            uses.Add(b);
+            uses.Add(c);
+            break;
+        case OpCode::Jmp:
+            break;
+        case OpCode::Call:
+            uses.AddRange(a, b + 1);
+            defs.AddRange(a, c);
+            break;
+        case OpCode::Return:
+            uses.AddRange(a, b);
+            break;
+        case OpCode::SetField:
+        case OpCode::SetFieldK:
+            uses.Add(a);
+            uses.Add(c);
+            break;
+        case OpCode::Self:
+            uses.Add(a + 1);
+            defs.Add(a);
+            break;
+        case OpCode::NewArray:
+            uses.AddRange(b, c);
+            defs.Add(a);
+            break;
+        case OpCode::NewMap:
+            uses.AddRange(b, 2 * c);
+            defs.Add(a);
+            break;
+        case OpCode::SetIndex:
+            uses.Add(a);
+            uses.Add(b);
+            uses.Add(c);
+            break;
+        case OpCode::ForPrep:
+            uses.Add(a);
+            defs.Add(a + 1);
+            break;
+        case OpCode::ForNext:
+        case OpCode::ForNext1:
+            // The key and value are only written when the loop goes on,
+            // see the successors in BuildStackMap
+            uses.AddRange(a, 2);
+            break;
+        case OpCode::DeferPush:
+            uses.Add(a);
+            uses.AddRange(b, c);
+            break;
+        case OpCode::DeferPop:
+            // The values are only written when a record is popped
+            uses.Add(b);
+            break;
+    }
+}
+
+bool IsSafePoint(OpCode op) {
+    switch (op) {
+        case OpCode::Add:
+        case OpCode::AddInt:
+        case OpCode::Call:
+        case OpCode::New:
+        case OpCode::NewArray:
+        case OpCode::NewMap:
+        case OpCode::DeferPush:
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace
+
+void BuildStackMap(FunctionObject* function) {
+    const auto& code = function->code;
+    size_t size = code.size();
+    std::vector<Registers> uses(size);
+    std::vector<Registers> defs(size);
+    for (size_t offset = 0; offset < size; offset++)
+        UsesAndDefs(code[offset], uses[offset], defs[offset]);
+
+    // Live registers at the start of each instruction, computed backward
+    // until nothing changes, loops need more than one pass
+    std::vector<Registers> live(size);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t offset = size; offset-- > 0; ) {
+            Instruction i = code[offset];
+            OpCode op = GetOp(i);
+            Registers out;
+            auto flow = [&](size_t target, int firstKilled, int killed) {
+                if (target >= size)
+                    return;
+                Registers in = live[target];
+                in.RemoveRange(firstKilled, killed);
+                for (size_t n = 0; n < kMaxRegisters / 64; n++)
+                    out.words[n] |= in.words[n];
+            };
+            switch (op) {
+                case OpCode::Return:
+                case OpCode::Throw:
+                    break;
+                case OpCode::Jmp:
+                    flow(offset + 1 + GetsJ(i), 0, 0);
+                    break;
+                case OpCode::LoadBool:
+                    flow(offset + (GetC(i) ? 2 : 1), 0, 0);
+                    break;
+                case OpCode::Switch: {
+                    auto& table = function->switches[GetBx(i)];
+                    flow(offset + 1 + table.defaultTarget, 0, 0);
+                    for (auto target : table.targets)
+                        flow(offset + 1 + target, 0, 0);
+                    break;
+                }
+                case OpCode::TestEq:
+                case OpCode::TestLt:
+                case OpCode::TestLe:
+                case OpCode::Test:
+                    flow(offset + 1, 0, 0);
+                    flow(offset + 2, 0, 0);
+                    break;
+                case OpCode::ForNext:
+                case OpCode::ForNext1:
+                    flow(offset + 1, GetA(i) + 1, op == OpCode::ForNext ? 3 : 2);
+                    flow(offset + 1 + GetsBx(i), GetA(i) + 1, 1);
+                    break;
+                case OpCode::DeferPop:
+                    flow(offset + 1, 0, 0);
+                    flow(offset + 2, GetA(i), GetC(i));
+                    break;
+                default:
+                    flow(offset + 1, 0, 0);
+                    break;
+            }
+            Registers in;
+            for (size_t n = 0; n < kMaxRegisters / 64; n++)
+                in.words[n] = (out.words[n] & ~defs[offset].words[n]) | uses[offset].words[n];
+            // An instruction may throw before it writes anything, the
+            // registers read by its handlers are live before it
+            for (auto& handler : function->handlers) {
+                if (offset < handler.start || offset >= handler.end || handler.target >= size)
+                    continue;
+                Registers caught = live[handler.target];
+                caught.RemoveRange(handler.reg, handler.NumRegisters());
+                for (size_t n = 0; n < kMaxRegisters / 64; n++)
+                    in.words[n] |= caught.words[n];
+            }
+            if (!std::equal(in.words, in.words + kMaxRegisters / 64, live[offset].words)) {
+                live[offset] = in;
+                changed = true;
+            }
+        }
+    }
+
+    int words = (function->numRegisters + 63) / 64;
+    function->liveWords = words;
+    function->safePoints.clear();
+    function->liveRegisters.clear();
+    std::vector<bool> targets(size);
+    for (auto& handler : function->handlers) {
+        if (handler.target < size)
+            targets[handler.target] = true;
+    }
+    for (size_t offset = 0; offset < size; offset++) {
+        if (!IsSafePoint(GetOp(code[offset])) && !targets[offset])
+            continue;
+        function->safePoints.push_back(static_cast<uint32_t>(offset));
+        function->liveRegisters.insert(function->liveRegisters.end(), live[offset].words,
+            live[offset].words + words);
+    }
+    // Registers read before they are written on some path are live at the
+    // start, they must not hold stale values of an earlier frame
+    Registers stale = size ? live[0] : Registers();
+    stale.RemoveRange(0, function->numParams);
+    function->clearRegisters = std::any_of(stale.words, stale.words + kMaxRegisters / 64,
+        [](uint64_t word) { return word != 0; });
+}
+
+const uint64_t* LiveRegistersAt(const FunctionObject* function, size_t offset) {
+    auto& safePoints = function->safePoints;
+    auto iter = std::lower_bound(safePoints.begin(), safePoints.end(), offset);
+    if (iter == safePoints.end() || *iter != offset)
+        return nullptr;
+    return function->liveRegisters.data() + (iter - safePoints.begin()) * function->liveWords;
+}
+
+const char* OpCodeName(OpCode op) {
+    auto index = static_cast<size_t>(op);
+    return index < sizeof(opCodeNames) / sizeof(opCodeNames[0]) ? opCodeNames[index] : "?";
+}
+
+std::string Disassemble(const FunctionObject* function) {
+    std::string text = "func " + function->name + " params " + std::to_string(function->numParams) +
+        " registers " + std::to_string(function->numRegisters) + " constants " +
+        std::to_string(function->constants.size()) + "\n";
+    char line[128];
+    std::string tables;
+    for (size_t pc = 0; pc < function->code.size(); pc++) {
+        Instruction i = function->code[pc];
+        OpCode op = GetOp(i);
+        int written = snprintf(line, sizeof(line), "%6zu [%4d] %-10s", pc,
+                pc < function->lines.size() ? function->lines[pc] : 0, OpCodeName(op));
+        std::string comment;
+        switch (op) {
+            case OpCode::LoadK:
+            case OpCode::New:
+            case OpCode::OrZero:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d", GetA(i), GetBx(i));
+                comment = ConstantToString(function, GetBx(i));
+                break;
+            case OpCode::GetGlobal:
+            case OpCode::SetGlobal:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d", GetA(i), GetBx(i));
+                break;
+            case OpCode::LoadInt:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d", GetA(i), GetsBx(i));
+                break;
+            case OpCode::ForNext:
+            case OpCode::ForNext1:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d", GetA(i), GetsBx(i));
+                comment = "to " + std::to_string(pc + 1 + GetsBx(i));
+                break;
+            case OpCode::Jmp:
+                written += snprintf(line + written, sizeof(line) - written, "%d", GetsJ(i));
+                comment = "to " + std::to_string(pc + 1 + GetsJ(i));
+                break;
+            case OpCode::Switch:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d", GetA(i), GetBx(i));
+                if (static_cast<size_t>(GetBx(i)) < function->switches.size()) {
+                    auto& table = function->switches[GetBx(i)];
+                    comment = SwitchKindName(table.kind);
+                    tables += "  switch " + std::to_string(GetBx(i)) + " at " + std::to_string(pc) + ": " +
+                        SwitchToString(table, pc) + "\n";
+                }
+                break;
+            case OpCode::AddInt:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d %d",
+                        GetA(i), GetB(i), GetsC(i));
+                break;
+            case OpCode::Self: {
+                written += snprintf(line + written, sizeof(line) - written, "%d %d", GetA(i), GetBx(i));
+                auto& site = function->callSites[GetBx(i)];
+                comment = ConstantToString(function, site.name);
+                if (site.interface >= 0)
+                    comment += " slot " + std::to_string(site.slot);
+                break;
+            }
+            case OpCode::GetFieldK:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d %d",
+                        GetA(i), GetB(i), GetC(i));
+                comment = ConstantToString(function, GetC(i));
+                break;
+            case OpCode::SetFieldK:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d %d",
+                        GetA(i), GetB(i), GetC(i));
+                comment = ConstantToString(function, GetB(i));
+                break;
+            default:
+                written += snprintf(line + written, sizeof(line) - written, "%d %d %d",
+                        GetA(i), GetB(i), GetC(i));
+                break;
+        }
+        text += line;
+        if (!comment.empty())
+            text += "\t; " + comment;
+        text += "\n";
+    }
+    text += tables;
+    for (auto& handler : function->handlers) {
+        text += "  catch " + std::to_string(handler.start) + " to " + std::to_string(handler.end) +
+            " at " + std::to_string(handler.target) + " in " + std::to_string(handler.reg);
+        if (handler.klass)
+            text += " class " + handler.klass->name;
+        else if (handler.interface >= 0)
+            text += " interface " + std::to_string(handler.interface);
+        else if (!handler.type.empty())
+            text += " type " + handler.type;
+        if (handler.rethrows)
+            text += " rethrows";
+        text += "\n";
+    }
+    return text;
+}
+
+std::string Disassemble(const Program& program) {
+    std::string text;
+    for (auto& interface : program.interfaces) {
+        text += "interface " + interface.name + " methods";
+        for (auto& method : interface.methods)
+            text += " " + method;
+        text += "\n";
+    }
+    for (auto klass : program.classes) {
+        text += "class " + klass->name + " fields";
+        for (auto& field : klass->fieldNames)
+            text += " " + field;
+        text += "\n";
+        for (size_t n = 0; n < klass->itables.size(); n++) {
+            if (klass->itables[n].empty())
+                continue;
+            text += "  itable " + program.interfaces[n].name;
+            for (auto method : klass->itables[n])
+                text += " " + method->name;
+            text += "\n";
+        }
+    }
+    if (program.init)
+        text += Disassemble(program.init);
+    for (auto function : program.functions)
+        text += Disassemble(function);
+    return text;
+}
+
+} // namespace zl
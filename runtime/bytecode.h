@@ -0,0 +1,169 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "heap.h"
+#include "object.h"
+#include "value.h"
+
+namespace zl {
+
+// The bytecode is register based, an instruction is 32 bits with the opcode
+// in the low 8 bits and its operands in one of the formats:
+//
+//   ABC:  A (8 bits) B (8 bits) C (8 bits)
+//   ABx:  A (8 bits) Bx (16 bits unsigned), sBx is Bx biased by kBiasBx
+//   sJ:   24 bits jump offset biased by kBiasJ
+//
+// R[x] is register x of the frame, K[x] is constant x of the function and
+// G[x] is global x of the program. Jump offsets are relative to the next
+// instruction. The Test* instructions skip the next instruction, which is
+// always a Jmp, if the comparison is not A.
+#define ZL_OPCODES(X)                                                         \
+    X(Move)       /* ABC  R[A] = R[B]                                    */ \
+    X(LoadK)      /* ABx  R[A] = K[Bx]                                   */ \
+    X(LoadInt)    /* ABx  R[A] = sBx                                     */ \
+    X(LoadNil)    /* ABC  R[A] = nil                                     */ \
+    X(LoadBool)   /* ABC  R[A] = B, skip the next instruction if C       */ \
+    X(GetGlobal)  /* ABx  R[A] = G[Bx]                                   */ \
+    X(SetGlobal)  /* ABx  G[Bx] = R[A]                                   */ \
+    X(Add)        /* ABC  R[A] = R[B] + R[C]                             */ \
+    X(Sub)                                                                  \
+    X(Mul)                                                                  \
+    X(Div)                                                                  \
+    X(Mod)                                                                  \
+    X(BitAnd)                                                               \
+    X(BitOr)                                                                \
+    X(BitXor)                                                               \
+    X(Shl)                                                                  \
+    X(Shr)                                                                  \
+    X(AddInt)     /* ABC  R[A] = R[B] + sC                               */ \
+    X(Neg)        /* ABC  R[A] = -R[B]                                   */ \
+    X(Not)        /* ABC  R[A] = !R[B]                                   */ \
+    X(ToInt)      /* ABC  R[A] = R[B] truncated to an int if a number    */ \
+    X(ToDouble)   /* ABC  R[A] = R[B] as a double if a number            */ \
+    X(Eq)         /* ABC  R[A] = R[B] == R[C]                            */ \
+    X(Lt)         /* ABC  R[A] = R[B] < R[C]                             */ \
+    X(Le)         /* ABC  R[A] = R[B] <= R[C]                            */ \
+    X(TestEq)     /* ABC  if (R[B] == R[C]) != A then pc++               */ \
+    X(TestLt)     /* ABC  if (R[B] < R[C]) != A then pc++                */ \
+    X(TestLe)     /* ABC  if (R[B] <= R[C]) != A then pc++               */ \
+    X(Test)       /* ABC  if truthy(R[A]) != C then pc++                 */ \
+    X(Jmp)        /* sJ   pc += sJ                                       */ \
+    X(Switch)     /* ABx  pc += target of R[A] in the switch table Bx    */ \
+    X(Call)       /* ABC  R[A..A+C-1] = R[A](R[A+1..A+B])                */ \
+    X(Return)     /* ABC  return R[A..A+B-1]                             */ \
+    X(GetField)   /* ABC  R[A] = R[B].fields[C]                          */ \
+    X(SetField)   /* ABC  R[A].fields[B] = R[C]                          */ \
+    X(GetFieldK)  /* ABC  R[A] = R[B].K[C]                               */ \
+    X(SetFieldK)  /* ABC  R[A].K[B] = R[C]                               */ \
+    X(Self)       /* ABx  R[A] = method of R[A+1] by call site Bx        */ \
+    X(New)        /* ABx  R[A] = new instance of class K[Bx]             */ \
+    X(NewArray)   /* ABC  R[A] = [R[B], ... R[B+C-1]]                    */ \
+    X(NewMap)     /* ABC  R[A] = {R[B]: R[B+1], ...} of C entries         */ \
+    X(GetIndex)   /* ABC  R[A] = R[B][R[C]]                              */ \
+    X(OrZero)     /* ABx  R[A] = K[Bx] if R[A] is nil, the zero value    */ \
+                  /*      read for a missing key of a map                */ \
+    X(SetIndex)   /* ABC  R[A][R[B]] = R[C]                              */ \
+    X(ForPrep)    /* ABC  check R[A] is iterable, R[A+1] = 0             */ \
+    X(ForNext)    /* ABx  R[A+2], R[A+3] = next key and value of R[A]    */ \
+                  /*      at position R[A+1], pc += sBx at the end       */ \
+    X(ForNext1)   /* ABx  as ForNext, R[A+2] = next element of array     */ \
+                  /*      or key of map                                  */ \
+    X(Assert)     /* ABC  fail if R[A] is not truthy                     */ \
+    X(DeferPush)  /* ABC  push R[B..B+C-1] on the defer stack R[A],      */ \
+                  /*      which is created if nil                        */ \
+    X(DeferPop)   /* ABC  R[A..] = values popped from the defer stack    */ \
+                  /*      R[B], at most C, skip the next instruction     */ \
+                  /*      unless it is empty                             */ \
+    X(Throw)      /* ABC  throw R[A] to the handler found in the         */ \
+                  /*      exception tables of the frames, C is set when  */ \
+                  /*      a handler throws again what it caught, the     */ \
+                  /*      site of its first throw in R[A+1] and R[A+2]   */
+
+enum class OpCode : uint8_t {
+#define ZL_OPCODE_ENUM(name) name,
+    ZL_OPCODES(ZL_OPCODE_ENUM)
+#undef ZL_OPCODE_ENUM
+};
+
+const int kNumOpCodes = 0
+#define ZL_OPCODE_COUNT(name) + 1
+    ZL_OPCODES(ZL_OPCODE_COUNT)
+#undef ZL_OPCODE_COUNT
+    ;
+
+const int kMaxRegisters = 256;
+const int kBiasBx = 0x7fff;
+const int kMaxBx = 0xffff;
+const int kBiasJ = 0x7fffff;
+const int kMaxJ = 0xffffff;
+
+// Return the name of the opcode, such as "Move"
+const char* OpCodeName(OpCode op);
+
+inline Instruction EncodeABC(OpCode op, int a, int b, int c) {
+    return static_cast<uint32_t>(op) | static_cast<uint32_t>(a) << 8 |
+        static_cast<uint32_t>(b) << 16 | static_cast<uint32_t>(c) << 24;
+}
+inline Instruction EncodeABx(OpCode op, int a, int bx) {
+    return static_cast<uint32_t>(op) | static_cast<uint32_t>(a) << 8 |
+        static_cast<uint32_t>(bx) << 16;
+}
+inline Instruction EncodeAsBx(OpCode op, int a, int sbx) {
+    return EncodeABx(op, a, sbx + kBiasBx);
+}
+inline Instruction EncodesJ(OpCode op, int sj) {
+    return static_cast<uint32_t>(op) | static_cast<uint32_t>(sj + kBiasJ) << 8;
+}
+
+inline OpCode GetOp(Instruction i) { return static_cast<OpCode>(i & 0xff); }
+inline int GetA(Instruction i) { return (i >> 8) & 0xff; }
+inline int GetB(Instruction i) { return (i >> 16) & 0xff; }
+inline int GetC(Instruction i) { return i >> 24; }
+inline int GetBx(Instruction i) { return i >> 16; }
+inline int GetsBx(Instruction i) { return static_cast<int>(i >> 16) - kBiasBx; }
+inline int GetsJ(Instruction i) { return static_cast<int>(i >> 8) - kBiasJ; }
+// The signed immediate of AddInt
+inline int GetsC(Instruction i) { return static_cast<int>(i >> 24) - 128; }
+
+// Build the stack map of the function once its code is complete, the
+// registers which may hold a value read later at each instruction which may
+// collect garbage: Add, AddInt, Call, New, NewArray, NewMap and DeferPush,
+// and at the targets of exception handlers, where a runtime error allocates
+// its message. Other registers may hold stale values which are not scanned.
+void BuildStackMap(FunctionObject* function);
+// Return the live registers of the stack map at the instruction, nullptr if
+// it is not a safe point
+const uint64_t* LiveRegistersAt(const FunctionObject* function, size_t offset);
+
+// ProgramInterface is an interface of the program, the index of a method
+// in methods is its slot in the itables of the classes
+struct ProgramInterface {
+    std::string name;
+    std::vector<std::string> methods;
+};
+
+// Program is the bytecode of all input files with the heap holding its
+// functions, classes and constants
+struct Program {
+    Heap heap;
+    // Functions and methods in declaration order, methods are named
+    // Class.Method
+    std::vector<FunctionObject*> functions;
+    std::vector<ClassObject*> classes;
+    std::vector<ProgramInterface> interfaces;
+    std::vector<std::string> globalNames;
+    std::vector<Value> globals;
+    // Initializer of the globals, run before main, nullptr if there is none
+    FunctionObject* init = nullptr;
+    // main function, or static main method of a class, nullptr if absent
+    FunctionObject* main = nullptr;
+};
+
+// Return the listing of the function, one instruction per line
+std::string Disassemble(const FunctionObject* function);
+// Return the listing of all functions and methods of the program
+std::string Disassemble(const Program& program);
+
+} // namespace zl
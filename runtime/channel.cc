@@ -0,0 +1,214 @@
+#include <algorithm>
+#include "channel.h"
+
+namespace zl {
+
+namespace {
+
+// Random order of the cases of a select, so that a ready channel does not
+// starve the others
+thread_local uint32_t selectRandom = 2463534242u;
+
+uint32_t NextRandom() {
+    selectRandom ^= selectRandom << 13;
+    selectRandom ^= selectRandom >> 17;
+    selectRandom ^= selectRandom << 5;
+    return selectRandom;
+}
+
+} // namespace
+
+void ChannelBase::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_.load(std::memory_order_relaxed))
+        throw RuntimeError("close of closed channel");
+    closed_.store(true, std::memory_order_release);
+    if (capacity_ > 0)
+        CloseBuffer();
+    // The waiters try again and see the channel closed
+    for (WaitQueue* queue : {&senders_, &receivers_}) {
+        for (auto& entry : queue->entries) {
+            if (Claim(entry))
+                Release(entry.waiter, false);
+        }
+        queue->entries.clear();
+        queue->size.store(0, std::memory_order_relaxed);
+    }
+}
+
+ChannelStatus ChannelBase::TrySendValue(void* value) {
+    if (capacity_ > 0) {
+        ChannelStatus status = Push(value);
+        if (status == ChannelStatus::Ok)
+            Wake(receivers_);
+        return status;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_.load(std::memory_order_relaxed))
+        return ChannelStatus::Closed;
+    while (!receivers_.entries.empty()) {
+        Entry entry = receivers_.entries.front();
+        receivers_.entries.pop_front();
+        receivers_.size.store(receivers_.entries.size(), std::memory_order_relaxed);
+        if (Claim(entry)) {
+            MoveValue(entry.value, value);
+            Release(entry.waiter, true);
+            return ChannelStatus::Ok;
+        }
+    }
+    return ChannelStatus::WouldBlock;
+}
+
+ChannelStatus ChannelBase::TryReceiveValue(void* value) {
+    if (capacity_ > 0) {
+        ChannelStatus status = Pop(value);
+        if (status == ChannelStatus::Ok)
+            Wake(senders_);
+        else if (status == ChannelStatus::Closed)
+            ResetValue(value);
+        return status;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!senders_.entries.empty()) {
+        Entry entry = senders_.entries.front();
+        senders_.entries.pop_front();
+        senders_.size.store(senders_.entries.size(), std::memory_order_relaxed);
+        if (Claim(entry)) {
+            MoveValue(value, entry.value);
+            Release(entry.waiter, true);
+            return ChannelStatus::Ok;
+        }
+    }
+    if (closed_.load(std::memory_order_relaxed)) {
+        ResetValue(value);
+        return ChannelStatus::Closed;
+    }
+    return ChannelStatus::WouldBlock;
+}
+
+void ChannelBase::WakeSlow(WaitQueue& queue) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!queue.entries.empty()) {
+        Entry entry = queue.entries.front();
+        queue.entries.pop_front();
+        queue.size.store(queue.entries.size(), std::memory_order_relaxed);
+        if (Claim(entry)) {
+            Release(entry.waiter, false);
+            return;
+        }
+    }
+}
+
+bool ChannelBase::Enqueue(ChannelWaiter& waiter, const Case& which, int index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    WaitQueue& queue = which.send ? senders_ : receivers_;
+    queue.entries.push_back(Entry{&waiter, index, which.value});
+    queue.size.store(queue.entries.size(), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (closed_.load(std::memory_order_relaxed))
+        return true;
+    if (capacity_ > 0)
+        return which.send ? !BufferFull() : !BufferEmpty();
+    return HasPeer(which.send ? receivers_ : senders_, waiter);
+}
+
+void ChannelBase::Dequeue(ChannelWaiter& waiter) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Remove(senders_, waiter);
+    Remove(receivers_, waiter);
+}
+
+bool ChannelBase::HasPeer(const WaitQueue& queue, const ChannelWaiter& waiter) {
+    for (auto& entry : queue.entries) {
+        if (entry.waiter != &waiter && entry.waiter->selected.load() == ChannelWaiter::kWaiting)
+            return true;
+    }
+    return false;
+}
+
+void ChannelBase::Remove(WaitQueue& queue, const ChannelWaiter& waiter) {
+    auto end = std::remove_if(queue.entries.begin(), queue.entries.end(),
+        [&waiter](const Entry& entry) { return entry.waiter == &waiter; });
+    queue.entries.erase(end, queue.entries.end());
+    queue.size.store(queue.entries.size(), std::memory_order_relaxed);
+}
+
+bool ChannelBase::Claim(const Entry& entry) {
+    int expected = ChannelWaiter::kWaiting;
+    return entry.waiter->selected.compare_exchange_strong(expected, entry.index);
+}
+
+void ChannelBase::Release(ChannelWaiter* waiter, bool handedOff) {
+    Coroutine* coroutine = waiter->coroutine;
+    waiter->handedOff = handedOff;
+    waiter->done.store(true, std::memory_order_release);
+    if (coroutine)
+        Scheduler::Unpark(coroutine);
+}
+
+int ChannelBase::Select(Case* cases, size_t count, bool block) {
+    if (count == 0) {
+        // Go blocks forever on an empty select
+        while (block)
+            Scheduler::Park();
+        return -1;
+    }
+    size_t start = NextRandom() % count;
+    // The case which woke the waiter is tried first, so that the value
+    // which woke it is not left to others which may be parked
+    int first = -1;
+    while (true) {
+        for (size_t k = 0; k <= count; k++) {
+            int index;
+            if (k == 0) {
+                if (first < 0)
+                    continue;
+                index = first;
+            } else {
+                index = static_cast<int>((start + k) % count);
+            }
+            Case& which = cases[index];
+            ChannelStatus status = which.send ? which.channel->TrySendValue(which.value)
+                : which.channel->TryReceiveValue(which.value);
+            if (status == ChannelStatus::Ok) {
+                which.ok = true;
+                return index;
+            }
+            if (status == ChannelStatus::Closed) {
+                if (which.send)
+                    throw RuntimeError("send on closed channel");
+                which.ok = false;
+                return index;
+            }
+        }
+        if (!block)
+            return -1;
+
+        ChannelWaiter waiter(Scheduler::Current());
+        size_t queued = 0;
+        bool ready = false;
+        while (queued < count && !ready) {
+            ready = cases[queued].channel->Enqueue(waiter, cases[queued], static_cast<int>(queued));
+            queued++;
+        }
+        int expected = ChannelWaiter::kWaiting;
+        if (!ready || !waiter.selected.compare_exchange_strong(expected, ChannelWaiter::kAborted)) {
+            // Claimed by a channel, at once if it claimed it while the
+            // waiter was giving up
+            while (!waiter.done.load(std::memory_order_acquire))
+                Scheduler::Park();
+        }
+        // Dequeue takes the lock of each channel, so the one which released
+        // the waiter has unparked it
+        for (size_t i = 0; i < queued; i++)
+            cases[i].channel->Dequeue(waiter);
+        int selected = waiter.selected.load();
+        if (selected >= 0 && waiter.handedOff) {
+            cases[selected].ok = true;
+            return selected;
+        }
+        first = selected;
+    }
+}
+
+} // namespace zl
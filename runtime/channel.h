@@ -0,0 +1,273 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "object.h"
+#include "scheduler.h"
+
+namespace zl {
+
+enum class ChannelStatus {
+    Ok,
+    // The buffer is full or empty, or no peer waits on an unbuffered channel
+    WouldBlock,
+    Closed,
+};
+
+// ChannelWaiter is a coroutine blocked in a send, a receive or a select, it
+// is queued on each channel it waits for. The first channel which claims it
+// by setting selected wakes it.
+struct ChannelWaiter {
+    static const int kWaiting = -1;
+    // The waiter gave up waiting, it found a case ready while queuing
+    static const int kAborted = -2;
+
+    explicit ChannelWaiter(Coroutine* coroutine): coroutine(coroutine) {}
+
+    // nullptr for a thread which is not a coroutine, it polls
+    Coroutine* coroutine;
+    // The case which claimed the waiter, or kWaiting or kAborted
+    std::atomic<int> selected{kWaiting};
+    // Set when the waiter may go on
+    std::atomic<bool> done{false};
+    // The peer of an unbuffered channel took or gave the value of the case,
+    // otherwise the waiter tries the case again
+    bool handedOff = false;
+};
+
+// ChannelBase is the part of Channel which does not depend on the type of
+// the values: waiting, closing and select. The fast paths never lock:
+//
+// - A buffered channel is a bounded ring of slots with sequence numbers
+//   (Vyukov's MPMC queue), a send or a receive claims a slot with one
+//   compare and swap.
+// - An unbuffered channel hands the value off directly between the sender
+//   and the receiver, one of them waits queued on the channel.
+//
+// A coroutine which can not go on queues itself on the channel under the
+// lock of that channel only and parks. A send wakes one queued receiver and
+// a receive one queued sender, a select queues on all its channels and is
+// woken by the first one. There is no lock held across channels.
+class ChannelBase {
+public:
+    // Case is one operation of a select
+    struct Case {
+        ChannelBase* channel;
+        bool send;
+        // The value to send, moved from only if the case is taken, or where
+        // the received value is stored
+        void* value;
+        // Set on return for a receive: false if the channel was closed and
+        // drained, the value is then reset
+        bool ok = false;
+    };
+
+    virtual ~ChannelBase() {}
+
+    // Zero for an unbuffered channel
+    size_t Capacity() const { return capacity_; }
+    bool IsClosed() const { return closed_.load(std::memory_order_acquire); }
+    // Close the channel: sends throw RuntimeError, receives get the buffered
+    // values and then fail. Waiters are woken. Closing twice throws.
+    void Close();
+
+    // Take one of the cases which can go on, chosen at random among them.
+    // If none can, block until one can, or return -1 at once if not block.
+    // Return the index of the case taken. A send on a closed channel throws
+    // RuntimeError.
+    static int Select(Case* cases, size_t count, bool block);
+
+protected:
+    explicit ChannelBase(size_t capacity): capacity_(capacity), closed_(false) {}
+
+    // The buffer of a buffered channel, they do not block
+    virtual ChannelStatus Push(void* value) = 0;
+    virtual ChannelStatus Pop(void* value) = 0;
+    virtual bool BufferFull() const = 0;
+    virtual bool BufferEmpty() const = 0;
+    virtual void CloseBuffer() = 0;
+    // Move a value between cases, for an unbuffered channel
+    virtual void MoveValue(void* to, void* from) = 0;
+    virtual void ResetValue(void* value) = 0;
+
+    ChannelStatus TrySendValue(void* value);
+    ChannelStatus TryReceiveValue(void* value);
+
+    struct Entry {
+        ChannelWaiter* waiter;
+        int index;
+        void* value;
+    };
+    struct WaitQueue {
+        std::deque<Entry> entries;
+        // Size of entries, read without the lock by Wake
+        std::atomic<size_t> size{0};
+    };
+    // Wake the first waiter of the queue still waiting, it tries again
+    void Wake(WaitQueue& queue) {
+        // Pairs with the fence of Enqueue: either the waiter sees the value
+        // sent or received, or this sees the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (queue.size.load(std::memory_order_relaxed) != 0)
+            WakeSlow(queue);
+    }
+    WaitQueue senders_;
+    WaitQueue receivers_;
+
+private:
+    ChannelBase(const ChannelBase&) = delete;
+    ChannelBase& operator = (const ChannelBase&) = delete;
+
+    void WakeSlow(WaitQueue& queue);
+    // Queue the case of the waiter, return true if it can go on now
+    bool Enqueue(ChannelWaiter& waiter, const Case& which, int index);
+    void Dequeue(ChannelWaiter& waiter);
+    // Return true if a waiter other than the given one waits in the queue
+    static bool HasPeer(const WaitQueue& queue, const ChannelWaiter& waiter);
+    static void Remove(WaitQueue& queue, const ChannelWaiter& waiter);
+    // Claim the waiter of the entry for its case, false if another case
+    // has or it gave up
+    static bool Claim(const Entry& entry);
+    // Let the claimed waiter go on, called with the lock of the channel so
+    // that it does not return before it is unparked
+    static void Release(ChannelWaiter* waiter, bool handedOff);
+
+protected:
+    const size_t capacity_;
+    std::atomic<bool> closed_;
+
+private:
+    // Guards the wait queues, and for an unbuffered channel the hand-off
+    std::mutex mutex_;
+};
+
+// Channel pass values of type T between coroutines, see ChannelBase. Values
+// are moved in and out.
+template <typename T>
+class Channel : public ChannelBase {
+public:
+    explicit Channel(size_t capacity = 0)
+        : ChannelBase(capacity), slots_(capacity ? new Slot[capacity] : nullptr), head_(0), tail_(0) {
+        for (size_t i = 0; i < capacity; i++)
+            slots_[i].sequence.store(2 * i, std::memory_order_relaxed);
+    }
+
+    // Send the value, blocking while the buffer is full, or until a
+    // receiver takes it from an unbuffered channel. Throw RuntimeError if the
+    // channel is closed.
+    void Send(T value) {
+        if (capacity_ > 0) {
+            ChannelStatus status = PushValue(value);
+            if (status == ChannelStatus::Ok) {
+                Wake(receivers_);
+                return;
+            }
+            if (status == ChannelStatus::Closed)
+                throw RuntimeError("send on closed channel");
+        }
+        Case which{this, true, &value};
+        Select(&which, 1, true);
+    }
+    // Receive a value, blocking while there is none. Return false if the
+    // channel is closed and drained, the value is then T().
+    bool Receive(T& value) {
+        if (capacity_ > 0 && PopValue(value) == ChannelStatus::Ok) {
+            Wake(senders_);
+            return true;
+        }
+        Case which{this, false, &value};
+        Select(&which, 1, true);
+        return which.ok;
+    }
+    // Send or receive without blocking
+    ChannelStatus TrySend(T value) { return TrySendValue(&value); }
+    ChannelStatus TryReceive(T& value) { return TryReceiveValue(&value); }
+
+private:
+    static const uint64_t kClosedBit = uint64_t(1) << 63;
+
+    struct Slot {
+        // Twice the position which may write the slot, or that plus one
+        // once it may be read. Doubling tells a written slot from one free
+        // for the next lap, which is the next position with one slot.
+        std::atomic<uint64_t> sequence;
+        T value;
+    };
+
+    ChannelStatus PushValue(T& value) {
+        uint64_t position = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            if (position & kClosedBit)
+                return ChannelStatus::Closed;
+            Slot& slot = slots_[position % capacity_];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            int64_t difference = static_cast<int64_t>(sequence - 2 * position);
+            if (difference == 0) {
+                if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(2 * position + 1, std::memory_order_release);
+                    return ChannelStatus::Ok;
+                }
+            } else if (difference < 0) {
+                // The slot still holds the value of the previous lap
+                return ChannelStatus::WouldBlock;
+            } else {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    ChannelStatus PopValue(T& value) {
+        uint64_t position = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots_[position % capacity_];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            int64_t difference = static_cast<int64_t>(sequence - (2 * position + 1));
+            if (difference == 0) {
+                if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.sequence.store(2 * (position + capacity_), std::memory_order_release);
+                    return ChannelStatus::Ok;
+                }
+            } else if (difference < 0) {
+                // Empty, or a sender claimed the slot and is writing it
+                uint64_t tail = tail_.load(std::memory_order_acquire);
+                if ((tail & kClosedBit) && (tail & ~kClosedBit) == position)
+                    return ChannelStatus::Closed;
+                return ChannelStatus::WouldBlock;
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    ChannelStatus Push(void* value) override { return PushValue(*static_cast<T*>(value)); }
+    ChannelStatus Pop(void* value) override { return PopValue(*static_cast<T*>(value)); }
+    bool BufferFull() const override {
+        uint64_t tail = tail_.load(std::memory_order_acquire) & ~kClosedBit;
+        return tail - head_.load(std::memory_order_acquire) >= capacity_;
+    }
+    bool BufferEmpty() const override {
+        uint64_t tail = tail_.load(std::memory_order_acquire) & ~kClosedBit;
+        return tail == head_.load(std::memory_order_acquire);
+    }
+    // Sends fail once the closed bit is set, receives fail once they reach
+    // the tail
+    void CloseBuffer() override { tail_.fetch_or(kClosedBit); }
+    void MoveValue(void* to, void* from) override {
+        *static_cast<T*>(to) = std::move(*static_cast<T*>(from));
+    }
+    void ResetValue(void* value) override { *static_cast<T*>(value) = T(); }
+
+private:
+    std::unique_ptr<Slot[]> slots_;
+    // Positions of the next receive and send, on separate cache lines
+    alignas(64) std::atomic<uint64_t> head_;
+    alignas(64) std::atomic<uint64_t> tail_;
+};
+
+} // namespace zl
@@ -0,0 +1,305 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace zl {
+
+// FlatMapTraits give the hash and the equality of keys of FlatMap, and if
+// the slots of the table keep a copy of the key. Primitive keys are kept in
+// the slots so that a lookup does not touch the entries, other keys are
+// compared in the entries and the slots keep their hash instead.
+template <typename K> struct FlatMapTraits;
+
+inline uint64_t MixHash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    return x ^ (x >> 33);
+}
+
+template <> struct FlatMapTraits<int32_t> {
+    static const bool kInlineKey = true;
+    static uint64_t Hash(int32_t key) { return MixHash(static_cast<uint32_t>(key)); }
+    static bool Equal(int32_t a, int32_t b) { return a == b; }
+};
+
+template <> struct FlatMapTraits<int64_t> {
+    static const bool kInlineKey = true;
+    static uint64_t Hash(int64_t key) { return MixHash(static_cast<uint64_t>(key)); }
+    static bool Equal(int64_t a, int64_t b) { return a == b; }
+};
+
+template <> struct FlatMapTraits<std::string> {
+    static const bool kInlineKey = false;
+    static uint64_t Hash(const std::string& key) { return MixHash(std::hash<std::string>()(key)); }
+    static bool Equal(const std::string& a, const std::string& b) { return a == b; }
+};
+
+namespace flat_map {
+
+// A control byte is kEmpty or the low 7 bits of the hash of a full slot
+const int8_t kEmpty = -128;
+const size_t kGroupSize = 16;
+
+// Group is the control bytes of 16 consecutive slots, they are compared
+// with one instruction where SSE2 is available
+class Group {
+public:
+#if defined(__SSE2__)
+    explicit Group(const int8_t* ctrl)
+        : ctrl_(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {}
+    // Bit n is set if slot n has the control byte
+    uint32_t Match(int8_t byte) const {
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(byte), ctrl_)));
+    }
+    uint32_t MatchEmpty() const {
+        // Only empty control bytes have the sign bit
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl_));
+    }
+private:
+    __m128i ctrl_;
+#else
+    explicit Group(const int8_t* ctrl) { memcpy(ctrl_, ctrl, kGroupSize); }
+    uint32_t Match(int8_t byte) const {
+        uint32_t bits = 0;
+        for (size_t n = 0; n < kGroupSize; n++)
+            bits |= static_cast<uint32_t>(ctrl_[n] == byte) << n;
+        return bits;
+    }
+    uint32_t MatchEmpty() const { return Match(kEmpty); }
+private:
+    int8_t ctrl_[kGroupSize];
+#endif
+};
+
+inline int LowestBit(uint32_t bits) {
+    return __builtin_ctz(bits);
+}
+
+template <typename K, bool inlineKey> struct Slot;
+
+// A slot of a primitive key keeps the key and the position of its entry
+template <typename K> struct Slot<K, true> {
+    K key;
+    uint32_t entry;
+};
+
+// A slot of another key keeps the high bits of its hash which give its home
+// slot, the slots are moved without hashing the keys again
+template <typename K> struct Slot<K, false> {
+    uint32_t hash;
+    uint32_t entry;
+};
+
+} // namespace flat_map
+
+// FlatMap is a hash table of open addressing in the SwissTable fashion. A
+// control byte for each slot holds 7 bits of the hash of its key, 16 of
+// them are probed at once and the keys are only compared where the bits
+// match. Keys are placed in the first empty slot after their home slot, a
+// lookup stops at the first group with an empty slot.
+//
+// The entries are kept in an array apart in insertion order, they are
+// iterated in place by position. Erase moves the last entry in place of the
+// erased one, and moves the following slots back over the erased slot, so
+// no tombstone is left behind and lookups never slow down with erasures.
+template <typename K, typename V, typename Traits = FlatMapTraits<K>>
+class FlatMap {
+public:
+    typedef std::pair<K, V> Entry;
+
+    FlatMap(): mask_(0) {}
+    FlatMap(FlatMap&& other) = default;
+    FlatMap& operator = (FlatMap&& other) = default;
+
+    size_t Size() const { return entries_.size(); }
+    // Entries in insertion order, unless some were erased
+    std::vector<Entry>& Entries() { return entries_; }
+    const std::vector<Entry>& Entries() const { return entries_; }
+
+    // Return the value of the key, nullptr if it is absent
+    V* Find(const K& key) {
+        size_t slot = FindSlot(key, Traits::Hash(key));
+        return slot == kNotFound ? nullptr : &entries_[slots_[slot].entry].second;
+    }
+    const V* Find(const K& key) const { return const_cast<FlatMap*>(this)->Find(key); }
+
+    // Set the value of the key, return true if it was absent
+    bool Insert(const K& key, const V& value) {
+        uint64_t hash = Traits::Hash(key);
+        size_t slot = FindSlot(key, hash);
+        if (slot != kNotFound) {
+            entries_[slots_[slot].entry].second = value;
+            return false;
+        }
+        if ((entries_.size() + 1) * 8 > Capacity() * 7)
+            Grow();
+        entries_.emplace_back(key, value);
+        Place(hash, key, static_cast<uint32_t>(entries_.size() - 1));
+        return true;
+    }
+
+    // Return the value of the key, it is inserted with a default value if
+    // it is absent
+    V& operator [] (const K& key) {
+        V* value = Find(key);
+        if (value)
+            return *value;
+        Insert(key, V());
+        return entries_.back().second;
+    }
+
+    // Remove the key, return false if it is absent
+    bool Erase(const K& key) {
+        size_t slot = FindSlot(key, Traits::Hash(key));
+        if (slot == kNotFound)
+            return false;
+        uint32_t entry = slots_[slot].entry;
+        RemoveSlot(slot);
+        uint32_t last = static_cast<uint32_t>(entries_.size() - 1);
+        if (entry != last) {
+            // The slot of the last entry follows it to its new position
+            const K& moved = entries_[last].first;
+            slots_[FindSlot(moved, Traits::Hash(moved))].entry = entry;
+            entries_[entry] = std::move(entries_[last]);
+        }
+        entries_.pop_back();
+        return true;
+    }
+
+    void Clear() {
+        entries_.clear();
+        ctrl_.reset();
+        slots_.reset();
+        mask_ = 0;
+    }
+
+    void Reserve(size_t size) {
+        entries_.reserve(size);
+        while (size * 8 > Capacity() * 7)
+            Grow();
+    }
+
+private:
+    FlatMap(const FlatMap&) = delete;
+    FlatMap& operator = (const FlatMap&) = delete;
+
+    typedef flat_map::Slot<K, Traits::kInlineKey> Slot;
+    static const size_t kNotFound = ~static_cast<size_t>(0);
+
+    size_t Capacity() const { return slots_ ? mask_ + 1 : 0; }
+    static int8_t ControlOf(uint64_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+    size_t HomeOf(uint64_t hash) const { return static_cast<size_t>(hash >> 32) & mask_; }
+
+    const K& KeyOf(const Slot& slot) const {
+        if constexpr (Traits::kInlineKey)
+            return slot.key;
+        else
+            return entries_[slot.entry].first;
+    }
+    // Return the hash of the key of the slot, or the bits of it giving its
+    // home slot and its control byte
+    uint64_t HashOf(const Slot& slot, int8_t control) const {
+        if constexpr (Traits::kInlineKey)
+            return Traits::Hash(slot.key);
+        else
+            return static_cast<uint64_t>(slot.hash) << 32 | static_cast<uint8_t>(control);
+    }
+
+    // The first control bytes are repeated after the last ones, so a group
+    // starting near the end wraps around
+    void SetControl(size_t slot, int8_t byte) {
+        ctrl_[slot] = byte;
+        if (slot < flat_map::kGroupSize - 1)
+            ctrl_[Capacity() + slot] = byte;
+    }
+
+    size_t FindSlot(const K& key, uint64_t hash) const {
+        if (!slots_)
+            return kNotFound;
+        int8_t control = ControlOf(hash);
+        size_t position = HomeOf(hash);
+        for (;;) {
+            flat_map::Group group(ctrl_.get() + position);
+            for (uint32_t bits = group.Match(control); bits; bits &= bits - 1) {
+                size_t slot = (position + flat_map::LowestBit(bits)) & mask_;
+                if (Traits::Equal(KeyOf(slots_[slot]), key))
+                    return slot;
+            }
+            if (group.MatchEmpty())
+                return kNotFound;
+            position = (position + flat_map::kGroupSize) & mask_;
+        }
+    }
+
+    // Place the key of the entry in the first empty slot from its home
+    void Place(uint64_t hash, const K& key, uint32_t entry) {
+        size_t position = HomeOf(hash);
+        for (;;) {
+            uint32_t empty = flat_map::Group(ctrl_.get() + position).MatchEmpty();
+            if (empty) {
+                size_t slot = (position + flat_map::LowestBit(empty)) & mask_;
+                SetControl(slot, ControlOf(hash));
+                if constexpr (Traits::kInlineKey)
+                    slots_[slot].key = key;
+                else
+                    slots_[slot].hash = static_cast<uint32_t>(hash >> 32);
+                slots_[slot].entry = entry;
+                return;
+            }
+            position = (position + flat_map::kGroupSize) & mask_;
+        }
+    }
+
+    // Empty the slot and move back the slots after it which can be reached
+    // from their home through it, until an empty slot
+    void RemoveSlot(size_t slot) {
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & mask_; ctrl_[next] != flat_map::kEmpty; next = (next + 1) & mask_) {
+            size_t home = HomeOf(HashOf(slots_[next], ctrl_[next]));
+            // The slot may move back if its home is not between the hole
+            // and itself
+            if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+                SetControl(hole, ctrl_[next]);
+                slots_[hole] = slots_[next];
+                hole = next;
+            }
+        }
+        SetControl(hole, flat_map::kEmpty);
+    }
+
+    void Grow() {
+        size_t capacity = Capacity() ? Capacity() * 2 : flat_map::kGroupSize;
+        std::unique_ptr<Slot[]> old(std::move(slots_));
+        std::unique_ptr<int8_t[]> oldCtrl(std::move(ctrl_));
+        size_t oldCapacity = old ? mask_ + 1 : 0;
+        ctrl_.reset(new int8_t[capacity + flat_map::kGroupSize - 1]);
+        memset(ctrl_.get(), flat_map::kEmpty, capacity + flat_map::kGroupSize - 1);
+        slots_.reset(new Slot[capacity]);
+        mask_ = capacity - 1;
+        for (size_t slot = 0; slot < oldCapacity; slot++) {
+            if (oldCtrl[slot] != flat_map::kEmpty)
+                Place(HashOf(old[slot], oldCtrl[slot]), KeyOf(old[slot]), old[slot].entry);
+        }
+    }
+
+private:
+    std::vector<Entry> entries_;
+    // Capacity control bytes and the first 15 repeated
+    std::unique_ptr<int8_t[]> ctrl_;
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_;
+};
+
+} // namespace zl
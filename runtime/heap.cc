@@ -0,0 +1,661 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "heap.h"
+
+namespace zl {
+
+namespace {
+
+const size_t kRegionSize = 256 << 10;
+const size_t kLineSize = 256;
+const size_t kLines = kRegionSize / kLineSize;
+// Objects start on granules, a line has 32 of them
+const size_t kGranule = 8;
+const size_t kGranulesPerLine = kLineSize / kGranule;
+// Larger objects are allocated apart from the regions
+const size_t kMaxRegionObject = 8 << 10;
+// Concatenations up to this size are copied, longer ones are ropes
+const size_t kMaxCopiedConcatenation = 128;
+// Marking smaller old generations does not pay for starting threads
+const uint64_t kParallelMarkBytes = 4 << 20;
+// Number of objects given to a marking thread at once
+const size_t kMarkBatch = 256;
+// Free regions kept for later collections, the others are released
+const size_t kKeptFreeRegions = 8;
+
+// The first lines of a region hold its tables, see Heap::Region
+const size_t kFirstLine = (kLines * (2 + sizeof(uint32_t)) + kLineSize - 1) / kLineSize;
+
+static_assert(kGranulesPerLine == 32, "the start bits of a line are a word");
+
+size_t Align(size_t size) {
+    return (size + kGranule - 1) & ~(kGranule - 1);
+}
+
+size_t ObjectSize(const Object* object) {
+    switch (object->kind) {
+        case ObjectKind::String:
+            return Align(sizeof(StringObject));
+        case ObjectKind::Array:
+            return Align(sizeof(ArrayObject));
+        case ObjectKind::Map:
+            return Align(sizeof(MapObject));
+        case ObjectKind::Instance:
+            return Align(sizeof(InstanceObject) +
+                static_cast<const InstanceObject*>(object)->fieldCount * sizeof(Value));
+        case ObjectKind::Class:
+            return Align(sizeof(ClassObject));
+        case ObjectKind::Function:
+            return Align(sizeof(FunctionObject));
+        case ObjectKind::Native:
+            return Align(sizeof(NativeObject));
+    }
+    return 0;
+}
+
+// Run the destructor of the object, its memory is not released
+void Destroy(Object* object) {
+    switch (object->kind) {
+        case ObjectKind::String:
+            static_cast<StringObject*>(object)->~StringObject();
+            break;
+        case ObjectKind::Array:
+            static_cast<ArrayObject*>(object)->~ArrayObject();
+            break;
+        case ObjectKind::Map:
+            static_cast<MapObject*>(object)->~MapObject();
+            break;
+        case ObjectKind::Instance:
+            // The fields are trivially destructible
+            static_cast<InstanceObject*>(object)->~InstanceObject();
+            break;
+        case ObjectKind::Class:
+            static_cast<ClassObject*>(object)->~ClassObject();
+            break;
+        case ObjectKind::Function:
+            static_cast<FunctionObject*>(object)->~FunctionObject();
+            break;
+        case ObjectKind::Native:
+            static_cast<NativeObject*>(object)->~NativeObject();
+            break;
+    }
+}
+
+// Move the young object to memory, only the kinds allocated in the nursery
+// are moved
+Object* Move(Object* object, void* memory) {
+    switch (object->kind) {
+        case ObjectKind::String:
+            return new (memory) StringObject(std::move(*static_cast<StringObject*>(object)));
+        case ObjectKind::Array:
+            return new (memory) ArrayObject(std::move(*static_cast<ArrayObject*>(object)));
+        case ObjectKind::Map:
+            return new (memory) MapObject(std::move(*static_cast<MapObject*>(object)));
+        case ObjectKind::Instance: {
+            auto instance = static_cast<InstanceObject*>(object);
+            auto copy = new (memory) InstanceObject(*instance);
+            memcpy(static_cast<void*>(copy->Fields()), instance->Fields(),
+                instance->fieldCount * sizeof(Value));
+            return copy;
+        }
+        default:
+            break;
+    }
+    abort();
+}
+
+// Call f with each value slot of the object
+template <typename F> void ForEachSlot(Object* object, F f) {
+    switch (object->kind) {
+        case ObjectKind::Array:
+            for (auto& value : static_cast<ArrayObject*>(object)->elements)
+                f(value);
+            break;
+        case ObjectKind::Map:
+            for (auto& entry : static_cast<MapObject*>(object)->Entries()) {
+                f(entry.first);
+                f(entry.second);
+            }
+            break;
+        case ObjectKind::Instance: {
+            auto instance = static_cast<InstanceObject*>(object);
+            Value* fields = instance->Fields();
+            for (uint32_t n = 0; n < instance->fieldCount; n++)
+                f(fields[n]);
+            break;
+        }
+        case ObjectKind::String: {
+            auto string = static_cast<StringObject*>(object);
+            if (string->form == StringObject::Rope) {
+                f(string->Sides()[0]);
+                f(string->Sides()[1]);
+            }
+            break;
+        }
+        default:
+            // The other kinds are permanent
+            break;
+    }
+}
+
+// Marker mark the objects reachable from marked roots on several threads.
+// Each thread traces from its own stack, it shares half of it when others
+// are idle and it is done when all threads are idle with nothing shared.
+class Marker {
+public:
+    explicit Marker(int threads): threads_(threads), idle_(0), pooled_(0), done_(false) {}
+
+    void Run(const std::vector<Object*>& roots) {
+        for (size_t n = 0; n < roots.size(); n += kMarkBatch)
+            pool_.emplace_back(roots.begin() + n, roots.begin() + std::min(n + kMarkBatch, roots.size()));
+        pooled_ = static_cast<int>(pool_.size());
+        std::vector<std::thread> workers;
+        for (int n = 1; n < threads_; n++)
+            workers.emplace_back(&Marker::Work, this);
+        Work();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+private:
+    Marker(const Marker&) = delete;
+    Marker& operator = (const Marker&) = delete;
+
+    void Work() {
+        std::vector<Object*> stack;
+        for (;;) {
+            if (stack.empty() && !Take(stack))
+                return;
+            Object* object = stack.back();
+            stack.pop_back();
+            ForEachSlot(object, [&stack](Value& value) {
+                if (!value.IsObject())
+                    return;
+                Object* child = value.AsObject();
+                if (child->space != Space::Permanent &&
+                        child->mark.exchange(1, std::memory_order_relaxed) == 0)
+                    stack.push_back(child);
+            });
+            if (stack.size() > 1 && idle_.load(std::memory_order_relaxed) > pooled_.load(std::memory_order_relaxed))
+                Share(stack);
+        }
+    }
+
+    // Wait for shared objects, return false when marking is done
+    bool Take(std::vector<Object*>& stack) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_++;
+        while (pool_.empty() && !done_) {
+            if (idle_ == threads_) {
+                done_ = true;
+                ready_.notify_all();
+                break;
+            }
+            ready_.wait(lock);
+        }
+        if (done_)
+            return false;
+        idle_--;
+        stack = std::move(pool_.back());
+        pool_.pop_back();
+        pooled_--;
+        return true;
+    }
+
+    void Share(std::vector<Object*>& stack) {
+        size_t half = stack.size() / 2;
+        std::lock_guard<std::mutex> lock(mutex_);
+        pool_.emplace_back(stack.begin(), stack.begin() + half);
+        stack.erase(stack.begin(), stack.begin() + half);
+        pooled_++;
+        ready_.notify_one();
+    }
+
+private:
+    const int threads_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::vector<std::vector<Object*>> pool_;
+    // Idle threads and shared stacks, read without the lock to decide if
+    // a busy thread shares
+    std::atomic<int> idle_;
+    std::atomic<int> pooled_;
+    bool done_;
+};
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+// Region is a block of the old generation aligned on its size, it starts
+// with its tables and the lines after them hold objects. A line is also the
+// card of the write barrier.
+struct Heap::Region {
+    // Lines holding live objects at the last major collection
+    uint8_t lines[kLines];
+    // Lines where an object given a young value starts
+    uint8_t cards[kLines];
+    // A bit per granule where an object starts, a word per line
+    uint32_t starts[kLines];
+
+    static Region* Of(const void* address) {
+        return reinterpret_cast<Region*>(reinterpret_cast<uintptr_t>(address) & ~(kRegionSize - 1));
+    }
+    static size_t LineOf(const void* address) {
+        return (reinterpret_cast<uintptr_t>(address) & (kRegionSize - 1)) / kLineSize;
+    }
+    char* Line(size_t line) { return reinterpret_cast<char*>(this) + line * kLineSize; }
+    void SetStart(const void* address) {
+        size_t granule = (reinterpret_cast<uintptr_t>(address) & (kRegionSize - 1)) / kGranule;
+        starts[granule / kGranulesPerLine] |= 1u << (granule % kGranulesPerLine);
+    }
+    // Call f with each object starting on the line
+    template <typename F> void ForEachObject(size_t line, F f) {
+        uint32_t bits = starts[line];
+        while (bits) {
+            int bit = __builtin_ctz(bits);
+            bits &= bits - 1;
+            f(reinterpret_cast<Object*>(Line(line) + bit * kGranule), bit);
+        }
+    }
+};
+
+Heap::Heap(const GcOptions& options)
+    : options_(options), roots_(nullptr), nextIdentity_(0), nursery_(nullptr), nurseryStart_(0),
+      nurserySize_(0), top_(nullptr), end_(nullptr), nextRegion_(0), region_(nullptr), line_(0),
+      cursor_(nullptr), limit_(nullptr), majorTrigger_(0) {
+    static_assert(sizeof(Region) <= kFirstLine * kLineSize, "the tables of a region overlap its lines");
+}
+
+Heap::~Heap() {
+    for (char* p = nursery_; p < top_; ) {
+        auto object = reinterpret_cast<Object*>(p);
+        p += ObjectSize(object);
+        Destroy(object);
+    }
+    ::operator delete(nursery_);
+    for (auto region : regions_) {
+        for (size_t line = kFirstLine; line < kLines; line++)
+            region->ForEachObject(line, [](Object* object, int) { Destroy(object); });
+        ::operator delete(region, std::align_val_t(kRegionSize));
+    }
+    for (auto objects : {&large_, &permanent_}) {
+        for (auto object : *objects) {
+            Destroy(object);
+            ::operator delete(object);
+        }
+    }
+}
+
+void Heap::Attach(GcRoots* roots) {
+    roots_ = roots;
+    if (!nursery_) {
+        nurserySize_ = std::max(Align(options_.nurserySize), kMaxRegionObject);
+        nursery_ = static_cast<char*>(::operator new(nurserySize_));
+        nurseryStart_ = reinterpret_cast<uintptr_t>(nursery_);
+        top_ = nursery_;
+        end_ = nursery_ + nurserySize_;
+        majorTrigger_ = options_.majorThreshold;
+    }
+}
+
+void Heap::Detach(GcRoots* roots) {
+    if (roots_ == roots)
+        roots_ = nullptr;
+}
+
+void* Heap::Allocate(size_t size, Space& space) {
+    size = Align(size);
+    if (!roots_) {
+        space = Space::Permanent;
+        return ::operator new(size);
+    }
+    if (size > kMaxRegionObject) {
+        space = Space::Large;
+        return ::operator new(size);
+    }
+    if (size > static_cast<size_t>(end_ - top_))
+        Collect(false);
+    space = Space::Young;
+    void* memory = top_;
+    top_ += size;
+    return memory;
+}
+
+template <typename T> T* Heap::Register(T* object, Space space, size_t bytes) {
+    object->space = space;
+    object->identity = nextIdentity_++ * 2654435761u;
+    if (space == Space::Permanent) {
+        permanent_.push_back(object);
+    } else if (space == Space::Large) {
+        large_.push_back(object);
+        stats_.oldBytes += ObjectSize(object);
+    }
+    stats_.allocations++;
+    stats_.bytesAllocated += bytes;
+    return object;
+}
+
+StringObject* Heap::NewString(std::string_view value) {
+    Space space;
+    void* memory = Allocate(sizeof(StringObject), space);
+    size_t bytes = sizeof(StringObject) + (value.size() > StringObject::kInlineSize ? value.size() : 0);
+    return Register(new (memory) StringObject(value.data(), value.size()), space, bytes);
+}
+
+StringObject* Heap::Concatenate(Value left, Value right) {
+    // The operands are roots while the result is allocated, a collection
+    // moves them
+    scopedRoots_.push_back(&left);
+    scopedRoots_.push_back(&right);
+    if (!IsObjectOf(left, ObjectKind::String))
+        left = Value::FromObject(NewString(ValueToString(left)));
+    if (!IsObjectOf(right, ObjectKind::String))
+        right = Value::FromObject(NewString(ValueToString(right)));
+    size_t leftSize = static_cast<StringObject*>(left.AsObject())->size;
+    size_t rightSize = static_cast<StringObject*>(right.AsObject())->size;
+    size_t size = leftSize + rightSize;
+    StringObject* result;
+    if (rightSize == 0) {
+        result = static_cast<StringObject*>(left.AsObject());
+    } else if (leftSize == 0) {
+        result = static_cast<StringObject*>(right.AsObject());
+    } else if (size <= kMaxCopiedConcatenation) {
+        char bytes[kMaxCopiedConcatenation];
+        memcpy(bytes, static_cast<StringObject*>(left.AsObject())->Data(), leftSize);
+        memcpy(bytes + leftSize, static_cast<StringObject*>(right.AsObject())->Data(), rightSize);
+        result = NewString(std::string_view(bytes, size));
+    } else if (size > UINT32_MAX) {
+        scopedRoots_.resize(scopedRoots_.size() - 2);
+        throw RuntimeError("string too long");
+    } else {
+        // Appending a short string to a rope copies it into the short right
+        // side of the rope, so a loop of appends makes a node per
+        // kMaxCopiedConcatenation bytes rather than per append
+        auto rope = static_cast<StringObject*>(left.AsObject());
+        if (rope->form == StringObject::Rope && IsObjectOf(rope->Sides()[1], ObjectKind::String)) {
+            auto side = static_cast<StringObject*>(rope->Sides()[1].AsObject());
+            if (side->form != StringObject::Rope && side->size + rightSize <= kMaxCopiedConcatenation) {
+                char bytes[kMaxCopiedConcatenation];
+                memcpy(bytes, side->Data(), side->size);
+                memcpy(bytes + side->size, static_cast<StringObject*>(right.AsObject())->Data(), rightSize);
+                right = Value::FromObject(NewString(std::string_view(bytes, side->size + rightSize)));
+                left = static_cast<StringObject*>(left.AsObject())->Sides()[0];
+            }
+        }
+        Space space;
+        void* memory = Allocate(sizeof(StringObject), space);
+        result = Register(new (memory) StringObject(left, right), space, sizeof(StringObject));
+    }
+    scopedRoots_.resize(scopedRoots_.size() - 2);
+    return result;
+}
+
+StringObject* Heap::Intern(std::string_view value) {
+    auto iter = interned_.find(value);
+    if (iter != interned_.end())
+        return iter->second;
+    // Interned strings are permanent, their bytes are the key of the table
+    auto string = new (::operator new(Align(sizeof(StringObject)))) StringObject(value.data(), value.size());
+    string->interned = true;
+    string->Hash();
+    Register(string, Space::Permanent, sizeof(StringObject) + value.size());
+    interned_.emplace(string->View(), string);
+    return string;
+}
+
+ArrayObject* Heap::NewArray() {
+    Space space;
+    void* memory = Allocate(sizeof(ArrayObject), space);
+    return Register(new (memory) ArrayObject(), space, sizeof(ArrayObject));
+}
+
+MapObject* Heap::NewMap() {
+    Space space;
+    void* memory = Allocate(sizeof(MapObject), space);
+    return Register(new (memory) MapObject(), space, sizeof(MapObject));
+}
+
+InstanceObject* Heap::NewInstance(ClassObject* klass) {
+    size_t fields = klass->fieldDefaults.size();
+    size_t size = sizeof(InstanceObject) + fields * sizeof(Value);
+    Space space;
+    auto instance = new (Allocate(size, space)) InstanceObject(klass);
+    Value* values = instance->Fields();
+    for (size_t i = 0; i < fields; i++)
+        values[i] = klass->fieldDefaults[i];
+    return Register(instance, space, size);
+}
+
+ClassObject* Heap::NewClass(const std::string& name) {
+    auto klass = new (::operator new(Align(sizeof(ClassObject)))) ClassObject(name);
+    return Register(klass, Space::Permanent, sizeof(ClassObject));
+}
+
+FunctionObject* Heap::NewFunction(const std::string& name) {
+    auto function = new (::operator new(Align(sizeof(FunctionObject)))) FunctionObject(name);
+    return Register(function, Space::Permanent, sizeof(FunctionObject));
+}
+
+NativeObject* Heap::NewNative(const std::string& name, NativeFunction function, int arity) {
+    auto native = new (::operator new(Align(sizeof(NativeObject)))) NativeObject(name, function, arity);
+    return Register(native, Space::Permanent, sizeof(NativeObject));
+}
+
+void* Heap::AllocateOld(size_t size) {
+    while (size > static_cast<size_t>(limit_ - cursor_))
+        NextHole();
+    void* memory = cursor_;
+    cursor_ += size;
+    Region::Of(memory)->SetStart(memory);
+    stats_.oldBytes += size;
+    return memory;
+}
+
+void Heap::NextHole() {
+    for (;;) {
+        if (region_) {
+            while (line_ < kLines && region_->lines[line_])
+                line_++;
+            if (line_ < kLines) {
+                size_t end = line_;
+                while (end < kLines && !region_->lines[end])
+                    end++;
+                cursor_ = region_->Line(line_);
+                limit_ = region_->Line(end);
+                line_ = end;
+                return;
+            }
+        }
+        if (nextRegion_ < recyclable_.size()) {
+            region_ = recyclable_[nextRegion_++];
+        } else {
+            region_ = static_cast<Region*>(::operator new(kRegionSize, std::align_val_t(kRegionSize)));
+            memset(static_cast<void*>(region_), 0, sizeof(Region));
+            regions_.push_back(region_);
+        }
+        line_ = kFirstLine;
+    }
+}
+
+void Heap::Remember(Object* object) {
+    if (object->space == Space::Old) {
+        Region* region = Region::Of(object);
+        size_t line = Region::LineOf(object);
+        if (!region->cards[line]) {
+            region->cards[line] = 1;
+            dirtyCards_.push_back({region, line});
+        }
+    } else if (!object->remembered) {
+        object->remembered = true;
+        remembered_.push_back(object);
+    }
+}
+
+void Heap::Collect(bool major) {
+    if (!roots_)
+        return;
+    CollectMinor();
+    if (major || stats_.oldBytes >= majorTrigger_)
+        CollectMajor();
+}
+
+void Heap::Evacuate(Value& value) {
+    if (!IsYoung(value))
+        return;
+    Object* object = value.AsObject();
+    if (object->space != Space::Forwarded) {
+        size_t size = ObjectSize(object);
+        Object* copy = Move(object, AllocateOld(size));
+        copy->space = Space::Old;
+        object->space = Space::Forwarded;
+        object->forward = copy;
+        stats_.bytesPromoted += size;
+        scan_.push_back(copy);
+    }
+    value = Value::FromObject(object->forward);
+}
+
+void Heap::CollectMinor() {
+    auto start = std::chrono::steady_clock::now();
+    auto evacuate = [this](Value& value) { Evacuate(value); };
+
+    rootSlots_.clear();
+    roots_->CollectRoots(rootSlots_);
+    rootSlots_.insert(rootSlots_.end(), scopedRoots_.begin(), scopedRoots_.end());
+    for (auto slot : rootSlots_)
+        Evacuate(*slot);
+    for (auto& card : dirtyCards_) {
+        card.first->ForEachObject(card.second, [&](Object* object, int) {
+            ForEachSlot(object, evacuate);
+        });
+        card.first->cards[card.second] = 0;
+    }
+    dirtyCards_.clear();
+    for (auto object : remembered_) {
+        ForEachSlot(object, evacuate);
+        object->remembered = false;
+    }
+    remembered_.clear();
+    // Moved objects are scanned in turn, until no young object is reachable
+    while (!scan_.empty()) {
+        Object* object = scan_.back();
+        scan_.pop_back();
+        ForEachSlot(object, evacuate);
+    }
+
+    for (char* p = nursery_; p < top_; ) {
+        auto object = reinterpret_cast<Object*>(p);
+        p += ObjectSize(object);
+        Destroy(object);
+    }
+    top_ = nursery_;
+
+    double pause = SecondsSince(start);
+    stats_.minorCollections++;
+    stats_.minorSeconds += pause;
+    stats_.maxPauseSeconds = std::max(stats_.maxPauseSeconds, pause);
+}
+
+void Heap::CollectMajor() {
+    auto start = std::chrono::steady_clock::now();
+    // The minor collection just run left the nursery empty and updated the
+    // root slots, they only reference old and permanent objects
+    std::vector<Object*> marked;
+    for (auto slot : rootSlots_) {
+        if (!slot->IsObject())
+            continue;
+        Object* object = slot->AsObject();
+        if (object->space != Space::Permanent && object->mark.exchange(1, std::memory_order_relaxed) == 0)
+            marked.push_back(object);
+    }
+    int threads = options_.markThreads;
+    if (threads <= 0)
+        threads = static_cast<int>(std::min(8u, std::max(1u, std::thread::hardware_concurrency())));
+    if (stats_.oldBytes < kParallelMarkBytes)
+        threads = 1;
+    Marker marker(threads);
+    marker.Run(marked);
+    Sweep();
+
+    majorTrigger_ = stats_.oldBytes + std::max<uint64_t>(options_.majorThreshold, stats_.oldBytes);
+    double pause = SecondsSince(start);
+    stats_.majorCollections++;
+    stats_.majorSeconds += pause;
+    stats_.maxPauseSeconds = std::max(stats_.maxPauseSeconds, pause);
+}
+
+void Heap::Sweep() {
+    uint64_t live = 0;
+    uint64_t freed = 0;
+    std::vector<Region*> empty;
+    recyclable_.clear();
+    nextRegion_ = 0;
+    region_ = nullptr;
+    cursor_ = limit_ = nullptr;
+
+    size_t kept = 0;
+    for (auto region : regions_) {
+        memset(region->lines, 0, sizeof(region->lines));
+        memset(region->cards, 0, sizeof(region->cards));
+        size_t regionLive = 0;
+        for (size_t line = kFirstLine; line < kLines; line++) {
+            region->ForEachObject(line, [&](Object* object, int bit) {
+                size_t size = ObjectSize(object);
+                if (object->mark.load(std::memory_order_relaxed)) {
+                    object->mark.store(0, std::memory_order_relaxed);
+                    size_t last = Region::LineOf(reinterpret_cast<char*>(object) + size - 1);
+                    for (size_t n = line; n <= last; n++)
+                        region->lines[n] = 1;
+                    regionLive += size;
+                } else {
+                    Destroy(object);
+                    region->starts[line] &= ~(1u << bit);
+                    freed += size;
+                }
+            });
+        }
+        live += regionLive;
+        if (regionLive == 0) {
+            if (kept++ < kKeptFreeRegions)
+                recyclable_.push_back(region);
+            else
+                empty.push_back(region);
+        } else if (std::count(region->lines + kFirstLine, region->lines + kLines, 0) > 0) {
+            recyclable_.push_back(region);
+        }
+    }
+    for (auto region : empty) {
+        regions_.erase(std::find(regions_.begin(), regions_.end(), region));
+        ::operator delete(region, std::align_val_t(kRegionSize));
+    }
+
+    size_t keptLarge = 0;
+    for (auto object : large_) {
+        size_t size = ObjectSize(object);
+        if (object->mark.load(std::memory_order_relaxed)) {
+            object->mark.store(0, std::memory_order_relaxed);
+            large_[keptLarge++] = object;
+            live += size;
+        } else {
+            Destroy(object);
+            ::operator delete(object);
+            freed += size;
+        }
+    }
+    large_.resize(keptLarge);
+
+    stats_.oldBytes = live;
+    stats_.bytesFreed += freed;
+}
+
+} // namespace zl
@@ -0,0 +1,171 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "object.h"
+#include "value.h"
+
+namespace zl {
+
+// GcOptions tune the collector, they are set before roots are attached
+struct GcOptions {
+    // Bytes of the nursery
+    size_t nurserySize = 4 << 20;
+    // The old generation is collected when it grew by this many bytes since
+    // the last major collection, or by its live size if that is larger
+    size_t majorThreshold = 32 << 20;
+    // Threads marking the old generation, 0 for one per processor up to 8
+    int markThreads = 0;
+};
+
+// GcStats count the collections and their pauses, see Heap::Stats
+struct GcStats {
+    uint64_t minorCollections = 0;
+    uint64_t majorCollections = 0;
+    // Total and longest pauses in seconds
+    double minorSeconds = 0;
+    double majorSeconds = 0;
+    double maxPauseSeconds = 0;
+    // Objects and bytes allocated since the heap was created
+    uint64_t allocations = 0;
+    uint64_t bytesAllocated = 0;
+    // Bytes moved from the nursery to the old generation
+    uint64_t bytesPromoted = 0;
+    // Bytes freed by major collections
+    uint64_t bytesFreed = 0;
+    // Bytes of the old generation, live at the last major collection and
+    // promoted or allocated there since
+    uint64_t oldBytes = 0;
+};
+
+// GcRoots give the roots of collections, the interpreter is one
+class GcRoots {
+public:
+    virtual ~GcRoots() {}
+    // Append the address of each value which may reference the heap
+    virtual void CollectRoots(std::vector<Value*>& roots) = 0;
+};
+
+// Heap allocate the objects of a program, it is generational:
+//
+// - Objects allocated while no roots are attached, the constants of the
+//   compiler, and all classes, functions and natives are permanent. They are
+//   never moved nor freed before the heap and only reference permanent
+//   objects: the arrays and maps of constants are read-only.
+// - Strings, arrays, maps and instances are allocated by bumping a pointer
+//   in the nursery. When it is full a minor collection copies the live ones
+//   to the old generation and empties it. Its roots are the values given by
+//   GcRoots, the objects on the dirty cards of the old generation and the
+//   remembered large objects.
+// - The old generation is made of regions divided in lines, objects are
+//   placed in the lines found free by the last major collection, larger
+//   objects are allocated apart. When it has grown enough a major collection
+//   marks the live objects on several threads and sweeps the regions.
+//
+// A store of a value into an object must call WriteBarrier, if an old object
+// is given a young one its line is marked as a dirty card which the next
+// minor collection scans.
+class Heap {
+public:
+    explicit Heap(const GcOptions& options = GcOptions());
+    ~Heap();
+
+    StringObject* NewString(std::string_view value);
+    // Return the concatenation of the values, a rope if it is long. Values
+    // which are not strings are converted as they are printed.
+    StringObject* Concatenate(Value left, Value right);
+    // Return the permanent string of the content, the same one for each
+    // content, its hash is computed at once
+    StringObject* Intern(std::string_view value);
+    ArrayObject* NewArray();
+    MapObject* NewMap();
+    InstanceObject* NewInstance(ClassObject* klass);
+    ClassObject* NewClass(const std::string& name);
+    FunctionObject* NewFunction(const std::string& name);
+    NativeObject* NewNative(const std::string& name, NativeFunction function, int arity);
+
+    // Collect garbage from the roots, objects are permanent until roots are
+    // attached and after they are detached
+    void Attach(GcRoots* roots);
+    void Detach(GcRoots* roots);
+    // Options are used from the first time roots are attached
+    void SetOptions(const GcOptions& options) { options_ = options; }
+    const GcOptions& Options() const { return options_; }
+    // Collect the nursery, and the old generation too if major
+    void Collect(bool major);
+
+    void WriteBarrier(Object* object, Value value) {
+        if (object->space != Space::Young && IsYoung(value))
+            Remember(object);
+    }
+    bool IsYoung(Value value) const {
+        return value.IsObject() &&
+            reinterpret_cast<uintptr_t>(value.AsObject()) - nurseryStart_ < nurserySize_;
+    }
+
+    const GcStats& Stats() const { return stats_; }
+    size_t Allocations() const { return stats_.allocations; }
+    size_t BytesAllocated() const { return stats_.bytesAllocated; }
+
+private:
+    Heap(const Heap&) = delete;
+    Heap& operator = (const Heap&) = delete;
+
+    struct Region;
+
+    // Return memory for an object of size bytes and its space
+    void* Allocate(size_t size, Space& space);
+    template <typename T> T* Register(T* object, Space space, size_t bytes);
+    // Return memory in the old generation, size is at most a region object
+    void* AllocateOld(size_t size);
+    // Move the cursor to the next free lines of the old generation
+    void NextHole();
+    void Remember(Object* object);
+
+    void CollectMinor();
+    void CollectMajor();
+    // Move the young object referenced by value to the old generation
+    void Evacuate(Value& value);
+    void Sweep();
+
+private:
+    GcOptions options_;
+    GcRoots* roots_;
+    GcStats stats_;
+    uint32_t nextIdentity_;
+
+    char* nursery_;
+    uintptr_t nurseryStart_;
+    size_t nurserySize_;
+    char* top_;
+    char* end_;
+
+    std::vector<Region*> regions_;
+    // Regions with free lines, they are allocated in from nextRegion_
+    std::vector<Region*> recyclable_;
+    size_t nextRegion_;
+    Region* region_;
+    size_t line_;
+    char* cursor_;
+    char* limit_;
+    std::vector<Object*> large_;
+    std::vector<Object*> permanent_;
+    std::unordered_map<std::string_view, StringObject*> interned_;
+    uint64_t majorTrigger_;
+
+    // Lines of old objects given young values, and the large or permanent
+    // objects given young values, since the last minor collection
+    std::vector<std::pair<Region*, size_t>> dirtyCards_;
+    std::vector<Object*> remembered_;
+    std::vector<Value*> rootSlots_;
+    // Values of the heap functions which are roots while they allocate
+    std::vector<Value*> scopedRoots_;
+    // Objects moved by the minor collection whose slots are not scanned yet
+    std::vector<Object*> scan_;
+};
+
+} // namespace zl
@@ -0,0 +1,478 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include "interpreter.h"
+
+#if defined(__GNUC__) && !defined(ZL_VM_NO_COMPUTED_GOTO)
+#define ZL_VM_HAS_COMPUTED_GOTO 1
+#endif
+
+namespace zl {
+
+namespace {
+
+const size_t kMaxFrames = 1 << 16;
+
+Value PrintBuiltin(Heap& heap, Value* args, int count) {
+    std::string text;
+    for (int n = 0; n < count; n++) {
+        if (n > 0)
+            text += " ";
+        text += ValueToString(args[n]);
+    }
+    text += "\n";
+    fwrite(text.data(), 1, text.size(), stdout);
+    return Value::Nil();
+}
+
+Value LenBuiltin(Heap& heap, Value* args, int count) {
+    Value value = args[0];
+    if (IsObjectOf(value, ObjectKind::Array))
+        return Value::Int(static_cast<int32_t>(static_cast<ArrayObject*>(value.AsObject())->elements.size()));
+    if (IsObjectOf(value, ObjectKind::Map))
+        return Value::Int(static_cast<int32_t>(static_cast<MapObject*>(value.AsObject())->Entries().size()));
+    if (IsObjectOf(value, ObjectKind::String))
+        return Value::Int(static_cast<int32_t>(static_cast<StringObject*>(value.AsObject())->Size()));
+    throw RuntimeError("len of " + TypeNameOf(value));
+}
+
+Value AppendBuiltin(Heap& heap, Value* args, int count) {
+    if (!IsObjectOf(args[0], ObjectKind::Array))
+        throw RuntimeError("append to " + TypeNameOf(args[0]));
+    auto array = static_cast<ArrayObject*>(args[0].AsObject());
+    if (array->readOnly)
+        throw RuntimeError("append to constant array");
+    array->elements.push_back(args[1]);
+    heap.WriteBarrier(array, args[1]);
+    return args[0];
+}
+
+// UncaughtException is thrown by Throw when no frame catches the value, it
+// is reported like a runtime error at the instruction which first threw it
+// but not caught again as one
+class UncaughtException : public RuntimeError {
+public:
+    UncaughtException(const std::string& msg, FunctionObject* function, uint32_t offset)
+        : RuntimeError(msg), function(function), offset(offset) {}
+
+    FunctionObject* function;
+    uint32_t offset;
+};
+
+bool Catches(const ExceptionHandler& handler, Value exception, bool runtimeError) {
+    if (handler.klass || handler.interface >= 0) {
+        if (!IsObjectOf(exception, ObjectKind::Instance))
+            return false;
+        auto klass = static_cast<InstanceObject*>(exception.AsObject())->klass;
+        if (handler.klass)
+            return klass == handler.klass;
+        auto interface = static_cast<size_t>(handler.interface);
+        return interface < klass->itables.size() && !klass->itables[interface].empty();
+    }
+    if (handler.type.empty())
+        return true;
+    return runtimeError ? handler.type == "string" : TypeNameOf(exception) == handler.type;
+}
+
+} // namespace
+
+bool Interpreter::HasThreadedDispatch() {
+#ifdef ZL_VM_HAS_COMPUTED_GOTO
+    return true;
+#else
+    return false;
+#endif
+}
+
+Interpreter::Dispatch Interpreter::DefaultDispatch() {
+#ifdef ZL_VM_SWITCH_DISPATCH
+    return Dispatch::Switch;
+#else
+    return HasThreadedDispatch() ? Dispatch::Threaded : Dispatch::Switch;
+#endif
+}
+
+void Interpreter::DeclareBuiltins(Program& program) {
+    const struct {
+        const char* name;
+        NativeFunction function;
+        int arity;
+    } builtins[] = {
+        {"print", PrintBuiltin, -1},
+        {"len", LenBuiltin, 1},
+        {"append", AppendBuiltin, 2},
+    };
+    for (auto& builtin : builtins) {
+        program.globalNames.push_back(builtin.name);
+        program.globals.push_back(Value::FromObject(
+            program.heap.NewNative(builtin.name, builtin.function, builtin.arity)));
+    }
+}
+
+Interpreter::Interpreter(Program& program)
+    : Interpreter(program, DefaultDispatch()) {}
+
+Interpreter::Interpreter(Program& program, Dispatch dispatch, size_t stackSize)
+    : program_(program), dispatch_(dispatch), stack_(stackSize), instructions_(0),
+      methodCache_(1 << kMethodCacheBits) {
+    if (dispatch_ == Dispatch::Threaded && !HasThreadedDispatch())
+        dispatch_ = Dispatch::Switch;
+    // Frames are never reallocated while the loop holds a pointer to one
+    frames_.reserve(kMaxFrames);
+    program_.heap.Attach(this);
+}
+
+Interpreter::~Interpreter() {
+    program_.heap.Detach(this);
+}
+
+void Interpreter::CollectRoots(std::vector<Value*>& roots) {
+    for (auto& global : program_.globals)
+        roots.push_back(&global);
+    for (auto& frame : frames_) {
+        auto function = frame.function;
+        // The frame is at the instruction before its saved pc
+        size_t offset = frame.pc - function->code.data() - 1;
+        const uint64_t* live = LiveRegistersAt(function, offset);
+        for (int reg = 0; reg < function->numRegisters; reg++) {
+            if (!live || (live[reg / 64] >> (reg % 64) & 1))
+                roots.push_back(&frame.base[reg]);
+        }
+    }
+}
+
+const ExceptionHandler* Interpreter::Unwind(Value exception, const ThrowSite& site, size_t entryDepth) {
+    for (size_t depth = frames_.size(); depth-- > entryDepth; ) {
+        Frame& frame = frames_[depth];
+        auto function = frame.function;
+        // The frame is at the instruction before its saved pc, a call for
+        // the frames below the top
+        auto offset = static_cast<uint32_t>(frame.pc - function->code.data() - 1);
+        for (auto& handler : function->handlers) {
+            if (offset < handler.start || offset >= handler.end ||
+                !Catches(handler, exception, site.runtimeError))
+                continue;
+            frames_.resize(depth + 1);
+            frame.pc = function->code.data() + handler.target;
+            frame.base[handler.reg] = site.runtimeError ? Value::Nil() : exception;
+            if (handler.rethrows) {
+                frame.base[handler.reg + 1] = Value::FromObject(site.function);
+                frame.base[handler.reg + 2] = Value::Int(static_cast<int32_t>(site.offset * 2 + site.runtimeError));
+            }
+            return &handler;
+        }
+    }
+    return nullptr;
+}
+
+void Interpreter::SetError(const std::string& msg) {
+    error_ = msg;
+}
+
+bool Interpreter::RunMain(Value& result) {
+    if (program_.init && !Call(Value::FromObject(program_.init), {}, result))
+        return false;
+    if (!program_.main) {
+        SetError("no main function");
+        return false;
+    }
+    std::vector<Value> args(program_.main->numParams);
+    return Call(Value::FromObject(program_.main), args, result);
+}
+
+bool Interpreter::Call(Value callee, const std::vector<Value>& args, Value& result) {
+    // The callee is placed above the registers of the running frame
+    Value* slot = stack_.data();
+    if (!frames_.empty())
+        slot = frames_.back().base + frames_.back().function->numRegisters;
+    if (slot + 1 + args.size() > stack_.data() + stack_.size()) {
+        SetError("stack overflow");
+        return false;
+    }
+    slot[0] = callee;
+    for (size_t n = 0; n < args.size(); n++)
+        slot[1 + n] = args[n];
+    size_t depth = frames_.size();
+    try {
+        if (!EnterCall(slot, static_cast<int>(args.size()), 1)) {
+            result = slot[0];
+            return true;
+        }
+    } catch (RuntimeError& e) {
+        SetError(e.what());
+        return false;
+    }
+    bool ok = dispatch_ == Dispatch::Threaded ? ExecuteThreaded(depth) : ExecuteSwitch(depth);
+    if (ok)
+        result = slot[0];
+    return ok;
+}
+
+bool Interpreter::EnterCall(Value* slot, int argc, int numResults) {
+    Value callee = slot[0];
+    if (IsObjectOf(callee, ObjectKind::Function)) {
+        auto function = static_cast<FunctionObject*>(callee.AsObject());
+        if (argc != function->numParams)
+            throw RuntimeError(function->name + " expects " + std::to_string(function->numParams) +
+                " arguments, got " + std::to_string(argc));
+        Value* base = slot + 1;
+        if (base + function->numRegisters > stack_.data() + stack_.size() ||
+                frames_.size() >= kMaxFrames)
+            throw RuntimeError("stack overflow");
+        if (function->clearRegisters) {
+            for (int reg = function->numParams; reg < function->numRegisters; reg++)
+                base[reg] = Value::Nil();
+        }
+        frames_.push_back({function, function->code.data(), base, numResults});
+        return true;
+    }
+    if (IsObjectOf(callee, ObjectKind::Native)) {
+        auto native = static_cast<NativeObject*>(callee.AsObject());
+        if (native->arity >= 0 && argc != native->arity)
+            throw RuntimeError(native->name + " expects " + std::to_string(native->arity) +
+                " arguments, got " + std::to_string(argc));
+        slot[0] = native->function(program_.heap, slot + 1, argc);
+        for (int n = 1; n < numResults; n++)
+            slot[n] = Value::Nil();
+        return false;
+    }
+    throw RuntimeError("cannot call " + TypeNameOf(callee));
+}
+
+Value Interpreter::Arithmetic(Heap& heap, OpCode op, Value a, Value b) {
+    if (Value::BothInt(a, b)) {
+        int32_t x = a.AsInt();
+        int32_t y = b.AsInt();
+        auto wrap = [](int64_t value) {
+            return Value::Int(static_cast<int32_t>(static_cast<uint32_t>(value)));
+        };
+        switch (op) {
+            case OpCode::Add:
+                return wrap(static_cast<int64_t>(x) + y);
+            case OpCode::Sub:
+                return wrap(static_cast<int64_t>(x) - y);
+            case OpCode::Mul:
+                return wrap(static_cast<int64_t>(x) * y);
+            case OpCode::Div:
+                if (y == 0)
+                    throw RuntimeError("division by zero");
+                return wrap(static_cast<int64_t>(x) / y);
+            case OpCode::Mod:
+                if (y == 0)
+                    throw RuntimeError("division by zero");
+                return wrap(static_cast<int64_t>(x) % y);
+            case OpCode::BitAnd:
+                return Value::Int(x & y);
+            case OpCode::BitOr:
+                return Value::Int(x | y);
+            case OpCode::BitXor:
+                return Value::Int(x ^ y);
+            case OpCode::Shl:
+                return Value::Int(static_cast<int32_t>(static_cast<uint32_t>(x) << (y & 31)));
+            case OpCode::Shr:
+                return Value::Int(x >> (y & 31));
+            default:
+                break;
+        }
+    } else if (a.IsNumber() && b.IsNumber()) {
+        double x = a.ToDouble();
+        double y = b.ToDouble();
+        switch (op) {
+            case OpCode::Add:
+                return Value::Double(x + y);
+            case OpCode::Sub:
+                return Value::Double(x - y);
+            case OpCode::Mul:
+                return Value::Double(x * y);
+            case OpCode::Div:
+                return Value::Double(x / y);
+            case OpCode::Mod:
+                return Value::Double(fmod(x, y));
+            default:
+                break;
+        }
+    } else if (op == OpCode::Add && (IsObjectOf(a, ObjectKind::String) ||
+                IsObjectOf(b, ObjectKind::String))) {
+        return Value::FromObject(heap.Concatenate(a, b));
+    }
+    throw RuntimeError("invalid operands " + TypeNameOf(a) + " and " + TypeNameOf(b) +
+        " of " + OpCodeName(op));
+}
+
+bool Interpreter::LessThan(Value a, Value b, bool orEqual) {
+    if (a.IsNumber() && b.IsNumber())
+        return orEqual ? a.ToDouble() <= b.ToDouble() : a.ToDouble() < b.ToDouble();
+    if (IsObjectOf(a, ObjectKind::String) && IsObjectOf(b, ObjectKind::String)) {
+        int result = static_cast<StringObject*>(a.AsObject())->View().compare(
+            static_cast<StringObject*>(b.AsObject())->View());
+        return orEqual ? result <= 0 : result < 0;
+    }
+    throw RuntimeError("can not compare " + TypeNameOf(a) + " and " + TypeNameOf(b));
+}
+
+Value Interpreter::GetField(Value object, const std::string& name) {
+    if (IsObjectOf(object, ObjectKind::Instance)) {
+        auto instance = static_cast<InstanceObject*>(object.AsObject());
+        int index = instance->klass->FieldIndex(name);
+        if (index >= 0)
+            return instance->Fields()[index];
+    }
+    throw RuntimeError(TypeNameOf(object) + " has no field " + name);
+}
+
+void Interpreter::SetField(Value object, const std::string& name, Value value) {
+    if (IsObjectOf(object, ObjectKind::Instance)) {
+        auto instance = static_cast<InstanceObject*>(object.AsObject());
+        int index = instance->klass->FieldIndex(name);
+        if (index >= 0) {
+            instance->Fields()[index] = value;
+            program_.heap.WriteBarrier(instance, value);
+            return;
+        }
+    }
+    throw RuntimeError(TypeNameOf(object) + " has no field " + name);
+}
+
+Value Interpreter::GetIndex(Value object, Value index) {
+    if (IsObjectOf(object, ObjectKind::Map))
+        return static_cast<MapObject*>(object.AsObject())->Get(index);
+    if (IsObjectOf(object, ObjectKind::Array) && index.IsInt())
+        throw RuntimeError("index " + std::to_string(index.AsInt()) + " out of range");
+    if (IsObjectOf(object, ObjectKind::String) && index.IsInt()) {
+        auto string = static_cast<StringObject*>(object.AsObject());
+        if (static_cast<uint32_t>(index.AsInt()) < string->Size())
+            return Value::Int(static_cast<unsigned char>(string->Data()[index.AsInt()]));
+        throw RuntimeError("index " + std::to_string(index.AsInt()) + " out of range");
+    }
+    throw RuntimeError("can not index " + TypeNameOf(object) + " with " + TypeNameOf(index));
+}
+
+void Interpreter::SetIndex(Value object, Value index, Value value) {
+    if (IsObjectOf(object, ObjectKind::Map)) {
+        auto map = static_cast<MapObject*>(object.AsObject());
+        if (map->readOnly)
+            throw RuntimeError("store into constant map");
+        map->Set(index, value);
+        program_.heap.WriteBarrier(object.AsObject(), index);
+        program_.heap.WriteBarrier(object.AsObject(), value);
+        return;
+    }
+    if (IsObjectOf(object, ObjectKind::Array) && index.IsInt()) {
+        auto array = static_cast<ArrayObject*>(object.AsObject());
+        if (array->readOnly)
+            throw RuntimeError("store into constant array");
+        auto& elements = array->elements;
+        if (static_cast<uint32_t>(index.AsInt()) >= elements.size())
+            throw RuntimeError("index " + std::to_string(index.AsInt()) + " out of range");
+        elements[index.AsInt()] = value;
+        program_.heap.WriteBarrier(object.AsObject(), value);
+        return;
+    }
+    throw RuntimeError("can not index " + TypeNameOf(object) + " with " + TypeNameOf(index));
+}
+
+Value Interpreter::NewInstance(Value klass) {
+    if (!IsObjectOf(klass, ObjectKind::Class))
+        throw RuntimeError("new of " + TypeNameOf(klass));
+    return Value::FromObject(program_.heap.NewInstance(static_cast<ClassObject*>(klass.AsObject())));
+}
+
+FunctionObject* Interpreter::LookupMethod(CallSite& site, const Value* constants, Value object) {
+    auto name = static_cast<StringObject*>(constants[site.name].AsObject())->ToString();
+    if (!IsObjectOf(object, ObjectKind::Instance))
+        throw RuntimeError("method " + name + " called on " + TypeNameOf(object));
+    ClassObject* klass = static_cast<InstanceObject*>(object.AsObject())->klass;
+    FunctionObject* method = klass->InterfaceMethod(site.interface, site.slot);
+    if (method) {
+        stats_.itableLookups++;
+    } else {
+        // Classes which do not implement the interface may still have the
+        // method
+        stats_.nameLookups++;
+        method = klass->Method(name);
+        if (!method)
+            throw RuntimeError(TypeNameOf(object) + " has no method " + name);
+    }
+    switch (site.state) {
+        case CallSite::Uninitialized:
+            site.state = CallSite::Monomorphic;
+            site.classes[0] = klass;
+            site.methods[0] = method;
+            site.count = 1;
+            break;
+        case CallSite::Monomorphic:
+        case CallSite::Polymorphic:
+            if (site.count < CallSite::kPolymorphicEntries) {
+                if (site.state == CallSite::Monomorphic)
+                    stats_.polymorphicSites++;
+                site.state = CallSite::Polymorphic;
+                site.classes[site.count] = klass;
+                site.methods[site.count] = method;
+                site.count++;
+                break;
+            }
+            stats_.megamorphicSites++;
+            site.state = CallSite::Megamorphic;
+            for (int n = 0; n < site.count; n++) {
+                auto cached = site.classes[n];
+                methodCache_[MethodCacheIndex(cached, site.selector)] = {cached, site.selector, site.methods[n]};
+            }
+            [[fallthrough]];
+        case CallSite::Megamorphic:
+            methodCache_[MethodCacheIndex(klass, site.selector)] = {klass, site.selector, method};
+            break;
+    }
+    return method;
+}
+
+bool Interpreter::ExecuteSwitch(size_t entryDepth) {
+#define ZL_VM_LOOP_BEGIN                   \
+    for (;;) {                             \
+        i = *pc++;                         \
+        count++;                           \
+        switch (GetOp(i)) {
+#define ZL_VM_LOOP_END                     \
+            default:                       \
+                throw RuntimeError("invalid opcode " + std::to_string(i & 0xff)); \
+        }                                  \
+    }
+#define ZL_VM_CASE(name) case OpCode::name:
+#define ZL_VM_DISPATCH() continue
+#include "interpreter_loop.h"
+#undef ZL_VM_LOOP_BEGIN
+#undef ZL_VM_LOOP_END
+#undef ZL_VM_CASE
+#undef ZL_VM_DISPATCH
+}
+
+#ifdef ZL_VM_HAS_COMPUTED_GOTO
+bool Interpreter::ExecuteThreaded(size_t entryDepth) {
+    // One entry for each opcode, the compiler never emits the others
+    static const void* const labels[256] = {
+#define ZL_VM_LABEL(name) &&op_##name,
+        ZL_OPCODES(ZL_VM_LABEL)
+#undef ZL_VM_LABEL
+    };
+#define ZL_VM_LOOP_BEGIN ZL_VM_DISPATCH();
+#define ZL_VM_LOOP_END
+#define ZL_VM_CASE(name) op_##name:
+#define ZL_VM_DISPATCH()                   \
+    do {                                   \
+        i = *pc++;                         \
+        count++;                           \
+        goto *labels[i & 0xff];            \
+    } while (0)
+#include "interpreter_loop.h"
+#undef ZL_VM_LOOP_BEGIN
+#undef ZL_VM_LOOP_END
+#undef ZL_VM_CASE
+#undef ZL_VM_DISPATCH
+}
+#else
+bool Interpreter::ExecuteThreaded(size_t entryDepth) {
+    return ExecuteSwitch(entryDepth);
+}
+#endif
+
+} // namespace zl
@@ -0,0 +1,192 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "bytecode.h"
+#include "object.h"
+#include "value.h"
+
+namespace zl {
+
+// DispatchStats count the method calls by how their method was found, see
+// CallSite
+struct DispatchStats {
+    // Calls whose class was in the cache of a monomorphic or polymorphic
+    // site, or in the method cache for a megamorphic site
+    uint64_t monomorphicHits = 0;
+    uint64_t polymorphicHits = 0;
+    uint64_t megamorphicHits = 0;
+    // Calls whose method was looked up in the itable of the interface or by
+    // name in the class
+    uint64_t itableLookups = 0;
+    uint64_t nameLookups = 0;
+    // Sites which became polymorphic and megamorphic
+    uint64_t polymorphicSites = 0;
+    uint64_t megamorphicSites = 0;
+};
+
+// Interpreter execute the bytecode of a program. Calls between bytecode
+// functions do not recurse on the native stack, each call pushes a frame
+// whose registers are a window of the value stack starting at the arguments.
+//
+// The dispatch loop is compiled twice, with computed goto where the compiler
+// supports labels as values (GCC and Clang) and with a switch, so both can
+// be measured in the same binary.
+//
+// Method calls are dispatched by the inline cache of their call site, the
+// method of a class missing from it is looked up in the itable of the
+// declared interface of the receiver, or by name otherwise.
+//
+// Exceptions cost nothing until one is thrown: a throw or a runtime error
+// looks the instruction up in the exception table of each frame from the
+// top, pops the frames without a handler for it and goes on at the handler.
+// A runtime error is thrown as its message, a string.
+//
+// The interpreter gives the roots of the collections of the heap: globals
+// and the registers of each frame live at its instruction, the frame saves
+// its pc before any instruction which may allocate.
+class Interpreter : private GcRoots {
+public:
+    enum class Dispatch {
+        Switch,
+        Threaded,
+    };
+    // Return true if threaded dispatch is compiled in
+    static bool HasThreadedDispatch();
+    // Threaded dispatch if it is available, unless ZL_VM_SWITCH_DISPATCH is
+    // defined
+    static Dispatch DefaultDispatch();
+
+    explicit Interpreter(Program& program);
+    Interpreter(Program& program, Dispatch dispatch, size_t stackSize = 1 << 20);
+    ~Interpreter();
+
+    // Run the initializer of globals and then main, return false on runtime
+    // error
+    bool RunMain(Value& result);
+    // Call the function with the arguments, return false on runtime error
+    bool Call(Value callee, const std::vector<Value>& args, Value& result);
+    // The message of last runtime error, "function:line: message"
+    const std::string& Error() const { return error_; }
+    // Number of instructions executed so far
+    uint64_t InstructionCount() const { return instructions_; }
+    const DispatchStats& Stats() const { return stats_; }
+
+    // Register the builtin functions print and len as globals of the
+    // program, called by BytecodeCompiler before compiling
+    static void DeclareBuiltins(Program& program);
+
+    // Operations of the instructions on operands other than those of their
+    // fast paths, they throw RuntimeError. The compiler folds constants with
+    // them, so folded and run code give the same values.
+    static Value Arithmetic(Heap& heap, OpCode op, Value a, Value b);
+    static bool LessThan(Value a, Value b, bool orEqual);
+
+private:
+    Interpreter() = delete;
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator = (const Interpreter&) = delete;
+
+    // The method cache of megamorphic sites is a hash table of methods by
+    // class and selector, direct mapped: an entry is replaced by the last
+    // method looked up for its place
+    struct MethodCacheEntry {
+        const ClassObject* klass = nullptr;
+        int selector = 0;
+        FunctionObject* method = nullptr;
+    };
+    static const int kMethodCacheBits = 9;
+
+    struct Frame {
+        FunctionObject* function;
+        // Next instruction, only saved when another frame is entered
+        const Instruction* pc;
+        // Register 0 of the frame, the callee is at base[-1] and the
+        // results are written from there
+        Value* base;
+        int numResults;
+    };
+
+    // Run the frames above entryDepth until they return
+    bool ExecuteSwitch(size_t entryDepth);
+    bool ExecuteThreaded(size_t entryDepth);
+    // Push the frame of a call whose callee is at slot and the arguments
+    // after it, native functions are called at once and push nothing.
+    // Return false if a native function was called.
+    bool EnterCall(Value* slot, int argc, int numResults);
+    // Instruction which first threw an exception, kept when handlers throw
+    // it again
+    struct ThrowSite {
+        FunctionObject* function;
+        uint32_t offset;
+        bool runtimeError;
+    };
+
+    // Find the handler of the exception thrown at the current instruction
+    // of the innermost frame above entryDepth which catches it, pop the
+    // frames above that one and move it to the handler with the exception
+    // in its register. Return nullptr, popping nothing, if none catches it.
+    // The message of a runtime error is not allocated yet, its register is
+    // set to nil.
+    const ExceptionHandler* Unwind(Value exception, const ThrowSite& site, size_t entryDepth);
+    void SetError(const std::string& msg);
+    void CollectRoots(std::vector<Value*>& roots) override;
+
+    // Slow paths of instructions, they throw RuntimeError
+    Value Arithmetic(OpCode op, Value a, Value b) { return Arithmetic(program_.heap, op, a, b); }
+    Value GetField(Value object, const std::string& name);
+    void SetField(Value object, const std::string& name, Value value);
+    Value GetIndex(Value object, Value index);
+    void SetIndex(Value object, Value index, Value value);
+    Value NewInstance(Value klass);
+    // Method of the receiver of the call site from its inline cache or the
+    // method cache, nullptr if they miss
+    FunctionObject* CachedMethod(const CallSite& site, Value object) {
+        if (!IsObjectOf(object, ObjectKind::Instance))
+            return nullptr;
+        ClassObject* klass = static_cast<InstanceObject*>(object.AsObject())->klass;
+        switch (site.state) {
+            case CallSite::Monomorphic:
+                if (site.classes[0] != klass)
+                    return nullptr;
+                stats_.monomorphicHits++;
+                return site.methods[0];
+            case CallSite::Polymorphic:
+                for (int n = 0; n < site.count; n++) {
+                    if (site.classes[n] == klass) {
+                        stats_.polymorphicHits++;
+                        return site.methods[n];
+                    }
+                }
+                return nullptr;
+            case CallSite::Megamorphic: {
+                auto& entry = methodCache_[MethodCacheIndex(klass, site.selector)];
+                if (entry.klass != klass || entry.selector != site.selector)
+                    return nullptr;
+                stats_.megamorphicHits++;
+                return entry.method;
+            }
+            default:
+                return nullptr;
+        }
+    }
+    // Method of the receiver of the call site whose caches missed, they are
+    // updated
+    FunctionObject* LookupMethod(CallSite& site, const Value* constants, Value object);
+    static size_t MethodCacheIndex(const ClassObject* klass, int selector) {
+        uint32_t hash = klass->id * 0x9e3779b1u + static_cast<uint32_t>(selector) * 0x85ebca77u;
+        return hash >> (32 - kMethodCacheBits);
+    }
+
+private:
+    Program& program_;
+    Dispatch dispatch_;
+    std::vector<Value> stack_;
+    std::vector<Frame> frames_;
+    std::string error_;
+    uint64_t instructions_;
+    DispatchStats stats_;
+    std::vector<MethodCacheEntry> methodCache_;
+};
+
+} // namespace zl
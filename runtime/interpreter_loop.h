@@ -0,0 +1,419 @@
+// The body of the dispatch loops of Interpreter, it is included by
+// interpreter.cc once for each dispatch with these macros defined:
+//
+//   ZL_VM_LOOP_BEGIN  start the loop and dispatch the first instruction
+//   ZL_VM_LOOP_END    end the loop
+//   ZL_VM_CASE(name)  start the handler of OpCode::name
+//   ZL_VM_DISPATCH()  fetch the next instruction into i and run its handler
+//
+// The handlers read i, pc, R (registers of the frame) and K (constants of
+// the function), and update count. Instructions which may allocate save pc
+// in the frame first, the collector finds the live registers from it.
+
+    Frame* frame = &frames_.back();
+    Value* R = frame->base;
+    const Value* K = frame->function->constants.data();
+    const Instruction* pc = frame->pc;
+    uint64_t count = 0;
+    Instruction i;
+
+#define ZL_VM_LOAD_FRAME()                             \
+    do {                                               \
+        frame = &frames_.back();                       \
+        R = frame->base;                               \
+        K = frame->function->constants.data();         \
+        pc = frame->pc;                                \
+    } while (0)
+
+#define ZL_VM_ARITHMETIC(name, op)                                                \
+    ZL_VM_CASE(name) {                                                            \
+        Value b = R[GetB(i)];                                                     \
+        Value c = R[GetC(i)];                                                     \
+        if (Value::BothInt(b, c))                                                 \
+            R[GetA(i)] = Value::Int(static_cast<int32_t>(                         \
+                static_cast<uint32_t>(b.AsInt()) op static_cast<uint32_t>(c.AsInt()))); \
+        else if (b.IsDouble() && c.IsDouble())                                    \
+            R[GetA(i)] = Value::Double(b.AsDouble() op c.AsDouble());             \
+        else {                                                                    \
+            frame->pc = pc;                                                       \
+            R[GetA(i)] = Arithmetic(OpCode::name, b, c);                          \
+        }                                                                         \
+        ZL_VM_DISPATCH();                                                         \
+    }
+
+#define ZL_VM_BITWISE(name, op)                                                   \
+    ZL_VM_CASE(name) {                                                            \
+        Value b = R[GetB(i)];                                                     \
+        Value c = R[GetC(i)];                                                     \
+        if (Value::BothInt(b, c))                                                 \
+            R[GetA(i)] = Value::Int(b.AsInt() op c.AsInt());                      \
+        else                                                                      \
+            R[GetA(i)] = Arithmetic(OpCode::name, b, c);                          \
+        ZL_VM_DISPATCH();                                                         \
+    }
+
+#define ZL_VM_SLOW_ARITHMETIC(name)                                               \
+    ZL_VM_CASE(name) {                                                            \
+        R[GetA(i)] = Arithmetic(OpCode::name, R[GetB(i)], R[GetC(i)]);           \
+        ZL_VM_DISPATCH();                                                         \
+    }
+
+#define ZL_VM_COMPARE(name, test, op, orEqual)                                    \
+    ZL_VM_CASE(name) {                                                            \
+        Value b = R[GetB(i)];                                                     \
+        Value c = R[GetC(i)];                                                     \
+        bool result = Value::BothInt(b, c) ? b.AsInt() op c.AsInt() : LessThan(b, c, orEqual); \
+        R[GetA(i)] = Value::Bool(result);                                         \
+        ZL_VM_DISPATCH();                                                         \
+    }                                                                             \
+    ZL_VM_CASE(test) {                                                            \
+        Value b = R[GetB(i)];                                                     \
+        Value c = R[GetC(i)];                                                     \
+        bool result = Value::BothInt(b, c) ? b.AsInt() op c.AsInt() : LessThan(b, c, orEqual); \
+        if (result != (GetA(i) != 0))                                             \
+            pc++;                                                                 \
+        ZL_VM_DISPATCH();                                                         \
+    }
+
+    // The loop is entered again at the handler of a runtime error
+    for (;;) try {
+        ZL_VM_LOOP_BEGIN
+
+        ZL_VM_CASE(Move) {
+            R[GetA(i)] = R[GetB(i)];
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(LoadK) {
+            R[GetA(i)] = K[GetBx(i)];
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(LoadInt) {
+            R[GetA(i)] = Value::Int(GetsBx(i));
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(LoadNil) {
+            R[GetA(i)] = Value::Nil();
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(LoadBool) {
+            R[GetA(i)] = Value::Bool(GetB(i) != 0);
+            if (GetC(i))
+                pc++;
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(GetGlobal) {
+            R[GetA(i)] = program_.globals[GetBx(i)];
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(SetGlobal) {
+            program_.globals[GetBx(i)] = R[GetA(i)];
+            ZL_VM_DISPATCH();
+        }
+
+        ZL_VM_ARITHMETIC(Add, +)
+        ZL_VM_ARITHMETIC(Sub, -)
+        ZL_VM_ARITHMETIC(Mul, *)
+        ZL_VM_SLOW_ARITHMETIC(Div)
+        ZL_VM_SLOW_ARITHMETIC(Mod)
+        ZL_VM_BITWISE(BitAnd, &)
+        ZL_VM_BITWISE(BitOr, |)
+        ZL_VM_BITWISE(BitXor, ^)
+        ZL_VM_SLOW_ARITHMETIC(Shl)
+        ZL_VM_SLOW_ARITHMETIC(Shr)
+
+        ZL_VM_CASE(AddInt) {
+            Value b = R[GetB(i)];
+            if (b.IsInt())
+                R[GetA(i)] = Value::Int(static_cast<int32_t>(
+                    static_cast<uint32_t>(b.AsInt()) + static_cast<uint32_t>(GetsC(i))));
+            else {
+                frame->pc = pc;
+                R[GetA(i)] = Arithmetic(OpCode::Add, b, Value::Int(GetsC(i)));
+            }
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Neg) {
+            Value b = R[GetB(i)];
+            if (b.IsInt())
+                R[GetA(i)] = Value::Int(static_cast<int32_t>(0u - static_cast<uint32_t>(b.AsInt())));
+            else if (b.IsDouble())
+                R[GetA(i)] = Value::Double(-b.AsDouble());
+            else
+                throw RuntimeError("invalid operand " + TypeNameOf(b) + " of -");
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Not) {
+            R[GetA(i)] = Value::Bool(!R[GetB(i)].IsTruthy());
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(ToInt) {
+            Value b = R[GetB(i)];
+            R[GetA(i)] = b.IsDouble() ? Value::Int(b.ToInt()) : b;
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(ToDouble) {
+            Value b = R[GetB(i)];
+            R[GetA(i)] = b.IsInt() ? Value::Double(b.AsInt()) : b;
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Eq) {
+            R[GetA(i)] = Value::Bool(ValuesEqual(R[GetB(i)], R[GetC(i)]));
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_COMPARE(Lt, TestLt, <, false)
+        ZL_VM_COMPARE(Le, TestLe, <=, true)
+        ZL_VM_CASE(TestEq) {
+            Value b = R[GetB(i)];
+            Value c = R[GetC(i)];
+            bool result = b == c || ValuesEqual(b, c);
+            if (result != (GetA(i) != 0))
+                pc++;
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Test) {
+            if (R[GetA(i)].IsTruthy() != (GetC(i) != 0))
+                pc++;
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Jmp) {
+            pc += GetsJ(i);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Switch) {
+            pc += frame->function->switches[GetBx(i)].Target(R[GetA(i)]);
+            ZL_VM_DISPATCH();
+        }
+
+        ZL_VM_CASE(Call) {
+            frame->pc = pc;
+            if (EnterCall(R + GetA(i), GetB(i), GetC(i)))
+                ZL_VM_LOAD_FRAME();
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Return) {
+            int a = GetA(i);
+            int b = GetB(i);
+            // The results are copied down over the callee slot, the source
+            // is always above the destination
+            Value* results = R - 1;
+            for (int n = 0; n < frame->numResults; n++)
+                results[n] = n < b ? R[a + n] : Value::Nil();
+            frames_.pop_back();
+            if (frames_.size() == entryDepth) {
+                instructions_ += count;
+                return true;
+            }
+            ZL_VM_LOAD_FRAME();
+            ZL_VM_DISPATCH();
+        }
+
+        ZL_VM_CASE(GetField) {
+            Value object = R[GetB(i)];
+            if (!IsObjectOf(object, ObjectKind::Instance))
+                throw RuntimeError("field access on " + TypeNameOf(object));
+            R[GetA(i)] = static_cast<InstanceObject*>(object.AsObject())->Fields()[GetC(i)];
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(SetField) {
+            Value object = R[GetA(i)];
+            if (!IsObjectOf(object, ObjectKind::Instance))
+                throw RuntimeError("field access on " + TypeNameOf(object));
+            static_cast<InstanceObject*>(object.AsObject())->Fields()[GetB(i)] = R[GetC(i)];
+            program_.heap.WriteBarrier(object.AsObject(), R[GetC(i)]);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(GetFieldK) {
+            auto name = static_cast<StringObject*>(K[GetC(i)].AsObject());
+            R[GetA(i)] = GetField(R[GetB(i)], name->ToString());
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(SetFieldK) {
+            auto name = static_cast<StringObject*>(K[GetB(i)].AsObject());
+            SetField(R[GetA(i)], name->ToString(), R[GetC(i)]);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Self) {
+            Value object = R[GetA(i) + 1];
+            CallSite& site = frame->function->callSites[GetBx(i)];
+            FunctionObject* method = CachedMethod(site, object);
+            if (!method)
+                method = LookupMethod(site, K, object);
+            R[GetA(i)] = Value::FromObject(method);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(New) {
+            frame->pc = pc;
+            R[GetA(i)] = NewInstance(K[GetBx(i)]);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(NewArray) {
+            frame->pc = pc;
+            auto array = program_.heap.NewArray();
+            array->elements.assign(R + GetB(i), R + GetB(i) + GetC(i));
+            R[GetA(i)] = Value::FromObject(array);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(NewMap) {
+            frame->pc = pc;
+            auto map = program_.heap.NewMap();
+            Value* entries = R + GetB(i);
+            for (int n = 0; n < GetC(i); n++)
+                map->Set(entries[2 * n], entries[2 * n + 1]);
+            R[GetA(i)] = Value::FromObject(map);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(GetIndex) {
+            Value object = R[GetB(i)];
+            Value index = R[GetC(i)];
+            if (IsObjectOf(object, ObjectKind::Array) && index.IsInt() &&
+                    static_cast<uint32_t>(index.AsInt()) <
+                    static_cast<ArrayObject*>(object.AsObject())->elements.size())
+                R[GetA(i)] = static_cast<ArrayObject*>(object.AsObject())->elements[index.AsInt()];
+            else
+                R[GetA(i)] = GetIndex(object, index);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(OrZero) {
+            if (R[GetA(i)].IsNil())
+                R[GetA(i)] = K[GetBx(i)];
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(SetIndex) {
+            SetIndex(R[GetA(i)], R[GetB(i)], R[GetC(i)]);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(ForPrep) {
+            Value* r = R + GetA(i);
+            if (!IsObjectOf(r[0], ObjectKind::Array) && !IsObjectOf(r[0], ObjectKind::Map))
+                throw RuntimeError("foreach over " + TypeNameOf(r[0]));
+            r[1] = Value::Int(0);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(ForNext) {
+            Value* r = R + GetA(i);
+            int32_t position = r[1].AsInt();
+            Object* object = r[0].AsObject();
+            if (object->kind == ObjectKind::Array) {
+                auto& elements = static_cast<ArrayObject*>(object)->elements;
+                if (static_cast<size_t>(position) < elements.size()) {
+                    r[2] = Value::Int(position);
+                    r[3] = elements[position];
+                } else {
+                    pc += GetsBx(i);
+                }
+            } else {
+                auto& entries = static_cast<MapObject*>(object)->Entries();
+                if (static_cast<size_t>(position) < entries.size()) {
+                    r[2] = entries[position].first;
+                    r[3] = entries[position].second;
+                } else {
+                    pc += GetsBx(i);
+                }
+            }
+            r[1] = Value::Int(position + 1);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(ForNext1) {
+            Value* r = R + GetA(i);
+            int32_t position = r[1].AsInt();
+            Object* object = r[0].AsObject();
+            if (object->kind == ObjectKind::Array) {
+                auto& elements = static_cast<ArrayObject*>(object)->elements;
+                if (static_cast<size_t>(position) < elements.size())
+                    r[2] = elements[position];
+                else
+                    pc += GetsBx(i);
+            } else {
+                auto& entries = static_cast<MapObject*>(object)->Entries();
+                if (static_cast<size_t>(position) < entries.size())
+                    r[2] = entries[position].first;
+                else
+                    pc += GetsBx(i);
+            }
+            r[1] = Value::Int(position + 1);
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Assert) {
+            if (!R[GetA(i)].IsTruthy())
+                throw RuntimeError("assertion failed");
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(DeferPush) {
+            // A record is its values followed by their count
+            if (R[GetA(i)].IsNil()) {
+                frame->pc = pc;
+                R[GetA(i)] = Value::FromObject(program_.heap.NewArray());
+            }
+            auto stack = static_cast<ArrayObject*>(R[GetA(i)].AsObject());
+            Value* values = R + GetB(i);
+            for (int n = 0; n < GetC(i); n++) {
+                stack->elements.push_back(values[n]);
+                program_.heap.WriteBarrier(stack, values[n]);
+            }
+            stack->elements.push_back(Value::Int(GetC(i)));
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(DeferPop) {
+            Value object = R[GetB(i)];
+            if (!object.IsNil()) {
+                auto& elements = static_cast<ArrayObject*>(object.AsObject())->elements;
+                if (!elements.empty()) {
+                    size_t first = elements.size() - 1 - elements.back().AsInt();
+                    int count = std::min(elements.back().AsInt(), GetC(i));
+                    std::copy(elements.begin() + first, elements.begin() + first + count, R + GetA(i));
+                    elements.resize(first);
+                    pc++;
+                }
+            }
+            ZL_VM_DISPATCH();
+        }
+        ZL_VM_CASE(Throw) {
+            frame->pc = pc;
+            Value exception = R[GetA(i)];
+            ThrowSite site = {frame->function, static_cast<uint32_t>(pc - frame->function->code.data() - 1), false};
+            if (GetC(i)) {
+                site.function = static_cast<FunctionObject*>(R[GetA(i) + 1].AsObject());
+                site.offset = static_cast<uint32_t>(R[GetA(i) + 2].AsInt()) / 2;
+                site.runtimeError = R[GetA(i) + 2].AsInt() & 1;
+            }
+            if (!Unwind(exception, site, entryDepth)) {
+                // A runtime error is thrown again as its message
+                throw UncaughtException(site.runtimeError ? ValueToString(exception) :
+                    "uncaught exception " + ValueToString(exception), site.function, site.offset);
+            }
+            ZL_VM_LOAD_FRAME();
+            ZL_VM_DISPATCH();
+        }
+
+        ZL_VM_LOOP_END
+    } catch (RuntimeError& e) {
+        // A runtime error is thrown as its message
+        frame->pc = pc;
+        auto function = frame->function;
+        size_t offset = pc - function->code.data();
+        auto uncaught = dynamic_cast<UncaughtException*>(&e);
+        if (!uncaught) {
+            ThrowSite site = {function, static_cast<uint32_t>(offset - 1), true};
+            if (auto handler = Unwind(Value::Nil(), site, entryDepth)) {
+                ZL_VM_LOAD_FRAME();
+                // The collector sees the frame at the handler, a safe point
+                frame->pc = pc + 1;
+                R[handler->reg] = Value::FromObject(program_.heap.NewString(e.what()));
+                continue;
+            }
+        } else {
+            function = uncaught->function;
+            offset = uncaught->offset + 1;
+        }
+        int line = offset > 0 && offset <= function->lines.size() ? function->lines[offset - 1] : 0;
+        SetError(function->name + ":" + std::to_string(line) + ": " + e.what());
+        frames_.resize(entryDepth);
+        instructions_ += count;
+        return false;
+    }
+
+#undef ZL_VM_LOAD_FRAME
+#undef ZL_VM_ARITHMETIC
+#undef ZL_VM_BITWISE
+#undef ZL_VM_SLOW_ARITHMETIC
+#undef ZL_VM_COMPARE
@@ -0,0 +1,188 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "object.h"
+
+namespace zl {
+
+StringObject::StringObject(const char* data, size_t size)
+    : Object(ObjectKind::String), size(static_cast<uint32_t>(size)), form(Inline), interned(false),
+      hashed(false), hash(0) {
+    char* target = bytes;
+    if (size > kInlineSize) {
+        form = Buffer;
+        buffer = static_cast<char*>(malloc(size + 1));
+        target = buffer;
+    }
+    memcpy(target, data, size);
+    target[size] = '\0';
+}
+
+StringObject::StringObject(Value left, Value right)
+    : Object(ObjectKind::String), form(Rope), interned(false), hashed(false), hash(0) {
+    size = static_cast<uint32_t>(static_cast<StringObject*>(left.AsObject())->size +
+        static_cast<StringObject*>(right.AsObject())->size);
+    sides[0] = left;
+    sides[1] = right;
+}
+
+StringObject::StringObject(StringObject&& other)
+    : Object(other), size(other.size), form(other.form), interned(other.interned),
+      hashed(other.hashed), hash(other.hash) {
+    memcpy(bytes, other.bytes, sizeof(bytes));
+    // The buffer now belongs to the copy
+    if (other.form == Buffer)
+        other.form = Inline;
+}
+
+void StringObject::Flatten() const {
+    auto self = const_cast<StringObject*>(this);
+    char* target = static_cast<char*>(malloc(size + 1));
+    target[size] = '\0';
+    // The leaves are copied from the last one, the right side is visited
+    // first and ropes built by appending in a loop, which are deep on the
+    // left, keep the stack at two nodes
+    size_t end = size;
+    std::vector<StringObject*> pending{self};
+    while (!pending.empty()) {
+        StringObject* node = pending.back();
+        pending.pop_back();
+        if (node->form == Rope) {
+            pending.push_back(static_cast<StringObject*>(node->sides[0].AsObject()));
+            pending.push_back(static_cast<StringObject*>(node->sides[1].AsObject()));
+        } else {
+            end -= node->size;
+            memcpy(target + end, node->form == Inline ? node->bytes : node->buffer, node->size);
+        }
+    }
+    self->form = Buffer;
+    self->buffer = target;
+}
+
+bool ValuesEqual(Value a, Value b) {
+    if (a == b)
+        return true;
+    if (a.IsNumber() && b.IsNumber())
+        return a.ToDouble() == b.ToDouble();
+    if (IsObjectOf(a, ObjectKind::String) && IsObjectOf(b, ObjectKind::String)) {
+        auto x = static_cast<StringObject*>(a.AsObject());
+        auto y = static_cast<StringObject*>(b.AsObject());
+        // Interned strings of the same content are the same object
+        if (x->size != y->size || (x->interned && y->interned))
+            return false;
+        if (x->hashed && y->hashed && x->hash != y->hash)
+            return false;
+        return memcmp(x->Data(), y->Data(), x->size) == 0;
+    }
+    return false;
+}
+
+size_t HashValue(Value value) {
+    // Integral doubles hash as int since they are equal keys
+    if (value.IsDouble()) {
+        double number = value.AsDouble();
+        // The cast is only defined for numbers in the range of int32
+        if (number >= INT32_MIN && number <= INT32_MAX && number == static_cast<int32_t>(number))
+            value = Value::Int(static_cast<int32_t>(number));
+    }
+    if (IsObjectOf(value, ObjectKind::String))
+        return static_cast<StringObject*>(value.AsObject())->Hash();
+    // Objects may move, their hash is the identity kept in the header
+    uint64_t bits = value.IsObject() ? value.AsObject()->identity : value.Bits();
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return static_cast<size_t>(bits);
+}
+
+int32_t SwitchTable::SlowTarget(Value value) const {
+    if (kind != String) {
+        // Numbers equal by value are the same case
+        if (!value.IsDouble())
+            return defaultTarget;
+        double number = value.AsDouble();
+        if (!(number >= INT32_MIN && number <= INT32_MAX) || number != static_cast<int32_t>(number))
+            return defaultTarget;
+        return Target(Value::Int(static_cast<int32_t>(number)));
+    }
+    if (!IsObjectOf(value, ObjectKind::String) || strings.empty())
+        return defaultTarget;
+    size_t hash = static_cast<StringObject*>(value.AsObject())->Hash();
+    size_t mask = strings.size() - 1;
+    int32_t seed = seeds[Slot(hash, 0, mask)];
+    size_t slot = seed < 0 ? static_cast<size_t>(-seed - 1) : Slot(hash, seed, mask);
+    return ValuesEqual(value, strings[slot]) ? targets[slot] : defaultTarget;
+}
+
+std::string ValueToString(Value value) {
+    if (value.IsNil())
+        return "nil";
+    if (value.IsBool())
+        return value.AsBool() ? "true" : "false";
+    if (value.IsInt())
+        return std::to_string(value.AsInt());
+    if (value.IsDouble()) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.14g", value.AsDouble());
+        return text;
+    }
+    Object* object = value.AsObject();
+    switch (object->kind) {
+        case ObjectKind::String:
+            return static_cast<StringObject*>(object)->ToString();
+        case ObjectKind::Array: {
+            std::string text = "[";
+            auto& elements = static_cast<ArrayObject*>(object)->elements;
+            for (size_t i = 0; i < elements.size(); i++)
+                text += (i ? ", " : "") + ValueToString(elements[i]);
+            return text + "]";
+        }
+        case ObjectKind::Map: {
+            std::string text = "{";
+            auto& entries = static_cast<MapObject*>(object)->Entries();
+            for (size_t i = 0; i < entries.size(); i++)
+                text += (i ? ", " : "") + ValueToString(entries[i].first) + ": " +
+                    ValueToString(entries[i].second);
+            return text + "}";
+        }
+        case ObjectKind::Instance:
+            return "<" + static_cast<InstanceObject*>(object)->klass->name + ">";
+        case ObjectKind::Class:
+            return "<class " + static_cast<ClassObject*>(object)->name + ">";
+        case ObjectKind::Function:
+            return "<func " + static_cast<FunctionObject*>(object)->name + ">";
+        case ObjectKind::Native:
+            return "<native " + static_cast<NativeObject*>(object)->name + ">";
+    }
+    return "";
+}
+
+std::string TypeNameOf(Value value) {
+    if (value.IsNil())
+        return "nil";
+    if (value.IsBool())
+        return "bool";
+    if (value.IsInt())
+        return "int";
+    if (value.IsDouble())
+        return "float";
+    switch (value.AsObject()->kind) {
+        case ObjectKind::String:
+            return "string";
+        case ObjectKind::Array:
+            return "array";
+        case ObjectKind::Map:
+            return "map";
+        case ObjectKind::Instance:
+            return static_cast<InstanceObject*>(value.AsObject())->klass->name;
+        case ObjectKind::Class:
+            return "class";
+        case ObjectKind::Function:
+        case ObjectKind::Native:
+            return "function";
+    }
+    return "";
+}
+
+} // namespace zl
@@ -0,0 +1,378 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "flat_map.h"
+#include "value.h"
+
+namespace zl {
+
+enum class ObjectKind : uint8_t {
+    String,
+    Array,
+    Map,
+    Instance,
+    Class,
+    Function,
+    Native,
+};
+
+// Space of the heap holding an object, see heap.h
+enum class Space : uint8_t {
+    Permanent,
+    Young,
+    Old,
+    Large,
+    // A young object moved by the collector, see Object::forward
+    Forwarded,
+};
+
+// Object is the header of all heap objects of the interpreter
+struct Object {
+    explicit Object(ObjectKind kind)
+        : kind(kind), space(Space::Permanent), remembered(false), mark(0), identity(0),
+          forward(nullptr) {}
+    // The collector moves objects with the move constructor of their kind,
+    // the copy keeps the kind, the space and the identity
+    Object(const Object& other)
+        : kind(other.kind), space(other.space), remembered(false), mark(0),
+          identity(other.identity), forward(nullptr) {}
+    ObjectKind kind;
+    Space space;
+    // Set while the object is in the remembered set of the heap
+    bool remembered;
+    // Set by the marking of major collections, which runs on several threads
+    std::atomic<uint8_t> mark;
+    // Hash of the object identity, it does not change when the object moves
+    uint32_t identity;
+    // New address of a young object moved by the collector
+    Object* forward;
+};
+
+// RuntimeError is thrown by the interpreter and native functions, it is
+// reported with the line of the failing instruction
+class RuntimeError : public std::runtime_error {
+public:
+    explicit RuntimeError(const std::string& msg): std::runtime_error(msg) {}
+};
+
+// StringObject is an immutable string of UTF-8 bytes. Strings of at most
+// kInlineSize bytes are kept in the object, longer ones in a buffer of their
+// own. A concatenation of longer strings is a rope referencing both sides,
+// it is flattened into a buffer the first time its bytes are read and drops
+// its sides, so that strings built by repeated concatenation are copied
+// once. The hash is computed on first use, interned strings are the only
+// ones of their content, see Heap::Intern.
+struct StringObject : Object {
+    static const size_t kInlineSize = 22;
+    enum Form : uint8_t {
+        Inline,
+        Buffer,
+        Rope,
+    };
+
+    StringObject(const char* data, size_t size);
+    // Rope of two strings
+    StringObject(Value left, Value right);
+    StringObject(StringObject&& other);
+    ~StringObject() {
+        if (form == Buffer)
+            free(buffer);
+    }
+
+    size_t Size() const { return size; }
+    const char* Data() const {
+        if (form == Rope)
+            Flatten();
+        return form == Inline ? bytes : buffer;
+    }
+    std::string_view View() const { return std::string_view(Data(), size); }
+    std::string ToString() const { return std::string(Data(), size); }
+    size_t Hash() const {
+        if (!hashed) {
+            hash = std::hash<std::string_view>()(View());
+            hashed = true;
+        }
+        return hash;
+    }
+    // Return the sides of a rope, they are strings
+    Value* Sides() { return sides; }
+
+    uint32_t size;
+    Form form;
+    bool interned;
+    mutable bool hashed;
+    mutable size_t hash;
+    union {
+        // Nul terminated bytes of an inline string
+        char bytes[kInlineSize + 2];
+        char* buffer;
+        Value sides[2];
+    };
+
+private:
+    StringObject(const StringObject&) = delete;
+    StringObject& operator = (const StringObject&) = delete;
+
+    // Copy the bytes of the rope into a buffer, the rope becomes a buffer
+    void Flatten() const;
+};
+
+struct ArrayObject : Object {
+    ArrayObject(): Object(ObjectKind::Array), readOnly(false) {}
+    std::vector<Value> elements;
+    // Set for the permanent arrays of constants, stores into them throw
+    bool readOnly;
+};
+
+// Equality and hash of map keys, numbers are equal by value and strings by
+// content, other objects by identity
+bool ValuesEqual(Value a, Value b);
+size_t HashValue(Value value);
+
+struct ValueKeyTraits {
+    // Keys may be moved by the collector, the table keeps their position
+    static const bool kInlineKey = false;
+    static uint64_t Hash(Value key) { return MixHash(HashValue(key)); }
+    static bool Equal(Value a, Value b) { return ValuesEqual(a, b); }
+};
+
+// MapObject keep its entries in insertion order, so that foreach visit them
+// by position without an iterator object
+struct MapObject : Object {
+    MapObject(): Object(ObjectKind::Map), readOnly(false) {}
+    // Return the value of key, nil if it is absent
+    Value Get(Value key) const {
+        const Value* value = table.Find(key);
+        return value ? *value : Value::Nil();
+    }
+    void Set(Value key, Value value) { table.Insert(key, value); }
+    std::vector<std::pair<Value, Value>>& Entries() { return table.Entries(); }
+    FlatMap<Value, Value, ValueKeyTraits> table;
+    // Set for the permanent maps of constants, stores into them throw
+    bool readOnly;
+};
+
+// An instruction of the bytecode, see bytecode.h
+typedef uint32_t Instruction;
+
+struct ClassObject;
+struct FunctionObject;
+
+// CallSite is a method call of a function with its inline cache, the Self
+// instruction names it by index. The cache holds the classes of the
+// receivers seen at the site and their method: one while the site is
+// monomorphic, up to kPolymorphicEntries while it is polymorphic. A site
+// which saw more classes is megamorphic, its methods are looked up in the
+// method cache of the interpreter.
+struct CallSite {
+    static const int kPolymorphicEntries = 4;
+    enum State : uint8_t {
+        Uninitialized,
+        Monomorphic,
+        Polymorphic,
+        Megamorphic,
+    };
+    // Constant holding the name of the method
+    int name = 0;
+    // Number of the name of the method among all method names
+    int selector = 0;
+    // Interface of the declared type of the receiver and index of the
+    // method in its itable, -1 if the type is not an interface
+    int interface = -1;
+    int slot = -1;
+    State state = Uninitialized;
+    uint8_t count = 0;
+    ClassObject* classes[kPolymorphicEntries] = {};
+    FunctionObject* methods[kPolymorphicEntries] = {};
+};
+
+// ExceptionHandler is an entry of the exception table of a function, an
+// exception thrown by an instruction it covers and of a type it catches
+// goes on at its target. Entries of inner try statements come first.
+struct ExceptionHandler {
+    // Instructions covered, end excluded
+    uint32_t start = 0;
+    uint32_t end = 0;
+    uint32_t target = 0;
+    // Register given the exception
+    int reg = 0;
+    // The handler catches instances of klass or of the classes implementing
+    // the interface, or values of the named type as TypeNameOf gives it. It
+    // catches all exceptions if none is set, for finally.
+    ClassObject* klass = nullptr;
+    int interface = -1;
+    std::string type;
+    // The handler throws the exception again, the function and the offset
+    // of the instruction which first threw it are given in the two
+    // registers after it so that it is reported there
+    bool rethrows = false;
+
+    int NumRegisters() const { return rethrows ? 3 : 1; }
+};
+
+// SwitchTable is the dispatch of a switch statement on constant integers or
+// strings, the Switch instruction jumps to the target of the case equal to
+// its value or to the default target. Targets are offsets from the
+// instruction after the Switch. The case is found by the kind of table:
+//
+// - Dense: the targets are indexed by the value minus low, the values
+//   between the cases have the default target.
+// - Sparse: the value is searched in the sorted integers.
+// - String: a perfect hash of the hash of the string gives the only slot
+//   whose string may be equal, it is compared once. The seed of the bucket
+//   of the hash places the strings of the bucket, a negative seed is the
+//   slot of the only string of its bucket.
+struct SwitchTable {
+    enum Kind : uint8_t {
+        Dense,
+        Sparse,
+        String,
+    };
+
+    // Slot of the hash for the seed, in a table of mask + 1 slots
+    static size_t Slot(size_t hash, int32_t seed, size_t mask) {
+        return MixHash(hash + static_cast<uint64_t>(seed) * 0x9e3779b97f4a7c15ull) & mask;
+    }
+
+    // Return the offset of the target of the value
+    int32_t Target(Value value) const {
+        if (kind == String || !value.IsInt())
+            return SlowTarget(value);
+        int32_t number = value.AsInt();
+        if (kind == Dense) {
+            uint32_t index = static_cast<uint32_t>(number) - static_cast<uint32_t>(low);
+            return index < targets.size() ? targets[index] : defaultTarget;
+        }
+        auto iter = std::lower_bound(integers.begin(), integers.end(), number);
+        if (iter == integers.end() || *iter != number)
+            return defaultTarget;
+        return targets[iter - integers.begin()];
+    }
+
+    Kind kind = Dense;
+    // First value of a dense table
+    int32_t low = 0;
+    // Values of a sparse table in increasing order
+    std::vector<int32_t> integers;
+    // Seed of each bucket and string of each slot of a string table, nil
+    // for free slots, their number is a power of two
+    std::vector<int32_t> seeds;
+    std::vector<Value> strings;
+    // Target of each value, integer or slot
+    std::vector<int32_t> targets;
+    int32_t defaultTarget = 0;
+
+private:
+    // Strings, and doubles equal to an integer
+    int32_t SlowTarget(Value value) const;
+};
+
+// FunctionObject is a compiled function or method. Parameters are in the
+// first registers, the receiver of a method is register 0.
+struct FunctionObject : Object {
+    explicit FunctionObject(const std::string& name)
+        : Object(ObjectKind::Function), name(name), numParams(0), numRegisters(0),
+          numResults(0), owner(nullptr), liveWords(0), clearRegisters(true) {}
+    std::string name;
+    int numParams;
+    int numRegisters;
+    int numResults;
+    std::vector<Instruction> code;
+    // Source line of each instruction
+    std::vector<int> lines;
+    // Constant pool of the function
+    std::vector<Value> constants;
+    // Method calls of the function
+    std::vector<CallSite> callSites;
+    // Exception table, nothing is run on entering a try
+    std::vector<ExceptionHandler> handlers;
+    // Tables of the Switch instructions
+    std::vector<SwitchTable> switches;
+    // Class of a method, nullptr for functions
+    ClassObject* owner;
+    // Stack map, the offsets of the instructions which may collect garbage
+    // in increasing order and the registers live at each of them, a bit per
+    // register in liveWords words per safe point. See BuildStackMap.
+    std::vector<uint32_t> safePoints;
+    std::vector<uint64_t> liveRegisters;
+    int liveWords;
+    // Set if registers other than parameters may be read before they are
+    // written, they are cleared when the function is entered
+    bool clearRegisters;
+};
+
+struct ClassObject : Object {
+    explicit ClassObject(const std::string& name)
+        : Object(ObjectKind::Class), name(name), id(0), constructor(nullptr) {}
+    // Return the index of the field, -1 if there is no such field
+    int FieldIndex(const std::string& field) const {
+        auto iter = fieldIndex.find(field);
+        return iter == fieldIndex.end() ? -1 : iter->second;
+    }
+    FunctionObject* Method(const std::string& method) const {
+        auto iter = methods.find(method);
+        return iter == methods.end() ? nullptr : iter->second;
+    }
+    // Return the method at slot of the itable of the interface, nullptr if
+    // the class does not implement it
+    FunctionObject* InterfaceMethod(int interface, int slot) const {
+        if (interface < 0 || static_cast<size_t>(interface) >= itables.size() || itables[interface].empty())
+            return nullptr;
+        return itables[interface][slot];
+    }
+    std::string name;
+    // Index of the class in the program
+    uint32_t id;
+    std::vector<std::string> fieldNames;
+    // Zero value of each field by its declared type
+    std::vector<Value> fieldDefaults;
+    std::unordered_map<std::string, int> fieldIndex;
+    std::unordered_map<std::string, FunctionObject*> methods;
+    // Itable of each interface of the program by its index, the methods in
+    // the order of the interface, empty for interfaces not implemented
+    std::vector<std::vector<FunctionObject*>> itables;
+    FunctionObject* constructor;
+};
+
+// InstanceObject is followed by the values of its fields
+struct InstanceObject : Object {
+    explicit InstanceObject(ClassObject* klass)
+        : Object(ObjectKind::Instance), klass(klass),
+          fieldCount(static_cast<uint32_t>(klass->fieldDefaults.size())) {}
+    Value* Fields() { return reinterpret_cast<Value*>(this + 1); }
+    ClassObject* klass;
+    uint32_t fieldCount;
+};
+
+class Heap;
+
+// A native function returns its result or throws RuntimeError
+typedef Value (*NativeFunction)(Heap& heap, Value* args, int count);
+
+struct NativeObject : Object {
+    NativeObject(const std::string& name, NativeFunction function, int arity)
+        : Object(ObjectKind::Native), name(name), function(function), arity(arity) {}
+    std::string name;
+    NativeFunction function;
+    // Number of arguments, -1 for any number
+    int arity;
+};
+
+// Return the value as it is printed, strings are not quoted
+std::string ValueToString(Value value);
+// Return the type name of the value for messages, such as "int" or "Point"
+std::string TypeNameOf(Value value);
+
+inline bool IsObjectOf(Value value, ObjectKind kind) {
+    return value.IsObject() && value.AsObject()->kind == kind;
+}
+
+} // namespace zl
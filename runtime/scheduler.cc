@@ -0,0 +1,590 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <new>
+#if defined(__x86_64__) && defined(__ELF__)
+#define ZL_CONTEXT_ASM 1
+#else
+#include <ucontext.h>
+#endif
+#include "scheduler.h"
+#include "work_deque.h"
+
+namespace zl {
+
+namespace {
+
+// Context is the suspended registers of a coroutine or a worker
+#ifdef ZL_CONTEXT_ASM
+struct Context {
+    // The callee-saved registers are pushed on the stack, then its top is
+    // saved here
+    void* sp = nullptr;
+};
+#else
+struct Context {
+    ucontext_t context;
+};
+#endif
+
+} // namespace
+
+// Coroutine is a function with its stack, see Scheduler
+struct Coroutine {
+    // State tells if the coroutine is parked. Notified is Running with an
+    // Unpark to consume by the next Park.
+    enum State {
+        Running,
+        Notified,
+        Parking,
+        Parked,
+    };
+    // Why the coroutine switched back to its worker
+    enum class Switch {
+        Yield,
+        Park,
+        Return,
+    };
+
+    Context context;
+    Scheduler* scheduler = nullptr;
+    std::function<void()> function;
+    // The mapping of the stack, its lowest page is the guard
+    char* stack = nullptr;
+    size_t stackSize = 0;
+    std::atomic<int> state{Running};
+    Switch reason = Switch::Return;
+    std::exception_ptr error;
+};
+
+} // namespace zl
+
+namespace {
+
+// The scheduler and worker of the current thread, see ThreadPool
+thread_local zl::Scheduler* currentScheduler = nullptr;
+thread_local size_t currentWorker = 0;
+thread_local zl::Coroutine* currentCoroutine = nullptr;
+thread_local zl::Context* workerContext = nullptr;
+
+// A coroutine may resume on another thread than it was suspended on, the
+// thread locals are read through calls which the compiler can not fold
+// across a switch
+__attribute__((noinline)) zl::Context* WorkerContext() {
+    return workerContext;
+}
+
+} // namespace
+
+// Run the function of the coroutine and switch back to its worker for good
+extern "C" __attribute__((used)) void zl_coroutine_main(zl::Coroutine* coroutine);
+
+#ifdef ZL_CONTEXT_ASM
+// zl_switch_context save the callee-saved registers of the System V ABI and
+// the floating point control words on the stack, store the stack pointer in
+// *save and restore the registers saved on the stack of sp. A new stack is
+// prepared to return into zl_coroutine_start with the coroutine in r12.
+extern "C" void zl_switch_context(void** save, void* sp);
+extern "C" void zl_coroutine_start();
+asm(R"(
+    .text
+    .globl zl_switch_context
+    .hidden zl_switch_context
+    .type zl_switch_context, @function
+    .p2align 4
+zl_switch_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size zl_switch_context, .-zl_switch_context
+
+    .globl zl_coroutine_start
+    .hidden zl_coroutine_start
+    .type zl_coroutine_start, @function
+zl_coroutine_start:
+    movq %r12, %rdi
+    call zl_coroutine_main
+    ud2
+    .size zl_coroutine_start, .-zl_coroutine_start
+)");
+#endif
+
+namespace zl {
+
+namespace {
+
+const int kFairnessInterval = 61;
+// Rounds of stealing from all workers before a worker sleeps
+const int kStealRounds = 4;
+
+#ifdef ZL_CONTEXT_ASM
+void SwitchContext(Context& from, Context& to) {
+    zl_switch_context(&from.sp, to.sp);
+}
+
+void MakeContext(Context& context, char* stack, size_t size, Coroutine* coroutine) {
+    // zl_switch_context pops the control words and six registers and
+    // returns into zl_coroutine_start, whose stack is then aligned for a
+    // call
+    auto top = reinterpret_cast<uint64_t*>(reinterpret_cast<uintptr_t>(stack + size) & ~uintptr_t(15));
+    top[-1] = reinterpret_cast<uint64_t>(&zl_coroutine_start);
+    top[-2] = 0; // rbp
+    top[-3] = 0; // rbx
+    top[-4] = reinterpret_cast<uint64_t>(coroutine); // r12
+    top[-5] = 0; // r13
+    top[-6] = 0; // r14
+    top[-7] = 0; // r15
+    // The default x87 control word and MXCSR
+    top[-8] = (uint64_t(0x037f) << 32) | 0x1f80;
+    context.sp = top - 8;
+}
+#else
+void SwitchContext(Context& from, Context& to) {
+    swapcontext(&from.context, &to.context);
+}
+
+// makecontext passes int arguments, the pointer is split in two
+void StartCoroutine(unsigned int high, unsigned int low) {
+    zl_coroutine_main(reinterpret_cast<Coroutine*>((uintptr_t(high) << 32) | low));
+}
+
+void MakeContext(Context& context, char* stack, size_t size, Coroutine* coroutine) {
+    getcontext(&context.context);
+    context.context.uc_stack.ss_sp = stack;
+    context.context.uc_stack.ss_size = size;
+    context.context.uc_link = nullptr;
+    auto address = reinterpret_cast<uintptr_t>(coroutine);
+    makecontext(&context.context, reinterpret_cast<void (*)()>(StartCoroutine), 2,
+        static_cast<unsigned int>(uint64_t(address) >> 32), static_cast<unsigned int>(address));
+}
+#endif
+
+size_t PageSize() {
+    static size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page;
+}
+
+// Map the stack of the coroutine and its guard page, the memory is only
+// committed when touched
+void MapStack(Coroutine* coroutine, size_t size) {
+    size_t page = PageSize();
+    size = (size + page - 1) / page * page + page;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::bad_alloc();
+    if (mprotect(memory, page, PROT_NONE) != 0) {
+        munmap(memory, size);
+        throw std::bad_alloc();
+    }
+    coroutine->stack = static_cast<char*>(memory);
+    coroutine->stackSize = size;
+}
+
+void DeleteCoroutine(Coroutine* coroutine) {
+    if (coroutine->stack)
+        munmap(coroutine->stack, coroutine->stackSize);
+    delete coroutine;
+}
+
+// Counters are only written by their worker, a relaxed increment is
+// enough for Stats to read them at any time
+void Count(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+__attribute__((noinline)) void SwitchToWorker(Coroutine* coroutine, Coroutine::Switch reason) {
+    coroutine->reason = reason;
+    SwitchContext(coroutine->context, *WorkerContext());
+}
+
+} // namespace
+
+struct Scheduler::Worker {
+    size_t index = 0;
+    std::thread thread;
+    WorkDeque<Coroutine> deque;
+    Context context;
+    // Returned coroutines whose stacks are reused by the next spawns
+    std::vector<Coroutine*> free;
+    uint64_t tick = 0;
+    uint32_t random = 0;
+    bool spinning = false;
+    // Set by WakeWorker, guarded by sleepMutex_
+    bool woken = false;
+    std::condition_variable wakeCond;
+    std::atomic<uint64_t> switches{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> fairTakes{0};
+    std::atomic<uint64_t> sleeps{0};
+    std::atomic<uint64_t> wakeups{0};
+};
+
+Scheduler::Scheduler(const SchedulerOptions& options)
+    : options_(options), globalSize_(0), spinning_(0), sleeping_(0), live_(0), spawned_(0), stop_(false) {
+    size_t count = options_.workers;
+    if (count == 0)
+        count = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < count; i++) {
+        workers_.emplace_back(new Worker());
+        workers_.back()->index = i;
+        workers_.back()->random = static_cast<uint32_t>(i * 2654435761u + 1);
+    }
+    for (auto& worker : workers_)
+        worker->thread = std::thread([this, &worker] { WorkerLoop(*worker); });
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::unique_lock<std::mutex> lock(doneMutex_);
+        doneCond_.wait(lock, [this] { return live_ == 0; });
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+        for (auto& worker : workers_)
+            worker->wakeCond.notify_one();
+    }
+    for (auto& worker : workers_) {
+        worker->thread.join();
+        for (auto coroutine : worker->free)
+            DeleteCoroutine(coroutine);
+    }
+}
+
+Coroutine* Scheduler::Current() {
+    return currentCoroutine;
+}
+
+Scheduler::Worker* Scheduler::CurrentWorker() const {
+    return currentScheduler == this ? workers_[currentWorker].get() : nullptr;
+}
+
+void Scheduler::Spawn(std::function<void()> function) {
+    Worker* worker = CurrentWorker();
+    Coroutine* coroutine;
+    if (worker && !worker->free.empty()) {
+        coroutine = worker->free.back();
+        worker->free.pop_back();
+    } else {
+        coroutine = new Coroutine();
+        coroutine->scheduler = this;
+        try {
+            MapStack(coroutine, options_.stackSize);
+        } catch (...) {
+            delete coroutine;
+            throw;
+        }
+    }
+    coroutine->function = std::move(function);
+    coroutine->state.store(Coroutine::Running, std::memory_order_relaxed);
+    size_t guard = PageSize();
+    MakeContext(coroutine->context, coroutine->stack + guard, coroutine->stackSize - guard, coroutine);
+    live_++;
+    spawned_.fetch_add(1, std::memory_order_relaxed);
+    MakeRunnable(coroutine);
+}
+
+void Scheduler::Wait() {
+    std::unique_lock<std::mutex> lock(doneMutex_);
+    doneCond_.wait(lock, [this] { return live_ == 0; });
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+SchedulerStats Scheduler::Stats() const {
+    SchedulerStats stats;
+    stats.spawned = spawned_.load(std::memory_order_relaxed);
+    for (auto& worker : workers_) {
+        stats.switches += worker->switches.load(std::memory_order_relaxed);
+        stats.steals += worker->steals.load(std::memory_order_relaxed);
+        stats.fairTakes += worker->fairTakes.load(std::memory_order_relaxed);
+        stats.sleeps += worker->sleeps.load(std::memory_order_relaxed);
+        stats.wakeups += worker->wakeups.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void Scheduler::Yield() {
+    Coroutine* coroutine = Current();
+    if (!coroutine) {
+        std::this_thread::yield();
+        return;
+    }
+    SwitchToWorker(coroutine, Coroutine::Switch::Yield);
+}
+
+void Scheduler::Park() {
+    Coroutine* coroutine = Current();
+    if (!coroutine) {
+        std::this_thread::yield();
+        return;
+    }
+    int state = Coroutine::Notified;
+    if (coroutine->state.compare_exchange_strong(state, Coroutine::Running))
+        return;
+    state = Coroutine::Running;
+    if (!coroutine->state.compare_exchange_strong(state, Coroutine::Parking)) {
+        // Unparked in between
+        coroutine->state.store(Coroutine::Running);
+        return;
+    }
+    // The worker marks it Parked once its registers are saved, an Unpark
+    // before that leaves it Notified and the worker queues it again
+    SwitchToWorker(coroutine, Coroutine::Switch::Park);
+}
+
+void Scheduler::Unpark(Coroutine* coroutine) {
+    int state = coroutine->state.load();
+    while (true) {
+        switch (state) {
+            case Coroutine::Running:
+            case Coroutine::Parking:
+                if (coroutine->state.compare_exchange_weak(state, Coroutine::Notified))
+                    return;
+                break;
+            case Coroutine::Parked:
+                if (coroutine->state.compare_exchange_weak(state, Coroutine::Running)) {
+                    coroutine->scheduler->MakeRunnable(coroutine);
+                    return;
+                }
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+void Scheduler::WorkerLoop(Worker& worker) {
+    currentScheduler = this;
+    currentWorker = worker.index;
+    workerContext = &worker.context;
+    while (true) {
+        Coroutine* coroutine = FindRunnable(worker);
+        if (coroutine) {
+            // The last spinning worker found work, another one starts
+            // searching in case there is more
+            if (worker.spinning) {
+                worker.spinning = false;
+                if (--spinning_ == 0)
+                    WakeWorker();
+            }
+            Resume(worker, coroutine);
+            continue;
+        }
+        if (stop_)
+            return;
+        Sleep(worker);
+    }
+}
+
+void Scheduler::Resume(Worker& worker, Coroutine* coroutine) {
+    Count(worker.switches);
+    currentCoroutine = coroutine;
+    SwitchContext(worker.context, coroutine->context);
+    currentCoroutine = nullptr;
+    switch (coroutine->reason) {
+        case Coroutine::Switch::Yield:
+            // Behind all the others
+            PushGlobal(coroutine);
+            WakeWorker();
+            break;
+        case Coroutine::Switch::Park: {
+            int state = Coroutine::Parking;
+            if (!coroutine->state.compare_exchange_strong(state, Coroutine::Parked)) {
+                coroutine->state.store(Coroutine::Running);
+                worker.deque.Push(coroutine);
+            }
+            break;
+        }
+        case Coroutine::Switch::Return:
+            Finish(worker, coroutine);
+            break;
+    }
+}
+
+Coroutine* Scheduler::FindRunnable(Worker& worker) {
+    Coroutine* coroutine;
+    worker.tick++;
+    if (worker.tick % kFairnessInterval == 0 && (coroutine = PopGlobal())) {
+        if (!worker.deque.Empty())
+            Count(worker.fairTakes);
+        return coroutine;
+    }
+    if (worker.tick % kFairnessInterval == kFairnessInterval / 2 && worker.deque.Size() > 1 &&
+            (coroutine = worker.deque.Steal())) {
+        Count(worker.fairTakes);
+        return coroutine;
+    }
+    if ((coroutine = worker.deque.Pop()) || (coroutine = PopGlobal()))
+        return coroutine;
+
+    // At most half of the busy workers spin, the others sleep at once
+    if (!worker.spinning) {
+        int busy = static_cast<int>(workers_.size()) - sleeping_.load();
+        if (2 * spinning_.load() >= busy)
+            return nullptr;
+        worker.spinning = true;
+        spinning_++;
+    }
+    for (int round = 0; round < kStealRounds; round++) {
+        if ((coroutine = StealFromOthers(worker)) || (coroutine = PopGlobal()))
+            return coroutine;
+        std::this_thread::yield();
+    }
+    return nullptr;
+}
+
+Coroutine* Scheduler::StealFromOthers(Worker& worker) {
+    size_t count = workers_.size();
+    // xorshift, so that thieves do not all start with the same victim
+    worker.random ^= worker.random << 13;
+    worker.random ^= worker.random >> 17;
+    worker.random ^= worker.random << 5;
+    size_t start = worker.random % count;
+    for (size_t i = 0; i < count; i++) {
+        Worker& victim = *workers_[(start + i) % count];
+        if (&victim == &worker)
+            continue;
+        if (Coroutine* coroutine = victim.deque.Steal()) {
+            Count(worker.steals);
+            return coroutine;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::MakeRunnable(Coroutine* coroutine) {
+    if (Worker* worker = CurrentWorker())
+        worker->deque.Push(coroutine);
+    else
+        PushGlobal(coroutine);
+    WakeWorker();
+}
+
+void Scheduler::PushGlobal(Coroutine* coroutine) {
+    std::lock_guard<std::mutex> lock(globalMutex_);
+    global_.push_back(coroutine);
+    globalSize_++;
+}
+
+Coroutine* Scheduler::PopGlobal() {
+    if (globalSize_.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+    std::lock_guard<std::mutex> lock(globalMutex_);
+    if (global_.empty())
+        return nullptr;
+    Coroutine* coroutine = global_.front();
+    global_.pop_front();
+    globalSize_--;
+    return coroutine;
+}
+
+bool Scheduler::HasWork() const {
+    if (globalSize_ > 0)
+        return true;
+    for (auto& worker : workers_) {
+        if (!worker->deque.Empty())
+            return true;
+    }
+    return false;
+}
+
+void Scheduler::WakeWorker() {
+    // Pairs with the fence of Sleep: either the sleeper sees the queued
+    // work or this sees the sleeper
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed) == 0 || spinning_.load(std::memory_order_relaxed) > 0)
+        return;
+    std::lock_guard<std::mutex> lock(sleepMutex_);
+    if (sleepers_.empty())
+        return;
+    Worker* worker = sleepers_.back();
+    sleepers_.pop_back();
+    sleeping_--;
+    // It wakes up spinning, so that other wakers leave the rest asleep
+    worker->woken = true;
+    worker->spinning = true;
+    spinning_++;
+    worker->wakeCond.notify_one();
+}
+
+void Scheduler::Sleep(Worker& worker) {
+    if (worker.spinning) {
+        worker.spinning = false;
+        spinning_--;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        if (stop_)
+            return;
+        worker.woken = false;
+        sleepers_.push_back(&worker);
+        sleeping_++;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::unique_lock<std::mutex> lock(sleepMutex_);
+    if (!worker.woken && HasWork()) {
+        // Work was queued before the waker could see this worker asleep
+        sleepers_.erase(std::find(sleepers_.begin(), sleepers_.end(), &worker));
+        sleeping_--;
+        return;
+    }
+    if (!worker.woken)
+        Count(worker.sleeps);
+    worker.wakeCond.wait(lock, [this, &worker] { return worker.woken || stop_; });
+    if (worker.woken)
+        Count(worker.wakeups);
+}
+
+void Scheduler::Finish(Worker& worker, Coroutine* coroutine) {
+    if (coroutine->error) {
+        std::lock_guard<std::mutex> lock(doneMutex_);
+        if (!error_)
+            error_ = coroutine->error;
+        coroutine->error = nullptr;
+    }
+    if (worker.free.size() < options_.cachedStacks)
+        worker.free.push_back(coroutine);
+    else
+        DeleteCoroutine(coroutine);
+    if (--live_ == 0) {
+        std::lock_guard<std::mutex> lock(doneMutex_);
+        doneCond_.notify_all();
+    }
+}
+
+} // namespace zl
+
+extern "C" void zl_coroutine_main(zl::Coroutine* coroutine) {
+    try {
+        coroutine->function();
+    } catch (...) {
+        coroutine->error = std::current_exception();
+    }
+    // The captures are released on the coroutine, they may unpark others
+    coroutine->function = nullptr;
+    zl::SwitchToWorker(coroutine, zl::Coroutine::Switch::Return);
+}
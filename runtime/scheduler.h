@@ -0,0 +1,143 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zl {
+
+// Coroutine is a lightweight thread run by a Scheduler, it is opaque and
+// only given to Unpark
+struct Coroutine;
+
+// SchedulerOptions are given when the scheduler is created
+struct SchedulerOptions {
+    // Worker threads, 0 for one per processor
+    size_t workers = 0;
+    // Bytes reserved for the stack of each coroutine. Pages are only given
+    // memory when the stack grows over them, a guard page below the stack
+    // faults on overflow. Each stack is a mapping of its own, so the
+    // coroutines alive at once are bounded by the mappings a process may
+    // have, about 32k on Linux by default.
+    size_t stackSize = 256 << 10;
+    // Stacks kept by each worker for the next coroutines
+    size_t cachedStacks = 1024;
+};
+
+// SchedulerStats count the work of the workers, see Scheduler::Stats
+struct SchedulerStats {
+    uint64_t spawned = 0;
+    // Coroutines resumed by a worker
+    uint64_t switches = 0;
+    // Coroutines taken from the deque of another worker
+    uint64_t steals = 0;
+    // Coroutines taken before the newest one of the deque of the worker, to
+    // be fair to them: from the global queue or the oldest of the deque
+    uint64_t fairTakes = 0;
+    // Times a worker found no work and slept, and was woken
+    uint64_t sleeps = 0;
+    uint64_t wakeups = 0;
+};
+
+// Scheduler run coroutines on a worker thread per processor, M:N. Each
+// coroutine has its own stack and switching between them saves only the
+// callee-saved registers, so spawning and switching cost about as much as a
+// function call instead of a system call.
+//
+// Each worker has a WorkDeque of runnable coroutines. Those spawned or
+// unparked by a coroutine are pushed on the deque of its worker and the
+// newest is run first, so a coroutine waking another one hands it the warm
+// cache. A worker whose deque is empty steals the oldest coroutine of
+// another worker. Coroutines spawned from other threads and coroutines
+// which yield go to a global queue.
+//
+// Fairness: scheduling is cooperative, a coroutine runs until it yields,
+// parks or returns. Every 61st time a worker schedules, it takes the global
+// queue first, and at another of those 61 times the oldest coroutine of its
+// own deque, so no runnable coroutine waits forever behind newer ones.
+//
+// A worker which finds no work spins stealing for a while and then sleeps.
+// Making a coroutine runnable wakes a sleeping worker unless one is already
+// spinning, so idle workers cost no processor time and only one of them at
+// a time searches for work.
+class Scheduler {
+public:
+    explicit Scheduler(const SchedulerOptions& options = SchedulerOptions());
+    // Wait the coroutines and stop the workers
+    ~Scheduler();
+
+    // Run the function on a new coroutine
+    void Spawn(std::function<void()> function);
+    // Block until all coroutines returned, it must not be called from a
+    // coroutine. An exception escaping a coroutine is thrown again here.
+    void Wait();
+    size_t Workers() const { return workers_.size(); }
+    // Sum of the counters of the workers, exact when no coroutine runs
+    SchedulerStats Stats() const;
+
+    // The running coroutine of the current thread, nullptr if it is not a
+    // worker running one
+    static Coroutine* Current();
+    // Let the other runnable coroutines run before the current one goes on
+    static void Yield();
+    // Suspend the current coroutine until Unpark is called for it. If Unpark
+    // was called since it last parked, it returns at once. A coroutine which
+    // waits a condition parks in a loop checking it.
+    static void Park();
+    // Make the parked coroutine runnable, or let its next Park return at
+    // once. Any thread may call it.
+    static void Unpark(Coroutine* coroutine);
+
+private:
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator = (const Scheduler&) = delete;
+
+    struct Worker;
+    // The worker of the current thread, nullptr if it is not one of this
+    // scheduler
+    Worker* CurrentWorker() const;
+    void WorkerLoop(Worker& worker);
+    // Run the coroutine until it yields, parks or returns
+    void Resume(Worker& worker, Coroutine* coroutine);
+    Coroutine* FindRunnable(Worker& worker);
+    Coroutine* StealFromOthers(Worker& worker);
+    // Queue the runnable coroutine on the worker of the current thread, or
+    // globally, and wake a worker if needed
+    void MakeRunnable(Coroutine* coroutine);
+    void PushGlobal(Coroutine* coroutine);
+    Coroutine* PopGlobal();
+    bool HasWork() const;
+    // Wake a sleeping worker if no worker is spinning
+    void WakeWorker();
+    void Sleep(Worker& worker);
+    void Finish(Worker& worker, Coroutine* coroutine);
+
+private:
+    SchedulerOptions options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // Coroutines spawned from other threads and those which yielded
+    std::mutex globalMutex_;
+    std::deque<Coroutine*> global_;
+    std::atomic<size_t> globalSize_;
+    // Workers searching for work and sleeping ones, guarded by sleepMutex_
+    std::atomic<int> spinning_;
+    std::atomic<int> sleeping_;
+    std::mutex sleepMutex_;
+    std::vector<Worker*> sleepers_;
+    // Coroutines spawned and not returned
+    std::atomic<size_t> live_;
+    std::atomic<uint64_t> spawned_;
+    std::mutex doneMutex_;
+    std::condition_variable doneCond_;
+    std::exception_ptr error_;
+    std::atomic<bool> stop_;
+};
+
+} // namespace zl
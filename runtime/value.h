@@ -0,0 +1,94 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+namespace zl {
+
+struct Object;
+
+// Value is a NaN-boxed 64 bits value of the interpreter. Doubles are stored
+// as they are, the other values are hidden in the quiet NaN space:
+//
+//   double:  any bits which are not a boxed value below
+//   int:     0x7ffd << 48 | 32 bits signed integer
+//   nil:     0x7ffe << 48
+//   bool:    0x7fff << 48 | 0 or 1
+//   object:  0xfffc << 48 | 48 bits pointer
+//
+// NaNs produced by arithmetic are canonicalized so that they are never taken
+// for a boxed value.
+class Value {
+public:
+    Value(): bits_(kNilBits) {}
+
+    static Value Nil() { return Value(kNilBits); }
+    static Value Bool(bool value) { return Value(kBoolBits | (value ? 1 : 0)); }
+    static Value Int(int32_t value) { return Value(kIntBits | static_cast<uint32_t>(value)); }
+    static Value Double(double value) {
+        if (value != value)
+            return Value(kCanonicalNaN);
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return Value(bits);
+    }
+    static Value FromObject(Object* object) {
+        return Value(kObjectBits | reinterpret_cast<uint64_t>(object));
+    }
+    static Value FromBits(uint64_t bits) { return Value(bits); }
+
+    bool IsNil() const { return bits_ == kNilBits; }
+    bool IsBool() const { return (bits_ & ~1ull) == kBoolBits; }
+    bool IsInt() const { return (bits_ >> 32) == (kIntBits >> 32); }
+    bool IsDouble() const { return (bits_ & kQNaN) != kQNaN; }
+    bool IsNumber() const { return IsInt() || IsDouble(); }
+    bool IsObject() const { return (bits_ & kObjectBits) == kObjectBits; }
+
+    bool AsBool() const { return bits_ & 1; }
+    int32_t AsInt() const { return static_cast<int32_t>(static_cast<uint32_t>(bits_)); }
+    double AsDouble() const {
+        double value;
+        memcpy(&value, &bits_, sizeof(value));
+        return value;
+    }
+    // Return the number as double, the value must be a number
+    double ToDouble() const { return IsInt() ? AsInt() : AsDouble(); }
+    // Return the number truncated toward zero, the value must be a number.
+    // Out of range and NaN give INT32_MIN like the conversion of x86-64.
+    int32_t ToInt() const {
+        if (IsInt())
+            return AsInt();
+        double value = AsDouble();
+        return value > -2147483649.0 && value < 2147483648.0 ? static_cast<int32_t>(value) : INT32_MIN;
+    }
+    Object* AsObject() const { return reinterpret_cast<Object*>(bits_ & kPointerMask); }
+    uint64_t Bits() const { return bits_; }
+
+    // nil and false are false, all other values are true
+    bool IsTruthy() const { return bits_ != kNilBits && bits_ != kBoolBits; }
+    // Identity of the bits, strings with the same content are not the same
+    bool operator == (const Value& rhs) const { return bits_ == rhs.bits_; }
+    bool operator != (const Value& rhs) const { return bits_ != rhs.bits_; }
+
+    // Return true if both values are int, the fast path of arithmetic
+    static bool BothInt(Value a, Value b) {
+        return (a.bits_ >> 32) == (kIntBits >> 32) && (b.bits_ >> 32) == (kIntBits >> 32);
+    }
+
+private:
+    explicit Value(uint64_t bits): bits_(bits) {}
+
+    static const uint64_t kQNaN = 0x7ffc000000000000ull;
+    static const uint64_t kCanonicalNaN = 0x7ff8000000000000ull;
+    static const uint64_t kIntBits = 0x7ffd000000000000ull;
+    static const uint64_t kNilBits = 0x7ffe000000000000ull;
+    static const uint64_t kBoolBits = 0x7fff000000000000ull;
+    static const uint64_t kObjectBits = 0xfffc000000000000ull;
+    static const uint64_t kPointerMask = 0x0000ffffffffffffull;
+
+    uint64_t bits_;
+};
+
+static_assert(sizeof(Value) == 8, "Value must be 64 bits");
+
+} // namespace zl
@@ -0,0 +1,123 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace zl {
+
+// WorkDeque is the Chase-Lev work-stealing deque of a worker thread: the
+// owner pushes and pops items at the bottom without locks, other threads
+// steal the oldest items at the top with one compare and swap. The memory
+// orders are those of Lê, Pop, Cohen and Zappa Nardelli, "Correct and
+// Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+//
+// The array grows when the owner pushes on a full deque. Thieves may still
+// read the old array, so it is kept until the deque is destroyed.
+template <typename T>
+class WorkDeque {
+public:
+    explicit WorkDeque(size_t capacity = 256)
+        : arrays_(), top_(0), bottom_(0), array_(NewArray(capacity)) {}
+
+    // Push the item at the bottom, only called by the owner
+    void Push(T* item) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_acquire);
+        Array* array = array_.load(std::memory_order_relaxed);
+        if (bottom - top > static_cast<int64_t>(array->mask))
+            array = Grow(array, top, bottom);
+        array->Put(bottom, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // Pop the newest item, nullptr if the deque is empty. Only called by the
+    // owner.
+    T* Pop() {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* array = array_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = array->Get(bottom);
+        if (top == bottom) {
+            // The last item, a thief may be taking it too
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                    std::memory_order_relaxed))
+                item = nullptr;
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Steal the oldest item, nullptr if the deque is empty. Any thread may
+    // call it, the owner too.
+    T* Steal() {
+        while (true) {
+            int64_t top = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = bottom_.load(std::memory_order_acquire);
+            if (top >= bottom)
+                return nullptr;
+            Array* array = array_.load(std::memory_order_acquire);
+            T* item = array->Get(top);
+            if (top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                    std::memory_order_relaxed))
+                return item;
+            // Another thief or the owner took it, try the next one
+        }
+    }
+
+    // Number of items, only exact when no other thread uses the deque
+    size_t Size() const {
+        int64_t size = bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed);
+        return size > 0 ? static_cast<size_t>(size) : 0;
+    }
+    bool Empty() const { return Size() == 0; }
+
+private:
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator = (const WorkDeque&) = delete;
+
+    // Array is a circular buffer of a power of two items
+    struct Array {
+        size_t mask;
+        std::unique_ptr<std::atomic<T*>[]> items;
+        T* Get(int64_t index) const { return items[index & mask].load(std::memory_order_relaxed); }
+        void Put(int64_t index, T* item) { items[index & mask].store(item, std::memory_order_relaxed); }
+    };
+
+    Array* NewArray(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        arrays_.emplace_back(new Array{size - 1, std::unique_ptr<std::atomic<T*>[]>(new std::atomic<T*>[size])});
+        return arrays_.back().get();
+    }
+
+    Array* Grow(Array* array, int64_t top, int64_t bottom) {
+        Array* grown = NewArray((array->mask + 1) * 2);
+        for (int64_t index = top; index < bottom; index++)
+            grown->Put(index, array->Get(index));
+        array_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+private:
+    // All arrays, only changed by the owner. It is constructed before
+    // array_, which is initialized with the first one.
+    std::vector<std::unique_ptr<Array>> arrays_;
+    // top_ is written by thieves and bottom_ by the owner, they are on
+    // separate cache lines
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    std::atomic<Array*> array_;
+};
+
+} // namespace zl
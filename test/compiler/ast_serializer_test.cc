@@ -0,0 +1,91 @@
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "compiler/ast_serializer.h"
+
+namespace zl {
+namespace {
+
+class StringWriter : public pugi::xml_writer {
+public:
+    void write(const void* data, size_t size) override {
+        output.append(static_cast<const char*>(data), size);
+    }
+    std::string output;
+};
+
+// Count the nodes below the node and collect their kinds
+void CountNodes(const ast::Node* node, size_t& nodes, std::set<ast::NodeKind>& kinds) {
+    nodes++;
+    kinds.insert(node->Kind());
+    std::vector<ast::Node*> children;
+    ast::CollectChildren(node, children);
+    for (auto child : children) {
+        if (child)
+            CountNodes(child, nodes, kinds);
+    }
+}
+
+const char* kSource =
+    "func f(n:int):int {\n"
+    "    defer print(n)\n"
+    "    switch (n) {\n"
+    "        case 1: case 2: return 1\n"
+    "        case 3: throw \"three\"\n"
+    "        default: return 0\n"
+    "    }\n"
+    "}\n"
+    "func main():int {\n"
+    "    try {\n"
+    "        return f(3)\n"
+    "    } catch (string e) {\n"
+    "        print(e)\n"
+    "    } finally {\n"
+    "        print(\"done\")\n"
+    "    }\n"
+    "    return 0\n"
+    "}\n";
+
+TEST(AstSerializerTest, NodeKindNames) {
+    for (size_t kind = 1; kind < static_cast<size_t>(ast::NodeKind::kCount); kind++)
+        EXPECT_STRNE(ast::NodeKindName(static_cast<ast::NodeKind>(kind)), "Unknown") << kind;
+}
+
+TEST(AstSerializerTest, BinaryRoundTrip) {
+    std::vector<SourceFile> files(1);
+    files[0].path = "kinds.zl";
+    files[0].diagnostics = RunFrontEnd(kSource, strlen(kSource), &files[0].decls).diagnostics;
+    ASSERT_TRUE(files[0].diagnostics.empty());
+
+    size_t nodes = 0;
+    std::set<ast::NodeKind> kinds;
+    for (auto decl : files[0].decls)
+        CountNodes(decl, nodes, kinds);
+    for (auto kind : {ast::NodeKind::DeferStmt, ast::NodeKind::SwitchStmt, ast::NodeKind::CaseStmt,
+            ast::NodeKind::ThrowStmt, ast::NodeKind::TryStmt, ast::NodeKind::CatchStmt,
+            ast::NodeKind::FinallyStmt})
+        EXPECT_TRUE(kinds.count(kind)) << ast::NodeKindName(kind);
+
+    StringWriter writer;
+    NewAstSerializer(DumpFormat::Binary, writer)->Serialize(files);
+    AstDumpSummary summary;
+    ASSERT_TRUE(ReadBinaryAst(writer.output.data(), writer.output.size(), summary));
+    EXPECT_EQ(summary.files, 1u);
+    EXPECT_EQ(summary.decls, files[0].decls.size());
+    EXPECT_EQ(summary.nodes, nodes);
+}
+
+TEST(AstSerializerTest, BinaryRejectsTruncatedDump) {
+    std::vector<SourceFile> files(1);
+    files[0].path = "kinds.zl";
+    RunFrontEnd(kSource, strlen(kSource), &files[0].decls);
+    StringWriter writer;
+    NewAstSerializer(DumpFormat::Binary, writer)->Serialize(files);
+    AstDumpSummary summary;
+    EXPECT_FALSE(ReadBinaryAst(writer.output.data(), writer.output.size() - 1, summary));
+}
+
+} // namespace
+} // namespace zl
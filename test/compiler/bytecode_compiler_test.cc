@@ -0,0 +1,247 @@
+#include <string.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "compiler/bytecode_compiler.h"
+#include "runtime/interpreter.h"
+
+namespace zl {
+namespace {
+
+// Compile the source as one file, return false with the first diagnostic
+// in error if it can not be compiled
+bool Compile(const std::string& source, Program& program, std::string& error) {
+    std::vector<SourceFile> files(1);
+    files[0].path = "test.zl";
+    files[0].diagnostics = RunFrontEnd(source.data(), source.size(), &files[0].decls).diagnostics;
+    if (!files[0].diagnostics.empty()) {
+        error = files[0].diagnostics[0].msg;
+        return false;
+    }
+    BytecodeCompiler compiler(program);
+    if (!compiler.Compile(files)) {
+        error = compiler.Diagnostics()[0].diagnostic.msg;
+        return false;
+    }
+    return true;
+}
+
+TEST(BytecodeCompilerTest, IntArithmetic) {
+    Program program;
+    std::string error;
+    ASSERT_TRUE(Compile("func main():int {\n"
+        "    var x:int = 46340\n"
+        "    return x * x % 1000 + 7 / 2\n"
+        "}\n", program, error)) << error;
+    Interpreter interpreter(program);
+    Value result;
+    ASSERT_TRUE(interpreter.RunMain(result)) << interpreter.Error();
+    ASSERT_TRUE(result.IsInt());
+    EXPECT_EQ(result.AsInt(), 46340 * 46340 % 1000 + 3);
+}
+
+// Integers of the interpreter are 32 bits, long of the other backends is 64
+// bits, so every place a type is written refuses long
+TEST(BytecodeCompilerTest, RefusesLong) {
+    const char* sources[] = {
+        "func main():int {\n    var x:long = 1\n    return 0\n}\n",
+        "func f(x:long):int {\n    return 0\n}\n",
+        "func f():long {\n    return 0\n}\n",
+        "var total:long = 0\n",
+        "func main():int {\n    var a:long[] = []\n    return 0\n}\n",
+        "func main():int {\n    var m:map<string, long> = {}\n    return 0\n}\n",
+        "class Counter {\n    count:long\n}\n",
+    };
+    for (auto source : sources) {
+        Program program;
+        std::string error;
+        EXPECT_FALSE(Compile(source, program, error)) << source;
+        EXPECT_NE(error.find("long is not supported"), std::string::npos) << source << error;
+    }
+}
+
+// Numbers of the interpreter are doubles, float of the other backends is 32
+// bits, so float is refused like long
+TEST(BytecodeCompilerTest, RefusesFloat) {
+    const char* sources[] = {
+        "func main():int {\n    var f:float = 0.1\n    print(f)\n    return 0\n}\n",
+        "func f(x:float):int {\n    return 0\n}\n",
+        "class Point {\n    x:float\n}\n",
+    };
+    for (auto source : sources) {
+        Program program;
+        std::string error;
+        EXPECT_FALSE(Compile(source, program, error)) << source;
+        EXPECT_NE(error.find("float is not supported"), std::string::npos) << source << error;
+    }
+}
+
+// Defers and finally run in handlers which throw the exception again, it is
+// still reported where it was first thrown, even when a deferred call throws
+// and catches its own
+TEST(BytecodeCompilerTest, RethrownExceptionsKeepTheirSite) {
+    struct {
+        const char* source;
+        const char* error;
+    } cases[] = {
+        {"func cleanup() {\n}\n"
+         "func f(a:int[]):int {\n"
+         "    defer cleanup()\n"
+         "    return a[3]\n"
+         "}\n"
+         "func main():int {\n"
+         "    return f([1, 2])\n"
+         "}\n", "f:5: index 3 out of range"},
+        {"func cleanup() {\n"
+         "    try {\n"
+         "        throw \"inner\"\n"
+         "    } catch (string e) {\n"
+         "    }\n"
+         "}\n"
+         "func f(a:int[]):int {\n"
+         "    defer cleanup()\n"
+         "    return a[3]\n"
+         "}\n"
+         "func main():int {\n"
+         "    return f([1])\n"
+         "}\n", "f:9: index 3 out of range"},
+        {"class E {\n    E() {}\n}\n"
+         "func cleanup() {\n}\n"
+         "func g() {\n"
+         "    defer cleanup()\n"
+         "    var e:E = new E()\n"
+         "    throw e\n"
+         "}\n"
+         "func main():int {\n"
+         "    g()\n"
+         "    return 0\n"
+         "}\n", "g:9: uncaught exception <E>"},
+        {"func main():int {\n"
+         "    try {\n"
+         "        var a:int[] = [1]\n"
+         "        print(a[5])\n"
+         "    } finally {\n"
+         "    }\n"
+         "    return 0\n"
+         "}\n", "main:4: index 5 out of range"},
+    };
+    for (auto& c : cases) {
+        Program program;
+        std::string error;
+        ASSERT_TRUE(Compile(c.source, program, error)) << error;
+        Interpreter interpreter(program);
+        Value result;
+        EXPECT_FALSE(interpreter.RunMain(result)) << c.source;
+        EXPECT_EQ(interpreter.Error(), c.error);
+    }
+}
+
+FunctionObject* FindFunction(const Program& program, const std::string& name) {
+    for (auto function : program.functions) {
+        if (function->name == name)
+            return function;
+    }
+    return nullptr;
+}
+
+// Dense integers are dispatched by a jump table, sparse ones by a binary
+// search and strings by a perfect hash, each reaches the case of its value
+// and the default for the others
+TEST(BytecodeCompilerTest, SwitchTables) {
+    std::string source =
+        "func dense(n:int):int {\n"
+        "    switch (n) {\n"
+        "        case 3: case 5: return 1\n"
+        "        case 4: return 2\n"
+        "        case 7: return 3\n"
+        "        case 8: return 4\n"
+        "    }\n"
+        "    return 0\n"
+        "}\n"
+        "func sparse(n:int):int {\n"
+        "    switch (n) {\n"
+        "        case -100000: return 1\n"
+        "        case 0: return 2\n"
+        "        case 10: case 1000: return 3\n"
+        "        default: return 0\n"
+        "    }\n"
+        "}\n"
+        "func words(s:string):int {\n"
+        "    switch (s) {\n";
+    for (int n = 0; n < 50; n++)
+        source += "        case \"w" + std::to_string(n) + "\": return " + std::to_string(n + 1) + "\n";
+    source +=
+        "        case \"\": return 100\n"
+        "    }\n"
+        "    return 0\n"
+        "}\n"
+        "func main():int {\n"
+        "    var sum:int = 0\n"
+        "    for (i:int = -3; i < 12; i += 1) {\n"
+        "        sum = sum + dense(i) * (i + 4)\n"
+        "    }\n"
+        "    sum = sum * 4 + sparse(-100000) + sparse(-99999) * 100\n"
+        "    sum = sum * 4 + sparse(0) + sparse(1) * 100\n"
+        "    sum = sum * 4 + sparse(10) + sparse(1000) + sparse(1001) * 100\n"
+        "    for (i:int = 0; i < 60; i += 1) {\n"
+        "        sum = sum + words(\"w\" + i) * (i + 1)\n"
+        "    }\n"
+        "    return sum + words(\"\") + words(\"w\") + words(\"W0\")\n"
+        "}\n";
+    Program program;
+    std::string error;
+    ASSERT_TRUE(Compile(source, program, error)) << error;
+    struct {
+        const char* function;
+        SwitchTable::Kind kind;
+    } tables[] = {{"dense", SwitchTable::Dense}, {"sparse", SwitchTable::Sparse}, {"words", SwitchTable::String}};
+    for (auto& table : tables) {
+        FunctionObject* function = FindFunction(program, table.function);
+        ASSERT_NE(function, nullptr) << table.function;
+        ASSERT_EQ(function->switches.size(), 1u) << table.function;
+        EXPECT_EQ(function->switches[0].kind, table.kind) << table.function;
+    }
+    EXPECT_EQ(FindFunction(program, "dense")->switches[0].low, 3);
+    EXPECT_EQ(FindFunction(program, "sparse")->switches[0].integers, std::vector<int32_t>({-100000, 0, 10, 1000}));
+
+    int32_t expected = 0;
+    const int32_t dense[] = {1, 2, 1, 0, 3, 4};
+    for (int32_t i = 3; i <= 8; i++)
+        expected += dense[i - 3] * (i + 4);
+    expected = expected * 4 + 1;
+    expected = expected * 4 + 2;
+    expected = expected * 4 + 6;
+    for (int32_t i = 0; i < 50; i++)
+        expected += (i + 1) * (i + 1);
+    expected += 100;
+    Interpreter interpreter(program);
+    Value result;
+    ASSERT_TRUE(interpreter.RunMain(result)) << interpreter.Error();
+    ASSERT_TRUE(result.IsInt());
+    EXPECT_EQ(result.AsInt(), expected);
+}
+
+// A switch with a case which is not constant, or with integers and strings,
+// compares the cases in turn
+TEST(BytecodeCompilerTest, SwitchesWithoutTable) {
+    Program program;
+    std::string error;
+    ASSERT_TRUE(Compile("func f(n:int, m:int):int {\n"
+        "    switch (n) {\n"
+        "        case 1: return 10\n"
+        "        case m: return 20\n"
+        "        default: return 30\n"
+        "    }\n"
+        "}\n"
+        "func main():int {\n"
+        "    return f(1, 1) + f(2, 2) * 100 + f(3, 4) * 10000\n"
+        "}\n", program, error)) << error;
+    EXPECT_TRUE(FindFunction(program, "f")->switches.empty());
+    Interpreter interpreter(program);
+    Value result;
+    ASSERT_TRUE(interpreter.RunMain(result)) << interpreter.Error();
+    EXPECT_EQ(result.AsInt(), 10 + 2000 + 300000);
+}
+
+} // namespace
+} // namespace zl
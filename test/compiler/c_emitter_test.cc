@@ -0,0 +1,128 @@
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "compiler/c_emitter.h"
+
+namespace zl {
+namespace {
+
+const char* kSource =
+    "interface Shape {\n"
+    "    Area():int\n"
+    "    Scale(factor:map<string, int[]>):Shape\n"
+    "}\n"
+    "class Square {\n"
+    "    Square(side:int) {\n"
+    "        self.side = side\n"
+    "    }\n"
+    "    Area():int { return side * side }\n"
+    "    Scale(factor:map<string, int[]>):Shape { return self }\n"
+    "    side:int\n"
+    "}\n"
+    "func main():int {\n"
+    "    var shape:Shape = new Square(3)\n"
+    "    var sides:int[] = [1, 2]\n"
+    "    print(shape.Area(), len(sides))\n"
+    "    return 0\n"
+    "}\n";
+
+std::vector<SourceFile> Parse(const char* source) {
+    std::vector<SourceFile> files(1);
+    files[0].path = "shapes.zl";
+    files[0].diagnostics = RunFrontEnd(source, strlen(source), &files[0].decls).diagnostics;
+    return files;
+}
+
+// Types interned by the compiler before emitting give the translation of
+// an emitter interning them itself
+TEST(CEmitterTest, SharedTypeContext) {
+    auto files = Parse(kSource);
+    ASSERT_TRUE(files[0].diagnostics.empty());
+    std::string own, shared;
+    CEmitter ownEmitter;
+    ASSERT_TRUE(ownEmitter.Emit(files, own));
+
+    auto other = Parse(kSource);
+    TypeContext types;
+    types.InternAll(other[0].decls);
+    CEmitter sharedEmitter(types);
+    ASSERT_TRUE(sharedEmitter.Emit(other, shared));
+    EXPECT_EQ(own, shared);
+}
+
+// Interface methods are implemented by the methods whose parameter and
+// result types are canonically the same
+TEST(CEmitterTest, ImplementationTypes) {
+    std::string source = kSource;
+    auto files = Parse(source.c_str());
+    std::string code;
+    CEmitter emitter;
+    ASSERT_TRUE(emitter.Emit(files, code));
+
+    size_t parameter = source.find("int[]", source.find("class Square"));
+    ASSERT_NE(parameter, std::string::npos);
+    source.replace(parameter, 5, "long[]");
+    files = Parse(source.c_str());
+    CEmitter other;
+    EXPECT_FALSE(other.Emit(files, code));
+    ASSERT_FALSE(other.Diagnostics().empty());
+    EXPECT_EQ(other.Diagnostics()[0].diagnostic.msg, "Square does not implement Shape.Scale");
+}
+
+TEST(CEmitterTest, TupleResults) {
+    const char* source =
+        "interface Pair {\n"
+        "    Get():(int, string)\n"
+        "}\n"
+        "class Entry {\n"
+        "    Get():(int, string) { return 1, \"one\" }\n"
+        "}\n"
+        "func main():int {\n"
+        "    var pair:Pair = new Entry()\n"
+        "    var n:int = 0\n"
+        "    var s:string = \"\"\n"
+        "    n, s = pair.Get()\n"
+        "    print(n, s)\n"
+        "    return 0\n"
+        "}\n";
+    auto files = Parse(source);
+    ASSERT_TRUE(files[0].diagnostics.empty()) << files[0].diagnostics[0].msg;
+    std::string code;
+    CEmitter emitter;
+    EXPECT_TRUE(emitter.Emit(files, code)) << emitter.Diagnostics()[0].diagnostic.msg;
+}
+
+// Constants and the elements of their arrays and maps are refused as store
+// targets, as the bytecode compiler and the interpreter do
+TEST(CEmitterTest, RefusesStoresIntoConstants) {
+    const std::pair<const char*, const char*> cases[] = {
+        {"const X = 3\nfunc main():int {\n    X = 4\n    return X\n}\n", "constant X can not be assigned"},
+        {"const X = 3\nfunc main():int {\n    X += 1\n    return X\n}\n", "constant X can not be assigned"},
+        {"func main():int {\n    const Y = 3\n    Y = 4\n    return Y\n}\n", "constant Y can not be assigned"},
+        {"const ARR = [1, 2]\nfunc main():int {\n    ARR[0] = 9\n    return 0\n}\n", "store into constant array"},
+        {"const M = {\"a\": [1]}\nfunc main():int {\n    M[\"a\"][0] = 9\n    return 0\n}\n",
+            "store into constant array"},
+        {"const M = {\"a\": 1}\nfunc main():int {\n    M[\"b\"] = 2\n    return 0\n}\n", "store into constant map"},
+        {"const ARR = [1, 2]\nfunc main():int {\n    append(ARR, 3)\n    return 0\n}\n", "append to constant array"},
+    };
+    for (auto& entry : cases) {
+        auto files = Parse(entry.first);
+        ASSERT_TRUE(files[0].diagnostics.empty()) << entry.first;
+        std::string code;
+        CEmitter emitter;
+        EXPECT_FALSE(emitter.Emit(files, code)) << entry.first;
+        ASSERT_FALSE(emitter.Diagnostics().empty()) << entry.first;
+        EXPECT_EQ(emitter.Diagnostics()[0].diagnostic.msg, entry.second) << entry.first;
+    }
+
+    // A copy of a constant is a variable
+    auto files = Parse("const X = 3\nfunc main():int {\n    var y:int = X\n    y = 4\n    return y\n}\n");
+    std::string code;
+    CEmitter emitter;
+    EXPECT_TRUE(emitter.Emit(files, code));
+}
+
+} // namespace
+} // namespace zl
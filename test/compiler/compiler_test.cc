@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <gtest/gtest.h>
+#include "compiler/compiler.h"
+#include "compiler/jit.h"
+
+namespace zl {
+namespace {
+
+// CompilerTest writes the input files into a private temporary directory
+class CompilerTest : public testing::Test {
+protected:
+    void SetUp() override {
+        char pattern[] = "/tmp/zlc-test-XXXXXX";
+        ASSERT_NE(mkdtemp(pattern), nullptr);
+        dir_ = pattern;
+    }
+
+    void TearDown() override {
+        std::string command = "rm -rf '" + dir_ + "'";
+        ASSERT_EQ(system(command.c_str()), 0);
+    }
+
+    // Write the source to the file and return its path
+    std::string Write(const std::string& name, const std::string& source) {
+        std::string path = dir_ + "/" + name;
+        std::ofstream file(path);
+        file << source;
+        return path;
+    }
+
+    std::string Path(const std::string& name) const { return dir_ + "/" + name; }
+
+    std::string Read(const std::string& name) const {
+        std::ifstream file(Path(name));
+        std::ostringstream stream;
+        stream << file.rdbuf();
+        return stream.str();
+    }
+
+private:
+    std::string dir_;
+};
+
+// Package p<k> declares f<k>, which calls f<k-1> of the package it imports
+std::string PackageSource(int k) {
+    std::string source = "package p" + std::to_string(k) + "\n";
+    if (k > 0)
+        source += "import p" + std::to_string(k - 1) + "\n";
+    source += "func f" + std::to_string(k) + "(n:int):int {\n";
+    if (k > 0)
+        source += "    return p" + std::to_string(k - 1) + ".f" + std::to_string(k - 1) + "(n) + 1\n";
+    else
+        source += "    return n\n";
+    return source + "}\n";
+}
+
+TEST_F(CompilerTest, ResolveInParallel) {
+    CompileOptions options;
+    options.resolve = true;
+    options.jobs = 4;
+    for (int k = 0; k < 64; k++)
+        options.inputFiles.push_back(Write("p" + std::to_string(k) + ".zl", PackageSource(k)));
+    EXPECT_EQ(Compiler(options).Run(), 0);
+}
+
+TEST_F(CompilerTest, ResolveReportsUnreadableFiles) {
+    CompileOptions options;
+    options.resolve = true;
+    options.jobs = 4;
+    for (int k = 0; k < 16; k++) {
+        if (k % 4 == 3)
+            options.inputFiles.push_back(Path("missing" + std::to_string(k) + ".zl"));
+        else
+            options.inputFiles.push_back(Write("f" + std::to_string(k) + ".zl", PackageSource(0)));
+    }
+    EXPECT_EQ(Compiler(options).Run(), 1);
+}
+
+TEST_F(CompilerTest, DumpInParallel) {
+    CompileOptions options;
+    options.dumpAst = "jsonl";
+    for (int k = 0; k < 32; k++)
+        options.inputFiles.push_back(Write("p" + std::to_string(k) + ".zl", PackageSource(k)));
+    options.jobs = 1;
+    options.dumpOutput = Path("serial.jsonl");
+    ASSERT_EQ(Compiler(options).Run(), 0);
+    options.jobs = 4;
+    options.dumpOutput = Path("parallel.jsonl");
+    ASSERT_EQ(Compiler(options).Run(), 0);
+    EXPECT_FALSE(Read("serial.jsonl").empty());
+    EXPECT_EQ(Read("serial.jsonl"), Read("parallel.jsonl"));
+}
+
+TEST_F(CompilerTest, DumpReportsUnreadableFiles) {
+    CompileOptions options;
+    options.dumpAst = "jsonl";
+    options.dumpOutput = Path("dump.jsonl");
+    options.jobs = 4;
+    for (int k = 0; k < 16; k++) {
+        if (k % 4 == 3)
+            options.inputFiles.push_back(Path("missing" + std::to_string(k) + ".zl"));
+        else
+            options.inputFiles.push_back(Write("f" + std::to_string(k) + ".zl", PackageSource(0)));
+    }
+    EXPECT_EQ(Compiler(options).Run(), 1);
+}
+
+TEST_F(CompilerTest, RunParsesInParallel) {
+    CompileOptions options;
+    options.run = true;
+    options.jobs = 4;
+    for (int k = 0; k < 16; k++) {
+        std::string name = "f" + std::to_string(k);
+        options.inputFiles.push_back(Write(name + ".zl",
+                "func " + name + "():int {\n    return " + std::to_string(k) + "\n}\n"));
+    }
+    options.inputFiles.push_back(Write("main.zl", "func main():int {\n    return f7() + f9()\n}\n"));
+    EXPECT_EQ(Compiler(options).Run(), 16);
+}
+
+TEST_F(CompilerTest, RunWithIrStats) {
+    CompileOptions options;
+    options.run = true;
+    options.irStats = true;
+    options.verifyIr = true;
+    options.inputFiles.push_back(Write("main.zl", "func main():int {\n    return 3\n}\n"));
+    EXPECT_EQ(Compiler(options).Run(), 3);
+}
+
+TEST_F(CompilerTest, RunRefusesLong) {
+    CompileOptions options;
+    options.run = true;
+    options.inputFiles.push_back(Write("main.zl",
+            "func main():int {\n    var x:long = 100000\n    print(x * x)\n    return 0\n}\n"));
+    EXPECT_EQ(Compiler(options).Run(), 1);
+}
+
+TEST_F(CompilerTest, JitRunsLong) {
+    if (!Jit::Supported())
+        GTEST_SKIP() << "the JIT does not run on this machine";
+    CompileOptions options;
+    options.jit = true;
+    options.inputFiles.push_back(Write("main.zl", "func main():int {\n"
+        "    var x:long = 100000\n"
+        "    var y:int = x * x / 1000000000\n"
+        "    return y\n"
+        "}\n"));
+    EXPECT_EQ(Compiler(options).Run(), 10);
+}
+
+// g takes arguments on the stack, which the JIT does not compile, so main
+// is not compiled either and must not be interpreted with 32-bit long
+TEST_F(CompilerTest, JitDoesNotInterpretLong) {
+    CompileOptions options;
+    options.jit = true;
+    options.inputFiles.push_back(Write("main.zl",
+        "func g(a:int, b:int, c:int, d:int, e:int, f:int, h:int):int {\n"
+        "    return a + b + c + d + e + f + h\n"
+        "}\n"
+        "func main():int {\n"
+        "    var x:long = 100000\n"
+        "    var y:int = x * x / 1000000000\n"
+        "    return y + g(1, 2, 3, 4, 5, 6, 7)\n"
+        "}\n"));
+    EXPECT_EQ(Compiler(options).Run(), 1);
+}
+
+// Stores into variables, fields, globals and elements declared int truncate
+// the value and the ones declared double convert it, in every backend
+TEST_F(CompilerTest, BackendsConvertStores) {
+    const char* scalars = "func main():int {\n"
+        "    var e:double = 3.5\n"
+        "    var j:int = e * 3\n"
+        "    var k:int = 0\n"
+        "    k = e * 3\n"
+        "    k += e\n"
+        "    var d:double = 1\n"
+        "    var h:int = d / 2 * 4\n"
+        "    return j + k + h\n"
+        "}\n";
+    const char* aggregates = "class Box {\n"
+        "    v:int\n"
+        "}\n"
+        "var g:int = 0\n"
+        "func main():int {\n"
+        "    var e:double = 3.5\n"
+        "    g = e * 3\n"
+        "    var b:Box = new Box()\n"
+        "    b.v = e\n"
+        "    var a:int[] = [0]\n"
+        "    a[0] = e * 2\n"
+        "    return g + b.v + a[0]\n"
+        "}\n";
+    std::pair<const char*, int> programs[] = {{scalars, 10 + 13 + 2}, {aggregates, 10 + 3 + 7}};
+    for (auto& program : programs) {
+        std::string path = Write("main.zl", program.first);
+        CompileOptions run;
+        run.run = true;
+        run.inputFiles.push_back(path);
+        EXPECT_EQ(Compiler(run).Run(), program.second) << program.first;
+
+        if (Jit::Supported()) {
+            CompileOptions jit;
+            jit.jit = true;
+            jit.inputFiles.push_back(path);
+            EXPECT_EQ(Compiler(jit).Run(), program.second) << program.first;
+        }
+
+        CompileOptions emit;
+        emit.emitExe = Path("main");
+        emit.inputFiles.push_back(path);
+        ASSERT_EQ(Compiler(emit).Run(), 0) << program.first;
+        int status = system(Path("main").c_str());
+        ASSERT_TRUE(WIFEXITED(status));
+        EXPECT_EQ(WEXITSTATUS(status), program.second) << program.first;
+    }
+}
+
+// A missing key of a map reads the zero value of its value type in every
+// backend, and when constants are folded
+TEST_F(CompilerTest, BackendsReadZeroForMissingKeys) {
+    std::string path = Write("main.zl", "const M:map<string, int> = {\"a\": 1}\n"
+        "const N:int = M[\"b\"]\n"
+        "func main():int {\n"
+        "    var counts:map<string, int> = {\"z\": 0}\n"
+        "    counts[\"a\"] += 1\n"
+        "    counts[\"a\"] += 1\n"
+        "    counts[\"b\"] += 1\n"
+        "    var r:int = counts[\"a\"] * 10 + counts[\"b\"] + counts[\"c\"]\n"
+        "    var d:map<int, double> = {1: 1.5}\n"
+        "    if (d[2] == 0)\n"
+        "        r += 30\n"
+        "    var b:map<int, bool> = {1: true}\n"
+        "    if (!b[2])\n"
+        "        r += 50\n"
+        "    var s:map<int, string> = {1: \"x\"}\n"
+        "    if (s[2] + \"y\" == \"y\")\n"
+        "        r += 100\n"
+        "    return r + M[\"a\"] + M[\"b\"] + N\n"
+        "}\n");
+    const int expected = 21 + 30 + 50 + 100 + 1;
+    CompileOptions run;
+    run.run = true;
+    run.inputFiles.push_back(path);
+    EXPECT_EQ(Compiler(run).Run(), expected);
+
+    CompileOptions emit;
+    emit.emitExe = Path("main");
+    emit.inputFiles.push_back(path);
+    ASSERT_EQ(Compiler(emit).Run(), 0);
+    int status = system(Path("main").c_str());
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), expected);
+}
+
+} // namespace
+} // namespace zl
@@ -0,0 +1,201 @@
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "compiler/bytecode_compiler.h"
+#include "compiler/const_evaluator.h"
+#include "runtime/interpreter.h"
+
+namespace zl {
+namespace {
+
+class ConstEvaluatorTest : public ::testing::Test {
+protected:
+    ConstEvaluatorTest(): evaluator_(heap_) {}
+
+    void Declare(const std::string& path, const std::string& source) {
+        files_.emplace_back(new SourceFile());
+        auto& file = *files_.back();
+        file.path = path;
+        file.diagnostics = RunFrontEnd(source.data(), source.size(), &file.decls).diagnostics;
+        ASSERT_TRUE(file.diagnostics.empty()) << file.diagnostics[0].msg;
+        evaluator_.DeclareFile(file);
+    }
+
+    // Value of the constant as seen from the package, name is Name or
+    // pkg.Name
+    bool Lookup(const std::string& package, const std::string& name, Value& value, std::string& error) {
+        auto dot = name.find('.');
+        std::unique_ptr<ast::Expr> expr;
+        if (dot == std::string::npos)
+            expr.reset(new ast::Identifier(Location(1), name));
+        else
+            expr.reset(new ast::SelectorExpr(Location(1), new ast::Identifier(Location(1), name.substr(0, dot)),
+                new ast::Identifier(Location(1), name.substr(dot + 1))));
+        return evaluator_.Lookup(package, expr.get(), value, error);
+    }
+    Value Lookup(const std::string& package, const std::string& name) {
+        Value value;
+        std::string error;
+        EXPECT_TRUE(Lookup(package, name, value, error)) << name << ": " << error;
+        return value;
+    }
+
+    std::vector<std::string> Errors() const {
+        std::vector<std::string> errors;
+        for (auto& error : evaluator_.Errors())
+            errors.push_back(error.diagnostic.msg);
+        return errors;
+    }
+
+    Heap heap_;
+    std::vector<std::unique_ptr<SourceFile>> files_;
+    ConstEvaluator evaluator_;
+};
+
+TEST_F(ConstEvaluatorTest, EvaluatesOnFirstUse) {
+    Declare("main.zl", "const (\n"
+        "    B:int = A * 2 + 1\n"
+        "    A:int = 20\n"
+        "    S:string = \"n\" + B\n"
+        "    F:double = 1\n"
+        "    Z:string\n"
+        ")\n");
+    EXPECT_EQ(Lookup("main", "B").AsInt(), 41);
+    EXPECT_EQ(ValueToString(Lookup("main", "S")), "n41");
+    EXPECT_TRUE(Lookup("main", "F").IsDouble());
+    EXPECT_EQ(ValueToString(Lookup("main", "Z")), "");
+    evaluator_.EvaluateAll();
+    EXPECT_TRUE(Errors().empty());
+}
+
+// Each constant of a cycle fails, the cycle is reported once
+TEST_F(ConstEvaluatorTest, ReportsCycles) {
+    Declare("main.zl", "const (\n"
+        "    A:int = B + 1\n"
+        "    B:int = C + 1\n"
+        "    C:int = A + 1\n"
+        "    D:int = D\n"
+        "    E:int = 1\n"
+        ")\n");
+    evaluator_.EvaluateAll();
+    auto errors = Errors();
+    ASSERT_EQ(errors.size(), 2u);
+    EXPECT_EQ(errors[0], "constant cycle A -> B -> C -> A");
+    EXPECT_EQ(errors[1], "constant cycle D -> D");
+    Value value;
+    std::string error;
+    EXPECT_TRUE(Lookup("main", "B", value, error));
+    EXPECT_TRUE(value.IsNil());
+    EXPECT_EQ(Lookup("main", "E").AsInt(), 1);
+}
+
+TEST_F(ConstEvaluatorTest, FindsConstantsOfOtherPackages) {
+    Declare("geometry.zl", "package geometry\n"
+        "public const (\n"
+        "    Sides:int = 4\n"
+        "    Unit:int = 10\n"
+        ")\n"
+        "private const Secret:int = 7\n");
+    Declare("shapes.zl", "package shapes\n"
+        "public const (\n"
+        "    Unit:int = 100\n"
+        "    Perimeter:int = geometry.Sides * geometry.Unit\n"
+        "    Corners:int = Sides\n"
+        ")\n");
+    Declare("main.zl", "const Total:int = shapes.Perimeter + Unit\n");
+    // The qualified name and the exported name
+    EXPECT_EQ(Lookup("shapes", "Perimeter").AsInt(), 40);
+    EXPECT_EQ(Lookup("shapes", "Corners").AsInt(), 4);
+    EXPECT_EQ(Lookup("shapes", "Unit").AsInt(), 100);
+    EXPECT_EQ(Lookup("main", "geometry.Sides").AsInt(), 4);
+
+    Value value;
+    std::string error;
+    EXPECT_FALSE(Lookup("main", "geometry.Secret", value, error));
+    EXPECT_EQ(error, "Secret is not exported by geometry");
+    EXPECT_FALSE(Lookup("main", "Unit", value, error));
+    EXPECT_NE(error.find("ambiguous constant Unit"), std::string::npos) << error;
+    evaluator_.EvaluateAll();
+    auto errors = Errors();
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_NE(errors[0].find("ambiguous constant Unit"), std::string::npos) << errors[0];
+}
+
+// Arrays and maps of constants are permanent and read-only, the ones they
+// hold too
+TEST_F(ConstEvaluatorTest, AggregatesAreReadOnly) {
+    Declare("main.zl", "const (\n"
+        "    Rows:int[][] = [[1, 2], [3]]\n"
+        "    Names:map<int, string> = {1: \"one\", 2: \"two\"}\n"
+        "    Second:int = Rows[0][1]\n"
+        "    Two:string = Names[2]\n"
+        "    Missing:string = Names[3]\n"
+        ")\n");
+    Value rows = Lookup("main", "Rows");
+    ASSERT_TRUE(IsObjectOf(rows, ObjectKind::Array));
+    auto array = static_cast<ArrayObject*>(rows.AsObject());
+    EXPECT_TRUE(array->readOnly);
+    EXPECT_EQ(array->space, Space::Permanent);
+    ASSERT_EQ(array->elements.size(), 2u);
+    EXPECT_TRUE(static_cast<ArrayObject*>(array->elements[0].AsObject())->readOnly);
+    Value names = Lookup("main", "Names");
+    ASSERT_TRUE(IsObjectOf(names, ObjectKind::Map));
+    EXPECT_TRUE(static_cast<MapObject*>(names.AsObject())->readOnly);
+    EXPECT_EQ(Lookup("main", "Second").AsInt(), 2);
+    EXPECT_EQ(ValueToString(Lookup("main", "Two")), "two");
+    EXPECT_EQ(ValueToString(Lookup("main", "Missing")), "");
+    evaluator_.EvaluateAll();
+    EXPECT_TRUE(Errors().empty());
+}
+
+// An interpreted store into a constant aggregate fails
+TEST_F(ConstEvaluatorTest, StoresIntoConstantsFailAtRunTime) {
+    const char* sources[][2] = {
+        {"const A:int[] = [1, 2]\n"
+         "func main():int {\n"
+         "    var a:int[] = A\n"
+         "    a[0] = 3\n"
+         "    return 0\n"
+         "}\n", "main:4: store into constant array"},
+        {"const M:map<int, int> = {1: 2}\n"
+         "func main():int {\n"
+         "    var m:map<int, int> = M\n"
+         "    m[1] = 3\n"
+         "    return 0\n"
+         "}\n", "main:4: store into constant map"},
+    };
+    for (auto& source : sources) {
+        Program program;
+        std::vector<SourceFile> files(1);
+        files[0].path = "main.zl";
+        files[0].diagnostics = RunFrontEnd(source[0], strlen(source[0]), &files[0].decls).diagnostics;
+        ASSERT_TRUE(files[0].diagnostics.empty());
+        BytecodeCompiler compiler(program);
+        ASSERT_TRUE(compiler.Compile(files)) << compiler.Diagnostics()[0].diagnostic.msg;
+        Interpreter interpreter(program);
+        Value result;
+        EXPECT_FALSE(interpreter.RunMain(result));
+        EXPECT_EQ(interpreter.Error(), source[1]);
+    }
+}
+
+TEST_F(ConstEvaluatorTest, ReportsOperationsFailingAtRunTime) {
+    Declare("main.zl", "const (\n"
+        "    Zero:int = 0\n"
+        "    A:int = 1 / Zero\n"
+        "    B:int[] = [1]\n"
+        "    C:int = B[1]\n"
+        "    D:int = \"text\"\n"
+        ")\n");
+    evaluator_.EvaluateAll();
+    auto errors = Errors();
+    ASSERT_EQ(errors.size(), 3u);
+    EXPECT_EQ(errors[0].rfind("constant A: ", 0), 0u) << errors[0];
+    EXPECT_EQ(errors[1], "constant C: index 1 out of range");
+    EXPECT_EQ(errors[2], "constant D: constant of type int is given a value of type string");
+}
+
+} // namespace
+} // namespace zl
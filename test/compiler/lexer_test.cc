@@ -0,0 +1,69 @@
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "compiler/lexer.h"
+
+namespace zl {
+namespace {
+
+// Lex the whole source, the END_OF_FILE token is not included
+std::vector<Token> Lex(const std::string& source) {
+    Lexer lexer(source.data(), source.size());
+    std::vector<Token> tokens;
+    for (Token token = lexer.Next(); token.type_ != Token::END_OF_FILE; token = lexer.Next()) {
+        tokens.push_back(token);
+        if (tokens.size() > source.size() + 1)
+            break;
+    }
+    return tokens;
+}
+
+void ExpectLiteral(const std::string& source, int type, const std::string& text) {
+    std::vector<Token> tokens = Lex(source);
+    ASSERT_EQ(tokens.size(), 1u) << source;
+    EXPECT_EQ(tokens[0].type_, type) << source;
+    EXPECT_EQ(tokens[0].assic_, text) << source;
+}
+
+TEST(LexerTest, OneDigitIntegers) {
+    for (char digit = '0'; digit <= '9'; digit++)
+        ExpectLiteral(std::string(1, digit), Token::INT, std::string(1, digit));
+}
+
+TEST(LexerTest, Integers) {
+    ExpectLiteral("42", Token::INT, "42");
+    ExpectLiteral("2147483647", Token::INT, "2147483647");
+    ExpectLiteral("0x1F", Token::INT, "0x1F");
+    ExpectLiteral("0X0", Token::INT, "0X0");
+}
+
+TEST(LexerTest, LeadingZeros) {
+    ExpectLiteral("00", Token::INT, "00");
+    ExpectLiteral("007", Token::INT, "007");
+    ExpectLiteral("0.5", Token::FLOAT, "0.5");
+}
+
+TEST(LexerTest, Floats) {
+    ExpectLiteral("3.25", Token::FLOAT, "3.25");
+    ExpectLiteral("1e9", Token::FLOAT, "1e9");
+    ExpectLiteral("2.5e-3", Token::FLOAT, "2.5e-3");
+}
+
+TEST(LexerTest, LiteralsFollowedByOperators) {
+    std::vector<Token> tokens = Lex("x=1+0;");
+    ASSERT_EQ(tokens.size(), 6u);
+    EXPECT_EQ(tokens[2].assic_, "1");
+    EXPECT_EQ(tokens[3].type_, Token::ADD);
+    EXPECT_EQ(tokens[4].assic_, "0");
+}
+
+TEST(LexerTest, Range) {
+    std::vector<Token> tokens = Lex("1...3");
+    ASSERT_EQ(tokens.size(), 3u);
+    EXPECT_EQ(tokens[0].type_, Token::INT);
+    EXPECT_EQ(tokens[0].assic_, "1");
+    EXPECT_EQ(tokens[2].assic_, "3");
+}
+
+} // namespace
+} // namespace zl
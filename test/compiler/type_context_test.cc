@@ -0,0 +1,57 @@
+#include <string.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "compiler/frontend.h"
+#include "compiler/type_context.h"
+
+namespace zl {
+namespace {
+
+TEST(TypeContextTest, StructuralIdentity) {
+    TypeContext types;
+    TypeId integer = types.Primitive("int");
+    EXPECT_EQ(types.Primitive("int"), integer);
+    EXPECT_NE(types.Primitive("long"), integer);
+    EXPECT_EQ(types.Array(integer), types.Array(types.Primitive("int")));
+    EXPECT_NE(types.Array(integer), types.Array(types.Primitive("long")));
+    TypeId map = types.Map(types.Primitive("string"), types.Array(integer));
+    EXPECT_EQ(types.Map(types.Primitive("string"), types.Array(integer)), map);
+    EXPECT_EQ(types.ToString(map), "map<string, int[]>");
+    EXPECT_EQ(types.Named("Shape", nullptr), types.Named("Shape", nullptr));
+}
+
+TEST(TypeContextTest, Tuples) {
+    TypeContext types;
+    TypeId integer = types.Primitive("int");
+    TypeId text = types.Primitive("string");
+    TypeId pair = types.Tuple({integer, text});
+    EXPECT_EQ(types.Tuple({integer, text}), pair);
+    EXPECT_NE(types.Tuple({text, integer}), pair);
+    EXPECT_NE(types.Tuple({integer, text, integer}), pair);
+    // The rest of a tuple is not one of its elements
+    EXPECT_NE(types.Tuple({integer}), integer);
+    EXPECT_EQ(types.ToString(pair), "(int, string)");
+    EXPECT_EQ(types.ToString(types.Tuple({})), "()");
+}
+
+TEST(TypeContextTest, InternSyntaxTypes) {
+    const char* source =
+        "var a:map<string, int[]> = {}\n"
+        "var b:map<string, int[]> = {}\n"
+        "var c:map<string, long[]> = {}\n";
+    std::vector<ast::Node*> decls;
+    ASSERT_TRUE(RunFrontEnd(source, strlen(source), &decls).diagnostics.empty());
+    ASSERT_EQ(decls.size(), 3u);
+    TypeContext types;
+    types.InternAll(decls);
+    auto typeOf = [&](size_t i) { return static_cast<ast::VariableDecl*>(decls[i])->type_->typeId_; };
+    EXPECT_NE(typeOf(0), kNoTypeId);
+    EXPECT_EQ(typeOf(0), typeOf(1));
+    EXPECT_NE(typeOf(0), typeOf(2));
+    for (auto decl : decls)
+        delete decl;
+}
+
+} // namespace
+} // namespace zl
@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <set>
+#include <gtest/gtest.h>
+#include "compiler/xml_arena.h"
+
+namespace zl {
+namespace {
+
+TEST(XmlArenaTest, BlocksAreReusedAfterReset) {
+    XmlArena arena(4096);
+    std::set<void*> first;
+    for (int i = 0; i < 1000; i++) {
+        void* data = arena.Allocate(40);
+        ASSERT_NE(data, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(data) % alignof(std::max_align_t), 0u);
+        first.insert(data);
+    }
+    EXPECT_EQ(first.size(), 1000u);
+    size_t reserved = arena.Reserved();
+    arena.Reset();
+    for (int i = 0; i < 1000; i++)
+        EXPECT_TRUE(first.count(arena.Allocate(40)));
+    EXPECT_EQ(arena.Reserved(), reserved);
+}
+
+TEST(XmlArenaTest, FailedBlocksLeaveTheArenaUsable) {
+    // No block of this size can be allocated
+    XmlArena arena(SIZE_MAX / 4);
+    EXPECT_EQ(arena.Allocate(16), nullptr);
+    EXPECT_EQ(arena.Allocate(16), nullptr);
+    arena.Reset();
+    EXPECT_EQ(arena.Allocate(16), nullptr);
+}
+
+} // namespace
+} // namespace zl
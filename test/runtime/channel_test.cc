@@ -0,0 +1,186 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "runtime/channel.h"
+
+namespace zl {
+namespace {
+
+SchedulerOptions Workers(size_t workers) {
+    SchedulerOptions options;
+    options.workers = workers;
+    return options;
+}
+
+// Wait until the coroutines started, and a little more so that they park
+void WaitStarted(const std::atomic<int>& started, int count) {
+    while (started.load() < count)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
+
+TEST(ChannelTest, SendAndReceive) {
+    for (size_t capacity : {0, 1, 16}) {
+        Scheduler scheduler(Workers(2));
+        Channel<long> channel(capacity);
+        long sum = 0;
+        scheduler.Spawn([&] {
+            for (long i = 1; i <= 1000; i++)
+                channel.Send(i);
+            channel.Close();
+        });
+        scheduler.Spawn([&] {
+            long value;
+            while (channel.Receive(value))
+                sum += value;
+        });
+        scheduler.Wait();
+        EXPECT_EQ(sum, 1000 * 1001 / 2) << capacity;
+    }
+}
+
+// Receivers parked on an empty channel are woken by Close and fail
+TEST(ChannelTest, CloseWakesParkedReceivers) {
+    for (size_t capacity : {0, 4}) {
+        Scheduler scheduler(Workers(2));
+        Channel<std::string> channel(capacity);
+        std::atomic<int> started(0);
+        std::atomic<int> failed(0);
+        for (int k = 0; k < 4; k++) {
+            scheduler.Spawn([&] {
+                std::string value = "unset";
+                started++;
+                if (!channel.Receive(value) && value.empty())
+                    failed++;
+            });
+        }
+        WaitStarted(started, 4);
+        channel.Close();
+        scheduler.Wait();
+        EXPECT_EQ(failed.load(), 4) << capacity;
+    }
+}
+
+// Senders parked on a full or unbuffered channel are woken by Close and
+// throw, the values buffered before are still received
+TEST(ChannelTest, CloseWakesParkedSenders) {
+    for (size_t capacity : {0, 1}) {
+        Scheduler scheduler(Workers(2));
+        Channel<int> channel(capacity);
+        if (capacity)
+            ASSERT_EQ(channel.TrySend(7), ChannelStatus::Ok);
+        std::atomic<int> started(0);
+        std::atomic<int> failed(0);
+        for (int k = 0; k < 4; k++) {
+            scheduler.Spawn([&, k] {
+                started++;
+                try {
+                    channel.Send(k);
+                } catch (RuntimeError&) {
+                    failed++;
+                }
+            });
+        }
+        WaitStarted(started, 4);
+        channel.Close();
+        scheduler.Wait();
+        EXPECT_EQ(failed.load(), 4) << capacity;
+        int value = -1;
+        if (capacity) {
+            EXPECT_TRUE(channel.Receive(value));
+            EXPECT_EQ(value, 7);
+        }
+        EXPECT_FALSE(channel.Receive(value));
+        EXPECT_EQ(value, 0);
+    }
+}
+
+TEST(ChannelTest, DrainAfterClose) {
+    Channel<int> channel(4);
+    for (int i = 1; i <= 3; i++)
+        channel.Send(i);
+    channel.Close();
+    EXPECT_TRUE(channel.IsClosed());
+    EXPECT_THROW(channel.Send(4), RuntimeError);
+    EXPECT_EQ(channel.TrySend(4), ChannelStatus::Closed);
+    EXPECT_THROW(channel.Close(), RuntimeError);
+    int value = 0;
+    for (int i = 1; i <= 3; i++) {
+        EXPECT_TRUE(channel.Receive(value));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_FALSE(channel.Receive(value));
+    EXPECT_EQ(channel.TryReceive(value), ChannelStatus::Closed);
+}
+
+// A select which does not block returns -1 when no case is ready, like a
+// select with a default case
+TEST(ChannelTest, SelectWithDefault) {
+    Channel<int> a(1);
+    Channel<int> b(1);
+    int fromA = 0;
+    int fromB = 0;
+    ChannelBase::Case receives[] = {{&a, false, &fromA}, {&b, false, &fromB}};
+    EXPECT_EQ(ChannelBase::Select(receives, 2, false), -1);
+
+    ASSERT_EQ(b.TrySend(5), ChannelStatus::Ok);
+    EXPECT_EQ(ChannelBase::Select(receives, 2, false), 1);
+    EXPECT_TRUE(receives[1].ok);
+    EXPECT_EQ(fromB, 5);
+
+    // A send case on a full channel is not ready
+    ASSERT_EQ(a.TrySend(1), ChannelStatus::Ok);
+    int value = 2;
+    ChannelBase::Case send[] = {{&a, true, &value}};
+    EXPECT_EQ(ChannelBase::Select(send, 1, false), -1);
+
+    // A receive on a closed and drained channel is ready and fails
+    b.Close();
+    EXPECT_EQ(ChannelBase::Select(&receives[1], 1, false), 0);
+    EXPECT_FALSE(receives[1].ok);
+}
+
+// Select takes each of the cases ready at random
+TEST(ChannelTest, SelectIsFair) {
+    const int kCount = 1000;
+    Channel<int> a(kCount);
+    Channel<int> b(kCount);
+    for (int i = 0; i < kCount; i++) {
+        ASSERT_EQ(a.TrySend(i), ChannelStatus::Ok);
+        ASSERT_EQ(b.TrySend(i), ChannelStatus::Ok);
+    }
+    int values[2];
+    ChannelBase::Case cases[] = {{&a, false, &values[0]}, {&b, false, &values[1]}};
+    int taken[2] = {0, 0};
+    for (int i = 0; i < kCount; i++)
+        taken[ChannelBase::Select(cases, 2, false)]++;
+    EXPECT_GT(taken[0], kCount / 3);
+    EXPECT_GT(taken[1], kCount / 3);
+}
+
+// A select blocked on several channels is woken by the first which gets a
+// value
+TEST(ChannelTest, SelectBlocksUntilACaseIsReady) {
+    Scheduler scheduler(Workers(2));
+    Channel<int> a;
+    Channel<int> b;
+    std::atomic<int> started(0);
+    int index = -1;
+    int values[2] = {0, 0};
+    scheduler.Spawn([&] {
+        ChannelBase::Case cases[] = {{&a, false, &values[0]}, {&b, false, &values[1]}};
+        started++;
+        index = ChannelBase::Select(cases, 2, true);
+    });
+    WaitStarted(started, 1);
+    scheduler.Spawn([&] { b.Send(9); });
+    scheduler.Wait();
+    EXPECT_EQ(index, 1);
+    EXPECT_EQ(values[1], 9);
+}
+
+} // namespace
+} // namespace zl
@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <gtest/gtest.h>
+#include "runtime/flat_map.h"
+
+namespace zl {
+namespace {
+
+// All keys have the last slot as home and the same control byte, they wrap
+// around the end of the table and are compared at every probe
+struct CollidingTraits {
+    static const bool kInlineKey = false;
+    static uint64_t Hash(int32_t) { return 0xffffffff00000005ull; }
+    static bool Equal(int32_t a, int32_t b) { return a == b; }
+};
+
+// Apply random inserts and erases to the map and to an unordered_map, they
+// must agree at each step
+template <typename K, typename Traits, typename MakeKey>
+void CompareWithUnorderedMap(MakeKey makeKey, int keys, int steps) {
+    FlatMap<K, int, Traits> map;
+    std::unordered_map<K, int> expected;
+    std::mt19937 random(42);
+    for (int step = 0; step < steps; step++) {
+        K key = makeKey(static_cast<int>(random() % keys));
+        if (random() % 3 == 0) {
+            EXPECT_EQ(map.Erase(key), expected.erase(key) == 1);
+        } else {
+            EXPECT_EQ(map.Insert(key, step), expected.count(key) == 0);
+            expected[key] = step;
+        }
+        ASSERT_EQ(map.Size(), expected.size());
+    }
+    for (int n = 0; n < keys; n++) {
+        K key = makeKey(n);
+        auto iter = expected.find(key);
+        const int* value = map.Find(key);
+        if (iter == expected.end()) {
+            EXPECT_EQ(value, nullptr);
+        } else {
+            ASSERT_NE(value, nullptr);
+            EXPECT_EQ(*value, iter->second);
+        }
+    }
+    for (auto& entry : map.Entries())
+        EXPECT_EQ(expected.at(entry.first), entry.second);
+}
+
+TEST(FlatMapTest, InsertFindErase) {
+    CompareWithUnorderedMap<int32_t, FlatMapTraits<int32_t>>([](int n) { return n; }, 1000, 20000);
+    CompareWithUnorderedMap<int64_t, FlatMapTraits<int64_t>>(
+        [](int n) { return static_cast<int64_t>(n) << 40; }, 1000, 20000);
+    CompareWithUnorderedMap<std::string, FlatMapTraits<std::string>>(
+        [](int n) { return "key" + std::to_string(n); }, 1000, 20000);
+}
+
+// Erasing moves the slots after the erased one back, across the end of the
+// table too
+TEST(FlatMapTest, EraseCollidingKeys) {
+    CompareWithUnorderedMap<int32_t, CollidingTraits>([](int n) { return n; }, 40, 2000);
+}
+
+// The map grows past each power of two, keys inserted before stay found
+TEST(FlatMapTest, Grows) {
+    FlatMap<int32_t, int32_t> map;
+    for (int32_t key = 0; key < 100000; key++) {
+        ASSERT_TRUE(map.Insert(key, -key));
+        if ((key & (key + 1)) == 0) {
+            for (int32_t found = 0; found <= key; found++)
+                ASSERT_EQ(*map.Find(found), -found) << key;
+        }
+    }
+    EXPECT_EQ(map.Size(), 100000u);
+    EXPECT_EQ(map.Find(100000), nullptr);
+}
+
+TEST(FlatMapTest, EntriesKeepInsertionOrder) {
+    FlatMap<std::string, int> map;
+    map.Reserve(100);
+    for (int n = 0; n < 5; n++)
+        map[std::to_string(n)] = n;
+    map["2"] += 10;
+    ASSERT_EQ(map.Entries().size(), 5u);
+    for (int n = 0; n < 5; n++)
+        EXPECT_EQ(map.Entries()[n].first, std::to_string(n));
+    EXPECT_EQ(map.Entries()[2].second, 12);
+    // The last entry takes the place of the erased one
+    EXPECT_TRUE(map.Erase("1"));
+    EXPECT_FALSE(map.Erase("1"));
+    ASSERT_EQ(map.Entries().size(), 4u);
+    EXPECT_EQ(map.Entries()[1].first, "4");
+    EXPECT_EQ(*map.Find("4"), 4);
+    map.Clear();
+    EXPECT_EQ(map.Size(), 0u);
+    EXPECT_EQ(map.Find("4"), nullptr);
+    EXPECT_TRUE(map.Insert("4", 5));
+}
+
+} // namespace
+} // namespace zl
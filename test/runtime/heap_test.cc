@@ -0,0 +1,171 @@
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "runtime/heap.h"
+
+namespace zl {
+namespace {
+
+// Roots is a list of values the collector updates
+class Roots : public GcRoots {
+public:
+    void CollectRoots(std::vector<Value*>& roots) override {
+        for (auto& value : values)
+            roots.push_back(&value);
+    }
+    std::vector<Value> values;
+};
+
+GcOptions SmallHeap() {
+    GcOptions options;
+    options.nurserySize = 64 << 10;
+    options.majorThreshold = 1 << 20;
+    return options;
+}
+
+std::string Text(Value value) {
+    return static_cast<StringObject*>(value.AsObject())->ToString();
+}
+
+ArrayObject* AsArray(Value value) {
+    return static_cast<ArrayObject*>(value.AsObject());
+}
+
+// An array of count strings, each longer than the inline ones
+Value NewStrings(Heap& heap, Roots& roots, int count) {
+    roots.values.push_back(Value::FromObject(heap.NewArray()));
+    for (int i = 0; i < count; i++) {
+        Value string = Value::FromObject(heap.NewString("string number " + std::to_string(i) + " of the array"));
+        ArrayObject* array = AsArray(roots.values.back());
+        array->elements.push_back(string);
+        heap.WriteBarrier(array, string);
+    }
+    Value array = roots.values.back();
+    roots.values.pop_back();
+    return array;
+}
+
+void ExpectStrings(Value array, int count) {
+    ASSERT_EQ(AsArray(array)->elements.size(), static_cast<size_t>(count));
+    for (int i = 0; i < count; i++)
+        EXPECT_EQ(Text(AsArray(array)->elements[i]), "string number " + std::to_string(i) + " of the array");
+}
+
+TEST(HeapTest, MinorCollectionPromotesReachableObjects) {
+    Heap heap(SmallHeap());
+    Roots roots;
+    heap.Attach(&roots);
+    roots.values.push_back(NewStrings(heap, roots, 10));
+    heap.NewString("garbage which is longer than an inline string");
+    EXPECT_TRUE(heap.IsYoung(roots.values[0]));
+    heap.Collect(false);
+    EXPECT_FALSE(heap.IsYoung(roots.values[0]));
+    ExpectStrings(roots.values[0], 10);
+    EXPECT_EQ(heap.Stats().minorCollections, 1u);
+    EXPECT_EQ(heap.Stats().majorCollections, 0u);
+    EXPECT_GT(heap.Stats().bytesPromoted, 0u);
+    heap.Detach(&roots);
+}
+
+// Filling the nursery collects it, objects referenced by the promoted ones
+// are promoted too
+TEST(HeapTest, FullNurseryIsCollected) {
+    Heap heap(SmallHeap());
+    Roots roots;
+    heap.Attach(&roots);
+    roots.values.push_back(NewStrings(heap, roots, 5000));
+    EXPECT_GT(heap.Stats().minorCollections, 0u);
+    ExpectStrings(roots.values[0], 5000);
+    heap.Detach(&roots);
+}
+
+// An old object given a young value keeps it alive through the dirty card
+// of its line, with no root referencing the young value
+TEST(HeapTest, WriteBarrierKeepsYoungValuesOfOldObjects) {
+    Heap heap(SmallHeap());
+    Roots roots;
+    heap.Attach(&roots);
+    roots.values.push_back(Value::FromObject(heap.NewArray()));
+    roots.values.push_back(Value::FromObject(heap.NewMap()));
+    heap.Collect(false);
+    ASSERT_FALSE(heap.IsYoung(roots.values[0]));
+    ASSERT_FALSE(heap.IsYoung(roots.values[1]));
+
+    for (int round = 0; round < 3; round++) {
+        Value string = Value::FromObject(heap.NewString("young string of the round " + std::to_string(round)));
+        auto array = AsArray(roots.values[0]);
+        array->elements.push_back(string);
+        heap.WriteBarrier(array, string);
+        Value key = Value::FromObject(heap.NewString("young key of the round " + std::to_string(round)));
+        auto map = static_cast<MapObject*>(roots.values[1].AsObject());
+        map->Set(key, Value::Int(round));
+        heap.WriteBarrier(map, key);
+        heap.Collect(false);
+        EXPECT_FALSE(heap.IsYoung(array->elements.back()));
+    }
+    auto array = AsArray(roots.values[0]);
+    auto map = static_cast<MapObject*>(roots.values[1].AsObject());
+    ASSERT_EQ(array->elements.size(), 3u);
+    ASSERT_EQ(map->Entries().size(), 3u);
+    for (int round = 0; round < 3; round++) {
+        EXPECT_EQ(Text(array->elements[round]), "young string of the round " + std::to_string(round));
+        EXPECT_EQ(Text(map->Entries()[round].first), "young key of the round " + std::to_string(round));
+        Value key = Value::FromObject(heap.NewString("young key of the round " + std::to_string(round)));
+        EXPECT_EQ(map->Get(key).AsInt(), round);
+    }
+    heap.Detach(&roots);
+}
+
+// A major collection frees the old objects no longer reachable and keeps
+// the others, whose lines are not reused
+TEST(HeapTest, MajorCollectionFreesUnreachableOldObjects) {
+    Heap heap(SmallHeap());
+    Roots roots;
+    heap.Attach(&roots);
+    for (int i = 0; i < 4; i++)
+        roots.values.push_back(NewStrings(heap, roots, 1000));
+    heap.Collect(false);
+    uint64_t old = heap.Stats().oldBytes;
+    // Drop every other array
+    roots.values.erase(roots.values.begin() + 2);
+    roots.values.erase(roots.values.begin());
+    heap.Collect(true);
+    EXPECT_EQ(heap.Stats().majorCollections, 1u);
+    EXPECT_GT(heap.Stats().bytesFreed, 0u);
+    EXPECT_LT(heap.Stats().oldBytes, old);
+    for (auto& array : roots.values)
+        ExpectStrings(array, 1000);
+
+    // New objects are promoted into the freed lines around the live ones
+    roots.values.push_back(NewStrings(heap, roots, 1000));
+    heap.Collect(true);
+    for (auto& array : roots.values)
+        ExpectStrings(array, 1000);
+    heap.Detach(&roots);
+}
+
+// The old generation is collected once it grew by the threshold
+TEST(HeapTest, MajorCollectionsAreTriggeredByGrowth) {
+    GcOptions options = SmallHeap();
+    options.majorThreshold = 128 << 10;
+    options.markThreads = 4;
+    Heap heap(options);
+    Roots roots;
+    heap.Attach(&roots);
+    roots.values.push_back(NewStrings(heap, roots, 100));
+    for (int i = 0; i < 200; i++) {
+        roots.values.push_back(NewStrings(heap, roots, 200));
+        // Keep a few of the arrays
+        if (i % 10 != 0)
+            roots.values.pop_back();
+    }
+    EXPECT_GT(heap.Stats().majorCollections, 0u);
+    EXPECT_GT(heap.Stats().bytesFreed, 0u);
+    ExpectStrings(roots.values[0], 100);
+    for (size_t i = 1; i < roots.values.size(); i++)
+        ExpectStrings(roots.values[i], 200);
+    heap.Detach(&roots);
+}
+
+} // namespace
+} // namespace zl
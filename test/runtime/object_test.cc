@@ -0,0 +1,26 @@
+#include <math.h>
+#include <gtest/gtest.h>
+#include "runtime/object.h"
+
+namespace zl {
+namespace {
+
+TEST(ObjectTest, IntegralDoublesHashAsInts) {
+    EXPECT_EQ(HashValue(Value::Double(2.0)), HashValue(Value::Int(2)));
+    EXPECT_EQ(HashValue(Value::Double(-7.0)), HashValue(Value::Int(-7)));
+    EXPECT_EQ(HashValue(Value::Double(2147483647.0)), HashValue(Value::Int(2147483647)));
+    EXPECT_TRUE(ValuesEqual(Value::Double(2.0), Value::Int(2)));
+}
+
+// Doubles the int32 cast is not defined for hash as doubles
+TEST(ObjectTest, HashOfDoublesOutOfIntRange) {
+    const double numbers[] = {NAN, INFINITY, -INFINITY, 1e300, -1e300, 2147483648.0, -2147483649.0, 0.5};
+    for (double number : numbers) {
+        Value value = Value::Double(number);
+        EXPECT_EQ(HashValue(value), HashValue(Value::Double(number))) << number;
+    }
+    EXPECT_NE(HashValue(Value::Double(4294967296.0)), HashValue(Value::Int(0)));
+}
+
+} // namespace
+} // namespace zl
@@ -0,0 +1,128 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <gtest/gtest.h>
+#include "runtime/scheduler.h"
+
+namespace zl {
+namespace {
+
+SchedulerOptions Workers(size_t workers) {
+    SchedulerOptions options;
+    options.workers = workers;
+    return options;
+}
+
+TEST(SchedulerTest, RunsSpawnedCoroutines) {
+    Scheduler scheduler(Workers(2));
+    std::atomic<int> ran(0);
+    for (int i = 0; i < 100; i++) {
+        scheduler.Spawn([&] {
+            for (int j = 0; j < 10; j++)
+                scheduler.Spawn([&] { ran++; });
+            Scheduler::Yield();
+            ran++;
+        });
+    }
+    scheduler.Wait();
+    EXPECT_EQ(ran.load(), 1100);
+    EXPECT_EQ(scheduler.Stats().spawned, 1100u);
+}
+
+TEST(SchedulerTest, WaitThrowsEscapingExceptions) {
+    Scheduler scheduler(Workers(1));
+    scheduler.Spawn([] { throw std::runtime_error("escaped"); });
+    EXPECT_THROW(scheduler.Wait(), std::runtime_error);
+}
+
+// A chain of coroutines each spawning the next one runs newest first on one
+// worker, the coroutine which ends it must still run before the chain is
+// long
+TEST(SchedulerTest, GlobalQueueIsNotStarved) {
+    Scheduler scheduler(Workers(1));
+    std::atomic<bool> done(false);
+    int links = 0;
+    std::function<void()> chain = [&] {
+        if (!done && ++links < 100000)
+            scheduler.Spawn(chain);
+    };
+    scheduler.Spawn(chain);
+    scheduler.Spawn([&] { done = true; });
+    scheduler.Wait();
+    EXPECT_TRUE(done);
+    EXPECT_LT(links, 1000);
+    EXPECT_GT(scheduler.Stats().fairTakes, 0u);
+}
+
+// The same with the coroutine which ends the chain at the top of the deque
+// of the worker, behind the newer links
+TEST(SchedulerTest, OldestOfTheDequeIsNotStarved) {
+    Scheduler scheduler(Workers(1));
+    std::atomic<bool> done(false);
+    int links = 0;
+    std::function<void()> chain = [&] {
+        if (!done && ++links < 100000)
+            scheduler.Spawn(chain);
+    };
+    scheduler.Spawn([&] {
+        scheduler.Spawn([&] { done = true; });
+        scheduler.Spawn(chain);
+    });
+    scheduler.Wait();
+    EXPECT_TRUE(done);
+    EXPECT_LT(links, 1000);
+    EXPECT_GT(scheduler.Stats().fairTakes, 0u);
+}
+
+// Coroutines spawned by one coroutine go to the deque of its worker, the
+// idle workers steal them
+TEST(SchedulerTest, IdleWorkersSteal) {
+    Scheduler scheduler(Workers(4));
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::atomic<int> ran(0);
+    scheduler.Spawn([&] {
+        for (int i = 0; i < 64; i++) {
+            scheduler.Spawn([&] {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    threads.insert(std::this_thread::get_id());
+                }
+                // Hold the worker so that the others find the rest
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                ran++;
+            });
+        }
+    });
+    scheduler.Wait();
+    EXPECT_EQ(ran.load(), 64);
+    EXPECT_GT(threads.size(), 1u);
+    EXPECT_GT(scheduler.Stats().steals, 0u);
+}
+
+// Park returns once Unpark was called, before or after it
+TEST(SchedulerTest, ParkAndUnpark) {
+    Scheduler scheduler(Workers(2));
+    std::atomic<Coroutine*> parked(nullptr);
+    std::atomic<bool> woken(false);
+    std::atomic<bool> go(false);
+    scheduler.Spawn([&] {
+        parked = Scheduler::Current();
+        while (!go)
+            Scheduler::Park();
+        woken = true;
+    });
+    while (!parked)
+        std::this_thread::yield();
+    go = true;
+    Scheduler::Unpark(parked);
+    scheduler.Wait();
+    EXPECT_TRUE(woken);
+}
+
+} // namespace
+} // namespace zl
@@ -0,0 +1,84 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "runtime/work_deque.h"
+
+namespace zl {
+namespace {
+
+TEST(WorkDequeTest, OwnerPopsNewestThievesStealOldest) {
+    WorkDeque<int> deque(4);
+    int items[3] = {0, 1, 2};
+    for (auto& item : items)
+        deque.Push(&item);
+    EXPECT_EQ(deque.Size(), 3u);
+    EXPECT_EQ(deque.Steal(), &items[0]);
+    EXPECT_EQ(deque.Pop(), &items[2]);
+    EXPECT_EQ(deque.Pop(), &items[1]);
+    EXPECT_EQ(deque.Pop(), nullptr);
+    EXPECT_EQ(deque.Steal(), nullptr);
+    EXPECT_TRUE(deque.Empty());
+}
+
+// Pushing on a full deque grows it, the items keep their order
+TEST(WorkDequeTest, Grows) {
+    WorkDeque<int> deque(2);
+    std::vector<int> items(100);
+    for (int i = 0; i < 10; i++)
+        deque.Push(&items[i]);
+    // The top moved, the grown array is indexed from it
+    for (int i = 0; i < 5; i++)
+        EXPECT_EQ(deque.Steal(), &items[i]);
+    for (int i = 10; i < 100; i++)
+        deque.Push(&items[i]);
+    EXPECT_EQ(deque.Size(), 95u);
+    for (int i = 5; i < 50; i++)
+        EXPECT_EQ(deque.Steal(), &items[i]);
+    for (int i = 99; i >= 50; i--)
+        EXPECT_EQ(deque.Pop(), &items[i]);
+    EXPECT_TRUE(deque.Empty());
+}
+
+// The owner pushes and pops while thieves steal, every item is taken once
+TEST(WorkDequeTest, ItemsAreTakenOnce) {
+    const int kItems = 100000;
+    const int kThieves = 3;
+    WorkDeque<int> deque(16);
+    std::vector<int> items(kItems);
+    std::vector<std::atomic<int>> taken(kItems);
+    std::atomic<bool> pushed(false);
+    auto take = [&](int* item) {
+        taken[item - items.data()]++;
+    };
+    std::vector<std::thread> thieves;
+    for (int k = 0; k < kThieves; k++) {
+        thieves.emplace_back([&] {
+            while (true) {
+                bool last = pushed.load();
+                while (int* item = deque.Steal())
+                    take(item);
+                if (last)
+                    return;
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (int i = 0; i < kItems; i++) {
+        deque.Push(&items[i]);
+        if (i % 3 == 0) {
+            if (int* item = deque.Pop())
+                take(item);
+        }
+    }
+    while (int* item = deque.Pop())
+        take(item);
+    pushed = true;
+    for (auto& thief : thieves)
+        thief.join();
+    for (int i = 0; i < kItems; i++)
+        ASSERT_EQ(taken[i].load(), 1) << i;
+}
+
+} // namespace
+} // namespace zl